@@ -0,0 +1,227 @@
+// bench_aead.cpp -- Benchmark sodium::aead<> with every F policy
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "aead.h"
+#include "aead_auto.h"
+#include "bench_common.h"
+
+using sodium::bytes;
+
+// the allocating API: returns a fresh BT each time
+template<typename F>
+static void
+BM_aead_encrypt(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::aead<bytes, F> aead;
+    typename sodium::aead<bytes, F>::nonce_type nonce;
+    bytes header(32);
+    bytes plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(aead.encrypt(header, plaintext, nonce));
+    meter.report(state, size);
+}
+
+// the allocation-free span API
+template<typename F>
+static void
+BM_aead_encrypt_span(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::aead<bytes, F> aead;
+    typename sodium::aead<bytes, F>::nonce_type nonce;
+    bytes header(32);
+    bytes plaintext(size);
+    bytes ciphertext(sodium::aead<bytes, F>::MACSIZE + size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+          aead.encrypt(ciphertext, header, plaintext, nonce));
+        benchmark::ClobberMemory();
+    }
+    meter.report(state, size);
+}
+
+template<typename F>
+static void
+BM_aead_decrypt(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::aead<bytes, F> aead;
+    typename sodium::aead<bytes, F>::nonce_type nonce;
+    bytes header(32);
+    bytes ciphertext = aead.encrypt(header, bytes(size), nonce);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(aead.decrypt(header, ciphertext, nonce));
+    meter.report(state, size);
+}
+
+// baseline: the raw libsodium call behind F
+template<typename F>
+static void
+BM_raw_aead_encrypt(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    typename sodium::aead<bytes, F>::key_type key;
+    typename sodium::aead<bytes, F>::nonce_type nonce;
+    bytes header(32);
+    bytes plaintext(size);
+    bytes ciphertext(sodium::aead<bytes, F>::MACSIZE + size);
+    unsigned long long clen;
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        F::encrypt(ciphertext.data(),
+                   &clen,
+                   plaintext.data(),
+                   plaintext.size(),
+                   header.data(),
+                   header.size(),
+                   NULL,
+                   nonce.data(),
+                   key.data());
+        benchmark::ClobberMemory();
+    }
+    meter.report(state, size);
+}
+
+#define SODIUM_AEAD_BENCHMARKS(F)                                              \
+    BENCHMARK_TEMPLATE(BM_aead_encrypt, F)->Apply(bench::message_sizes);       \
+    BENCHMARK_TEMPLATE(BM_aead_encrypt_span, F)->Apply(bench::message_sizes);  \
+    BENCHMARK_TEMPLATE(BM_aead_decrypt, F)->Apply(bench::message_sizes)
+
+SODIUM_AEAD_BENCHMARKS(sodium::aead_chacha20_poly1305);
+SODIUM_AEAD_BENCHMARKS(sodium::aead_chacha20_poly1305_ietf);
+SODIUM_AEAD_BENCHMARKS(sodium::aead_xchacha20_poly1305_ietf);
+
+BENCHMARK_TEMPLATE(BM_raw_aead_encrypt, sodium::aead_chacha20_poly1305)
+  ->Apply(bench::message_sizes);
+BENCHMARK_TEMPLATE(BM_raw_aead_encrypt, sodium::aead_chacha20_poly1305_ietf)
+  ->Apply(bench::message_sizes);
+BENCHMARK_TEMPLATE(BM_raw_aead_encrypt, sodium::aead_xchacha20_poly1305_ietf)
+  ->Apply(bench::message_sizes);
+
+// the runtime-dispatched facade, labelled with the construction it chose
+static void
+BM_aead_auto_encrypt_span(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::aead_auto<> aead{ sodium::aead_auto<>::key_type() };
+    sodium::aead_auto<>::nonce_type nonce;
+    bytes header(32);
+    bytes plaintext(size);
+    bytes ciphertext(sodium::aead_auto<>::TAGSIZE +
+                     sodium::aead_auto<>::MACSIZE + size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+          aead.encrypt(ciphertext, header, plaintext, nonce));
+        benchmark::ClobberMemory();
+    }
+    meter.report(state, size);
+    state.SetLabel(sodium::aead_auto<>::name(aead.chosen()));
+}
+BENCHMARK(BM_aead_auto_encrypt_span)->Apply(bench::message_sizes);
+
+// many threads encrypting with one shared, read-only AES-GCM context
+static void
+BM_aead_aesgcm_shared_context(benchmark::State& state)
+{
+    using aead_type = sodium::aead<bytes, sodium::aead_aesgcm_precomputed>;
+    static const aead_type::context_type context =
+      aead_type::make_context(aead_type::key_type());
+
+    const auto size = static_cast<std::size_t>(state.range(0));
+    const aead_type aead(context);
+    aead_type::nonce_type nonce;
+    bytes header(32);
+    bytes plaintext(size);
+    bytes ciphertext(aead_type::MACSIZE + size);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+          aead.encrypt(ciphertext, header, plaintext, nonce));
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            static_cast<int64_t>(size));
+}
+
+// AES256-GCM is only available on CPUs with AES-NI and pclmul: those
+// benchmarks are registered at runtime in main() below.
+
+int
+main(int argc, char** argv)
+{
+    if (sodium_init() == -1)
+        return EXIT_FAILURE;
+
+    if (sodium::aead_traits<sodium::aead_aesgcm>::available()) {
+        using sodium::aead_aesgcm;
+        using sodium::aead_aesgcm_precomputed;
+
+        benchmark::RegisterBenchmark("BM_aead_encrypt<sodium::aead_aesgcm>",
+                                     BM_aead_encrypt<aead_aesgcm>)
+          ->Apply(bench::message_sizes);
+        benchmark::RegisterBenchmark(
+          "BM_aead_encrypt_span<sodium::aead_aesgcm>",
+          BM_aead_encrypt_span<aead_aesgcm>)
+          ->Apply(bench::message_sizes);
+        benchmark::RegisterBenchmark("BM_aead_decrypt<sodium::aead_aesgcm>",
+                                     BM_aead_decrypt<aead_aesgcm>)
+          ->Apply(bench::message_sizes);
+        benchmark::RegisterBenchmark(
+          "BM_aead_encrypt<sodium::aead_aesgcm_precomputed>",
+          BM_aead_encrypt<aead_aesgcm_precomputed>)
+          ->Apply(bench::message_sizes);
+        benchmark::RegisterBenchmark(
+          "BM_aead_encrypt_span<sodium::aead_aesgcm_precomputed>",
+          BM_aead_encrypt_span<aead_aesgcm_precomputed>)
+          ->Apply(bench::message_sizes);
+        benchmark::RegisterBenchmark(
+          "BM_aead_decrypt<sodium::aead_aesgcm_precomputed>",
+          BM_aead_decrypt<aead_aesgcm_precomputed>)
+          ->Apply(bench::message_sizes);
+        benchmark::RegisterBenchmark(
+          "BM_raw_aead_encrypt<sodium::aead_aesgcm>",
+          BM_raw_aead_encrypt<aead_aesgcm>)
+          ->Apply(bench::message_sizes);
+        benchmark::RegisterBenchmark("BM_aead_aesgcm_shared_context",
+                                     BM_aead_aesgcm_shared_context)
+          ->Arg(16384)
+          ->ThreadRange(1, 8);
+    }
+
+    // record which path sodium::aead_auto takes on this host
+    benchmark::AddCustomContext(
+      "aead_auto",
+      sodium::aead_auto<>::name(sodium::aead_auto<>::preferred()));
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return EXIT_FAILURE;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return EXIT_SUCCESS;
+}
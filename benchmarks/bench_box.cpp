@@ -0,0 +1,194 @@
+// bench_box.cpp -- Benchmark sodium::box and sodium::box_precomputed
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "bench_common.h"
+#include "box.h"
+#include "box_precomputed.h"
+#include "box_seal.h"
+#include "keypair.h"
+#include "thread_pool.h"
+
+#include <vector>
+
+using sodium::bytes;
+
+static void
+BM_box_encrypt(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::keypair<> alice;
+    sodium::keypair<> bob;
+    sodium::box<> box;
+    sodium::box<>::nonce_type nonce;
+    bytes plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(box.encrypt(
+          plaintext, bob.public_key(), alice.private_key(), nonce));
+    meter.report(state, size);
+}
+BENCHMARK(BM_box_encrypt)->Apply(bench::message_sizes);
+
+static void
+BM_box_precomputed_encrypt(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::keypair<> alice;
+    sodium::keypair<> bob;
+    sodium::box_precomputed<> box(alice.private_key(), bob.public_key());
+    sodium::box_precomputed<>::nonce_type nonce;
+    bytes plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(box.encrypt(plaintext, nonce));
+    meter.report(state, size);
+}
+BENCHMARK(BM_box_precomputed_encrypt)->Apply(bench::message_sizes);
+
+// the cost of the X25519 scalar multiplication alone
+static void
+BM_box_precomputed_construct(benchmark::State& state)
+{
+    sodium::keypair<> alice;
+    sodium::keypair<> bob;
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        sodium::box_precomputed<> box(alice.private_key(), bob.public_key());
+        benchmark::DoNotOptimize(&box);
+    }
+    meter.report(state, 0);
+}
+BENCHMARK(BM_box_precomputed_construct);
+
+// one 4 KiB notification to range(0) recipients
+static std::vector<sodium::keypair<>::public_key_type>
+recipients(std::size_t n)
+{
+    std::vector<sodium::keypair<>::public_key_type> public_keys;
+    for (std::size_t i = 0; i != n; ++i)
+        public_keys.push_back(sodium::keypair<>().public_key());
+    return public_keys;
+}
+
+static void
+BM_box_seal_encrypt_each(benchmark::State& state)
+{
+    const auto public_keys =
+      recipients(static_cast<std::size_t>(state.range(0)));
+    sodium::box_seal<> sb;
+    bytes plaintext(4096);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        for (const auto& public_key : public_keys)
+            benchmark::DoNotOptimize(sb.encrypt(plaintext, public_key));
+    meter.report(state, plaintext.size());
+}
+BENCHMARK(BM_box_seal_encrypt_each)->Arg(16)->Arg(1024);
+
+static void
+BM_box_seal_encrypt_multi(benchmark::State& state)
+{
+    const auto public_keys =
+      recipients(static_cast<std::size_t>(state.range(0)));
+    sodium::box_seal<> sb;
+    bytes plaintext(4096);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(sb.encrypt_multi(plaintext, public_keys));
+    meter.report(state, plaintext.size());
+}
+BENCHMARK(BM_box_seal_encrypt_multi)->Arg(16)->Arg(1024);
+
+static void
+BM_box_seal_encrypt_multi_parallel(benchmark::State& state)
+{
+    const auto public_keys =
+      recipients(static_cast<std::size_t>(state.range(0)));
+    sodium::box_seal<> sb;
+    sodium::thread_pool pool;
+    bytes plaintext(4096);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(
+          sb.encrypt_multi(plaintext, public_keys, pool));
+    meter.report(state, plaintext.size());
+}
+BENCHMARK(BM_box_seal_encrypt_multi_parallel)
+  ->Arg(16)
+  ->Arg(1024)
+  ->UseRealTime();
+
+// baselines: the raw libsodium calls
+static void
+BM_raw_crypto_box_easy(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::keypair<> alice;
+    sodium::keypair<> bob;
+    sodium::box<>::nonce_type nonce;
+    bytes plaintext(size);
+    bytes ciphertext(sodium::box<>::MACSIZE + size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        crypto_box_easy(ciphertext.data(),
+                        plaintext.data(),
+                        plaintext.size(),
+                        nonce.data(),
+                        bob.public_key().data(),
+                        alice.private_key().data());
+        benchmark::DoNotOptimize(ciphertext.data());
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_raw_crypto_box_easy)->Apply(bench::message_sizes);
+
+static void
+BM_raw_crypto_box_easy_afternm(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::keypair<> alice;
+    sodium::keypair<> bob;
+    sodium::box<>::nonce_type nonce;
+    bytes shared(crypto_box_BEFORENMBYTES);
+    bytes plaintext(size);
+    bytes ciphertext(sodium::box<>::MACSIZE + size);
+
+    crypto_box_beforenm(
+      shared.data(), bob.public_key().data(), alice.private_key().data());
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        crypto_box_easy_afternm(ciphertext.data(),
+                                plaintext.data(),
+                                plaintext.size(),
+                                nonce.data(),
+                                shared.data());
+        benchmark::DoNotOptimize(ciphertext.data());
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_raw_crypto_box_easy_afternm)->Apply(bench::message_sizes);
+
+SODIUM_BENCHMARK_MAIN();
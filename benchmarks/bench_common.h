@@ -0,0 +1,87 @@
+// bench_common.h -- Helpers shared by all benchmarks
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "../tools/alloc_counter.h"
+
+#include <benchmark/benchmark.h>
+
+#include <sodium.h>
+
+#include <cstddef>
+#include <cstdlib>
+
+namespace bench {
+
+using alloc_counter::allocations;
+
+/**
+ * Message sizes swept by all size-dependent benchmarks:
+ *   16 B, 256 B, 4 KiB, 64 KiB, 1 MiB, 16 MiB.
+ **/
+inline void
+message_sizes(benchmark::internal::Benchmark* b)
+{
+    b->RangeMultiplier(16)->Range(16, 16 << 20);
+}
+
+/**
+ * Measure allocations per operation across the benchmark loop.
+ *
+ * Usage:
+ *   bench::alloc_meter meter;
+ *   for (auto _ : state) { ... }
+ *   meter.report(state, bytes_per_op);
+ **/
+class alloc_meter
+{
+  public:
+    alloc_meter()
+      : start_{ allocations() }
+    {}
+
+    void report(benchmark::State& state, std::size_t bytes_per_op)
+    {
+        const std::size_t allocs = allocations() - start_;
+
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                                static_cast<int64_t>(bytes_per_op));
+        state.counters["allocs/op"] = benchmark::Counter(
+          static_cast<double>(allocs), benchmark::Counter::kAvgIterations);
+    }
+
+  private:
+    std::size_t start_;
+};
+
+} // namespace bench
+
+// every benchmark executable needs an initialized libsodium
+#define SODIUM_BENCHMARK_MAIN()                                                \
+    int main(int argc, char** argv)                                            \
+    {                                                                          \
+        if (sodium_init() == -1)                                               \
+            return EXIT_FAILURE;                                               \
+        benchmark::Initialize(&argc, argv);                                    \
+        if (benchmark::ReportUnrecognizedArguments(argc, argv))                \
+            return EXIT_FAILURE;                                               \
+        benchmark::RunSpecifiedBenchmarks();                                   \
+        benchmark::Shutdown();                                                 \
+        return EXIT_SUCCESS;                                                   \
+    }
@@ -0,0 +1,272 @@
+// bench_filters.cpp -- Benchmark the boost::iostreams filters
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "aead_encrypt_filter.h"
+#include "auth_mac_filter.h"
+#include "bench_common.h"
+#include "blake2b_tee_filter.h"
+#include "buffered_stream_filter.h"
+#include "chacha20_filter.h"
+#include "multi_hash_tee_filter.h"
+#include "parallel_stream_xor_backend.h"
+#include "poly1305_tee_filter.h"
+#include "salsa20_filter.h"
+#include "secretbox_encrypt_filter.h"
+#include "thread_pool.h"
+#include "xchacha20_filter.h"
+#include "xsalsa20_filter.h"
+
+#include <boost/iostreams/device/null.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+namespace io = boost::iostreams;
+
+using sodium::bytes;
+using sodium::chars;
+
+constexpr std::streamsize FILTER_BUFFER_SIZE = 4096;
+
+/**
+ * Push a copy of filter on a fresh filtering_ostream writing into a
+ * null_sink, write the whole message, and close the chain. Closing
+ * is needed to make aggregate filters emit anything at all.
+ **/
+template<typename Filter>
+static void
+run_filter(benchmark::State& state, const Filter& filter)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    chars plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        io::filtering_ostream os;
+        os.push(filter);
+        os.push(io::null_sink{});
+        os.write(plaintext.data(), plaintext.size());
+        os.reset();
+    }
+    meter.report(state, size);
+}
+
+// ---- stream ciphers (symmetric_filters) --------------------------
+
+template<typename Filter>
+static void
+BM_stream_cipher_filter(benchmark::State& state)
+{
+    typename Filter::key_type key;
+    typename Filter::nonce_type nonce;
+
+    run_filter(state, Filter{ FILTER_BUFFER_SIZE, key, nonce });
+}
+BENCHMARK_TEMPLATE(BM_stream_cipher_filter, sodium::chacha20_filter)
+  ->Apply(bench::message_sizes);
+BENCHMARK_TEMPLATE(BM_stream_cipher_filter, sodium::xchacha20_filter)
+  ->Apply(bench::message_sizes);
+BENCHMARK_TEMPLATE(BM_stream_cipher_filter, sodium::salsa20_filter)
+  ->Apply(bench::message_sizes);
+BENCHMARK_TEMPLATE(BM_stream_cipher_filter, sodium::xsalsa20_filter)
+  ->Apply(bench::message_sizes);
+
+BENCHMARK_TEMPLATE(BM_stream_cipher_filter, sodium::buffered_xchacha20_filter)
+  ->Apply(bench::message_sizes);
+
+// large buffers, key stream on all cores (Arg: threads, 0 = all)
+static void
+BM_stream_cipher_filter_parallel(benchmark::State& state)
+{
+    constexpr std::size_t BUFFERSIZE = 16 * 1024 * 1024;
+    sodium::thread_pool pool(static_cast<std::size_t>(state.range(0)));
+    auto backend = std::make_shared<sodium::parallel_stream_xor_backend>(pool);
+    sodium::buffered_xchacha20_filter::key_type key;
+    sodium::buffered_xchacha20_filter::nonce_type nonce;
+    chars plaintext(4 * BUFFERSIZE);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        io::filtering_ostream os;
+        os.push(sodium::buffered_xchacha20_filter{
+          BUFFERSIZE, key, nonce, backend });
+        os.push(io::null_sink{});
+        os.write(plaintext.data(), plaintext.size());
+        os.reset();
+    }
+    meter.report(state, plaintext.size());
+}
+BENCHMARK(BM_stream_cipher_filter_parallel)
+  ->Arg(1)
+  ->Arg(2)
+  ->Arg(4)
+  ->Arg(0)
+  ->UseRealTime();
+
+// many small records written to the same stream
+template<typename Filter>
+static void
+BM_stream_cipher_filter_records(benchmark::State& state)
+{
+    constexpr std::size_t RECORDSIZE = 100;
+    constexpr std::size_t RECORDS = 10000;
+    typename Filter::key_type key;
+    typename Filter::nonce_type nonce;
+    Filter filter{ FILTER_BUFFER_SIZE, key, nonce };
+    chars record(RECORDSIZE);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        io::filtering_ostream os;
+        os.push(filter);
+        os.push(io::null_sink{});
+        for (std::size_t i = 0; i != RECORDS; ++i)
+            os.write(record.data(), record.size());
+        os.reset();
+    }
+    meter.report(state, RECORDS * RECORDSIZE);
+}
+BENCHMARK_TEMPLATE(BM_stream_cipher_filter_records, sodium::xchacha20_filter);
+BENCHMARK_TEMPLATE(BM_stream_cipher_filter_records,
+                   sodium::buffered_xchacha20_filter);
+
+// baseline: the raw libsodium call behind xchacha20_filter
+static void
+BM_raw_crypto_stream_xchacha20_xor(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::xchacha20_filter::key_type key;
+    sodium::xchacha20_filter::nonce_type nonce;
+    bytes plaintext(size);
+    bytes ciphertext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        crypto_stream_xchacha20_xor(ciphertext.data(),
+                                    plaintext.data(),
+                                    plaintext.size(),
+                                    nonce.data(),
+                                    key.data());
+        benchmark::DoNotOptimize(ciphertext.data());
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_raw_crypto_stream_xchacha20_xor)->Apply(bench::message_sizes);
+
+// ---- aggregate filters -------------------------------------------
+
+static void
+BM_aead_encrypt_filter(benchmark::State& state)
+{
+    sodium::aead<chars> aead;
+    sodium::aead_encrypt_filter::nonce_type nonce;
+    chars header(32);
+
+    run_filter(state, sodium::aead_encrypt_filter{ aead, nonce, header });
+}
+BENCHMARK(BM_aead_encrypt_filter)->Apply(bench::message_sizes);
+
+static void
+BM_secretbox_encrypt_filter(benchmark::State& state)
+{
+    sodium::secretbox<chars> secretbox;
+    sodium::secretbox_encrypt_filter::nonce_type nonce;
+
+    run_filter(state, sodium::secretbox_encrypt_filter{ secretbox, nonce });
+}
+BENCHMARK(BM_secretbox_encrypt_filter)->Apply(bench::message_sizes);
+
+static void
+BM_auth_mac_filter(benchmark::State& state)
+{
+    sodium::authenticator<chars> auth;
+
+    run_filter(state, sodium::auth_mac_filter{ auth });
+}
+BENCHMARK(BM_auth_mac_filter)->Apply(bench::message_sizes);
+
+// ---- tee filters --------------------------------------------------
+
+static void
+BM_blake2b_tee_filter(benchmark::State& state)
+{
+    using filter_type = sodium::blake2b_tee_filter<io::null_sink>;
+    io::null_sink hash_sink;
+    filter_type::key_type key(filter_type::KEYSIZE);
+
+    run_filter(state, filter_type{ hash_sink, key, filter_type::HASHSIZE });
+}
+BENCHMARK(BM_blake2b_tee_filter)->Apply(bench::message_sizes);
+
+static void
+BM_poly1305_tee_filter(benchmark::State& state)
+{
+    using filter_type = sodium::poly1305_tee_filter<io::null_sink>;
+    io::null_sink mac_sink;
+    filter_type::key_type key;
+
+    run_filter(state, filter_type{ mac_sink, key });
+}
+BENCHMARK(BM_poly1305_tee_filter)->Apply(bench::message_sizes);
+
+// BLAKE2b and Poly1305 of the same stream: two chained tee filters ...
+static void
+BM_blake2b_poly1305_chained_tee_filters(benchmark::State& state)
+{
+    using blake2b_type = sodium::blake2b_tee_filter<io::null_sink>;
+    using poly1305_type = sodium::poly1305_tee_filter<io::null_sink>;
+    io::null_sink tag_sink;
+    blake2b_type::key_type hashkey(blake2b_type::KEYSIZE);
+    poly1305_type::key_type mackey;
+    blake2b_type blake2b_filter{ tag_sink, hashkey, blake2b_type::HASHSIZE };
+    poly1305_type poly1305_filter{ tag_sink, mackey };
+
+    const auto size = static_cast<std::size_t>(state.range(0));
+    chars plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        io::filtering_ostream os;
+        os.push(blake2b_filter);
+        os.push(poly1305_filter);
+        os.push(io::null_sink{});
+        os.write(plaintext.data(), plaintext.size());
+        os.reset();
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_blake2b_poly1305_chained_tee_filters)->Apply(bench::message_sizes);
+
+// ... vs. one multi_hash_tee_filter computing both in a single pass
+static void
+BM_blake2b_poly1305_multi_hash_tee_filter(benchmark::State& state)
+{
+    using filter_type = sodium::multi_hash_tee_filter<io::null_sink,
+                                                      sodium::blake2b_digest<>,
+                                                      sodium::poly1305_digest>;
+    io::null_sink tag_sink;
+    sodium::keyvar<> hashkey(sodium::KEYSIZE_HASHKEY);
+    sodium::poly1305_digest::key_type mackey;
+
+    run_filter(state,
+               filter_type{ tag_sink,
+                            sodium::blake2b_digest<>(hashkey),
+                            sodium::poly1305_digest(mackey) });
+}
+BENCHMARK(BM_blake2b_poly1305_multi_hash_tee_filter)
+  ->Apply(bench::message_sizes);
+
+SODIUM_BENCHMARK_MAIN();
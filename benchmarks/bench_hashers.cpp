@@ -0,0 +1,170 @@
+// bench_hashers.cpp -- Benchmark sodium::hasher_generic, hasher_short
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "bench_common.h"
+#include "hasher_generic.h"
+#include "hasher_short.h"
+
+#include <cstdint>
+#include <vector>
+
+using sodium::bytes;
+
+static void
+BM_hasher_generic_hash(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::hasher_generic<> hasher;
+    bytes plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(hasher.hash(plaintext));
+    meter.report(state, size);
+}
+BENCHMARK(BM_hasher_generic_hash)->Apply(bench::message_sizes);
+
+// MACing with a reused thread-local state: reset() is a memcpy()
+static void
+BM_hasher_generic_local_state(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::hasher_generic<> hasher;
+    bytes plaintext(size);
+    bytes hash(sodium::hasher_generic<>::HASHSIZE);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        auto& hs = hasher.local_state();
+        hs.update(plaintext);
+        hs.final(hash);
+        benchmark::DoNotOptimize(hash.data());
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_hasher_generic_local_state)->Apply(bench::message_sizes);
+
+static void
+BM_hasher_short_hash(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::hasher_short<> hasher;
+    bytes plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(hasher.hash(plaintext));
+    meter.report(state, size);
+}
+BENCHMARK(BM_hasher_short_hash)->Apply(bench::message_sizes);
+
+// the allocation-free variant, returning a fixed_bytes<>
+static void
+BM_hasher_short_hash_fixed(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::hasher_short<> hasher;
+    bytes plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(hasher.hash_fixed(plaintext));
+    meter.report(state, size);
+}
+BENCHMARK(BM_hasher_short_hash_fixed)->Arg(16)->Arg(64)->Arg(256);
+
+static void
+BM_hasher_short_hash64(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::hasher_short<> hasher;
+    bytes plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(
+          hasher.hash64(plaintext.data(), plaintext.size()));
+    meter.report(state, size);
+}
+BENCHMARK(BM_hasher_short_hash64)->Arg(8)->Arg(16)->Arg(32)->Arg(64);
+
+// hash 64 keys per batch
+static void
+BM_hasher_short_hash64_batch(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    constexpr std::size_t n = 64;
+    sodium::hasher_short<> hasher;
+    std::vector<bytes> plaintexts(n, bytes(size));
+    std::vector<const void*> data;
+    for (const auto& plaintext : plaintexts)
+        data.push_back(plaintext.data());
+    std::vector<std::size_t> sizes(n, size);
+    std::vector<std::uint64_t> out(n);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        hasher.hash64(data.data(), sizes.data(), n, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    meter.report(state, n * size);
+}
+BENCHMARK(BM_hasher_short_hash64_batch)->Arg(8)->Arg(16)->Arg(32)->Arg(64);
+
+// baselines: the raw libsodium calls
+static void
+BM_raw_crypto_generichash(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::keyvar<> key(crypto_generichash_KEYBYTES);
+    bytes plaintext(size);
+    bytes hash(crypto_generichash_BYTES);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        crypto_generichash(hash.data(),
+                           hash.size(),
+                           plaintext.data(),
+                           plaintext.size(),
+                           key.data(),
+                           key.size());
+        benchmark::DoNotOptimize(hash.data());
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_raw_crypto_generichash)->Apply(bench::message_sizes);
+
+static void
+BM_raw_crypto_shorthash(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::hasher_short<>::key_type key;
+    bytes plaintext(size);
+    bytes hash(crypto_shorthash_BYTES);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        crypto_shorthash(
+          hash.data(), plaintext.data(), plaintext.size(), key.data());
+        benchmark::DoNotOptimize(hash.data());
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_raw_crypto_shorthash)->Apply(bench::message_sizes);
+
+SODIUM_BENCHMARK_MAIN();
@@ -0,0 +1,83 @@
+// bench_helpers.cpp -- Benchmark the hex and base64 codecs of helpers.h
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "bench_common.h"
+#include "helpers.h"
+
+#include <string>
+#include <vector>
+
+using sodium::byte;
+
+// a 32 bytes key id, the common case when logging
+constexpr std::size_t KEYID_SIZE = 32;
+
+static void
+BM_bin2hex_string(benchmark::State& state)
+{
+    std::vector<byte> in(KEYID_SIZE, 0x5a);
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(sodium::bin2hex(in));
+    meter.report(state, KEYID_SIZE);
+}
+BENCHMARK(BM_bin2hex_string);
+
+static void
+BM_bin2hex_span(benchmark::State& state)
+{
+    std::vector<byte> in(KEYID_SIZE, 0x5a);
+    char out[sodium::hex_encoded_size(KEYID_SIZE)];
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sodium::bin2hex(sodium::span<char>(out), in));
+        benchmark::DoNotOptimize(out);
+        benchmark::ClobberMemory();
+    }
+    meter.report(state, KEYID_SIZE);
+}
+BENCHMARK(BM_bin2hex_span);
+
+static void
+BM_bin2base64_string(benchmark::State& state)
+{
+    std::vector<byte> in(KEYID_SIZE, 0x5a);
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(sodium::bin2base64(in));
+    meter.report(state, KEYID_SIZE);
+}
+BENCHMARK(BM_bin2base64_string);
+
+static void
+BM_bin2base64_span(benchmark::State& state)
+{
+    std::vector<byte> in(KEYID_SIZE, 0x5a);
+    char out[sodium::base64_encoded_size<>(KEYID_SIZE)];
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+          sodium::bin2base64(sodium::span<char>(out), in));
+        benchmark::DoNotOptimize(out);
+        benchmark::ClobberMemory();
+    }
+    meter.report(state, KEYID_SIZE);
+}
+BENCHMARK(BM_bin2base64_span);
+
+SODIUM_BENCHMARK_MAIN();
@@ -0,0 +1,70 @@
+// bench_random.cpp -- Benchmark sodium::buffered_random
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "bench_common.h"
+#include "nonce.h"
+#include "random.h"
+
+#include <vector>
+
+using sodium::byte;
+
+// the system RNG, one call per request
+static void
+BM_raw_randombytes_buf(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    std::vector<byte> buf(size);
+
+    for (auto _ : state) {
+        ::randombytes_buf(buf.data(), buf.size());
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            static_cast<int64_t>(size));
+}
+BENCHMARK(BM_raw_randombytes_buf)->Arg(24)->Arg(32)->Arg(4096);
+
+// the per-thread buffered generator
+static void
+BM_buffered_random_fill(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    std::vector<byte> buf(size);
+
+    for (auto _ : state) {
+        sodium::buffered_random::fill(buf.data(), buf.size());
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            static_cast<int64_t>(size));
+}
+BENCHMARK(BM_buffered_random_fill)->Arg(24)->Arg(32)->Arg(4096)->Threads(4);
+
+// a random 24 bytes nonce, e.g. for xchacha20 or secretbox
+static void
+BM_nonce_random(benchmark::State& state)
+{
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(sodium::nonce<24>());
+    meter.report(state, 24);
+}
+BENCHMARK(BM_nonce_random);
+
+SODIUM_BENCHMARK_MAIN();
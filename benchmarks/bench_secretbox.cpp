@@ -0,0 +1,120 @@
+// bench_secretbox.cpp -- Benchmark sodium::secretbox
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "bench_common.h"
+#include "secretbox.h"
+
+using sodium::bytes;
+using secretbox_type = sodium::secretbox<>;
+
+static void
+BM_secretbox_encrypt(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    secretbox_type sb;
+    secretbox_type::nonce_type nonce;
+    bytes plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(sb.encrypt(plaintext, nonce));
+    meter.report(state, size);
+}
+BENCHMARK(BM_secretbox_encrypt)->Apply(bench::message_sizes);
+
+static void
+BM_secretbox_encrypt_inplace(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    secretbox_type sb;
+    secretbox_type::nonce_type nonce;
+    bytes plaintext(size);
+    bytes ciphertext(secretbox_type::MACSIZE + size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        sb.encrypt(ciphertext, plaintext, nonce);
+        benchmark::DoNotOptimize(ciphertext.data());
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_secretbox_encrypt_inplace)->Apply(bench::message_sizes);
+
+// encrypting messages back to back into one large send buffer
+static void
+BM_secretbox_encrypt_span(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    secretbox_type sb;
+    secretbox_type::nonce_type nonce;
+    bytes plaintext(size);
+    bytes sendbuf(4 * secretbox_type::ciphertext_size(size));
+
+    bench::alloc_meter meter;
+    std::size_t offset = 0;
+    for (auto _ : state) {
+        const std::size_t csize = secretbox_type::ciphertext_size(size);
+        if (offset + csize > sendbuf.size())
+            offset = 0;
+        sodium::span<sodium::byte> out(sendbuf.data() + offset, csize);
+        benchmark::DoNotOptimize(sb.encrypt(out, plaintext, nonce));
+        offset += csize;
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_secretbox_encrypt_span)->Apply(bench::message_sizes);
+
+static void
+BM_secretbox_decrypt(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    secretbox_type sb;
+    secretbox_type::nonce_type nonce;
+    bytes ciphertext = sb.encrypt(bytes(size), nonce);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(sb.decrypt(ciphertext, nonce));
+    meter.report(state, size);
+}
+BENCHMARK(BM_secretbox_decrypt)->Apply(bench::message_sizes);
+
+// baseline: the raw libsodium call
+static void
+BM_raw_crypto_secretbox_easy(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    secretbox_type::key_type key;
+    secretbox_type::nonce_type nonce;
+    bytes plaintext(size);
+    bytes ciphertext(secretbox_type::MACSIZE + size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        crypto_secretbox_easy(ciphertext.data(),
+                              plaintext.data(),
+                              plaintext.size(),
+                              nonce.data(),
+                              key.data());
+        benchmark::DoNotOptimize(ciphertext.data());
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_raw_crypto_secretbox_easy)->Apply(bench::message_sizes);
+
+SODIUM_BENCHMARK_MAIN();
@@ -0,0 +1,120 @@
+// bench_secretstream.cpp -- Benchmark sodium::secretstream
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "bench_common.h"
+#include "secretstream.h"
+#include "streamcryptor_aead.h"
+#include "streamcryptor_secretstream.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+using sodium::byte;
+using sodium::bytes;
+using sodium::span;
+using secretstream_type = sodium::secretstream<>;
+
+// small RPC-sized frames, pushed FRAMES at a time
+constexpr std::size_t FRAMES = 1000;
+
+static void
+frame_sizes(benchmark::internal::Benchmark* b)
+{
+    b->Arg(16)->Arg(64)->Arg(256)->Arg(1024);
+}
+
+static void
+BM_secretstream_push(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    secretstream_type ss;
+    ss.init_push();
+    const bytes plaintext(size);
+    const bytes added_data;
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        for (std::size_t i = 0; i != FRAMES; ++i)
+            benchmark::DoNotOptimize(ss.push(plaintext, added_data));
+    meter.report(state, FRAMES * size);
+}
+BENCHMARK(BM_secretstream_push)->Apply(frame_sizes);
+
+static void
+BM_secretstream_push_vectored(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    secretstream_type ss;
+    ss.init_push();
+    const bytes plaintext(size);
+    const std::vector<span<const byte>> segments(FRAMES, plaintext);
+    bytes out(secretstream_type::push_size(segments));
+    std::vector<std::size_t> offsets(FRAMES + 1);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ss.push(out, offsets, segments));
+        benchmark::ClobberMemory();
+    }
+    meter.report(state, FRAMES * size);
+}
+BENCHMARK(BM_secretstream_push_vectored)->Apply(frame_sizes);
+
+// file engines: the deprecated streamcryptor_aead (1 KiB blocks, as
+// used by sodiumtester) vs. streamcryptor_secretstream, on 16 MiB
+constexpr std::size_t FILESIZE = 16 * 1024 * 1024;
+
+static void
+BM_streamcryptor_aead_encrypt(benchmark::State& state)
+{
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::streamcryptor_aead<> sc(key, nonce, 1024);
+    const std::string plaintext(FILESIZE, 'a');
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        std::istringstream istr(plaintext);
+        std::ostringstream ostr;
+        sc.encrypt(istr, ostr);
+        benchmark::DoNotOptimize(ostr.tellp());
+    }
+    meter.report(state, FILESIZE);
+}
+BENCHMARK(BM_streamcryptor_aead_encrypt);
+
+static void
+BM_streamcryptor_secretstream_encrypt(benchmark::State& state)
+{
+    sodium::streamcryptor_secretstream<>::key_type key;
+    sodium::streamcryptor_secretstream<> sc(key);
+    const std::string plaintext(FILESIZE, 'a');
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        std::istringstream istr(plaintext);
+        std::ostringstream ostr;
+        sc.encrypt(istr, ostr);
+        benchmark::DoNotOptimize(ostr.tellp());
+    }
+    meter.report(state, FILESIZE);
+}
+BENCHMARK(BM_streamcryptor_secretstream_encrypt);
+
+SODIUM_BENCHMARK_MAIN();
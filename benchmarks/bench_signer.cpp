@@ -0,0 +1,97 @@
+// bench_signer.cpp -- Benchmark sodium::signer and sodium::verifier
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "bench_common.h"
+#include "keypairsign.h"
+#include "signer.h"
+#include "verifier.h"
+
+using sodium::bytes;
+
+static void
+BM_signer_sign_detached(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::keypairsign<> keypair;
+    sodium::signer<> signer(keypair.private_key());
+    bytes plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(signer.sign_detached(plaintext));
+    meter.report(state, size);
+}
+BENCHMARK(BM_signer_sign_detached)->Apply(bench::message_sizes);
+
+// the allocation-free variant, returning a fixed_bytes<>
+static void
+BM_signer_sign_detached_fixed(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::keypairsign<> keypair;
+    sodium::signer<> signer(keypair.private_key());
+    bytes plaintext(size);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(signer.sign_detached_fixed(plaintext));
+    meter.report(state, size);
+}
+BENCHMARK(BM_signer_sign_detached_fixed)->Apply(bench::message_sizes);
+
+static void
+BM_verifier_verify_detached(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::keypairsign<> keypair;
+    sodium::signer<> signer(keypair.private_key());
+    sodium::verifier<> verifier(keypair.public_key());
+    bytes plaintext(size);
+    bytes signature = signer.sign_detached(plaintext);
+
+    bench::alloc_meter meter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(
+          verifier.verify_detached(plaintext, signature));
+    meter.report(state, size);
+}
+BENCHMARK(BM_verifier_verify_detached)->Apply(bench::message_sizes);
+
+// baseline: the raw libsodium call
+static void
+BM_raw_crypto_sign_detached(benchmark::State& state)
+{
+    const auto size = static_cast<std::size_t>(state.range(0));
+    sodium::keypairsign<> keypair;
+    bytes plaintext(size);
+    bytes signature(crypto_sign_BYTES);
+
+    bench::alloc_meter meter;
+    for (auto _ : state) {
+        crypto_sign_detached(signature.data(),
+                             NULL,
+                             plaintext.data(),
+                             plaintext.size(),
+                             keypair.private_key().data());
+        benchmark::DoNotOptimize(signature.data());
+    }
+    meter.report(state, size);
+}
+BENCHMARK(BM_raw_crypto_sign_detached)->Apply(bench::message_sizes);
+
+SODIUM_BENCHMARK_MAIN();
@@ -18,57 +18,70 @@
 
 #pragma once
 
-#include "aead_aesgcm.h"
-#include "aead_aesgcm_precomputed.h"
-#include "aead_chacha20_poly1305.h"
-#include "aead_chacha20_poly1305_ietf.h"
-#include "aead_xchacha20_poly1305_ietf.h"
+#include "aead_traits.h"
 #include "aes_ctx.h"
 #include "common.h"
+#include "error.h"
+#include "extern_templates.h"
 #include "key.h"
+#include "metrics.h"
 #include "nonce.h"
+#include "padding.h"
+#include "span.h"
+#include <cstring>
+#include <memory>
 #include <sodium.h>
 #include <stdexcept>
+#include <system_error>
 #include <type_traits>
 
 namespace sodium {
 
 template<typename BT = bytes,
          typename F = sodium::aead_xchacha20_poly1305_ietf,
-         typename T = typename std::enable_if<
-           std::is_same<F, sodium::aead_chacha20_poly1305>::value ||
-             std::is_same<F, sodium::aead_chacha20_poly1305_ietf>::value ||
-             std::is_same<F, sodium::aead_xchacha20_poly1305_ietf>::value ||
-             std::is_same<F, sodium::aead_aesgcm>::value ||
-             std::is_same<F, sodium::aead_aesgcm_precomputed>::value,
-           int>::type>
+         typename T =
+           typename std::enable_if<sodium::is_aead<F>, int>::type>
 class aead
 {
   public:
-    static constexpr std::size_t NONCESIZE = F::NPUBBYTES;
-    static constexpr std::size_t KEYSIZE = F::KEYBYTES;
-    static constexpr std::size_t MACSIZE = F::ABYTES;
+    static constexpr std::size_t NONCESIZE = aead_traits<F>::NPUBBYTES;
+    static constexpr std::size_t KEYSIZE = aead_traits<F>::KEYBYTES;
+    static constexpr std::size_t MACSIZE = aead_traits<F>::ABYTES;
 
     using bytes_type = BT;
     using key_type = key<KEYSIZE>;
+    using shared_key_type = shared_key<KEYSIZE>;
     using nonce_type = nonce<NONCESIZE>;
 
     // A aead with a new random key
     aead()
-      : key_state_(std::move(key_type()))
+      : key_state_(make_shared_key(key_type()))
     {}
 
     // A aead with a user-supplied key (copying version)
     aead(const key_type& key)
-      : key_state_(key)
+      : key_state_(make_shared_key(key))
     {}
 
     // A aead with a user-supplied key (moving version)
     aead(key_type&& key)
-      : key_state_(std::move(key))
+      : key_state_(make_shared_key(std::move(key)))
     {}
 
-    // A copying constructor
+    /**
+     * A aead sharing the immutable key of other aead<>s, filters,
+     * etc., see make_shared_key(). Throw a std::runtime_error if key
+     * is empty.
+     **/
+
+    explicit aead(shared_key_type key)
+      : key_state_(std::move(key))
+    {
+        if (!key_state_)
+            throw std::runtime_error{ "sodium::aead::aead() empty key" };
+    }
+
+    // A copying constructor: shares the (immutable) key of other
     aead(const aead& other)
       : key_state_(other.key_state_)
     {}
@@ -78,6 +91,9 @@ class aead
       : key_state_(std::move(other.key_state_))
     {}
 
+    // the shared key of this aead
+    const shared_key_type& key_handle() const noexcept { return key_state_; }
+
     // XXX copying and moving assignment operators?
 
     /**
@@ -105,7 +121,9 @@ class aead
      * bytes.
      **/
 
-    BT encrypt(const BT& header, const BT& plaintext, const nonce_type& nonce)
+    BT encrypt(const BT& header,
+               const BT& plaintext,
+               const nonce_type& nonce) const
     {
         // make space for MAC and encrypted message, i.e. (MAC || encrypted)
         BT ciphertext(MACSIZE + plaintext.size());
@@ -124,7 +142,8 @@ class aead
                    header.size(),
                    NULL /* nsec */,
                    nonce.data(),
-                   key_state_.data());
+                   key_state_->data());
+        metrics::bytes_encrypted(plaintext.size());
         ciphertext.resize(static_cast<std::size_t>(clen));
 
         return ciphertext;
@@ -164,7 +183,7 @@ class aead
     BT encrypt(const BT& header,
                const BT& plaintext,
                const nonce_type& nonce,
-               BT& mac)
+               BT& mac) const
     {
         // some sanity checks before we get started
         if (mac.size() != MACSIZE)
@@ -191,7 +210,8 @@ class aead
           header.size(),
           NULL /* nsec */,
           nonce.data(),
-          key_state_.data());
+          key_state_->data());
+        metrics::bytes_encrypted(plaintext.size());
 
         return ciphertext;
     };
@@ -214,7 +234,7 @@ class aead
 
     BT decrypt(const BT& header,
                const BT& ciphertext_with_mac,
-               const nonce_type& nonce)
+               const nonce_type& nonce) const
     {
         // some sanity checks before we get started
         if (ciphertext_with_mac.size() < MACSIZE)
@@ -239,10 +259,13 @@ class aead
                                            header.data())),
                        header.size(),
                        nonce.data(),
-                       key_state_.data()) == -1)
+                       key_state_->data()) == -1) {
+            metrics::mac_failure();
             throw std::runtime_error{ "sodium::aead::decrypt() can't decrypt "
                                       "or message/tag corrupt" };
+        }
         plaintext.resize(static_cast<std::size_t>(mlen));
+        metrics::bytes_decrypted(plaintext.size());
 
         return plaintext;
     }
@@ -269,7 +292,7 @@ class aead
     BT decrypt(const BT& header,
                const BT& ciphertext,
                const nonce_type& nonce,
-               const BT& mac)
+               const BT& mac) const
     {
         // some sanity checks before we get started
         if (mac.size() != MACSIZE)
@@ -292,21 +315,297 @@ class aead
                  : reinterpret_cast<const unsigned char*>(header.data())),
               header.size(),
               nonce.data(),
-              key_state_.data()) == -1)
+              key_state_->data()) == -1) {
+            metrics::mac_failure();
             throw std::runtime_error{ "sodium::aead::decrypt(detached) can't "
                                       "decrypt or message/tag corrupt" };
+        }
+        metrics::bytes_decrypted(plaintext.size());
+
+        return plaintext;
+    }
+
+    /**
+     * Non-throwing variants of the two decrypt() functions above.
+     *
+     * Instead of throwing a std::runtime_error, they set ec to
+     * sodium::errc::verification_failed if the ciphertext, the MAC or
+     * the header have been tampered with, or to
+     * sodium::errc::message_too_short or sodium::errc::wrong_size, and
+     * return an empty BT. On success, ec is cleared. See error.h.
+     **/
+
+    BT decrypt(const BT& header,
+               const BT& ciphertext_with_mac,
+               const nonce_type& nonce,
+               std::error_code& ec) const
+    {
+        if (ciphertext_with_mac.size() < MACSIZE) {
+            ec = errc::message_too_short;
+            return BT();
+        }
+
+        BT plaintext(ciphertext_with_mac.size() - MACSIZE);
+        if (decrypt(span<byte>(plaintext),
+                    span<const byte>(header),
+                    span<const byte>(ciphertext_with_mac),
+                    nonce) != 0) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
+        return plaintext;
+    }
+
+    BT decrypt(const BT& header,
+               const BT& ciphertext,
+               const nonce_type& nonce,
+               const BT& mac,
+               std::error_code& ec) const
+    {
+        if (mac.size() != MACSIZE) {
+            ec = errc::wrong_size;
+            return BT();
+        }
 
+        BT plaintext(ciphertext.size());
+        if (decrypt(span<byte>(plaintext),
+                    span<const byte>(header),
+                    span<const byte>(ciphertext),
+                    span<const byte>(mac),
+                    nonce) != 0) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
         return plaintext;
     }
 
+    /**
+     * Allocation-free variants of encrypt() and decrypt() above.
+     *
+     * These functions read from and write into caller-owned buffers,
+     * passed as sodium::span<>s, and never allocate. Instead of
+     * throwing a std::runtime_error, they return 0 on success and -1
+     * on failure (wrong buffer sizes, or a forged/corrupted message),
+     * just like the underlying libsodium functions. They are intended
+     * for hot paths that recycle their buffers.
+     *
+     * Encryption and decryption can be done in-place: the output span
+     * may start at the same address as the input span. Partially
+     * overlapping spans are not supported.
+     **/
+
+    /**
+     * Encrypt plaintext and store (MAC || ciphertext), exactly as
+     * returned by encrypt(header, plaintext, nonce), into the first
+     * MACSIZE + plaintext.size() bytes of ciphertext_with_mac.
+     *
+     * Return -1 if ciphertext_with_mac is too small.
+     **/
+
+    int encrypt(span<byte> ciphertext_with_mac,
+                span<const byte> header,
+                span<const byte> plaintext,
+                const nonce_type& nonce) const noexcept
+    {
+        if (ciphertext_with_mac.size() < MACSIZE + plaintext.size())
+            return -1;
+
+        unsigned long long clen;
+
+        if (F::encrypt(ciphertext_with_mac.data(),
+                       &clen,
+                       plaintext.data(),
+                       plaintext.size(),
+                       (header.empty() ? nullptr : header.data()),
+                       header.size(),
+                       NULL /* nsec */,
+                       nonce.data(),
+                       key_state_->data()) != 0)
+            return -1;
+
+        metrics::bytes_encrypted(plaintext.size());
+        return 0;
+    }
+
+    /**
+     * Encrypt plaintext into ciphertext, which must be at least
+     * plaintext.size() bytes long, and store the MAC into mac, which
+     * must be exactly MACSIZE bytes long (detached mode).
+     **/
+
+    int encrypt(span<byte> ciphertext,
+                span<byte> mac,
+                span<const byte> header,
+                span<const byte> plaintext,
+                const nonce_type& nonce) const noexcept
+    {
+        if (mac.size() != MACSIZE || ciphertext.size() < plaintext.size())
+            return -1;
+
+        unsigned long long maclen;
+
+        if (F::encrypt_detached(ciphertext.data(),
+                                mac.data(),
+                                &maclen,
+                                plaintext.data(),
+                                plaintext.size(),
+                                (header.empty() ? nullptr : header.data()),
+                                header.size(),
+                                NULL /* nsec */,
+                                nonce.data(),
+                                key_state_->data()) != 0)
+            return -1;
+
+        metrics::bytes_encrypted(plaintext.size());
+        return 0;
+    }
+
+    /**
+     * Decrypt ciphertext_with_mac into the first
+     * ciphertext_with_mac.size() - MACSIZE bytes of plaintext.
+     *
+     * Return -1 if plaintext is too small, or if ciphertext_with_mac
+     * or header have been tampered with.
+     **/
+
+    int decrypt(span<byte> plaintext,
+                span<const byte> header,
+                span<const byte> ciphertext_with_mac,
+                const nonce_type& nonce) const noexcept
+    {
+        if (ciphertext_with_mac.size() < MACSIZE ||
+            plaintext.size() < ciphertext_with_mac.size() - MACSIZE)
+            return -1;
+
+        unsigned long long mlen;
+
+        if (F::decrypt(plaintext.data(),
+                       &mlen,
+                       nullptr /* nsec */,
+                       ciphertext_with_mac.data(),
+                       ciphertext_with_mac.size(),
+                       (header.empty() ? nullptr : header.data()),
+                       header.size(),
+                       nonce.data(),
+                       key_state_->data()) != 0) {
+            metrics::mac_failure();
+            return -1;
+        }
+
+        metrics::bytes_decrypted(ciphertext_with_mac.size() - MACSIZE);
+        return 0;
+    }
+
+    /**
+     * Decrypt ciphertext into plaintext, which must be at least
+     * ciphertext.size() bytes long, verifying it against mac, which
+     * must be exactly MACSIZE bytes long (detached mode).
+     **/
+
+    int decrypt(span<byte> plaintext,
+                span<const byte> header,
+                span<const byte> ciphertext,
+                span<const byte> mac,
+                const nonce_type& nonce) const noexcept
+    {
+        if (mac.size() != MACSIZE || plaintext.size() < ciphertext.size())
+            return -1;
+
+        if (F::decrypt_detached(plaintext.data(),
+                                nullptr /* nsec */,
+                                ciphertext.data(),
+                                ciphertext.size(),
+                                mac.data(),
+                                (header.empty() ? nullptr : header.data()),
+                                header.size(),
+                                nonce.data(),
+                                key_state_->data()) != 0) {
+            metrics::mac_failure();
+            return -1;
+        }
+
+        metrics::bytes_decrypted(ciphertext.size());
+        return 0;
+    }
+
+    /**
+     * Pad plaintext to a multiple of blocksize (see sodium::pad()) and
+     * encrypt it, in a single pass over ciphertext_with_mac: the
+     * plaintext is copied once, straight into the output buffer,
+     * padded there, and encrypted in place. If plaintext already sits
+     * at ciphertext_with_mac.data(), it isn't even copied.
+     *
+     * The result is the same as encrypt(ciphertext_with_mac, header,
+     * padded plaintext, nonce). Its length,
+     * padded_size(plaintext.size(), blocksize) + MACSIZE, is stored
+     * into ciphertext_len.
+     *
+     * Return 0 on success, or -1 if ciphertext_with_mac is too small
+     * or blocksize is 0.
+     **/
+
+    int encrypt_padded(span<byte> ciphertext_with_mac,
+                       span<const byte> header,
+                       span<const byte> plaintext,
+                       std::size_t blocksize,
+                       const nonce_type& nonce,
+                       std::size_t& ciphertext_len) const noexcept
+    {
+        if (ciphertext_with_mac.size() < MACSIZE ||
+            plaintext.size() > ciphertext_with_mac.size() - MACSIZE)
+            return -1;
+
+        span<byte> data =
+          ciphertext_with_mac.first(ciphertext_with_mac.size() - MACSIZE);
+        std::memmove(data.data(), plaintext.data(), plaintext.size());
+
+        std::size_t padded_len;
+        if (sodium::pad(data, plaintext.size(), blocksize, padded_len) != 0)
+            return -1;
+
+        data = data.first(padded_len);
+        span<byte> mac = ciphertext_with_mac.subspan(padded_len, MACSIZE);
+        if (encrypt(data, mac, header, data, nonce) != 0)
+            return -1;
+
+        ciphertext_len = padded_len + MACSIZE;
+        return 0;
+    }
+
+    /**
+     * Decrypt a ciphertext created by encrypt_padded() into plaintext,
+     * which must have room for the padded plaintext, and store the
+     * length of the plaintext without its padding into plaintext_len.
+     *
+     * Return 0 on success, or -1 if plaintext is too small, if the
+     * ciphertext has been tampered with, or if the pad is malformed.
+     **/
+
+    int decrypt_padded(span<byte> plaintext,
+                       span<const byte> header,
+                       span<const byte> ciphertext_with_mac,
+                       std::size_t blocksize,
+                       const nonce_type& nonce,
+                       std::size_t& plaintext_len) const noexcept
+    {
+        if (decrypt(plaintext, header, ciphertext_with_mac, nonce) != 0)
+            return -1;
+
+        return sodium::unpad(
+          plaintext.first(ciphertext_with_mac.size() - MACSIZE),
+          blocksize,
+          plaintext_len);
+    }
+
   private:
-    // In all but aead_aesgcm_precomputed, key_state_ is the AEAD key.
-    // In aead_aesgcm_precomputed, key_state_ is the state precomputed
-    // from the AEAD key with crypto_aead_aes256gcm_beforenm().
-    typename std::conditional<
-      std::is_same<F, sodium::aead_aesgcm_precomputed>::value,
-      aes_ctx,
-      key_type>::type key_state_;
+    // the AEAD key; aead_aesgcm_precomputed, which keeps the state
+    // precomputed by crypto_aead_aes256gcm_beforenm() instead, is
+    // handled by the partial specialization below.
+    shared_key_type key_state_;
 };
 
 // ----------------------------------------------------------------------------
@@ -327,39 +626,72 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
     using key_type = key<KEYSIZE>;
     using nonce_type = nonce<NONCESIZE>;
 
-    // A aead with a new random key
-    aead()
+    /**
+     * A shared, immutable AES-GCM state: the key expansion of
+     * crypto_aead_aes256gcm_beforenm() is done once by make_context(),
+     * and the resulting read-only state can then be used by any number
+     * of aead objects, in any number of threads, without locking.
+     *
+     * The state lives in protected memory, and is zeroed and freed
+     * when the last handle to it is gone.
+     **/
+
+    using context_type = std::shared_ptr<const aes_ctx>;
+
+    /**
+     * Expand key into a new shared context.
+     *
+     * Throw a std::runtime_error if AES-GCM isn't available on this
+     * CPU, see crypto_aead_aes256gcm_is_available().
+     **/
+
+    static context_type make_context(const key_type& key)
     {
-        sodium::aead_aesgcm_precomputed::init_ctx(key_state_.data(),
-                                                  key_type().data());
+        auto ctx = std::make_shared<aes_ctx>();
+        if (sodium::aead_aesgcm_precomputed::init_ctx(ctx->data(),
+                                                      key.data()) != 0)
+            throw std::runtime_error{ "sodium::aead::make_context() "
+                                      "AES-GCM not available" };
+        ctx->readonly();
+
+        return ctx;
     }
 
-    // A aead with a user-supplied key (copying version)
+    // A aead with a new random key
+    aead()
+      : key_state_(make_context(key_type()))
+    {}
+
+    // A aead with a user-supplied key
     aead(const key_type& key)
-    {
-        sodium::aead_aesgcm_precomputed::init_ctx(key_state_.data(),
-                                                  key.data());
-    }
+      : key_state_(make_context(key))
+    {}
 
-    // A aead with a user-supplied key (moving version)
-    aead(key_type&& key)
+    /**
+     * A aead using a context created by make_context(), without
+     * expanding the key again. Throw a std::runtime_error if context
+     * is empty.
+     **/
+
+    explicit aead(context_type context)
+      : key_state_(std::move(context))
     {
-        sodium::aead_aesgcm_precomputed::init_ctx(key_state_.data(),
-                                                  key.data());
-        // XXX what do we do with key now? let it go out of scope?
+        if (!key_state_)
+            throw std::runtime_error{ "sodium::aead::aead() empty context" };
     }
 
-    // A copying constructor
-    aead(const aead& other)
-      : key_state_(other.key_state_)
-    {}
+    // A copying constructor: shares the (immutable) context of other
+    aead(const aead& other) = default;
 
     // A moving constructor
-    aead(aead&& other)
-      : key_state_(std::move(other.key_state_))
-    {}
+    aead(aead&& other) = default;
 
-    BT encrypt(const BT& header, const BT& plaintext, const nonce_type& nonce)
+    // the shared context of this aead
+    const context_type& context() const noexcept { return key_state_; }
+
+    BT encrypt(const BT& header,
+               const BT& plaintext,
+               const nonce_type& nonce) const
     {
         // make space for MAC and encrypted message, i.e. (MAC || encrypted)
         BT ciphertext(MACSIZE + plaintext.size());
@@ -379,7 +711,8 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
           header.size(),
           NULL /* nsec */,
           nonce.data(),
-          key_state_.data());
+          key_state_->data());
+        metrics::bytes_encrypted(plaintext.size());
         ciphertext.resize(static_cast<std::size_t>(clen));
 
         return ciphertext;
@@ -388,7 +721,7 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
     BT encrypt(const BT& header,
                const BT& plaintext,
                const nonce_type& nonce,
-               BT& mac)
+               BT& mac) const
     {
         // some sanity checks before we get started
         if (mac.size() != MACSIZE)
@@ -415,14 +748,15 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
           header.size(),
           NULL /* nsec */,
           nonce.data(),
-          key_state_.data());
+          key_state_->data());
+        metrics::bytes_encrypted(plaintext.size());
 
         return ciphertext;
     }
 
     BT decrypt(const BT& header,
                const BT& ciphertext_with_mac,
-               const nonce_type& nonce)
+               const nonce_type& nonce) const
     {
         // some sanity checks before we get started
         if (ciphertext_with_mac.size() < MACSIZE)
@@ -448,10 +782,13 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
                  : reinterpret_cast<const unsigned char*>(header.data())),
               header.size(),
               nonce.data(),
-              key_state_.data()) == -1)
+              key_state_->data()) == -1) {
+            metrics::mac_failure();
             throw std::runtime_error{ "sodium::aead::decrypt() can't decrypt "
                                       "or message/tag corrupt" };
+        }
         plaintext.resize(static_cast<std::size_t>(mlen));
+        metrics::bytes_decrypted(plaintext.size());
 
         return plaintext;
     }
@@ -459,7 +796,7 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
     BT decrypt(const BT& header,
                const BT& ciphertext,
                const nonce_type& nonce,
-               const BT& mac)
+               const BT& mac) const
     {
         // some sanity checks before we get started
         if (mac.size() != MACSIZE)
@@ -482,15 +819,257 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
                  : reinterpret_cast<const unsigned char*>(header.data())),
               header.size(),
               nonce.data(),
-              key_state_.data()) == -1)
+              key_state_->data()) == -1) {
+            metrics::mac_failure();
             throw std::runtime_error{ "sodium::aead::decrypt(detached) can't "
                                       "decrypt or message/tag corrupt" };
+        }
+        metrics::bytes_decrypted(plaintext.size());
+
+        return plaintext;
+    }
+
+    // Non-throwing variants, see the primary template above.
 
+    BT decrypt(const BT& header,
+               const BT& ciphertext_with_mac,
+               const nonce_type& nonce,
+               std::error_code& ec) const
+    {
+        if (ciphertext_with_mac.size() < MACSIZE) {
+            ec = errc::message_too_short;
+            return BT();
+        }
+
+        BT plaintext(ciphertext_with_mac.size() - MACSIZE);
+        if (decrypt(span<byte>(plaintext),
+                    span<const byte>(header),
+                    span<const byte>(ciphertext_with_mac),
+                    nonce) != 0) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
         return plaintext;
     }
 
+    BT decrypt(const BT& header,
+               const BT& ciphertext,
+               const nonce_type& nonce,
+               const BT& mac,
+               std::error_code& ec) const
+    {
+        if (mac.size() != MACSIZE) {
+            ec = errc::wrong_size;
+            return BT();
+        }
+
+        BT plaintext(ciphertext.size());
+        if (decrypt(span<byte>(plaintext),
+                    span<const byte>(header),
+                    span<const byte>(ciphertext),
+                    span<const byte>(mac),
+                    nonce) != 0) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
+        return plaintext;
+    }
+
+    // Allocation-free variants, see the primary template above.
+
+    /**
+     * Encrypt plaintext and store (MAC || ciphertext), exactly as
+     * returned by encrypt(header, plaintext, nonce), into the first
+     * MACSIZE + plaintext.size() bytes of ciphertext_with_mac.
+     *
+     * Return -1 if ciphertext_with_mac is too small.
+     **/
+
+    int encrypt(span<byte> ciphertext_with_mac,
+                span<const byte> header,
+                span<const byte> plaintext,
+                const nonce_type& nonce) const noexcept
+    {
+        if (ciphertext_with_mac.size() < MACSIZE + plaintext.size())
+            return -1;
+
+        unsigned long long clen;
+
+        if (sodium::aead_aesgcm_precomputed::encrypt(
+              ciphertext_with_mac.data(),
+              &clen,
+              plaintext.data(),
+              plaintext.size(),
+              (header.empty() ? nullptr : header.data()),
+              header.size(),
+              NULL /* nsec */,
+              nonce.data(),
+              key_state_->data()) != 0)
+            return -1;
+
+        metrics::bytes_encrypted(plaintext.size());
+        return 0;
+    }
+
+    /**
+     * Encrypt plaintext into ciphertext, which must be at least
+     * plaintext.size() bytes long, and store the MAC into mac, which
+     * must be exactly MACSIZE bytes long (detached mode).
+     **/
+
+    int encrypt(span<byte> ciphertext,
+                span<byte> mac,
+                span<const byte> header,
+                span<const byte> plaintext,
+                const nonce_type& nonce) const noexcept
+    {
+        if (mac.size() != MACSIZE || ciphertext.size() < plaintext.size())
+            return -1;
+
+        unsigned long long maclen;
+
+        if (sodium::aead_aesgcm_precomputed::encrypt_detached(
+              ciphertext.data(),
+              mac.data(),
+              &maclen,
+              plaintext.data(),
+              plaintext.size(),
+              (header.empty() ? nullptr : header.data()),
+              header.size(),
+              NULL /* nsec */,
+              nonce.data(),
+              key_state_->data()) != 0)
+            return -1;
+
+        metrics::bytes_encrypted(plaintext.size());
+        return 0;
+    }
+
+    /**
+     * Decrypt ciphertext_with_mac into the first
+     * ciphertext_with_mac.size() - MACSIZE bytes of plaintext.
+     *
+     * Return -1 if plaintext is too small, or if ciphertext_with_mac
+     * or header have been tampered with.
+     **/
+
+    int decrypt(span<byte> plaintext,
+                span<const byte> header,
+                span<const byte> ciphertext_with_mac,
+                const nonce_type& nonce) const noexcept
+    {
+        if (ciphertext_with_mac.size() < MACSIZE ||
+            plaintext.size() < ciphertext_with_mac.size() - MACSIZE)
+            return -1;
+
+        unsigned long long mlen;
+
+        if (sodium::aead_aesgcm_precomputed::decrypt(
+              plaintext.data(),
+              &mlen,
+              nullptr /* nsec */,
+              ciphertext_with_mac.data(),
+              ciphertext_with_mac.size(),
+              (header.empty() ? nullptr : header.data()),
+              header.size(),
+              nonce.data(),
+              key_state_->data()) != 0) {
+            metrics::mac_failure();
+            return -1;
+        }
+
+        metrics::bytes_decrypted(ciphertext_with_mac.size() - MACSIZE);
+        return 0;
+    }
+
+    /**
+     * Decrypt ciphertext into plaintext, which must be at least
+     * ciphertext.size() bytes long, verifying it against mac, which
+     * must be exactly MACSIZE bytes long (detached mode).
+     **/
+
+    int decrypt(span<byte> plaintext,
+                span<const byte> header,
+                span<const byte> ciphertext,
+                span<const byte> mac,
+                const nonce_type& nonce) const noexcept
+    {
+        if (mac.size() != MACSIZE || plaintext.size() < ciphertext.size())
+            return -1;
+
+        if (sodium::aead_aesgcm_precomputed::decrypt_detached(
+              plaintext.data(),
+              nullptr /* nsec */,
+              ciphertext.data(),
+              ciphertext.size(),
+              mac.data(),
+              (header.empty() ? nullptr : header.data()),
+              header.size(),
+              nonce.data(),
+              key_state_->data()) != 0) {
+            metrics::mac_failure();
+            return -1;
+        }
+
+        metrics::bytes_decrypted(ciphertext.size());
+        return 0;
+    }
+
+    // Padded variants, see the primary template above.
+
+    int encrypt_padded(span<byte> ciphertext_with_mac,
+                       span<const byte> header,
+                       span<const byte> plaintext,
+                       std::size_t blocksize,
+                       const nonce_type& nonce,
+                       std::size_t& ciphertext_len) const noexcept
+    {
+        if (ciphertext_with_mac.size() < MACSIZE ||
+            plaintext.size() > ciphertext_with_mac.size() - MACSIZE)
+            return -1;
+
+        span<byte> data =
+          ciphertext_with_mac.first(ciphertext_with_mac.size() - MACSIZE);
+        std::memmove(data.data(), plaintext.data(), plaintext.size());
+
+        std::size_t padded_len;
+        if (sodium::pad(data, plaintext.size(), blocksize, padded_len) != 0)
+            return -1;
+
+        data = data.first(padded_len);
+        span<byte> mac = ciphertext_with_mac.subspan(padded_len, MACSIZE);
+        if (encrypt(data, mac, header, data, nonce) != 0)
+            return -1;
+
+        ciphertext_len = padded_len + MACSIZE;
+        return 0;
+    }
+
+    int decrypt_padded(span<byte> plaintext,
+                       span<const byte> header,
+                       span<const byte> ciphertext_with_mac,
+                       std::size_t blocksize,
+                       const nonce_type& nonce,
+                       std::size_t& plaintext_len) const noexcept
+    {
+        if (decrypt(plaintext, header, ciphertext_with_mac, nonce) != 0)
+            return -1;
+
+        return sodium::unpad(
+          plaintext.first(ciphertext_with_mac.size() - MACSIZE),
+          blocksize,
+          plaintext_len);
+    }
+
   private:
-    aes_ctx key_state_;
+    context_type key_state_;
 };
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(aead);
+
 } // namespace sodium
@@ -0,0 +1,338 @@
+// aead_auto.h -- AEAD with the construction chosen at runtime
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead_traits.h"
+#include "common.h"
+#include "error.h"
+#include "key.h"
+#include "nonce.h"
+#include "span.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<typename BT = bytes>
+class aead_auto
+{
+    /**
+     * An aead_auto encrypts like sodium::aead<BT, F>, but chooses the
+     * construction F at runtime, so that one binary runs on all hosts:
+     *
+     *   - AES-256-GCM where it is hardware-accelerated (AES-NI and
+     *     PCLMUL, as reported by crypto_aead_aes256gcm_is_available()),
+     *   - XChaCha20-Poly1305-IETF everywhere else.
+     *
+     * The CPU is probed once, by the first call to preferred().
+     *
+     * Every ciphertext starts with a one-byte tag identifying the
+     * construction that produced it:
+     *
+     *   tag || (ciphertext || MAC)
+     *
+     * and decrypt() dispatches on that tag, so that hosts with and
+     * without AES-NI interoperate (XChaCha20 ciphertexts decrypt
+     * everywhere, AES-GCM ones only where AES-GCM is available). The
+     * tag itself needs no extra authentication (and is not part of the
+     * additional data, so that the span API stays allocation-free):
+     * changing it selects the other construction, whose MAC check
+     * then fails.
+     *
+     * Both constructions use 32 byte keys. The nonce has the 24 bytes
+     * of XChaCha20; AES-GCM only uses its first 12 bytes. Since a
+     * nonce is incremented little-endian, incrementing it for every
+     * message keeps those 12 bytes unique too. Don't use random
+     * nonces if AES-GCM may be chosen: 96 bits are too short for that.
+     **/
+
+  public:
+    enum class algorithm : std::uint8_t
+    {
+        xchacha20_poly1305_ietf = aead_traits<aead_xchacha20_poly1305_ietf>::id,
+        aesgcm = aead_traits<aead_aesgcm>::id
+    };
+
+    static constexpr std::size_t KEYSIZE =
+      aead_xchacha20_poly1305_ietf::KEYBYTES;
+    static constexpr std::size_t NONCESIZE =
+      aead_xchacha20_poly1305_ietf::NPUBBYTES;
+    static constexpr std::size_t MACSIZE = aead_xchacha20_poly1305_ietf::ABYTES;
+    static constexpr std::size_t TAGSIZE = 1;
+
+    static_assert(aead_aesgcm::KEYBYTES == KEYSIZE, "key sizes differ");
+    static_assert(aead_aesgcm::ABYTES == MACSIZE, "MAC sizes differ");
+    static_assert(aead_aesgcm::NPUBBYTES <= NONCESIZE, "nonce too short");
+
+    using bytes_type = BT;
+    using key_type = key<KEYSIZE>;
+    using shared_key_type = shared_key<KEYSIZE>;
+    using nonce_type = nonce<NONCESIZE>;
+
+    /**
+     * The construction chosen for this host: the CPU features are
+     * probed once per process by sodium::runtime.
+     **/
+
+    static algorithm preferred()
+    {
+        static const algorithm chosen = aead_traits<aead_aesgcm>::available()
+                                          ? algorithm::aesgcm
+                                          : algorithm::xchacha20_poly1305_ietf;
+        return chosen;
+    }
+
+    // Can this host use construction a?
+    static bool available(algorithm a)
+    {
+        return a == algorithm::xchacha20_poly1305_ietf ||
+               (a == algorithm::aesgcm && preferred() == algorithm::aesgcm);
+    }
+
+    static const char* name(algorithm a)
+    {
+        return a == algorithm::aesgcm
+                 ? aead_traits<aead_aesgcm>::name
+                 : aead_traits<aead_xchacha20_poly1305_ietf>::name;
+    }
+
+    /**
+     * An aead_auto with key, that encrypts with the construction a
+     * (by default, the preferred() one of this host). The key is
+     * copied once into an immutable shared key (moved, if it is an
+     * rvalue), which copies of this aead_auto share.
+     *
+     * Throw a std::runtime_error if a isn't available on this host.
+     **/
+
+    aead_auto(const key_type& key, algorithm a = preferred())
+      : aead_auto(make_shared_key(key), a)
+    {}
+
+    aead_auto(key_type&& key, algorithm a = preferred())
+      : aead_auto(make_shared_key(std::move(key)), a)
+    {}
+
+    /**
+     * An aead_auto sharing the immutable key of other wrappers, see
+     * make_shared_key(). Throw a std::runtime_error if key is empty,
+     * or if a isn't available on this host.
+     **/
+
+    explicit aead_auto(shared_key_type key, algorithm a = preferred())
+      : key_{ std::move(key) }
+      , algorithm_{ a }
+    {
+        if (!key_)
+            throw std::runtime_error{ "sodium::aead_auto::aead_auto() "
+                                      "empty key" };
+        if (!available(a))
+            throw std::runtime_error{
+                "sodium::aead_auto::aead_auto() algorithm not available"
+            };
+    }
+
+    // the shared key of this aead_auto
+    const shared_key_type& key_handle() const noexcept { return key_; }
+
+    // the construction used by encrypt()
+    algorithm chosen() const { return algorithm_; }
+
+    /**
+     * Encrypt plaintext with the chosen construction, and return
+     * tag || (ciphertext || MAC), of size
+     *    TAGSIZE + MACSIZE + plaintext.size()
+     * bytes. The MAC covers header as well, as in sodium::aead.
+     **/
+
+    BT encrypt(const BT& header,
+               const BT& plaintext,
+               const nonce_type& nonce) const
+    {
+        BT ciphertext(TAGSIZE + MACSIZE + plaintext.size());
+        span<byte> out(ciphertext);
+        if (encrypt(out, header, plaintext, nonce) != 0)
+            throw std::runtime_error{
+                "sodium::aead_auto::encrypt() can't encrypt"
+            };
+        return ciphertext; // by move semantics
+    }
+
+    /**
+     * Decrypt tag || (ciphertext || MAC) with the construction of its
+     * tag, and return the plaintext.
+     *
+     * Throw a std::runtime_error if the tag is unknown, or names a
+     * construction that isn't available on this host, or if the
+     * ciphertext, tag, or header have been tampered with.
+     **/
+
+    BT decrypt(const BT& header,
+               const BT& ciphertext_with_tag,
+               const nonce_type& nonce) const
+    {
+        if (ciphertext_with_tag.size() < TAGSIZE + MACSIZE)
+            throw std::runtime_error{
+                "sodium::aead_auto::decrypt() ciphertext too small"
+            };
+
+        BT plaintext(ciphertext_with_tag.size() - TAGSIZE - MACSIZE);
+        span<byte> out(plaintext);
+        if (decrypt(out, header, ciphertext_with_tag, nonce) != 0)
+            throw std::runtime_error{ "sodium::aead_auto::decrypt() can't "
+                                      "decrypt or message/tag corrupt" };
+        return plaintext; // by move semantics
+    }
+
+    /**
+     * Non-throwing variant of decrypt() above: instead of throwing a
+     * std::runtime_error, set ec to sodium::errc::message_too_short or
+     * sodium::errc::verification_failed (which includes an unknown or
+     * unavailable tag), and return an empty BT. See error.h.
+     **/
+
+    BT decrypt(const BT& header,
+               const BT& ciphertext_with_tag,
+               const nonce_type& nonce,
+               std::error_code& ec) const
+    {
+        if (ciphertext_with_tag.size() < TAGSIZE + MACSIZE) {
+            ec = errc::message_too_short;
+            return BT();
+        }
+
+        BT plaintext(ciphertext_with_tag.size() - TAGSIZE - MACSIZE);
+        span<byte> out(plaintext);
+        if (decrypt(out, header, ciphertext_with_tag, nonce) != 0) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
+        return plaintext;
+    }
+
+    /**
+     * Allocation-free variants of encrypt() and decrypt(), with the
+     * same conventions as the span API of sodium::aead: they return 0
+     * on success, and -1 on failure, including an unknown or
+     * unavailable tag.
+     **/
+
+    int encrypt(span<byte> ciphertext_with_tag,
+                span<const byte> header,
+                span<const byte> plaintext,
+                const nonce_type& nonce) const noexcept
+    {
+        if (ciphertext_with_tag.size() < TAGSIZE + MACSIZE + plaintext.size())
+            return -1;
+
+        ciphertext_with_tag[0] = static_cast<byte>(algorithm_);
+        return dispatch(algorithm_, [&](auto f) {
+            return seal(f,
+                        ciphertext_with_tag.data() + TAGSIZE,
+                        header,
+                        plaintext,
+                        nonce);
+        });
+    }
+
+    int decrypt(span<byte> plaintext,
+                span<const byte> header,
+                span<const byte> ciphertext_with_tag,
+                const nonce_type& nonce) const noexcept
+    {
+        if (ciphertext_with_tag.size() < TAGSIZE + MACSIZE ||
+            plaintext.size() < ciphertext_with_tag.size() - TAGSIZE - MACSIZE)
+            return -1;
+
+        const algorithm a = static_cast<algorithm>(ciphertext_with_tag[0]);
+        if ((a != algorithm::xchacha20_poly1305_ietf &&
+             a != algorithm::aesgcm) ||
+            !available(a))
+            return -1;
+
+        return dispatch(a, [&](auto f) {
+            return open(f,
+                        plaintext.data(),
+                        header,
+                        ciphertext_with_tag.subspan(
+                          TAGSIZE, ciphertext_with_tag.size() - TAGSIZE),
+                        nonce);
+        });
+    }
+
+  private:
+    template<typename Fn>
+    static int dispatch(algorithm a, Fn fn)
+    {
+        if (a == algorithm::aesgcm)
+            return fn(aead_aesgcm());
+        return fn(aead_xchacha20_poly1305_ietf());
+    }
+
+    template<typename F>
+    int seal(F,
+             byte* out,
+             span<const byte> header,
+             span<const byte> plaintext,
+             const nonce_type& nonce) const noexcept
+    {
+        unsigned long long clen;
+        return F::encrypt(out,
+                          &clen,
+                          plaintext.data(),
+                          plaintext.size(),
+                          (header.empty() ? nullptr : header.data()),
+                          header.size(),
+                          NULL /* nsec */,
+                          nonce.data(),
+                          key_->data());
+    }
+
+    template<typename F>
+    int open(F,
+             byte* out,
+             span<const byte> header,
+             span<const byte> ciphertext,
+             const nonce_type& nonce) const noexcept
+    {
+        unsigned long long mlen;
+        return F::decrypt(out,
+                          &mlen,
+                          nullptr /* nsec */,
+                          ciphertext.data(),
+                          ciphertext.size(),
+                          (header.empty() ? nullptr : header.data()),
+                          header.size(),
+                          nonce.data(),
+                          key_->data());
+    }
+
+    shared_key_type key_;
+    algorithm algorithm_;
+};
+
+} // namespace sodium
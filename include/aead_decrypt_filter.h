@@ -21,8 +21,10 @@
 
 #include "aead.h"
 #include "common.h"
+#include "filter_profile.h"
 #include "key.h"
 #include "nonce.h"
+#include "trace.h"
 
 #include <boost/iostreams/categories.hpp>       // tags
 #include <boost/iostreams/filter/aggregate.hpp> // aggregate_filter
@@ -31,10 +33,7 @@
 #include <sodium.h>
 #include <stdexcept>
 
-#ifndef NDEBUG
-#include <iostream>
 #include <string>
-#endif // ! NDEBUG
 
 namespace io = boost::iostreams;
 
@@ -150,12 +149,11 @@ class aead_decrypt_filter : public io::aggregate_filter<char>
   private:
     virtual void do_filter(const vector_type& src, vector_type& dest)
     {
+        SODIUM_PROFILE_SPAN("aead_decrypt_filter", src.size());
 
-#ifndef NDEBUG
-        std::string src_string{ src.cbegin(), src.cend() };
-        std::cerr << "aead_decrypt_filter::do_filter(" << src_string
-                  << ") called" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::aead_decrypt_filter::do_filter()",
+                     "(" << std::string(src.cbegin(), src.cend())
+                         << ") called");
 
         try {
             if (src.size() < MACSIZE)
@@ -173,20 +171,15 @@ class aead_decrypt_filter : public io::aggregate_filter<char>
             error_message.append(
               "\nsodium::aead_decrypt_filter::do_filter() can't decrypt");
 
-#ifndef NDEBUG
-            std::cerr << "sodium::aead_decrypt_filter::do_filter() "
-                      << "throwing exception {" << error_message << "}"
-                      << std::endl;
-#endif // ! NDEBUG
+            SODIUM_TRACE("sodium::aead_decrypt_filter::do_filter()",
+                         "throwing exception {" << error_message << "}");
 
             throw std::ios_base::failure(error_message);
         }
 
-#ifndef NDEBUG
-        std::string dest_string{ dest.cbegin(), dest.cend() };
-        std::cerr << "aead_decrypt_filter::do_filter() returned {"
-                  << dest_string << "}" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::aead_decrypt_filter::do_filter()",
+                     "returned {" << std::string(dest.cbegin(), dest.cend())
+                                  << "}");
     }
 
   private:
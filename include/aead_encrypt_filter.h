@@ -21,18 +21,16 @@
 
 #include "aead.h"
 #include "common.h"
+#include "filter_profile.h"
 #include "key.h"
 #include "nonce.h"
+#include "trace.h"
 
 #include <boost/iostreams/categories.hpp>       // tags
 #include <boost/iostreams/filter/aggregate.hpp> // aggregate_filter
 
 #include <sodium.h>
 
-#ifndef NDEBUG
-#include <iostream>
-#endif // ! NDEBUG
-
 namespace io = boost::iostreams;
 
 namespace sodium {
@@ -41,6 +39,10 @@ class aead_encrypt_filter : public io::aggregate_filter<char>
 {
 
     /**
+     * Being an aggregate_filter, aead_encrypt_filter holds the whole
+     * stream in memory until close(). For big streams, use the chunked
+     * sodium::secretstream_encrypt_filter instead.
+     *
      * Use aead_encrypt_filter as a DualUse filter like this:
      *
      *     #include <boost/iostreams/device/array.hpp>
@@ -138,10 +140,9 @@ class aead_encrypt_filter : public io::aggregate_filter<char>
   private:
     virtual void do_filter(const vector_type& src, vector_type& dest)
     {
+        SODIUM_PROFILE_SPAN("aead_encrypt_filter", src.size());
 
-#ifndef NDEBUG
-        std::cerr << "aead_encrypt_filter::do_filter() called" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::aead_encrypt_filter::do_filter()", "called");
 
         // compute (MAC || ciphertext)
         vector_type ciphertext_with_mac{ aead_.encrypt(header_, src, nonce_) };
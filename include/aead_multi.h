@@ -0,0 +1,350 @@
+// aead_multi.h -- Batches of independent AEAD (key, nonce, message) lanes
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead_aesgcm.h"
+#include "aead_aesgcm_precomputed.h"
+#include "aead_traits.h"
+#include "common.h"
+#include "key.h"
+#include "metrics.h"
+#include "nonce.h"
+#include "span.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <type_traits>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<typename F = sodium::aead_chacha20_poly1305_ietf,
+         typename T = typename std::enable_if<
+           sodium::is_aead<F> &&
+             !std::is_same<F, sodium::aead_aesgcm_precomputed>::value,
+           int>::type>
+class aead_multi
+{
+    /**
+     * sodium::aead_multi<F> encrypts or decrypts a batch of
+     * independent lanes, each with its own key, nonce, header and
+     * message, in one call. It is meant for many small messages (say,
+     * 64-512 bytes), where the cost around the AEAD call dominates.
+     *
+     * The output of a lane is exactly that of the allocation-free
+     * sodium::aead<BT, F>::encrypt(ciphertext_with_mac, header,
+     * plaintext, nonce) with the same key, and vice versa, so lanes
+     * interoperate with aead<> messages.
+     *
+     * What a batch saves:
+     *   - the arguments of all lanes are checked once, up front, so
+     *     that the loop is nothing but AEAD calls; nothing is
+     *     allocated, and the metrics are updated once per batch.
+     *   - the input of the next lane is prefetched while the current
+     *     one is processed.
+     *   - with F = aead_aesgcm, the AES key schedule and the GHASH
+     *     powers (crypto_aead_aes256gcm_beforenm()) are computed once
+     *     per run of adjacent lanes with the same key object, instead
+     *     of once per message as crypto_aead_aes256gcm_encrypt() does:
+     *     point those lanes to the same key_type, and keep them next
+     *     to each other.
+     *   - large batches can be split across a sodium::thread_pool.
+     *
+     * libsodium already runs ChaCha20 on several blocks of a message
+     * at once with SIMD, but has no API for spreading the blocks of
+     * different messages across SIMD lanes; doing that would need a
+     * ChaCha20/Poly1305 of our own, which this library doesn't do.
+     * For ChaCha20-Poly1305, a batch therefore saves the overhead
+     * around the calls, not inside them.
+     *
+     * For aead_aesgcm_precomputed, use aead_aesgcm: the batch does
+     * the precomputation itself.
+     **/
+
+  public:
+    static constexpr std::size_t NONCESIZE = aead_traits<F>::NPUBBYTES;
+    static constexpr std::size_t KEYSIZE = aead_traits<F>::KEYBYTES;
+    static constexpr std::size_t MACSIZE = aead_traits<F>::ABYTES;
+
+    using key_type = key<KEYSIZE>;
+    using nonce_type = nonce<NONCESIZE>;
+
+    /**
+     * One message of a batch. key and nonce must not be nullptr, and
+     * must stay valid for the duration of the call. input is the
+     * plaintext (encrypt) or the ciphertext with MAC (decrypt), and
+     * output must have room for the ciphertext with MAC
+     * (input.size() + MACSIZE bytes) or the plaintext
+     * (input.size() - MACSIZE bytes). Input and output may be the
+     * same memory (in-place), but must not partially overlap.
+     **/
+
+    struct lane_type
+    {
+        const key_type* key;
+        const nonce_type* nonce;
+        span<const byte> header;
+        span<const byte> input;
+        span<byte> output;
+    };
+
+    // batches split across a thread_pool have at least this many lanes
+    static constexpr std::size_t PARALLEL_BATCHSIZE = 256;
+
+    /**
+     * Encrypt all lanes.
+     *
+     * Return 0 on success, or -1 if a lane has invalid arguments
+     * (before encrypting anything), if F isn't available on this host,
+     * or if encryption fails.
+     **/
+
+    static int encrypt(span<const lane_type> lanes) noexcept
+    {
+        if (!valid(lanes, true))
+            return -1;
+        return encrypt_range(lanes, 0, lanes.size());
+    }
+
+    /**
+     * Decrypt all lanes, and set verified[i] to 1 if lane i
+     * authenticated, or to 0 if it didn't; verified must have
+     * lanes.size() bytes. The output of a lane that doesn't
+     * authenticate is unspecified.
+     *
+     * Return 0 if all lanes authenticated, or -1 if at least one
+     * didn't, or if the arguments are invalid (before decrypting
+     * anything, and without setting verified).
+     **/
+
+    static int decrypt(span<const lane_type> lanes,
+                       span<byte> verified) noexcept
+    {
+        if (verified.size() != lanes.size() || !valid(lanes, false))
+            return -1;
+        return decrypt_range(lanes, verified, 0, lanes.size());
+    }
+
+    /**
+     * Same as encrypt(lanes), but with batches of at least
+     * PARALLEL_BATCHSIZE lanes split in one contiguous range per
+     * worker thread of pool. Smaller batches are encrypted on the
+     * calling thread.
+     **/
+
+    static int encrypt(span<const lane_type> lanes, thread_pool& pool)
+    {
+        if (!valid(lanes, true))
+            return -1;
+        return split(lanes.size(), pool, [=](std::size_t f, std::size_t l) {
+            return encrypt_range(lanes, f, l);
+        });
+    }
+
+    // Same as decrypt(lanes, verified), split across pool
+    static int decrypt(span<const lane_type> lanes,
+                       span<byte> verified,
+                       thread_pool& pool)
+    {
+        if (verified.size() != lanes.size() || !valid(lanes, false))
+            return -1;
+        return split(lanes.size(), pool, [=](std::size_t f, std::size_t l) {
+            return decrypt_range(lanes, verified, f, l);
+        });
+    }
+
+  private:
+    static constexpr bool expands_key =
+      std::is_same<F, sodium::aead_aesgcm>::value;
+
+    static bool valid(span<const lane_type> lanes, bool encrypting) noexcept
+    {
+        if (!aead_traits<F>::available())
+            return false;
+
+        for (const lane_type& lane : lanes) {
+            if (lane.key == nullptr || lane.nonce == nullptr)
+                return false;
+            const std::size_t in = lane.input.size();
+            if (encrypting ? lane.output.size() < in + MACSIZE
+                           : in < MACSIZE || lane.output.size() < in - MACSIZE)
+                return false;
+        }
+        return true;
+    }
+
+    static void prefetch(span<const lane_type> lanes, std::size_t i) noexcept
+    {
+#if defined(__GNUC__)
+        if (i < lanes.size()) {
+            __builtin_prefetch(lanes[i].input.data());
+            __builtin_prefetch(lanes[i].key->data());
+        }
+#else
+        (void)lanes;
+        (void)i;
+#endif
+    }
+
+    /**
+     * Call op(lane, i, g, k) for the lanes [first, last), where g is
+     * a G{} to call G::encrypt(..., k) / G::decrypt(..., k) with: F
+     * with the raw key, or aead_aesgcm_precomputed with the expanded
+     * key of the lane for F = aead_aesgcm. Return -1 if any op()
+     * returned non-zero.
+     **/
+
+    template<typename Op>
+    static int for_each(span<const lane_type> lanes,
+                        std::size_t first,
+                        std::size_t last,
+                        Op op) noexcept
+    {
+        int rc = 0;
+
+        if constexpr (expands_key) {
+            alignas(16) aead_aesgcm_precomputed::ctx_type ctx;
+            const key_type* expanded = nullptr;
+
+            for (std::size_t i = first; i != last; ++i) {
+                prefetch(lanes, i + 1);
+                const lane_type& lane = lanes[i];
+                if (lane.key != expanded) {
+                    aead_aesgcm_precomputed::init_ctx(&ctx, lane.key->data());
+                    expanded = lane.key;
+                }
+                if (op(lane, i, aead_aesgcm_precomputed{}, &ctx) != 0)
+                    rc = -1;
+            }
+            sodium_memzero(&ctx, sizeof ctx);
+        } else {
+            for (std::size_t i = first; i != last; ++i) {
+                prefetch(lanes, i + 1);
+                const lane_type& lane = lanes[i];
+                if (op(lane, i, F{}, lane.key->data()) != 0)
+                    rc = -1;
+            }
+        }
+
+        return rc;
+    }
+
+    static int encrypt_range(span<const lane_type> lanes,
+                             std::size_t first,
+                             std::size_t last) noexcept
+    {
+        std::size_t total = 0;
+        const int rc = for_each(
+          lanes,
+          first,
+          last,
+          [&total](const lane_type& lane, std::size_t, auto g, const auto* k) {
+              unsigned long long clen;
+              total += lane.input.size();
+              return decltype(g)::encrypt(
+                lane.output.data(),
+                &clen,
+                lane.input.data(),
+                lane.input.size(),
+                (lane.header.empty() ? nullptr : lane.header.data()),
+                lane.header.size(),
+                nullptr /* nsec */,
+                lane.nonce->data(),
+                k);
+          });
+
+        metrics::bytes_encrypted(total);
+        return rc;
+    }
+
+    static int decrypt_range(span<const lane_type> lanes,
+                             span<byte> verified,
+                             std::size_t first,
+                             std::size_t last) noexcept
+    {
+        std::size_t total = 0;
+        const int rc = for_each(
+          lanes,
+          first,
+          last,
+          [&total, verified](
+            const lane_type& lane, std::size_t i, auto g, const auto* k) {
+              unsigned long long mlen;
+              const int ok = decltype(g)::decrypt(
+                               lane.output.data(),
+                               &mlen,
+                               nullptr /* nsec */,
+                               lane.input.data(),
+                               lane.input.size(),
+                               (lane.header.empty() ? nullptr
+                                                    : lane.header.data()),
+                               lane.header.size(),
+                               lane.nonce->data(),
+                               k) == 0;
+              verified[i] = ok ? 1 : 0;
+              if (ok)
+                  total += lane.input.size() - MACSIZE;
+              else
+                  metrics::mac_failure();
+              return ok ? 0 : -1;
+          });
+
+        metrics::bytes_decrypted(total);
+        return rc;
+    }
+
+    // run range(first, last) on one contiguous range per worker
+    template<typename Range>
+    static int split(std::size_t n, thread_pool& pool, Range range)
+    {
+        if (n < PARALLEL_BATCHSIZE || pool.size() < 2)
+            return range(0, n);
+
+        const std::size_t nranges = std::min<std::size_t>(pool.size(), n);
+        std::vector<std::future<int>> results;
+        results.reserve(nranges);
+        int rc = 0;
+        try {
+            for (std::size_t r = 0; r != nranges; ++r) {
+                const std::size_t first = n * r / nranges;
+                const std::size_t last = n * (r + 1) / nranges;
+                results.push_back(
+                  pool.submit([=] { return range(first, last); }));
+            }
+
+            for (auto& result : results)
+                if (pool.get(result) != 0)
+                    rc = -1;
+        } catch (...) {
+            // the pending ranges write into the caller's lanes: let them
+            // finish
+            for (auto& result : results)
+                if (result.valid())
+                    pool.wait(result);
+            throw;
+        }
+        return rc;
+    }
+};
+
+} // namespace sodium
@@ -0,0 +1,190 @@
+// aead_traits.h -- Compile-time registry of AEAD and secretstream algorithms
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead_aesgcm.h"
+#include "aead_aesgcm_precomputed.h"
+#include "aead_chacha20_poly1305.h"
+#include "aead_chacha20_poly1305_ietf.h"
+#include "aead_xchacha20_poly1305_ietf.h"
+#include "runtime.h"
+#include "secretstream_xchacha20_poly1305.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * sodium::aead_traits<F> describes the AEAD construction F at compile
+ * time. sodium::aead<BT, F> accepts exactly those F for which it is
+ * registered (is_aead<F>), and generic code (stream cryptors,
+ * benchmarks, dispatchers, ...) can be written once against it and
+ * specialised for every construction:
+ *
+ *   NPUBBYTES, KEYBYTES, ABYTES  the nonce, key and MAC sizes
+ *   name                         F::construction_name
+ *   id                           the algorithm id of on-disk formats
+ *                                (see seekable_container.h), or 0
+ *   BLOCKSIZE                    a preferred plaintext size for
+ *                                chunking streams
+ *   random_nonces                whether nonces are long enough to be
+ *                                chosen at random for one key
+ *   supports_precomputed         whether F encrypts with an expanded
+ *                                key context instead of the raw key
+ *   hw_accelerated               whether F needs (and uses) dedicated
+ *                                CPU instructions
+ *   available()                  whether F can be used on this host,
+ *                                as probed once by sodium::runtime
+ *
+ * To register a new construction F, specialise aead_traits<F>,
+ * typically by deriving from aead_traits_base<F> and overriding the
+ * capabilities that differ:
+ *
+ *   template<>
+ *   struct aead_traits<my_aead> : aead_traits_base<my_aead>
+ *   {
+ *       static constexpr bool random_nonces = true;
+ *   };
+ **/
+
+template<typename F>
+struct aead_traits
+{
+    static constexpr bool registered = false;
+};
+
+template<typename F>
+struct aead_traits_base
+{
+    static constexpr bool registered = true;
+
+    static constexpr std::size_t NPUBBYTES = F::NPUBBYTES;
+    static constexpr std::size_t KEYBYTES = F::KEYBYTES;
+    static constexpr std::size_t ABYTES = F::ABYTES;
+    static constexpr std::size_t BLOCKSIZE = 64 * 1024;
+
+    static constexpr const char* name = F::construction_name;
+    static constexpr std::uint8_t id = 0;
+
+    static constexpr bool random_nonces = false;
+    static constexpr bool supports_precomputed = false;
+    static constexpr bool hw_accelerated = false;
+
+    static bool available() noexcept { return true; }
+};
+
+template<>
+struct aead_traits<aead_chacha20_poly1305>
+  : aead_traits_base<aead_chacha20_poly1305>
+{
+    static constexpr std::uint8_t id = 1;
+};
+
+template<>
+struct aead_traits<aead_chacha20_poly1305_ietf>
+  : aead_traits_base<aead_chacha20_poly1305_ietf>
+{
+    static constexpr std::uint8_t id = 2;
+};
+
+template<>
+struct aead_traits<aead_xchacha20_poly1305_ietf>
+  : aead_traits_base<aead_xchacha20_poly1305_ietf>
+{
+    static constexpr std::uint8_t id = 3;
+    static constexpr bool random_nonces = true; // 192 bits
+};
+
+template<>
+struct aead_traits<aead_aesgcm> : aead_traits_base<aead_aesgcm>
+{
+    static constexpr std::uint8_t id = 4;
+    static constexpr bool hw_accelerated = true; // AES-NI and PCLMUL
+
+    // probed once per process, see sodium::runtime
+    static bool available() noexcept
+    {
+        return runtime::instance().cpu().aes256gcm;
+    }
+};
+
+// same construction as aead_aesgcm, but with a different API: no id
+template<>
+struct aead_traits<aead_aesgcm_precomputed>
+  : aead_traits_base<aead_aesgcm_precomputed>
+{
+    static constexpr bool supports_precomputed = true;
+    static constexpr bool hw_accelerated = true;
+
+    static bool available() noexcept
+    {
+        return crypto_aead_aes256gcm_is_available() == 1;
+    }
+};
+
+// Is F a registered AEAD construction?
+template<typename F>
+constexpr bool is_aead = aead_traits<F>::registered;
+
+/**
+ * sodium::secretstream_traits<F> is the same kind of registry for the
+ * secretstream constructions of sodium::secretstream<BT, F>:
+ *
+ *   KEYBYTES, ABYTES, HEADERBYTES   the key, MAC and header sizes
+ *   MESSAGEBYTES_MAX                the maximum size of one message
+ *   name                            F::construction_name
+ *   BLOCKSIZE                       a preferred message size
+ *   available()                     whether F can be used on this host
+ **/
+
+template<typename F>
+struct secretstream_traits
+{
+    static constexpr bool registered = false;
+};
+
+template<typename F>
+struct secretstream_traits_base
+{
+    static constexpr bool registered = true;
+
+    static constexpr std::size_t KEYBYTES = F::KEYBYTES;
+    static constexpr std::size_t ABYTES = F::ABYTES;
+    static constexpr std::size_t HEADERBYTES = F::HEADERBYTES;
+    static constexpr std::size_t MESSAGEBYTES_MAX = F::MESSAGEBYTES_MAX;
+    static constexpr std::size_t BLOCKSIZE = 64 * 1024;
+
+    static constexpr const char* name = F::construction_name;
+
+    static bool available() noexcept { return true; }
+};
+
+template<>
+struct secretstream_traits<secretstream_xchacha20_poly1305>
+  : secretstream_traits_base<secretstream_xchacha20_poly1305>
+{};
+
+// Is F a registered secretstream construction?
+template<typename F>
+constexpr bool is_secretstream = secretstream_traits<F>::registered;
+
+} // namespace sodium
@@ -26,6 +26,18 @@ namespace sodium {
 
 class aes_ctx
 {
+    /**
+     * A sodium::aes_ctx holds a crypto_aead_aes256gcm_state, i.e. an
+     * expanded AES-256-GCM key, in 16-bytes aligned protected memory.
+     *
+     * Once initialized (see aead_aesgcm_precomputed::init_ctx()), the
+     * state is only ever read by the *_afternm() functions. After
+     * readonly(), a const aes_ctx can therefore be shared by many
+     * threads without locking, e.g. through a
+     * std::shared_ptr<const aes_ctx>, as done by
+     * sodium::aead<BT, aead_aesgcm_precomputed>.
+     **/
+
   public:
     using ctx_type = crypto_aead_aes256gcm_state;
     const std::size_t ctx_size = sizeof(ctx_type);
@@ -44,8 +56,21 @@ class aes_ctx
         return retval;
     }
 
+    const ctx_type* data() const
+    {
+        return reinterpret_cast<const ctx_type*>(ctx_.data());
+    }
+
     std::size_t size() const { return ctx_.size(); }
 
+    /**
+     * Make the state read-only, once it has been initialized.
+     *
+     * Throw a std::runtime_error if the underlying mprotect() failed.
+     **/
+
+    void readonly() { ctx_.get_allocator().readonly(ctx_.data()); }
+
   private:
     alignas(16) bytes_protected ctx_;
 };
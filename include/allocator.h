@@ -17,27 +17,31 @@
 // OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
 // Uncommend the following #define line, or pass it via command line
-// if you want (additional) calls to sodium_init() in sodium::allocator's
-// ctor.
+// if you want sodium::allocator's ctor to make sure that libsodium
+// has been initialized, via sodium::runtime::ensure() (see runtime.h):
+// sodium_init() is then called once per process, and each further
+// construction only checks a thread_local flag.
 //
-// This is normally unnecessary if you call sodium_init() in your
-// program before using libsodium or its wrapper(s). It is also
-// not necessary in the unit tests, since sodium_init() is normally
-// invoked in the test harness there, before the tests start.
+// This is normally unnecessary if you call sodium_init() (or
+// sodium::runtime::init()) in your program before using libsodium or
+// its wrapper(s). It is also not necessary in the unit tests, since
+// sodium_init() is normally invoked in the test harness there, before
+// the tests start.
 //
 // #define SODIUM_INIT_IN_ALLOCATOR
 
 #pragma once
 
+#include "metrics.h"
+#include "mlock_budget.h"
+#include "runtime.h"
+#include "trace.h"
+
 #include <sodium.h>
 
 #include <new>
 #include <stdexcept>
 
-#ifndef NDEBUG
-#include <iostream>
-#endif // ! NDEBUG
-
 /**
  * This custom allocator doles out "secure memory" using libsodium's
  * malloc*() utility functions.  The idea is to store sensitive key
@@ -47,14 +51,18 @@
  *
  * We implement a custom allocator template and override:
  *
- *   - the constructor, to initialize sodium_init()... once more,
- *     just to be safe
+ *   - the constructor, to make sure that sodium_init() has been
+ *     called, just to be safe
  *     (only if SODIUM_INIT_IN_ALLOCATOR is #define(d))
  *   - allocate(), to grab mprotected memory for num T elements
  *     using sodium_allocarray()
  *   - deallocate(), to release and zero memory automatically
  *     using sodium_free()
  *
+ * The memory is accounted for as locked lock_priority::key memory in
+ * the process-wide sodium::mlock_budget (see mlock_budget.h): it always
+ * stays locked, and takes precedence over bulk buffers.
+ *
  * Furthermore, we provide 3 additional functions not part of the
  * usual allocator interface, to manipulate the access rights of
  * the virtual page where the ptr points into:
@@ -78,20 +86,17 @@ class allocator
     using value_type = T;
 
     /**
-     * Initialize the libsodium library by calling sodium_init()
-     * at least once.  We throw a std::runtime_error if the library
+     * Initialize the libsodium library, once per process (see
+     * sodium::runtime).  We throw a std::runtime_error if the library
      * can't be initialized.
      **/
 
     allocator()
     {
 #ifdef SODIUM_INIT_IN_ALLOCATOR
-        // safe to call sodium_init() more than once, but must be called
-        // at least once before using other libsodium functions.
-        if (sodium_init() == -1)
-            throw std::runtime_error{
-                "sodium::allocator::allocator() can't sodium_init()"
-            };
+        // must be called at least once before using other libsodium
+        // functions; only the first call per thread costs anything.
+        runtime::ensure();
 #endif // SODIUM_INIT_IN_ALLOCATOR
     }
 
@@ -116,23 +121,24 @@ class allocator
 
     T* allocate(std::size_t num)
     {
-#ifndef NDEBUG
-        std::cerr << "DEBUG: sodium::allocator::allocate(" << num << ") -> ";
-#endif // ! NDEBUG
-
-        // XXX slowly increase num until we reach at least 64 bytes
-        // while (num * sizeof(T) <= 64) ++num;
+        // Rounding small requests up (to e.g. 64 bytes) wouldn't save
+        // anything, as each one gets its own pages anyway. Many small
+        // keys are better off in sodium::small_bytes_protected<> or
+        // sodium::bytes_pooled, which share one mapping per slab, see
+        // small_bytes.h.
 
         void* ptr = sodium_allocarray(num, sizeof(T));
 
-#ifndef NDEBUG
-        std::cerr << static_cast<void*>(ptr) << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::allocator::allocate()",
+                     "[num=" << num << "] -> " << ptr);
 
         if (ptr == NULL)
             throw std::bad_alloc{};
-        else
-            return static_cast<T*>(ptr);
+
+        mlock_budget::instance().acquire(
+          mlock_budget::locked_size(num * sizeof(T)), lock_priority::key);
+        metrics::allocated(num * sizeof(T));
+        return static_cast<T*>(ptr);
     }
 
     /**
@@ -147,19 +153,15 @@ class allocator
      *
      **/
 
-    void deallocate(T* ptr,
-#ifndef NDEBUG
-                    std::size_t num)
-#else
-                    std::size_t /* num */)
-#endif // ! NDEBUG
+    void deallocate(T* ptr, std::size_t num)
     {
-#ifndef NDEBUG
-        std::cerr << "DEBUG: sodium::allocator::deallocate("
-                  << static_cast<void*>(ptr) << ", " << num << ")" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::allocator::deallocate()",
+                     "[ptr=" << static_cast<void*>(ptr) << ", num=" << num
+                             << "]");
 
         sodium_free(ptr);
+        mlock_budget::instance().release(
+          mlock_budget::locked_size(num * sizeof(T)), lock_priority::key);
     }
 
     /**
@@ -173,10 +175,8 @@ class allocator
      **/
     void noaccess(T* ptr)
     {
-#ifndef NDEBUG
-        std::cerr << "DEBUG: sodium::allocator::noaccess("
-                  << static_cast<void*>(ptr) << ")" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::allocator::noaccess()",
+                     "[ptr=" << static_cast<void*>(ptr) << "]");
 
         if (sodium_mprotect_noaccess(ptr) == -1)
             throw std::runtime_error{ "sodium::allocator::noaccess() failed" };
@@ -193,10 +193,8 @@ class allocator
      **/
     void readonly(T* ptr)
     {
-#ifndef NDEBUG
-        std::cerr << "DEBUG: sodium::allocator::readonly("
-                  << static_cast<void*>(ptr) << ")" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::allocator::readonly()",
+                     "[ptr=" << static_cast<void*>(ptr) << "]");
 
         if (sodium_mprotect_readonly(ptr) == -1)
             throw std::runtime_error{ "sodium::allocator::readonly() failed" };
@@ -213,10 +211,8 @@ class allocator
      **/
     void readwrite(T* ptr)
     {
-#ifndef NDEBUG
-        std::cerr << "DEBUG: sodium::allocator::readwrite("
-                  << static_cast<void*>(ptr) << ")" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::allocator::readwrite()",
+                     "[ptr=" << static_cast<void*>(ptr) << "]");
 
         if (sodium_mprotect_readwrite(ptr) == -1)
             throw std::runtime_error{ "sodium::allocator::readwrite() failed" };
@@ -0,0 +1,398 @@
+// asio_buffers.h -- Boost.Asio buffer sequence adapters for the wrappers
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "authenticator.h"
+#include "common.h"
+#include "fixed_bytes.h"
+#include "hasher_generic.h"
+#include "key.h"
+#include "secretbox.h"
+#include "secretstream.h"
+#include "span.h"
+
+#include <boost/asio/buffer.hpp>
+
+#include <algorithm>
+#include <cstddef>
+
+#include <sodium.h>
+
+/**
+ * Adapters feeding Boost.Asio buffer sequences (e.g. the
+ * std::vector<boost::asio::const_buffer> of a scatter-gather
+ * async_write(), or the buffers() of a boost::asio::streambuf)
+ * into the wrappers, without first gathering them into one BT.
+ *
+ * The MAC and hash adapters feed the buffers one by one into the
+ * incremental libsodium APIs (crypto_auth_hmacsha512256_*(),
+ * crypto_onetimeauth_*(), crypto_generichash_*()): they never copy.
+ *
+ * libsodium has no incremental secretbox / AEAD / secretstream
+ * message API. The encrypt()/decrypt()/push()/pull() adapters thus
+ * work on contiguous bytes, going from cheapest to most expensive:
+ *   1. input sequence of one buffer, output's first buffer large
+ *      enough: call the span API on them directly, no copy at all;
+ *   2. output's first buffer large enough for the input too: gather
+ *      the input there, and encrypt/decrypt in-place;
+ *   3. otherwise, gather into a stack buffer of STACK_BUFSIZE bytes,
+ *      encrypt/decrypt in-place, and scatter into the output.
+ * secretstream can't work in-place (its frames start with the
+ * encrypted tag): it skips 2., and 3. uses separate halves of the
+ * stack buffer for input and output.
+ *
+ * None of them allocates. Messages that need the stack buffer but
+ * don't fit into it fail with -1: give them a contiguous output
+ * buffer instead.
+ *
+ * Like the span APIs, these adapters return 0 on success and -1 on
+ * failure (too small output buffers, or a forged/corrupted message).
+ **/
+
+namespace sodium {
+
+namespace asio_buffers_detail {
+
+// bytes of the stack buffer of case 3 above
+constexpr std::size_t STACK_BUFSIZE = 4096;
+
+// the first buffer of a (possibly empty) buffer sequence
+template<typename BufferSequence>
+auto
+first_buffer(const BufferSequence& buffers) noexcept
+{
+    auto it = boost::asio::buffer_sequence_begin(buffers);
+    using buffer_type = typename std::decay<decltype(*it)>::type;
+    return it == boost::asio::buffer_sequence_end(buffers) ? buffer_type{}
+                                                           : buffer_type{ *it };
+}
+
+/**
+ * Run f(span<byte> out, span<const byte> in), a span API writing
+ * outsize bytes, on the bytes of the buffer sequences out and in,
+ * as described above. in_place tells whether f supports out and in
+ * starting at the same address. Return what f returns, or -1 if out
+ * has less than outsize bytes.
+ **/
+
+template<bool in_place,
+         typename MutableBufferSequence,
+         typename ConstBufferSequence,
+         typename Function>
+int
+transform(const MutableBufferSequence& out,
+          const ConstBufferSequence& in,
+          std::size_t outsize,
+          Function&& f) noexcept
+{
+    namespace asio = boost::asio;
+
+    const std::size_t insize = asio::buffer_size(in);
+    if (asio::buffer_size(out) < outsize)
+        return -1;
+
+    const asio::mutable_buffer out0 = first_buffer(out);
+    const asio::const_buffer in0 = first_buffer(in);
+    byte* out0_data = static_cast<byte*>(out0.data());
+    const span<const byte> in_contiguous(
+      static_cast<const byte*>(in0.data()), insize);
+    const bool contiguous = in0.size() >= insize;
+
+    // 1. no copy
+    if (contiguous && out0.size() >= outsize)
+        return f(span<byte>(out0_data, outsize), in_contiguous);
+
+    // 2. gather into out, in-place
+    const std::size_t worksize =
+      in_place ? std::max(insize, outsize) : insize + outsize;
+    if (in_place && out0.size() >= worksize) {
+        asio::buffer_copy(asio::buffer(out0_data, insize), in);
+        return f(span<byte>(out0_data, outsize),
+                 span<const byte>(out0_data, insize));
+    }
+
+    // 3. gather into a stack buffer and scatter into out
+    if (worksize > STACK_BUFSIZE)
+        return -1;
+
+    byte stack[STACK_BUFSIZE];
+    byte* stack_in = in_place ? stack : stack + outsize;
+    int rc;
+    if (contiguous)
+        rc = f(span<byte>(stack, outsize), in_contiguous);
+    else {
+        asio::buffer_copy(asio::buffer(stack_in, insize), in);
+        rc = f(span<byte>(stack, outsize), span<const byte>(stack_in, insize));
+    }
+    if (rc == 0)
+        asio::buffer_copy(out, asio::buffer(stack, outsize));
+    sodium_memzero(stack, worksize);
+
+    return rc;
+}
+
+inline span<const byte>
+to_span(boost::asio::const_buffer buffer) noexcept
+{
+    return span<const byte>(static_cast<const byte*>(buffer.data()),
+                            buffer.size());
+}
+
+} // namespace asio_buffers_detail
+
+/**
+ * secretbox: encrypt the bytes of the buffer sequence plaintext into
+ * the buffer sequence ciphertext_with_mac, or decrypt them back.
+ * See secretbox<>::encrypt(span...) / decrypt(span...).
+ **/
+
+template<typename BT,
+         typename MutableBufferSequence,
+         typename ConstBufferSequence>
+int
+encrypt(const secretbox<BT>& sb,
+        const MutableBufferSequence& ciphertext_with_mac,
+        const ConstBufferSequence& plaintext,
+        const typename secretbox<BT>::nonce_type& nonce) noexcept
+{
+    return asio_buffers_detail::transform<true>(
+      ciphertext_with_mac,
+      plaintext,
+      boost::asio::buffer_size(plaintext) + secretbox<BT>::MACSIZE,
+      [&](span<byte> out, span<const byte> in) {
+          return sb.encrypt(out, in, nonce);
+      });
+}
+
+template<typename BT,
+         typename MutableBufferSequence,
+         typename ConstBufferSequence>
+int
+decrypt(const secretbox<BT>& sb,
+        const MutableBufferSequence& plaintext,
+        const ConstBufferSequence& ciphertext_with_mac,
+        const typename secretbox<BT>::nonce_type& nonce) noexcept
+{
+    const std::size_t size = boost::asio::buffer_size(ciphertext_with_mac);
+    if (size < secretbox<BT>::MACSIZE)
+        return -1;
+
+    return asio_buffers_detail::transform<true>(
+      plaintext,
+      ciphertext_with_mac,
+      size - secretbox<BT>::MACSIZE,
+      [&](span<byte> out, span<const byte> in) {
+          return sb.decrypt(out, in, nonce);
+      });
+}
+
+/**
+ * aead: encrypt the bytes of the buffer sequence plaintext, with the
+ * additional data header, into the buffer sequence
+ * ciphertext_with_mac, or decrypt them back.
+ * See aead<>::encrypt(span...) / decrypt(span...).
+ **/
+
+template<typename BT,
+         typename F,
+         typename T,
+         typename MutableBufferSequence,
+         typename ConstBufferSequence>
+int
+encrypt(const aead<BT, F, T>& sc_aead,
+        const MutableBufferSequence& ciphertext_with_mac,
+        boost::asio::const_buffer header,
+        const ConstBufferSequence& plaintext,
+        const typename aead<BT, F, T>::nonce_type& nonce) noexcept
+{
+    return asio_buffers_detail::transform<true>(
+      ciphertext_with_mac,
+      plaintext,
+      boost::asio::buffer_size(plaintext) + aead<BT, F, T>::MACSIZE,
+      [&](span<byte> out, span<const byte> in) {
+          return sc_aead.encrypt(
+            out, asio_buffers_detail::to_span(header), in, nonce);
+      });
+}
+
+template<typename BT,
+         typename F,
+         typename T,
+         typename MutableBufferSequence,
+         typename ConstBufferSequence>
+int
+decrypt(const aead<BT, F, T>& sc_aead,
+        const MutableBufferSequence& plaintext,
+        boost::asio::const_buffer header,
+        const ConstBufferSequence& ciphertext_with_mac,
+        const typename aead<BT, F, T>::nonce_type& nonce) noexcept
+{
+    const std::size_t size = boost::asio::buffer_size(ciphertext_with_mac);
+    if (size < aead<BT, F, T>::MACSIZE)
+        return -1;
+
+    return asio_buffers_detail::transform<true>(
+      plaintext,
+      ciphertext_with_mac,
+      size - aead<BT, F, T>::MACSIZE,
+      [&](span<byte> out, span<const byte> in) {
+          return sc_aead.decrypt(
+            out, asio_buffers_detail::to_span(header), in, nonce);
+      });
+}
+
+/**
+ * secretstream: push the bytes of the buffer sequence plaintext as
+ * one message into the buffer sequence ciphertext_with_mac, or pull
+ * one message back. The stream state only advances on success.
+ * See secretstream<>::push(span...) / pull(span...).
+ **/
+
+template<typename BT,
+         typename F,
+         typename T,
+         typename MutableBufferSequence,
+         typename ConstBufferSequence>
+int
+push(secretstream<BT, F, T>& stream,
+     const MutableBufferSequence& ciphertext_with_mac,
+     const ConstBufferSequence& plaintext,
+     boost::asio::const_buffer added_data = {},
+     const typename secretstream<BT, F, T>::tag_type tag =
+       secretstream<BT, F, T>::tag_type::TAG_MESSAGE) noexcept
+{
+    return asio_buffers_detail::transform<false>(
+      ciphertext_with_mac,
+      plaintext,
+      boost::asio::buffer_size(plaintext) + secretstream<BT, F, T>::MACSIZE,
+      [&](span<byte> out, span<const byte> in) {
+          return stream.push(
+            out, in, asio_buffers_detail::to_span(added_data), tag);
+      });
+}
+
+template<typename BT,
+         typename F,
+         typename T,
+         typename MutableBufferSequence,
+         typename ConstBufferSequence>
+int
+pull(secretstream<BT, F, T>& stream,
+     const MutableBufferSequence& plaintext,
+     typename secretstream<BT, F, T>::tag_type& tag,
+     const ConstBufferSequence& ciphertext_with_mac,
+     boost::asio::const_buffer added_data = {}) noexcept
+{
+    const std::size_t size = boost::asio::buffer_size(ciphertext_with_mac);
+    if (size < secretstream<BT, F, T>::MACSIZE)
+        return -1;
+
+    return asio_buffers_detail::transform<false>(
+      plaintext,
+      ciphertext_with_mac,
+      size - secretstream<BT, F, T>::MACSIZE,
+      [&](span<byte> out, span<const byte> in) {
+          return stream.pull(
+            out, tag, in, asio_buffers_detail::to_span(added_data));
+      });
+}
+
+/**
+ * authenticator: the MAC of the bytes of the buffer sequence
+ * plaintext, the same as authenticator<>::mac_fixed() of their
+ * concatenation, computed incrementally (see authenticator_state).
+ **/
+
+template<typename BT, typename ConstBufferSequence>
+typename authenticator<BT>::mac_type
+mac(const authenticator<BT>& auth, const ConstBufferSequence& plaintext)
+{
+    authenticator_state state = auth.state();
+    for (auto it = boost::asio::buffer_sequence_begin(plaintext);
+         it != boost::asio::buffer_sequence_end(plaintext);
+         ++it)
+        state.update(asio_buffers_detail::to_span(*it));
+    return state.final();
+}
+
+// Verify mac, as returned by mac(auth, plaintext), in constant time
+template<typename BT, typename ConstBufferSequence>
+bool
+verify(const authenticator<BT>& auth,
+       const ConstBufferSequence& plaintext,
+       const typename authenticator<BT>::mac_type& mac)
+{
+    return sodium::mac(auth, plaintext) == mac;
+}
+
+/**
+ * The Poly1305 one-time MAC (crypto_onetimeauth()) with key of the
+ * bytes of the buffer sequence plaintext, computed incrementally.
+ * As its name suggests, a Poly1305 key must NEVER be used for more
+ * than one message.
+ **/
+
+using poly1305_key_type = key<KEYSIZE_POLY1305>;
+using poly1305_mac_type = fixed_bytes<crypto_onetimeauth_BYTES>;
+
+template<typename ConstBufferSequence>
+poly1305_mac_type
+poly1305_mac(const poly1305_key_type& key,
+             const ConstBufferSequence& plaintext) noexcept
+{
+    crypto_onetimeauth_state state;
+    crypto_onetimeauth_init(&state, key.data());
+    for (auto it = boost::asio::buffer_sequence_begin(plaintext);
+         it != boost::asio::buffer_sequence_end(plaintext);
+         ++it) {
+        const boost::asio::const_buffer buffer{ *it };
+        crypto_onetimeauth_update(
+          &state, static_cast<const byte*>(buffer.data()), buffer.size());
+    }
+
+    poly1305_mac_type result;
+    crypto_onetimeauth_final(&state, result.data());
+    sodium_memzero(&state, sizeof state);
+    return result;
+}
+
+/**
+ * hasher_generic: write the hash of the bytes of the buffer sequence
+ * plaintext, the same as hash() of their concatenation, into out of
+ * hashsize bytes (HASHSIZE_MIN <= hashsize <= HASHSIZE_MAX). Uses
+ * the thread's local_state() of hasher, i.e. doesn't allocate after
+ * the first call. Throw a std::runtime_error on a wrong hashsize.
+ **/
+
+template<typename BT, typename ConstBufferSequence>
+void
+hash(const hasher_generic<BT>& hasher,
+     const ConstBufferSequence& plaintext,
+     span<byte> out)
+{
+    hasher_generic_state& state = hasher.local_state(out.size());
+    for (auto it = boost::asio::buffer_sequence_begin(plaintext);
+         it != boost::asio::buffer_sequence_end(plaintext);
+         ++it)
+        state.update(asio_buffers_detail::to_span(*it));
+    state.final(out);
+}
+
+} // namespace sodium
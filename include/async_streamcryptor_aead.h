@@ -0,0 +1,461 @@
+// async_streamcryptor_aead.h -- Asynchronous streamcryptor_aead for Boost.Asio
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "blocksize.h"
+#include "common.h"
+#include "error.h"
+#include "key.h"
+#include "nonce.h"
+#include "span.h"
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/execution/outstanding_work.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/prefer.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace sodium {
+
+namespace async_detail {
+
+// sodium::errc as a boost::system::error_code, for Asio handlers
+class error_category_impl : public boost::system::error_category
+{
+  public:
+    const char* name() const noexcept override { return "sodium"; }
+
+    std::string message(int ev) const override
+    {
+        return sodium::error_category().message(ev);
+    }
+};
+
+inline const boost::system::error_category&
+error_category() noexcept
+{
+    static const error_category_impl category;
+    return category;
+}
+
+inline boost::system::error_code
+to_error_code(errc e) noexcept
+{
+    return boost::system::error_code(static_cast<int>(e), error_category());
+}
+
+/**
+ * One async_encrypt() / async_decrypt() in progress. It lives in a
+ * shared_ptr held by all its pending operations, and all its state is
+ * only touched on strand_, the strand of the input stream's executor.
+ *
+ * The pipeline: blocks are read one after the other from in_, each
+ * one is handed to the compute executor, and the results are written
+ * to out_ in their order. At most window_ blocks are in flight at
+ * any time, i.e. read but not written yet.
+ **/
+
+template<typename AsyncReadStream,
+         typename AsyncWriteStream,
+         typename ComputeExecutor,
+         typename Handler>
+class stream_op
+  : public std::enable_shared_from_this<
+      stream_op<AsyncReadStream, AsyncWriteStream, ComputeExecutor, Handler>>
+{
+    using io_executor = typename AsyncReadStream::executor_type;
+    using work_type = typename std::decay<decltype(boost::asio::prefer(
+      std::declval<io_executor>(),
+      boost::asio::execution::outstanding_work.tracked))>::type;
+    using aead_type = aead<>;
+
+    struct slot
+    {
+        buffer in;
+        buffer out;
+        typename aead_type::nonce_type nonce;
+        bool done = false;
+        bool ok = true;
+    };
+
+  public:
+    stream_op(AsyncReadStream& in,
+              AsyncWriteStream& out,
+              const ComputeExecutor& compute,
+              Handler&& handler,
+              const aead_type& sc_aead,
+              const typename aead_type::nonce_type& nonce,
+              std::size_t blocksize,
+              std::size_t window,
+              bool encrypting)
+      : in_{ in }
+      , out_{ out }
+      , compute_{ compute }
+      , handler_{ std::move(handler) }
+      , strand_{ boost::asio::make_strand(in.get_executor()) }
+      , work_{ boost::asio::prefer(
+          in.get_executor(),
+          boost::asio::execution::outstanding_work.tracked) }
+      , aead_{ sc_aead }
+      , nonce_{ nonce }
+      , chunksize_{ encrypting ? blocksize : blocksize + aead_type::MACSIZE }
+      , window_{ window }
+      , encrypting_{ encrypting }
+    {}
+
+    void start()
+    {
+        boost::asio::dispatch(
+          strand_, [self = this->shared_from_this()] { self->read_more(); });
+    }
+
+  private:
+    // start reading the next block, if the window has room for it
+    void read_more()
+    {
+        if (reading_ || eof_ || ec_ || slots_.size() == window_)
+            return;
+
+        auto s = std::make_shared<slot>();
+        s->in.resize(chunksize_);
+        s->nonce = nonce_;
+        nonce_.increment();
+        slots_.push_back(s);
+
+        reading_ = true;
+        boost::asio::async_read(
+          in_,
+          boost::asio::buffer(s->in.data(), s->in.size()),
+          boost::asio::bind_executor(
+            strand_,
+            [self = this->shared_from_this(),
+             s](const boost::system::error_code& ec, std::size_t n) {
+                self->on_read(s, ec, n);
+            }));
+    }
+
+    void on_read(const std::shared_ptr<slot>& s,
+                 const boost::system::error_code& ec,
+                 std::size_t n)
+    {
+        reading_ = false;
+        if (ec == boost::asio::error::eof)
+            eof_ = true;
+        else if (ec && !ec_)
+            ec_ = ec;
+
+        if (ec_ || n == 0) {
+            slots_.pop_back(); // s: nothing to process
+            finish_if_idle();
+            return;
+        }
+        if (!encrypting_ && n < aead_type::MACSIZE) {
+            slots_.pop_back();
+            ec_ = to_error_code(errc::message_too_short);
+            finish_if_idle();
+            return;
+        }
+
+        s->in.resize(n);
+        s->out.resize(encrypting_ ? n + aead_type::MACSIZE
+                                  : n - aead_type::MACSIZE);
+        boost::asio::post(compute_, [self = this->shared_from_this(), s] {
+            self->process(*s);
+            boost::asio::post(self->strand_, [self, s] {
+                s->done = true;
+                self->write_more();
+            });
+        });
+
+        read_more();
+    }
+
+    // on the compute executor: only reads the (const) aead_ and s
+    void process(slot& s) const noexcept
+    {
+        const span<const byte> header;
+        const int rc = encrypting_
+                         ? aead_.encrypt(s.out, header, s.in, s.nonce)
+                         : aead_.decrypt(s.out, header, s.in, s.nonce);
+        s.ok = rc == 0;
+    }
+
+    // write the oldest block, if it has been processed
+    void write_more()
+    {
+        if (writing_ || ec_ || slots_.empty() || !slots_.front()->done) {
+            finish_if_idle();
+            return;
+        }
+
+        auto s = slots_.front();
+        if (!s->ok) {
+            ec_ = to_error_code(errc::verification_failed);
+            finish_if_idle();
+            return;
+        }
+
+        writing_ = true;
+        boost::asio::async_write(
+          out_,
+          boost::asio::buffer(s->out.data(), s->out.size()),
+          boost::asio::bind_executor(
+            strand_,
+            [self = this->shared_from_this()](
+              const boost::system::error_code& ec, std::size_t n) {
+                self->on_write(ec, n);
+            }));
+    }
+
+    void on_write(const boost::system::error_code& ec, std::size_t n)
+    {
+        writing_ = false;
+        written_ += n;
+        slots_.pop_front();
+        if (ec && !ec_)
+            ec_ = ec;
+
+        read_more();
+        write_more();
+    }
+
+    // complete, once nothing is left to do (or after an error, once
+    // no read or write is pending anymore)
+    void finish_if_idle()
+    {
+        if (finished_ || reading_ || writing_)
+            return;
+        if (!ec_ && !(eof_ && slots_.empty()))
+            return;
+
+        finished_ = true;
+        slots_.clear(); // after an error: the blocks still in the works
+        auto handler_ex =
+          boost::asio::get_associated_executor(handler_, in_.get_executor());
+        boost::asio::dispatch(
+          handler_ex,
+          [handler = std::move(handler_), ec = ec_, n = written_]() mutable {
+              handler(ec, n);
+          });
+    }
+
+    AsyncReadStream& in_;
+    AsyncWriteStream& out_;
+    ComputeExecutor compute_;
+    Handler handler_;
+    boost::asio::strand<io_executor> strand_;
+    work_type work_; // keeps the io_context running during the crypto
+    const aead_type aead_;
+    typename aead_type::nonce_type nonce_; // of the next block read
+    const std::size_t chunksize_;          // bytes read per block
+    const std::size_t window_;
+    const bool encrypting_;
+
+    std::deque<std::shared_ptr<slot>> slots_; // blocks in flight, in order
+    boost::system::error_code ec_;
+    std::uint64_t written_ = 0;
+    bool reading_ = false;
+    bool writing_ = false;
+    bool eof_ = false;
+    bool finished_ = false;
+};
+
+} // namespace async_detail
+
+/**
+ * sodium::async_streamcryptor_aead is the asynchronous counterpart to
+ * sodium::streamcryptor_aead, for Boost.Asio based programs: instead
+ * of blocking on a std::istream / std::ostream, async_encrypt() and
+ * async_decrypt() read from an AsyncReadStream (e.g. a socket) and
+ * write to an AsyncWriteStream, without ever blocking the threads
+ * running the streams' io_context. The crypto itself is offloaded to
+ * a compute executor, e.g. a boost::asio::thread_pool.
+ *
+ * The encrypted format is exactly that of streamcryptor_aead for the
+ * same key, nonce and blocksize: each one can decrypt what the other
+ * one has encrypted.
+ *
+ * Up to window blocks are in flight at any time: read, but not yet
+ * encrypted/decrypted and written. The memory used is thus bounded
+ * by about 2 * window * (blocksize + MACSIZE) bytes, and up to window
+ * blocks are processed in parallel on the compute executor.
+ *
+ * Like all Asio asynchronous operations, these accept any completion
+ * token for a void(boost::system::error_code, std::uint64_t)
+ * signature, the std::uint64_t being the number of bytes written:
+ *   - a callback,
+ *   - boost::asio::use_future,
+ *   - boost::asio::use_awaitable, to co_await them from a C++20
+ *     coroutine:
+ *       std::uint64_t n = co_await sc.async_encrypt(
+ *         socket, file, pool.get_executor(), boost::asio::use_awaitable);
+ *
+ * A decryption failure (a tampered block, a wrong key, nonce or
+ * blocksize) completes with sodium::errc::verification_failed (in
+ * async_detail::error_category()); the blocks before the faulty one
+ * have been written to the output stream. The end of the input
+ * stream is the end of the message: as with streamcryptor_aead,
+ * truncation at a block boundary is NOT detected.
+ *
+ * The streams and the async_streamcryptor_aead must outlive the
+ * operation. Only one operation per pair of streams may be in
+ * progress at a time.
+ **/
+
+class async_streamcryptor_aead
+{
+  public:
+    using aead_type = aead<>;
+    using key_type = aead_type::key_type;
+    using nonce_type = aead_type::nonce_type;
+
+    static constexpr std::size_t KEYSIZE = aead_type::KEYSIZE;
+    static constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+
+    /**
+     * An async_streamcryptor_aead encrypting blocks of blocksize
+     * bytes with key, the first one with nonce, and the n-th one with
+     * nonce incremented n times. window is the maximum number of
+     * blocks in flight.
+     *
+     * Throw a std::runtime_error if blocksize or window are 0, or if
+     * blocksize is blocksize::auto_tune (see blocksize.h).
+     **/
+
+    async_streamcryptor_aead(const key_type& key,
+                             const nonce_type& nonce,
+                             std::size_t blocksize,
+                             std::size_t window = 4)
+      : aead_{ key }
+      , nonce_{ nonce }
+      , blocksize_{ blocksize }
+      , window_{ window }
+    {
+        if (blocksize == 0 || blocksize == sodium::blocksize::auto_tune)
+            throw std::runtime_error{ "sodium::async_streamcryptor_aead::"
+                                      "async_streamcryptor_aead(): wrong "
+                                      "blocksize" };
+        if (window == 0)
+            throw std::runtime_error{ "sodium::async_streamcryptor_aead::"
+                                      "async_streamcryptor_aead(): wrong "
+                                      "window" };
+    }
+
+    /**
+     * Encrypt everything that can be read from in until the end of the
+     * stream, and write it to out. Encrypt on the compute executor.
+     **/
+
+    template<typename AsyncReadStream,
+             typename AsyncWriteStream,
+             typename ComputeExecutor,
+             typename CompletionToken>
+    auto async_encrypt(AsyncReadStream& in,
+                       AsyncWriteStream& out,
+                       const ComputeExecutor& compute,
+                       CompletionToken&& token) const
+    {
+        return initiate(in,
+                        out,
+                        compute,
+                        std::forward<CompletionToken>(token),
+                        true);
+    }
+
+    /**
+     * Decrypt everything that can be read from in until the end of the
+     * stream, and write it to out. Decrypt on the compute executor.
+     **/
+
+    template<typename AsyncReadStream,
+             typename AsyncWriteStream,
+             typename ComputeExecutor,
+             typename CompletionToken>
+    auto async_decrypt(AsyncReadStream& in,
+                       AsyncWriteStream& out,
+                       const ComputeExecutor& compute,
+                       CompletionToken&& token) const
+    {
+        return initiate(in,
+                        out,
+                        compute,
+                        std::forward<CompletionToken>(token),
+                        false);
+    }
+
+    // the blocksize in use
+    std::size_t blocksize() const noexcept { return blocksize_; }
+
+  private:
+    template<typename AsyncReadStream,
+             typename AsyncWriteStream,
+             typename ComputeExecutor,
+             typename CompletionToken>
+    auto initiate(AsyncReadStream& in,
+                  AsyncWriteStream& out,
+                  const ComputeExecutor& compute,
+                  CompletionToken&& token,
+                  bool encrypting) const
+    {
+        return boost::asio::async_initiate<
+          CompletionToken,
+          void(boost::system::error_code, std::uint64_t)>(
+          [this, &in, &out, compute, encrypting](auto&& handler) {
+              using op_type = async_detail::stream_op<
+                AsyncReadStream,
+                AsyncWriteStream,
+                ComputeExecutor,
+                typename std::decay<decltype(handler)>::type>;
+              std::make_shared<op_type>(in,
+                                        out,
+                                        compute,
+                                        std::move(handler),
+                                        aead_,
+                                        nonce_,
+                                        blocksize_,
+                                        window_,
+                                        encrypting)
+                ->start();
+          },
+          token);
+    }
+
+    aead_type aead_;
+    nonce_type nonce_;
+    std::size_t blocksize_;
+    std::size_t window_;
+};
+
+} // namespace sodium
@@ -24,14 +24,12 @@
 
 #include "authenticator.h"
 #include "common.h"
+#include "filter_profile.h"
 #include "key.h"
+#include "trace.h"
 
 #include <sodium.h>
 
-#ifndef NDEBUG
-#include <iostream>
-#endif // ! NDEBUG
-
 namespace io = boost::iostreams;
 
 namespace sodium {
@@ -129,10 +127,9 @@ class auth_mac_filter : public io::aggregate_filter<char>
   private:
     virtual void do_filter(const vector_type& src, vector_type& dest)
     {
+        SODIUM_PROFILE_SPAN("auth_mac_filter", src.size());
 
-#ifndef NDEBUG
-        std::cerr << "auth_mac_filter::do_filter() called" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::auth_mac_filter::do_filter()", "called");
 
         // Compute MAC:
         vector_type mac{ auth_.mac(src) }; // uses chars overload
@@ -21,7 +21,9 @@
 
 #include "authenticator.h"
 #include "common.h"
+#include "filter_profile.h"
 #include "key.h"
+#include "trace.h"
 
 #include <sodium.h>
 #include <stdexcept>
@@ -29,10 +31,6 @@
 #include <boost/iostreams/categories.hpp>       // tags
 #include <boost/iostreams/filter/aggregate.hpp> // aggregate_filter
 
-#ifndef NDEBUG
-#include <iostream>
-#endif // ! NDEBUG
-
 namespace io = boost::iostreams;
 
 namespace sodium {
@@ -41,6 +39,11 @@ class auth_verify_filter : public io::aggregate_filter<char>
 {
 
     /**
+     * Being an aggregate_filter, auth_verify_filter holds the whole
+     * stream in memory until close(). For big streams, use
+     * sodium::auth_verify_stream_filter instead, which verifies the
+     * same MACs in constant memory.
+     *
      * Use auth_verify_filter as a DualUse filter like this:
      *
      *     #include <boost/iostreams/device/array.hpp>
@@ -146,10 +149,9 @@ class auth_verify_filter : public io::aggregate_filter<char>
   private:
     virtual void do_filter(const vector_type& src, vector_type& dest)
     {
+        SODIUM_PROFILE_SPAN("auth_verify_filter", src.size());
 
-#ifndef NDEBUG
-        std::cerr << "auth_verify_filter::do_filter() called" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::auth_verify_filter::do_filter()", "called");
 
         if (mac_.size() != MACSIZE)
             throw std::runtime_error{
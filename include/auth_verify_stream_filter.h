@@ -0,0 +1,239 @@
+// auth_verify_stream_filter.h -- Streaming MAC verification filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "authenticator.h"
+#include "common.h"
+#include "filter_profile.h"
+#include "key.h"
+#include "trace.h"
+
+#include <boost/iostreams/filter/symmetric.hpp>
+#include <boost/iostreams/pipeline.hpp>
+
+#include <algorithm> // std::min<>
+#include <cstddef>   // std::size_t
+#include <cstring>   // std::memcpy()
+#include <stdexcept> // std::runtime_error
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+namespace sodium {
+
+class auth_verify_stream_symmetric_filter
+{
+    /**
+     * Verify the MAC of a stream, as computed by sodium::authenticator
+     * or auth_mac_filter, while passing the stream unchanged
+     * downstream.
+     *
+     * Unlike auth_verify_filter, which is an aggregate_filter and thus
+     * keeps the whole stream in memory, this filter feeds every chunk
+     * to the incremental crypto_auth_hmacsha512256_*() API (crypto_auth
+     * is HMAC-SHA-512-256) and releases it right away. Its memory use
+     * doesn't depend on the size of the stream.
+     *
+     * Since data is released before the end of the stream, the
+     * verification can only happen at the end of the stream: when
+     * the chain is closed (output), or when the source is exhausted
+     * (input). If throw_on_failure is set, a std::runtime_error is
+     * thrown then if the MAC doesn't match; otherwise, the verdict
+     * can be queried with verified().
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = authenticator<chars>::KEYSIZE_AUTH;
+    static constexpr std::size_t MACSIZE = authenticator<chars>::MACSIZE;
+
+    typedef char char_type;
+
+    using key_type = authenticator<chars>::key_type;
+
+    auth_verify_stream_symmetric_filter(const key_type& key,
+                                        const chars& mac,
+                                        const bool throw_on_failure)
+      : mac_{ mac }
+      , throw_on_failure_{ throw_on_failure }
+      , finished_{ false }
+      , verified_{ false }
+    {
+        if (mac.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::auth_verify_stream_filter::"
+                "auth_verify_stream_filter() wrong MAC size"
+            };
+
+        // keep a copy of the keyed initial state, to start afresh
+        // cheaply in close()
+        crypto_auth_hmacsha512256_init(&initial_, key.data(), key.size());
+        state_ = initial_;
+    }
+
+    ~auth_verify_stream_symmetric_filter()
+    {
+        sodium_memzero(&state_, sizeof state_);
+        sodium_memzero(&initial_, sizeof initial_);
+    }
+
+    /**
+     * Pass [i1,i2) through to [o1,o2), updating the MAC on the way.
+     * At the end of the stream (flush set, and no input left), check
+     * the MAC.
+     **/
+
+    bool filter(const char_type*& i1,
+                const char_type* i2,
+                char_type*& o1,
+                char_type* o2,
+                bool flush)
+    {
+        SODIUM_PROFILE_SPAN("auth_verify_stream_filter", i1);
+
+        const auto n = std::min<std::ptrdiff_t>(i2 - i1, o2 - o1);
+        if (n != 0) {
+            crypto_auth_hmacsha512256_update(
+              &state_, reinterpret_cast<const unsigned char*>(i1), n);
+            std::memcpy(o1, i1, n);
+            i1 += n;
+            o1 += n;
+        }
+
+        if (!flush || i1 != i2)
+            return true; // need more input, or more room for output
+
+        if (!finished_)
+            finish();
+
+        return false; // all done
+    }
+
+    /**
+     * Prepare to verify a whole new stream with the same key and MAC.
+     * The verdict of the last stream is kept.
+     **/
+
+    void close()
+    {
+        SODIUM_TRACE("sodium::auth_verify_stream_symmetric_filter::close()",
+                     "called [verified=" << verified_ << "]");
+
+        state_ = initial_;
+        finished_ = false;
+    }
+
+    /**
+     * true if the last stream went all the way to its end, and its
+     * MAC matched.
+     **/
+
+    bool verified() const { return verified_; }
+
+  private:
+    void finish()
+    {
+        unsigned char computed[MACSIZE];
+        crypto_auth_hmacsha512256_final(&state_, computed);
+        verified_ = sodium_memcmp(computed, mac_.data(), MACSIZE) == 0;
+        finished_ = true;
+
+        if (!verified_ && throw_on_failure_)
+            throw std::runtime_error{
+                "sodium::auth_verify_stream_filter::filter() "
+                "MAC doesn't verify"
+            };
+    }
+
+    crypto_auth_hmacsha512256_state state_;
+    crypto_auth_hmacsha512256_state initial_; // keyed, no data yet
+    chars mac_;
+    bool throw_on_failure_;
+    bool finished_; // MAC of this stream checked?
+    bool verified_; // ... and matched?
+}; // auth_verify_stream_symmetric_filter
+
+// Turn auth_verify_stream_symmetric_filter into a DualUse filter class:
+
+class auth_verify_stream_filter
+  : public io::symmetric_filter<auth_verify_stream_symmetric_filter>
+{
+    /**
+     * auth_verify_stream_filter is a DualUseFilter that passes a
+     * stream through unchanged, while verifying its MAC in constant
+     * memory.
+     *
+     * Parameters:
+     *   buffer_size     : size of the internal buffer of symmetric_filter.
+     *   key             : the key the MAC was computed with.
+     *   mac             : the expected MAC, MACSIZE bytes.
+     *   throw_on_failure: if true (the default), throw a
+     *                     std::runtime_error at the end of the stream if
+     *                     the MAC doesn't match.
+     *
+     * Use it like this (as an OutputFilter):
+     *
+     *   auth_verify_stream_filter verify_filter{ 4096, key, mac };
+     *
+     *   io::filtering_ostream os(verify_filter | io::file_sink(outfile));
+     *   os << ...;  // data is passed downstream as it arrives
+     *   os.reset(); // throws if the MAC doesn't match
+     *
+     * or, without exceptions:
+     *
+     *   auth_verify_stream_filter verify_filter{ 4096, key, mac, false };
+     *   ...
+     *   os.reset();
+     *   if (!verify_filter.verified()) ...
+     *
+     * Copies of this filter share their state, so verified() can be
+     * called on the copy the filter was pushed from.
+     *
+     * The data downstream is unauthenticated until the chain was
+     * closed successfully (output), or the source read to its end
+     * (input). Don't act on it before that.
+     **/
+
+  private:
+    typedef io::symmetric_filter<auth_verify_stream_symmetric_filter>
+      base_type;
+    typedef auth_verify_stream_symmetric_filter symmetric_filter_type;
+
+  public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::category category;
+
+    static constexpr std::size_t MACSIZE = symmetric_filter_type::MACSIZE;
+
+    using key_type = symmetric_filter_type::key_type;
+
+    auth_verify_stream_filter(std::streamsize buffer_size,
+                              const key_type& key,
+                              const chars& mac,
+                              const bool throw_on_failure = true)
+      : base_type(buffer_size, key, mac, throw_on_failure)
+    {}
+
+    // the verdict of the last stream, see above
+    bool verified() { return filter().verified(); }
+};
+
+BOOST_IOSTREAMS_PIPABLE(auth_verify_stream_filter, 0)
+
+} // namespace sodium
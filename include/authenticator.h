@@ -19,12 +19,136 @@
 #pragma once
 
 #include "common.h"
+#include "extern_templates.h"
+#include "fixed_bytes.h"
 #include "key.h"
+#include "span.h"
 #include <sodium.h>
 #include <stdexcept>
 
 namespace sodium {
 
+class authenticator_state
+{
+    /**
+     * An authenticator_state computes the MAC of authenticator<>
+     * (HMAC-SHA-512-256) incrementally, with the
+     * crypto_auth_hmacsha512256_*() streaming API, e.g. for records
+     * arriving in pieces:
+     *
+     *   authenticator_state state = auth.state();
+     *   state.update(piece1);
+     *   state.update(piece2);
+     *   auto mac = state.final(); // and reset() for the next record
+     *
+     * The keyed initial state (the key XORed with ipad and opad,
+     * already absorbed into both SHA-512 states) is computed once by
+     * the constructor and kept aside: reset(), and thus every new MAC,
+     * only copies it back instead of keying HMAC again. Copying an
+     * authenticator_state clones it, e.g. one per thread or per
+     * connection from one prototype.
+     *
+     * The states hold key material: they are wiped by the destructor.
+     * An authenticator_state is not thread-safe: use one per thread.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = crypto_auth_hmacsha512256_KEYBYTES;
+    static constexpr std::size_t MACSIZE = crypto_auth_hmacsha512256_BYTES;
+
+    // crypto_auth() is HMAC-SHA-512-256: the same MACs
+    static_assert(KEYSIZE == crypto_auth_KEYBYTES &&
+                    MACSIZE == crypto_auth_BYTES,
+                  "crypto_auth() is not HMAC-SHA-512-256");
+
+    using mac_type = fixed_bytes<MACSIZE>;
+
+    /**
+     * Create an incremental authenticator with the key [key,
+     * key+KEYSIZE). Throw a std::runtime_error if keysize != KEYSIZE.
+     **/
+
+    authenticator_state(const unsigned char* key, std::size_t keysize)
+    {
+        if (keysize != KEYSIZE)
+            throw std::runtime_error{ "sodium::authenticator_state::"
+                                      "authenticator_state() wrong key size" };
+
+        crypto_auth_hmacsha512256_init(&initial_, key, keysize);
+        state_ = initial_;
+    }
+
+    authenticator_state(const authenticator_state&) = default;
+    authenticator_state& operator=(const authenticator_state&) = default;
+
+    ~authenticator_state()
+    {
+        sodium_memzero(&initial_, sizeof initial_);
+        sodium_memzero(&state_, sizeof state_);
+    }
+
+    // Absorb the next size bytes of the message at data
+    void update(const void* data, std::size_t size) noexcept
+    {
+        crypto_auth_hmacsha512256_update(
+          &state_, static_cast<const unsigned char*>(data), size);
+    }
+
+    void update(span<const byte> data) noexcept
+    {
+        update(data.data(), data.size());
+    }
+
+    /**
+     * Return the MAC of the message absorbed so far, and reset() this
+     * state for the next message.
+     **/
+
+    mac_type final() noexcept
+    {
+        mac_type mac;
+        crypto_auth_hmacsha512256_final(&state_, mac.data());
+        reset();
+        return mac;
+    }
+
+    /**
+     * Same as final(), but write the MAC into out, which must be
+     * MACSIZE bytes long. Throw a std::runtime_error on a wrong
+     * out.size().
+     **/
+
+    void final(span<byte> out)
+    {
+        if (out.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::authenticator_state::final() wrong mac size"
+            };
+        crypto_auth_hmacsha512256_final(&state_, out.data());
+        reset();
+    }
+
+    /**
+     * Verify in constant time that mac is the MAC of the message
+     * absorbed so far, and reset() this state for the next message.
+     * A mac of the wrong size doesn't verify.
+     **/
+
+    bool verify(span<const byte> mac) noexcept
+    {
+        const mac_type expected = final();
+        return mac.size() == MACSIZE &&
+               sodium_memcmp(expected.data(), mac.data(), MACSIZE) == 0;
+    }
+
+    // Forget the message absorbed so far, keeping the key
+    void reset() noexcept { state_ = initial_; }
+
+  private:
+    crypto_auth_hmacsha512256_state initial_; // keyed, nothing absorbed yet
+    crypto_auth_hmacsha512256_state state_;
+};
+
 template<class BT = bytes>
 class authenticator
 {
@@ -36,23 +160,40 @@ class authenticator
     // Member type aliases
     using bytes_type = BT;
     using key_type = key<KEYSIZE_AUTH>;
+    using shared_key_type = shared_key<KEYSIZE_AUTH>;
+    using mac_type = fixed_bytes<MACSIZE>;
 
     // An authenticator with a new random key
     authenticator()
-      : auth_key_(std::move(key_type()))
+      : auth_key_(make_shared_key(key_type()))
     {}
 
     // An authenticator with a user-supplied key (copying version)
     authenticator(const key_type& auth_key)
-      : auth_key_(auth_key)
+      : auth_key_(make_shared_key(auth_key))
     {}
 
     // An authenticator with a user-supplied key (moving version)
     authenticator(key_type&& auth_key)
-      : auth_key_(std::move(auth_key))
+      : auth_key_(make_shared_key(std::move(auth_key)))
     {}
 
-    // A copying constructor
+    /**
+     * An authenticator sharing the immutable key of other wrappers,
+     * filters, etc., see make_shared_key(). Throw a std::runtime_error
+     * if key is empty.
+     **/
+
+    explicit authenticator(shared_key_type key)
+      : auth_key_(std::move(key))
+    {
+        if (!auth_key_)
+            throw std::runtime_error{
+                "sodium::authenticator::authenticator() empty key"
+            };
+    }
+
+    // A copying constructor: shares the (immutable) key of other
     authenticator(const authenticator& other)
       : auth_key_(other.auth_key_)
     {}
@@ -64,6 +205,9 @@ class authenticator
 
     // XXX copying and moving assignment operators?
 
+    // the shared key of this authenticator
+    const shared_key_type& key_handle() const noexcept { return auth_key_; }
+
     /**
      * Create and return a Message Authentication Code (MAC) for the supplied
      * plaintext, using the current authentication key.
@@ -71,7 +215,7 @@ class authenticator
      * The returned MAC is MACSIZE bytes long.
      **/
 
-    BT mac(const BT& plaintext);
+    BT mac(const BT& plaintext) const;
 
     /**
      * Verify MAC of plaintext using the current authentication key,
@@ -84,15 +228,54 @@ class authenticator
      * of the mac don't make sense.
      **/
 
-    bool verify(const BT& plaintext, const BT& mac);
+    bool verify(const BT& plaintext, const BT& mac) const;
+
+    /**
+     * Allocation-free variant of mac(): return the MAC of plaintext
+     * in a fixed_bytes<MACSIZE> on the stack.
+     **/
+
+    mac_type mac_fixed(span<const byte> plaintext) const noexcept
+    {
+        mac_type mac;
+        crypto_auth(
+          mac.data(), plaintext.data(), plaintext.size(), auth_key_->data());
+        return mac;
+    }
+
+    /**
+     * Allocation-free variant of verify(), for a MAC returned by
+     * mac_fixed(). As the size of mac is right by construction, this
+     * doesn't throw.
+     **/
+
+    bool verify(span<const byte> plaintext, const mac_type& mac) const
+      noexcept
+    {
+        return crypto_auth_verify(mac.data(),
+                                  plaintext.data(),
+                                  plaintext.size(),
+                                  auth_key_->data()) == 0;
+    }
+
+    /**
+     * Return a new incremental authenticator with the key of this
+     * authenticator. MACing a message with it gives the same result
+     * as mac(message).
+     **/
+
+    authenticator_state state() const
+    {
+        return authenticator_state(auth_key_->data(), auth_key_->size());
+    }
 
   private:
-    key_type auth_key_;
+    shared_key_type auth_key_;
 };
 
 template<class BT>
 BT
-authenticator<BT>::mac(const BT& plaintext)
+authenticator<BT>::mac(const BT& plaintext) const
 {
     // make space for MAC
     BT mac(authenticator<BT>::MACSIZE);
@@ -101,7 +284,7 @@ authenticator<BT>::mac(const BT& plaintext)
     crypto_auth(reinterpret_cast<unsigned char*>(mac.data()),
                 reinterpret_cast<const unsigned char*>(plaintext.data()),
                 plaintext.size(),
-                auth_key_.data());
+                auth_key_->data());
 
     // return the MAC bytes
     return mac;
@@ -109,7 +292,7 @@ authenticator<BT>::mac(const BT& plaintext)
 
 template<class BT>
 bool
-authenticator<BT>::verify(const BT& plaintext, const BT& mac)
+authenticator<BT>::verify(const BT& plaintext, const BT& mac) const
 {
     // some sanity checks before we get started
     if (mac.size() != authenticator<BT>::MACSIZE)
@@ -122,7 +305,10 @@ authenticator<BT>::verify(const BT& plaintext, const BT& mac)
              reinterpret_cast<const unsigned char*>(mac.data()),
              reinterpret_cast<const unsigned char*>(plaintext.data()),
              plaintext.size(),
-             auth_key_.data()) == 0;
+             auth_key_->data()) == 0;
 }
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(authenticator);
+
 } // namespace sodium
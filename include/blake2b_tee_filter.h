@@ -18,8 +18,13 @@
 
 #pragma once
 
+#include "filter_profile.h"
 #include "helpers.h"
 #include "keyvar.h"
+#include "metrics.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "tree_hash.h"
 
 #include <boost/assert.hpp>
 #include <boost/config.hpp> // BOOST_DEDUCE_TYPENAME.
@@ -36,13 +41,10 @@
 #include <boost/type_traits/is_convertible.hpp>
 #include <boost/type_traits/is_same.hpp>
 
+#include <memory>
 #include <sodium.h>
 #include <stdexcept> // std::runtime_error
-
-#ifndef NDEBUG
-#include <iostream>
 #include <string>
-#endif // ! NDEBUG
 
 using namespace boost::iostreams;
 
@@ -117,6 +119,16 @@ class blake2b_tee_filter : public detail::filter_adapter<Device>
      * passes all input unmodified through first Sink, and at the same
      * times computes a BLAKE2b hash which it passes to the second
      * Sink when the input stream is about to be closed.
+     *
+     * In an input chain, the data read from the source is passed
+     * through unmodified, and the hash is sent to the second Sink as
+     * soon as the source has been read to EOF:
+     *
+     *   chars hash;
+     *   io::filtering_istream is;
+     *   is.push(blake2b_tee_filter<vector_sink>(vector_sink(hash), key));
+     *   is.push(socket_source);
+     *   ... read is until EOF ...  // now, hash holds the hash
      **/
 
   public:
@@ -169,8 +181,9 @@ class blake2b_tee_filter : public detail::filter_adapter<Device>
                                 const key_type& key,
                                 const std::size_t hashsize = HASHSIZE)
       : detail::filter_adapter<Device>(dev)
-      , key_{ key }
+      , key_{ std::make_shared<const key_type>(key) }
       , hashsize_{ hashsize }
+      , hash_sent_{ false }
     {
         // Some sanity checks first regarding the key and desired size
         if (key.size() != 0 && key.size() < KEYSIZE_MIN)
@@ -187,17 +200,17 @@ class blake2b_tee_filter : public detail::filter_adapter<Device>
             throw std::runtime_error{ "sodium::blake2b_tee_filter::blake2b_tee_"
                                       "filter() hash size too big" };
 
-        // initialize the BLAKE2b state machine
+        // initialize the BLAKE2b state machine, and keep a copy of the
+        // keyed initial state, to start afresh cheaply in close()
         if (key.size() != 0)
             crypto_generichash_init(
-              &state_, key_.data(), key_.size(), hashsize_);
+              &state_, key_->data(), key_->size(), hashsize_);
         else
             crypto_generichash_init(&state_, NULL, 0, hashsize_);
+        initial_ = state_;
 
-#ifndef NDEBUG
-        std::cerr << "sodium::blake2b_tee_filter::blake2b_tee_filter() called"
-                  << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_filter::blake2b_tee_filter()",
+                     "called");
     }
 
     /**
@@ -219,8 +232,9 @@ class blake2b_tee_filter : public detail::filter_adapter<Device>
     explicit blake2b_tee_filter(param_type dev,
                                 const std::size_t hashsize = HASHSIZE)
       : detail::filter_adapter<Device>(dev)
-      , key_{ 0, false }
+      , key_{ std::make_shared<const key_type>(0, false) }
       , hashsize_{ hashsize }
+      , hash_sent_{ false }
     {
         // Some sanity checks first regarding the desired size
         if (hashsize < HASHSIZE_MIN)
@@ -232,57 +246,60 @@ class blake2b_tee_filter : public detail::filter_adapter<Device>
 
         // initialize the BLAKE2b state machine (keyless version)
         crypto_generichash_init(&state_, NULL, 0, hashsize_);
+        initial_ = state_;
 
-#ifndef NDEBUG
-        std::cerr
-          << "sodium::blake2b_tee_filter::blake2b_tee_filter(keyless) called"
-          << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_filter::blake2b_tee_filter()",
+                     "(keyless) called");
     }
 
-    template<typename Source>
-    std::streamsize read(Source& src, char_type* s, std::streamsize n)
-    {
-        /**
-         * NOTE: This function is not called for some reason! (XXX)
-         * If yes, throw an std::runtime_exception (for now).
-         * Need to better understand when read() is invoked!
-         **/
+    /**
+     * Construct a blake2b_tee_filter in tree hashing mode: instead of
+     * the plain BLAKE2b hash, compute the sodium::tree_hash of the
+     * data, with leaves of leafsize bytes hashed concurrently on the
+     * threads of pool. The root hash, of size hashsize, is sent to the
+     * second sink when the input stream is about to be closed.
+     *
+     * The preconditions are the same as for the keyed constructor
+     * above, with key.size() == 0 selecting keyless hashing, plus
+     * leafsize > 0.
+     *
+     * The pool must outlive this filter. Copies of this filter share
+     * the same tree; as usual, only one of them may be written to.
+     **/
 
-        throw std::runtime_error{
-            "sodium::blake2b_tee_filter::read() called. FIXME!"
-        };
+    blake2b_tee_filter(param_type dev,
+                       const key_type& key,
+                       const std::size_t hashsize,
+                       thread_pool& pool,
+                       const std::size_t leafsize = tree_hash::LEAFSIZE)
+      : blake2b_tee_filter(dev, key, hashsize)
+    {
+        tree_ = std::make_shared<tree_hash>(*key_, hashsize_, leafsize, pool);
+    }
 
-        // Read (up to) n chars from src into buffer s
-        // and update the BLAKE2b state machine for this chunk
-        // using the crypto_generichash_*() streaming API update function:
+    /**
+     * Read (up to) n chars from src into s, passing them through
+     * unchanged, and update the BLAKE2b state (or tree) with them.
+     *
+     * In an input chain, the hash is sent to the tee-ed Device as soon
+     * as src is exhausted, i.e. when the data has been read to EOF.
+     * If the chain is closed before EOF, no hash is sent.
+     **/
 
+    template<typename Source>
+    std::streamsize read(Source& src, char_type* s, std::streamsize n)
+    {
         std::streamsize result = boost::iostreams::read(src, s, n);
 
-#ifndef NDEBUG
-        std::cerr << "WARNING !!! sodium::blake2b_tee_filter::read() called "
-                  << "[n=" << n << "] " << '\n';
-        if (result != -1) {
-            std::string s_as_string{ s, s + result };
-            std::cerr << "  [s=" << s_as_string << "]" << std::endl;
-        }
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_filter::read()",
+                     "called [n=" << n << "] [result=" << result << "]");
 
-        // if (result != -1) {
-        //   crypto_generichash_update(&state_,
-        // 				   reinterpret_cast<unsigned char *>(s),
-        // 				   result);
-        //
-        //   // Don't send anything to the second sink yet, since we're
-        //   // not done yet computing the BLAKE2b hash.
-        //
-        //   // std::streamsize result2 = iostreams::write(this->component(), s,
-        //   result);
-        //   // (void) result2; // Suppress 'unused variable' warning.
-        //   // BOOST_ASSERT(result == result2);
-        // }
+        if (result > 0)
+            update(s, result);
+        else if (result == -1 && !hash_sent_)
+            send_hash(); // EOF
 
-        return result; // nr. of bytes read.
+        return result; // nr. of bytes read, or -1 on EOF
     }
 
     template<typename Sink>
@@ -293,17 +310,14 @@ class blake2b_tee_filter : public detail::filter_adapter<Device>
 
         std::streamsize result = boost::iostreams::write(snk, s, n);
 
-#ifndef NDEBUG
-        std::string s_as_string{ s, s + result };
-        std::cerr << "sodium::blake2b_tee_filter::write() called "
-                  << "[n=" << n << "] "
-                  << "[s=" << s_as_string << "] "
-                  << "[result=" << result << "]" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_filter::write()",
+                     "called [n=" << n << "] "
+                                  << "[s=" << std::string(s, s + result)
+                                  << "] "
+                                  << "[result=" << result << "]");
 
-        // Update the BLAKE2b state with the chunk we've got:
-        crypto_generichash_update(
-          &state_, reinterpret_cast<const unsigned char*>(s), result);
+        // Update the BLAKE2b state (or tree) with the chunk we've got:
+        update(s, result);
 
         // Don't write anything yet to the second sink, because we're not
         // done yet computing the BLAKE2b MAC:
@@ -316,64 +330,80 @@ class blake2b_tee_filter : public detail::filter_adapter<Device>
     }
 
     template<typename Next>
-    void close(Next&, BOOST_IOS::openmode)
+    void close(Next&, BOOST_IOS::openmode which)
     {
-        // before closing, send the computed BLAKE2b hash:
-        auto out = new char_type[hashsize_];
-        crypto_generichash_final(
-          &state_, reinterpret_cast<unsigned char*>(out), hashsize_);
-
-#ifndef NDEBUG
-        std::streamsize result =
-#else
-        (void)
-#endif // ! NDEBUG
-          boost::iostreams::write(this->component(), out, hashsize_);
-
-#ifndef NDEBUG
-        hash_type out_as_hash_type_var{ out, out + hashsize_ };
-        std::string out_as_hex_string{ sodium::bin2hex<hash_type>(
-          out_as_hash_type_var) };
-        std::cerr << "sodium::blake2b_tee_filter::close() called "
-                  << "[result=" << result << "], "
-                  << "[hashsize=" << hashsize_ << "]" << '\n'
-                  << "  [out=" << out_as_hex_string << "]" << std::endl;
-#endif // ! NDEBUG
-
-        BOOST_ASSERT(static_cast<std::size_t>(result) == hashsize_);
+        // before closing an output chain, send the computed BLAKE2b hash
+        // (input chains have sent it already on EOF):
+        if (which == BOOST_IOS::out && !hash_sent_)
+            send_hash();
 
         // and now close the streams
         detail::close_all(this->component());
 
         // reset the BLAKE2b state so we can start afresh with new streams
-        if (key_.size() != 0)
-            crypto_generichash_init(
-              &state_, key_.data(), key_.size(), hashsize_);
-        else
-            crypto_generichash_init(&state_, NULL, 0, hashsize_);
-
-        delete[] out;
+        state_ = initial_;
+        hash_sent_ = false;
     }
 
     template<typename Sink>
     bool flush(Sink& snk)
     {
+        metrics::filter_flushed();
         bool r1 = boost::iostreams::flush(snk);
         bool r2 =
           boost::iostreams::flush(this->component()); // actually a NO-OP
 
-#ifndef NDEBUG
-        std::cerr << "sodium::blake2b_tee_filter::flush() called "
-                  << "[r1=" << r1 << ",r2=" << r2 << "]" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_filter::flush()",
+                     "called [r1=" << r1 << ",r2=" << r2 << "]");
 
         return r1 && r2;
     }
 
   private:
-    key_type key_;
+    void update(const char_type* s, std::streamsize n)
+    {
+        SODIUM_PROFILE_SPAN("blake2b_tee_filter", n);
+
+        if (tree_)
+            tree_->update(reinterpret_cast<const unsigned char*>(s), n);
+        else
+            crypto_generichash_update(
+              &state_, reinterpret_cast<const unsigned char*>(s), n);
+    }
+
+    // send the computed BLAKE2b hash to the tee-ed Device
+    void send_hash()
+    {
+        char_type out[HASHSIZE_MAX];
+        if (tree_)
+            tree_->final(reinterpret_cast<unsigned char*>(out)); // resets
+        else
+            crypto_generichash_final(
+              &state_, reinterpret_cast<unsigned char*>(out), hashsize_);
+
+        std::streamsize result =
+          boost::iostreams::write(this->component(), out, hashsize_);
+
+        SODIUM_TRACE("sodium::blake2b_tee_filter::send_hash()",
+                     "called [result=" << result << "], "
+                                       << "[hashsize=" << hashsize_ << "]"
+                                       << '\n'
+                                       << "  [out="
+                                       << sodium::bin2hex<hash_type>(
+                                            hash_type{ out, out + hashsize_ })
+                                       << "]");
+
+        BOOST_ASSERT(static_cast<std::size_t>(result) == hashsize_);
+        (void)result; // unused with NDEBUG
+        hash_sent_ = true;
+    }
+
+    std::shared_ptr<const key_type> key_; // shared by all copies
     std::size_t hashsize_;
     crypto_generichash_state state_;
+    crypto_generichash_state initial_; // keyed, nothing absorbed yet
+    std::shared_ptr<tree_hash> tree_;  // nullptr unless tree hashing
+    bool hash_sent_;                   // for this stream, already?
 };
 
 BOOST_IOSTREAMS_PIPABLE(blake2b_tee_filter, 1)
@@ -572,7 +602,7 @@ class blake2b_tee_device
                        const std::size_t hashsize)
       : dev_(device)
       , sink_(sink)
-      , key_{ key }
+      , key_{ std::make_shared<const key_type>(key) }
       , hashsize_{ hashsize }
     {
         // Some sanity checks first regarding the key and desired size
@@ -590,17 +620,17 @@ class blake2b_tee_device
             throw std::runtime_error{ "sodium::blake2b_tee_device::blake2b_tee_"
                                       "device() hash size too big" };
 
-        // initialize the BLAKE2b state machine
+        // initialize the BLAKE2b state machine, and keep a copy of the
+        // keyed initial state, to start afresh cheaply in close()
         if (key.size() != 0)
             crypto_generichash_init(
-              &state_, key_.data(), key_.size(), hashsize_);
+              &state_, key_->data(), key_->size(), hashsize_);
         else
             crypto_generichash_init(&state_, NULL, 0, hashsize_);
+        initial_ = state_;
 
-#ifndef NDEBUG
-        std::cerr << "sodium::blake2b_tee_device::blake2b_tee_device() called"
-                  << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_device::blake2b_tee_device()",
+                     "called");
     }
 
     /**
@@ -624,7 +654,7 @@ class blake2b_tee_device
                                 const std::size_t hashsize = HASHSIZE)
       : dev_(device)
       , sink_(sink)
-      , key_{ 0, false }
+      , key_{ std::make_shared<const key_type>(0, false) }
       , hashsize_{ hashsize }
     {
         // Some sanity checks first regarding the desired size
@@ -637,12 +667,10 @@ class blake2b_tee_device
 
         // initialize the BLAKE2b state machine (keyless version)
         crypto_generichash_init(&state_, NULL, 0, hashsize_);
+        initial_ = state_;
 
-#ifndef NDEBUG
-        std::cerr
-          << "sodium::blake2b_tee_device::blake2b_tee_device(keyless) called"
-          << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_device::blake2b_tee_device()",
+                     "(keyless) called");
     }
 
     std::streamsize read(char_type* s, std::streamsize n)
@@ -668,14 +696,11 @@ class blake2b_tee_device
 
         std::streamsize result1 = boost::iostreams::read(dev_, s, n);
 
-#ifndef NDEBUG
-        std::cerr << "WARNING !!! sodium::blake2b_tee_device::read() called "
-                  << "[n=" << n << "] " << '\n';
-        if (result1 != -1) {
-            std::string s_as_string{ s, s + result1 };
-            std::cerr << "  [s=" << s_as_string << "]" << std::endl;
-        }
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_device::read()",
+                     "WARNING !!! called [n=" << n << "] "
+                       << "[s="
+                       << (result1 != -1 ? std::string(s, s + result1) : "")
+                       << "]");
 
         // if (result1 != -1) {
         //   crypto_generichash_update(&state_,
@@ -709,13 +734,11 @@ class blake2b_tee_device
 
         BOOST_ASSERT(result1 == n); // sanity check: we didn't lose anything
 
-#ifndef NDEBUG
-        std::string s_as_string{ s, s + result1 };
-        std::cerr << "sodium::blake2b_tee_device::write() called "
-                  << "[n=" << n << "] "
-                  << "[s=" << s_as_string << "] "
-                  << "[result1=" << result1 << "]" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_device::write()",
+                     "called [n=" << n << "] "
+                                  << "[s=" << std::string(s, s + result1)
+                                  << "] "
+                                  << "[result1=" << result1 << "]");
 
         // Update the BLAKE2b state with the chunk we've got:
         crypto_generichash_update(
@@ -740,49 +763,40 @@ class blake2b_tee_device
         crypto_generichash_final(
           &state_, reinterpret_cast<unsigned char*>(out), hashsize_);
 
-#ifndef NDEBUG
         std::streamsize result =
-#else
-        (void)
-#endif // ! NDEBUG
           boost::iostreams::write(sink_, out, hashsize_);
 
-#ifndef NDEBUG
-        hash_type out_as_hash_type_var{ out, out + hashsize_ };
-        std::string out_as_string{ sodium::bin2hex<hash_type>(
-          out_as_hash_type_var) };
-        std::cerr << "sodium::blake2b_tee_device::close() called "
-                  << "[result=" << result << "] "
-                  << "[hashsize=" << hashsize_ << "]" << '\n'
-                  << "  [out=" << out_as_string << "]" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_device::close()",
+                     "called [result=" << result << "] "
+                                       << "[hashsize=" << hashsize_ << "]"
+                                       << '\n'
+                                       << "  [out="
+                                       << sodium::bin2hex<hash_type>(
+                                            hash_type{ out, out + hashsize_ })
+                                       << "]");
 
         // sanity check: we didn't lose anything
         BOOST_ASSERT(static_cast<std::size_t>(result) == hashsize_);
+        (void)result; // unused with NDEBUG
 
         // And now, close the streams
         detail::execute_all(detail::call_close_all(dev_),
                             detail::call_close_all(sink_));
 
         // reset the BLAKE2b state so we can start afresh with new streams:
-        if (key_.size() != 0)
-            crypto_generichash_init(
-              &state_, key_.data(), key_.size(), hashsize_);
-        else
-            crypto_generichash_init(&state_, NULL, 0, hashsize_);
+        state_ = initial_;
 
         delete[] out;
     }
 
     bool flush()
     {
+        metrics::filter_flushed();
         bool r1 = boost::iostreams::flush(dev_);
         bool r2 = boost::iostreams::flush(sink_);
 
-#ifndef NDEBUG
-        std::cerr << "sodium::blake2b_tee_device::flush() called "
-                  << "[r1=" << r1 << ",r2=" << r2 << "]" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::blake2b_tee_device::flush()",
+                     "called [r1=" << r1 << ",r2=" << r2 << "]");
 
         return r1 && r2;
     }
@@ -803,9 +817,10 @@ class blake2b_tee_device
   private:
     device_value dev_;
     sink_value sink_;
-    key_type key_;
+    std::shared_ptr<const key_type> key_; // shared by all copies
     std::size_t hashsize_;
     crypto_generichash_state state_;
+    crypto_generichash_state initial_; // keyed, nothing absorbed yet
 };
 
 template<typename Device, typename Sink>
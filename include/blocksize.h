@@ -0,0 +1,178 @@
+// blocksize.h -- Host calibration of the blocksize of the stream classes
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "common.h"
+#include "nonce.h"
+#include "span.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace sodium {
+
+/**
+ * sodium::blocksize calibrates the blocksize of the stream classes
+ * whose output doesn't depend on it (StreamHash, StreamSignorPK,
+ * StreamVerifierPK) on the host:
+ *
+ *   StreamHash sh(StreamHash::HASHSIZE, sodium::blocksize::auto_tune);
+ *
+ * makes sh use tuned(), measured the first time it is called, and
+ * cached for the lifetime of the process.
+ *
+ * The blocksize trades three costs against each other:
+ *   - the per-block overhead: one MAC of MACSIZE bytes, one nonce
+ *     increment and one libsodium call per block of the stream
+ *     cryptors, one istream::read() / ostream::write() per block of
+ *     all stream classes. It favours large blocks;
+ *   - the cache footprint: a block is read, encrypted and written,
+ *     i.e. touched three times, and should stay in the L1/L2 caches
+ *     meanwhile. It favours small blocks;
+ *   - the stream buffer copies between the stream and the class,
+ *     cheaper per byte for larger blocks.
+ *
+ * calibrate() measures the throughput of the read / encrypt / write
+ * loop of streamcryptor_aead for blocksizes from MIN to MAX, over
+ * in-memory string streams, and picks the smallest one within
+ * tolerance of the best throughput: beyond that, larger blocks only
+ * cost cache and latency. It is CPU and cache tuning only: it doesn't
+ * see the latency or throughput of files, pipes or sockets.
+ *
+ * CAUTION: the tuned blocksize is noisy, and can differ from one
+ * process to the next even on the same host. The stream cryptors
+ * (streamcryptor_aead, filecryptor_aead, async_streamcryptor_aead)
+ * don't store the blocksize in their output, and a stream must be
+ * decrypted with the blocksize it was encrypted with: they therefore
+ * refuse auto_tune. To use a calibrated blocksize with them anyway,
+ * pass tuned() explicitly, and store it along with the stream.
+ **/
+
+namespace blocksize {
+
+// pass as blocksize to the stream classes to use tuned()
+constexpr std::size_t auto_tune = static_cast<std::size_t>(-1);
+
+// the range of blocksizes calibrate() measures, in powers of 2
+constexpr std::size_t MIN = 1024;
+constexpr std::size_t MAX = 1024 * 1024;
+
+// the bytes streamed per blocksize by tuned()'s calibrate()
+constexpr std::size_t CALIBRATION_BYTES = 4 * 1024 * 1024;
+
+struct measurement
+{
+    std::size_t blocksize;
+    double bytes_per_second; // of plaintext, read + encrypt + write
+};
+
+struct calibration
+{
+    std::vector<measurement> measurements; // from MIN to MAX
+    std::size_t best;                      // the chosen blocksize
+};
+
+/**
+ * Measure the throughput of streaming bytes_per_blocksize bytes
+ * through the read / aead<> encrypt / write loop of
+ * streamcryptor_aead, for each blocksize from MIN to MAX, and pick
+ * the smallest one reaching (1 - tolerance) times the best
+ * throughput.
+ **/
+
+inline calibration
+calibrate(std::size_t bytes_per_blocksize = CALIBRATION_BYTES,
+          double tolerance = 0.05)
+{
+    using clock = std::chrono::steady_clock;
+
+    const aead<> sc_aead;
+    const span<const byte> header;
+    const std::string plaintext(std::max(bytes_per_blocksize, MAX), 'x');
+    buffer in(MAX);
+    buffer out(MAX + aead<>::MACSIZE);
+
+    calibration result;
+    for (std::size_t size = MIN; size <= MAX; size *= 2) {
+        std::istringstream istr(plaintext);
+        std::ostringstream ostr;
+        aead<>::nonce_type nonce(false);
+        const std::size_t nblocks = std::max<std::size_t>(
+          1, bytes_per_blocksize / size);
+
+        const auto start = clock::now();
+        for (std::size_t i = 0; i != nblocks; ++i) {
+            istr.read(reinterpret_cast<char*>(in.data()), size);
+            sc_aead.encrypt(span<byte>(out.data(), size + aead<>::MACSIZE),
+                            header,
+                            span<const byte>(in.data(), size),
+                            nonce);
+            nonce.increment();
+            ostr.write(reinterpret_cast<const char*>(out.data()),
+                       size + aead<>::MACSIZE);
+        }
+        const std::chrono::duration<double> elapsed = clock::now() - start;
+
+        result.measurements.push_back(
+          { size,
+            static_cast<double>(nblocks * size) /
+              std::max(elapsed.count(), 1e-9) });
+    }
+
+    double best = 0;
+    for (const auto& m : result.measurements)
+        best = std::max(best, m.bytes_per_second);
+    result.best = MAX;
+    for (const auto& m : result.measurements)
+        if (m.bytes_per_second >= (1 - tolerance) * best) {
+            result.best = m.blocksize;
+            break;
+        }
+
+    return result;
+}
+
+/**
+ * The blocksize chosen by calibrate() on this host. The calibration
+ * runs once per process, on the first call (which takes a few tens
+ * of milliseconds); later calls return the cached result.
+ **/
+
+inline std::size_t
+tuned()
+{
+    static const std::size_t result = calibrate().best;
+    return result;
+}
+
+// blocksize, or tuned() if blocksize is auto_tune
+inline std::size_t
+resolve(std::size_t blocksize)
+{
+    return blocksize == auto_tune ? tuned() : blocksize;
+}
+
+} // namespace blocksize
+
+} // namespace sodium
@@ -0,0 +1,179 @@
+// bloom_filter.h -- A keyed, cache-blocked Bloom filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "hasher_short.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * sodium::bloom_filter is a Bloom filter whose hash functions are
+ * keyed with a sodium::hasher_short: without the secret key, an
+ * attacker can't craft values that set the same bits (and so drive
+ * up the false positive rate), nor test membership offline.
+ *
+ * The filter is split into blocks of one cache line (512 bits). Each
+ * value is hashed once, with the 128-bit SipHash of
+ * hasher_short::hash128(): 64 bits pick the block, and the next 64
+ * bits derive the k probes inside that block by double hashing. An
+ * insertion or a lookup therefore costs one hash and one cache miss,
+ * whatever k is. In exchange, a blocked filter needs a few percent
+ * more bits than a classic one for the same false positive rate.
+ *
+ *   sodium::hasher_short<> hasher;
+ *   sodium::bloom_filter<> seen(hasher, 1000000, 0.001);
+ *   seen.insert(std::string{ "alice" });
+ *   if (seen.possibly_contains(name)) ... // maybe, check for real
+ *
+ * Values are hashed like in sodium::short_hash<T> (see hasher_short.h).
+ * The filter only refers to the hasher_short, which must outlive it.
+ * Lookups may run concurrently; insertions need exclusive access.
+ **/
+
+namespace sodium {
+
+template<class BT = bytes>
+class bloom_filter
+{
+  public:
+    static constexpr std::size_t BLOCKBITS = 512; // one cache line
+    static constexpr std::size_t MAX_HASHES = 16;
+
+    /**
+     * A filter for about expected values, with a false positive rate
+     * of about fp_rate once they have been inserted. Throw a
+     * std::runtime_error unless 0 < fp_rate < 1.
+     **/
+
+    bloom_filter(const hasher_short<BT>& hasher,
+                 std::size_t expected,
+                 double fp_rate = 0.01)
+      : hasher_{ &hasher }
+    {
+        if (!(fp_rate > 0.0 && fp_rate < 1.0))
+            throw std::runtime_error{
+                "sodium::bloom_filter::bloom_filter() wrong fp_rate"
+            };
+
+        const double ln2 = std::log(2.0);
+        const double n =
+          static_cast<double>(std::max<std::size_t>(expected, 1));
+        const double bits = -n * std::log(fp_rate) / (ln2 * ln2);
+        const auto nblocks = static_cast<std::size_t>(
+          std::ceil(bits / static_cast<double>(BLOCKBITS)));
+        blocks_.resize(std::max<std::size_t>(nblocks, 1));
+
+        const auto k = static_cast<std::size_t>(std::lround(bits / n * ln2));
+        hashes_ = std::min(std::max<std::size_t>(k, 1), MAX_HASHES);
+    }
+
+    // Add the size bytes at data to the filter
+    void insert(const void* data, std::size_t size) noexcept
+    {
+        const auto h = hasher_->hash128(data, size);
+        block_type& block = blocks_[block_of(h[0])];
+        for_each_probe(h[1], [&block](std::size_t bit) {
+            block.words[bit / 64] |= std::uint64_t{ 1 } << (bit % 64);
+        });
+        ++count_;
+    }
+
+    template<typename T>
+    void insert(const T& value) noexcept
+    {
+        const span<const byte> bytes = short_hash_detail::bytes_of(value);
+        insert(bytes.data(), bytes.size());
+    }
+
+    /**
+     * False if the size bytes at data have certainly not been
+     * inserted. True if they have, or (with about the false positive
+     * rate of the filter) if they haven't.
+     **/
+
+    bool possibly_contains(const void* data, std::size_t size) const noexcept
+    {
+        const auto h = hasher_->hash128(data, size);
+        const block_type& block = blocks_[block_of(h[0])];
+        std::uint64_t missing = 0;
+        for_each_probe(h[1], [&block, &missing](std::size_t bit) {
+            const std::uint64_t mask = std::uint64_t{ 1 } << (bit % 64);
+            missing |= ~block.words[bit / 64] & mask;
+        });
+        return missing == 0;
+    }
+
+    template<typename T>
+    bool possibly_contains(const T& value) const noexcept
+    {
+        const span<const byte> bytes = short_hash_detail::bytes_of(value);
+        return possibly_contains(bytes.data(), bytes.size());
+    }
+
+    // Forget all inserted values
+    void clear() noexcept
+    {
+        std::fill(blocks_.begin(), blocks_.end(), block_type{});
+        count_ = 0;
+    }
+
+    // the size of the filter in bits, and the number of probes k
+    std::size_t size_bits() const noexcept
+    {
+        return blocks_.size() * BLOCKBITS;
+    }
+    std::size_t hashes() const noexcept { return hashes_; }
+
+    // the number of insert() calls since construction or clear()
+    std::size_t count() const noexcept { return count_; }
+
+  private:
+    struct alignas(64) block_type
+    {
+        std::uint64_t words[BLOCKBITS / 64] = {};
+    };
+
+    std::size_t block_of(std::uint64_t h) const noexcept
+    {
+        return static_cast<std::size_t>(h % blocks_.size());
+    }
+
+    // call f(bit) for the hashes_ probes, bit in [0, BLOCKBITS)
+    template<typename F>
+    void for_each_probe(std::uint64_t h, F f) const noexcept
+    {
+        const auto h1 = static_cast<std::uint32_t>(h);
+        const auto h2 = static_cast<std::uint32_t>(h >> 32) | 1; // odd
+        for (std::size_t i = 0; i != hashes_; ++i)
+            f(static_cast<std::size_t>(h1 + i * h2) % BLOCKBITS);
+    }
+
+    const hasher_short<BT>* hasher_;
+    std::vector<block_type> blocks_;
+    std::size_t hashes_;
+    std::size_t count_ = 0;
+};
+
+} // namespace sodium
@@ -19,9 +19,18 @@
 #pragma once
 
 #include "common.h"
+#include "error.h"
+#include "extern_templates.h"
 #include "key.h"
 #include "keypair.h"
 #include "nonce.h"
+#include "span.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <future>
+#include <system_error>
+#include <vector>
 
 namespace sodium {
 
@@ -76,7 +85,7 @@ class box
     BT encrypt(const BT& plaintext,
                const public_key_type& public_key,
                const private_key_type& private_key,
-               const nonce_type& nonce)
+               const nonce_type& nonce) const
     {
         // some sanity checks before we get started
         if (public_key.size() != KEYSIZE_PUBLIC_KEY)
@@ -117,7 +126,7 @@ class box
      **/
     BT encrypt(const BT& plaintext,
                const keypair_type& keypair,
-               const nonce_type& nonce)
+               const nonce_type& nonce) const
     {
         // no sanity checks necessary before we get started
 
@@ -150,7 +159,7 @@ class box
                const public_key_type& public_key,
                const private_key_type& private_key,
                const nonce_type& nonce,
-               BT& mac)
+               BT& mac) const
     {
         // some sanity checks before we get started
         if (public_key.size() != KEYSIZE_PUBLIC_KEY)
@@ -190,7 +199,7 @@ class box
     BT encrypt(const BT& plaintext,
                const keypair_type& keypair,
                const nonce_type& nonce,
-               BT& mac)
+               BT& mac) const
     {
         // sanity check before we get started
         if (mac.size() != MACSIZE)
@@ -234,7 +243,7 @@ class box
     BT decrypt(const BT& ciphertext_with_mac,
                const private_key_type& private_key,
                const public_key_type& public_key,
-               const nonce_type& nonce)
+               const nonce_type& nonce) const
     {
         // some sanity checks before we get started
         if (ciphertext_with_mac.size() < MACSIZE)
@@ -275,7 +284,7 @@ class box
                const private_key_type& private_key,
                const public_key_type& public_key,
                const nonce_type& nonce,
-               const BT& mac)
+               const BT& mac) const
     {
         // some sanity checks before we get started
         if (mac.size() != MACSIZE)
@@ -318,7 +327,7 @@ class box
 
     BT decrypt(const BT& ciphertext_with_mac,
                const keypair_type& keypair,
-               const nonce_type& nonce)
+               const nonce_type& nonce) const
     {
         // some sanity checks before we get started
         if (ciphertext_with_mac.size() < MACSIZE)
@@ -354,7 +363,7 @@ class box
     BT decrypt(const BT& ciphertext,
                const keypair_type& keypair,
                const nonce_type& nonce,
-               const BT& mac)
+               const BT& mac) const
     {
         // some sanity checks before we get started
         if (mac.size() != MACSIZE)
@@ -378,6 +387,255 @@ class box
 
         return decrypted;
     }
+
+    /**
+     * Non-throwing variants of the decrypt() functions above.
+     *
+     * Instead of throwing a std::runtime_error, they set ec to
+     * sodium::errc::verification_failed if the ciphertext or the MAC
+     * have been tampered with or the signature doesn't verify, or to
+     * sodium::errc::message_too_short or sodium::errc::wrong_size, and
+     * return an empty BT. On success, ec is cleared. See error.h.
+     **/
+
+    BT decrypt(const BT& ciphertext_with_mac,
+               const private_key_type& private_key,
+               const public_key_type& public_key,
+               const nonce_type& nonce,
+               std::error_code& ec) const
+    {
+        if (ciphertext_with_mac.size() < MACSIZE) {
+            ec = errc::message_too_short;
+            return BT();
+        }
+        if (public_key.size() != KEYSIZE_PUBLIC_KEY) {
+            ec = errc::wrong_size;
+            return BT();
+        }
+
+        BT decrypted(ciphertext_with_mac.size() - MACSIZE);
+        if (crypto_box_open_easy(
+              reinterpret_cast<unsigned char*>(decrypted.data()),
+              reinterpret_cast<const unsigned char*>(
+                ciphertext_with_mac.data()),
+              ciphertext_with_mac.size(),
+              nonce.data(),
+              reinterpret_cast<const unsigned char*>(public_key.data()),
+              private_key.data()) != 0) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
+        return decrypted;
+    }
+
+    BT decrypt(const BT& ciphertext,
+               const private_key_type& private_key,
+               const public_key_type& public_key,
+               const nonce_type& nonce,
+               const BT& mac,
+               std::error_code& ec) const
+    {
+        if (mac.size() != MACSIZE || public_key.size() != KEYSIZE_PUBLIC_KEY) {
+            ec = errc::wrong_size;
+            return BT();
+        }
+
+        BT decrypted(ciphertext.size());
+        if (crypto_box_open_detached(
+              reinterpret_cast<unsigned char*>(decrypted.data()),
+              reinterpret_cast<const unsigned char*>(ciphertext.data()),
+              reinterpret_cast<const unsigned char*>(mac.data()),
+              ciphertext.size(),
+              nonce.data(),
+              reinterpret_cast<const unsigned char*>(public_key.data()),
+              private_key.data()) != 0) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
+        return decrypted;
+    }
+
+    BT decrypt(const BT& ciphertext_with_mac,
+               const keypair_type& keypair,
+               const nonce_type& nonce,
+               std::error_code& ec) const
+    {
+        return decrypt(ciphertext_with_mac,
+                       keypair.private_key(),
+                       keypair.public_key(),
+                       nonce,
+                       ec);
+    }
+
+    BT decrypt(const BT& ciphertext,
+               const keypair_type& keypair,
+               const nonce_type& nonce,
+               const BT& mac,
+               std::error_code& ec) const
+    {
+        return decrypt(ciphertext,
+                       keypair.private_key(),
+                       keypair.public_key(),
+                       nonce,
+                       mac,
+                       ec);
+    }
+
+    /**
+     * Batch open, e.g. of the inbox of one recipient: decrypt each
+     * (MAC || ciphertext) ciphertexts[i] from the sender senders[i],
+     * with the nonce nonces[i] and the recipient's private_key,
+     * spreading the messages over the threads of pool in the second
+     * version. For each run of consecutive messages from the same
+     * sender, the shared key is computed only once.
+     *
+     * The plaintexts are written back to back into the single arena,
+     * which must have at least open_size(ciphertexts) bytes, and
+     * plaintexts[i] is set to the part of arena holding the plaintext
+     * of ciphertexts[i]. opened[i] is set to 1 if ciphertexts[i]
+     * opened, or to 0 if it was too small, tampered with, or not from
+     * senders[i]; its part of arena is then wiped, and plaintexts[i]
+     * is empty. One failure doesn't stop the other messages.
+     *
+     * Return -1 without decrypting anything if nonces, senders, arena,
+     * plaintexts or opened are too small, and 0 otherwise. The first
+     * version never throws; the second one throws only if pool can't
+     * take the tasks, and then only once the tasks it already took are
+     * done.
+     **/
+
+    static std::size_t open_size(
+      span<const span<const byte>> ciphertexts) noexcept
+    {
+        std::size_t size = 0;
+        for (const auto& ciphertext : ciphertexts)
+            if (ciphertext.size() >= MACSIZE)
+                size += ciphertext.size() - MACSIZE;
+        return size;
+    }
+
+    int decrypt_batch(span<byte> arena,
+                      span<span<byte>> plaintexts,
+                      span<byte> opened,
+                      span<const span<const byte>> ciphertexts,
+                      span<const nonce_type> nonces,
+                      span<const public_key_type> senders,
+                      const private_key_type& private_key) const noexcept
+    {
+        if (!layout_batch(arena, plaintexts, opened, ciphertexts, nonces,
+                          senders))
+            return -1;
+        open_range(plaintexts, opened, ciphertexts, nonces, senders,
+                   private_key, 0, ciphertexts.size());
+        return 0;
+    }
+
+    int decrypt_batch(span<byte> arena,
+                      span<span<byte>> plaintexts,
+                      span<byte> opened,
+                      span<const span<const byte>> ciphertexts,
+                      span<const nonce_type> nonces,
+                      span<const public_key_type> senders,
+                      const private_key_type& private_key,
+                      thread_pool& pool) const
+    {
+        if (!layout_batch(arena, plaintexts, opened, ciphertexts, nonces,
+                          senders))
+            return -1;
+
+        const std::size_t n = ciphertexts.size();
+        const std::size_t ntasks = std::min(pool.size(), n);
+        std::vector<std::future<void>> results;
+        results.reserve(ntasks);
+        try {
+            for (std::size_t t = 0; t != ntasks; ++t) {
+                const std::size_t first = n * t / ntasks;
+                const std::size_t last = n * (t + 1) / ntasks;
+                results.push_back(pool.submit([=, &private_key] {
+                    open_range(plaintexts, opened, ciphertexts, nonces,
+                               senders, private_key, first, last);
+                }));
+            }
+            for (auto& result : results)
+                pool.get(result);
+        } catch (...) {
+            // the pending tasks use private_key and arena: let them finish
+            for (auto& result : results)
+                if (result.valid())
+                    pool.wait(result);
+            throw;
+        }
+        return 0;
+    }
+
+  private:
+    // check the sizes of a decrypt_batch(), and carve up arena
+    static bool layout_batch(span<byte> arena,
+                             span<span<byte>> plaintexts,
+                             span<byte> opened,
+                             span<const span<const byte>> ciphertexts,
+                             span<const nonce_type> nonces,
+                             span<const public_key_type> senders) noexcept
+    {
+        const std::size_t n = ciphertexts.size();
+        if (plaintexts.size() < n || opened.size() < n || nonces.size() < n ||
+            senders.size() < n || arena.size() < open_size(ciphertexts))
+            return false;
+
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i != n; ++i) {
+            const std::size_t size = ciphertexts[i].size() >= MACSIZE
+                                       ? ciphertexts[i].size() - MACSIZE
+                                       : 0;
+            plaintexts[i] = arena.subspan(offset, size);
+            offset += size;
+        }
+        return true;
+    }
+
+    static void open_range(span<span<byte>> plaintexts,
+                           span<byte> opened,
+                           span<const span<const byte>> ciphertexts,
+                           span<const nonce_type> nonces,
+                           span<const public_key_type> senders,
+                           const private_key_type& private_key,
+                           std::size_t first,
+                           std::size_t last) noexcept
+    {
+        unsigned char shared[crypto_box_BEFORENMBYTES];
+        bool have_shared = false;
+
+        for (std::size_t i = first; i != last; ++i) {
+            const public_key_type& sender = senders[i];
+            if (i == first || !(sender == senders[i - 1]))
+                have_shared =
+                  sender.size() == KEYSIZE_PUBLIC_KEY &&
+                  crypto_box_beforenm(
+                    shared,
+                    reinterpret_cast<const unsigned char*>(sender.data()),
+                    private_key.data()) == 0;
+
+            opened[i] = have_shared && ciphertexts[i].size() >= MACSIZE &&
+                        crypto_box_open_easy_afternm(plaintexts[i].data(),
+                                                     ciphertexts[i].data(),
+                                                     ciphertexts[i].size(),
+                                                     nonces[i].data(),
+                                                     shared) == 0;
+            if (!opened[i]) {
+                ::sodium_memzero(plaintexts[i].data(), plaintexts[i].size());
+                plaintexts[i] = span<byte>(plaintexts[i].data(), 0);
+            }
+        }
+
+        ::sodium_memzero(shared, sizeof shared);
+    }
 };
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(box);
+
 } // namespace sodium
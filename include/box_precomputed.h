@@ -19,11 +19,14 @@
 #pragma once
 
 #include "common.h"
+#include "error.h"
+#include "extern_templates.h"
 #include "key.h"
 #include "keypair.h"
 #include "nonce.h"
 
 #include <stdexcept>
+#include <system_error>
 
 #include <sodium.h>
 
@@ -195,7 +198,7 @@ class box_precomputed
      *  - the shared key is not ready
      **/
 
-    BT encrypt(const BT& plaintext, const nonce_type& nonce)
+    BT encrypt(const BT& plaintext, const nonce_type& nonce) const
     {
         // some sanity checks before we start
         if (!shared_key_ready_)
@@ -225,7 +228,7 @@ class box_precomputed
      * XXX Document me
      **/
 
-    BT encrypt(const BT& plaintext, const nonce_type& nonce, BT& mac)
+    BT encrypt(const BT& plaintext, const nonce_type& nonce, BT& mac) const
     {
         // some sanity checks before we start
         if (!shared_key_ready_)
@@ -276,7 +279,7 @@ class box_precomputed
      *  - the shared key isn't ready
      **/
 
-    BT decrypt(const BT& ciphertext_with_mac, const nonce_type& nonce)
+    BT decrypt(const BT& ciphertext_with_mac, const nonce_type& nonce) const
     {
         // some sanity checks before we start
         if (ciphertext_with_mac.size() < MACSIZE)
@@ -311,7 +314,9 @@ class box_precomputed
      * XXX Document me (yada, yada, yada...)
      **/
 
-    BT decrypt(const BT& ciphertext, const nonce_type& nonce, const BT& mac)
+    BT decrypt(const BT& ciphertext,
+               const nonce_type& nonce,
+               const BT& mac) const
     {
         // some sanity checks before we start
         if (mac.size() != MACSIZE)
@@ -341,9 +346,81 @@ class box_precomputed
         return decrypted; // move semantics
     }
 
+    /**
+     * Non-throwing variants of the decrypt() functions above.
+     *
+     * Instead of throwing a std::runtime_error, they set ec to
+     * sodium::errc::verification_failed if decryption failed, to
+     * sodium::errc::invalid_key if the shared key isn't ready, or to
+     * sodium::errc::message_too_short or sodium::errc::wrong_size, and
+     * return an empty BT. On success, ec is cleared. See error.h.
+     **/
+
+    BT decrypt(const BT& ciphertext_with_mac,
+               const nonce_type& nonce,
+               std::error_code& ec) const
+    {
+        if (ciphertext_with_mac.size() < MACSIZE) {
+            ec = errc::message_too_short;
+            return BT();
+        }
+        if (!shared_key_ready_) {
+            ec = errc::invalid_key;
+            return BT();
+        }
+
+        BT decrypted(ciphertext_with_mac.size() - MACSIZE);
+        if (crypto_box_open_easy_afternm(
+              reinterpret_cast<unsigned char*>(decrypted.data()),
+              reinterpret_cast<const unsigned char*>(
+                ciphertext_with_mac.data()),
+              ciphertext_with_mac.size(),
+              nonce.data(),
+              shared_key_.data()) != 0) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
+        return decrypted;
+    }
+
+    BT decrypt(const BT& ciphertext,
+               const nonce_type& nonce,
+               const BT& mac,
+               std::error_code& ec) const
+    {
+        if (mac.size() != MACSIZE) {
+            ec = errc::wrong_size;
+            return BT();
+        }
+        if (!shared_key_ready_) {
+            ec = errc::invalid_key;
+            return BT();
+        }
+
+        BT decrypted(ciphertext.size());
+        if (crypto_box_open_detached_afternm(
+              reinterpret_cast<unsigned char*>(decrypted.data()),
+              reinterpret_cast<const unsigned char*>(ciphertext.data()),
+              reinterpret_cast<const unsigned char*>(mac.data()),
+              ciphertext.size(),
+              nonce.data(),
+              shared_key_.data()) != 0) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
+        return decrypted;
+    }
+
   private:
     key<KEYSIZE_SHAREDKEY> shared_key_;
     bool shared_key_ready_;
 };
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(box_precomputed);
+
 } // namespace sodium
@@ -0,0 +1,272 @@
+// box_precomputed_cache.h -- Bounded cache of sodium::box_precomputed keys
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "box_precomputed.h"
+#include "common.h"
+#include "key.h"
+#include "keypair.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<typename BT = bytes>
+class box_precomputed_cache
+{
+    /**
+     * A box_precomputed_cache keeps the most recently used
+     * sodium::box_precomputed<BT> objects, i.e. the shared keys of
+     * crypto_box_beforenm(), keyed by (local private key, peer public
+     * key). Repeat peers thus skip the X25519 scalar multiplication.
+     *
+     * The cache holds at most capacity shared keys. It is split into
+     * shards, each with its own mutex and its own LRU list, so that
+     * concurrent lookups of different peers rarely contend. When a
+     * shard is full, its least recently used entry is evicted.
+     *
+     * The shared keys live in the protected memory of the
+     * box_precomputed objects, and are zeroed when the last reference
+     * to them is gone. The private keys aren't stored at all: entries
+     * are indexed by a BLAKE2b hash of (private key || public key),
+     * keyed with a random secret that is private to each cache.
+     *
+     * All member functions are thread-safe.
+     **/
+
+  public:
+    using box_type = box_precomputed<BT>;
+    using private_key_type = typename box_type::private_key_type;
+    using public_key_type = typename box_type::public_key_type;
+
+    // the default number of shards
+    static constexpr std::size_t SHARDS = 16;
+
+    struct stats_type
+    {
+        std::size_t hits;      // get()s that found their shared key
+        std::size_t misses;    // get()s that had to compute it
+        std::size_t evictions; // entries dropped to make room
+        std::size_t size;      // entries currently in the cache
+    };
+
+    /**
+     * Create an empty cache of (about) capacity shared keys, split
+     * into shards shards. Every shard holds capacity / shards entries,
+     * rounded up.
+     *
+     * Throw a std::runtime_error if capacity or shards is 0.
+     **/
+
+    explicit box_precomputed_cache(const std::size_t capacity,
+                                   const std::size_t shards = SHARDS)
+      : shard_capacity_{ shards != 0 ? (capacity + shards - 1) / shards : 0 }
+      , shards_(shards)
+    {
+        if (capacity == 0)
+            throw std::runtime_error{ "sodium::box_precomputed_cache::box_"
+                                      "precomputed_cache() capacity is 0" };
+        if (shards == 0)
+            throw std::runtime_error{ "sodium::box_precomputed_cache::box_"
+                                      "precomputed_cache() shards is 0" };
+    }
+
+    box_precomputed_cache(const box_precomputed_cache&) = delete;
+    box_precomputed_cache& operator=(const box_precomputed_cache&) = delete;
+
+    /**
+     * Return the box_precomputed for (private_key, public_key),
+     * computing and caching it first if it isn't in the cache yet.
+     *
+     * The returned object remains valid even after it has been evicted
+     * from the cache. Its (const) encrypt() and decrypt() member
+     * functions can be called concurrently from multiple threads.
+     *
+     * Throw a std::runtime_error like box_precomputed's constructor,
+     * e.g. if public_key has the wrong size. Failures are not cached.
+     **/
+
+    std::shared_ptr<const box_type> get(const private_key_type& private_key,
+                                        const public_key_type& public_key)
+    {
+        const index_type index = index_of(private_key, public_key);
+        shard_type& shard = shard_of(index);
+
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.map.find(index);
+            if (it != shard.map.end()) {
+                ++shard.hits;
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                return it->second->second;
+            }
+            ++shard.misses;
+        }
+
+        // compute the shared key without holding the lock
+        auto box = std::make_shared<const box_type>(private_key, public_key);
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(index);
+        if (it != shard.map.end()) {
+            // someone else was faster: keep theirs
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return it->second->second;
+        }
+
+        if (shard.map.size() >= shard_capacity_) {
+            shard.map.erase(shard.lru.back().first);
+            shard.lru.pop_back();
+            ++shard.evictions;
+        }
+        shard.lru.emplace_front(index, box);
+        shard.map.emplace(index, shard.lru.begin());
+
+        return box;
+    }
+
+    // shorthand for get(keypair.private_key(), keypair.public_key())
+    std::shared_ptr<const box_type> get(const keypair<BT>& keypair)
+    {
+        return get(keypair.private_key(), keypair.public_key());
+    }
+
+    /**
+     * Evict the shared key of (private_key, public_key) from the
+     * cache. Return true if it was in the cache.
+     **/
+
+    bool erase(const private_key_type& private_key,
+               const public_key_type& public_key)
+    {
+        const index_type index = index_of(private_key, public_key);
+        shard_type& shard = shard_of(index);
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(index);
+        if (it == shard.map.end())
+            return false;
+        shard.lru.erase(it->second);
+        shard.map.erase(it);
+        return true;
+    }
+
+    // evict all shared keys; the statistics are kept
+    void clear()
+    {
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.map.clear();
+            shard.lru.clear();
+        }
+    }
+
+    // a snapshot of the hit/miss statistics, summed over all shards
+    stats_type stats() const
+    {
+        stats_type result{ 0, 0, 0, 0 };
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            result.hits += shard.hits;
+            result.misses += shard.misses;
+            result.evictions += shard.evictions;
+            result.size += shard.map.size();
+        }
+        return result;
+    }
+
+    // the maximum number of shared keys in the cache
+    std::size_t capacity() const
+    {
+        return shard_capacity_ * shards_.size();
+    }
+
+  private:
+    using index_type = std::array<unsigned char, 32>;
+
+    // the index is a keyed hash: its first bytes are as good as any hash
+    struct index_hash
+    {
+        std::size_t operator()(const index_type& index) const noexcept
+        {
+            std::size_t result;
+            std::memcpy(&result, index.data(), sizeof result);
+            return result;
+        }
+    };
+
+    using entry_type = std::pair<index_type, std::shared_ptr<const box_type>>;
+    using lru_type = std::list<entry_type>; // most recently used first
+
+    struct shard_type
+    {
+        mutable std::mutex mutex;
+        lru_type lru;
+        std::unordered_map<index_type, typename lru_type::iterator, index_hash>
+          map;
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+        std::size_t evictions = 0;
+    };
+
+    index_type index_of(const private_key_type& private_key,
+                        const public_key_type& public_key) const
+    {
+        crypto_generichash_state state;
+        crypto_generichash_init(
+          &state, secret_.data(), secret_.size(), index_type().size());
+        crypto_generichash_update(
+          &state,
+          reinterpret_cast<const unsigned char*>(private_key.data()),
+          private_key.size());
+        crypto_generichash_update(
+          &state,
+          reinterpret_cast<const unsigned char*>(public_key.data()),
+          public_key.size());
+
+        index_type index;
+        crypto_generichash_final(&state, index.data(), index.size());
+        return index;
+    }
+
+    // use other bytes of the index than index_hash does
+    shard_type& shard_of(const index_type& index)
+    {
+        const std::size_t n = (std::size_t{ index[30] } << 8) | index[31];
+        return shards_[n % shards_.size()];
+    }
+
+    key<KEYSIZE_HASHKEY> secret_; // random
+    std::size_t shard_capacity_;
+    std::vector<shard_type> shards_;
+};
+
+} // namespace sodium
@@ -21,8 +21,20 @@
 #include <sodium.h>
 
 #include "common.h"
+#include "error.h"
+#include "extern_templates.h"
 #include "key.h"
 #include "keypair.h"
+#include "span.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
 
 namespace sodium {
 
@@ -37,6 +49,17 @@ class box_seal
       sodium::keypair<BT>::KEYSIZE_PRIVATE_KEY;
     static constexpr std::size_t SEALSIZE = crypto_box_SEALBYTES;
 
+    // the multi-recipient format, see encrypt_multi()
+    static constexpr std::size_t MULTI_KEYSIZE =
+      crypto_aead_xchacha20poly1305_ietf_KEYBYTES;
+    static constexpr std::size_t MULTI_WRAPSIZE = SEALSIZE + MULTI_KEYSIZE;
+    static constexpr std::size_t MULTI_HEADERSIZE = 4;
+    static constexpr std::size_t MULTI_MACSIZE =
+      crypto_aead_xchacha20poly1305_ietf_ABYTES;
+    static constexpr std::size_t MULTI_NONCESIZE =
+      crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
     using public_key_type = typename sodium::keypair<BT>::public_key_type;
     using private_key_type = typename sodium::keypair<BT>::private_key_type;
 
@@ -64,7 +87,7 @@ class box_seal
      * this function here.
      **/
 
-    BT encrypt(const BT& plaintext, const public_key_type& public_key)
+    BT encrypt(const BT& plaintext, const public_key_type& public_key) const
     {
         // some sanity checks before we get started
         if (public_key.size() != KEYSIZE_PUBLIC_KEY)
@@ -89,7 +112,7 @@ class box_seal
      * Otherwise, see encrypt() above.
      **/
 
-    BT encrypt(const BT& plaintext, const keypair<BT>& keypair)
+    BT encrypt(const BT& plaintext, const keypair<BT>& keypair) const
     {
         return encrypt(plaintext, keypair.public_key());
     }
@@ -118,7 +141,7 @@ class box_seal
 
     BT decrypt(const BT& ciphertext_with_seal,
                const private_key_type& private_key,
-               const public_key_type& public_key)
+               const public_key_type& public_key) const
     {
         // some sanity checks before we get started
         if (public_key.size() != KEYSIZE_PUBLIC_KEY)
@@ -155,11 +178,444 @@ class box_seal
      * Otherwise, see decrypt() above.
      **/
 
-    BT decrypt(const BT& ciphertext_with_seal, const keypair<BT>& keypair)
+    BT decrypt(const BT& ciphertext_with_seal, const keypair<BT>& keypair) const
     {
         return decrypt(
           ciphertext_with_seal, keypair.private_key(), keypair.public_key());
     }
+
+    /**
+     * Non-throwing variants of the decrypt() functions above.
+     *
+     * Instead of throwing a std::runtime_error, they set ec to
+     * sodium::errc::verification_failed if the ciphertext can't be
+     * decrypted, or to sodium::errc::message_too_short or
+     * sodium::errc::wrong_size, and return an empty BT. On success, ec
+     * is cleared. See error.h.
+     **/
+
+    BT decrypt(const BT& ciphertext_with_seal,
+               const private_key_type& private_key,
+               const public_key_type& public_key,
+               std::error_code& ec) const
+    {
+        if (public_key.size() != KEYSIZE_PUBLIC_KEY) {
+            ec = errc::wrong_size;
+            return BT();
+        }
+        if (ciphertext_with_seal.size() < SEALSIZE) {
+            ec = errc::message_too_short;
+            return BT();
+        }
+
+        BT decrypted(ciphertext_with_seal.size() - SEALSIZE);
+        if (crypto_box_seal_open(
+              reinterpret_cast<unsigned char*>(decrypted.data()),
+              reinterpret_cast<const unsigned char*>(
+                ciphertext_with_seal.data()),
+              ciphertext_with_seal.size(),
+              reinterpret_cast<const unsigned char*>(public_key.data()),
+              private_key.data()) != 0) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
+        return decrypted;
+    }
+
+    BT decrypt(const BT& ciphertext_with_seal,
+               const keypair<BT>& keypair,
+               std::error_code& ec) const
+    {
+        return decrypt(ciphertext_with_seal,
+                       keypair.private_key(),
+                       keypair.public_key(),
+                       ec);
+    }
+
+    /**
+     * Batch open, e.g. of the inbox of one recipient: decrypt all the
+     * ciphertexts created by encrypt() for keypair, spreading them
+     * over the threads of pool in the second version.
+     *
+     * The plaintexts are written back to back into the single arena,
+     * which must have at least open_size(ciphertexts) bytes, and
+     * plaintexts[i] is set to the part of arena holding the plaintext
+     * of ciphertexts[i]. opened[i] is set to 1 if ciphertexts[i]
+     * opened, or to 0 if it was too small, tampered with, or not sealed
+     * for keypair; its part of arena is then wiped, and plaintexts[i]
+     * is empty. One failure doesn't stop the other messages.
+     *
+     * Return -1 without decrypting anything if arena, plaintexts or
+     * opened are too small, and 0 otherwise. The first version never
+     * throws; the second one throws only if pool can't take the tasks,
+     * and then only once the tasks it already took are done.
+     **/
+
+    static std::size_t open_size(
+      span<const span<const byte>> ciphertexts) noexcept
+    {
+        std::size_t size = 0;
+        for (const auto& ciphertext : ciphertexts)
+            if (ciphertext.size() >= SEALSIZE)
+                size += ciphertext.size() - SEALSIZE;
+        return size;
+    }
+
+    int decrypt_batch(span<byte> arena,
+                      span<span<byte>> plaintexts,
+                      span<byte> opened,
+                      span<const span<const byte>> ciphertexts,
+                      const keypair<BT>& keypair) const noexcept
+    {
+        if (!layout_batch(arena, plaintexts, opened, ciphertexts, keypair))
+            return -1;
+        open_range(plaintexts, opened, ciphertexts, keypair, 0,
+                   ciphertexts.size());
+        return 0;
+    }
+
+    int decrypt_batch(span<byte> arena,
+                      span<span<byte>> plaintexts,
+                      span<byte> opened,
+                      span<const span<const byte>> ciphertexts,
+                      const keypair<BT>& keypair,
+                      thread_pool& pool) const
+    {
+        if (!layout_batch(arena, plaintexts, opened, ciphertexts, keypair))
+            return -1;
+
+        // each message costs a scalar multiplication: worth a task
+        // per thread even for small batches
+        const std::size_t n = ciphertexts.size();
+        const std::size_t ntasks = std::min(pool.size(), n);
+        std::vector<std::future<void>> results;
+        results.reserve(ntasks);
+        try {
+            for (std::size_t t = 0; t != ntasks; ++t) {
+                const std::size_t first = n * t / ntasks;
+                const std::size_t last = n * (t + 1) / ntasks;
+                results.push_back(pool.submit([=, &keypair] {
+                    open_range(
+                      plaintexts, opened, ciphertexts, keypair, first, last);
+                }));
+            }
+            for (auto& result : results)
+                pool.get(result);
+        } catch (...) {
+            // the pending tasks use keypair and arena: let them finish
+            for (auto& result : results)
+                if (result.valid())
+                    pool.wait(result);
+            throw;
+        }
+        return 0;
+    }
+
+    /**
+     * Encrypt plaintext once for all the recipients whose public keys
+     * are in public_keys, and return a single ciphertext that each one
+     * of them can decrypt with decrypt_multi().
+     *
+     * The plaintext is encrypted with XChaCha20-Poly1305 under a fresh
+     * random key, and only that key is sealed for each recipient with
+     * crypto_box_seal(). The result is:
+     *
+     *   LE32(n) || wrap_0 || ... || wrap_n-1 || ciphertext || MAC
+     *
+     * where wrap_i is the sealed key for public_keys[i] (MULTI_WRAPSIZE
+     * bytes each). Since the key is used only once, the nonce of the
+     * payload is all zeroes; the header LE32(n) is its additional data.
+     *
+     * Like box_seal::encrypt(), this is anonymous: anybody can build a
+     * valid ciphertext for the same recipients, so replacing the wraps
+     * or the payload isn't detected as such (it just fails to decrypt
+     * for the recipients the attacker didn't include).
+     *
+     * The size of the returned ciphertext is:
+     *   MULTI_HEADERSIZE + n * MULTI_WRAPSIZE + MULTI_MACSIZE
+     *   + plaintext.size()
+     * bytes.
+     *
+     * This takes n (ephemeral keypair, scalar multiplication) pairs,
+     * but encrypts the payload only once, and allocates only once.
+     *
+     * Throw a std::runtime_error if there are no recipients, or if a
+     * public key has the wrong size.
+     **/
+
+    BT encrypt_multi(const BT& plaintext,
+                     const std::vector<public_key_type>& public_keys)
+    {
+        BT ciphertext = prepare_multi(plaintext, public_keys);
+        const key<MULTI_KEYSIZE> payload_key; // random, used only once
+        wrap_keys(ciphertext, payload_key, public_keys, 0, public_keys.size());
+        encrypt_payload(ciphertext, payload_key, plaintext, public_keys.size());
+        return ciphertext; // by move semantics
+    }
+
+    /**
+     * Same as encrypt_multi() above, but seal the key for the
+     * recipients in parallel on the worker threads of pool, while the
+     * calling thread encrypts the payload. Each worker writes its
+     * wraps in place, directly into the returned ciphertext, which has
+     * the same format as the one of the serial version.
+     **/
+
+    BT encrypt_multi(const BT& plaintext,
+                     const std::vector<public_key_type>& public_keys,
+                     thread_pool& pool)
+    {
+        BT ciphertext = prepare_multi(plaintext, public_keys);
+        const key<MULTI_KEYSIZE> payload_key; // random, used only once
+
+        // one contiguous range of recipients per worker thread
+        const std::size_t n = public_keys.size();
+        const std::size_t ntasks = std::min(pool.size(), n);
+        std::vector<std::future<void>> results;
+        results.reserve(ntasks);
+        try {
+            for (std::size_t t = 0; t != ntasks; ++t) {
+                const std::size_t first = n * t / ntasks;
+                const std::size_t last = n * (t + 1) / ntasks;
+                results.push_back(pool.submit(
+                  [&ciphertext, &payload_key, &public_keys, first, last] {
+                      wrap_keys(
+                        ciphertext, payload_key, public_keys, first, last);
+                  }));
+            }
+
+            // meanwhile, encrypt the payload on this thread
+            encrypt_payload(ciphertext, payload_key, plaintext, n);
+        } catch (...) {
+            // the tasks already submitted use ciphertext and payload_key
+            for (auto& result : results)
+                pool.wait(result);
+            throw;
+        }
+
+        // all workers must be done with ciphertext before we rethrow
+        for (auto& result : results)
+            pool.wait(result);
+        for (auto& result : results)
+            result.get();
+
+        return ciphertext; // by move semantics
+    }
+
+    /**
+     * Decrypt a ciphertext created by encrypt_multi(), with the
+     * private key private_key and corresponding public_key of one of
+     * its recipients. Return the plaintext.
+     *
+     * index is the position of the recipient's public key in the
+     * public_keys passed to encrypt_multi(). If index is npos (the
+     * default), try all the wraps until one opens with our keys.
+     *
+     * Throw a std::runtime_error if the ciphertext is malformed, if we
+     * are not one of its recipients, or if anything has been tampered
+     * with.
+     **/
+
+    BT decrypt_multi(const BT& ciphertext,
+                     const private_key_type& private_key,
+                     const public_key_type& public_key,
+                     std::size_t index = npos)
+    {
+        if (public_key.size() != KEYSIZE_PUBLIC_KEY)
+            throw std::runtime_error{
+                "sodium::box_seal::decrypt_multi() wrong public_key size"
+            };
+
+        const unsigned char* in =
+          reinterpret_cast<const unsigned char*>(ciphertext.data());
+        if (ciphertext.size() < MULTI_HEADERSIZE)
+            throw std::runtime_error{
+                "sodium::box_seal::decrypt_multi() ciphertext too small"
+            };
+        std::size_t n = 0;
+        for (std::size_t i = 0; i != MULTI_HEADERSIZE; ++i)
+            n |= static_cast<std::size_t>(in[i]) << (8 * i);
+        const std::size_t offset = MULTI_HEADERSIZE + n * MULTI_WRAPSIZE;
+        if (n == 0 || ciphertext.size() < offset + MULTI_MACSIZE)
+            throw std::runtime_error{
+                "sodium::box_seal::decrypt_multi() ciphertext too small"
+            };
+        if (index != npos && index >= n)
+            throw std::runtime_error{
+                "sodium::box_seal::decrypt_multi() wrong index"
+            };
+
+        // unseal our copy of the key
+        key<MULTI_KEYSIZE> payload_key(false);
+        const std::size_t first = (index == npos) ? 0 : index;
+        const std::size_t last = (index == npos) ? n : index + 1;
+        bool found = false;
+        for (std::size_t i = first; i != last && !found; ++i)
+            found =
+              crypto_box_seal_open(
+                payload_key.setdata(),
+                in + MULTI_HEADERSIZE + i * MULTI_WRAPSIZE,
+                MULTI_WRAPSIZE,
+                reinterpret_cast<const unsigned char*>(public_key.data()),
+                private_key.data()) == 0;
+        payload_key.readonly();
+        if (!found)
+            throw std::runtime_error{
+                "sodium::box_seal::decrypt_multi() not a recipient"
+            };
+
+        const unsigned char nonce[MULTI_NONCESIZE] = { 0 };
+        BT decrypted(ciphertext.size() - offset - MULTI_MACSIZE);
+        if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+              reinterpret_cast<unsigned char*>(decrypted.data()),
+              NULL,
+              NULL,
+              in + offset,
+              ciphertext.size() - offset,
+              in,
+              MULTI_HEADERSIZE,
+              nonce,
+              payload_key.data()) == -1)
+            throw std::runtime_error{
+                "sodium::box_seal::decrypt_multi() can't decrypt"
+            };
+
+        return decrypted; // by move semantics
+    }
+
+    /**
+     * Decrypt a ciphertext created by encrypt_multi(), with both keys
+     * of keypair. See decrypt_multi() above.
+     **/
+
+    BT decrypt_multi(const BT& ciphertext,
+                     const keypair<BT>& keypair,
+                     std::size_t index = npos)
+    {
+        return decrypt_multi(
+          ciphertext, keypair.private_key(), keypair.public_key(), index);
+    }
+
+  private:
+    // check the sizes of a decrypt_batch(), and carve up arena
+    static bool layout_batch(span<byte> arena,
+                             span<span<byte>> plaintexts,
+                             span<byte> opened,
+                             span<const span<const byte>> ciphertexts,
+                             const keypair<BT>& keypair) noexcept
+    {
+        const std::size_t n = ciphertexts.size();
+        if (plaintexts.size() < n || opened.size() < n ||
+            arena.size() < open_size(ciphertexts) ||
+            keypair.public_key().size() != KEYSIZE_PUBLIC_KEY)
+            return false;
+
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i != n; ++i) {
+            const std::size_t size = ciphertexts[i].size() >= SEALSIZE
+                                       ? ciphertexts[i].size() - SEALSIZE
+                                       : 0;
+            plaintexts[i] = arena.subspan(offset, size);
+            offset += size;
+        }
+        return true;
+    }
+
+    static void open_range(span<span<byte>> plaintexts,
+                           span<byte> opened,
+                           span<const span<const byte>> ciphertexts,
+                           const keypair<BT>& keypair,
+                           std::size_t first,
+                           std::size_t last) noexcept
+    {
+        const unsigned char* public_key =
+          reinterpret_cast<const unsigned char*>(keypair.public_key().data());
+        for (std::size_t i = first; i != last; ++i) {
+            opened[i] = ciphertexts[i].size() >= SEALSIZE &&
+                        crypto_box_seal_open(plaintexts[i].data(),
+                                             ciphertexts[i].data(),
+                                             ciphertexts[i].size(),
+                                             public_key,
+                                             keypair.private_key().data()) ==
+                          0;
+            if (!opened[i]) {
+                ::sodium_memzero(plaintexts[i].data(), plaintexts[i].size());
+                plaintexts[i] = span<byte>(plaintexts[i].data(), 0);
+            }
+        }
+    }
+
+  private:
+    // allocate the ciphertext of encrypt_multi(), and write its header
+    static BT prepare_multi(const BT& plaintext,
+                     const std::vector<public_key_type>& public_keys)
+    {
+        const std::size_t n = public_keys.size();
+        if (n == 0 || n > UINT32_MAX)
+            throw std::runtime_error{
+                "sodium::box_seal::encrypt_multi() wrong number of recipients"
+            };
+        for (const auto& public_key : public_keys)
+            if (public_key.size() != KEYSIZE_PUBLIC_KEY)
+                throw std::runtime_error{
+                    "sodium::box_seal::encrypt_multi() wrong public_key size"
+                };
+
+        BT ciphertext(MULTI_HEADERSIZE + n * MULTI_WRAPSIZE + MULTI_MACSIZE +
+                      plaintext.size());
+        unsigned char* out =
+          reinterpret_cast<unsigned char*>(ciphertext.data());
+        for (std::size_t i = 0; i != MULTI_HEADERSIZE; ++i)
+            out[i] = static_cast<unsigned char>(n >> (8 * i));
+        return ciphertext;
+    }
+
+    // seal the key for public_keys[first, last), in place
+    static void wrap_keys(BT& ciphertext,
+                          const key<MULTI_KEYSIZE>& payload_key,
+                          const std::vector<public_key_type>& public_keys,
+                          std::size_t first,
+                          std::size_t last)
+    {
+        unsigned char* out =
+          reinterpret_cast<unsigned char*>(ciphertext.data());
+        for (std::size_t i = first; i != last; ++i)
+            if (crypto_box_seal(out + MULTI_HEADERSIZE + i * MULTI_WRAPSIZE,
+                                payload_key.data(),
+                                MULTI_KEYSIZE,
+                                reinterpret_cast<const unsigned char*>(
+                                  public_keys[i].data())) != 0)
+                throw std::runtime_error{
+                    "sodium::box_seal::encrypt_multi() can't seal for "
+                    "public key"
+                };
+    }
+
+    static void encrypt_payload(BT& ciphertext,
+                                const key<MULTI_KEYSIZE>& payload_key,
+                                const BT& plaintext,
+                                std::size_t n)
+    {
+        unsigned char* out =
+          reinterpret_cast<unsigned char*>(ciphertext.data());
+        const std::size_t offset = MULTI_HEADERSIZE + n * MULTI_WRAPSIZE;
+        const unsigned char nonce[MULTI_NONCESIZE] = { 0 };
+        crypto_aead_xchacha20poly1305_ietf_encrypt(
+          out + offset,
+          NULL,
+          reinterpret_cast<const unsigned char*>(plaintext.data()),
+          plaintext.size(),
+          out,
+          MULTI_HEADERSIZE,
+          NULL,
+          nonce,
+          payload_key.data());
+    }
 };
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(box_seal);
+
 } // namespace sodium
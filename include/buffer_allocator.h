@@ -0,0 +1,127 @@
+// buffer_allocator.h -- Aligned allocator that doesn't zero-fill
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sodium {
+
+/**
+ * sodium::buffer_allocator<T, ALIGNMENT> allocates unprotected memory
+ * aligned to ALIGNMENT bytes (by default, one cache line), and
+ * default-initializes, instead of value-initializing, the elements of
+ * the containers using it: for bytes, that means they are NOT zeroed.
+ *
+ * The wrappers allocate their results like
+ *   BT ciphertext(MACSIZE + plaintext.size());
+ * and overwrite them immediately. With std::vector<byte>, this first
+ * memset()s the whole buffer, doubling the memory bandwidth of bulk
+ * encryption. With a sodium::buffer (see common.h), every output byte
+ * is written only once, by libsodium. Buffers reused across calls
+ * (clear() or resize(), then encrypt into them through the span APIs)
+ * keep their capacity, and aren't zeroed either.
+ *
+ * CAVEAT EMPTOR: the contents of a buffer that has been resized are
+ * indeterminate until they are written to. Don't use it for keys or
+ * other sensitive data either: it isn't protected like the memory of
+ * sodium::allocator, and isn't zeroed when freed.
+ **/
+
+template<typename T, std::size_t ALIGNMENT = 64>
+class buffer_allocator
+{
+    static_assert(ALIGNMENT > 0 && (ALIGNMENT & (ALIGNMENT - 1)) == 0,
+                  "sodium::buffer_allocator: ALIGNMENT not a power of two");
+    static_assert(ALIGNMENT >= alignof(T),
+                  "sodium::buffer_allocator: ALIGNMENT too small for T");
+
+  public:
+    using value_type = T;
+
+    // ALIGNMENT isn't a type parameter: std::allocator_traits needs help
+    template<typename U>
+    struct rebind
+    {
+        using other = buffer_allocator<U, ALIGNMENT>;
+    };
+
+    buffer_allocator() noexcept {}
+
+    template<typename U>
+    buffer_allocator(const buffer_allocator<U, ALIGNMENT>&) noexcept
+    {}
+
+    /**
+     * Allocate memory for num elements of type T, without constructing
+     * them, aligned to ALIGNMENT bytes.
+     *
+     * Throws std::bad_alloc if no memory could be obtained.
+     **/
+
+    T* allocate(std::size_t num)
+    {
+        if (num > SIZE_MAX / sizeof(T))
+            throw std::bad_alloc{};
+        return static_cast<T*>(
+          ::operator new(num * sizeof(T), std::align_val_t{ ALIGNMENT }));
+    }
+
+    void deallocate(T* ptr, std::size_t /* num */) noexcept
+    {
+        ::operator delete(ptr, std::align_val_t{ ALIGNMENT });
+    }
+
+    // default-initialize, e.g. in vector(n) and resize(n): no zeroing
+    template<typename U>
+    void construct(U* ptr) noexcept(
+      std::is_nothrow_default_constructible<U>::value)
+    {
+        ::new (static_cast<void*>(ptr)) U;
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* ptr, Args&&... args)
+    {
+        ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+    }
+};
+
+// All sodium::buffer_allocator allocators of the same ALIGNMENT are
+// equal: they all get their memory from the global operator new.
+template<typename T1, typename T2, std::size_t ALIGNMENT>
+bool
+operator==(const buffer_allocator<T1, ALIGNMENT>&,
+           const buffer_allocator<T2, ALIGNMENT>&) noexcept
+{
+    return true;
+}
+
+template<typename T1, typename T2, std::size_t ALIGNMENT>
+bool
+operator!=(const buffer_allocator<T1, ALIGNMENT>&,
+           const buffer_allocator<T2, ALIGNMENT>&) noexcept
+{
+    return false;
+}
+
+} // namespace sodium
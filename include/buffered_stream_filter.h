@@ -0,0 +1,353 @@
+// buffered_stream_filter.h -- Buffered stream cipher filters
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "filter_profile.h"
+#include "key.h"
+#include "metrics.h"
+#include "nonce.h"
+#include "stream_xor_backend.h"
+#include "trace.h"
+
+#include <boost/iostreams/filter/symmetric.hpp>
+#include <boost/iostreams/pipeline.hpp>
+
+#include <algorithm> // std::min<>, std::max<>
+#include <cstddef>   // std::ptrdiff_t
+#include <cstdint>   // std::uint64_t
+#include <cstring>   // std::memcpy()
+#include <memory>    // std::shared_ptr<>
+#include <stdexcept> // std::runtime_error
+#include <utility>   // std::move()
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+namespace sodium {
+
+template<typename Cipher>
+class buffered_stream_symmetric_filter
+{
+    /**
+     * buffered_stream_symmetric_filter is a SymmetricFilter model that
+     * applies the stream cipher Cipher, like xchacha20_symmetric_filter
+     * and friends, but tuned for throughput:
+     *
+     *   - small chunks are collected in an internal buffer of (at
+     *     least) MIN_BUFFERSIZE bytes, which is then xor-ed with the
+     *     key stream in one go, so that libsodium's vectorized code
+     *     paths always see large inputs;
+     *
+     *   - chunks that are already large go straight from input to
+     *     output, without being copied into the internal buffer.
+     *
+     * The filter keeps track of its absolute position in the stream,
+     * and continues the key stream exactly where it left off, even in
+     * the middle of a block. The result is therefore always the same
+     * as that of a single crypto_stream_*_xor() call of the whole
+     * stream, no matter how the stream was chunked.
+     *
+     * The internal buffer lives in protected memory, since it holds
+     * plaintext, and is zeroed when the stream is closed.
+     *
+     * The key stream is generated by a stream_xor_backend (see
+     * stream_xor_backend.h), libsodium by default.
+     *
+     * Buffered data is only sent downstream when the internal buffer
+     * is full, or when the stream is closed.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = Cipher::KEYSIZE;
+    static constexpr std::size_t NONCESIZE = Cipher::NONCESIZE;
+    static constexpr std::size_t BLOCKSIZE = 64;
+    static constexpr std::size_t MIN_BUFFERSIZE = 64 * 1024;
+
+    typedef char char_type; // !!! char, not unsigned char
+
+    using key_type = key<KEYSIZE>;
+    using nonce_type = nonce<NONCESIZE>;
+
+    /**
+     * Construct a buffered SymmetricFilter model for Cipher.
+     *
+     * Parameters:
+     *   buffer_size : the size of the internal buffer. It will be
+     *                 rounded up to a multiple of BLOCKSIZE, and to
+     *                 at least MIN_BUFFERSIZE bytes.
+     *   key         : the secret key used to encrypt/decrypt.
+     *   nonce       : a public nonce.
+     *   backend     : generates the key stream; see set_backend().
+     **/
+
+    buffered_stream_symmetric_filter(
+      std::size_t buffer_size,
+      const key_type& key,
+      const nonce_type& nonce,
+      std::shared_ptr<stream_xor_backend> backend =
+        default_stream_xor_backend())
+      : key_{ key }
+      , nonce_{ nonce }
+      , backend_{ std::move(backend) }
+      , buffer_(round_up_buffer_size(buffer_size))
+      , fill_{ 0 }
+      , emit_{ 0 }
+      , ready_{ false }
+      , pos_{ 0 }
+    {}
+
+    /**
+     * Generate the key stream with backend from now on, or with
+     * libsodium in the calling thread if backend is empty.
+     **/
+
+    void set_backend(std::shared_ptr<stream_xor_backend> backend) noexcept
+    {
+        backend_ = std::move(backend);
+    }
+
+    /**
+     * Filter the sequence [i1,i2) to [o1,o2). Update i1 and o1 after
+     * filtering.
+     *
+     * Return true as long as flush is false; when flush is true,
+     * return true while buffered data remains to be output.
+     **/
+
+    bool filter(const char_type*& i1,
+                const char_type* i2,
+                char_type*& o1,
+                char_type* o2,
+                bool flush)
+    {
+        SODIUM_PROFILE_SPAN("buffered_stream_filter", i1);
+
+        for (;;) {
+            // 1. send the already filtered bytes of the buffer downstream
+            if (ready_) {
+                std::size_t n = std::min<std::size_t>(fill_ - emit_, o2 - o1);
+                std::memcpy(o1, buffer_.data() + emit_, n);
+                o1 += n;
+                emit_ += n;
+                if (emit_ != fill_)
+                    return true; // output is full
+                ready_ = false;
+                fill_ = emit_ = 0;
+            }
+
+            // 2. large chunks go straight through, bypassing the buffer
+            if (fill_ == 0 &&
+                static_cast<std::size_t>(i2 - i1) >= buffer_.size() &&
+                o1 != o2) {
+                std::size_t n = std::min<std::ptrdiff_t>(i2 - i1, o2 - o1);
+                xor_stream(reinterpret_cast<unsigned char*>(o1),
+                           reinterpret_cast<const unsigned char*>(i1),
+                           n);
+                i1 += n;
+                o1 += n;
+                continue;
+            }
+
+            // 3. collect small chunks in the buffer
+            std::size_t n =
+              std::min<std::size_t>(i2 - i1, buffer_.size() - fill_);
+            std::memcpy(buffer_.data() + fill_, i1, n);
+            i1 += n;
+            fill_ += n;
+
+            if (fill_ == buffer_.size() || (flush && i1 == i2 && fill_ != 0)) {
+                if (fill_ != buffer_.size())
+                    metrics::filter_flushed(); // a partial buffer
+                xor_stream(buffer_.data(), buffer_.data(), fill_);
+                ready_ = true;
+                if (o1 == o2)
+                    return true; // output is full
+                continue;
+            }
+
+            // all input consumed, and no full buffer to send
+            return !flush;
+        }
+    }
+
+    /**
+     * Called when the stream is (about to be) closed. Restart the key
+     * stream at position 0, and wipe the buffer.
+     **/
+
+    void close()
+    {
+        SODIUM_TRACE("sodium::buffered_stream_symmetric_filter::close()",
+                     "called [pos=" << pos_ << "]");
+
+        sodium_memzero(buffer_.data(), buffer_.size());
+        fill_ = emit_ = 0;
+        ready_ = false;
+        pos_ = 0;
+    }
+
+  private:
+    static std::size_t round_up_buffer_size(std::size_t n)
+    {
+        n = std::max(n, MIN_BUFFERSIZE);
+        return (n + BLOCKSIZE - 1) / BLOCKSIZE * BLOCKSIZE;
+    }
+
+    // xor [in, in+size) with the key stream at pos_ into out
+    void xor_stream(unsigned char* out,
+                    const unsigned char* in,
+                    std::size_t size)
+    {
+        // finish a block started by a previous call
+        std::size_t offset = pos_ % BLOCKSIZE;
+        if (offset != 0 && size != 0) {
+            unsigned char block[BLOCKSIZE] = { 0 };
+            std::size_t n = std::min(size, BLOCKSIZE - offset);
+            std::memcpy(block + offset, in, n);
+            cipher_xor(block, block, BLOCKSIZE, pos_ / BLOCKSIZE);
+            std::memcpy(out, block + offset, n);
+            sodium_memzero(block, sizeof block);
+
+            out += n;
+            in += n;
+            size -= n;
+            pos_ += n;
+        }
+
+        // the rest starts on a block boundary
+        if (size != 0) {
+            cipher_xor(out, in, size, pos_ / BLOCKSIZE);
+            pos_ += size;
+        }
+    }
+
+    void cipher_xor(unsigned char* out,
+                    const unsigned char* in,
+                    std::size_t size,
+                    std::uint64_t ic)
+    {
+        if (stream_xor<Cipher>(backend_.get(),
+                               out,
+                               in,
+                               size,
+                               nonce_.data(),
+                               ic,
+                               key_.data()) == -1)
+            throw std::runtime_error{
+                "sodium::buffered_stream_symmetric_filter::filter() "
+                "crypto_stream_*_xor_ic() -1"
+            };
+    }
+
+    key_type key_;
+    nonce_type nonce_;
+    std::shared_ptr<stream_xor_backend> backend_;
+    bytes_protected buffer_;
+    std::size_t fill_;  // bytes in buffer_
+    std::size_t emit_;  // bytes of buffer_ already sent downstream
+    bool ready_;        // buffer_ is filtered, and being sent downstream
+    std::uint64_t pos_; // position in the whole stream
+};
+
+// Turn buffered_stream_symmetric_filter into a DualUse filter class:
+
+template<typename Cipher>
+class buffered_stream_filter
+  : public io::symmetric_filter<buffered_stream_symmetric_filter<Cipher>>
+{
+    /**
+     * buffered_stream_filter<Cipher> is a DualUseFilter that performs
+     * encryption/decryption on a stream with a large internal buffer;
+     * see buffered_stream_symmetric_filter above.
+     *
+     * It is used exactly like xchacha20_filter and friends, e.g.
+     *
+     *   buffered_xchacha20_filter::key_type   key;   // a random key
+     *   buffered_xchacha20_filter::nonce_type nonce; // a random nonce
+     *
+     *   buffered_xchacha20_filter encrypt_filter{ 1 << 20, key, nonce };
+     *
+     *   io::filtering_ostream os(encrypt_filter | sink);
+     *   for (const auto& record : records)
+     *       os.write(record.data(), record.size()); // many small writes
+     *   os.pop(); // or os.reset(): send the rest downstream
+     *
+     * but unlike those filters, its output is the same as that of one
+     * crypto_stream_*_xor() of the whole stream, whatever the sizes of
+     * the individual writes.
+     **/
+
+  private:
+    typedef buffered_stream_symmetric_filter<Cipher> symmetric_filter_type;
+    typedef io::symmetric_filter<symmetric_filter_type> base_type;
+
+  public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::category category;
+
+    using key_type = typename symmetric_filter_type::key_type;
+    using nonce_type = typename symmetric_filter_type::nonce_type;
+
+    /**
+     * Parameters:
+     *   buffer_size: the size of the internal buffer, at least
+     *                symmetric_filter_type::MIN_BUFFERSIZE bytes.
+     *   key        : secret key used to encrypt/decrypt data
+     *   nonce      : public nonce used to encrypt/decrypt.
+     *   backend    : generates the key stream (default: libsodium,
+     *                see default_stream_xor_backend()).
+     *
+     * The output buffer of the symmetric_filter is just as large, so
+     * that large writes can pass through in one piece.
+     **/
+
+    buffered_stream_filter(std::streamsize buffer_size,
+                           const key_type& key,
+                           const nonce_type& nonce,
+                           std::shared_ptr<stream_xor_backend> backend =
+                             default_stream_xor_backend())
+      : base_type(output_buffer_size(buffer_size),
+                  static_cast<std::size_t>(output_buffer_size(buffer_size)),
+                  key,
+                  nonce)
+    {
+        // one argument too many for io::symmetric_filter's forwarding
+        this->filter().set_backend(std::move(backend));
+    }
+
+  private:
+    static std::streamsize output_buffer_size(std::streamsize n)
+    {
+        return std::max<std::streamsize>(
+          n, symmetric_filter_type::MIN_BUFFERSIZE);
+    }
+};
+
+using buffered_xchacha20_filter =
+  buffered_stream_filter<stream_cipher_xchacha20>;
+using buffered_chacha20_filter = buffered_stream_filter<stream_cipher_chacha20>;
+using buffered_salsa20_filter = buffered_stream_filter<stream_cipher_salsa20>;
+using buffered_xsalsa20_filter =
+  buffered_stream_filter<stream_cipher_xsalsa20>;
+
+BOOST_IOSTREAMS_PIPABLE(buffered_stream_filter, 1)
+
+} // namespace sodium
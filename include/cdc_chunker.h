@@ -0,0 +1,173 @@
+// cdc_chunker.h -- Content-defined chunking with a keyed gear hash
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h"
+#include "span.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include <sodium.h>
+
+namespace sodium {
+
+class cdc_chunker
+{
+    /**
+     * A sodium::cdc_chunker splits a byte stream into content-defined
+     * chunks, FastCDC-style: a chunk ends where a rolling gear hash of
+     * the last bytes matches a mask, so that inserting or deleting
+     * bytes only changes the chunks around the edit, and identical
+     * content elsewhere (in the same or in another stream) yields
+     * identical chunks that can be deduplicated.
+     *
+     * As in FastCDC, the chunker
+     *   - skips the first min_size bytes of every chunk altogether,
+     *   - uses a harder mask (2 more bits) up to avg_size bytes and an
+     *     easier one (2 fewer bits) after that, which concentrates the
+     *     chunk sizes around avg_size ("normalized chunking"), and
+     *   - cuts at max_size bytes at the latest.
+     *
+     * The gear table (256 random 64-bit words) is derived from a key:
+     * with a secret key, the chunk boundaries, and thus the sizes of
+     * the chunks, don't leak information about the content to whoever
+     * sees the encrypted chunks.
+     *
+     * The gear hash is a serial dependency chain (h = (h << 1) + G[b]),
+     * which doesn't vectorize within a chunk; the loop is unrolled so
+     * that the compiler interleaves the table loads. Parallelism comes
+     * from processing different chunks concurrently, see
+     * sodium::dedup_encryptor.
+     *
+     * A cdc_chunker is immutable and can be shared between threads.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = randombytes_SEEDBYTES;
+
+    static constexpr std::size_t MIN_SIZE = 2048;
+    static constexpr std::size_t AVG_SIZE = 8192;
+    static constexpr std::size_t MAX_SIZE = 65536;
+
+    using key_type = key<KEYSIZE>;
+
+    /**
+     * A chunker with the gear table of key, and chunks of min_size to
+     * max_size bytes, avg_size on average. avg_size is rounded down
+     * to a power of two.
+     *
+     * Throw a std::runtime_error unless 64 <= min_size < avg_size <
+     * max_size.
+     **/
+
+    explicit cdc_chunker(const key_type& key,
+                         std::size_t min_size = MIN_SIZE,
+                         std::size_t avg_size = AVG_SIZE,
+                         std::size_t max_size = MAX_SIZE)
+      : min_size_{ min_size }
+      , avg_size_{ avg_size }
+      , max_size_{ max_size }
+    {
+        if (min_size < 64 || min_size >= avg_size || avg_size >= max_size)
+            throw std::runtime_error{
+                "sodium::cdc_chunker::cdc_chunker() wrong chunk sizes"
+            };
+
+        std::size_t bits = 0;
+        while ((std::size_t{ 2 } << bits) <= avg_size)
+            ++bits;
+        mask_small_ = ~std::uint64_t{ 0 } << (64 - (bits + 2));
+        mask_large_ = ~std::uint64_t{ 0 } << (64 - (bits - 2));
+
+        ::randombytes_buf_deterministic(gear_.data(), sizeof gear_, key.data());
+    }
+
+    std::size_t min_size() const noexcept { return min_size_; }
+    std::size_t avg_size() const noexcept { return avg_size_; }
+    std::size_t max_size() const noexcept { return max_size_; }
+
+    /**
+     * Return the size of the chunk that starts at data.data(), or 0 if
+     * more data is needed to tell.
+     *
+     * If data holds at least max_size() bytes, or if eof is true (data
+     * is the end of the stream), the result is never 0 for a non-empty
+     * data: the chunk ends at a cut point of the gear hash, at
+     * max_size(), or at the end of data, whichever comes first.
+     **/
+
+    std::size_t cut(span<const byte> data, bool eof) const noexcept
+    {
+        const std::size_t n = data.size();
+        if (n <= min_size_)
+            return eof ? n : 0;
+
+        const byte* p = data.data();
+        const std::size_t normal = n < avg_size_ ? n : avg_size_;
+        const std::size_t end = n < max_size_ ? n : max_size_;
+
+        std::uint64_t h = 0;
+        std::size_t i = min_size_;
+
+        // two bytes per iteration, checking both positions
+        for (; i + 2 <= normal; i += 2) {
+            h = (h << 1) + gear_[p[i]];
+            if ((h & mask_small_) == 0)
+                return i + 1;
+            h = (h << 1) + gear_[p[i + 1]];
+            if ((h & mask_small_) == 0)
+                return i + 2;
+        }
+        for (; i < normal; ++i) {
+            h = (h << 1) + gear_[p[i]];
+            if ((h & mask_small_) == 0)
+                return i + 1;
+        }
+
+        for (; i + 2 <= end; i += 2) {
+            h = (h << 1) + gear_[p[i]];
+            if ((h & mask_large_) == 0)
+                return i + 1;
+            h = (h << 1) + gear_[p[i + 1]];
+            if ((h & mask_large_) == 0)
+                return i + 2;
+        }
+        for (; i < end; ++i) {
+            h = (h << 1) + gear_[p[i]];
+            if ((h & mask_large_) == 0)
+                return i + 1;
+        }
+
+        return (end == max_size_ || eof) ? end : 0;
+    }
+
+  private:
+    std::size_t min_size_;
+    std::size_t avg_size_;
+    std::size_t max_size_;
+    std::uint64_t mask_small_;
+    std::uint64_t mask_large_;
+    std::array<std::uint64_t, 256> gear_;
+};
+
+} // namespace sodium
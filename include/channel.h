@@ -0,0 +1,295 @@
+// channel.h -- Duplex encrypted channel: crypto_kx + secretstream
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h"
+#include "keypair.h"
+#include "secretstream.h"
+#include "span.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include <sodium.h>
+
+namespace sodium {
+
+class channel
+{
+    /**
+     * A sodium::channel is one end of a duplex encrypted connection
+     * between a client and a server.
+     *
+     * Both ends derive a pair of session keys (rx, tx) out of their own
+     * keypair and the public key of the peer with libsodium's X25519
+     * key exchange crypto_kx_*_session_keys(). Each direction is then
+     * a separate sodium::secretstream, so there are no nonces to
+     * manage: each message is implicitly numbered by the stream.
+     *
+     * Setting up a channel:
+     *
+     *   // each end:
+     *   sodium::channel ch(my_keypair, peer_public_key, role);
+     *   send(ch.header());                    // HEADERSIZE bytes
+     *   ch.accept(receive_header_from_peer());
+     *
+     * Then, messages are sealed into resp. opened from caller-owned
+     * buffers, without allocating:
+     *
+     *   ch.seal_into(sendbuf, plaintext);     // MACSIZE + plaintext.size()
+     *   ch.open_into(plaintext, recvbuf);     // recvbuf.size() - MACSIZE
+     *
+     * The tx stream is rekeyed automatically every REKEY_MESSAGES
+     * messages or REKEY_BYTES bytes (whichever comes first), by sending
+     * the message crossing the limit with secretstream's TAG_REKEY:
+     * the receiving end then rekeys on its own, without any setup.
+     *
+     * A channel is not thread-safe: use one thread for sealing, and
+     * one for opening at most.
+     **/
+
+  public:
+    using secretstream_type = secretstream<bytes>;
+    using keypair_type = keypair<bytes>;
+    using public_key_type = keypair_type::public_key_type;
+    using session_key_type = secretstream_type::key_type;
+
+    static constexpr std::size_t KEYSIZE_PUBLIC_KEY = crypto_kx_PUBLICKEYBYTES;
+    static constexpr std::size_t KEYSIZE_SESSIONKEY = crypto_kx_SESSIONKEYBYTES;
+    static constexpr std::size_t HEADERSIZE = secretstream_type::HEADERSIZE;
+    static constexpr std::size_t MACSIZE = secretstream_type::MACSIZE;
+
+    static constexpr std::uint64_t REKEY_MESSAGES = 1ULL << 20;
+    static constexpr std::uint64_t REKEY_BYTES = 1ULL << 30;
+
+    static_assert(KEYSIZE_SESSIONKEY == secretstream_type::KEYSIZE,
+                  "sodium::channel session keys don't fit secretstream");
+
+    enum class role_type
+    {
+        client,
+        server
+    };
+
+    /**
+     * Derive the session keys from our own keypair and the peer's
+     * public key, and start the tx stream. One end must be a client,
+     * the other end a server.
+     *
+     * Rekey the tx stream every rekey_messages messages, or every
+     * rekey_bytes plaintext bytes. 0 means never.
+     *
+     * Throw a std::runtime_error if peer_public_key has the wrong size,
+     * or if it is not acceptable.
+     **/
+
+    channel(const keypair_type& self,
+            const public_key_type& peer_public_key,
+            role_type role,
+            std::uint64_t rekey_messages = REKEY_MESSAGES,
+            std::uint64_t rekey_bytes = REKEY_BYTES)
+      : channel(derive_session_keys(self, peer_public_key, role),
+                rekey_messages,
+                rekey_bytes)
+    {}
+
+    // the header of our tx stream, to be sent to the peer first
+    const bytes& header() const { return header_; }
+
+    /**
+     * Start the rx stream with the header() of the peer.
+     *
+     * Throw a std::runtime_error if peer_header is invalid.
+     **/
+
+    void accept(const bytes& peer_header)
+    {
+        if (peer_header.size() != HEADERSIZE)
+            throw std::runtime_error{
+                "sodium::channel::accept() wrong peer_header size"
+            };
+
+        rx_.init_pull(peer_header);
+        accepted_ = true;
+        closed_ = false;
+    }
+
+    // the size of a sealed message of plaintext_size bytes
+    static constexpr std::size_t sealed_size(std::size_t plaintext_size)
+    {
+        return plaintext_size + MACSIZE;
+    }
+
+    /**
+     * Encrypt plaintext into the first sealed_size(plaintext.size())
+     * bytes of out. If final, this is the last message of the tx
+     * stream: the peer will refuse to open anything after it, and
+     * this end refuses to seal anything after it.
+     *
+     * Return -1 if out is too small or if pushing fails, 0 otherwise.
+     * The rekeying counters only advance if the message was sealed.
+     *
+     * Throw a std::runtime_error if the tx stream has already been
+     * closed by a final message.
+     **/
+
+    int seal_into(span<byte> out,
+                  span<const byte> plaintext,
+                  span<const byte> added_data = {},
+                  bool final = false)
+    {
+        if (tx_closed_)
+            throw std::runtime_error{
+                "sodium::channel::seal_into() tx stream already closed"
+            };
+        if (out.size() < sealed_size(plaintext.size()))
+            return -1;
+
+        std::uint64_t messages = tx_messages_ + 1;
+        std::uint64_t nbytes = tx_bytes_ + plaintext.size();
+
+        auto tag = secretstream_type::tag_message();
+        if (final)
+            tag = secretstream_type::tag_final();
+        else if ((rekey_messages_ != 0 && messages >= rekey_messages_) ||
+                 (rekey_bytes_ != 0 && nbytes >= rekey_bytes_)) {
+            tag = secretstream_type::tag_rekey(); // both ends rekey after it
+            messages = 0;
+            nbytes = 0;
+        }
+
+        if (tx_.push(out, plaintext, added_data, tag) != 0)
+            return -1;
+
+        tx_messages_ = messages;
+        tx_bytes_ = nbytes;
+        if (final)
+            tx_closed_ = true;
+
+        return 0;
+    }
+
+    /**
+     * Decrypt and verify sealed, a message sealed by the peer, into
+     * the first sealed.size() - MACSIZE bytes of out.
+     *
+     * Return -1 if the rx stream hasn't been accept()ed yet, if it has
+     * already been closed by a final message, if out is too small, or
+     * if sealed is forged, truncated, replayed or out of order.
+     * Return 0 otherwise.
+     **/
+
+    int open_into(span<byte> out,
+                  span<const byte> sealed,
+                  span<const byte> added_data = {}) noexcept
+    {
+        if (!accepted_ || closed_)
+            return -1;
+
+        secretstream_type::tag_type tag;
+        if (rx_.pull(out, tag, sealed, added_data) != 0)
+            return -1;
+
+        if (tag == secretstream_type::tag_final())
+            closed_ = true;
+
+        return 0;
+    }
+
+    // the peer has sent its final message
+    bool closed() const noexcept { return closed_; }
+
+    // we have sent our final message
+    bool tx_closed() const noexcept { return tx_closed_; }
+
+  private:
+    struct session_keys
+    {
+        session_key_type rx{ false };
+        session_key_type tx{ false };
+    };
+
+    static session_keys derive_session_keys(
+      const keypair_type& self,
+      const public_key_type& peer_public_key,
+      role_type role)
+    {
+        if (peer_public_key.size() != KEYSIZE_PUBLIC_KEY)
+            throw std::runtime_error{
+                "sodium::channel::channel() wrong peer_public_key size"
+            };
+
+        const unsigned char* pk =
+          reinterpret_cast<const unsigned char*>(self.public_key().data());
+        const unsigned char* sk =
+          reinterpret_cast<const unsigned char*>(self.private_key().data());
+        const unsigned char* peer_pk =
+          reinterpret_cast<const unsigned char*>(peer_public_key.data());
+
+        session_keys keys;
+        int result =
+          (role == role_type::client
+             ? crypto_kx_client_session_keys(
+                 keys.rx.setdata(), keys.tx.setdata(), pk, sk, peer_pk)
+             : crypto_kx_server_session_keys(
+                 keys.rx.setdata(), keys.tx.setdata(), pk, sk, peer_pk));
+        if (result != 0)
+            throw std::runtime_error{
+                "sodium::channel::channel() unacceptable peer_public_key"
+            };
+        keys.rx.readonly();
+        keys.tx.readonly();
+
+        return keys;
+    }
+
+    channel(session_keys&& keys,
+            std::uint64_t rekey_messages,
+            std::uint64_t rekey_bytes)
+      : tx_{ std::move(keys.tx) }
+      , rx_{ std::move(keys.rx) }
+      , rekey_messages_{ rekey_messages }
+      , rekey_bytes_{ rekey_bytes }
+      , tx_messages_{ 0 }
+      , tx_bytes_{ 0 }
+      , accepted_{ false }
+      , closed_{ false }
+      , tx_closed_{ false }
+    {
+        header_ = tx_.init_push();
+    }
+
+    secretstream_type tx_;
+    secretstream_type rx_;
+    bytes header_;
+
+    std::uint64_t rekey_messages_;
+    std::uint64_t rekey_bytes_;
+    std::uint64_t tx_messages_; // since the last rekey
+    std::uint64_t tx_bytes_;    // since the last rekey
+
+    bool accepted_;
+    bool closed_;    // rx
+    bool tx_closed_; // tx
+};
+
+} // namespace sodium
@@ -19,9 +19,21 @@
 #pragma once
 
 #include "allocator.h"
+#include "buffer_allocator.h"
+#include "hugepage_allocator.h"
+#include "pooled_allocator.h"
 #include <string>
 #include <vector>
 
+/**
+ * Thread safety: the one-shot wrappers (aead, secretbox, box,
+ * authenticator, the hashers, signer, verifier, ...) never modify
+ * themselves nor their (read-only) keys in their const member
+ * functions, which therefore may run concurrently on one shared
+ * instance. Stateful objects (nonces, streams, filters,
+ * hasher_generic_state) are one per thread. See README.md.
+ **/
+
 namespace sodium {
 // libsodium treats all bytes as unsigned char
 using byte = unsigned char;
@@ -29,12 +41,25 @@ using byte = unsigned char;
 // a contiguous collection of bytes in unprotected memory
 using bytes = std::vector<byte>;
 
+// a contiguous collection of bytes in unprotected memory, aligned to
+// a cache line, that isn't zeroed when allocated or resized: for bulk
+// crypto output that is overwritten right away (see buffer_allocator.h)
+using buffer = std::vector<byte, sodium::buffer_allocator<byte>>;
+
 // a contiguous collection of bytes, interpreted as char
 using chars = std::vector<char>;
 
 // a contiguous collection of bytes, in protected memory
 using bytes_protected = std::vector<byte, sodium::allocator<byte>>;
 
+// a contiguous collection of bytes, in pooled protected memory
+// (many small objects share the guard pages of one slab)
+using bytes_pooled = std::vector<byte, sodium::pooled_allocator<byte>>;
+
+// a contiguous collection of bytes, in protected memory on NUMA-local
+// huge pages if it is large enough (e.g. bulk staging buffers)
+using bytes_hugepage = std::vector<byte, sodium::hugepage_allocator<byte>>;
+
 // a std::string in protected memory
 
 // CAVEAT EMPTOR:
@@ -0,0 +1,495 @@
+// compress_encrypt_filter.h -- Compress-then-encrypt stream filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "common.h"
+#include "filter_profile.h"
+#include "key.h"
+#include "nonce.h"
+#include "span.h"
+#include "trace.h"
+
+#include <boost/iostreams/filter/symmetric.hpp>
+#include <boost/iostreams/pipeline.hpp>
+
+#include <algorithm> // std::min<>, std::copy
+#include <array>
+#include <cmath>     // std::log2
+#include <cstddef>   // std::size_t
+#include <cstdint>
+#include <stdexcept> // std::runtime_error
+
+#include <sodium.h>
+#include <zlib.h>
+
+namespace io = boost::iostreams;
+
+namespace sodium {
+
+/**
+ * The compress-then-encrypt stream format
+ * ---------------------------------------
+ *
+ * The plaintext is cut into chunks of chunksize bytes (the last one
+ * may be shorter, or empty). Every chunk is either deflated (raw
+ * deflate, RFC 1951) or stored as is, whichever is smaller, and then
+ * sealed with XChaCha20-Poly1305-IETF. All integers are little-endian.
+ *
+ *   header   = "SWCE" || version (1) || 0 (3) || LE32(chunksize)
+ *              || nonce base
+ *
+ *   record_i = LE32(n_i) || label_i
+ *              || AEAD_encrypt(key, nonce base + i, AD = label_i,
+ *                              payload_i)
+ *
+ * where n_i is the size of the AEAD output (payload_i + MACSIZE), and
+ * label_i tells the decoder what payload_i is:
+ *
+ *   bit 0 (LABEL_DEFLATE): payload_i is the deflated chunk, else the
+ *                          chunk itself
+ *   bit 7 (LABEL_FINAL)  : this is the last record of the stream
+ *
+ * The label is the AD of its record, and the nonce is the position of
+ * the record in the stream: changing a label, reordering, dropping or
+ * duplicating records, and truncating the stream, are all detected.
+ * As with any compression before encryption, the sizes of the records
+ * reveal how compressible the chunks are.
+ **/
+
+namespace compress_detail {
+
+constexpr unsigned char MAGIC[4] = { 'S', 'W', 'C', 'E' };
+constexpr unsigned char VERSION = 1;
+constexpr unsigned char LABEL_DEFLATE = 0x01;
+constexpr unsigned char LABEL_FINAL = 0x80;
+constexpr std::size_t RECORD_PREFIXSIZE = 5; // LE32(n) || label
+constexpr std::size_t CHUNKSIZE_MAX = 16 * 1024 * 1024;
+
+using aead_type = aead<chars, aead_xchacha20_poly1305_ietf>;
+
+constexpr std::size_t HEADERSIZE = 12 + aead_type::NONCESIZE;
+
+/**
+ * A quick estimate of the entropy of data, in bits per byte (0 to 8),
+ * from the byte histogram of at most SAMPLES evenly spaced bytes.
+ * Random, encrypted or already compressed data is close to 8.
+ **/
+
+constexpr std::size_t SAMPLES = 4096;
+
+inline double
+estimate_entropy(span<const byte> data) noexcept
+{
+    if (data.empty())
+        return 0.0;
+
+    const std::size_t stride = data.size() > SAMPLES ? data.size() / SAMPLES
+                                                     : 1;
+    std::array<std::uint32_t, 256> histogram{};
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < data.size() && n != SAMPLES; i += stride) {
+        ++histogram[data[i]];
+        ++n;
+    }
+
+    double entropy = 0.0;
+    for (std::uint32_t count : histogram)
+        if (count != 0) {
+            const double p = static_cast<double>(count) / n;
+            entropy -= p * std::log2(p);
+        }
+    return entropy;
+}
+
+// A raw deflate stream, reset for every chunk
+class deflater
+{
+  public:
+    explicit deflater(int level)
+    {
+        stream_.zalloc = Z_NULL;
+        stream_.zfree = Z_NULL;
+        stream_.opaque = Z_NULL;
+        if (deflateInit2(
+              &stream_, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error{
+                "sodium::compress_encrypt_filter: can't initialize zlib"
+            };
+    }
+    ~deflater() { deflateEnd(&stream_); }
+
+    deflater(const deflater&) = delete;
+    deflater& operator=(const deflater&) = delete;
+
+    /**
+     * Deflate in into out, and return the deflated size, or 0 if it
+     * doesn't fit into out.
+     **/
+
+    std::size_t compress(span<const byte> in, span<byte> out) noexcept
+    {
+        deflateReset(&stream_);
+        stream_.next_in = const_cast<Bytef*>(in.data());
+        stream_.avail_in = static_cast<uInt>(in.size());
+        stream_.next_out = out.data();
+        stream_.avail_out = static_cast<uInt>(out.size());
+        if (deflate(&stream_, Z_FINISH) != Z_STREAM_END)
+            return 0;
+        return out.size() - stream_.avail_out;
+    }
+
+  private:
+    z_stream stream_;
+};
+
+// A raw inflate stream, reset for every chunk
+class inflater
+{
+  public:
+    inflater()
+    {
+        stream_.zalloc = Z_NULL;
+        stream_.zfree = Z_NULL;
+        stream_.opaque = Z_NULL;
+        stream_.next_in = Z_NULL;
+        stream_.avail_in = 0;
+        if (inflateInit2(&stream_, -15) != Z_OK)
+            throw std::runtime_error{
+                "sodium::decrypt_decompress_filter: can't initialize zlib"
+            };
+    }
+    ~inflater() { inflateEnd(&stream_); }
+
+    inflater(const inflater&) = delete;
+    inflater& operator=(const inflater&) = delete;
+
+    /**
+     * Inflate all of in into out, and return the inflated size. Return
+     * -1 if in isn't a complete deflate stream, or if it inflates to
+     * more than out.size() bytes.
+     **/
+
+    long decompress(span<const byte> in, span<byte> out) noexcept
+    {
+        inflateReset(&stream_);
+        stream_.next_in = const_cast<Bytef*>(in.data());
+        stream_.avail_in = static_cast<uInt>(in.size());
+        stream_.next_out = out.data();
+        stream_.avail_out = static_cast<uInt>(out.size());
+        if (inflate(&stream_, Z_FINISH) != Z_STREAM_END ||
+            stream_.avail_in != 0)
+            return -1;
+        return static_cast<long>(out.size() - stream_.avail_out);
+    }
+
+  private:
+    z_stream stream_;
+};
+
+inline void
+store_le32(byte* out, std::uint32_t value) noexcept
+{
+    for (std::size_t i = 0; i != 4; ++i)
+        out[i] = static_cast<byte>(value >> (8 * i));
+}
+
+inline std::uint32_t
+load_le32(const byte* in) noexcept
+{
+    std::uint32_t result = 0;
+    for (std::size_t i = 0; i != 4; ++i)
+        result |= static_cast<std::uint32_t>(in[i]) << (8 * i);
+    return result;
+}
+
+} // namespace compress_detail
+
+class compress_encrypt_symmetric_filter
+{
+    /**
+     * Compress and encrypt a stream in the format above, in chunks of
+     * chunksize bytes, holding only one chunk in memory.
+     *
+     * Each chunk is deflated straight into the output buffer, behind
+     * the room for its record prefix, and sealed there in place: there
+     * is no intermediate buffer between compression and encryption.
+     *
+     * Chunks whose estimated entropy is at least entropy_threshold
+     * bits per byte (see compress_detail::estimate_entropy()), such as
+     * encrypted or already compressed data, are not even given to
+     * zlib: they are encrypted as is, straight from the input buffer.
+     * So are the chunks that deflate doesn't make smaller.
+     *
+     * The same key and chunksize must be used to decrypt the stream,
+     * with decrypt_decompress_filter.
+     **/
+
+  public:
+    static constexpr std::size_t MACSIZE = compress_detail::aead_type::MACSIZE;
+    static constexpr std::size_t HEADERSIZE = compress_detail::HEADERSIZE;
+    static constexpr std::size_t RECORD_PREFIXSIZE =
+      compress_detail::RECORD_PREFIXSIZE;
+    static constexpr double ENTROPY_THRESHOLD = 7.5;
+
+    typedef char char_type;
+
+    using key_type = compress_detail::aead_type::key_type;
+    using nonce_type = compress_detail::aead_type::nonce_type;
+
+    compress_encrypt_symmetric_filter(const key_type& key,
+                                      const std::size_t chunksize,
+                                      const int level = Z_DEFAULT_COMPRESSION)
+      : aead_{ key }
+      , chunksize_{ chunksize }
+      , deflater_{ level }
+      , entropy_threshold_{ ENTROPY_THRESHOLD }
+      , out_len_{ 0 }
+      , out_pos_{ 0 }
+      , started_{ false }
+      , finished_{ false }
+    {
+        if (chunksize < 1 || chunksize > compress_detail::CHUNKSIZE_MAX)
+            throw std::runtime_error{
+                "sodium::compress_encrypt_filter::"
+                "compress_encrypt_filter() wrong chunksize"
+            };
+        in_.reserve(chunksize_);
+        out_.resize(
+          std::max(HEADERSIZE, RECORD_PREFIXSIZE + chunksize_ + MACSIZE));
+    }
+
+    // skip compression of chunks with at least threshold bits per byte
+    void set_entropy_threshold(double threshold) noexcept
+    {
+        entropy_threshold_ = threshold;
+    }
+
+    /**
+     * Consume as much of [i1,i2) as possible, and produce as much
+     * output in [o1,o2) as possible. The final record is emitted when
+     * flush is set, i.e. when the stream is closed.
+     **/
+
+    bool filter(const char_type*& i1,
+                const char_type* i2,
+                char_type*& o1,
+                char_type* o2,
+                bool flush)
+    {
+        SODIUM_PROFILE_SPAN("compress_encrypt_filter", i1);
+
+        for (;;) {
+            // first, write out what's still waiting in out_
+            if (out_pos_ != out_len_) {
+                const auto n =
+                  std::min<std::size_t>(out_len_ - out_pos_, o2 - o1);
+                std::copy(out_.cbegin() + out_pos_,
+                          out_.cbegin() + out_pos_ + n,
+                          o1);
+                out_pos_ += n;
+                o1 += n;
+                if (out_pos_ != out_len_)
+                    return true; // output buffer is full, call again
+            }
+
+            if (!started_) {
+                write_header();
+                started_ = true;
+                continue;
+            }
+            if (finished_)
+                return false; // all done
+
+            // then, fill the current chunk
+            const auto n =
+              std::min<std::size_t>(chunksize_ - in_.size(), i2 - i1);
+            in_.insert(in_.end(), i1, i1 + n);
+            i1 += n;
+
+            if (in_.size() == chunksize_) {
+                seal(0);
+                in_.clear();
+                continue;
+            }
+
+            if (!flush)
+                return true; // need more input
+
+            // end of stream: the remaining bytes make up the final record
+            seal(compress_detail::LABEL_FINAL);
+            in_.clear();
+            finished_ = true;
+
+            SODIUM_TRACE("sodium::compress_encrypt_symmetric_filter::filter()",
+                         "final record");
+        }
+    }
+
+    /**
+     * Prepare to encrypt a whole new stream, with a new header.
+     **/
+
+    void close()
+    {
+        SODIUM_TRACE("sodium::compress_encrypt_symmetric_filter::close()",
+                     "called");
+
+        in_.clear();
+        out_len_ = 0;
+        out_pos_ = 0;
+        started_ = false;
+        finished_ = false;
+    }
+
+  private:
+    byte* out() noexcept { return reinterpret_cast<byte*>(out_.data()); }
+
+    void write_header()
+    {
+        nonce_ = nonce_type();
+
+        byte* p = out();
+        std::fill(p, p + HEADERSIZE, 0);
+        std::copy(compress_detail::MAGIC, compress_detail::MAGIC + 4, p);
+        p[4] = compress_detail::VERSION;
+        compress_detail::store_le32(p + 8,
+                                    static_cast<std::uint32_t>(chunksize_));
+        std::copy(nonce_.data(), nonce_.data() + nonce_type::size(), p + 12);
+
+        out_len_ = HEADERSIZE;
+        out_pos_ = 0;
+    }
+
+    // compress (maybe) and encrypt in_ into a record in out_
+    void seal(byte label)
+    {
+        const span<const byte> chunk(reinterpret_cast<const byte*>(in_.data()),
+                                     in_.size());
+        byte* payload = out() + RECORD_PREFIXSIZE;
+
+        // deflate only pays off if it saves at least one byte
+        std::size_t size = 0;
+        if (chunk.size() > 1 &&
+            compress_detail::estimate_entropy(chunk) < entropy_threshold_)
+            size = deflater_.compress(chunk,
+                                      span<byte>(payload, chunk.size() - 1));
+
+        span<const byte> plaintext = chunk; // stored
+        if (size != 0) {
+            label |= compress_detail::LABEL_DEFLATE;
+            plaintext = span<const byte>(payload, size); // sealed in place
+        }
+
+        out()[4] = label;
+        compress_detail::store_le32(
+          out(), static_cast<std::uint32_t>(plaintext.size() + MACSIZE));
+        if (aead_.encrypt(span<byte>(payload, plaintext.size() + MACSIZE),
+                          span<const byte>(out() + 4, 1),
+                          plaintext,
+                          nonce_) != 0)
+            throw std::runtime_error{
+                "sodium::compress_encrypt_filter::filter() can't encrypt"
+            };
+        nonce_.increment();
+
+        out_len_ = RECORD_PREFIXSIZE + plaintext.size() + MACSIZE;
+        out_pos_ = 0;
+    }
+
+    compress_detail::aead_type aead_;
+    nonce_type nonce_;
+    std::size_t chunksize_;
+    compress_detail::deflater deflater_;
+    double entropy_threshold_;
+    chars in_;  // plaintext of the current chunk, up to chunksize_ bytes
+    chars out_; // header or record, allocated once
+    std::size_t out_len_;
+    std::size_t out_pos_;
+    bool started_;  // header emitted?
+    bool finished_; // final record emitted?
+}; // compress_encrypt_symmetric_filter
+
+// Turn compress_encrypt_symmetric_filter into a DualUse filter class:
+
+class compress_encrypt_filter
+  : public io::symmetric_filter<compress_encrypt_symmetric_filter>
+{
+    /**
+     * compress_encrypt_filter is a DualUseFilter that compresses and
+     * encrypts a stream in chunks of chunksize bytes, using constant
+     * memory. It replaces a chain of a compressor and an encryption
+     * filter, e.g. io::gzip_compressor | secretstream_encrypt_filter,
+     * without the copies between the two stages, and without wasting
+     * CPU on chunks that don't compress.
+     *
+     * Parameters:
+     *   buffer_size: size of the internal buffer of symmetric_filter.
+     *   key        : the secret key used for encryption/decryption.
+     *   chunksize  : number of plaintext bytes per record.
+     *   level      : the zlib compression level, 0 to 9.
+     *
+     * Use it like this (as an OutputFilter):
+     *
+     *   compress_encrypt_filter::key_type key;
+     *   compress_encrypt_filter encrypt_filter{ 4096, key, 65536 };
+     *
+     *   io::filtering_ostream os(encrypt_filter | io::file_sink(encfile));
+     *   os << ...;            // records are written as chunks fill up
+     *   os.reset();           // close the stream: write final record
+     *
+     * The final record is only written when the chain is closed:
+     * flushing is not enough.
+     *
+     * See also: decrypt_decompress_filter.
+     **/
+
+  private:
+    typedef io::symmetric_filter<compress_encrypt_symmetric_filter> base_type;
+    typedef compress_encrypt_symmetric_filter symmetric_filter_type;
+
+  public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::category category;
+
+    static constexpr std::size_t MACSIZE = symmetric_filter_type::MACSIZE;
+    static constexpr std::size_t HEADERSIZE =
+      symmetric_filter_type::HEADERSIZE;
+    static constexpr std::size_t RECORD_PREFIXSIZE =
+      symmetric_filter_type::RECORD_PREFIXSIZE;
+
+    using key_type = symmetric_filter_type::key_type;
+
+    compress_encrypt_filter(std::streamsize buffer_size,
+                            const key_type& key,
+                            const std::size_t chunksize,
+                            const int level = Z_DEFAULT_COMPRESSION)
+      : base_type(buffer_size, key, chunksize, level)
+    {}
+
+    // see compress_encrypt_symmetric_filter::set_entropy_threshold()
+    void set_entropy_threshold(double threshold) noexcept
+    {
+        this->filter().set_entropy_threshold(threshold);
+    }
+};
+
+BOOST_IOSTREAMS_PIPABLE(compress_encrypt_filter, 0)
+
+} // namespace sodium
@@ -0,0 +1,571 @@
+// datagram_batch.h -- Batches of sealed datagrams for sendmmsg()/recvmmsg()
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead_multi.h"
+#include "aead_traits.h"
+#include "common.h"
+#include "nonce.h"
+#include "replay_window.h"
+#include "span.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * The sealed datagram format
+ * --------------------------
+ *
+ * The k-th datagram sent with a key carries its sequence number k in
+ * the clear, followed by the AEAD encryption of its payload under the
+ * nonce base + k:
+ *
+ *   datagram_k = LE64(k) || AEAD_encrypt(key, base + k,
+ *                                        AD = LE64(k), payload_k)
+ *
+ * The receiver derives the nonce from k and the base it shares with
+ * the sender, and rejects replays with a sodium::replay_window over k.
+ * The AEAD output is libsodium's combined format, i.e. the ciphertext
+ * followed by the MAC, exactly as sodium::aead<BT, F>::encrypt().
+ **/
+
+namespace datagram_detail {
+
+constexpr std::size_t PREFIXSIZE = 8; // LE64(sequence number)
+
+#if defined(__linux__)
+using mmsghdr_type = ::mmsghdr;
+#else
+// the struct of sendmmsg()/recvmmsg(), which we emulate elsewhere
+struct mmsghdr_type
+{
+    ::msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#endif
+
+inline void
+store_le64(byte* out, std::uint64_t value) noexcept
+{
+    for (std::size_t i = 0; i != 8; ++i)
+        out[i] = static_cast<byte>(value >> (8 * i));
+}
+
+inline std::uint64_t
+load_le64(const byte* in) noexcept
+{
+    std::uint64_t result = 0;
+    for (std::size_t i = 0; i != 8; ++i)
+        result |= static_cast<std::uint64_t>(in[i]) << (8 * i);
+    return result;
+}
+
+} // namespace datagram_detail
+
+template<typename F = sodium::aead_chacha20_poly1305_ietf>
+class datagram_batch
+{
+    /**
+     * A sodium::datagram_batch<F> is an array of preallocated slots
+     * of sealed datagrams (see the format above), together with the
+     * mmsghdr array that describes them for sendmmsg() and
+     * recvmmsg(). Everything is allocated once, by the constructor:
+     * sealing, opening, sending and receiving a batch allocate
+     * nothing.
+     *
+     * Sending:
+     *
+     *   sodium::datagram_batch<> batch(64, 1200);
+     *   for (i...) {
+     *       // write the payload straight into its slot
+     *       std::memcpy(batch.payload(i).data(), msg.data(), msg.size());
+     *       batch.set_length(i, msg.size());
+     *   }
+     *   batch.resize(n);
+     *   sealer.seal(batch);    // in place, see datagram_sealer<>
+     *   batch.send(fd);        // one sendmmsg() for the whole batch
+     *
+     * Receiving:
+     *
+     *   batch.receive(fd);     // one recvmmsg(), sets size()
+     *   opener.open(batch);    // in place, see datagram_opener<>
+     *   for (std::size_t i = 0; i != batch.size(); ++i)
+     *       if (batch.accepted(i))
+     *           handle(batch.payload(i).first(batch.length(i)));
+     *
+     * The slots may also carry a peer address each (msg_name), for
+     * unconnected sockets. On systems without sendmmsg() and
+     * recvmmsg(), send() and receive() fall back to one sendmsg() or
+     * recvmsg() per datagram.
+     *
+     * A batch is not thread-safe.
+     **/
+
+  public:
+    static constexpr std::size_t PREFIXSIZE = datagram_detail::PREFIXSIZE;
+    static constexpr std::size_t MACSIZE = aead_traits<F>::ABYTES;
+    static constexpr std::size_t OVERHEAD = PREFIXSIZE + MACSIZE;
+
+    using mmsghdr_type = datagram_detail::mmsghdr_type;
+
+    /**
+     * A batch of capacity slots, each of them big enough for a
+     * datagram with max_payload bytes of payload, i.e.
+     * max_payload + OVERHEAD bytes on the wire. The batch starts
+     * with capacity datagrams of length 0.
+     *
+     * Throw a std::runtime_error if capacity is 0.
+     **/
+
+    datagram_batch(std::size_t capacity, std::size_t max_payload)
+      : max_payload_(max_payload)
+      , slotsize_(max_payload + OVERHEAD)
+      , size_(capacity)
+      , buffer_(capacity * slotsize_)
+      , lengths_(capacity, 0)
+      , accepted_(capacity, 0)
+      , addresses_(capacity)
+      , iovecs_(capacity)
+      , headers_(capacity)
+    {
+        if (capacity == 0)
+            throw std::runtime_error{
+                "sodium::datagram_batch::datagram_batch() capacity is 0"
+            };
+
+        for (std::size_t i = 0; i != capacity; ++i) {
+            iovecs_[i].iov_base = slot(i);
+            iovecs_[i].iov_len = 0;
+            headers_[i] = mmsghdr_type{};
+            headers_[i].msg_hdr.msg_iov = &iovecs_[i];
+            headers_[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    // the slots point into our own vectors: no copies
+    datagram_batch(const datagram_batch&) = delete;
+    datagram_batch& operator=(const datagram_batch&) = delete;
+
+    std::size_t capacity() const noexcept { return headers_.size(); }
+    std::size_t max_payload() const noexcept { return max_payload_; }
+
+    // the number of datagrams in the batch
+    std::size_t size() const noexcept { return size_; }
+
+    /**
+     * Use the first n slots. Throw a std::runtime_error if n is
+     * bigger than capacity().
+     **/
+
+    void resize(std::size_t n)
+    {
+        if (n > capacity())
+            throw std::runtime_error{
+                "sodium::datagram_batch::resize() n > capacity()"
+            };
+        size_ = n;
+    }
+
+    /**
+     * The max_payload() bytes of payload of slot i (i < capacity()),
+     * to be written before seal()ing, resp. read after open()ing.
+     **/
+
+    span<byte> payload(std::size_t i) noexcept
+    {
+        return span<byte>(slot(i) + PREFIXSIZE, max_payload_);
+    }
+
+    // the length of the payload of slot i
+    std::size_t length(std::size_t i) const noexcept { return lengths_[i]; }
+
+    // set the length of the payload of slot i (at most max_payload())
+    void set_length(std::size_t i, std::size_t length) noexcept
+    {
+        lengths_[i] = length < max_payload_ ? length : max_payload_;
+    }
+
+    // whether slot i was authenticated and not a replay, after open()
+    bool accepted(std::size_t i) const noexcept { return accepted_[i] != 0; }
+
+    /**
+     * The datagram of slot i, as it is on the wire: the sealed
+     * datagram after seal() or receive(). set_wire_length() is for
+     * datagrams that are received without receive().
+     **/
+
+    span<byte> wire(std::size_t i) noexcept
+    {
+        return span<byte>(slot(i), iovecs_[i].iov_len);
+    }
+
+    span<byte> wire_buffer(std::size_t i) noexcept
+    {
+        return span<byte>(slot(i), slotsize_);
+    }
+
+    void set_wire_length(std::size_t i, std::size_t length) noexcept
+    {
+        iovecs_[i].iov_len = length < slotsize_ ? length : slotsize_;
+    }
+
+    /**
+     * The peer address of slot i: the destination for send(), or the
+     * source after receive(). An address of length 0 (the default)
+     * sends to the peer of a connected socket.
+     **/
+
+    void set_address(std::size_t i,
+                     const ::sockaddr* address,
+                     ::socklen_t length) noexcept
+    {
+        if (length > sizeof(::sockaddr_storage))
+            length = sizeof(::sockaddr_storage);
+        std::memcpy(&addresses_[i], address, length);
+        headers_[i].msg_hdr.msg_name = length != 0 ? &addresses_[i] : nullptr;
+        headers_[i].msg_hdr.msg_namelen = length;
+    }
+
+    const ::sockaddr* address(std::size_t i) const noexcept
+    {
+        return reinterpret_cast<const ::sockaddr*>(&addresses_[i]);
+    }
+
+    ::socklen_t address_length(std::size_t i) const noexcept
+    {
+        return headers_[i].msg_hdr.msg_name != nullptr
+                 ? headers_[i].msg_hdr.msg_namelen
+                 : 0;
+    }
+
+    // the mmsghdr array of the size() datagrams, for syscalls of one's own
+    mmsghdr_type* headers() noexcept { return headers_.data(); }
+
+    /**
+     * Send the size() datagrams of the batch on the socket fd with
+     * sendmmsg(), and return the number of datagrams sent, which may
+     * be less than size(), or -1 with errno set.
+     **/
+
+    int send(int fd, int flags = 0) noexcept
+    {
+#if defined(__linux__)
+        return ::sendmmsg(fd,
+                          headers_.data(),
+                          static_cast<unsigned int>(size_),
+                          flags);
+#else
+        std::size_t i = 0;
+        for (; i != size_; ++i)
+            if (::sendmsg(fd, &headers_[i].msg_hdr, flags) == -1)
+                return i == 0 ? -1 : static_cast<int>(i);
+        return static_cast<int>(i);
+#endif
+    }
+
+    /**
+     * Receive up to capacity() datagrams from the socket fd with
+     * recvmmsg(), and return their number, which is also the new
+     * size(), or -1 with errno set (and size() 0). Pass MSG_DONTWAIT
+     * in flags to return as soon as no more datagrams are waiting.
+     *
+     * The source addresses are stored, see address().
+     **/
+
+    int receive(int fd, int flags = 0) noexcept
+    {
+        for (std::size_t i = 0; i != capacity(); ++i) {
+            iovecs_[i].iov_len = slotsize_;
+            headers_[i].msg_hdr.msg_name = &addresses_[i];
+            headers_[i].msg_hdr.msg_namelen = sizeof(::sockaddr_storage);
+            headers_[i].msg_hdr.msg_flags = 0;
+        }
+
+#if defined(__linux__)
+        const int n = ::recvmmsg(fd,
+                                 headers_.data(),
+                                 static_cast<unsigned int>(capacity()),
+                                 flags,
+                                 nullptr);
+#else
+        int n = 0;
+        for (; static_cast<std::size_t>(n) != capacity(); ++n) {
+            const ssize_t len = ::recvmsg(
+              fd, &headers_[n].msg_hdr, n == 0 ? flags : flags | MSG_DONTWAIT);
+            if (len == -1)
+                break;
+            headers_[n].msg_len = static_cast<unsigned int>(len);
+        }
+        if (n == 0)
+            n = -1;
+#endif
+
+        size_ = n > 0 ? static_cast<std::size_t>(n) : 0;
+        for (std::size_t i = 0; i != size_; ++i) {
+            // truncated datagrams don't authenticate: make sure of it
+            iovecs_[i].iov_len = (headers_[i].msg_hdr.msg_flags & MSG_TRUNC)
+                                   ? 0
+                                   : headers_[i].msg_len;
+            if (headers_[i].msg_hdr.msg_namelen == 0)
+                headers_[i].msg_hdr.msg_name = nullptr;
+        }
+        return n;
+    }
+
+  private:
+    template<typename, std::size_t>
+    friend class datagram_opener;
+
+    byte* slot(std::size_t i) noexcept
+    {
+        return buffer_.data() + i * slotsize_;
+    }
+
+    void set_accepted(std::size_t i, bool accepted) noexcept
+    {
+        accepted_[i] = accepted ? 1 : 0;
+    }
+
+    const std::size_t max_payload_;
+    const std::size_t slotsize_;
+    std::size_t size_;
+    std::vector<byte> buffer_;
+    std::vector<std::size_t> lengths_;
+    std::vector<byte> accepted_;
+    std::vector<::sockaddr_storage> addresses_;
+    std::vector<::iovec> iovecs_;
+    std::vector<mmsghdr_type> headers_;
+};
+
+template<typename F = sodium::aead_chacha20_poly1305_ietf>
+class datagram_sealer
+{
+    /**
+     * A sodium::datagram_sealer<F> seals the datagrams of a
+     * sodium::datagram_batch<F> in place, numbering them with
+     * consecutive sequence numbers, as described above. All datagrams
+     * of a batch are encrypted in one sodium::aead_multi<F> call
+     * (which, for aead_aesgcm, expands the key once per batch).
+     *
+     * One sealer per key and base nonce: a second sealer would reuse
+     * the nonces of the first. A sealer is not thread-safe.
+     **/
+
+  public:
+    using multi_type = aead_multi<F>;
+    using key_type = typename multi_type::key_type;
+    using nonce_type = typename multi_type::nonce_type;
+    using batch_type = datagram_batch<F>;
+
+    // seal with key, numbering datagrams first_seq, first_seq + 1, ...
+    datagram_sealer(const key_type& key,
+                    const nonce_type& base,
+                    std::uint64_t first_seq = 0)
+      : key_(key)
+      , base_(base)
+      , next_seq_(first_seq)
+    {}
+
+    /**
+     * Seal the size() datagrams of batch in place: prepend the
+     * sequence number to the payload(i).first(length(i)) of every
+     * slot and encrypt it, and point the mmsghdr entries to the
+     * results.
+     *
+     * Return 0 on success, or -1 if encryption fails, in which case
+     * no sequence number is used up. Only the first batch bigger than
+     * all previous ones allocates (and may throw std::bad_alloc).
+     **/
+
+    int seal(batch_type& batch)
+    {
+        const std::size_t n = batch.size();
+        reserve(n);
+
+        for (std::size_t i = 0; i != n; ++i) {
+            byte* slot = batch.wire_buffer(i).data();
+            const std::size_t len = batch.length(i);
+            datagram_detail::store_le64(slot, next_seq_ + i);
+            nonces_[i] = base_;
+            nonces_[i] += next_seq_ + i;
+            lanes_[i] = typename multi_type::lane_type{
+                &key_,
+                &nonces_[i],
+                span<const byte>(slot, batch_type::PREFIXSIZE),
+                span<const byte>(slot + batch_type::PREFIXSIZE, len),
+                span<byte>(slot + batch_type::PREFIXSIZE,
+                           len + batch_type::MACSIZE)
+            };
+        }
+
+        if (multi_type::encrypt(
+              span<const typename multi_type::lane_type>(lanes_.data(), n)) !=
+            0)
+            return -1;
+
+        for (std::size_t i = 0; i != n; ++i)
+            batch.set_wire_length(i, batch.length(i) + batch_type::OVERHEAD);
+        next_seq_ += n;
+        return 0;
+    }
+
+    // the sequence number of the next datagram
+    std::uint64_t next_sequence() const noexcept { return next_seq_; }
+
+  private:
+    void reserve(std::size_t n)
+    {
+        // grows to the biggest batch once, then never allocates again
+        if (lanes_.size() < n) {
+            lanes_.resize(n);
+            nonces_.resize(n, base_);
+        }
+    }
+
+    const key_type key_;
+    const nonce_type base_;
+    std::uint64_t next_seq_;
+    std::vector<typename multi_type::lane_type> lanes_;
+    std::vector<nonce_type> nonces_;
+};
+
+template<typename F = sodium::aead_chacha20_poly1305_ietf,
+         std::size_t WINDOW = 1024>
+class datagram_opener
+{
+    /**
+     * A sodium::datagram_opener<F, WINDOW> opens the datagrams of a
+     * sodium::datagram_batch<F> in place, and rejects replays with a
+     * sodium::replay_window<..., WINDOW>.
+     *
+     * The sequence numbers of a batch are checked against the window
+     * first, so that replayed and too old datagrams cost no
+     * decryption; the rest is decrypted in one sodium::aead_multi<F>
+     * call, and each datagram that authenticates is marked in the
+     * window, which also rejects duplicates within a batch.
+     *
+     * An opener is not thread-safe.
+     **/
+
+  public:
+    using multi_type = aead_multi<F>;
+    using key_type = typename multi_type::key_type;
+    using nonce_type = typename multi_type::nonce_type;
+    using batch_type = datagram_batch<F>;
+    using window_type = replay_window<multi_type::NONCESIZE, WINDOW>;
+
+    datagram_opener(const key_type& key, const nonce_type& base)
+      : key_(key)
+      , base_(base)
+      , window_(base)
+    {}
+
+    /**
+     * Open the size() datagrams of batch (as received, see wire())
+     * in place: afterwards, accepted(i) tells whether datagram i
+     * authenticated and wasn't a replay, and its payload is
+     * payload(i).first(length(i)).
+     *
+     * Return the number of accepted datagrams. As with seal(), only
+     * the first batch bigger than all previous ones allocates.
+     **/
+
+    std::size_t open(batch_type& batch)
+    {
+        const std::size_t n = batch.size();
+        reserve(n);
+
+        std::size_t m = 0;
+        for (std::size_t i = 0; i != n; ++i) {
+            batch.set_accepted(i, false);
+            batch.set_length(i, 0);
+
+            span<byte> wire = batch.wire(i);
+            if (wire.size() < batch_type::OVERHEAD)
+                continue;
+            const std::uint64_t seq = datagram_detail::load_le64(wire.data());
+            if (!window_.check(seq))
+                continue;
+
+            nonces_[m] = base_;
+            nonces_[m] += seq;
+            const std::size_t len = wire.size() - batch_type::OVERHEAD;
+            lanes_[m] = typename multi_type::lane_type{
+                &key_,
+                &nonces_[m],
+                span<const byte>(wire.data(), batch_type::PREFIXSIZE),
+                span<const byte>(wire.data() + batch_type::PREFIXSIZE,
+                                 len + batch_type::MACSIZE),
+                span<byte>(wire.data() + batch_type::PREFIXSIZE, len)
+            };
+            slots_[m] = i;
+            seqs_[m] = seq;
+            ++m;
+        }
+
+        multi_type::decrypt(
+          span<const typename multi_type::lane_type>(lanes_.data(), m),
+          span<byte>(verified_.data(), m));
+
+        std::size_t accepted = 0;
+        for (std::size_t j = 0; j != m; ++j) {
+            if (verified_[j] == 0 || !window_.check_and_mark(seqs_[j]))
+                continue;
+            batch.set_accepted(slots_[j], true);
+            batch.set_length(slots_[j], lanes_[j].output.size());
+            ++accepted;
+        }
+        return accepted;
+    }
+
+    const window_type& window() const noexcept { return window_; }
+
+  private:
+    void reserve(std::size_t n)
+    {
+        if (lanes_.size() < n) {
+            lanes_.resize(n);
+            nonces_.resize(n, base_);
+            slots_.resize(n);
+            seqs_.resize(n);
+            verified_.resize(n);
+        }
+    }
+
+    const key_type key_;
+    const nonce_type base_;
+    window_type window_;
+    std::vector<typename multi_type::lane_type> lanes_;
+    std::vector<nonce_type> nonces_;
+    std::vector<std::size_t> slots_;
+    std::vector<std::uint64_t> seqs_;
+    std::vector<byte> verified_;
+};
+
+} // namespace sodium
@@ -0,0 +1,277 @@
+// decode_filter.h -- Streaming hex and base64 decoding filters
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "encode_filter.h"
+#include "extern_templates.h"
+#include "filter_profile.h"
+#include "helpers.h"
+#include "trace.h"
+
+#include <boost/iostreams/filter/symmetric.hpp>
+#include <boost/iostreams/pipeline.hpp>
+
+#include <algorithm> // std::min<>
+#include <cstddef>   // std::ptrdiff_t
+#include <cstring>   // std::memcpy()
+#include <stdexcept> // std::runtime_error
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+namespace sodium {
+
+template<typename Codec>
+class decode_symmetric_filter
+{
+    /**
+     * decode_symmetric_filter is a SymmetricFilter model that decodes
+     * its input with Codec, e.g. codec_hex or codec_base64<VARIANT>.
+     * It is the inverse of encode_symmetric_filter<Codec>.
+     *
+     * Whole groups go straight from input to output, through the
+     * SIMD kernels of hex2bin(span, span) and base642bin(span, span)
+     * where the CPU has them. The last group of the stream is always
+     * held back until the stream is closed, because it may be
+     * partial or padded; it is then decoded just as strictly as by
+     * a single span base642bin() call of the whole stream. Everything
+     * else that isn't well-formed, e.g. padding in the middle of the
+     * stream, throws a std::runtime_error.
+     *
+     * Nothing is allocated per write.
+     **/
+
+  public:
+    static constexpr std::size_t GROUPSIZE = Codec::GROUPSIZE;
+    static constexpr std::size_t ENCODEDSIZE = Codec::ENCODEDSIZE;
+
+    typedef char char_type; // !!! char, not unsigned char
+
+    decode_symmetric_filter()
+      : carry_{}
+      , ncarry_{ 0 }
+      , pending_{}
+      , npending_{ 0 }
+      , emit_{ 0 }
+      , finished_{ false }
+    {}
+
+    /**
+     * Filter the sequence [i1,i2) to [o1,o2). Update i1 and o1 after
+     * filtering.
+     *
+     * Return true as long as flush is false; when flush is true,
+     * return true while decoded data remains to be output.
+     *
+     * Throw a std::runtime_error if the input isn't well-formed.
+     **/
+
+    bool filter(const char_type*& i1,
+                const char_type* i2,
+                char_type*& o1,
+                char_type* o2,
+                bool flush)
+    {
+        SODIUM_PROFILE_SPAN("decode_filter", i1);
+
+        if (finished_ && i1 != i2)
+            fail(); // input after the (padded) last group
+
+        for (;;) {
+            // 1. send a group decoded by a previous pass downstream
+            if (emit_ != npending_) {
+                std::size_t n =
+                  std::min<std::size_t>(npending_ - emit_, o2 - o1);
+                std::memcpy(o1, pending_ + emit_, n);
+                o1 += n;
+                emit_ += n;
+                if (emit_ != npending_)
+                    return true; // output is full
+                npending_ = emit_ = 0;
+            }
+
+            // 2. complete a group started by a previous write; it
+            //    isn't the last one if more input follows
+            while (ncarry_ != 0 && ncarry_ != ENCODEDSIZE && i1 != i2)
+                carry_[ncarry_++] = *i1++;
+            if (ncarry_ == ENCODEDSIZE && i1 != i2) {
+                decode_pending();
+                continue;
+            }
+
+            // 3. whole groups go straight through, except for the
+            //    last one of this write
+            std::size_t avail = i2 - i1;
+            std::size_t groups =
+              avail == 0 ? 0 : (avail - 1) / ENCODEDSIZE;
+            std::size_t fit = std::min<std::ptrdiff_t>(
+              groups, (o2 - o1) / static_cast<std::ptrdiff_t>(GROUPSIZE));
+            if (ncarry_ == 0 && fit != 0) {
+                if (!Codec::decode(
+                      reinterpret_cast<byte*>(o1), i1, fit * ENCODEDSIZE))
+                    fail();
+                i1 += fit * ENCODEDSIZE;
+                o1 += fit * GROUPSIZE;
+                continue;
+            }
+
+            // 4. the output has no room for a whole group: go through
+            //    pending_, which step 1 sends as far as possible
+            if (ncarry_ == 0 && groups != 0) {
+                std::memcpy(carry_, i1, ENCODEDSIZE);
+                i1 += ENCODEDSIZE;
+                ncarry_ = ENCODEDSIZE;
+                decode_pending();
+                continue;
+            }
+
+            // 5. carry the last group over to the next write, or
+            //    decode it as the last group of the stream
+            while (i1 != i2)
+                carry_[ncarry_++] = *i1++;
+            if (flush && ncarry_ != 0) {
+                decode_last();
+                continue;
+            }
+
+            // all input consumed, and nothing left to send
+            return !flush;
+        }
+    }
+
+    /**
+     * Called when the stream is (about to be) closed. Forget any
+     * carried over chars, and wipe them along with pending bytes.
+     **/
+
+    void close()
+    {
+        SODIUM_TRACE("sodium::decode_symmetric_filter::close()",
+                     "called [ncarry=" << ncarry_ << "]");
+
+        wipe();
+        npending_ = emit_ = 0;
+        finished_ = false;
+    }
+
+  private:
+    // decode the whole group in carry_ into pending_
+    void decode_pending()
+    {
+        if (!Codec::decode(pending_, carry_, ENCODEDSIZE))
+            fail();
+        npending_ = GROUPSIZE;
+        emit_ = 0;
+        ncarry_ = 0;
+        sodium_memzero(carry_, sizeof carry_);
+    }
+
+    // decode the last group of the stream in carry_ into pending_
+    void decode_last()
+    {
+        int n = Codec::decode_last(pending_, carry_, ncarry_);
+        if (n < 0)
+            fail();
+        npending_ = static_cast<std::size_t>(n);
+        emit_ = 0;
+        ncarry_ = 0;
+        sodium_memzero(carry_, sizeof carry_);
+        finished_ = true;
+    }
+
+    [[noreturn]] void fail()
+    {
+        wipe();
+        npending_ = emit_ = 0;
+        throw std::runtime_error{
+            "sodium::decode_symmetric_filter::filter() invalid input"
+        };
+    }
+
+    void wipe() noexcept
+    {
+        sodium_memzero(carry_, sizeof carry_);
+        sodium_memzero(pending_, sizeof pending_);
+        ncarry_ = 0;
+    }
+
+    char carry_[ENCODEDSIZE];     // chars of the last group seen
+    std::size_t ncarry_;          // chars in carry_
+    byte pending_[GROUPSIZE];     // a decoded group, not yet sent
+    std::size_t npending_;        // bytes in pending_
+    std::size_t emit_;            // bytes of pending_ already sent
+    bool finished_;               // the last group has been decoded
+};
+
+// Turn decode_symmetric_filter into a DualUse filter class:
+
+template<typename Codec>
+class decode_filter
+  : public io::symmetric_filter<decode_symmetric_filter<Codec>>
+{
+    /**
+     * decode_filter<Codec> is a DualUseFilter that decodes a hex or
+     * base64 stream on the fly, e.g. a multi-MB base64 payload of a
+     * JSON document, without ever materialising it:
+     *
+     *   io::filtering_istream is(sodium::base64_decode_filter<>() |
+     *                            io::array_source(b64, b64_size));
+     *   is.exceptions(std::ios_base::badbit);
+     *   is.read(buf, sizeof buf); // decoded bytes
+     *
+     * Malformed input throws a std::runtime_error out of the filter,
+     * which the stream turns into failbit/badbit (or an exception,
+     * depending on its exceptions() mask). When used for output,
+     * flush() the stream before closing it: closing a stream doesn't
+     * report errors of the writes that were still buffered.
+     **/
+
+  private:
+    typedef decode_symmetric_filter<Codec> symmetric_filter_type;
+    typedef io::symmetric_filter<symmetric_filter_type> base_type;
+
+  public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::category category;
+
+    /**
+     * buffer_size is the size of the output buffer of the
+     * symmetric_filter.
+     **/
+
+    explicit decode_filter(
+      std::streamsize buffer_size = io::default_device_buffer_size)
+      : base_type(buffer_size)
+    {}
+};
+
+using hex_decode_filter = decode_filter<codec_hex>;
+
+template<int VARIANT = sodium_base64_VARIANT_ORIGINAL>
+using base64_decode_filter = decode_filter<codec_base64<VARIANT>>;
+
+BOOST_IOSTREAMS_PIPABLE(decode_filter, 1)
+
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE(decode_symmetric_filter<codec_hex>);
+SODIUM_EXTERN_TEMPLATE(decode_symmetric_filter<codec_base64<>>);
+
+} // namespace sodium
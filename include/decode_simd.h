@@ -0,0 +1,536 @@
+// decode_simd.h -- Vectorized hex and base64 decoding kernels
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "runtime.h"
+
+#include <sodium.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                             \
+  (defined(__GNUC__) || defined(__clang__))
+#define SODIUM_DECODE_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define SODIUM_DECODE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/**
+ * The kernels behind sodium::hex2bin(span, span) and
+ * sodium::base642bin(span, span) (see helpers.h), which decode into
+ * exactly sized caller buffers.
+ *
+ * Large inputs are decoded 32 (SSSE3, NEON) or 64 (AVX2) chars at a
+ * time. The x86 kernels are compiled with target attributes and
+ * picked at run time from sodium::runtime::instance().cpu(), so the
+ * library itself doesn't need -mavx2. The base64 kernels translate
+ * chars with pshufb (tbl on NEON) lookups in registers, after
+ * W. Mula and D. Lemire, "Faster Base64 Encoding and Decoding using
+ * AVX2 Instructions" (2018).
+ *
+ * All paths, vectorized or scalar, run in constant time with respect
+ * to the decoded bytes: they have no branches and no memory lookups
+ * that depend on the input, and invalid chars are only accumulated
+ * into an error mask that is checked once at the end. This makes them
+ * suitable for keys and other secrets, unlike sodium_hex2bin() and
+ * sodium_base642bin() that stop at the first invalid char.
+ **/
+
+namespace sodium {
+
+namespace decode_detail {
+
+// inputs below this many chars aren't worth a vector kernel
+constexpr std::size_t SIMD_THRESHOLD = 64;
+
+// all ones if 0 <= x < n (x read as signed), else 0, without branches
+constexpr std::uint32_t
+mask_lt(std::uint32_t x, std::uint32_t n) noexcept
+{
+    return 0U - (((x - n) & ~x) >> 31);
+}
+
+// The value of the hex char c. Invalid chars set bits in err.
+inline std::uint32_t
+hex_value(std::uint32_t c, std::uint32_t& err) noexcept
+{
+    const std::uint32_t d = c - '0';
+    const std::uint32_t a = (c | 0x20U) - 'a';
+    const std::uint32_t is_d = mask_lt(d, 10);
+    const std::uint32_t is_a = mask_lt(a, 6);
+    err |= ~(is_d | is_a);
+    return (is_d & d) | (is_a & (a + 10));
+}
+
+// The value of the base64 char c of VARIANT. Invalid chars set err.
+template<int VARIANT>
+inline std::uint32_t
+base64_value(std::uint32_t c, std::uint32_t& err) noexcept
+{
+    constexpr bool urlsafe =
+      VARIANT == sodium_base64_VARIANT_URLSAFE ||
+      VARIANT == sodium_base64_VARIANT_URLSAFE_NO_PADDING;
+    constexpr std::uint32_t c62 = urlsafe ? '-' : '+';
+    constexpr std::uint32_t c63 = urlsafe ? '_' : '/';
+
+    const std::uint32_t u = c - 'A';
+    const std::uint32_t l = c - 'a';
+    const std::uint32_t d = c - '0';
+    const std::uint32_t is_u = mask_lt(u, 26);
+    const std::uint32_t is_l = mask_lt(l, 26);
+    const std::uint32_t is_d = mask_lt(d, 10);
+    const std::uint32_t is_62 = mask_lt(c ^ c62, 1);
+    const std::uint32_t is_63 = mask_lt(c ^ c63, 1);
+    err |= ~(is_u | is_l | is_d | is_62 | is_63);
+    return (is_u & u) | (is_l & (l + 26)) | (is_d & (d + 52)) | (is_62 & 62) |
+           (is_63 & 63);
+}
+
+inline void
+hex_decode_scalar(byte* out,
+                  const char* in,
+                  std::size_t n,
+                  std::uint32_t& err) noexcept
+{
+    for (std::size_t i = 0; i != n; ++i) {
+        const std::uint32_t hi =
+          hex_value(static_cast<unsigned char>(in[2 * i]), err);
+        const std::uint32_t lo =
+          hex_value(static_cast<unsigned char>(in[2 * i + 1]), err);
+        out[i] = static_cast<byte>((hi << 4) | lo);
+    }
+}
+
+// decode ngroups groups of 4 chars into 3 bytes each
+template<int VARIANT>
+inline void
+base64_decode_scalar(byte* out,
+                     const char* in,
+                     std::size_t ngroups,
+                     std::uint32_t& err) noexcept
+{
+    for (std::size_t g = 0; g != ngroups; ++g) {
+        const unsigned char* c =
+          reinterpret_cast<const unsigned char*>(in + 4 * g);
+        const std::uint32_t v = (base64_value<VARIANT>(c[0], err) << 18) |
+                                (base64_value<VARIANT>(c[1], err) << 12) |
+                                (base64_value<VARIANT>(c[2], err) << 6) |
+                                base64_value<VARIANT>(c[3], err);
+        out[3 * g] = static_cast<byte>(v >> 16);
+        out[3 * g + 1] = static_cast<byte>(v >> 8);
+        out[3 * g + 2] = static_cast<byte>(v);
+    }
+}
+
+#if defined(SODIUM_DECODE_X86)
+
+// The kernels return how much they have decoded (bytes for hex,
+// groups for base64), and OR any trace of invalid chars into bad.
+
+__attribute__((target("ssse3"))) inline __m128i
+hex_values_ssse3(__m128i x, __m128i& bad) noexcept
+{
+    const __m128i d = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+    const __m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    const __m128i a =
+      _mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i is_a = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(5)), a);
+    const __m128i valid = _mm_or_si128(is_d, is_a);
+    bad = _mm_or_si128(bad, _mm_andnot_si128(valid, _mm_set1_epi8(-1)));
+    return _mm_or_si128(
+      _mm_and_si128(is_d, d),
+      _mm_and_si128(is_a, _mm_add_epi8(a, _mm_set1_epi8(10))));
+}
+
+__attribute__((target("ssse3"))) inline std::size_t
+hex_decode_ssse3(byte* out, const char* in, std::size_t n, bool& ok) noexcept
+{
+    const __m128i weights = _mm_set1_epi16(0x0110); // 16 * hi + lo
+    __m128i bad = _mm_setzero_si128();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i a = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(in + 2 * i));
+        const __m128i b = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(in + 2 * i + 16));
+        const __m128i wa = _mm_maddubs_epi16(hex_values_ssse3(a, bad), weights);
+        const __m128i wb = _mm_maddubs_epi16(hex_values_ssse3(b, bad), weights);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                         _mm_packus_epi16(wa, wb));
+    }
+    ok = _mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) == 0xffff;
+    return i;
+}
+
+__attribute__((target("avx2"))) inline __m256i
+hex_values_avx2(__m256i x, __m256i& bad) noexcept
+{
+    const __m256i d = _mm256_sub_epi8(x, _mm256_set1_epi8('0'));
+    const __m256i is_d =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    const __m256i a = _mm256_sub_epi8(
+      _mm256_or_si256(x, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    const __m256i is_a =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(5)), a);
+    const __m256i valid = _mm256_or_si256(is_d, is_a);
+    bad =
+      _mm256_or_si256(bad, _mm256_andnot_si256(valid, _mm256_set1_epi8(-1)));
+    return _mm256_or_si256(
+      _mm256_and_si256(is_d, d),
+      _mm256_and_si256(is_a, _mm256_add_epi8(a, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2"))) inline std::size_t
+hex_decode_avx2(byte* out, const char* in, std::size_t n, bool& ok) noexcept
+{
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    __m256i bad = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i a = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(in + 2 * i));
+        const __m256i b = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(in + 2 * i + 32));
+        const __m256i wa =
+          _mm256_maddubs_epi16(hex_values_avx2(a, bad), weights);
+        const __m256i wb =
+          _mm256_maddubs_epi16(hex_values_avx2(b, bad), weights);
+        // packus works per 128-bit lane: put the 64-bit parts in order
+        const __m256i packed = _mm256_permute4x64_epi64(
+          _mm256_packus_epi16(wa, wb), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+    ok = _mm256_movemask_epi8(
+           _mm256_cmpeq_epi8(bad, _mm256_setzero_si256())) == -1;
+    return i;
+}
+
+// the 6-bit values of 16 base64 chars of VARIANT
+template<int VARIANT>
+__attribute__((target("ssse3"))) inline __m128i
+base64_values_ssse3(__m128i x, __m128i& bad) noexcept
+{
+    if (VARIANT == sodium_base64_VARIANT_URLSAFE ||
+        VARIANT == sodium_base64_VARIANT_URLSAFE_NO_PADDING) {
+        // reject '+' and '/', then map '-' to '+' and '_' to '/'
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8('+')));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8('/')));
+        x = _mm_add_epi8(x,
+                         _mm_and_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('-')),
+                                       _mm_set1_epi8('+' - '-')));
+        x = _mm_add_epi8(x,
+                         _mm_and_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('_')),
+                                       _mm_set1_epi8('/' - '_')));
+    }
+
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                         0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                         0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                         0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll =
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+    const __m128i hi_nibbles =
+      _mm_and_si128(_mm_srli_epi32(x, 4), mask_2f);
+    const __m128i lo_nibbles = _mm_and_si128(x, mask_2f);
+    bad = _mm_or_si128(bad,
+                       _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo_nibbles),
+                                     _mm_shuffle_epi8(lut_hi, hi_nibbles)));
+    const __m128i eq_2f = _mm_cmpeq_epi8(x, mask_2f);
+    const __m128i roll =
+      _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    return _mm_add_epi8(x, roll);
+}
+
+// pack 16 6-bit values into 12 bytes, in the low 12 bytes
+__attribute__((target("ssse3"))) inline __m128i
+base64_pack_ssse3(__m128i values) noexcept
+{
+    const __m128i merged =
+      _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i packed =
+      _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(
+      packed,
+      _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+template<int VARIANT>
+__attribute__((target("ssse3"))) inline std::size_t
+base64_decode_ssse3(byte* out,
+                    const char* in,
+                    std::size_t ngroups,
+                    bool& ok) noexcept
+{
+    __m128i bad = _mm_setzero_si128();
+    std::size_t g = 0;
+    // each store writes 16 bytes, 4 more than decoded: keep 2 groups
+    // (6 bytes) of slack for them
+    for (; g + 6 <= ngroups; g += 4) {
+        const __m128i x =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * g));
+        _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(out + 3 * g),
+          base64_pack_ssse3(base64_values_ssse3<VARIANT>(x, bad)));
+    }
+    ok = _mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) == 0xffff;
+    return g;
+}
+
+template<int VARIANT>
+__attribute__((target("avx2"))) inline std::size_t
+base64_decode_avx2(byte* out,
+                   const char* in,
+                   std::size_t ngroups,
+                   bool& ok) noexcept
+{
+    constexpr bool urlsafe =
+      VARIANT == sodium_base64_VARIANT_URLSAFE ||
+      VARIANT == sodium_base64_VARIANT_URLSAFE_NO_PADDING;
+
+    const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+      0x1b, 0x1b, 0x1b, 0x1a, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i shuffle = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+    __m256i bad = _mm256_setzero_si256();
+    std::size_t g = 0;
+    // each store writes 32 bytes, 8 more than decoded: keep 3 groups
+    // (9 bytes) of slack for them
+    for (; g + 11 <= ngroups; g += 8) {
+        __m256i x =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 4 * g));
+        if (urlsafe) {
+            bad = _mm256_or_si256(
+              bad, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('+')));
+            bad = _mm256_or_si256(
+              bad, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('/')));
+            x = _mm256_add_epi8(
+              x,
+              _mm256_and_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')),
+                               _mm256_set1_epi8('+' - '-')));
+            x = _mm256_add_epi8(
+              x,
+              _mm256_and_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')),
+                               _mm256_set1_epi8('/' - '_')));
+        }
+
+        const __m256i hi_nibbles =
+          _mm256_and_si256(_mm256_srli_epi32(x, 4), mask_2f);
+        const __m256i lo_nibbles = _mm256_and_si256(x, mask_2f);
+        bad = _mm256_or_si256(
+          bad,
+          _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo_nibbles),
+                           _mm256_shuffle_epi8(lut_hi, hi_nibbles)));
+        const __m256i eq_2f = _mm256_cmpeq_epi8(x, mask_2f);
+        const __m256i values = _mm256_add_epi8(
+          x,
+          _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)));
+
+        const __m256i merged =
+          _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        const __m256i packed =
+          _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        const __m256i bytes = _mm256_permutevar8x32_epi32(
+          _mm256_shuffle_epi8(packed, shuffle), gather);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 3 * g), bytes);
+    }
+    ok = _mm256_movemask_epi8(
+           _mm256_cmpeq_epi8(bad, _mm256_setzero_si256())) == -1;
+    return g;
+}
+
+#elif defined(SODIUM_DECODE_NEON)
+
+inline uint8x16_t
+hex_values_neon(uint8x16_t x, uint8x16_t& bad) noexcept
+{
+    const uint8x16_t d = vsubq_u8(x, vdupq_n_u8('0'));
+    const uint8x16_t is_d = vcltq_u8(d, vdupq_n_u8(10));
+    const uint8x16_t a =
+      vsubq_u8(vorrq_u8(x, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    const uint8x16_t is_a = vcltq_u8(a, vdupq_n_u8(6));
+    bad = vorrq_u8(bad, vmvnq_u8(vorrq_u8(is_d, is_a)));
+    return vorrq_u8(vandq_u8(is_d, d),
+                    vandq_u8(is_a, vaddq_u8(a, vdupq_n_u8(10))));
+}
+
+inline std::size_t
+hex_decode_neon(byte* out, const char* in, std::size_t n, bool& ok) noexcept
+{
+    uint8x16_t bad = vdupq_n_u8(0);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        // deinterleave: val[0] has the high nibbles, val[1] the low
+        const uint8x16x2_t x =
+          vld2q_u8(reinterpret_cast<const std::uint8_t*>(in + 2 * i));
+        const uint8x16_t hi = hex_values_neon(x.val[0], bad);
+        const uint8x16_t lo = hex_values_neon(x.val[1], bad);
+        vst1q_u8(out + i, vorrq_u8(vshlq_n_u8(hi, 4), lo));
+    }
+    ok = vmaxvq_u8(bad) == 0;
+    return i;
+}
+
+template<int VARIANT>
+inline uint8x16_t
+base64_values_neon(uint8x16_t x, uint8x16_t& bad) noexcept
+{
+    if (VARIANT == sodium_base64_VARIANT_URLSAFE ||
+        VARIANT == sodium_base64_VARIANT_URLSAFE_NO_PADDING) {
+        bad = vorrq_u8(bad, vceqq_u8(x, vdupq_n_u8('+')));
+        bad = vorrq_u8(bad, vceqq_u8(x, vdupq_n_u8('/')));
+        const uint8x16_t to_plus = vdupq_n_u8(0x100 + '+' - '-');
+        const uint8x16_t to_slash = vdupq_n_u8(0x100 + '/' - '_');
+        x = vaddq_u8(x, vandq_u8(vceqq_u8(x, vdupq_n_u8('-')), to_plus));
+        x = vaddq_u8(x, vandq_u8(vceqq_u8(x, vdupq_n_u8('_')), to_slash));
+    }
+
+    static const std::uint8_t lo_table[16] = { 0x15, 0x11, 0x11, 0x11,
+                                               0x11, 0x11, 0x11, 0x11,
+                                               0x11, 0x11, 0x13, 0x1a,
+                                               0x1b, 0x1b, 0x1b, 0x1a };
+    static const std::uint8_t hi_table[16] = { 0x10, 0x10, 0x01, 0x02,
+                                               0x04, 0x08, 0x04, 0x08,
+                                               0x10, 0x10, 0x10, 0x10,
+                                               0x10, 0x10, 0x10, 0x10 };
+    static const std::uint8_t roll_table[16] = {
+        0, 16, 19, 4, 191, 191, 185, 185, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+
+    // the tables are loaded whole: their reads don't depend on x
+    const uint8x16_t hi_nibbles = vshrq_n_u8(x, 4);
+    const uint8x16_t lo_nibbles = vandq_u8(x, vdupq_n_u8(0x0f));
+    bad = vorrq_u8(bad,
+                   vandq_u8(vqtbl1q_u8(vld1q_u8(lo_table), lo_nibbles),
+                            vqtbl1q_u8(vld1q_u8(hi_table), hi_nibbles)));
+    const uint8x16_t eq_2f = vceqq_u8(x, vdupq_n_u8(0x2f));
+    const uint8x16_t roll = vqtbl1q_u8(vld1q_u8(roll_table),
+                                       vaddq_u8(eq_2f, hi_nibbles));
+    return vaddq_u8(x, roll);
+}
+
+template<int VARIANT>
+inline std::size_t
+base64_decode_neon(byte* out,
+                   const char* in,
+                   std::size_t ngroups,
+                   bool& ok) noexcept
+{
+    uint8x16_t bad = vdupq_n_u8(0);
+    std::size_t g = 0;
+    for (; g + 16 <= ngroups; g += 16) {
+        // deinterleave 16 groups: val[k] has the k-th char of each
+        const uint8x16x4_t x =
+          vld4q_u8(reinterpret_cast<const std::uint8_t*>(in + 4 * g));
+        const uint8x16_t a = base64_values_neon<VARIANT>(x.val[0], bad);
+        const uint8x16_t b = base64_values_neon<VARIANT>(x.val[1], bad);
+        const uint8x16_t c = base64_values_neon<VARIANT>(x.val[2], bad);
+        const uint8x16_t d = base64_values_neon<VARIANT>(x.val[3], bad);
+        uint8x16x3_t y;
+        y.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+        y.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+        y.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+        vst3q_u8(out + 3 * g, y);
+    }
+    ok = vmaxvq_u8(bad) == 0;
+    return g;
+}
+
+#endif // SODIUM_DECODE_X86, SODIUM_DECODE_NEON
+
+/**
+ * Decode the 2 * n hex chars at in into the n bytes at out. Return
+ * false if there was an invalid char; out is garbage then.
+ **/
+
+inline bool
+hex_decode(byte* out, const char* in, std::size_t n) noexcept
+{
+    std::size_t done = 0;
+    bool ok = true;
+    if (2 * n >= SIMD_THRESHOLD) {
+#if defined(SODIUM_DECODE_X86)
+        const cpu_features& cpu = runtime::instance().cpu();
+        if (cpu.avx2)
+            done = hex_decode_avx2(out, in, n, ok);
+        else if (cpu.ssse3)
+            done = hex_decode_ssse3(out, in, n, ok);
+#elif defined(SODIUM_DECODE_NEON)
+        done = hex_decode_neon(out, in, n, ok);
+#endif
+    }
+
+    std::uint32_t err = 0;
+    hex_decode_scalar(out + done, in + 2 * done, n - done, err);
+    return ok && err == 0;
+}
+
+/**
+ * Decode the ngroups groups of 4 base64 chars of VARIANT at in into
+ * the 3 * ngroups bytes at out. Return false if there was an invalid
+ * char (padding included); out is garbage then.
+ **/
+
+template<int VARIANT>
+inline bool
+base64_decode_groups(byte* out, const char* in, std::size_t ngroups) noexcept
+{
+    std::size_t done = 0;
+    bool ok = true;
+    if (4 * ngroups >= SIMD_THRESHOLD) {
+#if defined(SODIUM_DECODE_X86)
+        const cpu_features& cpu = runtime::instance().cpu();
+        if (cpu.avx2)
+            done = base64_decode_avx2<VARIANT>(out, in, ngroups, ok);
+        else if (cpu.ssse3)
+            done = base64_decode_ssse3<VARIANT>(out, in, ngroups, ok);
+#elif defined(SODIUM_DECODE_NEON)
+        done = base64_decode_neon<VARIANT>(out, in, ngroups, ok);
+#endif
+    }
+
+    std::uint32_t err = 0;
+    base64_decode_scalar<VARIANT>(
+      out + 3 * done, in + 4 * done, ngroups - done, err);
+    return ok && err == 0;
+}
+
+} // namespace decode_detail
+
+} // namespace sodium
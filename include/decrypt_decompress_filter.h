@@ -0,0 +1,326 @@
+// decrypt_decompress_filter.h -- Decrypt-then-decompress stream filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "compress_encrypt_filter.h" // the format, compress_detail
+#include "filter_profile.h"
+#include "span.h"
+#include "trace.h"
+
+#include <boost/iostreams/filter/symmetric.hpp>
+#include <boost/iostreams/pipeline.hpp>
+
+#include <algorithm> // std::min<>, std::copy
+#include <cstddef>   // std::size_t
+#include <cstdint>
+#include <stdexcept> // std::runtime_error
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+namespace sodium {
+
+class decrypt_decompress_symmetric_filter
+{
+    /**
+     * Decrypt and decompress a stream written by
+     * compress_encrypt_filter, one record at a time.
+     *
+     * Every record is authenticated and decrypted in place, in the
+     * buffer it has been read into. Stored chunks are written out from
+     * there; deflated chunks are inflated into a second buffer of
+     * chunksize bytes, and written out from that one.
+     *
+     * Throws a std::runtime_error if the stream doesn't authenticate,
+     * was written with another chunksize, is truncated, or has data
+     * after its final record.
+     **/
+
+  public:
+    static constexpr std::size_t MACSIZE = compress_detail::aead_type::MACSIZE;
+    static constexpr std::size_t HEADERSIZE = compress_detail::HEADERSIZE;
+    static constexpr std::size_t RECORD_PREFIXSIZE =
+      compress_detail::RECORD_PREFIXSIZE;
+
+    typedef char char_type;
+
+    using key_type = compress_detail::aead_type::key_type;
+    using nonce_type = compress_detail::aead_type::nonce_type;
+
+    decrypt_decompress_symmetric_filter(const key_type& key,
+                                        const std::size_t chunksize)
+      : aead_{ key }
+      , nonce_{ false }
+      , chunksize_{ chunksize }
+      , in_len_{ 0 }
+      , wanted_{ HEADERSIZE }
+      , out_data_{ nullptr }
+      , out_len_{ 0 }
+      , out_pos_{ 0 }
+      , state_{ state_type::header }
+    {
+        if (chunksize < 1 || chunksize > compress_detail::CHUNKSIZE_MAX)
+            throw std::runtime_error{
+                "sodium::decrypt_decompress_filter::"
+                "decrypt_decompress_filter() wrong chunksize"
+            };
+
+        // deflated chunks are smaller than chunksize, or stored
+        record_max_ = chunksize_ + MACSIZE;
+
+        in_.resize(std::max(HEADERSIZE, record_max_));
+        out_.resize(chunksize_);
+    }
+
+    bool filter(const char_type*& i1,
+                const char_type* i2,
+                char_type*& o1,
+                char_type* o2,
+                bool flush)
+    {
+        SODIUM_PROFILE_SPAN("decrypt_decompress_filter", i1);
+
+        for (;;) {
+            // first, write out what's still waiting
+            if (out_pos_ != out_len_) {
+                const auto n =
+                  std::min<std::size_t>(out_len_ - out_pos_, o2 - o1);
+                std::copy(out_data_ + out_pos_, out_data_ + out_pos_ + n, o1);
+                out_pos_ += n;
+                o1 += n;
+                if (out_pos_ != out_len_)
+                    return true; // output buffer is full, call again
+            }
+
+            if (state_ == state_type::finished) {
+                if (i1 != i2)
+                    throw std::runtime_error{
+                        "sodium::decrypt_decompress_filter::filter() "
+                        "data after final record"
+                    };
+                return false; // all done
+            }
+
+            // then, collect the header, a record prefix, or a record
+            const auto n = std::min<std::size_t>(wanted_ - in_len_, i2 - i1);
+            std::copy(i1, i1 + n, in_.begin() + in_len_);
+            in_len_ += n;
+            i1 += n;
+
+            if (in_len_ == wanted_) {
+                next();
+                continue;
+            }
+
+            if (!flush)
+                return true; // need more input
+
+            throw std::runtime_error{
+                "sodium::decrypt_decompress_filter::filter() "
+                "stream truncated"
+            };
+        }
+    }
+
+    /**
+     * Prepare to decrypt a whole new stream, starting with its header.
+     **/
+
+    void close()
+    {
+        SODIUM_TRACE("sodium::decrypt_decompress_symmetric_filter::close()",
+                     "called");
+
+        in_len_ = 0;
+        wanted_ = HEADERSIZE;
+        out_len_ = 0;
+        out_pos_ = 0;
+        state_ = state_type::header;
+    }
+
+  private:
+    enum class state_type
+    {
+        header, // reading the header
+        prefix, // reading LE32(n) || label
+        record, // reading the n bytes of a record
+        finished
+    };
+
+    byte* in() noexcept { return reinterpret_cast<byte*>(in_.data()); }
+
+    // in_ holds wanted_ bytes: process them
+    void next()
+    {
+        switch (state_) {
+            case state_type::header:
+                read_header();
+                state_ = state_type::prefix;
+                wanted_ = RECORD_PREFIXSIZE;
+                break;
+            case state_type::prefix:
+                read_prefix();
+                state_ = state_type::record;
+                break;
+            case state_type::record:
+                open_record();
+                state_ =
+                  (label_ & compress_detail::LABEL_FINAL) != 0
+                    ? state_type::finished
+                    : state_type::prefix;
+                wanted_ = RECORD_PREFIXSIZE;
+                break;
+            case state_type::finished:
+                break;
+        }
+        in_len_ = 0;
+    }
+
+    void read_header()
+    {
+        const byte* p = in();
+        if (!std::equal(
+              compress_detail::MAGIC, compress_detail::MAGIC + 4, p) ||
+            p[4] != compress_detail::VERSION)
+            throw std::runtime_error{
+                "sodium::decrypt_decompress_filter::filter() "
+                "not a compress_encrypt stream"
+            };
+        if (compress_detail::load_le32(p + 8) != chunksize_)
+            throw std::runtime_error{
+                "sodium::decrypt_decompress_filter::filter() "
+                "wrong chunksize"
+            };
+        nonce_ = nonce_type(p + 12);
+    }
+
+    void read_prefix()
+    {
+        const std::size_t n = compress_detail::load_le32(in());
+        label_ = in()[4];
+
+        const byte known =
+          compress_detail::LABEL_DEFLATE | compress_detail::LABEL_FINAL;
+        if (n < MACSIZE || n > record_max_ || (label_ & ~known) != 0)
+            throw std::runtime_error{
+                "sodium::decrypt_decompress_filter::filter() "
+                "malformed record"
+            };
+        wanted_ = n;
+    }
+
+    // authenticate and decrypt the record in in_, in place
+    void open_record()
+    {
+        const std::size_t size = wanted_ - MACSIZE;
+        if (aead_.decrypt(span<byte>(in(), size),
+                          span<const byte>(&label_, 1),
+                          span<const byte>(in(), wanted_),
+                          nonce_) != 0)
+            throw std::runtime_error{
+                "sodium::decrypt_decompress_filter::filter() "
+                "record doesn't authenticate"
+            };
+        nonce_.increment();
+
+        if ((label_ & compress_detail::LABEL_DEFLATE) == 0) {
+            if (size > chunksize_)
+                throw std::runtime_error{
+                    "sodium::decrypt_decompress_filter::filter() "
+                    "chunk too big"
+                };
+            out_data_ = in_.data(); // stored: write it out from in_
+            out_len_ = size;
+        } else {
+            const long inflated = inflater_.decompress(
+              span<const byte>(in(), size),
+              span<byte>(reinterpret_cast<byte*>(out_.data()), out_.size()));
+            if (inflated < 0)
+                throw std::runtime_error{
+                    "sodium::decrypt_decompress_filter::filter() "
+                    "can't inflate chunk"
+                };
+            out_data_ = out_.data();
+            out_len_ = static_cast<std::size_t>(inflated);
+        }
+        out_pos_ = 0;
+    }
+
+    compress_detail::aead_type aead_;
+    nonce_type nonce_;
+    std::size_t chunksize_;
+    std::size_t record_max_;
+    compress_detail::inflater inflater_;
+    chars in_;                 // header, record prefix or record
+    std::size_t in_len_;       // bytes of in_ filled so far
+    std::size_t wanted_;       // bytes of in_ needed for the next step
+    chars out_;                // inflated chunk
+    const char* out_data_;     // in_ or out_, waiting to be written
+    std::size_t out_len_;
+    std::size_t out_pos_;
+    byte label_;
+    state_type state_;
+}; // decrypt_decompress_symmetric_filter
+
+// Turn decrypt_decompress_symmetric_filter into a DualUse filter class:
+
+class decrypt_decompress_filter
+  : public io::symmetric_filter<decrypt_decompress_symmetric_filter>
+{
+    /**
+     * decrypt_decompress_filter is a DualUseFilter that decrypts and
+     * decompresses a stream produced by compress_encrypt_filter, using
+     * constant memory.
+     *
+     * Parameters:
+     *   buffer_size: size of the internal buffer of symmetric_filter.
+     *   key        : the secret key used for encryption/decryption.
+     *   chunksize  : number of plaintext bytes per record, as used by
+     *                compress_encrypt_filter.
+     *
+     * See also: compress_encrypt_filter.
+     **/
+
+  private:
+    typedef io::symmetric_filter<decrypt_decompress_symmetric_filter>
+      base_type;
+    typedef decrypt_decompress_symmetric_filter symmetric_filter_type;
+
+  public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::category category;
+
+    static constexpr std::size_t MACSIZE = symmetric_filter_type::MACSIZE;
+    static constexpr std::size_t HEADERSIZE =
+      symmetric_filter_type::HEADERSIZE;
+
+    using key_type = symmetric_filter_type::key_type;
+
+    decrypt_decompress_filter(std::streamsize buffer_size,
+                              const key_type& key,
+                              const std::size_t chunksize)
+      : base_type(buffer_size, key, chunksize)
+    {}
+};
+
+BOOST_IOSTREAMS_PIPABLE(decrypt_decompress_filter, 0)
+
+} // namespace sodium
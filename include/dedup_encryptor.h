@@ -0,0 +1,326 @@
+// dedup_encryptor.h -- Single-pass chunk, identify and encrypt for dedup
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "cdc_chunker.h"
+#include "common.h"
+#include "hasher_generic.h"
+#include "nonce.h"
+#include "span.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<typename BT = bytes, typename F = aead_xchacha20_poly1305_ietf>
+class dedup_encryptor
+{
+    /**
+     * A sodium::dedup_encryptor turns a stream (e.g. a file to back
+     * up) into content-defined chunks, each one identified by a keyed
+     * hash of its plaintext, and encrypts only the chunks that the
+     * caller doesn't have yet, in a single pass over the data:
+     *
+     *   for each chunk of istr (see sodium::cdc_chunker):
+     *     id = BLAKE2b-256(id key, chunk)
+     *     if (is_new(id))
+     *       sink(id, nonce || AEAD_encrypt(key, nonce, AD = id, chunk))
+     *
+     * and returns the recipe of the stream: the ids (and sizes) of
+     * its chunks, in order, from which decrypt() restores it.
+     *
+     * The chunk ids are keyed, so that they don't reveal which
+     * plaintexts are stored to whoever doesn't know the id key; the
+     * id is the AD of its ciphertext, so that ciphertexts can't be
+     * swapped, and decrypt_chunk() checks that the plaintext hashes to
+     * its id again.
+     *
+     * Without a thread_pool, everything runs on the calling thread.
+     * With one, the chunks of every read buffer are hashed and (if
+     * new) encrypted in parallel, one task per chunk, while cutting
+     * the chunks stays sequential (it is much cheaper). is_new() and
+     * sink() are then called concurrently from the workers of the
+     * pool: they must be thread-safe, and is_new() must atomically
+     * claim the id, i.e. return true for the first caller only, so
+     * that a chunk that occurs twice in the stream is stored once.
+     *
+     * Every chunk is hashed straight from the read buffer, with the
+     * per-thread hasher state of hasher_generic::local_state(); the
+     * only allocation per chunk is the ciphertext of a new chunk.
+     **/
+
+  public:
+    using bytes_type = BT;
+    using aead_type = aead<BT, F>;
+    using key_type = typename aead_type::key_type;
+    using nonce_type = typename aead_type::nonce_type;
+    using hasher_type = hasher_generic<BT>;
+    using id_key_type = typename hasher_type::key_type;
+
+    static constexpr std::size_t IDSIZE = crypto_generichash_BYTES;
+    static constexpr std::size_t NONCESIZE = aead_type::NONCESIZE;
+    static constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+
+    // the size of an encrypted chunk minus the size of its plaintext
+    static constexpr std::size_t OVERHEAD = NONCESIZE + MACSIZE;
+
+    // the default number of bytes read from the stream at a time
+    static constexpr std::size_t READSIZE = 1024 * 1024;
+
+    using chunk_id_type = std::array<byte, IDSIZE>;
+
+    // an entry of the recipe of a stream
+    struct chunk_ref
+    {
+        chunk_id_type id;
+        std::uint64_t offset; // in the stream
+        std::size_t size;     // of the plaintext
+        bool stored;          // is_new() was true and sink() was called
+    };
+
+    using recipe_type = std::vector<chunk_ref>;
+
+    /**
+     * A dedup_encryptor with the encryption key key, the key id_key of
+     * the chunk ids, and the chunk boundaries of chunker. It reads
+     * readsize bytes at a time, but at least 2 * chunker.max_size().
+     **/
+
+    dedup_encryptor(const key_type& key,
+                    const id_key_type& id_key,
+                    const cdc_chunker& chunker,
+                    std::size_t readsize = READSIZE)
+      : aead_(key)
+      , hasher_(id_key)
+      , chunker_(chunker)
+      , readsize_{ std::max(readsize, 2 * chunker.max_size()) }
+    {}
+
+    // the keyed id of the chunk plaintext
+    chunk_id_type chunk_id(span<const byte> plaintext) const
+    {
+        auto& state = hasher_.local_state(IDSIZE);
+        state.update(plaintext);
+
+        chunk_id_type id;
+        state.final(id);
+        return id;
+    }
+
+    /**
+     * Chunk, identify and (if new) encrypt all of istr, calling
+     *
+     *   bool is_new(const chunk_id_type& id)
+     *   void sink(const chunk_id_type& id, span<const byte> encrypted)
+     *
+     * as described above, with pool or on the calling thread. Return
+     * the recipe of istr.
+     *
+     * If is_new(), sink() or the stream throw, the first exception is
+     * rethrown after all chunks of the current read buffer are done.
+     **/
+
+    template<typename IsNew, typename Sink>
+    recipe_type encrypt(std::istream& istr,
+                        IsNew is_new,
+                        Sink sink,
+                        thread_pool* pool = nullptr) const
+    {
+        recipe_type recipe;
+        bytes buffer(readsize_);
+        std::size_t filled = 0;
+        std::uint64_t offset = 0; // of buffer[0] in istr
+        bool eof = false;
+
+        while (!eof || filled != 0) {
+            if (!eof) {
+                istr.read(reinterpret_cast<char*>(buffer.data() + filled),
+                          buffer.size() - filled);
+                filled += static_cast<std::size_t>(istr.gcount());
+                eof = !istr;
+                if (eof && istr.bad())
+                    throw std::runtime_error{
+                        "sodium::dedup_encryptor::encrypt() can't read"
+                    };
+            }
+
+            // cut the chunks of the buffer
+            const std::size_t first = recipe.size();
+            std::size_t pos = 0;
+            while (pos != filled) {
+                const std::size_t size = chunker_.cut(
+                  span<const byte>(buffer.data() + pos, filled - pos), eof);
+                if (size == 0)
+                    break;
+                recipe.push_back(chunk_ref{ {}, offset + pos, size, false });
+                pos += size;
+            }
+
+            // identify and encrypt them
+            auto process = [&, first](std::size_t i) {
+                chunk_ref& ref = recipe[i];
+                const span<const byte> chunk(
+                  buffer.data() + (ref.offset - offset), ref.size);
+                ref.id = chunk_id(chunk);
+                if (is_new(static_cast<const chunk_id_type&>(ref.id))) {
+                    const bytes_type encrypted = encrypt_chunk(ref.id, chunk);
+                    sink(static_cast<const chunk_id_type&>(ref.id),
+                         span<const byte>(
+                           reinterpret_cast<const byte*>(encrypted.data()),
+                           encrypted.size()));
+                    ref.stored = true;
+                }
+            };
+            if (pool == nullptr) {
+                for (std::size_t i = first; i != recipe.size(); ++i)
+                    process(i);
+            } else {
+                std::vector<std::future<void>> done;
+                done.reserve(recipe.size() - first);
+                for (std::size_t i = first; i != recipe.size(); ++i)
+                    done.push_back(pool->submit([&process, i] { process(i); }));
+                for (auto& f : done)
+                    pool->wait(f); // all tasks use buffer
+                for (auto& f : done)
+                    f.get();
+            }
+
+            // keep the tail for the next round
+            std::copy(buffer.begin() + pos,
+                      buffer.begin() + filled,
+                      buffer.begin());
+            filled -= pos;
+            offset += pos;
+        }
+
+        return recipe;
+    }
+
+    // nonce || AEAD_encrypt(key, nonce, AD = id, plaintext)
+    bytes_type encrypt_chunk(const chunk_id_type& id,
+                             span<const byte> plaintext) const
+    {
+        bytes_type encrypted(OVERHEAD + plaintext.size());
+        byte* out = reinterpret_cast<byte*>(encrypted.data());
+
+        const nonce_type nonce;
+        std::copy(nonce.data(), nonce.data() + NONCESIZE, out);
+        if (aead_.encrypt(span<byte>(out + NONCESIZE, encrypted.size() -
+                                                        NONCESIZE),
+                          span<const byte>(id.data(), id.size()),
+                          plaintext,
+                          nonce) != 0)
+            throw std::runtime_error{
+                "sodium::dedup_encryptor::encrypt_chunk() can't encrypt"
+            };
+        return encrypted;
+    }
+
+    /**
+     * Decrypt the encrypted chunk of id, as passed to sink().
+     *
+     * Throw a std::runtime_error if encrypted has been tampered with,
+     * doesn't belong to id, or decrypts to a plaintext whose id isn't
+     * id.
+     **/
+
+    bytes_type decrypt_chunk(const chunk_id_type& id,
+                             span<const byte> encrypted) const
+    {
+        if (encrypted.size() < OVERHEAD)
+            throw std::runtime_error{
+                "sodium::dedup_encryptor::decrypt_chunk() chunk too small"
+            };
+
+        const nonce_type nonce(encrypted.data());
+        bytes_type plaintext(encrypted.size() - OVERHEAD);
+        const span<byte> out(reinterpret_cast<byte*>(plaintext.data()),
+                             plaintext.size());
+        if (aead_.decrypt(out,
+                          span<const byte>(id.data(), id.size()),
+                          encrypted.subspan(NONCESIZE,
+                                            encrypted.size() - NONCESIZE),
+                          nonce) != 0)
+            throw std::runtime_error{
+                "sodium::dedup_encryptor::decrypt_chunk() can't decrypt"
+            };
+
+        const chunk_id_type actual = chunk_id(out);
+        if (sodium_memcmp(actual.data(), id.data(), IDSIZE) != 0)
+            throw std::runtime_error{
+                "sodium::dedup_encryptor::decrypt_chunk() wrong chunk id"
+            };
+        return plaintext;
+    }
+
+    /**
+     * Restore the stream of recipe into ostr, fetching the encrypted
+     * chunks with
+     *
+     *   bytes_type fetch(const chunk_id_type& id)
+     *
+     * Throw a std::runtime_error like decrypt_chunk(), or if a chunk
+     * doesn't have the size that recipe says.
+     **/
+
+    template<typename Fetch>
+    void decrypt(const recipe_type& recipe, Fetch fetch, std::ostream& ostr)
+      const
+    {
+        for (const chunk_ref& ref : recipe) {
+            const bytes_type encrypted = fetch(ref.id);
+            const bytes_type plaintext = decrypt_chunk(
+              ref.id,
+              span<const byte>(reinterpret_cast<const byte*>(encrypted.data()),
+                               encrypted.size()));
+            if (plaintext.size() != ref.size)
+                throw std::runtime_error{
+                    "sodium::dedup_encryptor::decrypt() wrong chunk size"
+                };
+            ostr.write(reinterpret_cast<const char*>(plaintext.data()),
+                       plaintext.size());
+        }
+        if (!ostr)
+            throw std::runtime_error{
+                "sodium::dedup_encryptor::decrypt() can't write"
+            };
+    }
+
+  private:
+    const aead_type aead_;
+    const hasher_type hasher_;
+    const cdc_chunker chunker_;
+    const std::size_t readsize_;
+};
+
+} // namespace sodium
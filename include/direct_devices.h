@@ -0,0 +1,317 @@
+// direct_devices.h -- Zero-copy Direct devices that encrypt memory in place
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "common.h"
+#include "key.h"
+#include "nonce.h"
+#include "span.h"
+#include "stream_xor_backend.h"
+
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * The Direct devices below give a Boost.Iostreams stream access to a
+ * memory region that is encrypted in place, without any buffer:
+ *
+ *   std::vector<char> data = ...;        // or a mapped file, see below
+ *   using device = sodium::stream_cipher_device<>;
+ *   io::stream<device> s(device(data, key, nonce, direct_mode::decrypt));
+ *   s >> ...;                            // reads straight from data
+ *
+ * A filter (xchacha20_filter, aead_decrypt_filter, ...) copies every
+ * byte into its input buffer, and out of its output buffer again; a
+ * Direct device instead decrypts the whole region in place when it is
+ * constructed (direct_mode::decrypt), or encrypts it in place when it
+ * is closed (direct_mode::encrypt), and lets the stream read or
+ * write the region itself: one pass over the memory, no copy.
+ *
+ * This only works for constructions whose ciphertext is as long as
+ * the plaintext, i.e. for the stream ciphers, and for the AEADs in
+ * detached mode, where the MAC is kept apart from the region.
+ *
+ * The devices are seekable, as all Direct devices are: the stream
+ * seeks within the region itself. Copies of a device (Boost.Iostreams
+ * copies devices freely) share their state, so that the region is
+ * encrypted once, when the stream is closed.
+ *
+ * Re-encrypting a region after changing it needs a new nonce: use a
+ * decrypt device to read it, and an encrypt device with a fresh nonce
+ * to write it back.
+ **/
+
+enum class direct_mode
+{
+    decrypt, // the region is ciphertext: decrypt it now, in place
+    encrypt  // the region is plaintext: encrypt it in place on close()
+};
+
+/**
+ * A read/write mapping of the file at path, to be used as the region
+ * of a direct device. If size isn't 0, the file is created (or
+ * truncated) with size bytes first; otherwise it must exist.
+ *
+ * Throw a std::runtime_error if the file can't be mapped.
+ **/
+
+inline boost::iostreams::mapped_file
+map_direct_region(const std::string& path, std::size_t size = 0)
+{
+    boost::iostreams::mapped_file_params params(path);
+    params.flags = boost::iostreams::mapped_file::readwrite;
+    if (size != 0)
+        params.new_file_size =
+          static_cast<boost::iostreams::stream_offset>(size);
+
+    boost::iostreams::mapped_file file;
+    try {
+        file.open(params);
+    } catch (const std::exception&) {
+    }
+    if (!file.is_open())
+        throw std::runtime_error{ "sodium::map_direct_region() can't map " +
+                                  path };
+    return file;
+}
+
+template<typename Cipher = stream_cipher_xchacha20>
+class stream_cipher_device
+{
+    /**
+     * A sodium::stream_cipher_device<Cipher> is a seekable, Direct
+     * Boost.Iostreams device over a region encrypted with the stream
+     * cipher Cipher (see stream_xor_backend.h) under key and nonce,
+     * starting at block counter ic (the region starts at byte
+     * 64 * ic of the key stream). The result is the same as that of
+     * the corresponding stream cipher filter.
+     **/
+
+  public:
+    typedef char char_type;
+    struct category
+      : boost::iostreams::seekable_device_tag
+      , boost::iostreams::direct_tag
+      , boost::iostreams::closable_tag
+    {};
+
+    static constexpr std::size_t KEYSIZE = Cipher::KEYSIZE;
+    static constexpr std::size_t NONCESIZE = Cipher::NONCESIZE;
+
+    using key_type = key<KEYSIZE>;
+    using nonce_type = nonce<NONCESIZE>;
+
+    /**
+     * A device over region (e.g. a std::vector<char>, sodium::bytes,
+     * or a boost::iostreams::mapped_file), which must outlive it.
+     * direct_mode::decrypt decrypts the region right away.
+     **/
+
+    stream_cipher_device(span<char> region,
+                         const key_type& key,
+                         const nonce_type& nonce,
+                         direct_mode mode,
+                         std::uint64_t ic = 0,
+                         std::shared_ptr<stream_xor_backend> backend =
+                           default_stream_xor_backend())
+      : state_(std::make_shared<state>(
+          state{ region, key, nonce, ic, std::move(backend), mode }))
+    {
+        if (mode == direct_mode::decrypt)
+            state_->crypt();
+    }
+
+    std::pair<char*, char*> input_sequence() { return sequence(); }
+    std::pair<char*, char*> output_sequence() { return sequence(); }
+
+    // encrypt the region if in direct_mode::encrypt, once
+    void close()
+    {
+        if (state_->mode == direct_mode::encrypt && !state_->closed)
+            state_->crypt();
+        state_->closed = true;
+    }
+
+  private:
+    struct state
+    {
+        span<char> region;
+        key_type key;
+        nonce_type nonce;
+        std::uint64_t ic;
+        std::shared_ptr<stream_xor_backend> backend;
+        direct_mode mode;
+        bool closed = false;
+
+        void crypt()
+        {
+            unsigned char* p =
+              reinterpret_cast<unsigned char*>(region.data());
+            if (stream_xor<Cipher>(backend.get(),
+                                   p,
+                                   p,
+                                   region.size(),
+                                   nonce.data(),
+                                   ic,
+                                   key.data()) != 0)
+                throw std::runtime_error{
+                    "sodium::stream_cipher_device can't crypt region"
+                };
+        }
+    };
+
+    std::pair<char*, char*> sequence()
+    {
+        return { state_->region.data(),
+                 state_->region.data() + state_->region.size() };
+    }
+
+    std::shared_ptr<state> state_;
+};
+
+template<typename F = aead_xchacha20_poly1305_ietf>
+class aead_device
+{
+    /**
+     * A sodium::aead_device<F> is a seekable, Direct Boost.Iostreams
+     * device over a region encrypted with the AEAD F in detached
+     * mode: the MAC lives in a separate span of MACSIZE bytes, and
+     * header is authenticated as additional data. The region and the
+     * MAC are those of sodium::aead<BT, F>::encrypt(ciphertext, mac,
+     * header, plaintext, nonce).
+     *
+     * direct_mode::decrypt verifies and decrypts the region right
+     * away, and throws if it doesn't authenticate: the stream never
+     * sees unauthenticated plaintext. direct_mode::encrypt encrypts
+     * the region and stores the MAC on close().
+     **/
+
+  public:
+    typedef char char_type;
+    struct category
+      : boost::iostreams::seekable_device_tag
+      , boost::iostreams::direct_tag
+      , boost::iostreams::closable_tag
+    {};
+
+    using aead_type = aead<bytes, F>;
+    using key_type = typename aead_type::key_type;
+    using nonce_type = typename aead_type::nonce_type;
+
+    static constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+
+    /**
+     * A device over region and mac, which must outlive it.
+     *
+     * Throw a std::runtime_error if mac isn't MACSIZE bytes long, or
+     * if region and mac don't authenticate (direct_mode::decrypt). As
+     * libsodium zeroes the output of a failed decryption, and the
+     * output is the region itself, the region is wiped in that case:
+     * keep a copy if it may be needed again.
+     **/
+
+    aead_device(span<char> region,
+                span<byte> mac,
+                const key_type& key,
+                const nonce_type& nonce,
+                direct_mode mode,
+                span<const byte> header = span<const byte>())
+      : state_(std::make_shared<state>(
+          state{ region,
+                 mac,
+                 aead_type(key),
+                 nonce,
+                 bytes(header.begin(), header.end()),
+                 mode }))
+    {
+        if (mac.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::aead_device::aead_device() wrong MAC size"
+            };
+
+        if (mode == direct_mode::decrypt &&
+            state_->aead.decrypt(state_->bytes_of_region(),
+                                 state_->header,
+                                 state_->bytes_of_region(),
+                                 mac,
+                                 nonce) != 0)
+            throw std::runtime_error{
+                "sodium::aead_device::aead_device() region doesn't "
+                "authenticate"
+            };
+    }
+
+    std::pair<char*, char*> input_sequence() { return sequence(); }
+    std::pair<char*, char*> output_sequence() { return sequence(); }
+
+    // encrypt the region and store the MAC if in direct_mode::encrypt, once
+    void close()
+    {
+        if (state_->mode == direct_mode::encrypt && !state_->closed &&
+            state_->aead.encrypt(state_->bytes_of_region(),
+                                 state_->mac,
+                                 state_->header,
+                                 state_->bytes_of_region(),
+                                 state_->nonce) != 0)
+            throw std::runtime_error{
+                "sodium::aead_device::close() can't encrypt region"
+            };
+        state_->closed = true;
+    }
+
+  private:
+    struct state
+    {
+        span<char> region;
+        span<byte> mac;
+        aead_type aead;
+        nonce_type nonce;
+        bytes header;
+        direct_mode mode;
+        bool closed = false;
+
+        span<byte> bytes_of_region() const noexcept
+        {
+            return span<byte>(reinterpret_cast<byte*>(region.data()),
+                              region.size());
+        }
+    };
+
+    std::pair<char*, char*> sequence()
+    {
+        return { state_->region.data(),
+                 state_->region.data() + state_->region.size() };
+    }
+
+    std::shared_ptr<state> state_;
+};
+
+} // namespace sodium
@@ -0,0 +1,302 @@
+// encode_filter.h -- Streaming hex and base64 encoders for Boost.Iostreams
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "extern_templates.h"
+#include "filter_profile.h"
+#include "helpers.h"
+#include "span.h"
+#include "trace.h"
+
+#include <boost/iostreams/filter/symmetric.hpp>
+#include <boost/iostreams/pipeline.hpp>
+
+#include <algorithm> // std::min<>
+#include <cstddef>   // std::ptrdiff_t
+#include <cstring>   // std::memcpy()
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+namespace sodium {
+
+/**
+ * The codecs that an encode_symmetric_filter or a
+ * decode_symmetric_filter can use. Each one turns groups of GROUPSIZE
+ * bytes into ENCODEDSIZE chars; encode() may only be called with a
+ * partial group for the last group of a stream.
+ *
+ * decode() decodes whole groups that are known not to be the last
+ * one of the stream, and returns false if there is an invalid char.
+ * decode_last() decodes the (possibly partial or padded) last group,
+ * and returns the number of bytes decoded, or -1 if it isn't
+ * well-formed.
+ **/
+
+struct codec_hex
+{
+    static constexpr std::size_t GROUPSIZE = 1;
+    static constexpr std::size_t ENCODEDSIZE = 2;
+
+    static constexpr std::size_t encoded_size(std::size_t size) noexcept
+    {
+        return hex_encoded_size(size);
+    }
+
+    static void encode(char* out, const byte* in, std::size_t size) noexcept
+    {
+        static_cast<void>(
+          bin2hex(span<char>(out, encoded_size(size)),
+                  span<const byte>(in, size)));
+    }
+
+    static bool decode(byte* out, const char* in, std::size_t size) noexcept
+    {
+        return decode_detail::hex_decode(out, in, hex_decoded_size(size));
+    }
+
+    static int decode_last(byte* out, const char* in, std::size_t size) noexcept
+    {
+        const std::size_t n = hex_decoded_size(size);
+        if (hex2bin(span<byte>(out, n), span<const char>(in, size)) != 0)
+            return -1;
+        return static_cast<int>(n);
+    }
+};
+
+template<int VARIANT = sodium_base64_VARIANT_ORIGINAL>
+struct codec_base64
+{
+    static constexpr std::size_t GROUPSIZE = 3;
+    static constexpr std::size_t ENCODEDSIZE = 4;
+
+    static constexpr std::size_t encoded_size(std::size_t size) noexcept
+    {
+        return base64_encoded_size<VARIANT>(size);
+    }
+
+    static void encode(char* out, const byte* in, std::size_t size) noexcept
+    {
+        static_cast<void>(bin2base64<VARIANT>(
+          span<char>(out, encoded_size(size)), span<const byte>(in, size)));
+    }
+
+    static bool decode(byte* out, const char* in, std::size_t size) noexcept
+    {
+        return decode_detail::base64_decode_groups<VARIANT>(
+          out, in, size / ENCODEDSIZE);
+    }
+
+    static int decode_last(byte* out, const char* in, std::size_t size) noexcept
+    {
+        const span<const char> group(in, size);
+        const std::size_t n = base64_decoded_size<VARIANT>(group);
+        if (base642bin<VARIANT>(span<byte>(out, n), group) != 0)
+            return -1;
+        return static_cast<int>(n);
+    }
+};
+
+template<typename Codec>
+class encode_symmetric_filter
+{
+    /**
+     * encode_symmetric_filter is a SymmetricFilter model that encodes
+     * its input with Codec, e.g. codec_hex or codec_base64<VARIANT>.
+     *
+     * Whole groups go straight from input to output. The bytes of a
+     * group that straddles two writes are carried over to the next
+     * write, and, for base64, the last partial group is encoded (and
+     * padded, if the variant pads) when the stream is closed. The
+     * output is therefore always the same as that of a single
+     * bin2hex() or bin2base64() call of the whole stream, no matter
+     * how the stream was chunked.
+     *
+     * Nothing is allocated per write.
+     **/
+
+  public:
+    static constexpr std::size_t GROUPSIZE = Codec::GROUPSIZE;
+    static constexpr std::size_t ENCODEDSIZE = Codec::ENCODEDSIZE;
+
+    typedef char char_type; // !!! char, not unsigned char
+
+    encode_symmetric_filter()
+      : carry_{}
+      , ncarry_{ 0 }
+      , pending_{}
+      , npending_{ 0 }
+      , emit_{ 0 }
+    {}
+
+    /**
+     * Filter the sequence [i1,i2) to [o1,o2). Update i1 and o1 after
+     * filtering.
+     *
+     * Return true as long as flush is false; when flush is true,
+     * return true while encoded data remains to be output.
+     **/
+
+    bool filter(const char_type*& i1,
+                const char_type* i2,
+                char_type*& o1,
+                char_type* o2,
+                bool flush)
+    {
+        SODIUM_PROFILE_SPAN("encode_filter", i1);
+
+        for (;;) {
+            // 1. send a group encoded by a previous pass downstream
+            if (emit_ != npending_) {
+                std::size_t n =
+                  std::min<std::size_t>(npending_ - emit_, o2 - o1);
+                std::memcpy(o1, pending_ + emit_, n);
+                o1 += n;
+                emit_ += n;
+                if (emit_ != npending_)
+                    return true; // output is full
+                npending_ = emit_ = 0;
+            }
+
+            // 2. complete a group started by a previous write
+            while (ncarry_ != 0 && ncarry_ != GROUPSIZE && i1 != i2)
+                carry_[ncarry_++] = static_cast<byte>(*i1++);
+            if (ncarry_ == GROUPSIZE) {
+                encode_pending(ncarry_);
+                continue;
+            }
+
+            // 3. whole groups go straight through
+            std::size_t groups = std::min<std::ptrdiff_t>(
+              (i2 - i1) / GROUPSIZE, (o2 - o1) / ENCODEDSIZE);
+            if (groups != 0) {
+                Codec::encode(
+                  o1, reinterpret_cast<const byte*>(i1), groups * GROUPSIZE);
+                i1 += groups * GROUPSIZE;
+                o1 += groups * ENCODEDSIZE;
+                continue;
+            }
+
+            // 4. the output has no room for a whole group: go through
+            //    pending_, which step 1 sends as far as possible
+            if (static_cast<std::size_t>(i2 - i1) >= GROUPSIZE) {
+                std::memcpy(carry_, i1, GROUPSIZE);
+                i1 += GROUPSIZE;
+                encode_pending(GROUPSIZE);
+                continue;
+            }
+
+            // 5. carry a partial group over to the next write, or
+            //    encode it as the last group of the stream
+            while (i1 != i2)
+                carry_[ncarry_++] = static_cast<byte>(*i1++);
+            if (flush && ncarry_ != 0) {
+                encode_pending(ncarry_);
+                continue;
+            }
+
+            // all input consumed, and nothing left to send
+            return !flush;
+        }
+    }
+
+    /**
+     * Called when the stream is (about to be) closed. Forget any
+     * carried over bytes, and wipe them.
+     **/
+
+    void close()
+    {
+        SODIUM_TRACE("sodium::encode_symmetric_filter::close()",
+                     "called [ncarry=" << ncarry_ << "]");
+
+        sodium_memzero(carry_, sizeof carry_);
+        sodium_memzero(pending_, sizeof pending_);
+        ncarry_ = npending_ = emit_ = 0;
+    }
+
+  private:
+    // encode the first size bytes of carry_ into pending_
+    void encode_pending(std::size_t size)
+    {
+        Codec::encode(pending_, carry_, size);
+        npending_ = Codec::encoded_size(size);
+        emit_ = 0;
+        ncarry_ = 0;
+        sodium_memzero(carry_, sizeof carry_);
+    }
+
+    byte carry_[GROUPSIZE];       // bytes of a partial group
+    std::size_t ncarry_;          // bytes in carry_
+    char pending_[ENCODEDSIZE];   // an encoded group, not yet sent
+    std::size_t npending_;        // chars in pending_
+    std::size_t emit_;            // chars of pending_ already sent
+};
+
+// Turn encode_symmetric_filter into a DualUse filter class:
+
+template<typename Codec>
+class encode_filter
+  : public io::symmetric_filter<encode_symmetric_filter<Codec>>
+{
+    /**
+     * encode_filter<Codec> is a DualUseFilter that encodes a stream
+     * in hex or base64 on the fly, without ever holding more than one
+     * group of the stream:
+     *
+     *   io::filtering_ostream os(sodium::base64_encode_filter<>() |
+     *                            io::back_inserter(encoded));
+     *   for (const auto& record : records)
+     *       os.write(record.data(), record.size()); // many small writes
+     *   os.pop(); // or os.reset(): send the padded last group
+     **/
+
+  private:
+    typedef encode_symmetric_filter<Codec> symmetric_filter_type;
+    typedef io::symmetric_filter<symmetric_filter_type> base_type;
+
+  public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::category category;
+
+    /**
+     * buffer_size is the size of the output buffer of the
+     * symmetric_filter.
+     **/
+
+    explicit encode_filter(
+      std::streamsize buffer_size = io::default_device_buffer_size)
+      : base_type(buffer_size)
+    {}
+};
+
+using hex_encode_filter = encode_filter<codec_hex>;
+
+template<int VARIANT = sodium_base64_VARIANT_ORIGINAL>
+using base64_encode_filter = encode_filter<codec_base64<VARIANT>>;
+
+BOOST_IOSTREAMS_PIPABLE(encode_filter, 1)
+
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE(encode_symmetric_filter<codec_hex>);
+SODIUM_EXTERN_TEMPLATE(encode_symmetric_filter<codec_base64<>>);
+
+} // namespace sodium
@@ -0,0 +1,994 @@
+// encrypted_log.h -- Append-only log of AEAD-encrypted records
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "common.h"
+#include "key.h"
+#include "nonce.h"
+#include "random.h"
+#include "span.h"
+#include "thread_pool.h"
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * The encrypted log format
+ * ------------------------
+ *
+ * An encrypted log is a pair of files: the log at path, and its sparse
+ * index at path + ".idx". All integers are little-endian.
+ *
+ * The log is a header followed by the records, in sequence number
+ * order (the first record has sequence number 0):
+ *
+ *   header   = "SWEL" || version (1) || 0 (3) || nonce prefix (16)
+ *
+ *   record_i = LE32(n_i) || LE64(time_i)
+ *              || AEAD_encrypt(key, nonce prefix || LE64(i),
+ *                              AD = LE32(n_i) || LE64(time_i) || LE64(i),
+ *                              payload_i)
+ *
+ * where n_i = payload_i.size() + MACSIZE, and time_i is a timestamp
+ * (or any other non-decreasing 64-bit search key) of the caller's
+ * choice. The nonce of a record is derived from its sequence number
+ * and a random prefix per log, so it doesn't have to be stored, and
+ * is never reused under the same key. Binding the sequence number
+ * into the AD detects records that have been dropped, swapped, or
+ * moved from another log.
+ *
+ * The index holds an entry for every record whose sequence number is
+ * a multiple of the index interval I:
+ *
+ *   header   = "SWEI" || version (1) || 0 (3) || LE32(I) || LE32(0)
+ *
+ *   entry_k  = LE64(k * I) || LE64(time_k*I) || LE64(offset_k*I)
+ *
+ * The index is merely a hint: it can be rebuilt from the log (the
+ * writer does so when it is missing), and a wrong offset can't make
+ * the reader return a wrong record, since every record is verified
+ * against its sequence number.
+ **/
+
+namespace encrypted_log_detail {
+
+constexpr unsigned char MAGIC[4] = { 'S', 'W', 'E', 'L' };
+constexpr unsigned char INDEX_MAGIC[4] = { 'S', 'W', 'E', 'I' };
+constexpr unsigned char VERSION = 1;
+
+constexpr std::size_t PREFIXSIZE = 16;
+constexpr std::size_t HEADERSIZE = 8 + PREFIXSIZE;
+constexpr std::size_t RECORD_HEADERSIZE = 4 + 8; // LE32(n) || LE64(time)
+constexpr std::size_t ADSIZE = RECORD_HEADERSIZE + 8;
+constexpr std::size_t INDEX_HEADERSIZE = 16;
+constexpr std::size_t ENTRYSIZE = 3 * 8;
+
+using aead_type = aead<bytes, aead_xchacha20_poly1305_ietf>;
+using prefix_type = std::array<byte, PREFIXSIZE>;
+
+static_assert(aead_type::NONCESIZE == PREFIXSIZE + 8,
+              "the nonce must hold the prefix and a sequence number");
+
+inline void
+store_le(byte* out, std::uint64_t value, std::size_t size) noexcept
+{
+    for (std::size_t i = 0; i != size; ++i)
+        out[i] = static_cast<byte>(value >> (8 * i));
+}
+
+inline std::uint64_t
+load_le(const byte* in, std::size_t size) noexcept
+{
+    std::uint64_t result = 0;
+    for (std::size_t i = 0; i != size; ++i)
+        result |= static_cast<std::uint64_t>(in[i]) << (8 * i);
+    return result;
+}
+
+inline aead_type::nonce_type
+make_nonce(const prefix_type& prefix, std::uint64_t seq) noexcept
+{
+    byte data[aead_type::NONCESIZE];
+    std::copy(prefix.begin(), prefix.end(), data);
+    store_le(data + PREFIXSIZE, seq, 8);
+    return aead_type::nonce_type(data);
+}
+
+// the AD of record seq, whose header is at record
+inline void
+make_ad(byte* ad, const byte* record, std::uint64_t seq) noexcept
+{
+    std::copy(record, record + RECORD_HEADERSIZE, ad);
+    store_le(ad + RECORD_HEADERSIZE, seq, 8);
+}
+
+inline void
+check_header(const byte* header, const unsigned char* magic)
+{
+    if (!std::equal(magic, magic + 4, header) || header[4] != VERSION)
+        throw std::runtime_error{
+            "sodium::encrypted_log not an encrypted log"
+        };
+}
+
+/**
+ * A file descriptor, opened with ::open() and closed on destruction.
+ * The writer needs POSIX files, for their O_APPEND and fsync().
+ **/
+
+class file
+{
+  public:
+    file(const std::string& path, int flags)
+      : fd_(::open(path.c_str(), flags | O_CLOEXEC, 0600))
+    {
+        if (fd_ == -1)
+            throw std::runtime_error{
+                "sodium::encrypted_log_writer can't open " + path
+            };
+    }
+    ~file() { ::close(fd_); }
+
+    file(const file&) = delete;
+    file& operator=(const file&) = delete;
+
+    std::uint64_t size() const
+    {
+        struct stat st;
+        if (::fstat(fd_, &st) == -1)
+            throw std::runtime_error{
+                "sodium::encrypted_log_writer can't stat file"
+            };
+        return static_cast<std::uint64_t>(st.st_size);
+    }
+
+    // write (append) all of data, return false on errors
+    bool write(const byte* data, std::size_t size) noexcept
+    {
+        while (size != 0) {
+            const ssize_t n = ::write(fd_, data, size);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    // read exactly size bytes at offset, return false on errors
+    bool read(byte* data, std::size_t size, std::uint64_t offset) const
+      noexcept
+    {
+        while (size != 0) {
+            const ssize_t n =
+              ::pread(fd_, data, size, static_cast<off_t>(offset));
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= static_cast<std::size_t>(n);
+            offset += static_cast<std::uint64_t>(n);
+        }
+        return true;
+    }
+
+    bool truncate(std::uint64_t size) noexcept
+    {
+        return ::ftruncate(fd_, static_cast<off_t>(size)) == 0;
+    }
+
+    bool sync() noexcept
+    {
+#if defined(__linux__)
+        return ::fdatasync(fd_) == 0;
+#else
+        return ::fsync(fd_) == 0;
+#endif
+    }
+
+  private:
+    int fd_;
+};
+
+/**
+ * A read-only mapping of a whole file, or nothing if the file doesn't
+ * exist or is empty (which mapped_file_source refuses to map).
+ **/
+
+class mapped_file
+{
+  public:
+    explicit mapped_file(const std::string& path)
+    {
+        try {
+            file_.open(path);
+        } catch (const std::exception&) {
+        }
+    }
+
+    const byte* data() const noexcept
+    {
+        return file_.is_open() ? reinterpret_cast<const byte*>(file_.data())
+                               : nullptr;
+    }
+    std::size_t size() const noexcept
+    {
+        return file_.is_open() ? file_.size() : 0;
+    }
+
+  private:
+    boost::iostreams::mapped_file_source file_;
+};
+
+} // namespace encrypted_log_detail
+
+/**
+ * The tuning knobs of a sodium::encrypted_log_writer<>.
+ **/
+
+struct encrypted_log_options
+{
+    // commit() automatically once this many bytes are pending
+    std::size_t group_bytes = 1 << 20;
+
+    // add an index entry for every index_interval-th record; must be
+    // the same every time a log is opened
+    std::size_t index_interval = 1024;
+
+    // fsync() the log on every commit; without it, a commit() hands
+    // the records to the OS, but a crash may lose them
+    bool durable = true;
+};
+
+template<typename BT = bytes>
+class encrypted_log_writer
+{
+    /**
+     * A sodium::encrypted_log_writer<> appends records to an
+     * encrypted log (see the format above), creating it if needed.
+     *
+     * append() encrypts a record into a pending buffer, in memory;
+     * commit() writes all pending records with one write() and makes
+     * them durable with one fsync() (group commit). A commit happens
+     * automatically when group_bytes are pending, and on destruction.
+     * append_sync() appends a record and waits until it is durable:
+     * threads that call it concurrently share their commits, i.e.
+     * while one of them is waiting for its fsync(), the records of
+     * the others pile up in the pending buffer to be committed
+     * together next.
+     *
+     * Opening an existing log reads its index and the record headers
+     * after the last index entry, to find the next sequence number.
+     * A torn record at the end of the log (a crash during a commit)
+     * is cut off, and missing index entries are added.
+     *
+     * All members may be called concurrently from many threads.
+     * There must be only one writer per log at a time.
+     **/
+
+  public:
+    using aead_type = encrypted_log_detail::aead_type;
+    using key_type = aead_type::key_type;
+    using seq_type = std::uint64_t;
+
+    static constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+    static constexpr std::size_t HEADERSIZE = encrypted_log_detail::HEADERSIZE;
+    static constexpr std::size_t RECORD_HEADERSIZE =
+      encrypted_log_detail::RECORD_HEADERSIZE;
+
+    // the largest payload of a record
+    static constexpr std::size_t PAYLOAD_MAX = 0xffffffffUL - MACSIZE;
+
+    /**
+     * Open the log at path (and its index at path + ".idx") for
+     * appending, creating them if they don't exist.
+     *
+     * Throw a std::runtime_error if the files can't be opened, if
+     * path isn't an encrypted log, if options.index_interval is 0 or
+     * differs from the one of the existing index, or on I/O errors.
+     **/
+
+    encrypted_log_writer(const std::string& path,
+                         const key_type& key,
+                         const encrypted_log_options& options = {})
+      : options_(options)
+      , aead_(key)
+      , log_(path, O_RDWR | O_CREAT | O_APPEND)
+      , index_(path + ".idx", O_RDWR | O_CREAT | O_APPEND)
+    {
+        if (options_.index_interval == 0)
+            throw std::runtime_error{
+                "sodium::encrypted_log_writer() index_interval is 0"
+            };
+        open_log();
+        open_index();
+        recover();
+    }
+
+    encrypted_log_writer(const encrypted_log_writer&) = delete;
+    encrypted_log_writer& operator=(const encrypted_log_writer&) = delete;
+
+    // commit the pending records, ignoring errors
+    ~encrypted_log_writer()
+    {
+        try {
+            commit();
+        } catch (const std::exception&) {
+        }
+    }
+
+    /**
+     * Append a record with payload and time to the pending buffer,
+     * and return its sequence number. Commit if group_bytes are
+     * pending.
+     *
+     * Throw a std::runtime_error if payload is bigger than
+     * PAYLOAD_MAX, or if a previous commit failed.
+     **/
+
+    seq_type append(span<const byte> payload, std::uint64_t time)
+    {
+        using namespace encrypted_log_detail;
+
+        if (payload.size() > PAYLOAD_MAX)
+            throw std::runtime_error{
+                "sodium::encrypted_log_writer::append() payload too big"
+            };
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (failed_)
+            throw std::runtime_error{
+                "sodium::encrypted_log_writer::append() log failed"
+            };
+
+        const seq_type seq = next_seq_;
+        const std::size_t n = payload.size() + MACSIZE;
+        const std::size_t pos = pending_.size();
+        pending_.resize(pos + RECORD_HEADERSIZE + n);
+
+        byte* record = pending_.data() + pos;
+        store_le(record, n, 4);
+        store_le(record + 4, time, 8);
+        byte ad[ADSIZE];
+        make_ad(ad, record, seq);
+
+        if (aead_.encrypt(span<byte>(record + RECORD_HEADERSIZE, n),
+                          span<const byte>(ad, ADSIZE),
+                          payload,
+                          make_nonce(prefix_, seq)) != 0) {
+            pending_.resize(pos);
+            throw std::runtime_error{
+              "sodium::encrypted_log_writer::append() can't encrypt record"
+            };
+        }
+
+        if (seq % options_.index_interval == 0)
+            add_entry(pending_index_, seq, time, next_offset_);
+
+        ++next_seq_;
+        next_offset_ += RECORD_HEADERSIZE + n;
+
+        const bool full = pending_.size() >= options_.group_bytes;
+        lock.unlock();
+
+        if (full)
+            sync(seq);
+        return seq;
+    }
+
+    // Same as append(payload, time), then wait until it is durable
+    seq_type append_sync(span<const byte> payload, std::uint64_t time)
+    {
+        const seq_type seq = append(payload, time);
+        sync(seq);
+        return seq;
+    }
+
+    /**
+     * Wait until the record seq has been committed, committing the
+     * pending records if no other thread is doing so already.
+     *
+     * Throw a std::runtime_error if the commit fails. The log is
+     * unusable afterwards; reopen it to continue after the last
+     * durable record.
+     **/
+
+    void sync(seq_type seq)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (seq >= durable_ && seq < next_seq_ && !failed_) {
+            if (committing_) {
+                cv_.wait(lock);
+                continue;
+            }
+
+            // we are the leader: commit everything pending
+            committing_ = true;
+            std::swap(pending_, writing_);
+            std::swap(pending_index_, writing_index_);
+            const seq_type end = next_seq_;
+            lock.unlock();
+
+            const bool ok = write_out();
+
+            lock.lock();
+            committing_ = false;
+            if (ok)
+                durable_ = end;
+            else
+                failed_ = true;
+            cv_.notify_all();
+        }
+
+        if (seq >= durable_ && failed_)
+            throw std::runtime_error{
+                "sodium::encrypted_log_writer::sync() can't write log"
+            };
+    }
+
+    // Commit all pending records, see sync()
+    void commit()
+    {
+        seq_type last;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (next_seq_ == durable_ && !failed_)
+                return;
+            last = next_seq_ - 1;
+        }
+        sync(last);
+    }
+
+    // the number of records in the log, including the pending ones
+    seq_type size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return next_seq_;
+    }
+
+    // the number of committed records
+    seq_type durable() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return durable_;
+    }
+
+  private:
+    static void add_entry(std::vector<byte>& index,
+                          seq_type seq,
+                          std::uint64_t time,
+                          std::uint64_t offset)
+    {
+        using encrypted_log_detail::store_le;
+
+        const std::size_t pos = index.size();
+        index.resize(pos + encrypted_log_detail::ENTRYSIZE);
+        store_le(index.data() + pos, seq, 8);
+        store_le(index.data() + pos + 8, time, 8);
+        store_le(index.data() + pos + 16, offset, 8);
+    }
+
+    // write writing_ and writing_index_, outside of the lock
+    bool write_out() noexcept
+    {
+        // the log first: an index entry must never point past its end
+        bool ok = log_.write(writing_.data(), writing_.size()) &&
+                  (!options_.durable || log_.sync()) &&
+                  index_.write(writing_index_.data(), writing_index_.size());
+        writing_.clear(); // keep the capacity for the next commit
+        writing_index_.clear();
+        return ok;
+    }
+
+    void open_log()
+    {
+        using namespace encrypted_log_detail;
+
+        byte header[HEADERSIZE];
+        log_size_ = log_.size();
+        if (log_size_ == 0) {
+            randombytes_buf_inplace(prefix_);
+            std::fill(header, header + HEADERSIZE, 0);
+            std::copy(MAGIC, MAGIC + sizeof MAGIC, header);
+            header[4] = VERSION;
+            std::copy(prefix_.begin(), prefix_.end(), header + 8);
+            if (!log_.write(header, HEADERSIZE) || !log_.sync())
+                throw std::runtime_error{
+                    "sodium::encrypted_log_writer() can't write header"
+                };
+            log_size_ = HEADERSIZE;
+            return;
+        }
+
+        if (log_size_ < HEADERSIZE || !log_.read(header, HEADERSIZE, 0))
+            throw std::runtime_error{
+                "sodium::encrypted_log_writer() not an encrypted log"
+            };
+        check_header(header, MAGIC);
+        std::copy(header + 8, header + HEADERSIZE, prefix_.begin());
+    }
+
+    void open_index()
+    {
+        using namespace encrypted_log_detail;
+
+        byte header[INDEX_HEADERSIZE];
+        const std::uint64_t size = index_.size();
+        if (size < INDEX_HEADERSIZE) {
+            // new (or torn) index: start over, recover() rebuilds it
+            std::fill(header, header + INDEX_HEADERSIZE, 0);
+            std::copy(INDEX_MAGIC, INDEX_MAGIC + sizeof INDEX_MAGIC, header);
+            header[4] = VERSION;
+            store_le(header + 8, options_.index_interval, 4);
+            if (!index_.truncate(0) || !index_.write(header, INDEX_HEADERSIZE))
+                throw std::runtime_error{
+                    "sodium::encrypted_log_writer() can't write index"
+                };
+            entries_ = 0;
+            return;
+        }
+
+        if (!index_.read(header, INDEX_HEADERSIZE, 0))
+            throw std::runtime_error{
+                "sodium::encrypted_log_writer() can't read index"
+            };
+        check_header(header, INDEX_MAGIC);
+        if (load_le(header + 8, 4) != options_.index_interval)
+            throw std::runtime_error{
+                "sodium::encrypted_log_writer() wrong index_interval"
+            };
+        entries_ = (size - INDEX_HEADERSIZE) / ENTRYSIZE;
+    }
+
+    // find the end of the log, cut off a torn record, complete the index
+    void recover()
+    {
+        using namespace encrypted_log_detail;
+
+        // the last index entry that points into the log
+        seq_type seq = 0;
+        std::uint64_t offset = HEADERSIZE;
+        byte entry[ENTRYSIZE];
+        while (entries_ != 0) {
+            if (!index_.read(entry,
+                             ENTRYSIZE,
+                             INDEX_HEADERSIZE + (entries_ - 1) * ENTRYSIZE))
+                throw std::runtime_error{
+                    "sodium::encrypted_log_writer() can't read index"
+                };
+            seq = load_le(entry, 8);
+            offset = load_le(entry + 16, 8);
+            if (seq == (entries_ - 1) * options_.index_interval &&
+                offset >= HEADERSIZE &&
+                offset + RECORD_HEADERSIZE <= log_size_)
+                break;
+            --entries_; // stale: written before a crash
+        }
+        if (entries_ == 0) {
+            seq = 0;
+            offset = HEADERSIZE;
+        }
+
+        // skip the record of the last entry: it's in the index already
+        byte header[RECORD_HEADERSIZE];
+        std::vector<byte> rebuilt;
+        bool indexed = entries_ != 0;
+        while (offset + RECORD_HEADERSIZE <= log_size_) {
+            if (!log_.read(header, RECORD_HEADERSIZE, offset))
+                throw std::runtime_error{
+                    "sodium::encrypted_log_writer() can't read log"
+                };
+            const std::uint64_t n = load_le(header, 4);
+            if (n < MACSIZE || offset + RECORD_HEADERSIZE + n > log_size_)
+                break; // torn
+            if (seq % options_.index_interval == 0 && !indexed)
+                add_entry(rebuilt, seq, load_le(header + 4, 8), offset);
+            indexed = false;
+            offset += RECORD_HEADERSIZE + n;
+            ++seq;
+        }
+
+        if (!index_.truncate(INDEX_HEADERSIZE + entries_ * ENTRYSIZE) ||
+            !index_.write(rebuilt.data(), rebuilt.size()) ||
+            (offset != log_size_ && !log_.truncate(offset)))
+            throw std::runtime_error{
+                "sodium::encrypted_log_writer() can't repair log"
+            };
+
+        next_seq_ = durable_ = seq;
+        next_offset_ = log_size_ = offset;
+    }
+
+    const encrypted_log_options options_;
+    const aead_type aead_;
+    encrypted_log_detail::file log_;
+    encrypted_log_detail::file index_;
+    encrypted_log_detail::prefix_type prefix_;
+    std::uint64_t log_size_ = 0; // at open, then = next_offset_
+    std::uint64_t entries_ = 0;  // index entries at open
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<byte> pending_;       // encrypted records, not yet written
+    std::vector<byte> pending_index_; // their index entries
+    std::vector<byte> writing_;       // being written by the leader
+    std::vector<byte> writing_index_;
+    seq_type next_seq_ = 0;
+    seq_type durable_ = 0;
+    std::uint64_t next_offset_ = 0;
+    bool committing_ = false;
+    bool failed_ = false;
+};
+
+template<typename BT = bytes>
+class encrypted_log_reader
+{
+    /**
+     * A sodium::encrypted_log_reader<> reads the records of an
+     * encrypted log (see the format above), as they were when the
+     * reader was constructed: construct a new reader to see records
+     * committed since.
+     *
+     * The log and its index are mapped read-only. Constructing a
+     * reader reads the record headers after the last index entry to
+     * count the records. Finding a record by sequence number (get())
+     * or by time (lower_bound()) is a lookup or a binary search in the
+     * index, followed by at most index_interval - 1 hops from record
+     * header to record header, and one decryption: nothing before the
+     * record is decrypted.
+     *
+     * scan() decrypts a range of records sequentially, or all of them
+     * in parallel on a sodium::thread_pool, one batch of index
+     * intervals per task.
+     *
+     * A record that doesn't authenticate (a wrong key, a tampered
+     * or truncated log, a wrong index) is reported with a
+     * std::runtime_error. The times used by lower_bound() are those
+     * of the record headers, and are only verified when the found
+     * records are decrypted.
+     *
+     * All members are const and may be called concurrently.
+     **/
+
+  public:
+    using aead_type = encrypted_log_detail::aead_type;
+    using key_type = aead_type::key_type;
+    using seq_type = std::uint64_t;
+
+    static constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+
+    /**
+     * Open the log at path, and its index at path + ".idx" if it
+     * exists.
+     *
+     * Throw a std::runtime_error if path can't be mapped, or isn't
+     * an encrypted log.
+     **/
+
+    encrypted_log_reader(const std::string& path, const key_type& key)
+      : aead_(key)
+      , log_(path)
+      , index_(path + ".idx")
+    {
+        using namespace encrypted_log_detail;
+
+        if (log_.size() < HEADERSIZE)
+            throw std::runtime_error{
+                "sodium::encrypted_log_reader() can't map " + path
+            };
+        check_header(log_.data(), MAGIC);
+        std::copy(log_.data() + 8, log_.data() + HEADERSIZE, prefix_.begin());
+
+        if (index_.size() >= INDEX_HEADERSIZE) {
+            check_header(index_.data(), INDEX_MAGIC);
+            interval_ = load_le(index_.data() + 8, 4);
+            if (interval_ != 0)
+                entries_ = (index_.size() - INDEX_HEADERSIZE) / ENTRYSIZE;
+        }
+
+        // count the records after the last usable index entry
+        while (entries_ != 0 &&
+               entry_offset(entries_ - 1) + RECORD_HEADERSIZE > log_.size())
+            --entries_; // the index is ahead of a truncated log
+        size_ = entries_ != 0 ? (entries_ - 1) * interval_ : 0;
+        std::uint64_t offset =
+          entries_ != 0 ? entry_offset(entries_ - 1) : HEADERSIZE;
+        while (record_end(offset) != 0) {
+            offset = record_end(offset);
+            ++size_;
+        }
+    }
+
+    encrypted_log_reader(const encrypted_log_reader&) = delete;
+    encrypted_log_reader& operator=(const encrypted_log_reader&) = delete;
+
+    // the number of records
+    seq_type size() const noexcept { return size_; }
+
+    // the index interval of the log, or 0 if it has no index
+    std::size_t index_interval() const noexcept { return interval_; }
+
+    /**
+     * Decrypt and return the payload of record seq. If time isn't
+     * nullptr, store the (verified) time of the record there.
+     *
+     * Throw a std::runtime_error if seq >= size(), or if the record
+     * doesn't authenticate.
+     **/
+
+    BT get(seq_type seq, std::uint64_t* time = nullptr) const
+    {
+        if (seq >= size_)
+            throw std::runtime_error{
+                "sodium::encrypted_log_reader::get() no such record"
+            };
+
+        const std::uint64_t offset = offset_of(seq);
+        BT payload(payload_size(offset));
+        open(payload, seq, offset);
+        if (time != nullptr)
+            *time = record_time(offset);
+        return payload;
+    }
+
+    /**
+     * Return the sequence number of the first record whose time is
+     * not less than time, or size() if there is none. The times of
+     * the records must be non-decreasing.
+     **/
+
+    seq_type lower_bound(std::uint64_t time) const
+    {
+        // the last index entry before time, if any
+        std::uint64_t lo = 0, hi = entries_;
+        while (lo != hi) {
+            const std::uint64_t mid = lo + (hi - lo) / 2;
+            if (entry_time(mid) < time)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        seq_type seq = 0;
+        std::uint64_t offset = encrypted_log_detail::HEADERSIZE;
+        if (lo != 0) {
+            seq = (lo - 1) * interval_;
+            offset = checked_entry_offset(lo - 1);
+        }
+        for (; seq < size_; ++seq) {
+            if (record_time(offset) >= time)
+                return seq;
+            if (seq + 1 != size_)
+                offset = next_record(offset);
+        }
+        return size_;
+    }
+
+    /**
+     * Decrypt the records [first, last) in order, and call
+     * f(seq, time, payload) for each of them, where payload is a
+     * span<const byte> that is only valid during the call.
+     *
+     * Throw a std::runtime_error if last > size(), or if a record
+     * doesn't authenticate (after calling f() for all records before
+     * it). Exceptions of f() are propagated.
+     **/
+
+    template<typename Func>
+    void scan(seq_type first, seq_type last, Func f) const
+    {
+        if (first > last || last > size_)
+            throw std::runtime_error{
+                "sodium::encrypted_log_reader::scan() no such record"
+            };
+        if (first == last)
+            return;
+
+        BT payload;
+        std::uint64_t offset = offset_of(first);
+        for (seq_type seq = first; seq != last; ++seq) {
+            payload.resize(payload_size(offset));
+            open(payload, seq, offset);
+            f(seq,
+              record_time(offset),
+              span<const byte>(
+                reinterpret_cast<const byte*>(payload.data()),
+                payload.size()));
+            if (seq + 1 != last)
+                offset = next_record(offset);
+        }
+    }
+
+    /**
+     * Decrypt all records on pool, calling f(seq, time, payload) for
+     * each of them, as in scan(first, last, f). f() is called
+     * concurrently from the worker threads, in no particular order,
+     * and must be thread-safe.
+     *
+     * Throw the first exception of the tasks (a record that doesn't
+     * authenticate, or an exception of f()), or of pool, after all
+     * tasks are done.
+     **/
+
+    template<typename Func>
+    void scan(thread_pool& pool, Func f) const
+    {
+        // a handful of tasks per worker, each of whole index intervals
+        const std::uint64_t intervals = std::max<std::uint64_t>(entries_, 1);
+        const std::uint64_t tasks =
+          std::min<std::uint64_t>(intervals, 4 * pool.size());
+
+        std::vector<std::future<void>> results;
+        results.reserve(tasks);
+        try {
+            for (std::uint64_t t = 0; t != tasks; ++t) {
+                const seq_type first =
+                  entries_ != 0 ? intervals * t / tasks * interval_ : 0;
+                const seq_type last =
+                  t + 1 == tasks ? size_
+                                 : intervals * (t + 1) / tasks * interval_;
+                results.push_back(pool.submit(
+                  [this, first, last, &f] { scan(first, last, f); }));
+            }
+        } catch (...) {
+            // the tasks already submitted use f and this: let them finish
+            for (auto& result : results)
+                pool.wait(result);
+            throw;
+        }
+        for (auto& result : results)
+            pool.wait(result);
+        for (auto& result : results)
+            result.get();
+    }
+
+  private:
+    std::uint64_t entry_field(std::uint64_t k, std::size_t field) const
+      noexcept
+    {
+        using namespace encrypted_log_detail;
+        return load_le(
+          index_.data() + INDEX_HEADERSIZE + k * ENTRYSIZE + field * 8, 8);
+    }
+    std::uint64_t entry_time(std::uint64_t k) const noexcept
+    {
+        return entry_field(k, 1);
+    }
+    std::uint64_t entry_offset(std::uint64_t k) const noexcept
+    {
+        return entry_field(k, 2);
+    }
+
+    // the offset of entry k, after checking that it fits the log
+    std::uint64_t checked_entry_offset(std::uint64_t k) const
+    {
+        const std::uint64_t offset = entry_offset(k);
+        if (entry_field(k, 0) != k * interval_ ||
+            offset < encrypted_log_detail::HEADERSIZE ||
+            record_end(offset) == 0)
+            throw std::runtime_error{
+                "sodium::encrypted_log_reader corrupted index"
+            };
+        return offset;
+    }
+
+    // the end of the record at offset, or 0 if it doesn't fit the log
+    std::uint64_t record_end(std::uint64_t offset) const noexcept
+    {
+        using namespace encrypted_log_detail;
+
+        if (offset + RECORD_HEADERSIZE > log_.size())
+            return 0;
+        const std::uint64_t n = load_le(log_.data() + offset, 4);
+        const std::uint64_t end = offset + RECORD_HEADERSIZE + n;
+        return n >= MACSIZE && end <= log_.size() ? end : 0;
+    }
+
+    std::uint64_t next_record(std::uint64_t offset) const
+    {
+        const std::uint64_t next = record_end(offset);
+        if (record_end(next) == 0) // only called for seq + 1 < size_
+            throw std::runtime_error{
+                "sodium::encrypted_log_reader corrupted log"
+            };
+        return next;
+    }
+
+    std::uint64_t record_time(std::uint64_t offset) const noexcept
+    {
+        return encrypted_log_detail::load_le(log_.data() + offset + 4, 8);
+    }
+
+    std::size_t payload_size(std::uint64_t offset) const noexcept
+    {
+        return static_cast<std::size_t>(
+          encrypted_log_detail::load_le(log_.data() + offset, 4) - MACSIZE);
+    }
+
+    // the offset of record seq < size_
+    std::uint64_t offset_of(seq_type seq) const
+    {
+        seq_type at = 0;
+        std::uint64_t offset = encrypted_log_detail::HEADERSIZE;
+        if (entries_ != 0) {
+            const std::uint64_t k =
+              std::min<std::uint64_t>(seq / interval_, entries_ - 1);
+            at = k * interval_;
+            offset = checked_entry_offset(k);
+        }
+        for (; at != seq; ++at)
+            offset = next_record(offset);
+        return offset;
+    }
+
+    // decrypt the record seq at offset into payload
+    void open(BT& payload, seq_type seq, std::uint64_t offset) const
+    {
+        using namespace encrypted_log_detail;
+
+        const byte* record = log_.data() + offset;
+        byte ad[ADSIZE];
+        make_ad(ad, record, seq);
+
+        if (aead_.decrypt(
+              span<byte>(reinterpret_cast<byte*>(payload.data()),
+                         payload.size()),
+              span<const byte>(ad, ADSIZE),
+              span<const byte>(record + RECORD_HEADERSIZE,
+                               payload.size() + MACSIZE),
+              make_nonce(prefix_, seq)) != 0)
+            throw std::runtime_error{
+                "sodium::encrypted_log_reader record doesn't authenticate"
+            };
+    }
+
+    const aead_type aead_;
+    encrypted_log_detail::mapped_file log_;
+    encrypted_log_detail::mapped_file index_;
+    encrypted_log_detail::prefix_type prefix_;
+    std::uint64_t interval_ = 0;
+    std::uint64_t entries_ = 0; // usable index entries
+    seq_type size_ = 0;
+};
+
+} // namespace sodium
@@ -0,0 +1,559 @@
+// envelope.h -- Envelope encryption with a cache of unwrapped data keys
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "aead_traits.h"
+#include "common.h"
+#include "key.h"
+#include "nonce.h"
+#include "span.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * The envelope format
+ * -------------------
+ *
+ * Every object is encrypted with its own random data encryption key
+ * (DEK), and the DEK is stored with the object, wrapped (encrypted)
+ * with a key encryption key (KEK). All integers are little-endian.
+ *
+ *   prefix = "SWEV" || version (1) || algorithm id (1) || 0 (2)
+ *            || LE32(kek id)
+ *
+ *   header = prefix || wrap nonce
+ *            || AEAD_encrypt(KEK, wrap nonce, AD = prefix, DEK)
+ *
+ *   object = header || nonce
+ *            || AEAD_encrypt(DEK, nonce, AD = ad, plaintext)
+ *
+ * where ad is optional additional data supplied by the caller. The
+ * algorithm id is the one of aead_traits<F>, e.g. 3 for
+ * XChaCha20-Poly1305-IETF, and the same construction is used for both
+ * layers. The header has a fixed size, HEADERSIZE, so that it can be
+ * read (and cached, see envelope<>) without parsing the rest of the
+ * object. Since every DEK encrypts a single object, headers can't be
+ * swapped between objects: the body wouldn't authenticate.
+ **/
+
+namespace envelope_detail {
+
+constexpr unsigned char MAGIC[4] = { 'S', 'W', 'E', 'V' };
+constexpr unsigned char VERSION = 1;
+constexpr std::size_t PREFIXSIZE = 12;
+
+} // namespace envelope_detail
+
+template<typename BT = bytes, typename F = aead_xchacha20_poly1305_ietf>
+class envelope
+{
+    /**
+     * A sodium::envelope<BT, F> encrypts objects in the envelope
+     * format above, under one KEK, and keeps a bounded cache of the
+     * DEKs it has unwrapped.
+     *
+     * Decrypting an object looks its header up in the cache first;
+     * only on a miss is the DEK unwrapped with the KEK. Hot objects
+     * thus skip the KEK decryption entirely, and pay a keyed BLAKE2b
+     * hash of the header and a hash map lookup instead.
+     *
+     * The cache holds at most capacity DEKs, for at most ttl each
+     * after they have been unwrapped: an expired DEK is unwrapped
+     * again on its next use, so that a revoked KEK (and a DEK that is
+     * no longer in use) doesn't stay in memory forever. Like
+     * box_precomputed_cache, the cache is split into shards with their
+     * own mutex and LRU list. The DEKs live in the protected memory of
+     * sodium::aead<BT, F> objects, which are shared with the callers
+     * of unwrap() and zeroed when the last reference is gone. Entries
+     * are indexed by a hash of the header, keyed with a random secret
+     * that is private to each envelope.
+     *
+     * unwrap(headers, pool) unwraps a batch of headers, e.g. of a
+     * directory listing, with the misses spread over a
+     * sodium::thread_pool.
+     *
+     * All member functions are thread-safe.
+     **/
+
+  public:
+    using bytes_type = BT;
+    using aead_type = aead<BT, F>;
+    using key_type = typename aead_type::key_type; // both KEK and DEK
+    using nonce_type = typename aead_type::nonce_type;
+    using kek_id_type = std::uint32_t;
+    using clock = std::chrono::steady_clock;
+
+    static constexpr std::size_t KEYSIZE = aead_type::KEYSIZE;
+    static constexpr std::size_t NONCESIZE = aead_type::NONCESIZE;
+    static constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+    static constexpr std::size_t PREFIXSIZE = envelope_detail::PREFIXSIZE;
+    static constexpr std::size_t HEADERSIZE =
+      PREFIXSIZE + NONCESIZE + KEYSIZE + MACSIZE;
+
+    // the size of an object minus the size of its plaintext
+    static constexpr std::size_t OVERHEAD = HEADERSIZE + NONCESIZE + MACSIZE;
+
+    // defaults of the cache
+    static constexpr std::size_t CAPACITY = 1024;
+    static constexpr std::size_t SHARDS = 16;
+
+    struct stats_type
+    {
+        std::size_t hits;        // lookups that found their DEK
+        std::size_t misses;      // lookups that had to unwrap it
+        std::size_t expirations; // DEKs dropped because of the ttl
+        std::size_t evictions;   // DEKs dropped to make room
+        std::size_t size;        // DEKs currently in the cache
+    };
+
+    /**
+     * An envelope wrapping DEKs with kek, tagging them with kek_id.
+     * Its cache holds (about) capacity DEKs, split into shards
+     * shards, for at most ttl each.
+     *
+     * Throw a std::runtime_error if capacity or shards is 0.
+     **/
+
+    envelope(const key_type& kek,
+             const kek_id_type kek_id = 0,
+             const std::size_t capacity = CAPACITY,
+             const clock::duration ttl = std::chrono::minutes(5),
+             const std::size_t shards = SHARDS)
+      : kek_(kek)
+      , kek_id_{ kek_id }
+      , ttl_{ ttl }
+      , shard_capacity_{ shards != 0 ? (capacity + shards - 1) / shards : 0 }
+      , shards_(shards)
+    {
+        if (capacity == 0)
+            throw std::runtime_error{
+                "sodium::envelope::envelope() capacity is 0"
+            };
+        if (shards == 0)
+            throw std::runtime_error{
+                "sodium::envelope::envelope() shards is 0"
+            };
+    }
+
+    envelope(const envelope&) = delete;
+    envelope& operator=(const envelope&) = delete;
+
+    kek_id_type kek_id() const noexcept { return kek_id_; }
+
+    /**
+     * Wrap dek with the KEK, and return the HEADERSIZE bytes of its
+     * header.
+     **/
+
+    BT wrap(const key_type& dek) const
+    {
+        BT header(HEADERSIZE);
+        write_prefix(data(header));
+
+        const nonce_type nonce;
+        std::copy(nonce.data(), nonce.data() + NONCESIZE, &header[PREFIXSIZE]);
+        if (kek_.encrypt(span<byte>(data(header) + PREFIXSIZE + NONCESIZE,
+                                    KEYSIZE + MACSIZE),
+                         span<const byte>(data(header), PREFIXSIZE),
+                         span<const byte>(dek.data(), KEYSIZE),
+                         nonce) != 0)
+            throw std::runtime_error{ "sodium::envelope::wrap() can't wrap" };
+        return header;
+    }
+
+    /**
+     * Return an aead<BT, F> with the DEK of header, from the cache if
+     * it is there and hasn't expired, else unwrapped with the KEK and
+     * cached.
+     *
+     * The returned object shares the DEK with the cache, and remains
+     * valid after it has been evicted.
+     *
+     * Throw a std::runtime_error if header is malformed, has another
+     * kek id, or doesn't authenticate. Failures are not cached.
+     **/
+
+    aead_type unwrap(span<const byte> header)
+    {
+        check_header(header, "sodium::envelope::unwrap()");
+
+        const index_type index = index_of(header);
+        shard_type& shard = shard_of(index);
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (const aead_type* cached = find_locked(shard, index))
+                return *cached;
+        }
+
+        // unwrap without holding the lock
+        aead_type dek(unwrap_dek(header));
+        return insert(shard, index, std::move(dek));
+    }
+
+    /**
+     * Unwrap all headers, like unwrap(header) each, with the misses
+     * unwrapped in parallel on pool. The result has one entry per
+     * header, in the same order; headers that fail to unwrap have no
+     * value (a nullptr), instead of throwing. Anything else thrown
+     * (e.g. std::bad_alloc, or by pool) is rethrown, but only once all
+     * the tasks already submitted to pool, which use headers and this
+     * envelope, are done.
+     **/
+
+    template<typename HBT>
+    std::vector<std::unique_ptr<aead_type>> unwrap(
+      const std::vector<HBT>& headers,
+      thread_pool& pool)
+    {
+        std::vector<std::unique_ptr<aead_type>> result(headers.size());
+        std::vector<std::pair<std::size_t, std::future<aead_type>>> misses;
+        misses.reserve(headers.size()); // no future lost to a reallocation
+
+        try {
+            for (std::size_t i = 0; i != headers.size(); ++i) {
+                const span<const byte> header(data(headers[i]),
+                                              headers[i].size());
+                if (!valid_header(header))
+                    continue;
+
+                const index_type index = index_of(header);
+                shard_type& shard = shard_of(index);
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    if (const aead_type* cached = find_locked(shard, index)) {
+                        result[i].reset(new aead_type(*cached));
+                        continue;
+                    }
+                }
+                misses.emplace_back(
+                  i, pool.submit([this, header, index, &shard] {
+                      return insert(
+                        shard, index, aead_type(unwrap_dek(header)));
+                  }));
+            }
+
+            for (auto& miss : misses) {
+                try {
+                    result[miss.first].reset(
+                      new aead_type(pool.get(miss.second)));
+                } catch (const std::runtime_error&) {
+                    // a header that doesn't authenticate: no value
+                }
+            }
+        } catch (...) {
+            // the pending tasks use headers and this: let them finish
+            for (auto& miss : misses)
+                if (miss.second.valid())
+                    pool.wait(miss.second);
+            throw;
+        }
+        return result;
+    }
+
+    /**
+     * Encrypt plaintext into a new object, under a new random DEK.
+     * Optional additional data ad is authenticated, but not stored:
+     * it must be supplied again to decrypt().
+     **/
+
+    BT encrypt(const BT& plaintext, const BT& ad = BT()) const
+    {
+        const key_type dek;
+        const aead_type cryptor(dek);
+
+        BT object(OVERHEAD + plaintext.size());
+        const BT header = wrap(dek);
+        std::copy(header.begin(), header.end(), object.begin());
+
+        const nonce_type nonce;
+        std::copy(nonce.data(), nonce.data() + NONCESIZE, &object[HEADERSIZE]);
+        if (cryptor.encrypt(
+              span<byte>(data(object) + HEADERSIZE + NONCESIZE,
+                         plaintext.size() + MACSIZE),
+              span<const byte>(data(ad), ad.size()),
+              span<const byte>(data(plaintext), plaintext.size()),
+              nonce) != 0)
+            throw std::runtime_error{
+                "sodium::envelope::encrypt() can't encrypt"
+            };
+        return object;
+    }
+
+    /**
+     * Decrypt object, with the DEK of its header (see unwrap()) and
+     * the additional data ad it was encrypted with.
+     *
+     * Throw a std::runtime_error if object is too small, if its DEK
+     * can't be unwrapped, or if its body or ad have been tampered
+     * with.
+     **/
+
+    BT decrypt(const BT& object, const BT& ad = BT())
+    {
+        if (object.size() < OVERHEAD)
+            throw std::runtime_error{
+                "sodium::envelope::decrypt() object too small"
+            };
+
+        const aead_type cryptor =
+          unwrap(span<const byte>(data(object), HEADERSIZE));
+        const nonce_type nonce(data(object) + HEADERSIZE);
+
+        BT plaintext(object.size() - OVERHEAD);
+        if (cryptor.decrypt(
+              span<byte>(data(plaintext), plaintext.size()),
+              span<const byte>(data(ad), ad.size()),
+              span<const byte>(data(object) + HEADERSIZE + NONCESIZE,
+                               object.size() - HEADERSIZE - NONCESIZE),
+              nonce) != 0)
+            throw std::runtime_error{
+                "sodium::envelope::decrypt() can't decrypt"
+            };
+        return plaintext;
+    }
+
+    /**
+     * Evict the DEK of header from the cache. Return true if it was
+     * in the cache.
+     **/
+
+    bool erase(span<const byte> header)
+    {
+        if (!valid_header(header))
+            return false;
+
+        const index_type index = index_of(header);
+        shard_type& shard = shard_of(index);
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(index);
+        if (it == shard.map.end())
+            return false;
+        shard.lru.erase(it->second);
+        shard.map.erase(it);
+        return true;
+    }
+
+    // evict all DEKs; the statistics are kept
+    void clear()
+    {
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.map.clear();
+            shard.lru.clear();
+        }
+    }
+
+    // a snapshot of the cache statistics, summed over all shards
+    stats_type stats() const
+    {
+        stats_type result{ 0, 0, 0, 0, 0 };
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            result.hits += shard.hits;
+            result.misses += shard.misses;
+            result.expirations += shard.expirations;
+            result.evictions += shard.evictions;
+            result.size += shard.map.size();
+        }
+        return result;
+    }
+
+    // the maximum number of DEKs in the cache
+    std::size_t capacity() const
+    {
+        return shard_capacity_ * shards_.size();
+    }
+
+  private:
+    using index_type = std::array<unsigned char, 32>;
+
+    // the index is a keyed hash: its first bytes are as good as any hash
+    struct index_hash
+    {
+        std::size_t operator()(const index_type& index) const noexcept
+        {
+            std::size_t result;
+            std::memcpy(&result, index.data(), sizeof result);
+            return result;
+        }
+    };
+
+    struct entry_type
+    {
+        index_type index;
+        aead_type dek;
+        clock::time_point expires;
+    };
+    using lru_type = std::list<entry_type>; // most recently used first
+
+    struct shard_type
+    {
+        mutable std::mutex mutex;
+        lru_type lru;
+        std::unordered_map<index_type, typename lru_type::iterator, index_hash>
+          map;
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+        std::size_t expirations = 0;
+        std::size_t evictions = 0;
+    };
+
+    template<typename C>
+    static byte* data(C& c) noexcept
+    {
+        return reinterpret_cast<byte*>(c.data());
+    }
+
+    template<typename C>
+    static const byte* data(const C& c) noexcept
+    {
+        return reinterpret_cast<const byte*>(c.data());
+    }
+
+    void write_prefix(byte* out) const noexcept
+    {
+        std::memset(out, 0, PREFIXSIZE);
+        std::copy(envelope_detail::MAGIC, envelope_detail::MAGIC + 4, out);
+        out[4] = envelope_detail::VERSION;
+        out[5] = aead_traits<F>::id;
+        for (std::size_t i = 0; i != 4; ++i)
+            out[8 + i] = static_cast<byte>(kek_id_ >> (8 * i));
+    }
+
+    bool valid_header(span<const byte> header) const noexcept
+    {
+        byte prefix[PREFIXSIZE];
+        write_prefix(prefix);
+        return header.size() == HEADERSIZE &&
+               std::equal(prefix, prefix + PREFIXSIZE, header.data());
+    }
+
+    void check_header(span<const byte> header, const char* fn) const
+    {
+        if (!valid_header(header))
+            throw std::runtime_error{ std::string(fn) +
+                                      " malformed header or wrong kek id" };
+    }
+
+    key_type unwrap_dek(span<const byte> header) const
+    {
+        const nonce_type nonce(header.data() + PREFIXSIZE);
+
+        key_type dek(false);
+        if (kek_.decrypt(span<byte>(dek.setdata(), KEYSIZE),
+                         header.first(PREFIXSIZE),
+                         header.subspan(PREFIXSIZE + NONCESIZE,
+                                        KEYSIZE + MACSIZE),
+                         nonce) != 0)
+            throw std::runtime_error{
+                "sodium::envelope::unwrap() can't unwrap DEK"
+            };
+        dek.readonly();
+        return dek;
+    }
+
+    // the cached DEK at index, if any; shard.mutex held
+    const aead_type* find_locked(shard_type& shard, const index_type& index)
+    {
+        auto it = shard.map.find(index);
+        if (it == shard.map.end()) {
+            ++shard.misses;
+            return nullptr;
+        }
+        if (clock::now() >= it->second->expires) {
+            shard.lru.erase(it->second);
+            shard.map.erase(it);
+            ++shard.expirations;
+            ++shard.misses;
+            return nullptr;
+        }
+        ++shard.hits;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return &shard.lru.front().dek;
+    }
+
+    aead_type insert(shard_type& shard, const index_type& index, aead_type dek)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(index);
+        if (it != shard.map.end()) {
+            // someone else was faster: keep theirs
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return it->second->dek;
+        }
+
+        if (shard.map.size() >= shard_capacity_) {
+            shard.map.erase(shard.lru.back().index);
+            shard.lru.pop_back();
+            ++shard.evictions;
+        }
+        shard.lru.push_front(entry_type{ index, dek, clock::now() + ttl_ });
+        shard.map.emplace(index, shard.lru.begin());
+        return dek;
+    }
+
+    index_type index_of(span<const byte> header) const
+    {
+        index_type index;
+        crypto_generichash(index.data(),
+                           index.size(),
+                           header.data(),
+                           header.size(),
+                           secret_.data(),
+                           secret_.size());
+        return index;
+    }
+
+    // use other bytes of the index than index_hash does
+    shard_type& shard_of(const index_type& index)
+    {
+        const std::size_t n = (std::size_t{ index[30] } << 8) | index[31];
+        return shards_[n % shards_.size()];
+    }
+
+    const aead_type kek_;
+    const kek_id_type kek_id_;
+    const clock::duration ttl_;
+    key<KEYSIZE_HASHKEY> secret_; // random
+    std::size_t shard_capacity_;
+    std::vector<shard_type> shards_;
+};
+
+} // namespace sodium
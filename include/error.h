@@ -0,0 +1,100 @@
+// error.h -- std::error_code support for the non-throwing overloads
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+namespace sodium {
+
+/**
+ * The errors reported by the std::error_code& overloads of the
+ * decrypt() and verify() members of the wrappers.
+ *
+ * Those overloads report a forged or corrupted message, or arguments
+ * of the wrong size, through their std::error_code& argument instead
+ * of throwing a std::runtime_error, just like the std::filesystem
+ * functions do. Rejecting bad input then costs a branch, not a stack
+ * unwind:
+ *
+ *   std::error_code ec;
+ *   auto plaintext = sb.decrypt(ciphertext, nonce, ec);
+ *   if (ec)
+ *       return; // ec == sodium::errc::verification_failed, ...
+ *
+ * They may still throw std::bad_alloc when allocating their result.
+ **/
+
+enum class errc
+{
+    // 0 is success, as for all std::error_codes
+    verification_failed = 1, // forged or corrupted message, wrong key
+    message_too_short,       // too short to even hold a MAC / signature
+    wrong_size,              // e.g. a MAC or a signature of the wrong size
+    invalid_key              // e.g. a public key that isn't on the curve
+};
+
+namespace error_detail {
+
+class error_category_impl : public std::error_category
+{
+  public:
+    const char* name() const noexcept override { return "sodium"; }
+
+    std::string message(int ev) const override
+    {
+        switch (static_cast<errc>(ev)) {
+            case errc::verification_failed:
+                return "verification failed";
+            case errc::message_too_short:
+                return "message too short";
+            case errc::wrong_size:
+                return "argument of the wrong size";
+            case errc::invalid_key:
+                return "invalid key";
+        }
+        return "unknown error";
+    }
+};
+
+} // namespace error_detail
+
+inline const std::error_category&
+error_category() noexcept
+{
+    static const error_detail::error_category_impl category;
+    return category;
+}
+
+inline std::error_code
+make_error_code(errc e) noexcept
+{
+    return std::error_code(static_cast<int>(e), error_category());
+}
+
+} // namespace sodium
+
+namespace std {
+
+template<>
+struct is_error_code_enum<sodium::errc> : true_type
+{};
+
+} // namespace std
@@ -0,0 +1,70 @@
+// extern_templates.h -- Instantiations provided by the sodium-wrapper library
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// The wrappers are header-only templates, so every translation unit
+// instantiates e.g. aead<bytes> again, and the linker throws all but
+// one copy away. The sodium-wrapper library (src/sodium_wrapper.cpp)
+// instantiates the wrappers once for the common BT types bytes, chars
+// and bytes_protected. Code that links against it is compiled with
+// SODIUM_EXTERN_TEMPLATES defined to 1 (CMake does that for targets
+// that link sodium-wrapper), and then only declares them, with
+// extern template.
+//
+// The library is compiled with the default switches. Code that sets
+// SODIUM_PROFILE, SODIUM_METRICS, SODIUM_TRACE_POLICY or a
+// SODIUM_TRACE_LEVEL other than the default (on the command line, or
+// before including the first wrapper) gets no extern declarations,
+// but its own instantiations, even if SODIUM_EXTERN_TEMPLATES is 1:
+// the library's wouldn't have its hooks. Code that doesn't link
+// against sodium-wrapper, or that is compiled with another NDEBUG
+// than the library, must leave SODIUM_EXTERN_TEMPLATES at 0 (the
+// default).
+
+#pragma once
+
+#include "common.h"
+
+#ifndef SODIUM_EXTERN_TEMPLATES
+#define SODIUM_EXTERN_TEMPLATES 0
+#endif // ! SODIUM_EXTERN_TEMPLATES
+
+/**
+ * SODIUM_EXTERN_TEMPLATE_BT(T) declares the instantiations of the
+ * class template T for bytes, chars and bytes_protected as extern;
+ * it is used at the end of each wrapper header, inside namespace
+ * sodium. SODIUM_INSTANTIATE_BT(T) defines them, in the library.
+ **/
+
+#define SODIUM_INSTANTIATE_BT(T)                                               \
+    template class T<bytes>;                                                   \
+    template class T<chars>;                                                   \
+    template class T<bytes_protected>
+
+// the switches of the library (metrics.h and trace.h come with common.h)
+#if SODIUM_EXTERN_TEMPLATES && !(defined(SODIUM_PROFILE) && SODIUM_PROFILE) && \
+  !SODIUM_METRICS && SODIUM_TRACE_LEVEL == SODIUM_TRACE_LEVEL_DEFAULT &&      \
+  !defined(SODIUM_TRACE_POLICY)
+#define SODIUM_EXTERN_TEMPLATE_BT(T)                                           \
+    extern template class T<bytes>;                                            \
+    extern template class T<chars>;                                            \
+    extern template class T<bytes_protected>
+#define SODIUM_EXTERN_TEMPLATE(...) extern template class __VA_ARGS__
+#else
+#define SODIUM_EXTERN_TEMPLATE_BT(T) static_assert(true, "")
+#define SODIUM_EXTERN_TEMPLATE(...) static_assert(true, "")
+#endif // SODIUM_EXTERN_TEMPLATES && library switches
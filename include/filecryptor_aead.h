@@ -19,11 +19,28 @@
 #pragma once
 
 #include "aead.h"
+#include "blocksize.h"
+#include "io_pipeline.h"
 #include "key.h"
 #include "keyvar.h"
 #include "nonce.h"
+#include "span.h"
+#include "streambuf_io.h"
+#include "thread_pool.h"
+#include "tree_hash.h"
 
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
 #include <fstream>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
 #include <sodium.h>
 
 /**
@@ -104,7 +121,17 @@ class filecryptor_aead
                      const std::size_t blocksize,
                      const keyvar<>& hashkey,
                      const std::size_t hashsize)
-      : sc_aead_{ aead<BT>(key) }
+      : filecryptor_aead(
+          make_shared_key(key), nonce, blocksize, hashkey, hashsize)
+    {}
+
+    // the same, sharing an immutable key instead of copying it
+    filecryptor_aead(typename aead<BT>::shared_key_type key,
+                     const typename aead<BT>::nonce_type& nonce,
+                     const std::size_t blocksize,
+                     const keyvar<>& hashkey,
+                     const std::size_t hashsize)
+      : sc_aead_{ std::move(key) }
       , hashkey_{ hashkey }
       , nonce_{ nonce }
       , header_{}
@@ -115,6 +142,10 @@ class filecryptor_aead
         if (blocksize < 1)
             throw std::runtime_error{ "sodium::filecryptor_aead::filecryptor_"
                                       "aead(): wrong blocksize" };
+        if (blocksize == sodium::blocksize::auto_tune)
+            throw std::runtime_error{ "sodium::filecryptor_aead::filecryptor_"
+                                      "aead(): auto_tune isn't stored in the "
+                                      "stream" };
         if (hashkey.size() < HASHKEYSIZE_MIN)
             throw std::runtime_error{ "sodium::filecryptor_aead::filecryptor_"
                                       "aead(): hash key too small" };
@@ -192,6 +223,85 @@ class filecryptor_aead
                                       "error writing hash to file" };
     }
 
+    /**
+     * Fast-path versions of encrypt(istr, ostr): read from the
+     * std::streambuf in and write to the std::streambuf out (e.g.
+     * istr.rdbuf() and ostr.rdbuf()), or use the file descriptors in
+     * and out, without the std::istream / std::ostream layer. See
+     * streamcryptor_aead::encrypt(in, out) and streambuf_io.h.
+     *
+     * The output is the same as that of encrypt(istr, ostr).
+     **/
+
+    void encrypt(std::streambuf* in, std::streambuf* out)
+    {
+        streambuf_reader reader{ in };
+        streambuf_writer writer{ out };
+        encrypt_from(reader, writer);
+    }
+
+    void encrypt(raw_fd in, raw_fd out)
+    {
+        fd_reader reader{ in };
+        fd_writer writer{ out };
+        encrypt_from(reader, writer);
+    }
+
+    /**
+     * Pipelined version of encrypt(istr, ostr), with the same output.
+     *
+     * Reading ISTR, encrypting and hashing, and writing OSTR overlap in
+     * time, through a sodium::io_pipeline of DEPTH reused buffers of
+     * WINDOW blocks each. See streamcryptor_aead::encrypt_pipelined().
+     *
+     * Throw a std::runtime_error if reading or writing fails.
+     **/
+
+    void encrypt_pipelined(std::istream& istr,
+                           std::ostream& ostr,
+                           std::size_t depth = io_pipeline::DEPTH,
+                           std::size_t window = 16)
+    {
+        if (window == 0)
+            throw std::runtime_error{ "sodium::filecryptor_aead::encrypt_"
+                                      "pipelined() wrong window" };
+
+        // the hash streaming API
+        BT hash(hashsize_, '\0');
+        crypto_generichash_state state;
+        crypto_generichash_init(
+          &state, hashkey_.data(), hashkey_.size(), hashsize_);
+
+        io_pipeline pipeline(
+          window * blocksize_, window * (MACSIZE + blocksize_), depth);
+        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+
+        pipeline.run(istr, ostr, [&](span<const byte> in, span<byte> out) {
+            std::size_t outsize = 0;
+            for (std::size_t offset = 0; offset < in.size();
+                 offset += blocksize_) {
+                const std::size_t size =
+                  std::min(blocksize_, in.size() - offset);
+                span<byte> chunk = out.subspan(outsize, MACSIZE + size);
+                sc_aead_.encrypt(
+                  chunk, header_, in.subspan(offset, size), running_nonce);
+                running_nonce.increment();
+                outsize += chunk.size();
+            }
+
+            // update the hash with the whole buffer at once
+            crypto_generichash_update(&state, out.data(), outsize);
+            return outsize;
+        });
+
+        // finish computing the hash, and write it to the end of the stream
+        crypto_generichash_final(&state, hash.data(), hash.size());
+        ostr.write(reinterpret_cast<char*>(hash.data()), hash.size());
+        if (!ostr)
+            throw std::runtime_error{ "sodium::filecryptor_aead::encrypt_"
+                                      "pipelined() error writing hash" };
+    }
+
     /**
      * Decrypt the input _file_ stream IFS in a blockwise fashion, using
      * the algorithm described in sodium::aead, and write the result
@@ -347,7 +457,528 @@ class filecryptor_aead
             };
     }
 
+    /**
+     * Encrypt the file INFILE into the file OUTFILE, producing exactly
+     * the same output as encrypt(istr, ostr) would.
+     *
+     * Instead of going through iostreams, both files are memory-mapped:
+     * each block is encrypted straight from the mapped INFILE into the
+     * mapped OUTFILE, and hashed from there. No intermediate buffers
+     * are allocated. OUTFILE is created or truncated, and resized to
+     * its final size before encryption starts.
+     *
+     * Throw a std::runtime_error if a file can't be mapped, or if
+     * the encryption fails. No strong guarantee w.r.t. OUTFILE.
+     **/
+
+    void encrypt(const std::string& infile, const std::string& outfile)
+    {
+        const std::size_t insize = file_size(infile);
+        const std::size_t nblocks = (insize + blocksize_ - 1) / blocksize_;
+        const std::size_t outsize = insize + nblocks * MACSIZE + hashsize_;
+
+        mapped_input in(infile, insize);
+        mapped_output out(outfile, outsize);
+
+        crypto_generichash_state state;
+        crypto_generichash_init(
+          &state, hashkey_.data(), hashkey_.size(), hashsize_);
+
+        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+        const byte* src = in.data();
+        byte* dst = out.data();
+
+        for (std::size_t remaining = insize; remaining != 0;) {
+            const std::size_t s = std::min(remaining, blocksize_);
+            span<byte> ciphertext(dst, MACSIZE + s);
+
+            if (sc_aead_.encrypt(ciphertext,
+                                 header_,
+                                 span<const byte>(src, s),
+                                 running_nonce) != 0)
+                throw std::runtime_error{ "sodium::filecryptor_aead::encrypt() "
+                                          "can't encrypt chunk" };
+            running_nonce.increment();
+
+            crypto_generichash_update(
+              &state, ciphertext.data(), ciphertext.size());
+
+            src += s;
+            dst += ciphertext.size();
+            remaining -= s;
+        }
+
+        // the hash goes right after the last (MAC || ciphertext)
+        crypto_generichash_final(&state, dst, hashsize_);
+    }
+
+    /**
+     * Decrypt the file INFILE, generated by encrypt(), into the file
+     * OUTFILE, using memory-mapped I/O like encrypt(infile, outfile).
+     *
+     * Unlike decrypt(ifs, ostr), the authenticated hash at the end of
+     * INFILE is verified over the mapped (MAC || ciphertext)s _before_
+     * anything is decrypted. Therefore, OUTFILE is not touched at all
+     * if INFILE has been truncated or tampered with in a way that the
+     * hash detects.
+     *
+     * Throw a std::runtime_error if a file can't be mapped, if the
+     * hash doesn't match, or if a block can't be decrypted.
+     **/
+
+    void decrypt(const std::string& infile, const std::string& outfile)
+    {
+        const std::size_t insize = file_size(infile);
+        if (insize < hashsize_)
+            throw std::runtime_error{ "sodium::filecryptor_aead::decrypt(): "
+                                      "file too small for hash" };
+
+        mapped_input in(infile, insize);
+        const std::size_t csize = insize - hashsize_;
+
+        // verify the hash of the whole ciphertext first
+        BT hash(hashsize_, '\0');
+        crypto_generichash(reinterpret_cast<unsigned char*>(hash.data()),
+                           hash.size(),
+                           in.data(),
+                           csize,
+                           hashkey_.data(),
+                           hashkey_.size());
+        if (sodium_memcmp(hash.data(), in.data() + csize, hashsize_) != 0)
+            throw std::runtime_error{
+                "sodium::filecryptor_aead::decrypt() hash mismatch!"
+            };
+
+        const std::size_t chunksize = MACSIZE + blocksize_;
+        const std::size_t nblocks = (csize + chunksize - 1) / chunksize;
+        if (nblocks != 0 && csize - (nblocks - 1) * chunksize < MACSIZE)
+            throw std::runtime_error{ "sodium::filecryptor_aead::decrypt() "
+                                      "final chunk too small for a tag" };
+
+        mapped_output out(outfile, csize - nblocks * MACSIZE);
+
+        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+        const byte* src = in.data();
+        byte* dst = out.data();
+
+        for (std::size_t remaining = csize; remaining != 0;) {
+            const std::size_t s = std::min(remaining, chunksize);
+
+            if (sc_aead_.decrypt(span<byte>(dst, s - MACSIZE),
+                                 header_,
+                                 span<const byte>(src, s),
+                                 running_nonce) != 0)
+                throw std::runtime_error{ "sodium::filecryptor_aead::decrypt() "
+                                          "can't decrypt or message/tag "
+                                          "corrupt" };
+            running_nonce.increment();
+
+            src += s;
+            dst += s - MACSIZE;
+            remaining -= s;
+        }
+    }
+
+    /**
+     * Random access: decrypt only block k (counting from 0) of the
+     * seekable stream istr, generated by encrypt(), and return its
+     * plaintext.
+     *
+     * The nonce of block k is computed in constant time as the initial
+     * nonce + k, and only the (MAC || ciphertext) chunk of block k is
+     * read, along with the size of the stream to locate the trailing
+     * hash. That hash is NOT verified: block k is authenticated by its
+     * own MAC only, which doesn't detect truncation of whole blocks.
+     * Use decrypt() to verify the whole file.
+     *
+     * Throw a std::runtime_error if block k doesn't exist, or if it
+     * can't be decrypted.
+     **/
+
+    BT decrypt_block(std::istream& istr, std::uint64_t k)
+    {
+        const std::size_t chunksize = MACSIZE + blocksize_;
+
+        istr.clear();
+        istr.seekg(0, std::ios::end);
+        const std::streamoff size = istr.tellg();
+        if (!istr || size < static_cast<std::streamoff>(hashsize_))
+            throw std::runtime_error{ "sodium::filecryptor_aead::decrypt_"
+                                      "block() file too small for hash" };
+
+        // the (MAC || ciphertext)s end where the hash starts
+        const std::uint64_t csize =
+          static_cast<std::uint64_t>(size) - hashsize_;
+        if (k >= (csize + chunksize - 1) / chunksize)
+            throw std::runtime_error{
+                "sodium::filecryptor_aead::decrypt_block() no such block"
+            };
+        const std::size_t s = static_cast<std::size_t>(
+          std::min<std::uint64_t>(chunksize, csize - k * chunksize));
+        if (s < MACSIZE)
+            throw std::runtime_error{ "sodium::filecryptor_aead::decrypt_"
+                                      "block() final chunk too small for a "
+                                      "tag" };
+
+        BT ciphertext(s, '\0');
+        istr.seekg(static_cast<std::streamoff>(k * chunksize), std::ios::beg);
+        if (!istr.read(reinterpret_cast<char*>(ciphertext.data()), s))
+            throw std::runtime_error{ "sodium::filecryptor_aead::decrypt_"
+                                      "block() can't read block" };
+
+        return sc_aead_.decrypt(header_, ciphertext, nonce_ + k);
+    }
+
+    /**
+     * Tree mode: encrypt the file INFILE into the file OUTFILE on the
+     * worker threads of pool.
+     *
+     * The blocks are encrypted like in encrypt(infile, outfile), but
+     * the integrity hash is a sodium::tree_hash with one leaf per
+     * (MAC || ciphertext) chunk instead of one crypto_generichash_state
+     * over the whole ciphertext. The leaf hashes are stored too, so
+     * the output is
+     *
+     *   C_0 || ... || C_{n-1} || L_0 || ... || L_{n-1} || root
+     *
+     * with C_i the chunk of block i, L_i its TREE_LEAF_HASHSIZE bytes
+     * keyed BLAKE2b leaf hash, and root the hashsize bytes root hash,
+     * i.e. the tree_hash of C_0 || ... || C_{n-1} with leafsize
+     * MACSIZE + blocksize. Encrypting and hashing a chunk only depends
+     * on its index, so all of them run concurrently, one contiguous
+     * range of chunks per worker.
+     *
+     * This is NOT the format of encrypt(): use decrypt_tree() and
+     * verify_tree() on it.
+     *
+     * Throw a std::runtime_error if a file can't be mapped, or if the
+     * encryption fails. No strong guarantee w.r.t. OUTFILE.
+     **/
+
+    static constexpr std::size_t TREE_LEAF_HASHSIZE =
+      tree_hash::LEAF_HASHSIZE;
+
+    void encrypt_tree(const std::string& infile,
+                      const std::string& outfile,
+                      thread_pool& pool)
+    {
+        const std::size_t insize = file_size(infile);
+        const std::size_t nblocks = (insize + blocksize_ - 1) / blocksize_;
+        const std::size_t csize = insize + nblocks * MACSIZE;
+        const std::size_t outsize =
+          csize + nblocks * TREE_LEAF_HASHSIZE + hashsize_;
+
+        mapped_input in(infile, insize);
+        mapped_output out(outfile, outsize);
+        const tree_hash tree(hashkey_, hashsize_, MACSIZE + blocksize_, pool);
+
+        const byte* src = in.data();
+        byte* dst = out.data();
+        byte* leaves = dst + csize;
+
+        for_each_range(pool, nblocks, [&](std::size_t i) {
+            const std::size_t offset = i * blocksize_;
+            const std::size_t s = std::min(blocksize_, insize - offset);
+            span<byte> chunk(dst + offset + i * MACSIZE, MACSIZE + s);
+
+            if (sc_aead_.encrypt(chunk,
+                                 header_,
+                                 span<const byte>(src + offset, s),
+                                 nonce_ + i) != 0)
+                throw std::runtime_error{ "sodium::filecryptor_aead::encrypt_"
+                                          "tree() can't encrypt chunk" };
+
+            tree.hash_leaf(i,
+                           chunk.data(),
+                           chunk.size(),
+                           leaves + i * TREE_LEAF_HASHSIZE);
+        });
+
+        tree.hash_root(
+          leaves, nblocks, csize, leaves + nblocks * TREE_LEAF_HASHSIZE);
+    }
+
+    /**
+     * Tree mode: decrypt the file INFILE, generated by encrypt_tree(),
+     * into the file OUTFILE on the worker threads of pool.
+     *
+     * Only the stored leaf hashes are checked against the root hash up
+     * front, which is cheap: there is no first pass over the whole
+     * ciphertext like in decrypt(infile, outfile). Each chunk is then
+     * verified against its leaf hash and decrypted right away, while
+     * it is in the cache, concurrently with the other chunks.
+     *
+     * Throw a std::runtime_error if a file can't be mapped, if INFILE
+     * is malformed, if the leaf hashes don't match the root hash, or
+     * if a chunk doesn't match its leaf hash or can't be decrypted.
+     * The message names the first such chunk; use verify_tree() to
+     * find all of them. No strong guarantee w.r.t. OUTFILE.
+     **/
+
+    void decrypt_tree(const std::string& infile,
+                      const std::string& outfile,
+                      thread_pool& pool)
+    {
+        const std::size_t insize = file_size(infile);
+        mapped_input in(infile, insize);
+        const tree_layout layout = check_tree(in.data(), insize, pool);
+
+        mapped_output out(outfile, layout.csize - layout.nblocks * MACSIZE);
+        const tree_hash tree(hashkey_, hashsize_, MACSIZE + blocksize_, pool);
+        const std::size_t chunksize = MACSIZE + blocksize_;
+
+        const byte* src = in.data();
+        byte* dst = out.data();
+
+        for_each_range(pool, layout.nblocks, [&](std::size_t i) {
+            const std::size_t offset = i * chunksize;
+            const std::size_t s = std::min(chunksize, layout.csize - offset);
+
+            if (!leaf_matches(tree, i, src + offset, s, layout.leaves) ||
+                sc_aead_.decrypt(span<byte>(dst + i * blocksize_, s - MACSIZE),
+                                 header_,
+                                 span<const byte>(src + offset, s),
+                                 nonce_ + i) != 0)
+                throw std::runtime_error{
+                    "sodium::filecryptor_aead::decrypt_tree() chunk " +
+                    std::to_string(i) + " corrupt"
+                };
+        });
+    }
+
+    /**
+     * Tree mode: verify the file INFILE, generated by encrypt_tree(),
+     * on the worker threads of pool, without decrypting it. Return the
+     * indices of the chunks that don't match their leaf hash, in
+     * increasing order: an empty vector means INFILE is intact.
+     *
+     * Throw a std::runtime_error if INFILE is malformed, or if the
+     * leaf hashes themselves don't match the root hash (then no chunk
+     * can be pinpointed).
+     **/
+
+    std::vector<std::uint64_t> verify_tree(const std::string& infile,
+                                           thread_pool& pool)
+    {
+        const std::size_t insize = file_size(infile);
+        mapped_input in(infile, insize);
+        const tree_layout layout = check_tree(in.data(), insize, pool);
+        const tree_hash tree(hashkey_, hashsize_, MACSIZE + blocksize_, pool);
+        const std::size_t chunksize = MACSIZE + blocksize_;
+
+        // one byte per chunk: can be written concurrently
+        std::vector<unsigned char> ok(layout.nblocks, 0);
+        for_each_range(pool, layout.nblocks, [&](std::size_t i) {
+            const std::size_t offset = i * chunksize;
+            const std::size_t s = std::min(chunksize, layout.csize - offset);
+            ok[i] = leaf_matches(tree, i, in.data() + offset, s, layout.leaves);
+        });
+
+        std::vector<std::uint64_t> corrupt;
+        for (std::size_t i = 0; i != ok.size(); ++i)
+            if (!ok[i])
+                corrupt.push_back(i);
+        return corrupt;
+    }
+
+    // the blocksize in use
+    std::size_t blocksize() const noexcept { return blocksize_; }
+
   private:
+    template<typename Reader, typename Writer>
+    void encrypt_from(Reader& in, Writer& out)
+    {
+        BT hash(hashsize_, '\0');
+        crypto_generichash_state state;
+        crypto_generichash_init(
+          &state, hashkey_.data(), hashkey_.size(), hashsize_);
+
+        BT plaintext(blocksize_, '\0');
+        BT ciphertext(MACSIZE + blocksize_, '\0');
+        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+
+        span<const byte> block;
+        while (!(block = in.next_block(blocksize_, plaintext)).empty()) {
+            const bool full = block.size() == blocksize_;
+
+            sc_aead_.encrypt(span<byte>(ciphertext),
+                             span<const byte>(header_),
+                             block,
+                             running_nonce);
+            running_nonce.increment();
+
+            span<const byte> chunk =
+              span<const byte>(ciphertext).first(MACSIZE + block.size());
+            if (!out.write(chunk))
+                throw std::runtime_error{
+                    full ? "sodium::filecryptor_aead::encrypt() error "
+                           "writing full chunk to file"
+                         : "sodium::filecryptor_aead::encrypt() error "
+                           "writing final chunk to file"
+                };
+            crypto_generichash_update(&state, chunk.data(), chunk.size());
+            if (!full)
+                break;
+        }
+
+        crypto_generichash_final(&state, hash.data(), hash.size());
+        if (!out.write(hash))
+            throw std::runtime_error{ "sodium::filecryptor_aead::encrypt() "
+                                      "error writing hash to file" };
+    }
+
+  private:
+    static std::size_t file_size(const std::string& path)
+    {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        if (ec)
+            throw std::runtime_error{ "sodium::filecryptor_aead: can't stat " +
+                                      path + ": " + ec.message() };
+        return static_cast<std::size_t>(size);
+    }
+
+    // where things are in a file generated by encrypt_tree()
+    struct tree_layout
+    {
+        std::size_t nblocks;
+        std::size_t csize;   // the size of C_0 || ... || C_{n-1}
+        const byte* leaves;  // L_0
+    };
+
+    // locate the parts of a tree mode file, and check its leaf hashes
+    tree_layout check_tree(const byte* data,
+                           std::size_t size,
+                           thread_pool& pool) const
+    {
+        if (size < hashsize_)
+            throw std::runtime_error{ "sodium::filecryptor_aead: tree file "
+                                      "too small for hash" };
+
+        // each block takes a chunk of at most MACSIZE + blocksize_
+        // bytes, plus a leaf hash: n chunks fill a range of sizes of
+        // their own, so n is unique
+        const std::size_t stride = MACSIZE + blocksize_ + TREE_LEAF_HASHSIZE;
+        const std::size_t body = size - hashsize_;
+        tree_layout layout;
+        layout.nblocks = (body + stride - 1) / stride;
+        if (body < layout.nblocks * TREE_LEAF_HASHSIZE)
+            throw std::runtime_error{ "sodium::filecryptor_aead: tree file "
+                                      "too small for its leaf hashes" };
+        layout.csize = body - layout.nblocks * TREE_LEAF_HASHSIZE;
+        layout.leaves = data + layout.csize;
+
+        if (layout.nblocks != 0 &&
+            layout.csize <= (layout.nblocks - 1) * (MACSIZE + blocksize_) +
+                              MACSIZE)
+            throw std::runtime_error{ "sodium::filecryptor_aead: tree file "
+                                      "final chunk too small" };
+
+        const tree_hash tree(hashkey_, hashsize_, MACSIZE + blocksize_, pool);
+        BT root(hashsize_, '\0');
+        tree.hash_root(layout.leaves,
+                       layout.nblocks,
+                       layout.csize,
+                       reinterpret_cast<unsigned char*>(root.data()));
+        if (sodium_memcmp(root.data(), data + body, hashsize_) != 0)
+            throw std::runtime_error{ "sodium::filecryptor_aead: tree file "
+                                      "leaf hashes don't match root hash" };
+
+        return layout;
+    }
+
+    // does chunk i of size bytes at data match its stored leaf hash?
+    static bool leaf_matches(const tree_hash& tree,
+                             std::size_t i,
+                             const byte* data,
+                             std::size_t size,
+                             const byte* leaves)
+    {
+        unsigned char leaf_hash[TREE_LEAF_HASHSIZE];
+        tree.hash_leaf(i, data, size, leaf_hash);
+        return sodium_memcmp(leaf_hash,
+                             leaves + i * TREE_LEAF_HASHSIZE,
+                             TREE_LEAF_HASHSIZE) == 0;
+    }
+
+    // run f(i) for all i in [0, n), one contiguous range per worker
+    template<typename Func>
+    static void for_each_range(thread_pool& pool, std::size_t n, Func f)
+    {
+        const std::size_t nranges = std::min(pool.size(), n);
+        std::vector<std::future<void>> results;
+        results.reserve(nranges);
+        for (std::size_t r = 0; r != nranges; ++r) {
+            const std::size_t first = n * r / nranges;
+            const std::size_t last = n * (r + 1) / nranges;
+            results.push_back(pool.submit([&f, first, last] {
+                for (std::size_t i = first; i != last; ++i)
+                    f(i);
+            }));
+        }
+
+        // all workers must be done with the mappings before we rethrow
+        for (auto& result : results)
+            pool.wait(result);
+        for (auto& result : results)
+            result.get();
+    }
+
+    // A read-only mapping of a whole file. Empty files aren't mapped.
+    class mapped_input
+    {
+      public:
+        mapped_input(const std::string& path, std::size_t size)
+        {
+            if (size != 0)
+                file_.open(path, size);
+            if (size != 0 && !file_.is_open())
+                throw std::runtime_error{ "sodium::filecryptor_aead: can't "
+                                          "map " +
+                                          path };
+        }
+
+        const byte* data() const
+        {
+            return reinterpret_cast<const byte*>(file_.data());
+        }
+
+      private:
+        boost::iostreams::mapped_file_source file_;
+    };
+
+    // A read-write mapping of a new file of the given size.
+    class mapped_output
+    {
+      public:
+        mapped_output(const std::string& path, std::size_t size)
+        {
+            if (size == 0) {
+                // can't map 0 bytes: just create/truncate the file
+                std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+                if (!ofs)
+                    throw std::runtime_error{ "sodium::filecryptor_aead: "
+                                              "can't create " +
+                                              path };
+                return;
+            }
+
+            boost::iostreams::mapped_file_params params(path);
+            params.new_file_size = static_cast<boost::intmax_t>(size);
+            params.flags = boost::iostreams::mapped_file::readwrite;
+            file_.open(params);
+            if (!file_.is_open())
+                throw std::runtime_error{ "sodium::filecryptor_aead: can't "
+                                          "map " +
+                                          path };
+        }
+
+        byte* data() { return reinterpret_cast<byte*>(file_.data()); }
+
+      private:
+        boost::iostreams::mapped_file_sink file_;
+    };
+
     aead<BT> sc_aead_;
     keyvar<> hashkey_;
     typename aead<BT>::nonce_type nonce_;
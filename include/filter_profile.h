@@ -0,0 +1,475 @@
+// filter_profile.h -- Per-stage profiling of Boost.Iostreams chains
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// The filters of this library only record profiling spans if
+// SODIUM_PROFILE is defined to a non-zero value, e.g. with
+// -DSODIUM_PROFILE on the command line. Otherwise, SODIUM_PROFILE_SPAN()
+// compiles to nothing. The profiled_filter<> wrapper below works
+// either way.
+
+#pragma once
+
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/close.hpp>
+#include <boost/iostreams/flush.hpp>
+#include <boost/iostreams/operations.hpp>
+#include <boost/iostreams/traits.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef SODIUM_PROFILE
+#define SODIUM_PROFILE 0
+#endif // ! SODIUM_PROFILE
+
+/**
+ * When a chain like blake2b_tee_filter -> aead_encrypt_filter ->
+ * xchacha20_filter -> file sink is slow, a sodium::filter_profile
+ * shows which stage is responsible. It records, per stage, the
+ * number of calls, the bytes in and out, and the time spent in the
+ * stage itself, i.e. without the time spent in the stages after it
+ * (output chains) or before it (input chains).
+ *
+ * Stages are recorded in two ways:
+ *
+ *   - by wrapping a filter into a sodium::profiled_filter<> before
+ *     pushing it (see profiled()), which works for any filter:
+ *
+ *       sodium::filter_profile profile;
+ *       io::filtering_ostream os;
+ *       os.push(sodium::profiled(blake2b_tee_filter<...>(...), profile,
+ *                                "blake2b"));
+ *       os.push(sodium::profiled(aead_encrypt_filter<>(...), profile,
+ *                                "aead"));
+ *       os.push(sink);
+ *       ... write to os ...
+ *       os.reset(); // closes the chain
+ *       profile.report(std::clog);
+ *
+ *   - by the spans built into the filters of this library (only with
+ *     SODIUM_PROFILE), which time their crypto work alone, e.g.
+ *     "xchacha20_filter". They land in the profile that a
+ *     profiled_filter<> (or a filter_profile::scope) has activated on
+ *     the calling thread, if any.
+ *
+ * Time is measured in TSC ticks on x86 (rdtsc: no system call, no
+ * serialization, a few dozen cycles per span) and with
+ * std::chrono::steady_clock elsewhere. Ticks are converted to seconds
+ * by comparing both clocks over the lifetime of the profile.
+ *
+ * A filter_profile is not thread-safe: use one per chain, and drive
+ * each chain from one thread at a time.
+ **/
+
+namespace sodium {
+
+namespace profile_detail {
+
+inline std::uint64_t
+ticks() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+        .count());
+#endif
+}
+
+} // namespace profile_detail
+
+struct stage_stats
+{
+    std::string name;
+    std::uint64_t calls = 0;     // read(), write(), flush(), close()
+    std::uint64_t bytes_in = 0;  // taken from the previous stage
+    std::uint64_t bytes_out = 0; // handed to the next stage
+    std::uint64_t ticks = 0;     // spent in the stage itself
+};
+
+class filter_profile
+{
+  public:
+    filter_profile()
+      : start_ticks_{ profile_detail::ticks() }
+      , start_time_{ std::chrono::steady_clock::now() }
+    {}
+
+    filter_profile(const filter_profile&) = delete;
+    filter_profile& operator=(const filter_profile&) = delete;
+
+    /**
+     * The stage called name, created on first use. References stay
+     * valid for the lifetime of the profile. Stages are matched by the
+     * address of name first, so that string literals are cheap.
+     **/
+    stage_stats& stage(const char* name)
+    {
+        for (auto& entry : stages_)
+            if (entry.first == name)
+                return entry.second;
+        for (auto& entry : stages_)
+            if (entry.second.name == name)
+                return entry.second;
+        stages_.emplace_back(name, stage_stats{});
+        stages_.back().second.name = name;
+        return stages_.back().second;
+    }
+
+    // all the stages, in order of creation
+    std::vector<stage_stats> stages() const
+    {
+        std::vector<stage_stats> result;
+        for (const auto& entry : stages_)
+            result.push_back(entry.second);
+        return result;
+    }
+
+    // the time of ticks, in seconds
+    double seconds(std::uint64_t ticks) const noexcept
+    {
+        const std::uint64_t elapsed_ticks =
+          profile_detail::ticks() - start_ticks_;
+        const double elapsed_seconds =
+          std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                        start_time_)
+            .count();
+        return elapsed_ticks == 0
+                 ? 0.0
+                 : ticks * (elapsed_seconds / elapsed_ticks);
+    }
+
+    /**
+     * One line per stage. The built-in spans of a filter are nested in
+     * the stage of its profiled_filter<>, if any: their times are a
+     * part of it, not to be added to it.
+     **/
+    void report(std::ostream& os) const
+    {
+        for (const auto& entry : stages_) {
+            const stage_stats& s = entry.second;
+            const double secs = seconds(s.ticks);
+            os << std::left << std::setw(24) << s.name << std::right
+               << " calls=" << s.calls << " in=" << s.bytes_in
+               << " out=" << s.bytes_out << " time=" << std::fixed
+               << std::setprecision(6) << secs << "s";
+            if (secs > 0)
+                os << " rate=" << std::setprecision(1)
+                   << s.bytes_in / secs / 1e6 << "MB/s";
+            os << '\n';
+        }
+        os.unsetf(std::ios::floatfield);
+    }
+
+    /**
+     * Make *this the profile of the built-in spans of the calling
+     * thread, for the lifetime of the scope (scopes nest).
+     **/
+    class scope
+    {
+      public:
+        explicit scope(filter_profile& profile) noexcept
+          : previous_{ active_slot() }
+        {
+            active_slot() = &profile;
+        }
+        ~scope() { active_slot() = previous_; }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+      private:
+        filter_profile* previous_;
+    };
+
+    // the profile activated on the calling thread, or nullptr
+    static filter_profile* active() noexcept { return active_slot(); }
+
+  private:
+    static filter_profile*& active_slot() noexcept
+    {
+        thread_local filter_profile* profile = nullptr;
+        return profile;
+    }
+
+    std::deque<std::pair<const char*, stage_stats>> stages_;
+    std::uint64_t start_ticks_;
+    std::chrono::steady_clock::time_point start_time_;
+};
+
+/**
+ * A span of a built-in hook: times its own lifetime into the stage
+ * name of the active profile, if there is one, and counts bytes as
+ * its input and output. The bytes are either given upfront, or are
+ * those consumed by advancing cursor (e.g. the i1 of a symmetric
+ * filter) during the span. See SODIUM_PROFILE_SPAN().
+ **/
+class profile_span
+{
+  public:
+    profile_span(const char* name, std::size_t bytes)
+      : stage_{ start(name) }
+    {
+        if (stage_ != nullptr) {
+            stage_->bytes_in += bytes;
+            stage_->bytes_out += bytes;
+        }
+    }
+
+    profile_span(const char* name, const char*& cursor)
+      : stage_{ start(name) }
+      , cursor_{ &cursor }
+      , first_{ cursor }
+    {}
+
+    ~profile_span()
+    {
+        if (stage_ == nullptr)
+            return;
+        stage_->ticks += profile_detail::ticks() - start_;
+        if (cursor_ != nullptr) {
+            const auto consumed = static_cast<std::uint64_t>(*cursor_ - first_);
+            stage_->bytes_in += consumed;
+            stage_->bytes_out += consumed;
+        }
+    }
+
+    profile_span(const profile_span&) = delete;
+    profile_span& operator=(const profile_span&) = delete;
+
+  private:
+    stage_stats* start(const char* name)
+    {
+        filter_profile* profile = filter_profile::active();
+        if (profile == nullptr)
+            return nullptr;
+        stage_stats* stage = &profile->stage(name);
+        ++stage->calls;
+        start_ = profile_detail::ticks();
+        return stage;
+    }
+
+    std::uint64_t start_ = 0;
+    stage_stats* stage_;
+    const char* const* cursor_ = nullptr;
+    const char* first_ = nullptr;
+};
+
+#define SODIUM_PROFILE_CONCAT2(a, b) a##b
+#define SODIUM_PROFILE_CONCAT(a, b) SODIUM_PROFILE_CONCAT2(a, b)
+
+// SODIUM_PROFILE_SPAN(name, bytes_or_cursor): time the rest of the
+// enclosing scope into the stage name, see profile_span
+#if SODIUM_PROFILE
+#define SODIUM_PROFILE_SPAN(name, bytes_or_cursor)                             \
+    ::sodium::profile_span SODIUM_PROFILE_CONCAT(sodium_profile_span_,        \
+                                                 __LINE__)(name,               \
+                                                           bytes_or_cursor)
+#else
+#define SODIUM_PROFILE_SPAN(name, bytes_or_cursor) ((void)0)
+#endif // SODIUM_PROFILE
+
+namespace profile_detail {
+
+// the device between a profiled_filter and the next stage: counts
+// the bytes, and the ticks spent in the next stage
+template<typename Device>
+class timed_device
+{
+  public:
+    typedef typename boost::iostreams::char_type_of<Device>::type char_type;
+    struct category
+      : boost::iostreams::bidirectional_device_tag
+      , boost::iostreams::flushable_tag
+    {};
+
+    timed_device(Device& dev,
+                 std::uint64_t& bytes,
+                 std::uint64_t& ticks) noexcept
+      : dev_(dev)
+      , bytes_(bytes)
+      , ticks_(ticks)
+    {}
+
+    std::streamsize read(char_type* s, std::streamsize n)
+    {
+        const std::uint64_t start = ticks();
+        const std::streamsize result = boost::iostreams::read(dev_, s, n);
+        ticks_ += profile_detail::ticks() - start;
+        if (result > 0)
+            bytes_ += static_cast<std::uint64_t>(result);
+        return result;
+    }
+
+    std::streamsize write(const char_type* s, std::streamsize n)
+    {
+        const std::uint64_t start = ticks();
+        const std::streamsize result = boost::iostreams::write(dev_, s, n);
+        ticks_ += profile_detail::ticks() - start;
+        if (result > 0)
+            bytes_ += static_cast<std::uint64_t>(result);
+        return result;
+    }
+
+    bool flush()
+    {
+        const std::uint64_t start = ticks();
+        const bool result = boost::iostreams::flush(dev_);
+        ticks_ += profile_detail::ticks() - start;
+        return result;
+    }
+
+  private:
+    Device& dev_;
+    std::uint64_t& bytes_;
+    std::uint64_t& ticks_;
+};
+
+} // namespace profile_detail
+
+/**
+ * A filter that behaves exactly like Filter, and records its calls,
+ * bytes and time as a stage of a filter_profile. While Filter runs,
+ * the profile is active on the thread, so that the built-in spans of
+ * Filter land in it too.
+ *
+ * The profile must outlive the chain the filter is pushed onto.
+ **/
+template<typename Filter>
+class profiled_filter
+{
+  public:
+    typedef typename boost::iostreams::char_type_of<Filter>::type char_type;
+    struct category
+      : boost::iostreams::mode_of<Filter>::type
+      , boost::iostreams::filter_tag
+      , boost::iostreams::multichar_tag
+      , boost::iostreams::closable_tag
+      , boost::iostreams::flushable_tag
+    {};
+
+    profiled_filter(const Filter& filter,
+                    filter_profile& profile,
+                    const char* name)
+      : filter_(filter)
+      , profile_(&profile)
+      , stage_(&profile.stage(name))
+    {}
+
+    // input chains: the previous stage is src
+    template<typename Source>
+    std::streamsize read(Source& src, char_type* s, std::streamsize n)
+    {
+        return timed<std::streamsize>(src, stage_->bytes_in, [&](auto& dev) {
+            const std::streamsize result =
+              boost::iostreams::read(filter_, dev, s, n);
+            if (result > 0)
+                stage_->bytes_out += static_cast<std::uint64_t>(result);
+            return result;
+        });
+    }
+
+    // output chains: the next stage is snk
+    template<typename Sink>
+    std::streamsize write(Sink& snk, const char_type* s, std::streamsize n)
+    {
+        return timed<std::streamsize>(snk, stage_->bytes_out, [&](auto& dev) {
+            const std::streamsize result =
+              boost::iostreams::write(filter_, dev, s, n);
+            if (result > 0)
+                stage_->bytes_in += static_cast<std::uint64_t>(result);
+            return result;
+        });
+    }
+
+    template<typename Device>
+    bool flush(Device& dev)
+    {
+        return timed<bool>(dev, stage_->bytes_out, [&](auto& timed_dev) {
+            return boost::iostreams::flush(filter_, timed_dev);
+        });
+    }
+
+    template<typename Device>
+    void close(Device& dev, BOOST_IOS::openmode which)
+    {
+        // an output filter typically writes its last bytes here
+        std::uint64_t& bytes =
+          (which & BOOST_IOS::in) ? stage_->bytes_in : stage_->bytes_out;
+        timed<int>(dev, bytes, [&](auto& timed_dev) {
+            boost::iostreams::close(filter_, timed_dev, which);
+            return 0;
+        });
+    }
+
+  private:
+    // run f on a timed_device over dev, and add the ticks spent in f,
+    // but not in dev, to the stage
+    template<typename R, typename Device, typename F>
+    R timed(Device& dev, std::uint64_t& bytes, F f)
+    {
+        std::uint64_t next_ticks = 0;
+        profile_detail::timed_device<Device> timed_dev(dev, bytes, next_ticks);
+        filter_profile::scope scope(*profile_);
+
+        ++stage_->calls;
+        const std::uint64_t start = profile_detail::ticks();
+        struct account
+        {
+            stage_stats* stage;
+            std::uint64_t start;
+            std::uint64_t& next_ticks;
+            ~account()
+            {
+                const std::uint64_t elapsed = profile_detail::ticks() - start;
+                stage->ticks += elapsed > next_ticks ? elapsed - next_ticks : 0;
+            }
+        } guard{ stage_, start, next_ticks };
+
+        return f(timed_dev);
+    }
+
+    Filter filter_;
+    filter_profile* profile_;
+    stage_stats* stage_;
+};
+
+// profiled(filter, profile, name): a profiled_filter<> around filter
+template<typename Filter>
+profiled_filter<Filter>
+profiled(const Filter& filter, filter_profile& profile, const char* name)
+{
+    return profiled_filter<Filter>(filter, profile, name);
+}
+
+} // namespace sodium
@@ -0,0 +1,94 @@
+// fixed_bytes.h -- Fixed-size byte arrays with constant-time comparison
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <cstddef>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<std::size_t N>
+class fixed_bytes
+{
+    /**
+     * A sodium::fixed_bytes<N> holds exactly N bytes in place, in a
+     * std::array<byte, N>. It is returned by the allocation-free
+     * variants of functions whose output size is known at compile
+     * time (MACs, short hashes, detached signatures), so that those
+     * results live on the stack instead of in a heap-allocated BT.
+     *
+     * Like sodium::bytes, it has data() and size(), and can thus be
+     * viewed as a sodium::span<const byte>.
+     *
+     * Unlike std::array's, operator== and operator!= compare in
+     * constant time, using sodium_memcmp(): MACs and signatures must
+     * not leak the position of the first differing byte.
+     **/
+
+  public:
+    using value_type = byte;
+    using iterator = typename std::array<byte, N>::iterator;
+    using const_iterator = typename std::array<byte, N>::const_iterator;
+
+    // N zero bytes
+    constexpr fixed_bytes() noexcept
+      : data_{}
+    {}
+
+    byte* data() noexcept { return data_.data(); }
+    const byte* data() const noexcept { return data_.data(); }
+    static constexpr std::size_t size() noexcept { return N; }
+
+    byte& operator[](std::size_t idx) noexcept { return data_[idx]; }
+    const byte& operator[](std::size_t idx) const noexcept
+    {
+        return data_[idx];
+    }
+
+    iterator begin() noexcept { return data_.begin(); }
+    iterator end() noexcept { return data_.end(); }
+    const_iterator begin() const noexcept { return data_.cbegin(); }
+    const_iterator end() const noexcept { return data_.cend(); }
+
+    // a copy of the bytes in a BT, for the BT-based APIs
+    template<typename BT = bytes>
+    BT to() const
+    {
+        return BT(data_.cbegin(), data_.cend());
+    }
+
+    friend bool operator==(const fixed_bytes& a, const fixed_bytes& b) noexcept
+    {
+        return sodium_memcmp(a.data(), b.data(), N) == 0;
+    }
+
+    friend bool operator!=(const fixed_bytes& a, const fixed_bytes& b) noexcept
+    {
+        return !(a == b);
+    }
+
+  private:
+    std::array<byte, N> data_;
+};
+
+} // namespace sodium
@@ -19,13 +19,143 @@
 #pragma once
 
 #include "common.h"
+#include "extern_templates.h"
 #include "key.h" // keysize constants
 #include "keyvar.h"
+#include "small_bytes.h"
+#include "span.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
 
 #include <sodium.h>
 
 namespace sodium {
 
+class hasher_generic_state
+{
+    /**
+     * A hasher_generic_state computes a (keyed) BLAKE2b hash
+     * incrementally, with the crypto_generichash_*() streaming API:
+     *
+     *   hasher_generic_state state(key, hashsize);
+     *   state.update(chunk1);
+     *   state.update(chunk2);
+     *   state.final(out); // and reset() for the next message
+     *
+     * The keyed initial state is computed once by the constructor
+     * and kept aside, so that reset() only copies it back
+     * (sizeof(crypto_generichash_state) bytes), instead of deriving
+     * the parameter block and absorbing the key again. This matters
+     * when MACing many small messages with the same key.
+     *
+     * The states hold key material: they are wiped by the destructor.
+     * A hasher_generic_state is not thread-safe: use one per thread
+     * (see hasher_generic::local_state()).
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE_MIN = sodium::KEYSIZE_HASHKEY_MIN;
+    static constexpr std::size_t KEYSIZE_MAX = sodium::KEYSIZE_HASHKEY_MAX;
+    static constexpr std::size_t HASHSIZE = crypto_generichash_BYTES;
+    static constexpr std::size_t HASHSIZE_MIN = crypto_generichash_BYTES_MIN;
+    static constexpr std::size_t HASHSIZE_MAX = crypto_generichash_BYTES_MAX;
+
+    /**
+     * Create an incremental hasher with the key [key, key+keysize),
+     * computing hashes of hashsize bytes. keysize may be 0 for
+     * unkeyed hashing.
+     *
+     * Throw a std::runtime_error if keysize or hashsize are out of
+     * their [_MIN, _MAX] ranges.
+     **/
+
+    hasher_generic_state(const unsigned char* key,
+                         std::size_t keysize,
+                         std::size_t hashsize = HASHSIZE)
+      : hashsize_{ hashsize }
+    {
+        if (keysize != 0 && (keysize < KEYSIZE_MIN || keysize > KEYSIZE_MAX))
+            throw std::runtime_error{ "sodium::hasher_generic_state::hasher_"
+                                      "generic_state() wrong key size" };
+        if (hashsize < HASHSIZE_MIN || hashsize > HASHSIZE_MAX)
+            throw std::runtime_error{ "sodium::hasher_generic_state::hasher_"
+                                      "generic_state() wrong hash size" };
+
+        crypto_generichash_init(
+          &initial_, keysize != 0 ? key : NULL, keysize, hashsize_);
+        state_ = initial_;
+    }
+
+    // A hasher_generic_state with a keyvar<> (that may be keyless)
+    explicit hasher_generic_state(const keyvar<>& key,
+                                  std::size_t hashsize = HASHSIZE)
+      : hasher_generic_state(key.data(), key.size(), hashsize)
+    {}
+
+    hasher_generic_state(const hasher_generic_state&) = default;
+    hasher_generic_state& operator=(const hasher_generic_state&) = default;
+
+    ~hasher_generic_state()
+    {
+        sodium_memzero(&initial_, sizeof initial_);
+        sodium_memzero(&state_, sizeof state_);
+    }
+
+    // the size of the hashes computed by final()
+    std::size_t hashsize() const noexcept { return hashsize_; }
+
+    // Absorb the next size bytes of the message at data
+    void update(const void* data, std::size_t size) noexcept
+    {
+        crypto_generichash_update(
+          &state_, static_cast<const unsigned char*>(data), size);
+    }
+
+    void update(span<const byte> data) noexcept
+    {
+        update(data.data(), data.size());
+    }
+
+    /**
+     * Write the hash of the message absorbed so far into out, which
+     * must be hashsize() bytes long, and reset() this state for the
+     * next message. Throw a std::runtime_error on a wrong out.size().
+     **/
+
+    void final(span<byte> out)
+    {
+        if (out.size() != hashsize_)
+            throw std::runtime_error{
+                "sodium::hasher_generic_state::final() wrong hash size"
+            };
+        crypto_generichash_final(&state_, out.data(), out.size());
+        reset();
+    }
+
+    // Same as final(out), but return the hash in a new BT, e.g. in a
+    // sodium::small_bytes<> to avoid allocating (see small_bytes.h)
+    template<class BT = bytes>
+    BT final()
+    {
+        BT out(hashsize_);
+        final(span<byte>(out));
+        return out; // by move semantics
+    }
+
+    // Forget the message absorbed so far, keeping the key
+    void reset() noexcept { state_ = initial_; }
+
+  private:
+    crypto_generichash_state initial_; // keyed, nothing absorbed yet
+    crypto_generichash_state state_;
+    std::size_t hashsize_;
+};
+
 template<class BT = bytes>
 class hasher_generic
 {
@@ -44,6 +174,7 @@ class hasher_generic
     // A hasher_generic with a new random key of default length
     hasher_generic()
       : key_(key_type(KEYSIZE))
+      , id_{ next_id() }
     {}
 
     /**
@@ -63,6 +194,7 @@ class hasher_generic
     // A hasher_generic with a user-supplied key (copying version)
     hasher_generic(const key_type& key)
       : key_(key)
+      , id_{ next_id() }
     {
         // some sanity checks before we start
 
@@ -79,6 +211,7 @@ class hasher_generic
     // A hasher_generic with a user-supplied key (moving version)
     hasher_generic(key_type&& key)
       : key_(std::move(key))
+      , id_{ next_id() }
     {
         // some sanity checks before we start
 
@@ -95,6 +228,7 @@ class hasher_generic
     // A copying constructor
     hasher_generic(const hasher_generic& other)
       : key_(other.key_)
+      , id_{ other.id_ } // same key: may share the local_state()s
     {
         // other key has already been sanity-checked for length
     }
@@ -102,6 +236,7 @@ class hasher_generic
     // A moving constructor
     hasher_generic(hasher_generic&& other)
       : key_(std::move(other.key_))
+      , id_{ other.id_ }
     {
         // other key has already been sanity-checked for length
     }
@@ -124,7 +259,7 @@ class hasher_generic
      * The computed and returned hash will be hashsize bytes long.
      **/
 
-    BT hash(const BT& plaintext, const std::size_t hashsize = HASHSIZE);
+    BT hash(const BT& plaintext, const std::size_t hashsize = HASHSIZE) const;
 
     /**
      * Hash a plaintext, using the provided key, into a hash of the
@@ -144,15 +279,91 @@ class hasher_generic
      * the key will very likely result in a different hash.
      **/
 
-    void hash(const BT& plaintext, BT& outHash);
+    void hash(const BT& plaintext, BT& outHash) const;
+
+    /**
+     * Hash the bytes of plaintext into a new HT of hashsize bytes,
+     * e.g. a sodium::small_bytes<>, which keeps hashes of up to 64
+     * bytes without a heap allocation (see small_bytes.h):
+     *
+     *   auto h = hasher.hash<sodium::small_bytes<>>(message);
+     *
+     * Otherwise, see hash(plaintext, hashsize).
+     **/
+
+    template<class HT>
+    HT hash(span<const byte> plaintext,
+            const std::size_t hashsize = HASHSIZE) const;
+
+    /**
+     * Return a new incremental hasher with the key of this hasher,
+     * for hashes of hashsize bytes. Hashing a message with it gives
+     * the same result as hash(message, hashsize).
+     **/
+
+    hasher_generic_state state(const std::size_t hashsize = HASHSIZE) const
+    {
+        return hasher_generic_state(key_, hashsize);
+    }
+
+    /**
+     * Return the incremental hasher for hashes of hashsize bytes with
+     * the key of this hasher, that belongs to the calling thread,
+     * after reset()ting it. It is created on first use, and reused by
+     * all later calls on the same thread, so that servers hashing many
+     * small messages neither allocate nor re-key per message:
+     *
+     *   auto& state = hasher.local_state();
+     *   state.update(message);
+     *   state.final(mac);
+     *
+     * The reference is valid until the thread exits, or until the
+     * thread has used local_state() of more than LOCAL_STATES other
+     * hashers, whichever comes first. Each thread keeps the states of
+     * up to LOCAL_STATES hashers (and their key material) until then.
+     **/
+
+    static constexpr std::size_t LOCAL_STATES = 16;
+
+    hasher_generic_state& local_state(
+      const std::size_t hashsize = HASHSIZE) const
+    {
+        using states_type =
+          std::unordered_map<std::uint64_t,
+                             std::unique_ptr<hasher_generic_state>>;
+        thread_local states_type states;
+
+        if (hashsize < HASHSIZE_MIN || hashsize > HASHSIZE_MAX)
+            throw std::runtime_error{
+                "sodium::hasher_generic::local_state() wrong hash size"
+            };
+
+        const std::uint64_t slot = (id_ << 7) | hashsize; // hashsize <= 64
+        auto it = states.find(slot);
+        if (it == states.end()) {
+            if (states.size() == LOCAL_STATES)
+                states.clear(); // wipes them all
+            auto state = std::make_unique<hasher_generic_state>(key_, hashsize);
+            it = states.emplace(slot, std::move(state)).first;
+        }
+        it->second->reset();
+        return *it->second;
+    }
 
   private:
+    static std::uint64_t next_id()
+    {
+        static std::atomic<std::uint64_t> counter{ 0 };
+        return ++counter;
+    }
+
     key_type key_;
+    std::uint64_t id_; // identifies key_ in local_state()
 };
 
 template<class BT>
 BT
-hasher_generic<BT>::hash(const BT& plaintext, const std::size_t hashsize)
+hasher_generic<BT>::hash(const BT& plaintext, const std::size_t hashsize) const
 {
     // some sanity checks before we start
     if (hashsize < hasher_generic<BT>::HASHSIZE_MIN)
@@ -179,9 +390,34 @@ hasher_generic<BT>::hash(const BT& plaintext, const std::size_t hashsize)
     return outHash; // using move semantics
 }
 
+template<class BT>
+template<class HT>
+HT
+hasher_generic<BT>::hash(span<const byte> plaintext,
+                         const std::size_t hashsize) const
+{
+    if (hashsize < hasher_generic<BT>::HASHSIZE_MIN)
+        throw std::runtime_error{
+            "sodium::hasher_generic::hash() hash size too small"
+        };
+    if (hashsize > hasher_generic<BT>::HASHSIZE_MAX)
+        throw std::runtime_error{
+            "sodium::hasher_generic::hash() hash size too big"
+        };
+
+    HT outHash(hashsize);
+    crypto_generichash(reinterpret_cast<unsigned char*>(outHash.data()),
+                       outHash.size(),
+                       plaintext.data(),
+                       plaintext.size(),
+                       key_.data(),
+                       key_.size());
+    return outHash;
+}
+
 template<class BT>
 void
-hasher_generic<BT>::hash(const BT& plaintext, BT& outHash)
+hasher_generic<BT>::hash(const BT& plaintext, BT& outHash) const
 {
     // some sanity checks before we start
     if (outHash.size() < hasher_generic<BT>::HASHSIZE_MIN)
@@ -204,4 +440,7 @@ hasher_generic<BT>::hash(const BT& plaintext, BT& outHash)
     // hash is returned implicitely in outHash by reference.
 }
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(hasher_generic);
+
 } // namespace sodium
@@ -19,6 +19,9 @@
 #pragma once
 
 #include "common.h"
+#include "extern_templates.h"
+#include "small_bytes.h"
+#include "span.h"
 
 #include <sodium.h>
 
@@ -44,7 +47,7 @@ class hasher_generic_keyless
      * Otherwise, see sodium::hasher_generic template for keyed generic hashing.
      **/
 
-    BT hash(const BT& plaintext, const std::size_t hashsize = HASHSIZE);
+    BT hash(const BT& plaintext, const std::size_t hashsize = HASHSIZE) const;
 
     /**
      * Hash a plaintext into a hash of the size outHash.size().
@@ -55,13 +58,24 @@ class hasher_generic_keyless
      * Otherwise, see sodium::hasher_generic template for keyed generic hashing.
      **/
 
-    void hash(const BT& plaintext, BT& outHash);
+    void hash(const BT& plaintext, BT& outHash) const;
+
+    /**
+     * Hash the bytes of plaintext into a new HT of hashsize bytes,
+     * e.g. a sodium::small_bytes<> (see small_bytes.h).
+     *
+     * Otherwise, see hash(plaintext, hashsize).
+     **/
+
+    template<class HT>
+    HT hash(span<const byte> plaintext,
+            const std::size_t hashsize = HASHSIZE) const;
 };
 
 template<class BT>
 BT
 hasher_generic_keyless<BT>::hash(const BT& plaintext,
-                                 const std::size_t hashsize)
+                                 const std::size_t hashsize) const
 {
     // some sanity checks before we start
     if (hashsize < hasher_generic_keyless<BT>::HASHSIZE_MIN)
@@ -88,9 +102,34 @@ hasher_generic_keyless<BT>::hash(const BT& plaintext,
     return outHash; // using move semantics
 }
 
+template<class BT>
+template<class HT>
+HT
+hasher_generic_keyless<BT>::hash(span<const byte> plaintext,
+                                 const std::size_t hashsize) const
+{
+    if (hashsize < hasher_generic_keyless<BT>::HASHSIZE_MIN)
+        throw std::runtime_error{
+            "sodium::hasher_generic_keyless::hash() hash size too small"
+        };
+    if (hashsize > hasher_generic_keyless<BT>::HASHSIZE_MAX)
+        throw std::runtime_error{
+            "sodium::hasher_generic_keyless::hash() hash size too big"
+        };
+
+    HT outHash(hashsize);
+    crypto_generichash(reinterpret_cast<unsigned char*>(outHash.data()),
+                       outHash.size(),
+                       plaintext.data(),
+                       plaintext.size(),
+                       NULL,
+                       0); // keyless hashing
+    return outHash;
+}
+
 template<class BT>
 void
-hasher_generic_keyless<BT>::hash(const BT& plaintext, BT& outHash)
+hasher_generic_keyless<BT>::hash(const BT& plaintext, BT& outHash) const
 {
     // some sanity checks before we start
     if (outHash.size() < hasher_generic_keyless<BT>::HASHSIZE_MIN)
@@ -113,4 +152,7 @@ hasher_generic_keyless<BT>::hash(const BT& plaintext, BT& outHash)
     // hash is returned implicitely in outHash by reference.
 }
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(hasher_generic_keyless);
+
 } // namespace sodium
@@ -19,7 +19,16 @@
 #pragma once
 
 #include "common.h"
+#include "extern_templates.h"
+#include "fixed_bytes.h"
 #include "key.h" // keysize constants
+#include "span.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
 
 #include <sodium.h>
 
@@ -35,6 +44,7 @@ class hasher_short
 
     using bytes_type = BT;
     using key_type = key<KEYSIZE>;
+    using hash_type = fixed_bytes<HASHSIZE>;
 
     // A hasher_short with a new random key
     hasher_short()
@@ -84,7 +94,7 @@ class hasher_short
      * The computed and returned hash will be HASHSIZE bytes long.
      **/
 
-    BT hash(const BT& plaintext);
+    BT hash(const BT& plaintext) const;
 
     /**
      * Hash a (typically short) plaintext, using hasher_short's key_,
@@ -106,15 +116,267 @@ class hasher_short
      * the same hash.
      **/
 
-    void hash(const BT& plaintext, BT& outHash);
+    void hash(const BT& plaintext, BT& outHash) const;
+
+    /**
+     * Allocation-free variant of hash(): return the hash of plaintext
+     * in a fixed_bytes<HASHSIZE> on the stack.
+     **/
+
+    hash_type hash_fixed(span<const byte> plaintext) const noexcept
+    {
+        hash_type outHash;
+        crypto_shorthash(
+          outHash.data(), plaintext.data(), plaintext.size(), key_.data());
+        return outHash;
+    }
+
+    /**
+     * Hash the size bytes at data, and return the hash as a 64-bit
+     * integer instead of as a BT.
+     *
+     * This is the same hash as the one computed by hash(), read as a
+     * little-endian number, but without allocating anything. It is
+     * meant for hash tables; see also sodium::short_hash below.
+     **/
+
+    std::uint64_t hash64(const void* data, std::size_t size) const noexcept
+    {
+        unsigned char outHash[HASHSIZE];
+        crypto_shorthash(outHash,
+                         static_cast<const unsigned char*>(data),
+                         size,
+                         key_.data());
+        return load_le64(outHash);
+    }
+
+    /**
+     * Hash the size bytes at data into a 128-bit hash with the key of
+     * this hasher, and return it as two 64-bit integers (low half
+     * first). Underlying libsodium function:
+     * crypto_shorthash_siphashx24(), i.e. SipHash-2-4 with 128 bits of
+     * output. One call gives enough independent bits for several hash
+     * table or Bloom filter probes (see sodium::bloom_filter).
+     **/
+
+    std::array<std::uint64_t, 2> hash128(const void* data,
+                                         std::size_t size) const noexcept
+    {
+        unsigned char outHash[crypto_shorthash_siphashx24_BYTES];
+        crypto_shorthash_siphashx24(outHash,
+                                    static_cast<const unsigned char*>(data),
+                                    size,
+                                    key_.data());
+        return { load_le64(outHash), load_le64(outHash + 8) };
+    }
+
+    /**
+     * Batch version of hash64(): for 0 <= i < n, hash the sizes[i]
+     * bytes at data[i] into out[i].
+     *
+     * The inputs are hashed LANES at a time, with the SipHash-2-4 rounds
+     * of all lanes interleaved, so that the compiler can keep them in
+     * SIMD registers and the CPU can overlap their dependency chains.
+     * This pays off best when the inputs of a batch have about the same
+     * size: lanes are in lockstep for as many 8-byte blocks as the
+     * shortest input of their group has, and finish one by one.
+     *
+     * The results are identical to those of hash64().
+     **/
+
+    void hash64(const void* const* data,
+                const std::size_t* sizes,
+                std::size_t n,
+                std::uint64_t* out) const noexcept
+    {
+        const std::uint64_t k0 = load_le64(key_.data());
+        const std::uint64_t k1 = load_le64(key_.data() + 8);
+
+        const std::size_t full = n - n % LANES;
+        for (std::size_t i = 0; i != full; i += LANES)
+            siphash_lanes(k0, k1, data + i, sizes + i, out + i);
+        for (std::size_t i = full; i != n; ++i)
+            out[i] = hash64(data[i], sizes[i]);
+    }
+
+    // the number of inputs hashed together by the batch hash64()
+    static constexpr std::size_t LANES = 4;
 
   private:
+    // crypto_shorthash() is SipHash-2-4, see
+    //   https://131002.net/siphash/siphash.pdf
+
+    static std::uint64_t load_le64(const unsigned char* p) noexcept
+    {
+        std::uint64_t result = 0;
+        for (std::size_t i = 0; i != 8; ++i)
+            result |= static_cast<std::uint64_t>(p[i]) << (8 * i);
+        return result;
+    }
+
+    static std::uint64_t rotl(std::uint64_t x, int b) noexcept
+    {
+        return (x << b) | (x >> (64 - b));
+    }
+
+    static void sipround(std::uint64_t& v0,
+                         std::uint64_t& v1,
+                         std::uint64_t& v2,
+                         std::uint64_t& v3) noexcept
+    {
+        v0 += v1;
+        v1 = rotl(v1, 13);
+        v1 ^= v0;
+        v0 = rotl(v0, 32);
+        v2 += v3;
+        v3 = rotl(v3, 16);
+        v3 ^= v2;
+        v0 += v3;
+        v3 = rotl(v3, 21);
+        v3 ^= v0;
+        v2 += v1;
+        v1 = rotl(v1, 17);
+        v1 ^= v2;
+        v2 = rotl(v2, 32);
+    }
+
+    // the message word of block b of a size bytes long input
+    static std::uint64_t siphash_word(const unsigned char* in,
+                                      std::size_t size,
+                                      std::size_t b) noexcept
+    {
+        if (8 * b + 8 <= size)
+            return load_le64(in + 8 * b);
+
+        // the final block: the remaining bytes and the size
+        std::uint64_t m = static_cast<std::uint64_t>(size) << 56;
+        for (std::size_t i = 8 * b; i != size; ++i)
+            m |= static_cast<std::uint64_t>(in[i]) << (8 * (i - 8 * b));
+        return m;
+    }
+
+    static void siphash_compress(std::uint64_t& v0,
+                                 std::uint64_t& v1,
+                                 std::uint64_t& v2,
+                                 std::uint64_t& v3,
+                                 std::uint64_t m) noexcept
+    {
+        v3 ^= m;
+        sipround(v0, v1, v2, v3);
+        sipround(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    static void siphash_lanes(std::uint64_t k0,
+                              std::uint64_t k1,
+                              const void* const* data,
+                              const std::size_t* sizes,
+                              std::uint64_t* out) noexcept
+    {
+        const unsigned char* in[LANES];
+        std::size_t nblocks[LANES]; // including the final block
+        std::uint64_t v0[LANES], v1[LANES], v2[LANES], v3[LANES];
+        std::size_t common = SIZE_MAX;
+
+        for (std::size_t l = 0; l != LANES; ++l) {
+            in[l] = static_cast<const unsigned char*>(data[l]);
+            nblocks[l] = sizes[l] / 8 + 1;
+            common = std::min(common, nblocks[l]);
+            v0[l] = k0 ^ 0x736f6d6570736575ULL;
+            v1[l] = k1 ^ 0x646f72616e646f6dULL;
+            v2[l] = k0 ^ 0x6c7967656e657261ULL;
+            v3[l] = k1 ^ 0x7465646279746573ULL;
+        }
+
+        // the blocks that all lanes have, in lockstep
+        for (std::size_t b = 0; b != common; ++b)
+            for (std::size_t l = 0; l != LANES; ++l)
+                siphash_compress(v0[l],
+                                 v1[l],
+                                 v2[l],
+                                 v3[l],
+                                 siphash_word(in[l], sizes[l], b));
+
+        // the longer lanes catch up one by one
+        for (std::size_t l = 0; l != LANES; ++l)
+            for (std::size_t b = common; b != nblocks[l]; ++b)
+                siphash_compress(v0[l],
+                                 v1[l],
+                                 v2[l],
+                                 v3[l],
+                                 siphash_word(in[l], sizes[l], b));
+
+        // and all lanes are finalized in lockstep again
+        for (std::size_t l = 0; l != LANES; ++l) {
+            v2[l] ^= 0xff;
+            for (std::size_t r = 0; r != 4; ++r)
+                sipround(v0[l], v1[l], v2[l], v3[l]);
+            out[l] = v0[l] ^ v1[l] ^ v2[l] ^ v3[l];
+        }
+    }
+
     key_type key_;
 };
 
+/**
+ * sodium::short_hash<T> is a std::hash<T> replacement for unordered
+ * containers, keyed by a sodium::hasher_short: with a secret random
+ * key, an attacker can't craft keys that all land in the same bucket
+ * (hash flooding).
+ *
+ *   sodium::hasher_short<> hasher;
+ *   std::unordered_map<std::string, int, sodium::short_hash<std::string>>
+ *     table(16, sodium::short_hash<std::string>(hasher));
+ *
+ * T can be a contiguous container of trivially copyable elements, with
+ * data() and size() (std::string, std::string_view, std::vector<int>,
+ * sodium::bytes, ...), or a trivially copyable type whose value is
+ * given by its object representation, such as an integer or a pointer.
+ *
+ * short_hash only refers to the hasher_short, which must outlive it
+ * and every container using it.
+ **/
+
+namespace short_hash_detail {
+
+// the bytes that represent value for hashing, see short_hash below
+template<typename T>
+span<const byte>
+bytes_of(const T& value) noexcept
+{
+    if constexpr (std::has_unique_object_representations_v<T>)
+        return span<const byte>(reinterpret_cast<const byte*>(&value),
+                                sizeof value);
+    else
+        return span<const byte>(
+          reinterpret_cast<const byte*>(value.data()),
+          value.size() * sizeof(*value.data()));
+}
+
+} // namespace short_hash_detail
+
+template<typename T, class BT = bytes>
+class short_hash
+{
+  public:
+    explicit short_hash(const hasher_short<BT>& hasher) noexcept
+      : hasher_{ &hasher }
+    {}
+
+    std::size_t operator()(const T& value) const noexcept
+    {
+        const span<const byte> bytes = short_hash_detail::bytes_of(value);
+        return static_cast<std::size_t>(
+          hasher_->hash64(bytes.data(), bytes.size()));
+    }
+
+  private:
+    const hasher_short<BT>* hasher_;
+};
+
 template<class BT>
 BT
-hasher_short<BT>::hash(const BT& plaintext)
+hasher_short<BT>::hash(const BT& plaintext) const
 {
     BT outHash(hasher_short<BT>::HASHSIZE);
     crypto_shorthash(reinterpret_cast<unsigned char*>(outHash.data()),
@@ -126,7 +388,7 @@ hasher_short<BT>::hash(const BT& plaintext)
 
 template<class BT>
 void
-hasher_short<BT>::hash(const BT& plaintext, BT& outHash)
+hasher_short<BT>::hash(const BT& plaintext, BT& outHash) const
 {
     if (outHash.size() != hasher_short<BT>::HASHSIZE)
         throw std::runtime_error{
@@ -140,4 +402,7 @@ hasher_short<BT>::hash(const BT& plaintext, BT& outHash)
     // return outHash implicitely by reference
 }
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(hasher_short);
+
 } // namespace sodium
@@ -19,6 +19,10 @@
 #pragma once
 
 #include "common.h"
+#include "decode_simd.h"
+#include "span.h"
+#include <algorithm>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <sodium.h>
@@ -65,9 +69,130 @@ is_zero(const BT& n)
                           n.size()) == 1;
 }
 
+/**
+ * The number of chars of the hexadecimal representation of size
+ * bytes, as written by the bin2hex() functions below. Unlike
+ * libsodium's sizes, this doesn't count a terminating \0.
+ **/
+
+constexpr std::size_t
+hex_encoded_size(const std::size_t size) noexcept
+{
+    return 2 * size;
+}
+
+/**
+ * The number of chars of the base64 representation of size bytes
+ * in the base64 algorithm VARIANT, as written by the bin2base64()
+ * functions below. Unlike sodium_base64_encoded_len(), this doesn't
+ * count a terminating \0.
+ **/
+
+template<int VARIANT = sodium_base64_VARIANT_ORIGINAL>
+constexpr std::size_t
+base64_encoded_size(const std::size_t size) noexcept
+{
+    static_assert(VARIANT == sodium_base64_VARIANT_ORIGINAL ||
+                    VARIANT == sodium_base64_VARIANT_ORIGINAL_NO_PADDING ||
+                    VARIANT == sodium_base64_VARIANT_URLSAFE ||
+                    VARIANT == sodium_base64_VARIANT_URLSAFE_NO_PADDING,
+                  "sodium::base64_encoded_size() unknown variant");
+
+    return (VARIANT == sodium_base64_VARIANT_ORIGINAL ||
+            VARIANT == sodium_base64_VARIANT_URLSAFE)
+             ? (size + 2) / 3 * 4
+             : size / 3 * 4 + (size % 3 == 0 ? 0 : size % 3 + 1);
+}
+
+/**
+ * The number of bytes decoded from size hexadecimal chars by the
+ * span hex2bin() below.
+ **/
+
+constexpr std::size_t
+hex_decoded_size(const std::size_t size) noexcept
+{
+    return size / 2;
+}
+
+/**
+ * The number of bytes decoded from the base64 chars in "in", in the
+ * base64 algorithm VARIANT, by the span base642bin() below, if "in"
+ * is well-formed. For the padded variants, this depends on the
+ * number of '=' at the end of "in"; else only on its size.
+ **/
+
+template<int VARIANT = sodium_base64_VARIANT_ORIGINAL>
+std::size_t
+base64_decoded_size(span<const char> in) noexcept
+{
+    const std::size_t size = in.size();
+    if (VARIANT == sodium_base64_VARIANT_ORIGINAL ||
+        VARIANT == sodium_base64_VARIANT_URLSAFE) {
+        std::size_t pad = 0;
+        if (size >= 4 && size % 4 == 0 && in[size - 1] == '=')
+            pad = in[size - 2] == '=' ? 2 : 1;
+        return size / 4 * 3 - pad;
+    }
+    return size / 4 * 3 + (size % 4 == 0 ? 0 : size % 4 - 1);
+}
+
+/**
+ * Write the hexadecimal representation of the bytes in "in" into
+ * the first hex_encoded_size(in.size()) chars of out. No \0 is
+ * appended. The conversion runs in constant time, like
+ * sodium_bin2hex().
+ *
+ * Return 0 on success, or -1 if out is too small. Nothing is
+ * allocated.
+ **/
+
+inline int
+bin2hex(span<char> out, span<const byte> in) noexcept
+{
+    if (out.size() < hex_encoded_size(in.size()))
+        return -1;
+
+    // the same branch-free nibble to char mapping as sodium_bin2hex()
+    for (std::size_t i = 0; i != in.size(); ++i) {
+        const unsigned int b = in[i] >> 4;
+        const unsigned int c = in[i] & 0xfU;
+        out[2 * i] = static_cast<char>(87U + b + (((b - 10U) >> 8) & ~38U));
+        out[2 * i + 1] =
+          static_cast<char>(87U + c + (((c - 10U) >> 8) & ~38U));
+    }
+
+    return 0;
+}
+
+/**
+ * Write the hexadecimal representation of the bytes in "in" to the
+ * output iterator d_first, in chunks encoded on the stack. Return
+ * the iterator past the last char written.
+ **/
+
+template<typename OutputIt>
+OutputIt
+bin2hex_copy(span<const byte> in, OutputIt d_first)
+{
+    constexpr std::size_t CHUNKSIZE = 64;
+    char chunk[hex_encoded_size(CHUNKSIZE)];
+
+    for (std::size_t pos = 0; pos < in.size(); pos += CHUNKSIZE) {
+        const auto part =
+          in.subspan(pos, std::min(CHUNKSIZE, in.size() - pos));
+        static_cast<void>(bin2hex(span<char>(chunk), part));
+        d_first =
+          std::copy(chunk, chunk + hex_encoded_size(part.size()), d_first);
+    }
+
+    sodium_memzero(chunk, sizeof chunk);
+    return d_first;
+}
+
 /**
  * Convert the bytes stored in "in" to a hexadecimal string.
- * The underlying libsodium function runs in constant time.
+ * The underlying conversion runs in constant time.
  *
  * Specify as return type either
  *   std::string
@@ -75,8 +200,8 @@ is_zero(const BT& n)
  *   sodium::string_protected.
  * All other return types result in compile failures.
  *
- * Wrapped libsodium function:
- *   sodium_bin2hex()
+ * The result is written directly into the returned string:
+ * there is no temporary buffer.
  **/
 
 template<typename BT = bytes, typename RETURN_TYPE = std::string>
@@ -86,60 +211,26 @@ typename std::enable_if<
   RETURN_TYPE>::type
 bin2hex(const BT& in)
 {
-    // each byte turns into 2-char hex + \0 terminator.
-    const std::size_t hexbuf_size = in.size() * 2 + 1;
-
-    // In C++17, we could construct a std::string with hexbuf_size chars,
-    // and modify it directly through non-const data(). Unfortunately,
-    // in C++11 and C++14, std::string's data() is const only, so we need
-    // to copy the data over from sodium::chars to std::string for now.
-
-    // If we were sure that in.size() was small, we could
-    // also alloca() on the stack, and just before returning
-    // we could stackzero(in.size() + some_align_slack)
-    // if clearmem is true. But that would not be portable.
-    // So we don't and stick to the heap.
-
-    // CAREFUL: even when using sodium::string_protected, this temp
-    // buffer is NOT in protected memory. It is not even zeroed
-    // after use, so there is a substantial time window where it
-    // could leak to or be modified by outsiders.
-    //
-    // XXX use a sodium::bytes_protected buffer instead in this case?
-    // In normal other cases, using the heap is much faster though.
-
-    std::unique_ptr<char> hexbuf(new char[hexbuf_size]);
-
-    // convert bytes in in into hex using sodium_bin2hex().
-    // hexbuf will contain a \0-terminated C-string.
-    static_cast<void>(
-      sodium_bin2hex(hexbuf.get(),
-                     hexbuf_size,
-                     reinterpret_cast<const unsigned char*>(in.data()),
-                     in.size()));
+    RETURN_TYPE outhex(hex_encoded_size(in.size()), '\0');
+    static_cast<void>(bin2hex(span<char>(outhex), span<const byte>(in)));
 
-    // build a std::string<...>, stripping terminating \0 as well.
-    RETURN_TYPE outhex(hexbuf.get());
-
-    // return the string
     return outhex;
 }
 
 /**
  * Convert the bytes stored in "in" to a hexadecimal string.
- * The underlying libsodium function runs in constant time.
+ * The underlying conversion runs in constant time.
  *
- * If clearmem is true, zero temp buffer on the heap in
- * constant time.
+ * clearmem used to request zeroing a temp buffer on the heap.
+ * Since the result is now written directly into the returned
+ * string, there is nothing left to clear; clearmem is kept
+ * for compatibility only.
  *
  * Specify as return type either
  *   std::string
  * or
  *   sodium::string_protected.
  * All other return types result in compile failures.
- *
- * Wrapped libsodium function:
- *   sodium_bin2hex()
  **/
 
 template<typename BT = bytes, typename RETURN_TYPE = std::string>
@@ -149,47 +240,106 @@ typename std::enable_if<
   RETURN_TYPE>::type
 bin2hex(const BT& in, bool clearmem)
 {
-    // each byte turns into 2-char hex + \0 terminator.
-    const std::size_t hexbuf_size = in.size() * 2 + 1;
-
-    // In C++17, we could construct a std::string with hexbuf_size chars,
-    // and modify it directly through non-const data(). Unfortunately,
-    // in C++11 and C++14, std::string's data() is const only, so we need
-    // to copy the data over from sodium::chars to std::string for now.
-
-    // If we were sure that in.size() was small, we could
-    // also alloca() on the stack, and just before returning
-    // we could stackzero(in.size() + some_align_slack)
-    // if clearmem is true. But that would not be portable.
-    // So we don't and stick to the heap.
-
-    // CAREFUL: even when using sodium::string_protected, this temp
-    // buffer is NOT in protected memory. Even if it is quickly zeroed
-    // after use, there is a small time window where it could leak to
-    // or be modified by outsiders.
-    //
-    // XXX use a sodium::bytes_protected buffer instead in this case?
-    // In normal other cases, using the heap is much faster though.
-
-    deleted_unique_ptr<char> hexbuf(new char[hexbuf_size], [=](char* buf) {
-        if (clearmem)
-            sodium_memzero(buf, hexbuf_size);
-        delete[] buf;
-    });
-
-    // convert bytes in in into hex using sodium_bin2hex().
-    // hexbuf will contain a \0-terminated C-string.
-    static_cast<void>(
-      sodium_bin2hex(hexbuf.get(),
-                     hexbuf_size,
-                     reinterpret_cast<const unsigned char*>(in.data()),
-                     in.size()));
+    static_cast<void>(clearmem);
+    return bin2hex<BT, RETURN_TYPE>(in);
+}
 
-    // build a std::string<...>, stripping terminating \0 as well.
-    RETURN_TYPE outhex(hexbuf.get());
+/**
+ * Decode the hexadecimal chars in "in" (upper or lower case) into
+ * the first hex_decoded_size(in.size()) bytes of out.
+ *
+ * Unlike sodium_hex2bin(), the decoding is strict (no chars are
+ * ignored, in.size() must be even) and runs in constant time with
+ * respect to the bytes, also when it fails: use this for keys.
+ * Large inputs are decoded with SSSE3, AVX2 or NEON, where the CPU
+ * has them (see decode_simd.h).
+ *
+ * Return 0 on success, or -1 if "in" isn't well-formed, or if out is
+ * too small. Out is wiped on failure. Nothing is allocated.
+ **/
 
-    // return the string
-    return outhex;
+inline int
+hex2bin(span<byte> out, span<const char> in) noexcept
+{
+    const std::size_t size = hex_decoded_size(in.size());
+    if (in.size() % 2 != 0 || out.size() < size)
+        return -1;
+
+    if (!decode_detail::hex_decode(out.data(), in.data(), size)) {
+        sodium_memzero(out.data(), size);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Decode the base64 chars in "in", in the base64 algorithm VARIANT,
+ * into the first base64_decoded_size<VARIANT>(in) bytes of out.
+ *
+ * The decoding is strict: no chars are ignored, the padded variants
+ * need in.size() % 4 == 0 and padding only at the end, and unused
+ * bits of the last char must be zero, just like sodium_base642bin()
+ * with ignore == nullptr requires. It runs in constant time with
+ * respect to the bytes, and decodes large inputs with SSSE3, AVX2 or
+ * NEON, where the CPU has them (see decode_simd.h).
+ *
+ * Return 0 on success, or -1 if "in" isn't well-formed, or if out is
+ * too small. Out is wiped on failure. Nothing is allocated.
+ **/
+
+template<int VARIANT = sodium_base64_VARIANT_ORIGINAL>
+int
+base642bin(span<byte> out, span<const char> in) noexcept
+{
+    static_assert(VARIANT == sodium_base64_VARIANT_ORIGINAL ||
+                    VARIANT == sodium_base64_VARIANT_ORIGINAL_NO_PADDING ||
+                    VARIANT == sodium_base64_VARIANT_URLSAFE ||
+                    VARIANT == sodium_base64_VARIANT_URLSAFE_NO_PADDING,
+                  "sodium::base642bin() unknown variant");
+    constexpr bool padded = VARIANT == sodium_base64_VARIANT_ORIGINAL ||
+                            VARIANT == sodium_base64_VARIANT_URLSAFE;
+
+    if ((padded && in.size() % 4 != 0) || (!padded && in.size() % 4 == 1))
+        return -1;
+    const std::size_t size = base64_decoded_size<VARIANT>(in);
+    if (out.size() < size)
+        return -1;
+
+    // the last group, if it is padded or partial, is decoded apart
+    std::size_t tail = in.size() % 4;
+    if (padded && size % 3 != 0)
+        tail = 4 - (3 - size % 3);
+    const std::size_t ngroups = (in.size() - (padded && tail ? 4 : tail)) / 4;
+
+    bool ok = decode_detail::base64_decode_groups<VARIANT>(
+      out.data(), in.data(), ngroups);
+
+    if (tail != 0) {
+        const auto* c =
+          reinterpret_cast<const unsigned char*>(in.data() + 4 * ngroups);
+        byte* o = out.data() + 3 * ngroups;
+        std::uint32_t err = 0;
+        const std::uint32_t v0 =
+          decode_detail::base64_value<VARIANT>(c[0], err);
+        const std::uint32_t v1 =
+          decode_detail::base64_value<VARIANT>(c[1], err);
+        o[0] = static_cast<byte>((v0 << 2) | (v1 >> 4));
+        if (tail == 2)
+            err |= v1 & 0x0f; // unused bits
+        else {
+            const std::uint32_t v2 =
+              decode_detail::base64_value<VARIANT>(c[2], err);
+            o[1] = static_cast<byte>(((v1 & 0x0f) << 4) | (v2 >> 2));
+            err |= v2 & 0x03;
+        }
+        ok = ok && err == 0;
+    }
+
+    if (!ok) {
+        sodium_memzero(out.data(), size);
+        return -1;
+    }
+    return 0;
 }
 
 /**
@@ -214,6 +364,14 @@ template<typename BT = bytes>
 BT
 hex2bin(const std::string& hex, const std::string& ignore = "")
 {
+    // well-formed input without ignored chars: decode into exactly
+    // sized bin, in constant time (see hex2bin(span, span) above)
+    if (ignore.empty()) {
+        BT bin(hex_decoded_size(hex.size()));
+        if (hex2bin(span<byte>(bin), span<const char>(hex)) == 0)
+            return bin;
+    }
+
     std::size_t bin_maxlen = hex.size() >> 1; // XXX fixed length, for now
 
     BT bin(bin_maxlen);
@@ -239,6 +397,78 @@ hex2bin(const std::string& hex, const std::string& ignore = "")
     // XXX how do we return max_end?
 }
 
+/**
+ * Write the base64 representation of the bytes in "in", in the
+ * base64 algorithm VARIANT, into the first
+ * base64_encoded_size<VARIANT>(in.size()) chars of out. No \0 is
+ * appended.
+ *
+ * Return 0 on success, or -1 if out is too small. Nothing is
+ * allocated.
+ *
+ * Wrapped libsodium function:
+ *   sodium_bin2base64()
+ **/
+
+template<int VARIANT = sodium_base64_VARIANT_ORIGINAL>
+int
+bin2base64(span<char> out, span<const byte> in) noexcept
+{
+    if (out.size() < base64_encoded_size<VARIANT>(in.size()))
+        return -1;
+    if (in.empty())
+        return 0;
+
+    // sodium_bin2base64() always appends a \0, for which out may have
+    // no room. So we encode all but the last (up to 3) bytes directly
+    // into out, where the \0 lands on the first char of the tail, and
+    // the tail through a small buffer on the stack.
+    const std::size_t head = (in.size() - 1) / 3 * 3;
+    if (head != 0)
+        static_cast<void>(sodium_bin2base64(out.data(),
+                                            head / 3 * 4 + 1,
+                                            in.data(),
+                                            head,
+                                            VARIANT));
+
+    char tail[4 + 1];
+    static_cast<void>(sodium_bin2base64(
+      tail, sizeof tail, in.data() + head, in.size() - head, VARIANT));
+    std::memcpy(out.data() + head / 3 * 4,
+                tail,
+                base64_encoded_size<VARIANT>(in.size() - head));
+    sodium_memzero(tail, sizeof tail);
+
+    return 0;
+}
+
+/**
+ * Write the base64 representation of the bytes in "in", in the
+ * base64 algorithm VARIANT, to the output iterator d_first, in
+ * chunks encoded on the stack. Return the iterator past the last
+ * char written.
+ **/
+
+template<int VARIANT = sodium_base64_VARIANT_ORIGINAL, typename OutputIt>
+OutputIt
+bin2base64_copy(span<const byte> in, OutputIt d_first)
+{
+    // a multiple of 3, so that only the last chunk is padded
+    constexpr std::size_t CHUNKSIZE = 48;
+    char chunk[base64_encoded_size<VARIANT>(CHUNKSIZE)];
+
+    for (std::size_t pos = 0; pos < in.size(); pos += CHUNKSIZE) {
+        const auto part =
+          in.subspan(pos, std::min(CHUNKSIZE, in.size() - pos));
+        static_cast<void>(bin2base64<VARIANT>(span<char>(chunk), part));
+        d_first = std::copy(
+          chunk, chunk + base64_encoded_size<VARIANT>(part.size()), d_first);
+    }
+
+    sodium_memzero(chunk, sizeof chunk);
+    return d_first;
+}
+
 /**
  * Convert the contents in "in", interpreted as bytes, in base64.
  *
@@ -252,7 +482,8 @@ hex2bin(const std::string& hex, const std::string& ignore = "")
  *   sodium::string_protected.
  * All other return types result in compile failures.
  *
- * Return the base64 as a string.
+ * Return the base64 as a string. The result is written directly
+ * into the returned string: there is no temporary buffer.
  *
  * Wrapped libsodium function:
  *   sodium_bin2base64()
@@ -271,44 +502,10 @@ typename std::enable_if<
   RETURN_TYPE>::type
 bin2base64(const BT& in)
 {
-    // compute size for base64 output buffer, including trailing \0 byte
-    const std::size_t base64buf_size =
-      sodium_base64_encoded_len(in.size(), VARIANT);
-
-    // In C++17, we could construct a std::string with base64buf_size chars,
-    // and modify it directly through non-const data(). Unfortunately,
-    // in C++11 and C++14, std::string's data() is const only, so we need
-    // to copy the data over from sodium::chars to std::string for now.
-
-    // If we were sure that in.size() was small, we could
-    // also alloca() on the stack, and just before returning
-    // we could stackzero(in.size() + some_align_slack)
-    // if clearmem is true. But that would not be portable.
-    // So we don't and stick to the heap.
-
-    // CAREFUL: even when using sodium::string_protected, this temp
-    // buffer is NOT in protected memory. It is not even zeroed
-    // after use, so there is a substantial time window where it
-    // could leak to or be modified by outsiders.
-    //
-    // XXX use a sodium::bytes_protected buffer instead in this case?
-    // In normal other cases, using the heap is much faster though.
-
-    std::unique_ptr<char> base64buf(new char[base64buf_size]);
-
-    // convert bytes in in into base64 using sodium_bin2base64().
-    // base64buf will contain a \0-terminated C-string.
+    RETURN_TYPE outbase64(base64_encoded_size<VARIANT>(in.size()), '\0');
     static_cast<void>(
-      sodium_bin2base64(base64buf.get(),
-                        base64buf_size,
-                        reinterpret_cast<const unsigned char*>(in.data()),
-                        in.size(),
-                        VARIANT));
-
-    // build a std::string<...>, stripping terminating \0 as well.
-    RETURN_TYPE outbase64(base64buf.get());
+      bin2base64<VARIANT>(span<char>(outbase64), span<const byte>(in)));
 
-    // return the string
     return outbase64;
 }
 
@@ -325,8 +522,10 @@ bin2base64(const BT& in)
  *   sodium::string_protected.
  * All other return types result in compile failures.
  *
- * If clearmem is true, zero temp buffer on the heap in
- * constant time.
+ * clearmem used to request zeroing a temp buffer on the heap.
+ * Since the result is now written directly into the returned
+ * string, there is nothing left to clear; clearmem is kept
+ * for compatibility only.
  *
  * Return the base64 as a string.
  *
@@ -347,50 +546,8 @@ typename std::enable_if<
   RETURN_TYPE>::type
 bin2base64(const BT& in, bool clearmem)
 {
-    // compute size for base64 output buffer, including trailing \0 byte
-    const std::size_t base64buf_size =
-      sodium_base64_encoded_len(in.size(), VARIANT);
-
-    // In C++17, we could construct a std::string with base64buf_size chars,
-    // and modify it directly through non-const data(). Unfortunately,
-    // in C++11 and C++14, std::string's data() is const only, so we need
-    // to copy the data over from sodium::chars to std::string for now.
-
-    // If we were sure that in.size() was small, we could
-    // also alloca() on the stack, and just before returning
-    // we could stackzero(in.size() + some_align_slack)
-    // if clearmem is true. But that would not be portable.
-    // So we don't and stick to the heap.
-
-    // CAREFUL: even when using sodium::string_protected, this temp
-    // buffer is NOT in protected memory. Even if it is quickly zeroed
-    // after use, there is a small time window where it could leak to
-    // or be modified by outsiders.
-    //
-    // XXX use a sodium::bytes_protected buffer instead in this case?
-    // In normal other cases, using the heap is much faster though.
-
-    deleted_unique_ptr<char> base64buf(
-      new char[base64buf_size], [=](char* buf) {
-          if (clearmem)
-              sodium_memzero(buf, base64buf_size);
-          delete[] buf;
-      });
-
-    // convert bytes in in into base64 using sodium_bin2base64().
-    // base64buf will contain a \0-terminated C-string.
-    static_cast<void>(
-      sodium_bin2base64(base64buf.get(),
-                        base64buf_size,
-                        reinterpret_cast<const unsigned char*>(in.data()),
-                        in.size(),
-                        VARIANT));
-
-    // build a std::string<...>, stripping terminating \0 as well.
-    RETURN_TYPE outbase64(base64buf.get());
-
-    // return the string
-    return outbase64;
+    static_cast<void>(clearmem);
+    return bin2base64<VARIANT, BT, RETURN_TYPE>(in);
 }
 
 template<int VARIANT = sodium_base64_VARIANT_ORIGINAL,
@@ -406,6 +563,14 @@ typename std::enable_if<
   RETURN_TYPE>::type
 base642bin(const STRING_TYPE& b64, const std::string& ignore = "")
 {
+    // well-formed input without ignored chars: decode into exactly
+    // sized bin, in constant time (see base642bin(span, span) above)
+    if (ignore.empty()) {
+        RETURN_TYPE bin(base64_decoded_size<VARIANT>(b64));
+        if (base642bin<VARIANT>(span<byte>(bin), span<const char>(b64)) == 0)
+            return bin;
+    }
+
     // since libsodium doesn't provide the reverse of
     // sodium_base64_encoded_len(size_t bin_len, int variant)
     // to estimate bin_maxlen, we set it conservatively to
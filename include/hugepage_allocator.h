@@ -0,0 +1,569 @@
+// hugepage_allocator.h -- Protected memory on NUMA-local huge pages
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "mlock_budget.h"
+#include "runtime.h"
+#include "trace.h"
+
+#include <sodium.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define SODIUM_HAVE_HUGEPAGES 1
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000 // Linux 4.17+, a mere hint before
+#endif
+#else
+#define SODIUM_HAVE_HUGEPAGES 0
+#endif // __linux__
+
+/**
+ * sodium_allocarray() backs every protected buffer with 4 KiB pages.
+ * For large buffers that are streamed through, e.g. bulk staging
+ * buffers or big key tables, that means one TLB entry per 4 KiB, and
+ * pages that land on whatever NUMA node the kernel happens to choose.
+ *
+ * sodium::hugepage_arena maps large buffers on 2 MiB huge pages,
+ * and binds them to the NUMA node of the allocating thread. It keeps
+ * the guarantees of sodium_malloc():
+ *
+ *   [guard | ... huge pages: ........ canary | data | guard]
+ *
+ *   - the data is mlock()ed and excluded from core dumps,
+ *   - it is followed immediately by a PROT_NONE guard page, and
+ *     preceded by a secret canary that is checked on deallocation,
+ *     and a PROT_NONE guard page in front of the huge pages,
+ *   - it is zeroed with sodium_memzero() before being unmapped,
+ *   - noaccess(), readonly() and readwrite() mprotect() the whole
+ *     (private) huge page region.
+ *
+ * The huge pages come from the hugetlbfs pool (MAP_HUGETLB) if the
+ * administrator reserved some (vm.nr_hugepages), else from
+ * transparent huge pages (madvise(MADV_HUGEPAGE)), which the kernel
+ * may or may not honor. Either way, each region gets huge pages of
+ * its own: a 1.5 MiB buffer occupies a whole 2 MiB huge page.
+ *
+ * Requests smaller than hugepage_arena::THRESHOLD bytes, and all
+ * requests on platforms other than Linux, fall back to
+ * sodium_allocarray() / sodium_free(), exactly like sodium::allocator.
+ *
+ * Either way, the memory is lock_priority::bulk memory of the
+ * sodium::mlock_budget (see mlock_budget.h): once the budget is used
+ * up, it is left unlocked (and for sodium_allocarray(), munlock()ed
+ * again right away) instead of competing with keys for the
+ * RLIMIT_MEMLOCK of the process.
+ **/
+
+namespace sodium {
+
+class hugepage_arena
+{
+  public:
+    static constexpr std::size_t HUGEPAGESIZE = 2 * 1024 * 1024;
+
+    // Smaller requests are not worth a whole huge page.
+    static constexpr std::size_t THRESHOLD = HUGEPAGESIZE / 2;
+
+    // Size of the canary in front of the data.
+    static constexpr std::size_t CANARYSIZE = 16;
+
+    enum class protection_type
+    {
+        readwrite,
+        readonly,
+        noaccess
+    };
+
+    /**
+     * The statistics exposed by stats(), mostly for tests and capacity
+     * planning.
+     **/
+    struct stats_type
+    {
+        std::size_t regions;  // number of live regions
+        std::size_t hugetlb;  // ... of which on hugetlbfs pages
+        std::size_t numa;     // ... of which bound to a NUMA node
+        std::size_t bytes;    // total size of their huge page mappings
+    };
+
+    /**
+     * The process-wide arena, shared by all hugepage_allocator<T>s.
+     *
+     * It is constructed (and its canary generated) on first use,
+     * after initializing libsodium if needed (see sodium::runtime).
+     **/
+    static hugepage_arena& instance()
+    {
+        static hugepage_arena arena;
+        return arena;
+    }
+
+    hugepage_arena(const hugepage_arena&) = delete;
+    hugepage_arena& operator=(const hugepage_arena&) = delete;
+
+    ~hugepage_arena()
+    {
+        // Regions still alive at exit belong to objects with static
+        // storage duration that haven't been destroyed yet. Leave them.
+        sodium_memzero(canary_.data(), canary_.size());
+    }
+
+    /**
+     * Allocate size bytes on huge pages. Return nullptr if size is
+     * below THRESHOLD, or if huge pages aren't supported on this
+     * platform (the caller should then fall back to sodium_allocarray()).
+     *
+     * Throws std::bad_alloc if the region can't be mapped.
+     **/
+    void* allocate(std::size_t size)
+    {
+#if SODIUM_HAVE_HUGEPAGES
+        if (size < THRESHOLD)
+            return nullptr;
+
+        if (size > SIZE_MAX - 4 * HUGEPAGESIZE)
+            throw std::bad_alloc{};
+
+        // the data, 16-byte aligned, and its canary
+        const std::size_t needed = round_up(size, 16) + CANARYSIZE;
+
+        region_type r;
+        r.numa = false;
+        r.locked = false;
+        r.length = round_up(needed, HUGEPAGESIZE);
+
+        // huge pages from the hugetlbfs pool, if there are any...
+        r.hugetlb = map_hugetlb(r);
+
+        // ... else transparent huge pages
+        if (!r.hugetlb)
+            map_transparent(r);
+
+        // before the first touch, so the pages are allocated locally
+        r.numa = bind_to_local_node(r.base, r.length);
+
+        // like sodium_malloc(): mlock() is best effort, within budget
+        ::madvise(r.base, r.length, MADV_DONTDUMP);
+        r.locked =
+          mlock_budget::instance().acquire(r.length, lock_priority::bulk);
+        if (r.locked)
+            ::mlock(r.base, r.length);
+
+        // right-align the data against the guard page behind the region
+        r.data = r.base + r.length - round_up(size, 16);
+        std::memcpy(r.data - CANARYSIZE, canary_.data(), CANARYSIZE);
+
+        if (!r.locked)
+            mlock_budget::instance().remember_unlocked(r.data, r.length);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        regions_.emplace(reinterpret_cast<std::uintptr_t>(r.data), r);
+
+        SODIUM_TRACE("sodium::hugepage_arena::allocate()",
+                     "[size=" << size << ",hugetlb=" << r.hugetlb
+                              << ",numa=" << r.numa << "] -> "
+                              << static_cast<void*>(r.data));
+
+        return r.data;
+#else
+        (void)size;
+        return nullptr;
+#endif // SODIUM_HAVE_HUGEPAGES
+    }
+
+    /**
+     * Check the canary of the region at ptr, zero it, and unmap it.
+     * Return false if ptr wasn't allocated by this arena (in which
+     * case the caller should sodium_free() it).
+     **/
+    bool deallocate(void* ptr)
+    {
+#if SODIUM_HAVE_HUGEPAGES
+        region_type r;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = regions_.find(reinterpret_cast<std::uintptr_t>(ptr));
+            if (it == regions_.end())
+                return false;
+            r = it->second;
+            regions_.erase(it);
+        }
+
+        // we need write access to zero the region
+        if (::mprotect(r.base, r.length, PROT_READ | PROT_WRITE) != 0)
+            std::abort();
+
+        if (sodium_memcmp(r.data - CANARYSIZE, canary_.data(), CANARYSIZE) !=
+            0) {
+            SODIUM_TRACE("sodium::hugepage_arena::deallocate()",
+                         "[ptr=" << ptr << "] canary corrupted");
+            std::abort();
+        }
+
+        SODIUM_TRACE("sodium::hugepage_arena::deallocate()",
+                     "[ptr=" << ptr << "]");
+
+        sodium_memzero(r.base, r.length);
+        if (r.locked) {
+            ::munlock(r.base, r.length);
+            mlock_budget::instance().release(r.length, lock_priority::bulk);
+        } else
+            mlock_budget::instance().forget_unlocked(r.data, r.length);
+        ::munmap(r.reserved, r.reserved_length);
+        return true;
+#else
+        (void)ptr;
+        return false;
+#endif // SODIUM_HAVE_HUGEPAGES
+    }
+
+    /**
+     * Change the protection of the region at ptr.
+     *
+     * Return false if ptr wasn't allocated by this arena. Throw a
+     * std::runtime_error if the underlying mprotect() call failed.
+     **/
+    bool protect(void* ptr, protection_type prot)
+    {
+#if SODIUM_HAVE_HUGEPAGES
+        region_type r;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = regions_.find(reinterpret_cast<std::uintptr_t>(ptr));
+            if (it == regions_.end())
+                return false;
+            r = it->second;
+        }
+
+        int flags = PROT_NONE;
+        if (prot == protection_type::readwrite)
+            flags = PROT_READ | PROT_WRITE;
+        else if (prot == protection_type::readonly)
+            flags = PROT_READ;
+
+        if (::mprotect(r.base, r.length, flags) != 0)
+            throw std::runtime_error{
+                "sodium::hugepage_arena::protect() failed"
+            };
+        return true;
+#else
+        (void)ptr;
+        (void)prot;
+        return false;
+#endif // SODIUM_HAVE_HUGEPAGES
+    }
+
+    stats_type stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        stats_type result{ regions_.size(), 0, 0, 0 };
+        for (const auto& entry : regions_) {
+            result.hugetlb += entry.second.hugetlb;
+            result.numa += entry.second.numa;
+            result.bytes += entry.second.length;
+        }
+        return result;
+    }
+
+  private:
+    struct region_type
+    {
+        unsigned char* reserved;     // the whole PROT_NONE reservation
+        std::size_t reserved_length; // ... and its length
+        unsigned char* base;         // the huge page aligned region
+        std::size_t length;          // ... a multiple of HUGEPAGESIZE
+        unsigned char* data;         // what we hand out
+        bool hugetlb;                // from the hugetlbfs pool?
+        bool numa;                   // bound to the local NUMA node?
+        bool locked;                 // mlock()ed within the budget?
+    };
+
+    hugepage_arena()
+    {
+        runtime::init();
+        ::randombytes_buf(canary_.data(), canary_.size());
+    }
+
+    static std::size_t round_up(std::size_t n, std::size_t multiple)
+    {
+        return (n + multiple - 1) / multiple * multiple;
+    }
+
+#if SODIUM_HAVE_HUGEPAGES
+    static std::size_t page_size()
+    {
+        static const std::size_t pagesize =
+          static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        return pagesize;
+    }
+
+    // map r.length bytes from the hugetlbfs pool, between guard pages
+    static bool map_hugetlb(region_type& r)
+    {
+        void* base = ::mmap(nullptr,
+                            r.length,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                            -1,
+                            0);
+        if (base == MAP_FAILED)
+            return false;
+
+        const std::size_t pagesize = page_size();
+        r.base = static_cast<unsigned char*>(base);
+        r.reserved = r.base - pagesize;
+        r.reserved_length = r.length + 2 * pagesize;
+
+        if (!map_guard(r.reserved, pagesize)) {
+            ::munmap(r.base, r.length);
+            return false;
+        }
+        if (!map_guard(r.base + r.length, pagesize)) {
+            ::munmap(r.reserved, pagesize + r.length);
+            return false;
+        }
+        return true;
+    }
+
+    // Map a PROT_NONE guard page at addr, unless something else is
+    // already mapped there. (We can't MAP_FIXED a hugetlbfs region
+    // into a reservation either: if that fails for lack of huge pages,
+    // the kernel has already unmapped the reservation.)
+    static bool map_guard(unsigned char* addr, std::size_t pagesize)
+    {
+        void* guard = ::mmap(addr,
+                             pagesize,
+                             PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+                             -1,
+                             0);
+        if (guard == addr)
+            return true;
+        if (guard != MAP_FAILED)
+            ::munmap(guard, pagesize); // an old kernel took it as a hint
+        return false;
+    }
+
+    // Reserve a HUGEPAGESIZE-aligned region with guards on both sides,
+    // and ask the kernel for transparent huge pages.
+    static void map_transparent(region_type& r)
+    {
+        r.reserved_length = r.length + 2 * HUGEPAGESIZE;
+        void* reserved = ::mmap(nullptr,
+                                r.reserved_length,
+                                PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                -1,
+                                0);
+        if (reserved == MAP_FAILED)
+            throw std::bad_alloc{};
+
+        r.reserved = static_cast<unsigned char*>(reserved);
+        const auto misalignment =
+          reinterpret_cast<std::uintptr_t>(r.reserved) % HUGEPAGESIZE;
+        r.base = r.reserved + (HUGEPAGESIZE - misalignment); // >= 1 guard page
+
+        if (::mprotect(r.base, r.length, PROT_READ | PROT_WRITE) != 0) {
+            ::munmap(r.reserved, r.reserved_length);
+            throw std::bad_alloc{};
+        }
+        ::madvise(r.base, r.length, MADV_HUGEPAGE);
+    }
+
+    // prefer the NUMA node of the calling thread for [addr, addr+len)
+    static bool bind_to_local_node(void* addr, std::size_t len)
+    {
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (::syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+            return false;
+
+        constexpr std::size_t BITS = 8 * sizeof(unsigned long);
+        std::array<unsigned long, 16> nodemask{}; // up to 1024 nodes
+        if (node >= BITS * nodemask.size())
+            return false;
+        nodemask[node / BITS] = 1UL << (node % BITS);
+
+        return ::syscall(SYS_mbind,
+                         addr,
+                         len,
+                         MPOL_PREFERRED,
+                         nodemask.data(),
+                         BITS * nodemask.size(),
+                         0) == 0;
+    }
+#endif // SODIUM_HAVE_HUGEPAGES
+
+    std::mutex mutex_;
+    std::array<unsigned char, CANARYSIZE> canary_;
+    std::map<std::uintptr_t, region_type> regions_;
+};
+
+/**
+ * hugepage_allocator<T> has the same interface as sodium::allocator<T>,
+ * including the non-standard noaccess(), readonly() and readwrite()
+ * functions, but allocates large objects from the hugepage_arena above.
+ *
+ * Use it through sodium::bytes_hugepage (see common.h), e.g. for a
+ * large protected staging buffer:
+ *   sodium::bytes_hugepage buffer(16 * 1024 * 1024);
+ **/
+
+template<typename T>
+class hugepage_allocator
+{
+  public:
+    using value_type = T;
+
+    hugepage_allocator() {}
+
+    template<typename U>
+    hugepage_allocator(const hugepage_allocator<U>&)
+    {}
+
+    ~hugepage_allocator() {}
+
+    /**
+     * Allocate memory for num elements of type T, without constructing
+     * them, from the hugepage_arena. If num * sizeof(T) bytes are too
+     * few for huge pages, get them from sodium_allocarray() instead.
+     *
+     * Throws std::bad_alloc if no memory could be obtained.
+     **/
+
+    T* allocate(std::size_t num)
+    {
+        if (num > SIZE_MAX / sizeof(T))
+            throw std::bad_alloc{};
+
+        void* ptr = hugepage_arena::instance().allocate(num * sizeof(T));
+        if (ptr == nullptr) {
+            ptr = sodium_allocarray(num, sizeof(T));
+            if (ptr != NULL) {
+                // the data is still in its sodium_malloc() garbage
+                // state: sodium_munlock() zeroing it doesn't hurt
+                const std::size_t size = num * sizeof(T);
+                if (!mlock_budget::instance().acquire(
+                      mlock_budget::locked_size(size), lock_priority::bulk)) {
+                    sodium_munlock(ptr, size);
+                    mlock_budget::instance().remember_unlocked(ptr, size);
+                }
+            }
+        }
+
+        SODIUM_TRACE("sodium::hugepage_allocator::allocate()",
+                     "[num=" << num << "] -> " << static_cast<void*>(ptr));
+
+        if (ptr == NULL)
+            throw std::bad_alloc{};
+        return static_cast<T*>(ptr);
+    }
+
+    /**
+     * Deallocate memory pointed to by ptr. The memory is zeroed, and
+     * its canary checked, either by the hugepage_arena or sodium_free().
+     **/
+
+    void deallocate(T* ptr, std::size_t num)
+    {
+        SODIUM_TRACE("sodium::hugepage_allocator::deallocate()",
+                     "[ptr=" << static_cast<void*>(ptr) << "]");
+
+        if (!hugepage_arena::instance().deallocate(ptr)) {
+            // forget ptr before it can be handed out again
+            const std::size_t size = num * sizeof(T);
+            if (!mlock_budget::instance().forget_unlocked(ptr, size))
+                mlock_budget::instance().release(
+                  mlock_budget::locked_size(size), lock_priority::bulk);
+            sodium_free(ptr);
+        }
+    }
+
+    /**
+     * Change the protection of the object at ptr.
+     *
+     * These functions throw a std::runtime_error if the underlying
+     * mprotect() call failed.
+     **/
+
+    void noaccess(T* ptr)
+    {
+        if (!hugepage_arena::instance().protect(
+              ptr, hugepage_arena::protection_type::noaccess) &&
+            sodium_mprotect_noaccess(ptr) == -1)
+            throw std::runtime_error{
+                "sodium::hugepage_allocator::noaccess() failed"
+            };
+    }
+
+    void readonly(T* ptr)
+    {
+        if (!hugepage_arena::instance().protect(
+              ptr, hugepage_arena::protection_type::readonly) &&
+            sodium_mprotect_readonly(ptr) == -1)
+            throw std::runtime_error{
+                "sodium::hugepage_allocator::readonly() failed"
+            };
+    }
+
+    void readwrite(T* ptr)
+    {
+        if (!hugepage_arena::instance().protect(
+              ptr, hugepage_arena::protection_type::readwrite) &&
+            sodium_mprotect_readwrite(ptr) == -1)
+            throw std::runtime_error{
+                "sodium::hugepage_allocator::readwrite() failed"
+            };
+    }
+};
+
+// Two sodium::hugepage_allocator allocators are always equal: they
+// share the same process-wide hugepage_arena.
+template<typename T1, typename T2>
+bool
+operator==(const hugepage_allocator<T1>&,
+           const hugepage_allocator<T2>&) noexcept
+{
+    return true;
+}
+
+template<typename T1, typename T2>
+bool
+operator!=(const hugepage_allocator<T1>&,
+           const hugepage_allocator<T2>&) noexcept
+{
+    return false;
+}
+
+} // namespace sodium
@@ -0,0 +1,343 @@
+// io_pipeline.h -- Overlap reading, transforming and writing of streams
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "span.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace sodium {
+
+class io_pipeline
+{
+    /**
+     * An io_pipeline overlaps the I/O and the CPU work of a blockwise
+     * stream transformation (e.g. encryption), so that the disk
+     * doesn't sit idle while the CPU works, and the other way around.
+     *
+     * Data flows through a ring of depth reused buffers:
+     *
+     *   reader thread:   istr -> free buffer's input half
+     *   calling thread:  input half -> transform() -> output half
+     *   writer thread:   output half -> ostr, buffer is free again
+     *
+     * so that up to depth - 1 reads are in flight while a buffer is
+     * being transformed, and writes complete in the background. The
+     * output is written in the same order as the input was read.
+     *
+     * Each half is aligned on ALIGNMENT bytes, as needed by unbuffered
+     * (O_DIRECT / FILE_FLAG_NO_BUFFERING) file I/O. The buffers are
+     * allocated once by the constructor, and reused by every run().
+     *
+     * This is the portable implementation, on top of std::istream and
+     * std::ostream with one thread each for reading and writing.
+     * Kernel-level asynchronous I/O (io_uring, overlapped I/O) would
+     * replace these two threads only, behind the same interface.
+     **/
+
+  public:
+    static constexpr std::size_t ALIGNMENT = 4096;
+    static constexpr std::size_t DEPTH = 4;
+
+    /**
+     * Create a pipeline of depth buffers, each one with insize bytes
+     * of input and outsize bytes of output.
+     *
+     * Throw a std::runtime_error if depth < 2 or insize == 0.
+     **/
+
+    io_pipeline(std::size_t insize,
+                std::size_t outsize,
+                std::size_t depth = DEPTH)
+      : insize_{ insize }
+      , outsize_{ outsize }
+    {
+        if (depth < 2)
+            throw std::runtime_error{
+                "sodium::io_pipeline::io_pipeline() depth too small"
+            };
+        if (insize == 0)
+            throw std::runtime_error{
+                "sodium::io_pipeline::io_pipeline() wrong buffer size"
+            };
+
+        slots_.resize(depth);
+        for (auto& slot : slots_) {
+            slot.in.reset(allocate(insize_));
+            slot.out.reset(allocate(outsize_));
+        }
+    }
+
+    io_pipeline(const io_pipeline&) = delete;
+    io_pipeline& operator=(const io_pipeline&) = delete;
+
+    std::size_t depth() const { return slots_.size(); }
+    std::size_t insize() const { return insize_; }
+    std::size_t outsize() const { return outsize_; }
+
+    /**
+     * Read istr in chunks of insize() bytes until EOF, call
+     *
+     *   std::size_t transform(span<const byte> in, span<byte> out)
+     *
+     * on the calling thread for each chunk in order, and write the
+     * first transform(...) bytes of out (out.size() == outsize()) to
+     * ostr. Only the last chunk may be shorter than insize().
+     *
+     * If reading, writing, or transform() fail (by throwing), the
+     * pipeline is stopped and the first exception is rethrown, after
+     * both I/O threads have been joined. Output of the chunks that
+     * were transformed before the failure may or may not have been
+     * written to ostr: there is no strong guarantee w.r.t. ostr.
+     **/
+
+    template<typename Transform>
+    void run(std::istream& istr, std::ostream& ostr, Transform transform)
+    {
+        start();
+
+        std::thread reader([this, &istr] { guarded([&] { read_all(istr); }); });
+        std::thread writer(
+          [this, &ostr] { guarded([&] { write_all(ostr); }); });
+
+        guarded([&] {
+            process(
+              [&](slot& s) {
+                  s.outsize = transform(span<const byte>(s.in.get(), s.insize),
+                                        span<byte>(s.out.get(), outsize_));
+              },
+              false);
+        });
+
+        finish(reader, &writer);
+    }
+
+    /**
+     * Read istr in chunks of insize() bytes until EOF, and call
+     *
+     *   void consume(span<const byte> in)
+     *
+     * on the calling thread for each chunk in order, e.g. to hash or
+     * sign a stream while its next chunks are being read. Nothing is
+     * written, and outsize() may be 0.
+     *
+     * Failures are handled like those of run(istr, ostr, transform).
+     **/
+
+    template<typename Consume>
+    void run(std::istream& istr, Consume consume)
+    {
+        start();
+
+        std::thread reader([this, &istr] { guarded([&] { read_all(istr); }); });
+
+        guarded([&] {
+            process(
+              [&](slot& s) { consume(span<const byte>(s.in.get(), s.insize)); },
+              true);
+        });
+
+        finish(reader, nullptr);
+    }
+
+  private:
+    struct aligned_delete
+    {
+        void operator()(byte* p) const
+        {
+            ::operator delete(p, std::align_val_t(ALIGNMENT));
+        }
+    };
+
+    struct slot
+    {
+        std::unique_ptr<byte, aligned_delete> in;
+        std::unique_ptr<byte, aligned_delete> out;
+        std::size_t insize = 0;
+        std::size_t outsize = 0;
+    };
+
+    static byte* allocate(std::size_t size)
+    {
+        // round up to whole pages, never 0
+        size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT + ALIGNMENT;
+        return static_cast<byte*>(
+          ::operator new(size, std::align_val_t(ALIGNMENT)));
+    }
+
+    // run f, and on failure, remember the first exception and stop
+    template<typename F>
+    void guarded(F f)
+    {
+        try {
+            f();
+        } catch (...) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!failure_)
+                    failure_ = std::current_exception();
+            }
+            cv_.notify_all();
+        }
+    }
+
+    void start()
+    {
+        read_ = transformed_ = written_ = 0;
+        eof_ = false;
+        failure_ = nullptr;
+    }
+
+    // transform all buffers read, in order; release: without a writer
+    template<typename Step>
+    void process(Step step, bool release)
+    {
+        for (;;) {
+            slot* s;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] {
+                    return failure_ || transformed_ != read_ || eof_;
+                });
+                if (failure_ || transformed_ == read_)
+                    break; // failed, or EOF and all done
+                s = &slots_[transformed_ % slots_.size()];
+            }
+
+            step(*s);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ++transformed_;
+                if (release)
+                    written_ = transformed_;
+            }
+            cv_.notify_all();
+        }
+    }
+
+    // wake up and join the I/O threads, and rethrow the first failure
+    void finish(std::thread& reader, std::thread* writer)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_transforming_ = true;
+        }
+        cv_.notify_all();
+        reader.join();
+        if (writer != nullptr)
+            writer->join();
+        done_transforming_ = false;
+
+        if (failure_)
+            std::rethrow_exception(failure_);
+    }
+
+    void read_all(std::istream& istr)
+    {
+        for (;;) {
+            slot* s;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] {
+                    return failure_ || read_ - written_ != slots_.size();
+                });
+                if (failure_)
+                    return;
+                s = &slots_[read_ % slots_.size()];
+            }
+
+            istr.read(reinterpret_cast<char*>(s->in.get()), insize_);
+            s->insize = static_cast<std::size_t>(istr.gcount());
+            if (istr.bad())
+                throw std::runtime_error{
+                    "sodium::io_pipeline::run() error reading from stream"
+                };
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (s->insize != 0)
+                    ++read_;
+                if (s->insize != insize_)
+                    eof_ = true;
+            }
+            cv_.notify_all();
+            if (s->insize != insize_)
+                return;
+        }
+    }
+
+    void write_all(std::ostream& ostr)
+    {
+        for (;;) {
+            slot* s;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] {
+                    return failure_ || written_ != transformed_ ||
+                           done_transforming_;
+                });
+                if (failure_ || written_ == transformed_)
+                    return; // failed, or all done
+                s = &slots_[written_ % slots_.size()];
+            }
+
+            ostr.write(reinterpret_cast<const char*>(s->out.get()),
+                       s->outsize);
+            if (!ostr)
+                throw std::runtime_error{
+                    "sodium::io_pipeline::run() error writing to stream"
+                };
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ++written_;
+            }
+            cv_.notify_all();
+        }
+    }
+
+    std::size_t insize_;
+    std::size_t outsize_;
+    std::vector<slot> slots_;
+
+    // the ring: counts of buffers read, transformed and written so far
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::uint64_t read_ = 0;
+    std::uint64_t transformed_ = 0;
+    std::uint64_t written_ = 0;
+    bool eof_ = false;
+    bool done_transforming_ = false;
+    std::exception_ptr failure_;
+};
+
+} // namespace sodium
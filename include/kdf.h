@@ -0,0 +1,415 @@
+// kdf.h -- Subkey derivation with crypto_kdf, and a cache of subkeys
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h"
+#include "key_table.h"
+#include "span.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+class kdf
+{
+    /**
+     * A sodium::kdf derives subkeys from a master key, with
+     * crypto_kdf_derive_from_key(): every (context, subkey id) pair
+     * yields an independent subkey of SUBKEYSIZE_MIN to SUBKEYSIZE_MAX
+     * bytes, e.g. one key<32> per tenant id:
+     *
+     *   sodium::kdf kdf(master_key);
+     *   const auto ctx = sodium::kdf::make_context("tenants");
+     *   sodium::key<32> tenant_key = kdf.derive<32>(tenant_id, ctx);
+     *
+     * A context is CONTEXTSIZE (8) arbitrary bytes that separate the
+     * uses of the master key, such as "tenants" and "sessions".
+     *
+     * The master key lives in protected memory, shared between copies
+     * of the kdf, like the key of sodium::aead<>. All member functions
+     * are const and can be called concurrently.
+     *
+     * To stop deriving the same subkeys over and over again, e.g. on
+     * the request path of a tenant, put a sodium::kdf_cache<N> in
+     * front of the kdf.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = KEYSIZE_KDF;
+    static constexpr std::size_t CONTEXTSIZE = crypto_kdf_CONTEXTBYTES;
+    static constexpr std::size_t SUBKEYSIZE_MIN = crypto_kdf_BYTES_MIN;
+    static constexpr std::size_t SUBKEYSIZE_MAX = crypto_kdf_BYTES_MAX;
+
+    using key_type = key<KEYSIZE>;
+    using shared_key_type = shared_key<KEYSIZE>;
+    using context_type = std::array<char, CONTEXTSIZE>;
+    using subkey_id_type = std::uint64_t;
+
+    // A kdf with a new random master key
+    kdf()
+      : master_(make_shared_key(key_type()))
+    {}
+
+    // A kdf with a user-supplied master key (copying version)
+    kdf(const key_type& master_key)
+      : master_(make_shared_key(master_key))
+    {}
+
+    // A kdf with a user-supplied master key (moving version)
+    kdf(key_type&& master_key)
+      : master_(make_shared_key(std::move(master_key)))
+    {}
+
+    // A copying constructor: shares the (immutable) master key
+    kdf(const kdf& other) = default;
+
+    /**
+     * The context of name, padded with zero bytes to CONTEXTSIZE.
+     *
+     * Throw a std::runtime_error if name is longer than CONTEXTSIZE.
+     **/
+
+    static context_type make_context(const std::string& name)
+    {
+        if (name.size() > CONTEXTSIZE)
+            throw std::runtime_error{
+                "sodium::kdf::make_context() name too long"
+            };
+        context_type ctx{};
+        std::copy(name.begin(), name.end(), ctx.begin());
+        return ctx;
+    }
+
+    /**
+     * Derive subkey subkey_id of context ctx into subkey, whose size
+     * must be in [SUBKEYSIZE_MIN, SUBKEYSIZE_MAX].
+     *
+     * Return -1 if the size of subkey is out of range.
+     **/
+
+    int derive(span<byte> subkey,
+               subkey_id_type subkey_id,
+               const context_type& ctx) const noexcept
+    {
+        if (subkey.size() < SUBKEYSIZE_MIN || subkey.size() > SUBKEYSIZE_MAX)
+            return -1;
+        return crypto_kdf_derive_from_key(subkey.data(),
+                                          subkey.size(),
+                                          subkey_id,
+                                          ctx.data(),
+                                          master_->data());
+    }
+
+    // Derive subkey subkey_id of context ctx as a key<N>
+    template<std::size_t N>
+    key<N> derive(subkey_id_type subkey_id, const context_type& ctx) const
+    {
+        static_assert(N >= SUBKEYSIZE_MIN && N <= SUBKEYSIZE_MAX,
+                      "sodium::kdf::derive<N>() wrong subkey size");
+
+        key<N> result(false);
+        derive(span<byte>(result.setdata(), N), subkey_id, ctx);
+        result.readonly();
+        return result;
+    }
+
+    /**
+     * Derive the subkeys subkey_ids of context ctx, in this order,
+     * as a vector of key<N>.
+     **/
+
+    template<std::size_t N>
+    std::vector<key<N>> derive(span<const subkey_id_type> subkey_ids,
+                               const context_type& ctx) const
+    {
+        std::vector<key<N>> result;
+        result.reserve(subkey_ids.size());
+        for (subkey_id_type id : subkey_ids)
+            result.push_back(derive<N>(id, ctx));
+        return result;
+    }
+
+    /**
+     * Derive the subkeys subkey_ids of context ctx into the slots
+     * [0, subkey_ids.size()) of table, with a single mprotect() round
+     * trip for the whole batch instead of one protected allocation
+     * per subkey.
+     *
+     * Throw a std::runtime_error if table has fewer slots than
+     * subkey_ids.
+     **/
+
+    template<std::size_t N, typename TBT>
+    void derive(span<const subkey_id_type> subkey_ids,
+                const context_type& ctx,
+                key_table<N, TBT>& table) const
+    {
+        static_assert(N >= SUBKEYSIZE_MIN && N <= SUBKEYSIZE_MAX,
+                      "sodium::kdf::derive<N>() wrong subkey size");
+
+        if (table.size() < subkey_ids.size())
+            throw std::runtime_error{
+                "sodium::kdf::derive() table too small"
+            };
+
+        const auto prot = table.protection();
+        table.readwrite();
+        for (std::size_t i = 0; i != subkey_ids.size(); ++i)
+            derive(span<byte>(table.setdata(i), N), subkey_ids[i], ctx);
+        if (prot == key_table<N, TBT>::protection_type::readonly)
+            table.readonly();
+        else if (prot == key_table<N, TBT>::protection_type::noaccess)
+            table.noaccess();
+    }
+
+    // the shared master key of this kdf
+    const shared_key_type& key_handle() const noexcept { return master_; }
+
+  private:
+    shared_key_type master_;
+};
+
+template<std::size_t N>
+class kdf_cache
+{
+    /**
+     * A kdf_cache<N> keeps the most recently used subkeys of N bytes
+     * of a sodium::kdf, keyed by (context, subkey id), so that hot
+     * subkeys (e.g. of the busiest tenants) are derived only once.
+     *
+     * The cache holds at most capacity subkeys. Like
+     * box_precomputed_cache, it is split into shards, each with its
+     * own mutex and its own LRU list, so that concurrent lookups of
+     * different subkeys rarely contend. When a shard is full, its
+     * least recently used entry is evicted.
+     *
+     * The subkeys live in protected memory, and are zeroed when the
+     * last reference to them is gone.
+     *
+     * All member functions are thread-safe.
+     **/
+
+  public:
+    using kdf_type = kdf;
+    using context_type = kdf::context_type;
+    using subkey_id_type = kdf::subkey_id_type;
+    using subkey_type = key<N>;
+    using shared_subkey_type = shared_key<N>;
+
+    static_assert(N >= kdf::SUBKEYSIZE_MIN && N <= kdf::SUBKEYSIZE_MAX,
+                  "sodium::kdf_cache<N> wrong subkey size");
+
+    // the default number of shards
+    static constexpr std::size_t SHARDS = 16;
+
+    struct stats_type
+    {
+        std::size_t hits;      // get()s that found their subkey
+        std::size_t misses;    // get()s that had to derive it
+        std::size_t evictions; // entries dropped to make room
+        std::size_t size;      // entries currently in the cache
+    };
+
+    /**
+     * Create an empty cache of (about) capacity subkeys of kdf, split
+     * into shards shards. Every shard holds capacity / shards entries,
+     * rounded up.
+     *
+     * Throw a std::runtime_error if capacity or shards is 0.
+     **/
+
+    kdf_cache(const kdf_type& kdf,
+              const std::size_t capacity,
+              const std::size_t shards = SHARDS)
+      : kdf_(kdf)
+      , shard_capacity_{ shards != 0 ? (capacity + shards - 1) / shards : 0 }
+      , shards_(shards)
+    {
+        if (capacity == 0)
+            throw std::runtime_error{
+                "sodium::kdf_cache::kdf_cache() capacity is 0"
+            };
+        if (shards == 0)
+            throw std::runtime_error{
+                "sodium::kdf_cache::kdf_cache() shards is 0"
+            };
+    }
+
+    kdf_cache(const kdf_cache&) = delete;
+    kdf_cache& operator=(const kdf_cache&) = delete;
+
+    /**
+     * Return subkey subkey_id of context ctx, deriving and caching it
+     * first if it isn't in the cache yet. The returned subkey remains
+     * valid even after it has been evicted from the cache.
+     **/
+
+    shared_subkey_type get(subkey_id_type subkey_id, const context_type& ctx)
+    {
+        const index_type index{ subkey_id, ctx };
+        shard_type& shard = shard_of(index);
+
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.map.find(index);
+            if (it != shard.map.end()) {
+                ++shard.hits;
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                return it->second->second;
+            }
+            ++shard.misses;
+        }
+
+        // derive the subkey without holding the lock
+        auto subkey = make_shared_key(kdf_.derive<N>(subkey_id, ctx));
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(index);
+        if (it != shard.map.end()) {
+            // someone else was faster: keep theirs
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return it->second->second;
+        }
+
+        if (shard.map.size() >= shard_capacity_) {
+            shard.map.erase(shard.lru.back().first);
+            shard.lru.pop_back();
+            ++shard.evictions;
+        }
+        shard.lru.emplace_front(index, subkey);
+        shard.map.emplace(index, shard.lru.begin());
+
+        return subkey;
+    }
+
+    /**
+     * Evict subkey subkey_id of context ctx from the cache. Return
+     * true if it was in the cache.
+     **/
+
+    bool erase(subkey_id_type subkey_id, const context_type& ctx)
+    {
+        const index_type index{ subkey_id, ctx };
+        shard_type& shard = shard_of(index);
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(index);
+        if (it == shard.map.end())
+            return false;
+        shard.lru.erase(it->second);
+        shard.map.erase(it);
+        return true;
+    }
+
+    // evict all subkeys; the statistics are kept
+    void clear()
+    {
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.map.clear();
+            shard.lru.clear();
+        }
+    }
+
+    // a snapshot of the hit/miss statistics, summed over all shards
+    stats_type stats() const
+    {
+        stats_type result{ 0, 0, 0, 0 };
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            result.hits += shard.hits;
+            result.misses += shard.misses;
+            result.evictions += shard.evictions;
+            result.size += shard.map.size();
+        }
+        return result;
+    }
+
+    // the maximum number of subkeys in the cache
+    std::size_t capacity() const
+    {
+        return shard_capacity_ * shards_.size();
+    }
+
+  private:
+    struct index_type
+    {
+        subkey_id_type subkey_id;
+        context_type ctx;
+
+        bool operator==(const index_type& other) const noexcept
+        {
+            return subkey_id == other.subkey_id && ctx == other.ctx;
+        }
+    };
+
+    // subkey ids and contexts are not secret: mix them, no keyed hash
+    struct index_hash
+    {
+        std::size_t operator()(const index_type& index) const noexcept
+        {
+            std::uint64_t ctx;
+            std::memcpy(&ctx, index.ctx.data(), sizeof ctx);
+            std::uint64_t h = (index.subkey_id ^ ctx) * 0x9e3779b97f4a7c15ULL;
+            return static_cast<std::size_t>(h ^ (h >> 32));
+        }
+    };
+
+    using entry_type = std::pair<index_type, shared_subkey_type>;
+    using lru_type = std::list<entry_type>; // most recently used first
+
+    struct shard_type
+    {
+        mutable std::mutex mutex;
+        lru_type lru;
+        std::unordered_map<index_type, typename lru_type::iterator, index_hash>
+          map;
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+        std::size_t evictions = 0;
+    };
+
+    // use other bits of the hash than the hash map does
+    shard_type& shard_of(const index_type& index)
+    {
+        const std::size_t h = index_hash()(index);
+        return shards_[(h >> 16) % shards_.size()];
+    }
+
+    const kdf_type kdf_;
+    std::size_t shard_capacity_;
+    std::vector<shard_type> shards_;
+};
+
+} // namespace sodium
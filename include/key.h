@@ -20,8 +20,11 @@
 
 #include "allocator.h"
 #include "common.h"
+#include "metrics.h"
 #include "random.h"
+#include "trace.h"
 
+#include <memory>
 #include <string>
 #include <type_traits>
 #include <utility>
@@ -29,9 +32,6 @@
 
 #include <sodium.h>
 
-#ifndef NDEBUG
-#include <iostream>
-#endif // ! NDEBUG
 
 namespace sodium {
 
@@ -51,6 +51,7 @@ static constexpr std::size_t KEYSIZE_XCHACHA20 =
   crypto_stream_xchacha20_KEYBYTES;
 static constexpr std::size_t KEYSIZE_SALSA20 = crypto_stream_salsa20_KEYBYTES;
 static constexpr std::size_t KEYSIZE_XSALSA20 = crypto_stream_KEYBYTES;
+static constexpr std::size_t KEYSIZE_KDF = crypto_kdf_KEYBYTES;
 
 template<std::size_t KEYSZ = 0, typename BT = bytes_protected>
 class key
@@ -89,8 +90,9 @@ class key
     using byte_type =
       typename bytes_type::value_type; // e.g. byte (unsigned char)
 
-    // refuse to compile when not instantiating with bytes_protected
-    static_assert(std::is_same<bytes_type, bytes_protected>(),
+    // refuse to compile when not instantiating with protected memory
+    static_assert(std::is_same<bytes_type, bytes_protected>() ||
+                    std::is_same<bytes_type, bytes_pooled>(),
                   "key<> not in protected memory");
 
     // The strength of the key derivation efforts for setpass()
@@ -259,6 +261,24 @@ class key
                 };
         }
 
+        setpass(password, salt, strength_cpu, strength_mem);
+    }
+
+    /**
+     * Like setpass(password, salt, strength), but with explicit
+     * crypto_pwhash() limits, e.g. those picked by
+     * sodium::pwhash_service::calibrate().
+     *
+     * This function throws a std::runtime_error if the salt size
+     * doesn't make sense, or if crypto_pwhash() fails, e.g. because
+     * it runs out of memory or the limits are out of range.
+     **/
+
+    void setpass(const std::string& password,
+                 const bytes& salt,
+                 const unsigned long long opslimit,
+                 const std::size_t memlimit)
+    {
         // check salt length
         if (salt.size() != KEYSIZE_SALT)
             throw std::runtime_error{
@@ -267,13 +287,14 @@ class key
 
         // derive a key from the hash of the password, and store it!
         readwrite(); // temporarily unlock the key (if not already)
+        metrics::pwhash_timer timer;
         if (crypto_pwhash(keydata_.data(),
                           keydata_.size(),
                           password.data(),
                           password.size(),
                           salt.data(),
-                          strength_cpu,
-                          strength_mem,
+                          opslimit,
+                          memlimit,
                           crypto_pwhash_ALG_DEFAULT) != 0)
             throw std::runtime_error{
                 "sodium::key::setpass() crypto_pwhash()"
@@ -282,9 +303,9 @@ class key
     }
 
     /**
-     * Initialize, i.e. fill with random data generated with libsodium's
-     * function randombytes_buf() the number of bytes already allocated
-     * to this key upon construction.
+     * Initialize, i.e. fill with random data from the per-thread
+     * sodium::buffered_random generator (see random.h) the number of
+     * bytes already allocated to this key upon construction.
      *
      * You normally don't need to call this function yourself, as it is
      * called by key's constructor. It is provided as a public function
@@ -295,7 +316,7 @@ class key
      * or noaccess() on systems that enforce mprotect().
      **/
 
-    void initialize() { sodium::randombytes_buf_inplace(keydata_); }
+    void initialize() { sodium::randombytes_buf_buffered_inplace(keydata_); }
 
     /**
      * Destroy the bytes stored in protected memory of this key by
@@ -330,6 +351,11 @@ class key
      *
      * Note that the key bytes are still available, even when noaccess()
      * has been called. Restore access by calling readonly() or readwrite().
+     *
+     * Toggling noaccess() / readonly() around every use of a key costs
+     * two mprotect() syscalls each time: see sodium::pinned_key
+     * (pinned_key.h) for a cheaper way to keep a key noaccess() while
+     * it is idle.
      **/
 
     void noaccess() { keydata_.get_allocator().noaccess(keydata_.data()); }
@@ -358,32 +384,70 @@ class key
     bytes_type keydata_; // the bytes of the key are stored in protected memory
 };
 
+/**
+ * A sodium::shared_key<KEYSZ> is a reference-counted handle to an
+ * immutable, readonly() key.
+ *
+ * The symmetric wrappers (sodium::aead<>, sodium::secretbox<>,
+ * sodium::authenticator<>, sodium::secretstream<>) and everything
+ * built on them, e.g. the Boost.Iostreams filters, hold their key
+ * through a shared_key: copying a wrapper, or a filter that Boost.Iostreams
+ * copies into a chain, then copies a pointer, not the protected pages
+ * of the key. The key is zeroed and freed with its last handle.
+ *
+ * make_shared_key(std::move(k)) takes over the protected memory of k
+ * without allocating any; make_shared_key(k) copies k once.
+ **/
+
+template<std::size_t KEYSZ, typename BT = bytes_protected>
+using shared_key = std::shared_ptr<const key<KEYSZ, BT>>;
+
+template<std::size_t KEYSZ, typename BT>
+shared_key<KEYSZ, BT>
+make_shared_key(key<KEYSZ, BT>&& k)
+{
+    auto result = std::make_shared<key<KEYSZ, BT>>(std::move(k));
+    result->readonly();
+    return result;
+}
+
+template<std::size_t KEYSZ, typename BT>
+shared_key<KEYSZ, BT>
+make_shared_key(const key<KEYSZ, BT>& k)
+{
+    return make_shared_key(key<KEYSZ, BT>(k));
+}
+
 } // namespace sodium
 
-template<std::size_t KEYSIZE1, std::size_t KEYSIZE2>
+template<std::size_t KEYSIZE1,
+         std::size_t KEYSIZE2,
+         typename BT1,
+         typename BT2>
 bool
-operator==(const sodium::key<KEYSIZE1>& k1, const sodium::key<KEYSIZE2>& k2)
+operator==(const sodium::key<KEYSIZE1, BT1>& k1,
+           const sodium::key<KEYSIZE2, BT2>& k2)
 {
     // Don't do this (side channel attack):
     // std::equal(k1.data(), k1.data() + k1.size(),
     //            k2.data());
 
-#ifndef NDEBUG
-    std::cerr << "DEBUG: sodium::key::operator==() called" << std::endl;
-#endif // ! NDEBUG
+    SODIUM_TRACE("sodium::key::operator==()", "called");
 
     // compare two keys in constant time instead:
     return (k1.size() == k2.size()) &&
            (sodium_memcmp(k1.data(), k2.data(), k1.size()) == 0);
 }
 
-template<std::size_t KEYSIZE1, std::size_t KEYSIZE2>
+template<std::size_t KEYSIZE1,
+         std::size_t KEYSIZE2,
+         typename BT1,
+         typename BT2>
 bool
-operator!=(const sodium::key<KEYSIZE1>& k1, const sodium::key<KEYSIZE2>& k2)
+operator!=(const sodium::key<KEYSIZE1, BT1>& k1,
+           const sodium::key<KEYSIZE2, BT2>& k2)
 {
-#ifndef NDEBUG
-    std::cerr << "DEBUG: sodium::key::operator!=() called" << std::endl;
-#endif // ! NDEBUG
+    SODIUM_TRACE("sodium::key::operator!=()", "called");
 
     return (!(k1 == k2));
 }
\ No newline at end of file
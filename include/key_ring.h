@@ -0,0 +1,194 @@
+// key_ring.h -- Multi-key decryption during key rotation
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "span.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <stdexcept>
+#include <utility>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<typename C, typename ID = std::uint32_t>
+class key_ring
+{
+    /**
+     * A sodium::key_ring<C, ID> holds the K keys that are active
+     * during a key rotation, as cryptor objects C with span-based
+     * decrypt() members, i.e. sodium::aead<> or sodium::secretbox<>,
+     * each tagged with a key id of type ID.
+     *
+     * A ciphertext may have been encrypted with any of the active
+     * keys. decrypt() tries them in turn, starting with the key whose
+     * id the sender sent along as a hint, and stops at the first one
+     * that authenticates the message:
+     *
+     *   sodium::key_ring<sodium::aead<>> ring;
+     *   ring.add(7, sodium::aead<>(key7));
+     *   ring.add(8, sodium::aead<>(key8));  // the newest, for encrypt()
+     *
+     *   std::uint32_t id = id_from_header;   // the hint, and the match
+     *   if (ring.decrypt(id, plaintext, header, ciphertext, nonce) != 0)
+     *       reject(); // no active key authenticates the message
+     *
+     * Unlike a loop around the throwing decrypt() members, the failure
+     * path never throws and never allocates: every trial writes into
+     * the same caller-owned plaintext span. A failed trial doesn't
+     * leave any plaintext behind (the MAC is verified before
+     * decrypting), and plaintext is zeroed if no key matches.
+     *
+     * The MAC verifications are constant-time. The number of trials,
+     * which is visible from the outside, only depends on the position
+     * of the matching key relative to the (public) hint, not on the
+     * keys or the message.
+     *
+     * Keys are added and removed by the owner; decrypt() can be
+     * called concurrently as long as the ring isn't modified.
+     **/
+
+  public:
+    using cryptor_type = C;
+    using id_type = ID;
+
+    key_ring() = default;
+
+    key_ring(const key_ring&) = delete;
+    key_ring& operator=(const key_ring&) = delete;
+
+    // the number of active keys
+    std::size_t size() const noexcept { return entries_.size(); }
+    bool empty() const noexcept { return entries_.empty(); }
+
+    /**
+     * Add cryptor under key id id. It becomes the newest key, which
+     * is tried first in the absence of a matching hint, and which is
+     * returned by newest().
+     *
+     * Throws std::runtime_error if id is already in the ring.
+     **/
+
+    void add(const ID& id, C cryptor)
+    {
+        if (find(id) != nullptr)
+            throw std::runtime_error{ "sodium::key_ring::add() duplicate id" };
+
+        entries_.push_front(entry_type{ id, std::move(cryptor) });
+    }
+
+    /**
+     * Remove the key with id id, destroying (and wiping) its cryptor.
+     * Return false if there was no such key.
+     **/
+
+    bool remove(const ID& id)
+    {
+        for (auto it = entries_.begin(); it != entries_.end(); ++it)
+            if (it->id == id) {
+                entries_.erase(it);
+                return true;
+            }
+        return false;
+    }
+
+    // the cryptor of key id id, or nullptr
+    C* find(const ID& id) noexcept
+    {
+        for (auto& e : entries_)
+            if (e.id == id)
+                return &e.cryptor;
+        return nullptr;
+    }
+
+    /**
+     * The id and the cryptor of the newest key, to encrypt() with.
+     *
+     * Throws std::runtime_error if the ring is empty.
+     **/
+
+    const ID& newest_id() const
+    {
+        check_not_empty();
+        return entries_.front().id;
+    }
+
+    C& newest()
+    {
+        check_not_empty();
+        return entries_.front().cryptor;
+    }
+
+    /**
+     * Decrypt with the first key that authenticates the message,
+     * trying the key with id id first, then all the others from the
+     * newest to the oldest.
+     *
+     * args are the arguments of C's span-based decrypt() after the
+     * plaintext span, e.g. (header, ciphertext_with_mac, nonce) for
+     * sodium::aead<>, or (ciphertext_with_mac, nonce) for
+     * sodium::secretbox<>; the detached variants work too.
+     *
+     * On success, return 0 and set id to the id of the matching key.
+     * On failure, return -1 and zero plaintext; id is left unchanged.
+     **/
+
+    template<typename... Args>
+    int decrypt(ID& id, span<byte> plaintext, const Args&... args) noexcept
+    {
+        entry_type* hinted = nullptr;
+        for (auto& e : entries_)
+            if (e.id == id) {
+                hinted = &e;
+                if (e.cryptor.decrypt(plaintext, args...) == 0)
+                    return 0;
+                break;
+            }
+
+        for (auto& e : entries_)
+            if (&e != hinted && e.cryptor.decrypt(plaintext, args...) == 0) {
+                id = e.id;
+                return 0;
+            }
+
+        sodium_memzero(plaintext.data(), plaintext.size());
+        return -1;
+    }
+
+  private:
+    struct entry_type
+    {
+        ID id;
+        C cryptor;
+    };
+
+    void check_not_empty() const
+    {
+        if (entries_.empty())
+            throw std::runtime_error{ "sodium::key_ring::newest() empty ring" };
+    }
+
+    // a list, as the cryptors can't be assigned to; newest first
+    std::list<entry_type> entries_;
+};
+
+} // namespace sodium
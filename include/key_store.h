@@ -0,0 +1,536 @@
+// key_store.h -- Memory-mapped store of wrapped keys, unwrapped lazily
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "common.h"
+#include "key.h"
+#include "key_table.h"
+#include "nonce.h"
+#include "span.h"
+#include "thread_pool.h"
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * The key store format
+ * --------------------
+ *
+ * A key store file holds n keys of KEYSZ bytes each, every one of them
+ * wrapped (encrypted) with XChaCha20-Poly1305-IETF under a single
+ * wrapping key, and identified by a 64-bit key id. All integers are
+ * little-endian.
+ *
+ *   header   = "SWKS" || version (1) || 0 (3) || LE32(KEYSZ)
+ *              || LE32(0) || LE64(n)
+ *
+ *   index    = LE64(id_0) || ... || LE64(id_n-1)     (ascending)
+ *
+ *   record_i = nonce_i || AEAD_encrypt(wrapping key, nonce_i,
+ *                                      AD = header || LE64(id_i),
+ *                                      key_i)
+ *
+ * The index and the records are arrays of fixed-size entries, so that
+ * the record of id_i starts at HEADERSIZE + n * 8 + i * RECORDSIZE:
+ * finding a key is a binary search in the index, and no part of the
+ * file has to be parsed when opening it. Binding the header and the
+ * key id into the AD of every record detects records that have been
+ * swapped, or moved from another store.
+ **/
+
+namespace key_store_detail {
+
+constexpr unsigned char MAGIC[4] = { 'S', 'W', 'K', 'S' };
+constexpr unsigned char VERSION = 1;
+constexpr std::size_t HEADERSIZE = 24;
+constexpr std::size_t IDSIZE = 8;
+
+inline void
+store_le(unsigned char* out, std::uint64_t value, std::size_t size) noexcept
+{
+    for (std::size_t i = 0; i != size; ++i)
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+inline std::uint64_t
+load_le(const unsigned char* in, std::size_t size) noexcept
+{
+    std::uint64_t result = 0;
+    for (std::size_t i = 0; i != size; ++i)
+        result |= static_cast<std::uint64_t>(in[i]) << (8 * i);
+    return result;
+}
+
+/**
+ * A read-only mapping of a whole key store file.
+ **/
+
+class mapped_file
+{
+  public:
+    explicit mapped_file(const std::string& path)
+    {
+        try {
+            file_.open(path);
+        } catch (const std::exception&) {
+        }
+        if (!file_.is_open())
+            throw std::runtime_error{
+                "sodium::key_store::key_store() can't map " + path
+            };
+    }
+
+    const unsigned char* data() const noexcept
+    {
+        return reinterpret_cast<const unsigned char*>(file_.data());
+    }
+    std::size_t size() const noexcept { return file_.size(); }
+
+  private:
+    boost::iostreams::mapped_file_source file_;
+};
+
+} // namespace key_store_detail
+
+template<std::size_t KEYSZ, typename BT = bytes_protected>
+class key_store
+{
+    /**
+     * A sodium::key_store<KEYSZ> gives access to the keys of a key
+     * store file (see the format above), without reading them all at
+     * startup.
+     *
+     * Constructing a key_store maps the file read-only and checks its
+     * header and size; it neither reads the index nor unwraps a single
+     * key, and it makes one protected allocation, the
+     * sodium::key_table<KEYSZ, BT> that will hold the unwrapped keys.
+     * Opening a store of a million keys thus costs about as much as
+     * opening a store of one key, instead of a million allocations of
+     * sodium::key<KEYSZ> and a million decryptions.
+     *
+     * A key is unwrapped into its slot of the table when it is looked
+     * up for the first time, and served from there afterwards: the
+     * fast path of lookup() is a binary search in the mapped index
+     * and an atomic load. prewarm() unwraps all keys not yet in the
+     * table, either in the calling thread or in the background on a
+     * sodium::thread_pool, so that later lookups don't pay for it.
+     *
+     * The wrapped keys never leave the mapped file, and the unwrapped
+     * ones never leave the (mlock()ed, readonly()) table, except for
+     * the copies returned by get().
+     *
+     * lookup(), get() and prewarm() may be called concurrently from
+     * many threads. Unwrapping is serialized, since it makes the
+     * whole table readwrite() for a moment; the spans returned by
+     * lookup() stay valid during that time and until the key_store
+     * is destroyed.
+     **/
+
+  public:
+    using id_type = std::uint64_t;
+    using key_type = key<KEYSZ>;
+    using table_type = key_table<KEYSZ, BT>;
+    using wrapper_type = aead<bytes, aead_xchacha20_poly1305_ietf>;
+    using wrapping_key_type = typename wrapper_type::key_type;
+
+    static constexpr std::size_t KEYSIZE = KEYSZ;
+    static constexpr std::size_t HEADERSIZE = key_store_detail::HEADERSIZE;
+    static constexpr std::size_t NONCESIZE = wrapper_type::NONCESIZE;
+    static constexpr std::size_t MACSIZE = wrapper_type::MACSIZE;
+    static constexpr std::size_t RECORDSIZE = NONCESIZE + KEYSZ + MACSIZE;
+
+    // returned by index_of() for unknown key ids
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    // keys unwrapped per lock of the table in prewarm()
+    static constexpr std::size_t PREWARM_BATCH = 4096;
+
+    /**
+     * Write a key store with the keys of table to os: the key in slot
+     * i gets the key id ids[i]. The records are sorted by key id.
+     *
+     * Throw a std::runtime_error if the sizes of ids and table don't
+     * match, if a key id occurs more than once, or if os fails.
+     **/
+
+    template<typename TBT>
+    static void write(std::ostream& os,
+                      const wrapping_key_type& wrapping_key,
+                      const std::vector<id_type>& ids,
+                      const key_table<KEYSZ, TBT>& table)
+    {
+        using namespace key_store_detail;
+
+        if (ids.size() != table.size())
+            throw std::runtime_error{
+                "sodium::key_store::write() ids and table size mismatch"
+            };
+
+        std::vector<std::size_t> order(ids.size());
+        std::iota(order.begin(), order.end(), std::size_t{ 0 });
+        std::sort(order.begin(),
+                  order.end(),
+                  [&ids](std::size_t a, std::size_t b) {
+                      return ids[a] < ids[b];
+                  });
+        for (std::size_t i = 1; i < order.size(); ++i)
+            if (ids[order[i - 1]] == ids[order[i]])
+                throw std::runtime_error{
+                    "sodium::key_store::write() duplicate key id"
+                };
+
+        const bytes header = make_header(ids.size());
+        os.write(reinterpret_cast<const char*>(header.data()),
+                 header.size());
+
+        unsigned char le[IDSIZE];
+        for (std::size_t i : order) {
+            store_le(le, ids[i], IDSIZE);
+            os.write(reinterpret_cast<const char*>(le), IDSIZE);
+        }
+
+        const wrapper_type wrapper(wrapping_key);
+        bytes ad(header);
+        ad.resize(HEADERSIZE + IDSIZE);
+        bytes record(RECORDSIZE);
+
+        for (std::size_t i : order) {
+            const typename wrapper_type::nonce_type nonce;
+            std::copy(nonce.data(), nonce.data() + NONCESIZE, record.data());
+            store_le(ad.data() + HEADERSIZE, ids[i], IDSIZE);
+
+            span<byte> wrapped(record.data() + NONCESIZE, KEYSZ + MACSIZE);
+            if (wrapper.encrypt(wrapped, ad, table[i], nonce) != 0)
+                throw std::runtime_error{
+                    "sodium::key_store::write() can't wrap key"
+                };
+            os.write(reinterpret_cast<const char*>(record.data()),
+                     record.size());
+        }
+
+        if (!os)
+            throw std::runtime_error{
+                "sodium::key_store::write() can't write key store"
+            };
+    }
+
+    // Same as write(os, ...), into the file at path
+    template<typename TBT>
+    static void write(const std::string& path,
+                      const wrapping_key_type& wrapping_key,
+                      const std::vector<id_type>& ids,
+                      const key_table<KEYSZ, TBT>& table)
+    {
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        if (!ofs)
+            throw std::runtime_error{
+                "sodium::key_store::write() can't open file"
+            };
+        write(ofs, wrapping_key, ids, table);
+    }
+
+    /**
+     * Open the key store at path, whose keys have been wrapped with
+     * wrapping_key. O(1) in the number of keys, except for allocating
+     * and zeroing the table and one status byte per key.
+     *
+     * Throw a std::runtime_error if the file can't be mapped, if it
+     * isn't a key store of KEYSZ byte keys, or if its size doesn't
+     * match the number of keys in its header.
+     **/
+
+    key_store(const std::string& path, const wrapping_key_type& wrapping_key)
+      : file_(path)
+      , size_{ check_header(file_) }
+      , ids_{ file_.data() + HEADERSIZE }
+      , records_{ ids_ + size_ * key_store_detail::IDSIZE }
+      , wrapper_(wrapping_key)
+      , table_(size_, false)
+      , state_(new std::atomic<unsigned char>[size_]())
+      , materialized_{ 0 }
+      , stop_{ false }
+    {}
+
+    // waits for a background prewarm() to stop
+    ~key_store()
+    {
+        stop_.store(true, std::memory_order_relaxed);
+        if (prewarm_.valid())
+            prewarm_.wait();
+    }
+
+    key_store(const key_store&) = delete;
+    key_store& operator=(const key_store&) = delete;
+
+    // the number of keys in the store
+    std::size_t size() const noexcept { return size_; }
+
+    // the key id of record i, in ascending order; i must be < size()
+    id_type id(std::size_t i) const noexcept
+    {
+        return key_store_detail::load_le(
+          ids_ + i * key_store_detail::IDSIZE, key_store_detail::IDSIZE);
+    }
+
+    /**
+     * Return the record index of key id, or npos if the store has no
+     * such key. O(log size()), reading only the mapped index.
+     **/
+
+    std::size_t index_of(id_type key_id) const noexcept
+    {
+        std::size_t lo = 0;
+        std::size_t hi = size_;
+        while (lo < hi) {
+            const std::size_t mid = lo + (hi - lo) / 2;
+            if (id(mid) < key_id)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return (lo < size_ && id(lo) == key_id) ? lo : npos;
+    }
+
+    bool contains(id_type key_id) const noexcept
+    {
+        return index_of(key_id) != npos;
+    }
+
+    /**
+     * Return the KEYSZ bytes of key id in the table, unwrapping them
+     * first if this is the first lookup of key id.
+     *
+     * Throw a std::runtime_error if the store has no such key, or if
+     * its record has been tampered with (or the wrapping key is
+     * wrong).
+     **/
+
+    span<const byte> lookup(id_type key_id)
+    {
+        const std::size_t i = index_of(key_id);
+        if (i == npos)
+            throw std::runtime_error{
+                "sodium::key_store::lookup() unknown key id"
+            };
+        if (!materialized_at(i) && !materialize(i))
+            throw std::runtime_error{
+                "sodium::key_store::lookup() can't unwrap key"
+            };
+        return table_[i];
+    }
+
+    // Same as lookup(), but return a copy of the key
+    key_type get(id_type key_id)
+    {
+        const span<const byte> k = lookup(key_id);
+
+        key_type result(false);
+        std::copy(k.begin(), k.end(), result.setdata());
+        result.readonly();
+        return result;
+    }
+
+    // has key id already been unwrapped?
+    bool materialized(id_type key_id) const noexcept
+    {
+        const std::size_t i = index_of(key_id);
+        return i != npos && materialized_at(i);
+    }
+
+    // the number of keys unwrapped so far
+    std::size_t materialized_count() const noexcept
+    {
+        return materialized_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Unwrap all keys that haven't been unwrapped yet, in batches of
+     * PREWARM_BATCH keys, so that concurrent lookups of other keys
+     * don't wait for the whole store. Records that fail to unwrap are
+     * skipped: looking them up will throw.
+     *
+     * Return the number of keys unwrapped by this call.
+     **/
+
+    std::size_t prewarm()
+    {
+        std::size_t count = 0;
+        std::size_t i = 0;
+        while (i < size_ && !stop_.load(std::memory_order_relaxed)) {
+            const std::size_t end = std::min(size_, i + PREWARM_BATCH);
+            std::lock_guard<std::mutex> lock(mutex_);
+            writable w(table_);
+            for (; i != end; ++i)
+                if (!materialized_at(i) && unwrap_locked(i))
+                    ++count;
+        }
+        return count;
+    }
+
+    /**
+     * Run prewarm() in the background, on pool. Only one background
+     * prewarm() runs at a time: a second call waits for the first one.
+     * The destructor stops it between two batches.
+     **/
+
+    void prewarm(thread_pool& pool)
+    {
+        if (prewarm_.valid())
+            prewarm_.wait();
+        prewarm_ = pool.submit([this] { return prewarm(); });
+    }
+
+    // wait for the background prewarm(), if any; rethrow its exception
+    std::size_t wait_prewarm()
+    {
+        return prewarm_.valid() ? prewarm_.get() : 0;
+    }
+
+  private:
+    // make the table readwrite() for the lifetime of this object
+    class writable
+    {
+      public:
+        explicit writable(table_type& table)
+          : table_{ table }
+        {
+            table_.readwrite();
+        }
+        ~writable() { table_.readonly(); }
+
+        writable(const writable&) = delete;
+        writable& operator=(const writable&) = delete;
+
+      private:
+        table_type& table_;
+    };
+
+    static bytes make_header(std::uint64_t n)
+    {
+        using namespace key_store_detail;
+
+        bytes header(HEADERSIZE, 0);
+        std::copy(MAGIC, MAGIC + sizeof MAGIC, header.data());
+        header[4] = VERSION;
+        store_le(header.data() + 8, KEYSZ, 4);
+        store_le(header.data() + 16, n, 8);
+        return header;
+    }
+
+    // return the number of keys of file, after checking its header
+    static std::size_t check_header(const key_store_detail::mapped_file& file)
+    {
+        using namespace key_store_detail;
+
+        const unsigned char* p = file.data();
+        if (file.size() < HEADERSIZE ||
+            !std::equal(MAGIC, MAGIC + sizeof MAGIC, p) || p[4] != VERSION)
+            throw std::runtime_error{
+                "sodium::key_store::key_store() not a key store"
+            };
+        if (load_le(p + 8, 4) != KEYSZ)
+            throw std::runtime_error{
+                "sodium::key_store::key_store() wrong key size"
+            };
+
+        const std::uint64_t n = load_le(p + 16, 8);
+        const std::uint64_t entry = IDSIZE + RECORDSIZE;
+        if (n > (file.size() - HEADERSIZE) / entry ||
+            file.size() != HEADERSIZE + n * entry)
+            throw std::runtime_error{
+                "sodium::key_store::key_store() wrong file size"
+            };
+        return static_cast<std::size_t>(n);
+    }
+
+    bool materialized_at(std::size_t i) const noexcept
+    {
+        return state_[i].load(std::memory_order_acquire) != 0;
+    }
+
+    bool materialize(std::size_t i)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (materialized_at(i))
+            return true;
+        writable w(table_);
+        return unwrap_locked(i);
+    }
+
+    // unwrap record i into its slot; mutex_ held, table_ readwrite()
+    bool unwrap_locked(std::size_t i) noexcept
+    {
+        using namespace key_store_detail;
+
+        unsigned char ad[HEADERSIZE + IDSIZE];
+        std::copy(file_.data(), file_.data() + HEADERSIZE, ad);
+        std::copy(ids_ + i * IDSIZE, ids_ + (i + 1) * IDSIZE, ad + HEADERSIZE);
+
+        const unsigned char* record = records_ + i * RECORDSIZE;
+        const typename wrapper_type::nonce_type nonce(record);
+
+        if (wrapper_.decrypt(span<byte>(table_.setdata(i), KEYSZ),
+                             span<const byte>(ad, sizeof ad),
+                             span<const byte>(record + NONCESIZE,
+                                              KEYSZ + MACSIZE),
+                             nonce) != 0) {
+            sodium_memzero(table_.setdata(i), KEYSZ);
+            return false;
+        }
+
+        state_[i].store(1, std::memory_order_release);
+        materialized_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    const key_store_detail::mapped_file file_;
+    const std::size_t size_;
+    const unsigned char* const ids_;
+    const unsigned char* const records_;
+    const wrapper_type wrapper_;
+
+    table_type table_;
+    std::unique_ptr<std::atomic<unsigned char>[]> state_;
+    std::atomic<std::size_t> materialized_;
+
+    std::mutex mutex_; // serializes unwrapping
+    std::atomic<bool> stop_;
+    std::future<std::size_t> prewarm_;
+};
+
+} // namespace sodium
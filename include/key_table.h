@@ -0,0 +1,285 @@
+// key_table.h -- Many keys of the same size in one protected region
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h"
+#include "random.h"
+#include "span.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<std::size_t KEYSZ, typename BT = bytes_protected>
+class key_table
+{
+    /**
+     * A sodium::key_table<KEYSZ> stores many keys of KEYSZ bytes back
+     * to back, in a single region of protected memory.
+     *
+     * Each sodium::key<KEYSZ> has its own bytes_protected buffer, i.e.
+     * its own mapping with guard pages: a million keys are a million
+     * mappings (far above the default vm.max_map_count), and looking
+     * up key #i touches a page of its own every time. In a key_table,
+     * the keys share the guard pages, mlock() and the protection of
+     * the whole region, and key #i is at data(i) == data(0) + i*KEYSZ.
+     *
+     * With BT = bytes_hugepage, a big table also lives on (NUMA-local)
+     * huge pages, i.e. needs only a handful of TLB entries.
+     *
+     * Protection is all or nothing: readonly(), noaccess() and
+     * readwrite() apply to the whole table. The table is readonly()
+     * after construction, and the functions that modify a slot make it
+     * temporarily readwrite(), then restore its previous protection.
+     *
+     * A key_table is neither copyable nor movable: hand out references
+     * to it, or the spans of its slots.
+     **/
+
+  public:
+    using bytes_type = BT;
+    using byte_type = typename bytes_type::value_type;
+    using key_type = key<KEYSZ>;
+
+    // refuse to compile when not instantiating with protected memory
+    static_assert(std::is_same<bytes_type, bytes_protected>() ||
+                    std::is_same<bytes_type, bytes_pooled>() ||
+                    std::is_same<bytes_type, bytes_hugepage>(),
+                  "key_table<> not in protected memory");
+
+    static_assert(KEYSZ > 0, "key_table<> of empty keys");
+
+    static constexpr std::size_t KEYSIZE = KEYSZ;
+
+    enum class protection_type
+    {
+        readwrite,
+        readonly,
+        noaccess
+    };
+
+    /**
+     * Construct a table of n keys. If init is true, fill every slot
+     * with random bytes, else zero them all. Either way, the table is
+     * readonly() afterwards.
+     **/
+
+    explicit key_table(std::size_t n, bool init = true)
+      : keydata_(n * KEYSZ)
+      , size_{ n }
+      , prot_{ protection_type::readwrite }
+    {
+        if (n != 0 && keydata_.size() / n != KEYSZ)
+            throw std::runtime_error{
+                "sodium::key_table::key_table() too many keys"
+            };
+
+        if (init)
+            sodium::randombytes_buf_buffered_inplace(keydata_);
+        else
+            sodium_memzero(keydata_.data(), keydata_.size());
+        readonly();
+    }
+
+    key_table(const key_table&) = delete;
+    key_table& operator=(const key_table&) = delete;
+
+    // the number of slots
+    std::size_t size() const noexcept { return size_; }
+
+    /**
+     * O(1) access to the KEYSZ bytes of slot i, like key::data().
+     * No bounds checking: i must be less than size().
+     **/
+
+    const byte_type* data(std::size_t i) const noexcept
+    {
+        return keydata_.data() + i * KEYSZ;
+    }
+
+    span<const byte_type> operator[](std::size_t i) const noexcept
+    {
+        return span<const byte_type>(data(i), KEYSZ);
+    }
+
+    /**
+     * Mutable access to slot i, like key::setdata(). It is the
+     * responsibility of the caller to make the table readwrite()
+     * before writing through the returned pointer, and to write no
+     * more than KEYSZ bytes.
+     **/
+
+    byte_type* setdata(std::size_t i) noexcept
+    {
+        return keydata_.data() + i * KEYSZ;
+    }
+
+    /**
+     * Return a copy of slot i as a sodium::key<KEYSZ>, e.g. to
+     * construct a sodium::secretbox<> with it.
+     *
+     * Throw a std::runtime_error if i is out of range, or if the
+     * table is noaccess().
+     **/
+
+    key_type get(std::size_t i) const
+    {
+        check_index(i, "sodium::key_table::get() index out of range");
+        if (prot_ == protection_type::noaccess)
+            throw std::runtime_error{ "sodium::key_table::get() noaccess" };
+
+        key_type result(false);
+        std::memcpy(result.setdata(), data(i), KEYSZ);
+        result.readonly();
+        return result;
+    }
+
+    /**
+     * Store the bytes of k into slot i.
+     *
+     * Throw a std::runtime_error if i is out of range.
+     **/
+
+    template<typename KBT>
+    void set(std::size_t i, const key<KEYSZ, KBT>& k)
+    {
+        check_index(i, "sodium::key_table::set() index out of range");
+
+        writable w(*this);
+        std::memcpy(setdata(i), k.data(), KEYSZ);
+    }
+
+    /**
+     * Fill slot i with fresh random bytes.
+     *
+     * Throw a std::runtime_error if i is out of range.
+     **/
+
+    void initialize(std::size_t i)
+    {
+        check_index(i, "sodium::key_table::initialize() index out of range");
+
+        writable w(*this);
+        sodium::buffered_random::fill(setdata(i), KEYSZ);
+    }
+
+    /**
+     * Securely erase slot i, i.e. sodium_memzero() its bytes,
+     * whatever the current protection of the table.
+     *
+     * Throw a std::runtime_error if i is out of range.
+     **/
+
+    void destroy(std::size_t i)
+    {
+        check_index(i, "sodium::key_table::destroy() index out of range");
+
+        writable w(*this);
+        sodium_memzero(setdata(i), KEYSZ);
+    }
+
+    // erase all the slots (think: Panic Button)
+    void destroy()
+    {
+        writable w(*this);
+        sodium_memzero(keydata_.data(), keydata_.size());
+    }
+
+    /**
+     * Return true if slot i has been destroy()ed (or holds only zero
+     * bytes), in constant time. The table must not be noaccess().
+     **/
+
+    bool empty(std::size_t i) const noexcept
+    {
+        return sodium_is_zero(data(i), KEYSZ) == 1;
+    }
+
+    /**
+     * Change the protection of the whole table at once, with a single
+     * mprotect() call.
+     **/
+
+    void noaccess()
+    {
+        keydata_.get_allocator().noaccess(keydata_.data());
+        prot_ = protection_type::noaccess;
+    }
+
+    void readonly()
+    {
+        keydata_.get_allocator().readonly(keydata_.data());
+        prot_ = protection_type::readonly;
+    }
+
+    void readwrite()
+    {
+        keydata_.get_allocator().readwrite(keydata_.data());
+        prot_ = protection_type::readwrite;
+    }
+
+    protection_type protection() const noexcept { return prot_; }
+
+  private:
+    // make the table readwrite() for the lifetime of this object
+    class writable
+    {
+      public:
+        explicit writable(key_table& table)
+          : table_{ table }
+          , prot_{ table.prot_ }
+        {
+            if (prot_ != protection_type::readwrite)
+                table_.readwrite();
+        }
+
+        ~writable()
+        {
+            if (prot_ == protection_type::readonly)
+                table_.readonly();
+            else if (prot_ == protection_type::noaccess)
+                table_.noaccess();
+        }
+
+        writable(const writable&) = delete;
+        writable& operator=(const writable&) = delete;
+
+      private:
+        key_table& table_;
+        const protection_type prot_;
+    };
+
+    void check_index(std::size_t i, const char* message) const
+    {
+        if (i >= size_)
+            throw std::runtime_error{ message };
+    }
+
+    bytes_type keydata_;
+    const std::size_t size_;
+    protection_type prot_;
+};
+
+} // namespace sodium
@@ -160,6 +160,42 @@ class keypair
         private_key_.readonly();
     }
 
+    /**
+     * Construct a keypair from a previously calculated private key AND
+     * its public key, without deriving the public key again. This is
+     * for keys that have been generated in bulk (see
+     * sodium::keypair_pool<>), where crypto_scalarmult_base() has
+     * already been paid for.
+     *
+     * The caller MUST make sure that both keys belong together.
+     * Providing keys of wrong size will throw a std::runtime_error.
+     *
+     * Otherwise, see keypair(private_key_data, private_key_size).
+     **/
+
+    keypair(const byte* private_key_data,
+            const std::size_t private_key_size,
+            const byte* public_key_data,
+            const std::size_t public_key_size)
+      : public_key_(KEYSIZE_PUBLIC_KEY, '\0')
+      , private_key_(false)
+    {
+        if (private_key_size != KEYSIZE_PRIVATE_KEY ||
+            public_key_size != KEYSIZE_PUBLIC_KEY)
+            throw std::runtime_error{
+                "sodium::keypair::keypair(private_key_data, ..., "
+                "public_key_data, ...) wrong key size"
+            };
+        std::copy(private_key_data,
+                  private_key_data + private_key_size,
+                  private_key_.setdata());
+        std::copy(public_key_data,
+                  public_key_data + public_key_size,
+                  public_key_.begin());
+
+        private_key_.readonly();
+    }
+
     /**
      * Copy and move constructors
      **/
@@ -0,0 +1,318 @@
+// keypair_pool.h -- A background-refilled pool of pregenerated keypairs
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key_table.h"
+#include "keypair.h"
+#include "keypairsign.h"
+#include "span.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * How a sodium::keypair_pool<KP> generates and hands out a KP.
+ *
+ * generate() writes a fresh random public key / private key pair
+ * into caller-provided buffers of KP::KEYSIZE_PUBLIC_KEY and
+ * KP::KEYSIZE_PRIVATE_KEY bytes.
+ *
+ * make() constructs a KP from such a pair without deriving the public
+ * key again.
+ **/
+
+template<typename KP>
+struct keypair_pool_traits;
+
+template<typename PK, typename SEED_TYPE, typename T>
+struct keypair_pool_traits<keypair<PK, SEED_TYPE, T>>
+{
+    using keypair_type = keypair<PK, SEED_TYPE, T>;
+
+    static void generate(byte* public_key, byte* private_key) noexcept
+    {
+        crypto_box_keypair(public_key, private_key);
+    }
+
+    static keypair_type make(const byte* public_key, const byte* private_key)
+    {
+        return keypair_type(private_key,
+                            keypair_type::KEYSIZE_PRIVATE_KEY,
+                            public_key,
+                            keypair_type::KEYSIZE_PUBLIC_KEY);
+    }
+};
+
+template<typename PK, typename SEED_TYPE, typename T>
+struct keypair_pool_traits<keypairsign<PK, SEED_TYPE, T>>
+{
+    using keypair_type = keypairsign<PK, SEED_TYPE, T>;
+
+    static void generate(byte* public_key, byte* private_key) noexcept
+    {
+        crypto_sign_keypair(public_key, private_key);
+    }
+
+    // an Ed25519 private key ends with its public key: copying is cheap
+    static keypair_type make(const byte*, const byte* private_key)
+    {
+        return keypair_type(private_key, keypair_type::KEYSIZE_PRIVATE_KEY);
+    }
+};
+
+template<typename KP = keypair<>>
+class keypair_pool
+{
+    /**
+     * A sodium::keypair_pool<KP> keeps between low and high watermark
+     * pregenerated keypairs of type KP (sodium::keypair<> for
+     * crypto_box, sodium::keypairsign<> for crypto_sign), so that
+     * protocols with ephemeral keys pop() a ready keypair in O(1)
+     * instead of paying for crypto_box_keypair() at connection setup.
+     *
+     * The pool is filled up to the high watermark by the constructor.
+     * Whenever pop()s take it below the low watermark, a background
+     * thread refills it up to the high watermark again. If the pool
+     * happens to be empty, pop() generates a keypair synchronously,
+     * and counts a miss().
+     *
+     * All the keypairs live back to back in a single sodium::key_table,
+     * i.e. in ONE region of protected memory, instead of one mapping
+     * per private key: each slot holds the private key followed by
+     * its public key. As the pool writes into the table all the time,
+     * the table stays readwrite() (but guarded and mlock()ed) for the
+     * lifetime of the pool. A popped slot is wiped at once, and the
+     * whole table when the pool is destroyed.
+     *
+     * The slots form a ring: pop() takes from the front under a mutex,
+     * while the refill thread generates into the free slots at the
+     * back without holding it, then publishes them in one go.
+     *
+     * A keypair_pool is neither copyable nor movable.
+     **/
+
+    using traits_type = keypair_pool_traits<KP>;
+
+  public:
+    using keypair_type = KP;
+
+    static constexpr std::size_t KEYSIZE_PUBLIC_KEY = KP::KEYSIZE_PUBLIC_KEY;
+    static constexpr std::size_t KEYSIZE_PRIVATE_KEY = KP::KEYSIZE_PRIVATE_KEY;
+    static constexpr std::size_t SLOTSIZE =
+      KEYSIZE_PRIVATE_KEY + KEYSIZE_PUBLIC_KEY;
+
+    /**
+     * Create a pool that holds up to high pregenerated keypairs, and
+     * is refilled in the background when it holds fewer than low.
+     * A low watermark of 0 disables the refills.
+     *
+     * Throw a std::runtime_error if high is 0 or less than low.
+     **/
+
+    keypair_pool(std::size_t low, std::size_t high)
+      : table_(check_watermarks(low, high), false)
+      , low_{ low }
+      , head_{ 0 }
+      , count_{ 0 }
+      , misses_{ 0 }
+      , refilling_{ false }
+      , done_{ false }
+    {
+        table_.readwrite();
+        refill();
+        if (low_ != 0)
+            refiller_ = std::thread([this] { work(); });
+    }
+
+    keypair_pool(const keypair_pool&) = delete;
+    keypair_pool& operator=(const keypair_pool&) = delete;
+
+    ~keypair_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cv_.notify_all();
+        if (refiller_.joinable())
+            refiller_.join();
+        table_.destroy();
+    }
+
+    /**
+     * Pop a pregenerated keypair, or generate one synchronously if the
+     * pool is empty.
+     **/
+
+    keypair_type pop()
+    {
+        bytes_protected slot(SLOTSIZE);
+        if (pop(span<byte>(slot.data(), KEYSIZE_PUBLIC_KEY),
+                span<byte>(slot.data() + KEYSIZE_PUBLIC_KEY,
+                           KEYSIZE_PRIVATE_KEY)) != 0) {
+            traits_type::generate(slot.data(),
+                                  slot.data() + KEYSIZE_PUBLIC_KEY);
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++misses_;
+        }
+        return traits_type::make(slot.data(),
+                                 slot.data() + KEYSIZE_PUBLIC_KEY);
+    }
+
+    /**
+     * Allocation-free version of pop(): copy a pregenerated keypair
+     * into public_key and private_key, which must be exactly
+     * KEYSIZE_PUBLIC_KEY resp. KEYSIZE_PRIVATE_KEY bytes long (e.g.
+     * the setdata() of a key, or a slot of a key_table).
+     *
+     * Return 0 on success, or -1 if the sizes are wrong or if the pool
+     * is empty. Unlike pop(), this never generates a keypair itself.
+     **/
+
+    int pop(span<byte> public_key, span<byte> private_key) noexcept
+    {
+        if (public_key.size() != KEYSIZE_PUBLIC_KEY ||
+            private_key.size() != KEYSIZE_PRIVATE_KEY)
+            return -1;
+
+        bool wake = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (count_ == 0)
+                return -1;
+
+            byte* slot = table_.setdata(head_);
+            std::memcpy(private_key.data(), slot, KEYSIZE_PRIVATE_KEY);
+            std::memcpy(public_key.data(),
+                        slot + KEYSIZE_PRIVATE_KEY,
+                        KEYSIZE_PUBLIC_KEY);
+            sodium_memzero(slot, SLOTSIZE);
+
+            head_ = (head_ + 1) % table_.size();
+            --count_;
+            wake = count_ < low_ && !refilling_;
+        }
+        if (wake)
+            cv_.notify_one();
+        return 0;
+    }
+
+    /**
+     * Synchronously top up the pool to its high watermark, e.g. to
+     * warm it up before a burst of connections. Return the number of
+     * keypairs generated.
+     **/
+
+    std::size_t refill()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // only one refill at a time may own the free slots
+        cv_.wait(lock, [this] { return !refilling_; });
+        refilling_ = true;
+
+        // pop()s may free more slots while we generate: loop until full
+        std::size_t total = 0;
+        while (count_ != table_.size()) {
+            const std::size_t first = (head_ + count_) % table_.size();
+            const std::size_t n = table_.size() - count_;
+            lock.unlock();
+
+            // the free slots are ours: nobody pop()s them before publishing
+            for (std::size_t i = 0; i != n; ++i) {
+                byte* slot = table_.setdata((first + i) % table_.size());
+                traits_type::generate(slot + KEYSIZE_PRIVATE_KEY, slot);
+            }
+
+            lock.lock();
+            count_ += n;
+            total += n;
+        }
+
+        refilling_ = false;
+        lock.unlock();
+        cv_.notify_all();
+        return total;
+    }
+
+    // the number of keypairs ready to be popped
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+    // the watermarks
+    std::size_t capacity() const noexcept { return table_.size(); }
+    std::size_t low_watermark() const noexcept { return low_; }
+
+    // the number of pop()s that found the pool empty
+    std::size_t misses() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return misses_;
+    }
+
+  private:
+    static std::size_t check_watermarks(std::size_t low, std::size_t high)
+    {
+        if (high == 0 || high < low)
+            throw std::runtime_error{
+                "sodium::keypair_pool::keypair_pool() wrong watermarks"
+            };
+        return high;
+    }
+
+    void work()
+    {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] {
+                    return done_ || (count_ < low_ && !refilling_);
+                });
+                if (done_)
+                    return;
+            }
+            refill();
+        }
+    }
+
+    key_table<SLOTSIZE> table_;
+    const std::size_t low_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::size_t head_;  // the oldest ready slot
+    std::size_t count_; // the number of ready slots from head_ on
+    std::size_t misses_;
+    bool refilling_;
+    bool done_;
+    std::thread refiller_;
+};
+
+} // namespace sodium
@@ -21,16 +21,16 @@
 #include "allocator.h"
 #include "common.h"
 #include "key.h" // for KEYSIZE constants
+#include "metrics.h"
 #include "random.h"
+#include "small_bytes.h"
+#include "trace.h"
 #include <sodium.h>
 #include <string>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
-#ifndef NDEBUG
-#include <iostream>
-#endif // ! NDEBUG
 
 namespace sodium {
 
@@ -53,6 +53,11 @@ class keyvar
      *
      * When a keyvar goes out of scope, it auto-destructs by zeroing its
      * memory, and eventually releasing the virtual pages too.
+     *
+     * Most keys are 16 to 64 bytes long. A keyvar<small_bytes_protected<>>
+     * keeps them in a slot of a shared protected slab instead of virtual
+     * pages of their own, which makes creating, copying and destroying
+     * it much cheaper (see small_bytes.h).
      **/
 
   public:
@@ -70,8 +75,10 @@ class keyvar
     using byte_type =
       typename bytes_type::value_type; // e.g. byte (unsigned char)
 
-    // refuse to compile when not instantiating with bytes_protected
-    static_assert(std::is_same<bytes_type, bytes_protected>(),
+    // refuse to compile when not instantiating with protected memory
+    static_assert(std::is_same<bytes_type, bytes_protected>() ||
+                    std::is_same<bytes_type, bytes_pooled>() ||
+                    is_small_bytes_protected<bytes_type>(),
                   "keyvar<> not in protected memory");
 
     // The strength of the key derivation efforts for setpass()
@@ -233,6 +240,24 @@ class keyvar
                 };
         }
 
+        setpass(password, salt, strength_cpu, strength_mem);
+    }
+
+    /**
+     * Like setpass(password, salt, strength), but with explicit
+     * crypto_pwhash() limits, e.g. those picked by
+     * sodium::pwhash_service::calibrate().
+     *
+     * This function throws a std::runtime_error if the salt size
+     * doesn't make sense, or if crypto_pwhash() fails, e.g. because
+     * it runs out of memory or the limits are out of range.
+     **/
+
+    void setpass(const std::string& password,
+                 const bytes& salt,
+                 const unsigned long long opslimit,
+                 const std::size_t memlimit)
+    {
         // check salt length
         if (salt.size() != KEYSIZE_SALT)
             throw std::runtime_error{
@@ -241,13 +266,14 @@ class keyvar
 
         // derive a key from the hash of the password, and store it!
         readwrite(); // temporarily unlock the key (if not already)
+        metrics::pwhash_timer timer;
         if (crypto_pwhash(keydata_.data(),
                           keydata_.size(),
                           password.data(),
                           password.size(),
                           salt.data(),
-                          strength_cpu,
-                          strength_mem,
+                          opslimit,
+                          memlimit,
                           crypto_pwhash_ALG_DEFAULT) != 0)
             throw std::runtime_error{
                 "sodium::keyvar::setpass() crypto_pwhash()"
@@ -256,9 +282,9 @@ class keyvar
     }
 
     /**
-     * Initialize, i.e. fill with random data generated with libsodium's
-     * function randombytes_buf() the number of bytes already allocated
-     * to this keyvar upon construction.
+     * Initialize, i.e. fill with random data from the per-thread
+     * sodium::buffered_random generator (see random.h) the number of
+     * bytes already allocated to this keyvar upon construction.
      *
      * You normally don't need to call this function yourself, as it is
      * called by keyvar's constructor. It is provided as a public function
@@ -269,7 +295,7 @@ class keyvar
      * or noaccess() on systems that enforce mprotect().
      **/
 
-    void initialize() { sodium::randombytes_buf_inplace(keydata_); }
+    void initialize() { sodium::randombytes_buf_buffered_inplace(keydata_); }
 
     /**
      * Destroy the bytes stored in protected memory of this key by
@@ -344,9 +370,7 @@ operator==(const sodium::keyvar<BT>& k1, const sodium::keyvar<BT>& k2)
     //   std::equal(k1.data(), k1.data() + k1.size(),
     // 	     k2.data());
 
-#ifndef NDEBUG
-    std::cerr << "DEBUG: sodium::keyvar::operator==() called" << std::endl;
-#endif // ! NDEBUG
+    SODIUM_TRACE("sodium::keyvar::operator==()", "called");
 
     // Compare in constant time instead:
     return (k1.size() == k2.size()) &&
@@ -357,9 +381,7 @@ template<class BT>
 bool
 operator!=(const sodium::keyvar<BT>& k1, const sodium::keyvar<BT>& k2)
 {
-#ifndef NDEBUG
-    std::cerr << "DEBUG: sodium::keyvar::operator!=() called" << std::endl;
-#endif // ! NDEBUG
+    SODIUM_TRACE("sodium::keyvar::operator!=()", "called");
 
     return (!(k1 == k2));
 }
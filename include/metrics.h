@@ -0,0 +1,421 @@
+// metrics.h -- Opt-in per-thread performance counters
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// The wrappers only record metrics if SODIUM_METRICS is defined to a
+// non-zero value, e.g. with -DSODIUM_METRICS on the command line.
+// Otherwise, all the recording hooks compile to nothing, and
+// sodium::metrics::collect() returns an all-zero snapshot.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef SODIUM_METRICS
+#define SODIUM_METRICS 0
+#endif // ! SODIUM_METRICS
+
+namespace sodium {
+
+namespace metrics {
+
+static constexpr bool enabled = SODIUM_METRICS != 0;
+
+/**
+ * A latency histogram with fixed buckets, in seconds.
+ *
+ * buckets[i] counts the observations in (bounds[i-1], bounds[i]],
+ * and buckets[BUCKETS] those above bounds[BUCKETS-1] (i.e. the
+ * buckets are NOT cumulative, unlike Prometheus' le buckets).
+ **/
+
+struct histogram
+{
+    static constexpr std::size_t BUCKETS = 12;
+    static constexpr std::array<double, BUCKETS> bounds{ 0.001, 0.0025, 0.005,
+                                                         0.01,  0.025,  0.05,
+                                                         0.1,   0.25,   0.5,
+                                                         1.0,   2.5,    5.0 };
+
+    std::array<std::uint64_t, BUCKETS + 1> buckets{};
+    std::uint64_t sum_nanoseconds = 0;
+
+    std::uint64_t count() const noexcept
+    {
+        std::uint64_t result = 0;
+        for (std::uint64_t b : buckets)
+            result += b;
+        return result;
+    }
+
+    double sum_seconds() const noexcept { return sum_nanoseconds / 1e9; }
+
+    // the index of the bucket of an observation of ns nanoseconds
+    static std::size_t bucket_of(std::uint64_t ns) noexcept
+    {
+        const double seconds = ns / 1e9;
+        return std::lower_bound(bounds.cbegin(), bounds.cend(), seconds) -
+               bounds.cbegin();
+    }
+};
+
+/**
+ * A sodium::metrics::snapshot is a copy of the counters, taken by
+ * collect() for the whole process, or by collect_this_thread() for
+ * the calling thread only.
+ *
+ * Counters only ever increase. To attribute work to a request or a
+ * tenant, take a snapshot before and after, and subtract them:
+ *
+ *   auto before = sodium::metrics::collect_this_thread();
+ *   handle(request);
+ *   auto used = sodium::metrics::collect_this_thread() - before;
+ **/
+
+struct snapshot
+{
+    std::uint64_t bytes_encrypted = 0; // plaintext bytes encrypted
+    std::uint64_t bytes_decrypted = 0; // plaintext bytes decrypted
+    std::uint64_t mac_failures = 0;    // forged or corrupted messages
+    std::uint64_t allocations = 0;     // sodium::allocator::allocate()s
+    std::uint64_t allocated_bytes = 0; // ... and their total size
+    std::uint64_t filter_flushes = 0;  // filters flushing downstream
+    histogram pwhash_latency;          // crypto_pwhash() key derivations
+
+    snapshot& operator-=(const snapshot& other) noexcept
+    {
+        bytes_encrypted -= other.bytes_encrypted;
+        bytes_decrypted -= other.bytes_decrypted;
+        mac_failures -= other.mac_failures;
+        allocations -= other.allocations;
+        allocated_bytes -= other.allocated_bytes;
+        filter_flushes -= other.filter_flushes;
+        for (std::size_t i = 0; i != pwhash_latency.buckets.size(); ++i)
+            pwhash_latency.buckets[i] -= other.pwhash_latency.buckets[i];
+        pwhash_latency.sum_nanoseconds -=
+          other.pwhash_latency.sum_nanoseconds;
+        return *this;
+    }
+};
+
+inline snapshot
+operator-(snapshot lhs, const snapshot& rhs) noexcept
+{
+    return lhs -= rhs;
+}
+
+namespace detail {
+
+// the slots of a thread's counters
+enum slot : std::size_t
+{
+    BYTES_ENCRYPTED,
+    BYTES_DECRYPTED,
+    MAC_FAILURES,
+    ALLOCATIONS,
+    ALLOCATED_BYTES,
+    FILTER_FLUSHES,
+    PWHASH_NANOSECONDS,
+    PWHASH_BUCKETS, // histogram::BUCKETS + 1 of them
+    SLOTS = PWHASH_BUCKETS + histogram::BUCKETS + 1
+};
+
+using slots_type = std::array<std::uint64_t, SLOTS>;
+
+class thread_counters;
+
+// the live thread_counters, and the sums of those of exited threads
+struct registry
+{
+    std::mutex mutex;
+    std::vector<const thread_counters*> live;
+    slots_type retired{};
+
+    static registry& instance()
+    {
+        static registry the_registry;
+        return the_registry;
+    }
+};
+
+/**
+ * The counters of one thread. Only their own thread writes them, so
+ * adding to them is a relaxed load and store, without a locked
+ * read-modify-write instruction nor contention on shared cache lines.
+ * Other threads only read them, in collect().
+ **/
+
+class alignas(64) thread_counters
+{
+  public:
+    thread_counters()
+    {
+        for (auto& s : slots_)
+            s.store(0, std::memory_order_relaxed);
+
+        registry& r = registry::instance();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.live.push_back(this);
+    }
+
+    // fold the counters of an exiting thread into the registry
+    ~thread_counters()
+    {
+        registry& r = registry::instance();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        add_to(r.retired);
+        r.live.erase(std::find(r.live.begin(), r.live.end(), this));
+    }
+
+    thread_counters(const thread_counters&) = delete;
+    thread_counters& operator=(const thread_counters&) = delete;
+
+    void add(std::size_t slot, std::uint64_t n) noexcept
+    {
+        auto& s = slots_[slot];
+        s.store(s.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+    }
+
+    void add_to(slots_type& sums) const noexcept
+    {
+        for (std::size_t i = 0; i != SLOTS; ++i)
+            sums[i] += slots_[i].load(std::memory_order_relaxed);
+    }
+
+    static thread_counters& this_thread()
+    {
+        thread_local thread_counters the_counters;
+        return the_counters;
+    }
+
+  private:
+    std::array<std::atomic<std::uint64_t>, SLOTS> slots_;
+};
+
+inline snapshot
+to_snapshot(const slots_type& sums) noexcept
+{
+    snapshot result;
+    result.bytes_encrypted = sums[BYTES_ENCRYPTED];
+    result.bytes_decrypted = sums[BYTES_DECRYPTED];
+    result.mac_failures = sums[MAC_FAILURES];
+    result.allocations = sums[ALLOCATIONS];
+    result.allocated_bytes = sums[ALLOCATED_BYTES];
+    result.filter_flushes = sums[FILTER_FLUSHES];
+    result.pwhash_latency.sum_nanoseconds = sums[PWHASH_NANOSECONDS];
+    for (std::size_t i = 0; i != result.pwhash_latency.buckets.size(); ++i)
+        result.pwhash_latency.buckets[i] = sums[PWHASH_BUCKETS + i];
+    return result;
+}
+
+inline void
+add(std::size_t slot, std::uint64_t n) noexcept
+{
+    if constexpr (enabled)
+        thread_counters::this_thread().add(slot, n);
+}
+
+} // namespace detail
+
+/**
+ * Return the counters of all the threads, including those that have
+ * already exited.
+ **/
+
+inline snapshot
+collect()
+{
+    detail::slots_type sums{};
+    if constexpr (enabled) {
+        detail::registry& r = detail::registry::instance();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        sums = r.retired;
+        for (const detail::thread_counters* tc : r.live)
+            tc->add_to(sums);
+    }
+    return detail::to_snapshot(sums);
+}
+
+// return the counters of the calling thread only
+inline snapshot
+collect_this_thread()
+{
+    detail::slots_type sums{};
+    if constexpr (enabled)
+        detail::thread_counters::this_thread().add_to(sums);
+    return detail::to_snapshot(sums);
+}
+
+// recording hooks, called by the wrappers
+
+inline void
+bytes_encrypted(std::size_t plaintext_size) noexcept
+{
+    detail::add(detail::BYTES_ENCRYPTED, plaintext_size);
+}
+
+inline void
+bytes_decrypted(std::size_t plaintext_size) noexcept
+{
+    detail::add(detail::BYTES_DECRYPTED, plaintext_size);
+}
+
+// a message failed to authenticate, and was not decrypted
+inline void
+mac_failure() noexcept
+{
+    detail::add(detail::MAC_FAILURES, 1);
+}
+
+inline void
+allocated(std::size_t size) noexcept
+{
+    detail::add(detail::ALLOCATIONS, 1);
+    detail::add(detail::ALLOCATED_BYTES, size);
+}
+
+inline void
+filter_flushed() noexcept
+{
+    detail::add(detail::FILTER_FLUSHES, 1);
+}
+
+inline void
+pwhash_timed(std::chrono::steady_clock::duration elapsed) noexcept
+{
+    const auto ns = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    detail::add(detail::PWHASH_NANOSECONDS, ns);
+    detail::add(detail::PWHASH_BUCKETS + histogram::bucket_of(ns), 1);
+}
+
+/**
+ * A sodium::metrics::pwhash_timer records the time between its
+ * construction and its destruction in the pwhash latency histogram.
+ * Without SODIUM_METRICS, it doesn't even read the clock.
+ **/
+
+class pwhash_timer
+{
+  public:
+    pwhash_timer() noexcept
+    {
+        if constexpr (enabled)
+            start_ = std::chrono::steady_clock::now();
+    }
+
+    ~pwhash_timer()
+    {
+        if constexpr (enabled)
+            pwhash_timed(std::chrono::steady_clock::now() - start_);
+    }
+
+    pwhash_timer(const pwhash_timer&) = delete;
+    pwhash_timer& operator=(const pwhash_timer&) = delete;
+
+  private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * Write snapshot s to os, in the Prometheus text exposition format.
+ *
+ * labels, if not empty, is added to each sample, e.g.
+ *
+ *   write_prometheus(std::cout, collect(), "tenant=\"acme\"");
+ *
+ * It must already be escaped as Prometheus requires.
+ **/
+
+inline void
+write_prometheus(std::ostream& os,
+                 const snapshot& s,
+                 const std::string& labels = "")
+{
+    const std::string braced = labels.empty() ? "" : '{' + labels + '}';
+    const std::string prefix = labels.empty() ? "" : labels + ',';
+
+    auto counter = [&](const char* name, const char* help, std::uint64_t v) {
+        os << "# HELP " << name << ' ' << help << '\n'
+           << "# TYPE " << name << " counter\n"
+           << name << braced << ' ' << v << '\n';
+    };
+
+    counter("sodium_bytes_encrypted_total",
+            "Plaintext bytes encrypted.",
+            s.bytes_encrypted);
+    counter("sodium_bytes_decrypted_total",
+            "Plaintext bytes decrypted.",
+            s.bytes_decrypted);
+    counter("sodium_mac_failures_total",
+            "Messages that failed to authenticate.",
+            s.mac_failures);
+    counter("sodium_allocations_total",
+            "Allocations by sodium::allocator.",
+            s.allocations);
+    counter("sodium_allocated_bytes_total",
+            "Bytes allocated by sodium::allocator.",
+            s.allocated_bytes);
+    counter("sodium_filter_flushes_total",
+            "Flushes of buffered data by the stream filters.",
+            s.filter_flushes);
+
+    const char* name = "sodium_pwhash_duration_seconds";
+    os << "# HELP " << name << " Duration of crypto_pwhash() calls.\n"
+       << "# TYPE " << name << " histogram\n";
+
+    std::uint64_t cumulative = 0;
+    for (std::size_t i = 0; i != histogram::BUCKETS; ++i) {
+        cumulative += s.pwhash_latency.buckets[i];
+        os << name << "_bucket{" << prefix << "le=\""
+           << histogram::bounds[i] << "\"} " << cumulative << '\n';
+    }
+    cumulative += s.pwhash_latency.buckets[histogram::BUCKETS];
+    os << name << "_bucket{" << prefix << "le=\"+Inf\"} " << cumulative
+       << '\n';
+
+    // nanosecond resolution, without touching os' own format
+    std::ostringstream sum;
+    sum << std::fixed << std::setprecision(9)
+        << s.pwhash_latency.sum_seconds();
+    os << name << "_sum" << braced << ' ' << sum.str() << '\n'
+       << name << "_count" << braced << ' ' << cumulative << '\n';
+}
+
+inline std::string
+to_prometheus(const snapshot& s, const std::string& labels = "")
+{
+    std::ostringstream os;
+    write_prometheus(os, s, labels);
+    return os.str();
+}
+
+} // namespace metrics
+
+} // namespace sodium
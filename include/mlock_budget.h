@@ -0,0 +1,236 @@
+// mlock_budget.h -- Accounting and budget of mlock()ed memory
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <sodium.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#define SODIUM_HAVE_RLIMIT_MEMLOCK 1
+#else
+#define SODIUM_HAVE_RLIMIT_MEMLOCK 0
+#endif
+
+/**
+ * sodium_malloc() mlock()s every protected buffer, and a process may
+ * only lock RLIMIT_MEMLOCK bytes. Under peak load, large staging
+ * buffers can eat up that limit, until locking (or, depending on the
+ * platform and libsodium version, allocating) the next key fails.
+ *
+ * sodium::mlock_budget accounts for the memory that the allocators of
+ * this library lock, and enforces a budget with two priorities:
+ *
+ *   - lock_priority::key: sodium::allocator and sodium::pooled_allocator,
+ *     i.e. keys and other small secrets. Their memory is always
+ *     locked, even beyond the budget (which is then counted in
+ *     over_budget).
+ *   - lock_priority::bulk: sodium::hugepage_allocator, i.e. bulk
+ *     staging buffers. Their memory is locked only while the locked
+ *     total stays below budget - key_reserve, and is left unlocked
+ *     otherwise: still between guard pages, behind a canary, excluded
+ *     from core dumps (huge pages), and zeroed on deallocation, but
+ *     possibly swapped out.
+ *
+ * The budget defaults to RLIMIT_MEMLOCK at first use, or to no budget
+ * at all where there is no such limit, and key_reserve to a quarter
+ * of it. Both can be changed with configure() at any time; memory
+ * that is already allocated stays as it is.
+ *
+ * stats() reports the currently locked bytes and pages, e.g. for
+ * capacity planning. The page counts are exact for huge page regions,
+ * and follow the layout of sodium_malloc() otherwise.
+ **/
+
+namespace sodium {
+
+enum class lock_priority
+{
+    key, // must stay locked
+    bulk // may fall back to unlocked memory
+};
+
+struct mlock_options
+{
+    // the most bytes to keep locked; 0 for RLIMIT_MEMLOCK
+    std::size_t budget = 0;
+
+    // the part of budget that bulk memory can't use; SIZE_MAX for a
+    // quarter of budget
+    std::size_t key_reserve = SIZE_MAX;
+};
+
+class mlock_budget
+{
+  public:
+    struct stats_type
+    {
+        std::size_t budget;         // see mlock_options
+        std::size_t key_reserve;    // ...
+        std::size_t locked_bytes;   // currently locked, all priorities
+        std::size_t locked_pages;   // ... in pages of page_size()
+        std::size_t key_bytes;      // ... of which lock_priority::key
+        std::size_t bulk_bytes;     // ... of which lock_priority::bulk
+        std::size_t unlocked_bytes; // bulk memory that fell back
+        std::size_t over_budget;    // key allocations beyond budget
+    };
+
+    // the process-wide budget, shared by all allocators
+    static mlock_budget& instance()
+    {
+        static mlock_budget budget;
+        return budget;
+    }
+
+    mlock_budget(const mlock_budget&) = delete;
+    mlock_budget& operator=(const mlock_budget&) = delete;
+
+    void configure(const mlock_options& options) noexcept
+    {
+        const std::size_t budget =
+          options.budget != 0 ? options.budget : rlimit_memlock();
+        budget_.store(budget);
+        key_reserve_.store(options.key_reserve != SIZE_MAX
+                             ? options.key_reserve
+                             : budget / 4);
+    }
+
+    /**
+     * Account for bytes of memory of priority that an allocator is
+     * about to lock. Return false, and account for nothing, if bulk
+     * memory doesn't fit in the budget and should stay unlocked; key
+     * memory is always accepted.
+     **/
+    bool acquire(std::size_t bytes, lock_priority priority) noexcept
+    {
+        if (priority == lock_priority::key) {
+            const std::size_t before = locked_.fetch_add(bytes);
+            key_.fetch_add(bytes);
+            if (before + bytes > budget_.load())
+                over_budget_.fetch_add(1);
+            return true;
+        }
+
+        const std::size_t budget = budget_.load();
+        const std::size_t reserve = key_reserve_.load();
+        const std::size_t limit = budget > reserve ? budget - reserve : 0;
+        std::size_t locked = locked_.load();
+        do {
+            if (locked > limit || bytes > limit - locked)
+                return false;
+        } while (!locked_.compare_exchange_weak(locked, locked + bytes));
+        bulk_.fetch_add(bytes);
+        return true;
+    }
+
+    // the memory of a successful acquire() has been unlocked
+    void release(std::size_t bytes, lock_priority priority) noexcept
+    {
+        locked_.fetch_sub(bytes);
+        (priority == lock_priority::key ? key_ : bulk_).fetch_sub(bytes);
+    }
+
+    /**
+     * Remember that the bulk memory at ptr, of bytes bytes, was left
+     * unlocked, and forget it again on deallocation: forget() returns
+     * false if ptr wasn't remembered, i.e. if it is locked.
+     **/
+    void remember_unlocked(const void* ptr, std::size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        unlocked_ptrs_.insert(ptr);
+        unlocked_.fetch_add(bytes);
+    }
+
+    bool forget_unlocked(const void* ptr, std::size_t bytes) noexcept
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (unlocked_ptrs_.erase(ptr) == 0)
+            return false;
+        unlocked_.fetch_sub(bytes);
+        return true;
+    }
+
+    stats_type stats() const noexcept
+    {
+        const std::size_t locked = locked_.load();
+        return stats_type{ budget_.load(),   key_reserve_.load(),
+                           locked,           locked / page_size(),
+                           key_.load(),      bulk_.load(),
+                           unlocked_.load(), over_budget_.load() };
+    }
+
+    /**
+     * The number of bytes that sodium_malloc(size) locks: the pages
+     * holding the data and its canary, without the guard pages.
+     **/
+    static std::size_t locked_size(std::size_t size) noexcept
+    {
+        const std::size_t pagesize = page_size();
+        return (size + CANARYSIZE + pagesize - 1) / pagesize * pagesize;
+    }
+
+    static std::size_t page_size() noexcept
+    {
+#if SODIUM_HAVE_RLIMIT_MEMLOCK
+        static const std::size_t pagesize =
+          static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        return pagesize;
+#else
+        return 4096;
+#endif
+    }
+
+  private:
+    // the canary of sodium_malloc() in front of the data
+    static constexpr std::size_t CANARYSIZE = 16;
+
+    mlock_budget() noexcept { configure(mlock_options{}); }
+
+    static std::size_t rlimit_memlock() noexcept
+    {
+#if SODIUM_HAVE_RLIMIT_MEMLOCK
+        struct rlimit limit;
+        if (::getrlimit(RLIMIT_MEMLOCK, &limit) == 0 &&
+            limit.rlim_cur != RLIM_INFINITY &&
+            limit.rlim_cur < static_cast<rlim_t>(SIZE_MAX))
+            return static_cast<std::size_t>(limit.rlim_cur);
+#endif
+        return SIZE_MAX;
+    }
+
+    std::atomic<std::size_t> budget_{ 0 };
+    std::atomic<std::size_t> key_reserve_{ 0 };
+    std::atomic<std::size_t> locked_{ 0 };
+    std::atomic<std::size_t> key_{ 0 };
+    std::atomic<std::size_t> bulk_{ 0 };
+    std::atomic<std::size_t> unlocked_{ 0 };
+    std::atomic<std::size_t> over_budget_{ 0 };
+
+    std::mutex mutex_;
+    std::unordered_set<const void*> unlocked_ptrs_;
+};
+
+} // namespace sodium
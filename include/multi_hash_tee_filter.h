@@ -0,0 +1,604 @@
+// multi_hash_tee_filter.h -- Several hashes/MACs in one pass, tee-ed to a sink
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "filter_profile.h"
+#include "key.h"
+#include "keyvar.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <boost/assert.hpp>
+#include <boost/config.hpp> // BOOST_DEDUCE_TYPENAME.
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/detail/adapter/filter_adapter.hpp>
+#include <boost/iostreams/detail/call_traits.hpp>
+#include <boost/iostreams/detail/execute.hpp>
+#include <boost/iostreams/detail/functional.hpp> // call_close_all
+#include <boost/iostreams/operations.hpp>
+#include <boost/iostreams/pipeline.hpp>
+#include <boost/iostreams/traits.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_convertible.hpp>
+#include <boost/type_traits/is_same.hpp>
+
+#include <sodium.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept> // std::runtime_error
+#include <tuple>
+#include <type_traits>
+
+namespace sodium {
+
+/**
+ * Digest policies for sodium::multi_hash_tee_filter<> and
+ * sodium::multi_hash_tee_device<>.
+ *
+ * A digest policy wraps the init/update/final state machine of one
+ * libsodium hash or MAC, and provides:
+ *
+ *   static constexpr std::size_t DIGESTSIZE; // bytes written by final()
+ *   void update(const unsigned char* in, std::size_t inlen);
+ *   void final(unsigned char* out);          // and reset()
+ *   void reset();                            // forget all input so far
+ *
+ * Keyed policies take their key in the constructor, and keep a copy of
+ * the initial (keyed) state, so that reset() doesn't need the key.
+ **/
+
+template<std::size_t HASHSIZE = crypto_generichash_BYTES>
+class blake2b_digest
+{
+    static_assert(HASHSIZE >= crypto_generichash_BYTES_MIN &&
+                    HASHSIZE <= crypto_generichash_BYTES_MAX,
+                  "sodium::blake2b_digest<> invalid HASHSIZE");
+
+  public:
+    static constexpr std::size_t DIGESTSIZE = HASHSIZE;
+    static constexpr std::size_t KEYSIZE_MIN = sodium::KEYSIZE_HASHKEY_MIN;
+    static constexpr std::size_t KEYSIZE_MAX = sodium::KEYSIZE_HASHKEY_MAX;
+
+    using key_type = keyvar<>;
+
+    // keyless BLAKE2b
+    blake2b_digest()
+    {
+        crypto_generichash_init(&initial_, nullptr, 0, DIGESTSIZE);
+        state_ = initial_;
+    }
+
+    // keyed BLAKE2b, KEYSIZE_MIN <= key.size() <= KEYSIZE_MAX
+    explicit blake2b_digest(const key_type& key)
+    {
+        if (key.size() < KEYSIZE_MIN)
+            throw std::runtime_error{
+                "sodium::blake2b_digest() key too small"
+            };
+        if (key.size() > KEYSIZE_MAX)
+            throw std::runtime_error{
+                "sodium::blake2b_digest() key too big"
+            };
+
+        crypto_generichash_init(&initial_,
+                                reinterpret_cast<const unsigned char*>(
+                                  key.data()),
+                                key.size(),
+                                DIGESTSIZE);
+        state_ = initial_;
+    }
+
+    ~blake2b_digest()
+    {
+        sodium_memzero(&state_, sizeof(state_));
+        sodium_memzero(&initial_, sizeof(initial_));
+    }
+
+    void update(const unsigned char* in, std::size_t inlen)
+    {
+        crypto_generichash_update(&state_, in, inlen);
+    }
+
+    void final(unsigned char* out)
+    {
+        crypto_generichash_final(&state_, out, DIGESTSIZE);
+        reset();
+    }
+
+    void reset() { state_ = initial_; }
+
+  private:
+    crypto_generichash_state state_;
+    crypto_generichash_state initial_; // keyed, nothing absorbed yet
+};
+
+class poly1305_digest
+{
+  public:
+    static constexpr std::size_t DIGESTSIZE = crypto_onetimeauth_BYTES;
+    static constexpr std::size_t KEYSIZE = sodium::KEYSIZE_POLY1305;
+
+    using key_type = key<KEYSIZE>;
+
+    // Poly1305 is a one-time MAC: never reuse key for another message!
+    explicit poly1305_digest(const key_type& key)
+    {
+        crypto_onetimeauth_init(&initial_, key.data());
+        state_ = initial_;
+    }
+
+    ~poly1305_digest()
+    {
+        sodium_memzero(&state_, sizeof(state_));
+        sodium_memzero(&initial_, sizeof(initial_));
+    }
+
+    void update(const unsigned char* in, std::size_t inlen)
+    {
+        crypto_onetimeauth_update(&state_, in, inlen);
+    }
+
+    void final(unsigned char* out)
+    {
+        crypto_onetimeauth_final(&state_, out);
+        reset();
+    }
+
+    void reset() { state_ = initial_; }
+
+  private:
+    crypto_onetimeauth_state state_;
+    crypto_onetimeauth_state initial_; // keyed, nothing absorbed yet
+};
+
+class sha512_digest
+{
+  public:
+    static constexpr std::size_t DIGESTSIZE = crypto_hash_sha512_BYTES;
+
+    sha512_digest() { reset(); }
+
+    void update(const unsigned char* in, std::size_t inlen)
+    {
+        crypto_hash_sha512_update(&state_, in, inlen);
+    }
+
+    void final(unsigned char* out)
+    {
+        crypto_hash_sha512_final(&state_, out);
+        reset();
+    }
+
+    void reset() { crypto_hash_sha512_init(&state_); }
+
+  private:
+    crypto_hash_sha512_state state_;
+};
+
+class sha256_digest
+{
+  public:
+    static constexpr std::size_t DIGESTSIZE = crypto_hash_sha256_BYTES;
+
+    sha256_digest() { reset(); }
+
+    void update(const unsigned char* in, std::size_t inlen)
+    {
+        crypto_hash_sha256_update(&state_, in, inlen);
+    }
+
+    void final(unsigned char* out)
+    {
+        crypto_hash_sha256_final(&state_, out);
+        reset();
+    }
+
+    void reset() { crypto_hash_sha256_init(&state_); }
+
+  private:
+    crypto_hash_sha256_state state_;
+};
+
+/**
+ * multi_hash<Policies...>
+ *
+ * The digest policies Policies... updated together, block by block:
+ * each block of BLOCKSIZE bytes is fed to all the policies before
+ * moving on to the next one, while it is still in the L1 cache.
+ *
+ * final() writes all the digests back to back, in the order of
+ * Policies..., i.e. DIGESTSIZE bytes in total. Use offset<I>() to
+ * find the digest of the I-th policy in there.
+ *
+ * This is the engine of multi_hash_tee_filter<> and
+ * multi_hash_tee_device<>, but it can also be used directly.
+ **/
+
+template<typename... Policies>
+class multi_hash
+{
+    static_assert(sizeof...(Policies) > 0,
+                  "sodium::multi_hash<> needs at least one digest policy");
+
+  public:
+    static constexpr std::size_t BLOCKSIZE = 16384;
+    static constexpr std::size_t DIGESTSIZE = (Policies::DIGESTSIZE + ...);
+
+    // the offset of the I-th digest in the output of final()
+    template<std::size_t I>
+    static constexpr std::size_t offset()
+    {
+        constexpr std::size_t sizes[] = { Policies::DIGESTSIZE... };
+        std::size_t result = 0;
+        for (std::size_t i = 0; i != I; ++i)
+            result += sizes[i];
+        return result;
+    }
+
+    // all policies default-constructed (i.e. keyless)
+    multi_hash() = default;
+
+    explicit multi_hash(const Policies&... policies)
+      : policies_(policies...)
+    {}
+
+    void update(const unsigned char* in, std::size_t inlen)
+    {
+        while (inlen != 0) {
+            const std::size_t n = (std::min)(inlen, BLOCKSIZE);
+            std::apply([in, n](auto&... p) { (p.update(in, n), ...); },
+                       policies_);
+            in += n;
+            inlen -= n;
+        }
+    }
+
+    // write DIGESTSIZE bytes to out, and reset()
+    void final(unsigned char* out)
+    {
+        std::apply(
+          [&out](auto&... p) {
+              ((p.final(out), out += std::decay_t<decltype(p)>::DIGESTSIZE),
+               ...);
+          },
+          policies_);
+    }
+
+    void reset()
+    {
+        std::apply([](auto&... p) { (p.reset(), ...); }, policies_);
+    }
+
+  private:
+    std::tuple<Policies...> policies_;
+};
+
+/**
+ * multi_hash_tee_filter<Device, Policies...>
+ *
+ * A pipeable tee filter that computes several hashes and/or MACs of
+ * the data going through it in a single pass, instead of chaining a
+ * blake2b_tee_filter, a poly1305_tee_filter, etc. where every byte
+ * would go through each layer and its buffers.
+ *
+ * The data is passed unchanged downstream. The digests are sent back
+ * to back (see multi_hash<>::offset<I>()) to the tee-ed Device:
+ *   - in an output chain, when the stream is about to be closed,
+ *   - in an input chain, as soon as the source has been read to EOF.
+ *
+ * Usage (example):
+ *
+ *   using vector_sink = io::back_insert_device<sodium::chars>;
+ *   using tee_type = multi_hash_tee_filter<vector_sink,
+ *                                          blake2b_digest<>,
+ *                                          sha512_digest>;
+ *
+ *   sodium::chars tags; // blake2b || sha512, after close
+ *   vector_sink tagsink(tags);
+ *   {
+ *       io::filtering_ostream os(tee_type(tagsink) | outfile);
+ *       os.write(plainblob.data(), plainblob.size());
+ *   }
+ *   sodium::chars sha512{ tags.cbegin() + tee_type::offset<1>(),
+ *                         tags.cend() };
+ *
+ * Keyed policies are passed to the constructor:
+ *
+ *   multi_hash_tee_filter<vector_sink, blake2b_digest<>, poly1305_digest>
+ *     tee(tagsink, blake2b_digest<>(hashkey), poly1305_digest(mackey));
+ **/
+
+template<typename Device, typename... Policies>
+class multi_hash_tee_filter
+  : public boost::iostreams::detail::filter_adapter<Device>
+{
+    using base_type = boost::iostreams::detail::filter_adapter<Device>;
+    using hash_type = multi_hash<Policies...>;
+
+  public:
+    typedef typename boost::iostreams::detail::param_type<Device>::type
+      param_type;
+    typedef typename boost::iostreams::char_type_of<Device>::type char_type;
+    struct category
+      : boost::iostreams::dual_use_filter_tag
+      , boost::iostreams::multichar_tag
+      , boost::iostreams::closable_tag
+      , boost::iostreams::flushable_tag
+      , boost::iostreams::localizable_tag
+      , boost::iostreams::optimally_buffered_tag
+    {};
+
+    BOOST_STATIC_ASSERT(boost::iostreams::is_device<Device>::value);
+    BOOST_STATIC_ASSERT(
+      (boost::is_convertible<
+        BOOST_DEDUCED_TYPENAME boost::iostreams::category_of<Device>::type,
+        boost::iostreams::output>::value));
+
+    static constexpr std::size_t DIGESTSIZE = hash_type::DIGESTSIZE;
+
+    template<std::size_t I>
+    static constexpr std::size_t offset()
+    {
+        return hash_type::template offset<I>();
+    }
+
+    // all policies default-constructed (i.e. keyless)
+    explicit multi_hash_tee_filter(param_type dev)
+      : base_type(dev)
+      , hash_{}
+      , digests_sent_{ false }
+    {}
+
+    multi_hash_tee_filter(param_type dev, const Policies&... policies)
+      : base_type(dev)
+      , hash_{ policies... }
+      , digests_sent_{ false }
+    {}
+
+    template<typename Source>
+    std::streamsize read(Source& src, char_type* s, std::streamsize n)
+    {
+        std::streamsize result = boost::iostreams::read(src, s, n);
+
+        if (result > 0) {
+            SODIUM_PROFILE_SPAN("multi_hash_tee_filter", result);
+            hash_.update(reinterpret_cast<const unsigned char*>(s), result);
+        } else if (result == -1 && !digests_sent_)
+            send_digests(); // EOF
+
+        return result; // nr. of bytes read, or -1 on EOF
+    }
+
+    template<typename Sink>
+    std::streamsize write(Sink& snk, const char_type* s, std::streamsize n)
+    {
+        std::streamsize result = boost::iostreams::write(snk, s, n);
+
+        {
+            SODIUM_PROFILE_SPAN("multi_hash_tee_filter", result);
+            hash_.update(reinterpret_cast<const unsigned char*>(s), result);
+        }
+
+        return result;
+    }
+
+    template<typename Next>
+    void close(Next&, BOOST_IOS::openmode which)
+    {
+        // input chains have sent the digests already on EOF
+        if (which == BOOST_IOS::out && !digests_sent_)
+            send_digests();
+
+        boost::iostreams::detail::close_all(this->component());
+
+        // start afresh with new streams
+        hash_.reset();
+        digests_sent_ = false;
+    }
+
+    template<typename Sink>
+    bool flush(Sink& snk)
+    {
+        metrics::filter_flushed();
+        bool r1 = boost::iostreams::flush(snk);
+        bool r2 = boost::iostreams::flush(this->component());
+
+        return r1 && r2;
+    }
+
+  private:
+    void send_digests()
+    {
+        char_type out[DIGESTSIZE];
+        hash_.final(reinterpret_cast<unsigned char*>(out));
+
+        std::streamsize result =
+          boost::iostreams::write(this->component(), out, DIGESTSIZE);
+
+        SODIUM_TRACE("sodium::multi_hash_tee_filter::send_digests()",
+                     "called [result=" << result << "], "
+                                       << "[DIGESTSIZE=" << DIGESTSIZE
+                                       << "]");
+
+        BOOST_ASSERT(result == static_cast<std::streamsize>(DIGESTSIZE));
+        (void)result; // unused with NDEBUG
+        digests_sent_ = true;
+    }
+
+    hash_type hash_;
+    bool digests_sent_; // for this stream, already?
+};
+
+// BOOST_IOSTREAMS_PIPABLE() doesn't handle variadic templates
+template<typename Device, typename... Policies, typename Component>
+boost::iostreams::pipeline<
+  boost::iostreams::detail::pipeline_segment<
+    multi_hash_tee_filter<Device, Policies...>>,
+  Component>
+operator|(const multi_hash_tee_filter<Device, Policies...>& f,
+          const Component& c)
+{
+    typedef boost::iostreams::detail::pipeline_segment<
+      multi_hash_tee_filter<Device, Policies...>>
+      segment;
+    return boost::iostreams::pipeline<segment, Component>(segment(f), c);
+}
+
+/**
+ * multi_hash_tee_device<Device, Sink, Policies...>
+ *
+ * An OutputDevice that sends its data unchanged to a Device, and
+ * computes all the Policies... digests of it in a single pass. When
+ * the stream is about to close, it sends the digests back to back to
+ * Sink.
+ *
+ * With Device = io::null_sink, this is an allocation-free way to get
+ * e.g. the BLAKE2b and SHA-512 of a stream:
+ *
+ *   multi_hash_tee_device<io::null_sink, vector_sink,
+ *                         blake2b_digest<>, sha512_digest>
+ *     dev(io::null_sink(), tagsink);
+ *   io::filtering_ostream os(dev);
+ **/
+
+template<typename Device, typename Sink, typename... Policies>
+class multi_hash_tee_device
+{
+    using hash_type = multi_hash<Policies...>;
+
+  public:
+    typedef typename boost::iostreams::detail::param_type<Device>::type
+      device_param;
+    typedef
+      typename boost::iostreams::detail::param_type<Sink>::type sink_param;
+    typedef typename boost::iostreams::detail::value_type<Device>::type
+      device_value;
+    typedef
+      typename boost::iostreams::detail::value_type<Sink>::type sink_value;
+    typedef typename boost::iostreams::char_type_of<Device>::type char_type;
+    struct category
+      : boost::iostreams::output
+      , boost::iostreams::device_tag
+      , boost::iostreams::closable_tag
+      , boost::iostreams::flushable_tag
+      , boost::iostreams::localizable_tag
+      , boost::iostreams::optimally_buffered_tag
+    {};
+
+    BOOST_STATIC_ASSERT(boost::iostreams::is_device<Device>::value);
+    BOOST_STATIC_ASSERT(boost::iostreams::is_device<Sink>::value);
+    BOOST_STATIC_ASSERT(
+      (boost::is_same<
+        char_type,
+        BOOST_DEDUCED_TYPENAME boost::iostreams::char_type_of<Sink>::type>::
+         value));
+    BOOST_STATIC_ASSERT(
+      (boost::is_convertible<
+        BOOST_DEDUCED_TYPENAME boost::iostreams::category_of<Device>::type,
+        boost::iostreams::output>::value));
+    BOOST_STATIC_ASSERT(
+      (boost::is_convertible<
+        BOOST_DEDUCED_TYPENAME boost::iostreams::category_of<Sink>::type,
+        boost::iostreams::output>::value));
+
+    static constexpr std::size_t DIGESTSIZE = hash_type::DIGESTSIZE;
+
+    template<std::size_t I>
+    static constexpr std::size_t offset()
+    {
+        return hash_type::template offset<I>();
+    }
+
+    multi_hash_tee_device(device_param device, sink_param sink)
+      : dev_(device)
+      , sink_(sink)
+      , hash_{}
+    {}
+
+    multi_hash_tee_device(device_param device,
+                          sink_param sink,
+                          const Policies&... policies)
+      : dev_(device)
+      , sink_(sink)
+      , hash_{ policies... }
+    {}
+
+    std::streamsize write(const char_type* s, std::streamsize n)
+    {
+        std::streamsize result = boost::iostreams::write(dev_, s, n);
+
+        BOOST_ASSERT(result == n); // sanity check: we didn't lose anything
+
+        hash_.update(reinterpret_cast<const unsigned char*>(s), result);
+
+        return n;
+    }
+
+    void close()
+    {
+        // before closing, send the digests:
+        char_type out[DIGESTSIZE];
+        hash_.final(reinterpret_cast<unsigned char*>(out)); // resets
+
+        std::streamsize result =
+          boost::iostreams::write(sink_, out, DIGESTSIZE);
+
+        SODIUM_TRACE("sodium::multi_hash_tee_device::close()",
+                     "called [result=" << result << "], "
+                                       << "[DIGESTSIZE=" << DIGESTSIZE
+                                       << "]");
+
+        BOOST_ASSERT(result == static_cast<std::streamsize>(DIGESTSIZE));
+        (void)result; // unused with NDEBUG
+
+        boost::iostreams::detail::execute_all(
+          boost::iostreams::detail::call_close_all(dev_),
+          boost::iostreams::detail::call_close_all(sink_));
+    }
+
+    bool flush()
+    {
+        metrics::filter_flushed();
+        bool r1 = boost::iostreams::flush(dev_);
+        bool r2 = boost::iostreams::flush(sink_);
+
+        return r1 && r2;
+    }
+
+    template<typename Locale>
+    void imbue(const Locale& loc)
+    {
+        boost::iostreams::imbue(dev_, loc);
+        boost::iostreams::imbue(sink_, loc);
+    }
+
+    std::streamsize optimal_buffer_size() const
+    {
+        return (std::max)(boost::iostreams::optimal_buffer_size(dev_),
+                          boost::iostreams::optimal_buffer_size(sink_));
+    }
+
+  private:
+    device_value dev_;
+    sink_value sink_;
+    hash_type hash_;
+};
+
+} // namespace sodium
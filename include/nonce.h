@@ -20,11 +20,12 @@
 
 #include "common.h"
 #include "random.h"
+#include "trace.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <sodium.h>
 
-#ifndef NDEBUG
-#include <iostream>
-#endif // ! NDEBUG
 
 namespace sodium {
 
@@ -51,9 +52,14 @@ class nonce
      * Nonces SHOULD be generated randomly, and MUST NOT be reused
      * ever again with the same key. They are NOT necessarily secret
      * and can even be sent over an insecure channel. Therefore, nonces
-     * are kept in regular, non-protected (bytes) memory, unlike
-     * sodium::key objects whose data are allocated in protected
-     * memory (sodium::bytes_protected).
+     * are kept in regular, non-protected memory, unlike sodium::key
+     * objects whose data are allocated in protected memory
+     * (sodium::bytes_protected).
+     *
+     * The N bytes are stored inline, in a word-aligned std::array:
+     * a nonce is trivially copyable, and creating, copying or
+     * incrementing one (e.g. the running nonce of a stream) never
+     * allocates.
      *
      * This template is parameterized with the number of bytes of the
      * nonce.
@@ -64,29 +70,33 @@ class nonce
      * Construct a nonce of size N bytes.
      *
      * If bool is true (the default), initialize the nonce,
-     * i.e. fill it with random data generated by libsodium's
-     * randombytes_buf().
+     * i.e. fill it with random data from the per-thread
+     * sodium::buffered_random generator (see random.h).
      *
-     * If bool is false, the nonce remains default-initialized to the
-     * default value of bytes, i.e. to zero bytes.
+     * If bool is false, the nonce is initialized to zero bytes.
      **/
 
     nonce(bool init = true)
-      : noncedata_(N)
+      : noncedata_{}
     {
         if (init)
-            sodium::randombytes_buf_inplace(noncedata_);
+            sodium::randombytes_buf_buffered_inplace(noncedata_);
+    }
+
+    /**
+     * Construct a nonce from the N bytes at data, e.g. a nonce that was
+     * stored in the header of an encrypted file.
+     **/
+
+    explicit nonce(const byte* data)
+    {
+        std::copy(data, data + N, noncedata_.begin());
     }
 
     // there's nothing special about copy operations: allow them.
     nonce(const nonce&) = default;
     nonce& operator=(const nonce&) = default;
 
-    // to increase efficiency, enable moving constructor:
-    nonce(nonce&& other)
-      : noncedata_{ std::move(other.noncedata_) }
-    {}
-
     /**
      * Various libsodium functions used either directly on in
      * the wrappers need access to the bytes stored in the nonce.
@@ -100,11 +110,7 @@ class nonce
      *
      * !!!! IMPORTANT INVARIANT -- CHECK MANUALLY !!!!
      *
-     * Note that we return N instead of noncedata_.size() in size()
-     * so that size() can be declared constexpr and used in
-     * static_assert() in callers.  We must make sure that the
-     * invariant N == noncedata_.size() always holds when modifying
-     * this class.
+     * size() is N, and can be used in static_assert() in callers.
      **/
 
     const byte* data() const { return noncedata_.data(); }
@@ -114,7 +120,10 @@ class nonce
      * Expose noncedata_ as const bytes for sodium::bin2hex().
      **/
 
-    const bytes as_bytes() const { return noncedata_; }
+    const bytes as_bytes() const
+    {
+        return bytes(noncedata_.cbegin(), noncedata_.cend());
+    }
 
     /**
      * Increment the nonce by 1 in constant time.
@@ -161,10 +170,41 @@ class nonce
         return *this;
     }
 
+    /**
+     * Compute (*this + offset) mod (2 ^ (8*N)) in constant time, and
+     * store the result back in *this.
+     *
+     * This is the same as calling increment() offset times, but takes
+     * the same time for every offset. It is meant to compute the nonce
+     * of block k of a stream directly, as nonce + k.
+     **/
+
+    nonce& operator+=(std::uint64_t offset)
+    {
+        byte b[N] = { 0 };
+        for (std::size_t i = 0; i != N && i != sizeof offset; ++i)
+            b[i] = static_cast<byte>(offset >> (8 * i));
+        sodium_add(noncedata_.data(), b, N);
+        return *this;
+    }
+
   private:
-    bytes noncedata_; // the bytes of the nonce are stored in normal memory
+    // the bytes of the nonce, inline and aligned for word-wise access
+    alignas(std::uint64_t) std::array<byte, N> noncedata_;
 };
 
+/**
+ * Return a copy of the nonce a, incremented by offset in constant time.
+ **/
+
+template<std::size_t N>
+nonce<N>
+operator+(nonce<N> a, std::uint64_t offset)
+{
+    a += offset;
+    return a;
+}
+
 /**
  * Compare two nonces in constant time.
  **/
@@ -172,9 +212,7 @@ template<std::size_t N>
 int
 compare(const nonce<N>& a, const nonce<N>& b)
 {
-#ifndef NDEBUG
-    std::cerr << "DEBUG: nonce::compare called." << std::endl;
-#endif // ! NDEBUG
+    SODIUM_TRACE("sodium::nonce::compare()", "called");
 
     return sodium_compare(a.data(), b.data(), a.size());
 }
@@ -19,11 +19,79 @@
 #pragma once
 
 #include "common.h"
+#include "span.h"
 #include <algorithm>
+#include <cstddef>
 #include <sodium.h>
+#include <stdexcept>
 
 namespace sodium {
 
+/**
+ * The size of unpadded_size bytes once padded to a multiple of
+ * blocksize, i.e. with 1 to blocksize bytes of padding appended.
+ * blocksize must not be 0.
+ **/
+
+constexpr std::size_t
+padded_size(std::size_t unpadded_size, std::size_t blocksize) noexcept
+{
+    return (unpadded_size / blocksize + 1) * blocksize;
+}
+
+/**
+ * Allocation-free padding: the first unpadded_size bytes of buf are
+ * padded in place, within buf, to padded_size(unpadded_size,
+ * blocksize) bytes. That new length is stored into padded_len.
+ *
+ * buf is a view of memory owned by the caller, e.g. the reserved
+ * capacity of a recycled buffer, or the output buffer of an
+ * encryption (see encrypt_padded() in sodium::secretbox and
+ * sodium::aead). Nothing is ever reallocated.
+ *
+ * Return 0 on success, or -1 if blocksize is 0 or if buf is too small
+ * for the padded data. Never throws.
+ *
+ * Wrapped libsodium function:
+ *     sodium_pad()
+ **/
+
+inline int
+pad(span<byte> buf,
+    std::size_t unpadded_size,
+    std::size_t blocksize,
+    std::size_t& padded_len) noexcept
+{
+    if (blocksize == 0 || unpadded_size > buf.size())
+        return -1;
+
+    return sodium_pad(
+      &padded_len, buf.data(), unpadded_size, blocksize, buf.size());
+}
+
+/**
+ * Allocation-free unpadding: compute the length of the data in
+ * padded, without its padding, and store it into unpadded_len. The
+ * data itself stays where it is: it is the first unpadded_len bytes
+ * of padded.
+ *
+ * Return 0 on success, or -1 if the pad is malformed. Never throws.
+ *
+ * Wrapped libsodium function:
+ *     sodium_unpad()
+ **/
+
+inline int
+unpad(span<const byte> padded,
+      std::size_t blocksize,
+      std::size_t& unpadded_len) noexcept
+{
+    if (blocksize == 0)
+        return -1;
+
+    return sodium_unpad(&unpadded_len, padded.data(), padded.size(), blocksize);
+}
+
 /**
  * Add padding to the buffer unpadded, such that the padded
  * result has a multiple of blocksize length.
@@ -43,13 +111,11 @@ template<typename BT = bytes>
 BT
 pad(const BT& unpadded, const size_t blocksize)
 {
-    // we conservatively add ONE more block
-    // and hope for the best.
-    std::size_t xpadlen = blocksize;
+    if (blocksize == 0)
+        throw std::runtime_error("sodium::pad() failed");
 
-    // now that we know how much the padding will take,
-    // calculating the new size is easy-peasy:
-    std::size_t newsize = unpadded.size() + xpadlen;
+    // the exact size: no shrinking resize() afterwards
+    std::size_t newsize = padded_size(unpadded.size(), blocksize);
 
     // copy unpadded to our new extended buffer
     // XXX DANGER WILL ROBINSON: potential timing side channel attack?
@@ -79,7 +145,8 @@ pad(const BT& unpadded, const size_t blocksize)
  * The input buffer is padded in place, i.e. it will be resize()d.
  *
  * As usual with resize(), this invalidates all iterators
- * pointing into unpadded.
+ * pointing into unpadded, unless its capacity() is already large
+ * enough (see reserve_padded()).
  *
  * Throw a std::runtime_error if an error is reported
  * by the wrapped libsodium function.
@@ -94,13 +161,12 @@ pad_inplace(BT& unpadded, const size_t blocksize)
 {
     std::size_t unpadded_size = unpadded.size();
 
-    // XXX we conservatively add ONE more block (for now)
-    // und hope for the best.
-    std::size_t xpadlen = blocksize;
+    if (blocksize == 0)
+        throw std::runtime_error("sodium::pad_inplace() failed");
 
-    // now that we know how much the padding will take,
-    // calculating the new size is easy-peasy:
-    std::size_t newsize = unpadded_size + xpadlen;
+    // the exact size: resize() doesn't reallocate if unpadded
+    // already has the capacity, e.g. after reserve_padded().
+    std::size_t newsize = padded_size(unpadded_size, blocksize);
 
     unpadded.resize(newsize);
     std::size_t padded_buflen_p;
@@ -117,6 +183,22 @@ pad_inplace(BT& unpadded, const size_t blocksize)
         unpadded.resize(padded_buflen_p);
 }
 
+/**
+ * Reserve enough capacity in buf to pad size bytes (default: its
+ * current size()) to a multiple of blocksize, so that a following
+ * pad_inplace() doesn't reallocate.
+ **/
+
+template<typename BT = bytes>
+void
+reserve_padded(BT& buf, const size_t blocksize, std::size_t size = 0)
+{
+    if (size == 0)
+        size = buf.size();
+    if (blocksize != 0)
+        buf.reserve(padded_size(size, blocksize));
+}
+
 /**
  * Remove padding from the buffer padded.
  *
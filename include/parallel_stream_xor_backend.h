@@ -0,0 +1,208 @@
+// parallel_stream_xor_backend.h -- Multi-threaded key stream generation
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "stream_xor_backend.h"
+#include "thread_pool.h"
+
+#include <algorithm>          // std::min<>, std::max<>
+#include <atomic>             // std::atomic<>
+#include <condition_variable> // std::condition_variable
+#include <cstddef>            // std::size_t
+#include <cstdint>            // std::uint64_t
+#include <memory>             // std::shared_ptr<>
+#include <mutex>              // std::mutex
+
+namespace sodium {
+
+class parallel_stream_xor_backend : public stream_xor_backend
+{
+    /**
+     * A parallel_stream_xor_backend splits each call into slices of
+     * slice_size bytes, aligned on BLOCKSIZE boundaries so that slice
+     * i starts at block counter ic + i * slice_size / BLOCKSIZE, and
+     * xors them concurrently with crypto_stream_*_xor_ic() on the
+     * worker threads of a thread_pool. The output is the same as
+     * that of libsodium in one go.
+     *
+     * Use it with the stream cipher filters like this:
+     *
+     *   // on default_thread_pool(), shared by all filters
+     *   auto backend =
+     *     std::make_shared<sodium::parallel_stream_xor_backend>();
+     *
+     *   sodium::buffered_xchacha20_filter filter{ 1 << 24, key, nonce,
+     *                                             backend };
+     *
+     * Calls below min_size bytes stay in the calling thread (see
+     * stream_xor_backend::min_size()): splitting only pays off on
+     * large buffers, e.g. the 16 MiB of the filter above.
+     *
+     * The calling thread processes slices too, and only waits for
+     * slices that are already being processed: it never waits for a
+     * task that is still queued. A parallel_stream_xor_backend can
+     * therefore be used from the workers of its own pool, or with a
+     * busy pool, without deadlocking; it just gets less help then.
+     *
+     * A pool passed by reference must outlive the backend, and the
+     * filters using it.
+     **/
+
+  public:
+    static constexpr std::size_t MIN_SIZE = 256 * 1024;
+    static constexpr std::size_t SLICESIZE = 64 * 1024;
+
+    /**
+     * A backend on pool's threads, for calls of at least min_size
+     * bytes, in slices of slice_size bytes (rounded up to a multiple
+     * of BLOCKSIZE).
+     **/
+
+    explicit parallel_stream_xor_backend(thread_pool& pool,
+                                         std::size_t min_size = MIN_SIZE,
+                                         std::size_t slice_size = SLICESIZE)
+      : pool_{ pool }
+      , min_size_{ min_size }
+      , slice_size_{ round_up_slice_size(slice_size) }
+    {}
+
+    // Same, on the library-wide default_thread_pool()
+    explicit parallel_stream_xor_backend(std::size_t min_size = MIN_SIZE,
+                                         std::size_t slice_size = SLICESIZE)
+      : owned_pool_{ default_thread_pool() }
+      , pool_{ *owned_pool_ }
+      , min_size_{ min_size }
+      , slice_size_{ round_up_slice_size(slice_size) }
+    {}
+
+    const char* name() const noexcept override { return "parallel"; }
+    std::size_t min_size() const noexcept override { return min_size_; }
+    std::size_t slice_size() const noexcept { return slice_size_; }
+
+    int xor_ic(stream_cipher_id cipher,
+               unsigned char* c,
+               const unsigned char* m,
+               unsigned long long mlen,
+               const unsigned char* n,
+               std::uint64_t ic,
+               const unsigned char* k) noexcept override
+    {
+        const std::size_t slices = (mlen + slice_size_ - 1) / slice_size_;
+        if (slices <= 1)
+            return libsodium_.xor_ic(cipher, c, m, mlen, n, ic, k);
+
+        std::shared_ptr<job> j;
+        try {
+            j = std::make_shared<job>(
+              job_args{ cipher, c, m, mlen, n, ic, k, slice_size_, slices });
+        } catch (...) {
+            return libsodium_.xor_ic(cipher, c, m, mlen, n, ic, k);
+        }
+
+        // helpers that only start after the calling thread is done
+        // find no slice left, and just drop their reference to j
+        const std::size_t helpers = std::min(pool_.size(), slices - 1);
+        try {
+            for (std::size_t i = 0; i != helpers; ++i)
+                pool_.submit([j] { j->run(); });
+        } catch (...) {
+            // pool shutting down, out of memory: do the rest ourselves
+        }
+
+        j->run();
+        j->wait();
+        return j->result;
+    }
+
+  private:
+    struct job_args
+    {
+        stream_cipher_id cipher;
+        unsigned char* c;
+        const unsigned char* m;
+        unsigned long long mlen;
+        const unsigned char* n;
+        std::uint64_t ic;
+        const unsigned char* k;
+        std::size_t slice_size;
+        std::size_t slices;
+    };
+
+    struct job : job_args
+    {
+        explicit job(const job_args& args)
+          : job_args(args)
+        {}
+
+        // claim and xor slices until there are none left
+        void run() noexcept
+        {
+            for (;;) {
+                const std::size_t i = next++;
+                if (i >= slices)
+                    return;
+
+                const std::size_t offset = i * slice_size;
+                const std::size_t size =
+                  std::min<unsigned long long>(slice_size, mlen - offset);
+                if (libsodium_stream_xor_backend().xor_ic(
+                      cipher,
+                      c + offset,
+                      m + offset,
+                      size,
+                      n,
+                      ic + offset / BLOCKSIZE,
+                      k) != 0)
+                    result = -1;
+
+                if (++done == slices) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    cv.notify_all();
+                }
+            }
+        }
+
+        // wait until all slices have been xor-ed
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return done == slices; });
+        }
+
+        std::atomic<std::size_t> next{ 0 };
+        std::atomic<std::size_t> done{ 0 };
+        std::atomic<int> result{ 0 };
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    static std::size_t round_up_slice_size(std::size_t n)
+    {
+        n = std::max(n, BLOCKSIZE);
+        return (n + BLOCKSIZE - 1) / BLOCKSIZE * BLOCKSIZE;
+    }
+
+    std::shared_ptr<thread_pool> owned_pool_; // keeps a default pool alive
+    thread_pool& pool_;
+    std::size_t min_size_;
+    std::size_t slice_size_;
+    libsodium_stream_xor_backend libsodium_;
+};
+
+} // namespace sodium
@@ -0,0 +1,386 @@
+// pinned_key.h -- Reference-counted, batched access to noaccess() keys
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace sodium {
+
+/**
+ * A sodium::key_reaper is the background thread that makes idle
+ * sodium::pinned_key<>s noaccess() again. All the pinned keys with
+ * an idle timeout register with one reaper (by default, the shared()
+ * one of the process), instead of each starting a thread of its own.
+ *
+ * The reaper sleeps until the earliest deadline of its keys, and then
+ * sweeps all of them at once: every key idle for its timeout at that
+ * moment is made noaccess() in the same pass, so keys falling idle
+ * together are locked away together, with one wake-up.
+ **/
+
+class key_reaper
+{
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * What the reaper needs to know about a key: reap() makes it
+     * noaccess() if it has been idle up to now, and returns the next
+     * time it must be looked at again (clock::time_point::max() if
+     * it isn't pending).
+     **/
+
+    class reapable
+    {
+      public:
+        virtual clock::time_point reap(clock::time_point now) const = 0;
+
+      protected:
+        ~reapable() = default;
+    };
+
+    key_reaper()
+      : thread_([this] { run(); })
+    {}
+
+    key_reaper(const key_reaper&) = delete;
+    key_reaper& operator=(const key_reaper&) = delete;
+
+    // All the keys must have been removed.
+    ~key_reaper()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    // The reaper shared by all pinned_key<>s of the process
+    static key_reaper& shared()
+    {
+        static key_reaper reaper;
+        return reaper;
+    }
+
+    void add(const reapable* key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        keys_.push_back(key);
+    }
+
+    // Once remove() returns, the reaper doesn't touch key anymore.
+    void remove(const reapable* key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        keys_.erase(std::remove(keys_.begin(), keys_.end(), key),
+                    keys_.end());
+    }
+
+    // A key must be looked at again by deadline.
+    void wake(clock::time_point deadline)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (deadline < next_sweep_) {
+            next_sweep_ = deadline;
+            cv_.notify_one();
+        }
+    }
+
+    // The number of keys currently registered
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return keys_.size();
+    }
+
+  private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!done_) {
+            if (next_sweep_ == clock::time_point::max()) {
+                cv_.wait(lock);
+                continue;
+            }
+            const clock::time_point now = clock::now();
+            if (now < next_sweep_) {
+                cv_.wait_until(lock, next_sweep_);
+                continue;
+            }
+
+            // the sweep: lock order is always mutex_, then the key's
+            clock::time_point next = clock::time_point::max();
+            for (const reapable* key : keys_)
+                next = std::min(next, key->reap(now));
+            next_sweep_ = next;
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<const reapable*> keys_; // guarded by mutex_
+    clock::time_point next_sweep_ = clock::time_point::max();
+    bool done_ = false; // guarded by mutex_
+    std::thread thread_;
+};
+
+/**
+ * A sodium::pinned_key<K> keeps a key K (a sodium::key<> or
+ * sodium::keyvar<>) noaccess() while it isn't used, and hands out
+ * scoped access guards to the threads that need its bytes:
+ *
+ *   sodium::pinned_key<sodium::key<32>> pinned(std::move(k));
+ *   ...
+ *   {
+ *       auto access = pinned.access(); // key readable in this scope
+ *       crypto_xxx(..., access.data());
+ *   }
+ *
+ * Calling readonly() and noaccess() around each use costs two
+ * mprotect() syscalls, and a TLB shootdown on all the cores running
+ * the process, every time. pinned_key instead counts the guards
+ * alive at any moment, and changes the protection of the key only
+ * when that count goes from 0 to 1 (readonly()) and from 1 to 0
+ * (noaccess()). Guards taken while the key is already in use are
+ * merely an atomic increment and decrement.
+ *
+ * With a non-zero idle_timeout, the transition to noaccess() is
+ * deferred until the key hasn't been used for idle_timeout: a
+ * key_reaper (shared by all pinned keys by default) then makes it
+ * noaccess(). A key that is used every few milliseconds thus stays
+ * readonly(), and doesn't pay for any mprotect() at all, while a key
+ * that is left idle is locked away again after idle_timeout at most
+ * (give or take the scheduling of the reaper). With a zero
+ * idle_timeout (the default), the key is made noaccess() as soon as
+ * the last guard is gone, exactly like calling noaccess() by hand.
+ *
+ * The key is readonly(), never readwrite(), while it is being
+ * accessed: guards only give const access. A pinned_key is
+ * thread-safe; its guards are not (use one per thread). It must
+ * outlive its guards, and its key_reaper must outlive it.
+ **/
+
+template<typename K>
+class pinned_key : private key_reaper::reapable
+{
+  public:
+    using key_type = K;
+    using clock = key_reaper::clock;
+
+    /**
+     * A scoped guard: the key is readable as long as it is alive. It
+     * can be moved, but not copied.
+     **/
+
+    class access_guard
+    {
+      public:
+        access_guard(access_guard&& other) noexcept
+          : pinned_{ other.pinned_ }
+        {
+            other.pinned_ = nullptr;
+        }
+
+        access_guard(const access_guard&) = delete;
+        access_guard& operator=(const access_guard&) = delete;
+        access_guard& operator=(access_guard&&) = delete;
+
+        ~access_guard()
+        {
+            if (pinned_ != nullptr)
+                pinned_->release();
+        }
+
+        const key_type& key() const noexcept { return pinned_->key_; }
+        const auto* data() const noexcept { return pinned_->key_.data(); }
+        std::size_t size() const noexcept { return pinned_->key_.size(); }
+
+      private:
+        friend class pinned_key;
+
+        explicit access_guard(const pinned_key* pinned)
+          : pinned_{ pinned }
+        {
+            pinned_->acquire();
+        }
+
+        const pinned_key* pinned_;
+    };
+
+    /**
+     * Take over key, and make it noaccess(). If idle_timeout isn't
+     * zero, the key is registered with the shared key_reaper, which
+     * makes it noaccess() once it has been idle for idle_timeout.
+     **/
+
+    explicit pinned_key(key_type&& key,
+                        std::chrono::milliseconds idle_timeout =
+                          std::chrono::milliseconds::zero())
+      : pinned_key(std::move(key),
+                   idle_timeout,
+                   idle_timeout == std::chrono::milliseconds::zero()
+                     ? nullptr
+                     : &key_reaper::shared())
+    {}
+
+    // The same, registering with reaper instead of the shared one.
+    pinned_key(key_type&& key,
+               std::chrono::milliseconds idle_timeout,
+               key_reaper& reaper)
+      : pinned_key(std::move(key), idle_timeout, &reaper)
+    {}
+
+    pinned_key(const pinned_key&) = delete;
+    pinned_key& operator=(const pinned_key&) = delete;
+
+    // All guards must be gone. The key is zeroed.
+    ~pinned_key()
+    {
+        if (reaper_ != nullptr)
+            reaper_->remove(this);
+        key_.destroy();
+    }
+
+    // A guard that makes the key readable for its lifetime
+    access_guard access() const { return access_guard(this); }
+
+    // The number of guards currently alive
+    std::size_t users() const noexcept
+    {
+        return users_.load(std::memory_order_relaxed);
+    }
+
+    // Is the key currently readonly(), i.e. not noaccess()?
+    bool accessible() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return accessible_;
+    }
+
+    std::chrono::milliseconds idle_timeout() const noexcept
+    {
+        return idle_timeout_;
+    }
+
+  private:
+    pinned_key(key_type&& key,
+               std::chrono::milliseconds idle_timeout,
+               key_reaper* reaper)
+      : key_{ std::move(key) }
+      , idle_timeout_{ idle_timeout }
+      , reaper_{ idle_timeout == std::chrono::milliseconds::zero()
+                   ? nullptr
+                   : reaper }
+    {
+        if (idle_timeout_ < std::chrono::milliseconds::zero())
+            throw std::runtime_error{
+                "sodium::pinned_key::pinned_key() negative idle_timeout"
+            };
+
+        key_.noaccess();
+        if (reaper_ != nullptr)
+            reaper_->add(this);
+    }
+
+    void acquire() const
+    {
+        // fast path: the key is in use, and therefore readable already
+        std::size_t n = users_.load(std::memory_order_relaxed);
+        while (n != 0)
+            if (users_.compare_exchange_weak(
+                  n, n + 1, std::memory_order_acquire))
+                return;
+
+        // 0 -> 1: make the key readable before publishing the new count,
+        // so that the fast path above never sees an unmapped key
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!accessible_) {
+            key_.readonly();
+            accessible_ = true;
+        }
+        users_.fetch_add(1, std::memory_order_release);
+    }
+
+    void release() const
+    {
+        // fast path: we're not the last user
+        std::size_t n = users_.load(std::memory_order_relaxed);
+        while (n > 1)
+            if (users_.compare_exchange_weak(
+                  n, n - 1, std::memory_order_release))
+                return;
+
+        // 1 -> 0, unless another user came along in the meantime
+        clock::time_point deadline;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (users_.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+            if (reaper_ == nullptr) {
+                key_.noaccess();
+                accessible_ = false;
+                return;
+            }
+            last_release_ = clock::now();
+            deadline = last_release_ + idle_timeout_;
+        }
+
+        // outside of mutex_: the reaper takes its own mutex first
+        reaper_->wake(deadline);
+    }
+
+    // called by the reaper: noaccess() the key if idle for idle_timeout_
+    clock::time_point reap(clock::time_point now) const override
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!accessible_ || users_.load(std::memory_order_acquire) != 0)
+            return clock::time_point::max(); // release() will wake us
+
+        const clock::time_point deadline = last_release_ + idle_timeout_;
+        if (now < deadline)
+            return deadline;
+
+        // users_ can't go 0 -> 1 while we hold the lock
+        key_.noaccess();
+        accessible_ = false;
+        return clock::time_point::max();
+    }
+
+    mutable key_type key_;
+    const std::chrono::milliseconds idle_timeout_;
+    key_reaper* const reaper_; // nullptr with a zero idle_timeout_
+
+    mutable std::atomic<std::size_t> users_{ 0 };
+    mutable std::mutex mutex_;
+    mutable bool accessible_ = false;        // guarded by mutex_
+    mutable clock::time_point last_release_; // guarded by mutex_
+};
+
+} // namespace sodium
@@ -18,7 +18,11 @@
 
 #pragma once
 
+#include "filter_profile.h"
+#include "helpers.h"
 #include "key.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <boost/assert.hpp>
 #include <boost/config.hpp> // BOOST_DEDUCE_TYPENAME.
@@ -35,13 +39,10 @@
 #include <boost/type_traits/is_convertible.hpp>
 #include <boost/type_traits/is_same.hpp>
 
+#include <memory>
 #include <sodium.h>
 #include <stdexcept> // std::runtime_error
-
-#ifndef NDEBUG
-#include <iostream>
 #include <string>
-#endif // ! NDEBUG
 
 using namespace boost::iostreams;
 
@@ -111,6 +112,16 @@ class poly1305_tee_filter : public detail::filter_adapter<Device>
      * times computes a Poly1305 checksum which it passes to the second
      * Sink when the input stream is about to be closed.
      *
+     * In an input chain, the data read from the source is passed
+     * through unmodified, and the MAC is sent to the second Sink as
+     * soon as the source has been read to EOF:
+     *
+     *   chars mac;
+     *   io::filtering_istream is;
+     *   is.push(poly1305_tee_filter<vector_sink>(vector_sink(mac), key));
+     *   is.push(socket_source);
+     *   ... read is until EOF ...  // now, mac holds the MAC
+     *
      * Use as a pipeable filter when both sinks have the same type
      * Device.
      **/
@@ -148,61 +159,41 @@ class poly1305_tee_filter : public detail::filter_adapter<Device>
 
     explicit poly1305_tee_filter(param_type dev, const key_type& key)
       : detail::filter_adapter<Device>(dev)
-      , key_{ key }
+      , key_{ make_shared_key(key) }
+      , mac_sent_{ false }
     {
         // initialize the Poly1305 state machine
-        crypto_onetimeauth_init(&state_, key_.data());
+        crypto_onetimeauth_init(&state_, key_->data());
 
-#ifndef NDEBUG
-        std::cerr << "sodium::poly1305_tee_filter::poly1305_tee_filter() called"
-                  << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::poly1305_tee_filter::poly1305_tee_filter()",
+                     "called");
     }
 
+    /**
+     * Read (up to) n chars from src into s, passing them through
+     * unchanged, and update the Poly1305 MAC with them.
+     *
+     * In an input chain, the MAC is sent to the tee-ed Device as soon
+     * as src is exhausted, i.e. when the data has been read to EOF.
+     * If the chain is closed before EOF, no MAC is sent.
+     **/
+
     template<typename Source>
     std::streamsize read(Source& src, char_type* s, std::streamsize n)
     {
-
-        /**
-         * NOTE: This function is not called for some reason! (XXX)
-         * If yes, throw an std::runtime_exception (for now).
-         * Need to better understand when read() is invoked!
-         **/
-
-        throw std::runtime_error{
-            "sodium::poly1305_tee_filter::read() called. FIXME!"
-        };
-
-        // Read (up to) n chars from src into buffer s
-        // and update the Poly1305 state machine for this chunk
-        // using the crypto_onetimeauth_*() streaming API update function:
-
         std::streamsize result = boost::iostreams::read(src, s, n);
 
-#ifndef NDEBUG
-        std::cerr << "WARNING !!! sodium::poly1305_tee_filter::read() called "
-                  << "[n=" << n << "] " << '\n';
-        if (result != -1) {
-            std::string s_as_string{ s, s + result };
-            std::cerr << "  [s=" << s_as_string << "]" << std::endl;
-        }
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::poly1305_tee_filter::read()",
+                     "called [n=" << n << "] [result=" << result << "]");
 
-        // if (result != -1) {
-        //   crypto_onetimeauth_update(&state_,
-        // 				reinterpret_cast<unsigned char *>(s),
-        // 				result);
-        //
-        //  // Don't send anything to the second sink yet, since we're
-        //   // not done yet computing the Poly1305 MAC.
-        //
-        //   // std::streamsize result2 = iostreams::write(this->component(), s,
-        //   result);
-        //   // (void) result2; // Suppress 'unused variable' warning.
-        //   // BOOST_ASSERT(result == result2);
-        // }
+        if (result > 0) {
+            SODIUM_PROFILE_SPAN("poly1305_tee_filter", result);
+            crypto_onetimeauth_update(
+              &state_, reinterpret_cast<const unsigned char*>(s), result);
+        } else if (result == -1 && !mac_sent_)
+            send_mac(); // EOF
 
-        return result; // nr. of bytes read.
+        return result; // nr. of bytes read, or -1 on EOF
     }
 
     template<typename Sink>
@@ -213,17 +204,18 @@ class poly1305_tee_filter : public detail::filter_adapter<Device>
 
         std::streamsize result = boost::iostreams::write(snk, s, n);
 
-#ifndef NDEBUG
-        std::string s_as_string{ s, s + result };
-        std::cerr << "sodium::poly1305_tee_filter::write() called "
-                  << "[n=" << n << "] "
-                  << "[s=" << s_as_string << "] "
-                  << "[result=" << result << "]" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::poly1305_tee_filter::write()",
+                     "called [n=" << n << "] "
+                                  << "[s=" << std::string(s, s + result)
+                                  << "] "
+                                  << "[result=" << result << "]");
 
         // Update the Poly1305 state with the chunk we've got:
-        crypto_onetimeauth_update(
-          &state_, reinterpret_cast<const unsigned char*>(s), result);
+        {
+            SODIUM_PROFILE_SPAN("poly1305_tee_filter", result);
+            crypto_onetimeauth_update(
+              &state_, reinterpret_cast<const unsigned char*>(s), result);
+        }
 
         // Don't write anything yet to the second sink, because we're not
         // done yet computing the Poly1305 MAC:
@@ -236,57 +228,63 @@ class poly1305_tee_filter : public detail::filter_adapter<Device>
     }
 
     template<typename Next>
-    void close(Next&, BOOST_IOS::openmode)
+    void close(Next&, BOOST_IOS::openmode which)
     {
-        // before closing, send the computed Poly1305 MAC:
-        char_type out[MACSIZE];
-        crypto_onetimeauth_final(&state_,
-                                 reinterpret_cast<unsigned char*>(out));
-
-#ifndef NDEBUG
-        std::streamsize result =
-#else
-        (void)
-#endif // ! NDEBUG
-          boost::iostreams::write(this->component(), out, MACSIZE);
-
-#ifndef NDEBUG
-        mac_type out_as_mac_type_var{ out, out + MACSIZE };
-        std::string out_as_string{ sodium::bin2hex<mac_type>(
-          out_as_mac_type_var) };
-        std::cerr << "sodium::poly1305_tee_filter::close() called "
-                  << "[result=" << result << "], "
-                  << "[MACSIZE=" << MACSIZE << "]" << '\n'
-                  << "  [out=" << out_as_string << "]" << std::endl;
-#endif // ! NDEBUG
-
-        BOOST_ASSERT(result == MACSIZE);
+        // before closing an output chain, send the computed Poly1305 MAC
+        // (input chains have sent it already on EOF):
+        if (which == BOOST_IOS::out && !mac_sent_)
+            send_mac();
 
         // and now close the streams
         detail::close_all(this->component());
 
         // reset Poly1305 state so we can start afresh with new streams:
-        crypto_onetimeauth_init(&state_, key_.data());
+        crypto_onetimeauth_init(&state_, key_->data());
+        mac_sent_ = false;
     }
 
     template<typename Sink>
     bool flush(Sink& snk)
     {
+        metrics::filter_flushed();
         bool r1 = boost::iostreams::flush(snk);
         bool r2 =
           boost::iostreams::flush(this->component()); // actually a NO-OP
 
-#ifndef NDEBUG
-        std::cerr << "sodium::poly1305_tee_filter::flush() called "
-                  << "[r1=" << r1 << ",r2=" << r2 << "]" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::poly1305_tee_filter::flush()",
+                     "called [r1=" << r1 << ",r2=" << r2 << "]");
 
         return r1 && r2;
     }
 
   private:
-    key_type key_;
+    // send the computed Poly1305 MAC to the tee-ed Device
+    void send_mac()
+    {
+        char_type out[MACSIZE];
+        crypto_onetimeauth_final(&state_,
+                                 reinterpret_cast<unsigned char*>(out));
+
+        std::streamsize result =
+          boost::iostreams::write(this->component(), out, MACSIZE);
+
+        SODIUM_TRACE("sodium::poly1305_tee_filter::send_mac()",
+                     "called [result=" << result << "], "
+                                       << "[MACSIZE=" << MACSIZE << "]"
+                                       << '\n'
+                                       << "  [out="
+                                       << sodium::bin2hex<mac_type>(
+                                            mac_type{ out, out + MACSIZE })
+                                       << "]");
+
+        BOOST_ASSERT(result == MACSIZE);
+        (void)result; // unused with NDEBUG
+        mac_sent_ = true;
+    }
+
+    std::shared_ptr<const key_type> key_; // shared by all copies
     crypto_onetimeauth_state state_;
+    bool mac_sent_; // for this stream, already?
 };
 
 BOOST_IOSTREAMS_PIPABLE(poly1305_tee_filter, 1)
@@ -455,15 +453,13 @@ class poly1305_tee_device
                         const key_type& key)
       : dev_(device)
       , sink_(sink)
-      , key_{ key }
+      , key_{ make_shared_key(key) }
     {
         // initialize the Poly1305 state machine
-        crypto_onetimeauth_init(&state_, key_.data());
+        crypto_onetimeauth_init(&state_, key_->data());
 
-#ifndef NDEBUG
-        std::cerr << "sodium::poly1305_tee_device::poly1305_tee_device() called"
-                  << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::poly1305_tee_device::poly1305_tee_device()",
+                     "called");
     }
 
     std::streamsize read(char_type* s, std::streamsize n)
@@ -489,14 +485,11 @@ class poly1305_tee_device
 
         std::streamsize result1 = boost::iostreams::read(dev_, s, n);
 
-#ifndef NDEBUG
-        std::cerr << "WARNING !!! sodium::poly1305_tee_device::read() called "
-                  << "[n=" << n << "] " << '\n';
-        if (result1 != -1) {
-            std::string s_as_string{ s, s + result1 };
-            std::cerr << "  [s=" << s_as_string << "]" << std::endl;
-        }
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::poly1305_tee_device::read()",
+                     "WARNING !!! called [n=" << n << "] "
+                       << "[s="
+                       << (result1 != -1 ? std::string(s, s + result1) : "")
+                       << "]");
 
         // if (result1 != -1) {
         //   crypto_onetimeauth_update(&state_,
@@ -530,13 +523,11 @@ class poly1305_tee_device
 
         BOOST_ASSERT(result1 == n); // sanity check: we didn't lose anything
 
-#ifndef NDEBUG
-        std::string s_as_string{ s, s + result1 };
-        std::cerr << "sodium::poly1305_tee_device::write() called "
-                  << "[n=" << n << "] "
-                  << "[s=" << s_as_string << "] "
-                  << "[result1=" << result1 << "]" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::poly1305_tee_device::write()",
+                     "called [n=" << n << "] "
+                                  << "[s=" << std::string(s, s + result1)
+                                  << "] "
+                                  << "[result1=" << result1 << "]");
 
         // Update the Poly1305 state with the chunk we've got:
         crypto_onetimeauth_update(
@@ -561,43 +552,37 @@ class poly1305_tee_device
         crypto_onetimeauth_final(&state_,
                                  reinterpret_cast<unsigned char*>(out));
 
-#ifndef NDEBUG
-        std::streamsize result =
-#else
-        (void)
-#endif // ! NDEBUG
-          boost::iostreams::write(sink_, out, MACSIZE);
-
-#ifndef NDEBUG
-        mac_type out_as_mac_type_var{ out, out + MACSIZE };
-        std::string out_as_string{ sodium::bin2hex<mac_type>(
-          out_as_mac_type_var) };
-        std::cerr << "sodium::poly1305_tee_device::close() called "
-                  << "[result=" << result << "] "
-                  << "[MACSIZE=" << MACSIZE << "]" << '\n'
-                  << "  [out=" << out_as_string << "]" << std::endl;
-#endif // ! NDEBUG
+        std::streamsize result = boost::iostreams::write(sink_, out, MACSIZE);
+
+        SODIUM_TRACE("sodium::poly1305_tee_device::close()",
+                     "called [result=" << result << "] "
+                                       << "[MACSIZE=" << MACSIZE << "]"
+                                       << '\n'
+                                       << "  [out="
+                                       << sodium::bin2hex<mac_type>(
+                                            mac_type{ out, out + MACSIZE })
+                                       << "]");
 
         BOOST_ASSERT(result ==
                      MACSIZE); // sanity check: we didn't lose anything
+        (void)result; // unused with NDEBUG
 
         // And now, close the streams
         detail::execute_all(detail::call_close_all(dev_),
                             detail::call_close_all(sink_));
 
         // reset Poly1305 state so we can start afresh with new streams:
-        crypto_onetimeauth_init(&state_, key_.data());
+        crypto_onetimeauth_init(&state_, key_->data());
     }
 
     bool flush()
     {
+        metrics::filter_flushed();
         bool r1 = boost::iostreams::flush(dev_);
         bool r2 = boost::iostreams::flush(sink_);
 
-#ifndef NDEBUG
-        std::cerr << "sodium::poly1305_tee_device::flush() called "
-                  << "[r1=" << r1 << ",r2=" << r2 << "]" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::poly1305_tee_device::flush()",
+                     "called [r1=" << r1 << ",r2=" << r2 << "]");
 
         return r1 && r2;
     }
@@ -618,7 +603,7 @@ class poly1305_tee_device
   private:
     device_value dev_;
     sink_value sink_;
-    key_type key_;
+    std::shared_ptr<const key_type> key_; // shared by all copies
     crypto_onetimeauth_state state_;
 };
 
@@ -0,0 +1,485 @@
+// pooled_allocator.h -- An allocator for small objects in pooled protected memory
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "mlock_budget.h"
+#include "runtime.h"
+#include "trace.h"
+
+#include <sodium.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define SODIUM_HAVE_POOLED_SLOTS 1
+#else
+#define SODIUM_HAVE_POOLED_SLOTS 0
+#endif
+
+/**
+ * sodium::allocator (see allocator.h) calls sodium_allocarray() for
+ * every single allocation. Each call maps at least three virtual pages
+ * (two guard pages and one or more pages for the data), mlock()s them,
+ * and places a canary in front of the data. That's a handful of
+ * syscalls and mappings per key, and programs that hold tens of
+ * thousands of keys quickly run into the vm.max_map_count limit.
+ *
+ * sodium::pooled_allocator is a drop-in replacement for small objects.
+ * It carves them out of large slabs, each of which is a single
+ * sodium_malloc() region (and thus guard-paged, mlock()ed and
+ * canary-protected as a whole). Inside a slab, every slot starts on a
+ * page boundary and spans whole pages, and each object is followed by
+ * a secret canary:
+ *
+ *   slab = [object 0 | canary | ...][object 1 | canary | ...] ...
+ *          ^ page                   ^ page
+ *
+ * Since no two objects share a page, noaccess(), readonly() and
+ * readwrite() mprotect() the pages of their object only, and a key
+ * that has been made noaccess() is inaccessible, whatever its slab
+ * neighbours are. Neighbouring slots with the same protection are
+ * merged into one mapping by the kernel.
+ *
+ * On deallocation, the canary of the object is checked in constant
+ * time; if it has been overwritten (i.e. a buffer overflow occured),
+ * the program is aborted, just like sodium_free() would do. Then the
+ * slot is zeroed with sodium_memzero(), and returned to the slab.
+ * Slabs that become completely empty are sodium_free()d immediately.
+ *
+ * Requests larger than secure_arena::MAX_SLOTSIZE bytes fall back to
+ * sodium_allocarray() / sodium_free(), exactly like sodium::allocator,
+ * and so do all requests on platforms without mprotect().
+ *
+ * Keys that can share one protection (and thus pages) are packed much
+ * more densely by sodium::key_table (see key_table.h).
+ **/
+
+namespace sodium {
+
+class secure_arena
+{
+  public:
+    // Size of one slab. A multiple of the page size, so that the data
+    // part of the sodium_malloc() region starts on a page boundary.
+    static constexpr std::size_t SLABSIZE = 64 * 1024;
+
+    // Size of the canary trailing each object.
+    static constexpr std::size_t CANARYSIZE = 16;
+
+    // Largest object that gets a slot.
+    static constexpr std::size_t MAX_SLOTSIZE = 2048;
+
+    enum class protection_type
+    {
+        readwrite,
+        readonly,
+        noaccess
+    };
+
+    /**
+     * The statistics exposed by stats(), mostly for tests and capacity
+     * planning.
+     **/
+    struct stats_type
+    {
+        std::size_t slabs;       // number of live slabs
+        std::size_t slots_inuse; // number of allocated slots
+    };
+
+    /**
+     * The process-wide arena, shared by all pooled_allocator<T>s.
+     *
+     * It is constructed (and its canary generated) on first use,
+     * after initializing libsodium if needed (see sodium::runtime).
+     * It is never destroyed: objects with static storage duration
+     * may still deallocate into it during static destruction.
+     **/
+    static secure_arena& instance()
+    {
+        static secure_arena* arena = new secure_arena; // leaked on purpose
+        return *arena;
+    }
+
+    secure_arena(const secure_arena&) = delete;
+    secure_arena& operator=(const secure_arena&) = delete;
+
+    /**
+     * The number of slots of a slab: each slot spans whole pages.
+     **/
+    std::size_t slots_per_slab() const noexcept { return nslots_; }
+
+    /**
+     * Allocate size bytes. Return nullptr if size is too big for
+     * a slot (the caller should then fall back to sodium_allocarray()).
+     *
+     * Throws std::bad_alloc if a new slab can't be sodium_malloc()ed.
+     **/
+    void* allocate(std::size_t size)
+    {
+        if (!SODIUM_HAVE_POOLED_SLOTS || size > MAX_SLOTSIZE)
+            return nullptr;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        slab_type* slab = partial_.empty() ? new_slab() : partial_.back();
+
+        const std::uint32_t idx = slab->free_slots.back();
+        slab->free_slots.pop_back();
+        if (slab->free_slots.empty())
+            remove_partial(slab);
+
+        // free slots are readwrite, and so is a fresh object
+        slab->slots[idx].size = static_cast<std::uint32_t>(size);
+        unsigned char* slot = slab->base + idx * stride_;
+        std::copy(canary_.cbegin(), canary_.cend(), slot + size);
+
+        return slot;
+    }
+
+    /**
+     * Return the slot ptr to its slab after checking its canary and
+     * zeroing it. Return false if ptr doesn't belong to any slab (in
+     * which case the caller should sodium_free() it).
+     **/
+    bool deallocate(void* ptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        slab_type* slab = find_slab(ptr);
+        if (slab == nullptr)
+            return false;
+
+        unsigned char* slot = static_cast<unsigned char*>(ptr);
+        const auto idx =
+          static_cast<std::uint32_t>((slot - slab->base) / stride_);
+
+        // we need write access to zero the slot
+        if (slab->slots[idx].prot != protection_type::readwrite)
+            set_protection(slab, idx, protection_type::readwrite);
+
+        if (sodium_memcmp(slot + slab->slots[idx].size, canary_.data(),
+                          CANARYSIZE) != 0) {
+            SODIUM_TRACE("sodium::secure_arena::deallocate()",
+                         "[ptr=" << static_cast<void*>(ptr)
+                                 << "] canary corrupted");
+            std::abort();
+        }
+        sodium_memzero(slot, slab->slots[idx].size + CANARYSIZE);
+
+        if (slab->free_slots.empty())
+            partial_.push_back(slab);
+        slab->free_slots.push_back(idx);
+
+        // the slab is empty now: give its pages back immediately.
+        if (slab->free_slots.size() == nslots_)
+            release_slab(slab);
+
+        return true;
+    }
+
+    /**
+     * Give the object at ptr the protection prot, by mprotect()ing
+     * the pages of its slot.
+     *
+     * Return false if ptr doesn't belong to any slab. Throw a
+     * std::runtime_error if the underlying mprotect() call failed.
+     **/
+    bool protect(void* ptr, protection_type prot)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        slab_type* slab = find_slab(ptr);
+        if (slab == nullptr)
+            return false;
+
+        const auto idx = static_cast<std::uint32_t>(
+          (static_cast<const unsigned char*>(ptr) - slab->base) / stride_);
+        if (slab->slots[idx].prot != prot)
+            set_protection(slab, idx, prot);
+        return true;
+    }
+
+    stats_type stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        stats_type result{ slabs_.size(), 0 };
+        for (const auto& entry : slabs_)
+            result.slots_inuse += nslots_ - entry.second->free_slots.size();
+        return result;
+    }
+
+  private:
+    struct slot_type
+    {
+        std::uint32_t size = 0; // of the object in the slot
+        protection_type prot = protection_type::readwrite;
+    };
+
+    struct slab_type
+    {
+        unsigned char* base; // start of the sodium_malloc() region
+        std::vector<std::uint32_t> free_slots; // indices of free slots
+        std::vector<slot_type> slots;          // one per slot
+    };
+
+    secure_arena()
+    {
+        runtime::init();
+        ::randombytes_buf(canary_.data(), canary_.size());
+
+        // whole pages per slot, and at least one slot per slab
+        const std::size_t pagesize = mlock_budget::page_size();
+        stride_ = (MAX_SLOTSIZE + CANARYSIZE + pagesize - 1) / pagesize *
+                  pagesize;
+        slabsize_ = std::max(SLABSIZE, stride_);
+        nslots_ = slabsize_ / stride_;
+    }
+
+    // never called, see instance()
+    ~secure_arena() = default;
+
+    slab_type* new_slab()
+    {
+        void* base = sodium_malloc(slabsize_);
+        if (base == NULL)
+            throw std::bad_alloc{};
+        mlock_budget::instance().acquire(mlock_budget::locked_size(slabsize_),
+                                         lock_priority::key);
+
+        std::unique_ptr<slab_type> slab{ new slab_type };
+        slab->base = static_cast<unsigned char*>(base);
+
+        // sodium_malloc() fills its regions with garbage: start clean.
+        sodium_memzero(base, slabsize_);
+
+        slab->slots.resize(nslots_);
+
+        // hand out the lowest slots first
+        slab->free_slots.reserve(nslots_);
+        for (std::size_t i = nslots_; i > 0; --i)
+            slab->free_slots.push_back(static_cast<std::uint32_t>(i - 1));
+
+        slab_type* result = slab.get();
+        slabs_.emplace(reinterpret_cast<std::uintptr_t>(base),
+                       std::move(slab));
+        partial_.push_back(result);
+
+        SODIUM_TRACE("sodium::secure_arena::new_slab()",
+                     "[nslots=" << nslots_ << "] -> " << base);
+
+        return result;
+    }
+
+    void release_slab(slab_type* slab)
+    {
+        SODIUM_TRACE("sodium::secure_arena::release_slab()",
+                     "[base=" << static_cast<void*>(slab->base) << "]");
+
+        remove_partial(slab);
+        void* base = slab->base;
+        slabs_.erase(reinterpret_cast<std::uintptr_t>(base)); // deletes slab
+        sodium_free(base); // makes the whole region readwrite first
+        mlock_budget::instance().release(mlock_budget::locked_size(slabsize_),
+                                         lock_priority::key);
+    }
+
+    void remove_partial(slab_type* slab)
+    {
+        for (auto it = partial_.begin(); it != partial_.end(); ++it) {
+            if (*it == slab) {
+                partial_.erase(it);
+                return;
+            }
+        }
+    }
+
+    slab_type* find_slab(const void* ptr)
+    {
+        const auto addr = reinterpret_cast<std::uintptr_t>(ptr);
+        auto it = slabs_.upper_bound(addr);
+        if (it == slabs_.begin())
+            return nullptr;
+        --it;
+        if (addr >= it->first + slabsize_)
+            return nullptr;
+        return it->second.get();
+    }
+
+    void set_protection(slab_type* slab,
+                        std::uint32_t idx,
+                        protection_type prot)
+    {
+        int rc = -1;
+#if SODIUM_HAVE_POOLED_SLOTS
+        int flags = PROT_READ | PROT_WRITE;
+        if (prot == protection_type::readonly)
+            flags = PROT_READ;
+        else if (prot == protection_type::noaccess)
+            flags = PROT_NONE;
+        rc = ::mprotect(slab->base + idx * stride_, stride_, flags);
+#endif // SODIUM_HAVE_POOLED_SLOTS
+        if (rc == -1)
+            throw std::runtime_error{ "sodium::secure_arena::protect() failed" };
+        slab->slots[idx].prot = prot;
+    }
+
+    std::mutex mutex_;
+    std::array<unsigned char, CANARYSIZE> canary_;
+    std::size_t stride_;   // bytes per slot: whole pages
+    std::size_t slabsize_; // bytes per slab: whole slots
+    std::size_t nslots_;   // slots per slab
+    std::map<std::uintptr_t, std::unique_ptr<slab_type>> slabs_;
+    std::vector<slab_type*> partial_; // slabs with free slots
+};
+
+/**
+ * pooled_allocator<T> has the same interface as sodium::allocator<T>,
+ * including the non-standard noaccess(), readonly() and readwrite()
+ * functions, but allocates small objects from the secure_arena above.
+ *
+ * Use it through sodium::bytes_pooled (see common.h), e.g.
+ *   sodium::key<32, sodium::bytes_pooled> k;
+ **/
+
+template<typename T>
+class pooled_allocator
+{
+  public:
+    using value_type = T;
+
+    pooled_allocator() {}
+
+    template<typename U>
+    pooled_allocator(const pooled_allocator<U>&)
+    {}
+
+    ~pooled_allocator() {}
+
+    /**
+     * Allocate memory for num elements of type T, without constructing
+     * them, from a slab of the secure_arena. If num * sizeof(T) bytes
+     * don't fit in a slot, get them from sodium_allocarray() instead.
+     *
+     * Throws std::bad_alloc if no memory could be obtained.
+     **/
+
+    T* allocate(std::size_t num)
+    {
+        void* ptr = secure_arena::instance().allocate(num * sizeof(T));
+        if (ptr == nullptr) {
+            ptr = sodium_allocarray(num, sizeof(T));
+            if (ptr != NULL)
+                mlock_budget::instance().acquire(
+                  mlock_budget::locked_size(num * sizeof(T)),
+                  lock_priority::key);
+        }
+
+        SODIUM_TRACE("sodium::pooled_allocator::allocate()",
+                     "[num=" << num << "] -> " << static_cast<void*>(ptr));
+
+        if (ptr == NULL)
+            throw std::bad_alloc{};
+        return static_cast<T*>(ptr);
+    }
+
+    /**
+     * Deallocate memory pointed to by ptr. The memory is zeroed, and
+     * its canary checked, either by the secure_arena or sodium_free().
+     **/
+
+    void deallocate(T* ptr, std::size_t num)
+    {
+        SODIUM_TRACE("sodium::pooled_allocator::deallocate()",
+                     "[ptr=" << static_cast<void*>(ptr) << "]");
+
+        if (!secure_arena::instance().deallocate(ptr)) {
+            sodium_free(ptr);
+            mlock_budget::instance().release(
+              mlock_budget::locked_size(num * sizeof(T)), lock_priority::key);
+        }
+    }
+
+    /**
+     * Change the protection of the object at ptr. Pooled objects and
+     * large objects alike have pages of their own.
+     *
+     * These functions throw a std::runtime_error if the underlying
+     * mprotect() call failed.
+     **/
+
+    void noaccess(T* ptr)
+    {
+        if (!secure_arena::instance().protect(
+              ptr, secure_arena::protection_type::noaccess) &&
+            sodium_mprotect_noaccess(ptr) == -1)
+            throw std::runtime_error{
+                "sodium::pooled_allocator::noaccess() failed"
+            };
+    }
+
+    void readonly(T* ptr)
+    {
+        if (!secure_arena::instance().protect(
+              ptr, secure_arena::protection_type::readonly) &&
+            sodium_mprotect_readonly(ptr) == -1)
+            throw std::runtime_error{
+                "sodium::pooled_allocator::readonly() failed"
+            };
+    }
+
+    void readwrite(T* ptr)
+    {
+        if (!secure_arena::instance().protect(
+              ptr, secure_arena::protection_type::readwrite) &&
+            sodium_mprotect_readwrite(ptr) == -1)
+            throw std::runtime_error{
+                "sodium::pooled_allocator::readwrite() failed"
+            };
+    }
+};
+
+// Two sodium::pooled_allocator allocators are always equal: they share
+// the same process-wide secure_arena.
+template<typename T1, typename T2>
+bool
+operator==(const pooled_allocator<T1>&, const pooled_allocator<T2>&) noexcept
+{
+    return true;
+}
+
+template<typename T1, typename T2>
+bool
+operator!=(const pooled_allocator<T1>&, const pooled_allocator<T2>&) noexcept
+{
+    return false;
+}
+
+} // namespace sodium
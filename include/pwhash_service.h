@@ -0,0 +1,371 @@
+// pwhash_service.h -- Memory-bounded, asynchronous password key derivation
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+class pwhash_service
+{
+    /**
+     * A sodium::pwhash_service derives keys from passwords with
+     * crypto_pwhash() (Argon2id) on a fixed number of worker threads,
+     * instead of blocking the caller like key::setpass() does.
+     *
+     * Every derivation needs memlimit bytes of memory while it runs.
+     * The service admits derivations in FIFO order, and only as long
+     * as the sum of the memlimits of the running ones fits into a
+     * global memory budget. A burst of requests thus queues up
+     * instead of exhausting the host's memory. Optionally, the queue
+     * itself is bounded too, and derive() fails fast when it is full.
+     *
+     * Results are handed back through a std::future<K>, or to a
+     * callback. K is any key type with a setpass(password, salt,
+     * opslimit, memlimit) member function, i.e. sodium::key<N> or
+     * sodium::keyvar<>.
+     *
+     * The destructor finishes all pending derivations before joining
+     * the worker threads.
+     **/
+
+  public:
+    // the crypto_pwhash() limits of a derivation
+    struct params_type
+    {
+        unsigned long long opslimit;
+        std::size_t memlimit;
+    };
+
+    // the limits used by key::setpass() for each strength_type
+    static constexpr params_type interactive()
+    {
+        return { crypto_pwhash_OPSLIMIT_INTERACTIVE,
+                 crypto_pwhash_MEMLIMIT_INTERACTIVE };
+    }
+    static constexpr params_type moderate()
+    {
+        return { crypto_pwhash_OPSLIMIT_MODERATE,
+                 crypto_pwhash_MEMLIMIT_MODERATE };
+    }
+    static constexpr params_type sensitive()
+    {
+        return { crypto_pwhash_OPSLIMIT_SENSITIVE,
+                 crypto_pwhash_MEMLIMIT_SENSITIVE };
+    }
+
+    /**
+     * Create a service with nthreads worker threads, which runs
+     * derivations totalling at most memory_budget bytes at a time,
+     * and queues at most max_pending derivations (0: no limit).
+     *
+     * If nthreads is 0, use std::thread::hardware_concurrency()
+     * threads (at least one).
+     *
+     * Throw a std::runtime_error if memory_budget is 0.
+     **/
+
+    explicit pwhash_service(std::size_t memory_budget,
+                            std::size_t nthreads = 0,
+                            std::size_t max_pending = 0)
+      : budget_{ memory_budget }
+      , max_pending_{ max_pending }
+    {
+        if (memory_budget == 0)
+            throw std::runtime_error{ "sodium::pwhash_service::pwhash_"
+                                      "service() memory budget is 0" };
+
+        if (nthreads == 0)
+            nthreads = std::thread::hardware_concurrency();
+        if (nthreads == 0)
+            nthreads = 1;
+
+        workers_.reserve(nthreads);
+        for (std::size_t i = 0; i != nthreads; ++i)
+            workers_.emplace_back([this] { work(); });
+    }
+
+    pwhash_service(const pwhash_service&) = delete;
+    pwhash_service& operator=(const pwhash_service&) = delete;
+
+    ~pwhash_service()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cv_.notify_all();
+        for (auto& worker : workers_)
+            worker.join();
+    }
+
+    // the number of worker threads
+    std::size_t size() const { return workers_.size(); }
+
+    // the memory budget, in bytes
+    std::size_t budget() const { return budget_; }
+
+    // the memory reserved by the running derivations, in bytes
+    std::size_t in_use() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return in_use_;
+    }
+
+    // the number of derivations waiting to be admitted
+    std::size_t pending() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return jobs_.size();
+    }
+
+    /**
+     * Schedule key.setpass(password, salt, params.opslimit,
+     * params.memlimit), and return a std::future of the derived key.
+     * key is typically created uninitialized, e.g. key<N>(false).
+     *
+     * The service keeps a copy of password until the derivation is
+     * done, and zeroes it then. If the derivation fails, the future's
+     * get() rethrows the std::runtime_error of setpass().
+     *
+     * Throw a std::runtime_error right away if salt has the wrong
+     * size, if params.memlimit exceeds the memory budget, if the
+     * queue is full, or if the service is shutting down.
+     **/
+
+    template<typename K>
+    std::future<K> derive(K key,
+                          const std::string& password,
+                          const bytes& salt,
+                          const params_type& params)
+    {
+        auto task = make_task(std::move(key), password, salt, params);
+        std::future<K> result = task->get_future();
+
+        enqueue(params.memlimit, [task] { (*task)(); });
+
+        return result;
+    }
+
+    /**
+     * Like derive(key, password, salt, params), but instead of
+     * returning a future, call done(std::future<K>) with the ready
+     * future on the worker thread when the derivation is complete.
+     * Exceptions thrown by done() are ignored.
+     **/
+
+    template<typename K, typename Callback>
+    void derive(K key,
+                const std::string& password,
+                const bytes& salt,
+                const params_type& params,
+                Callback done)
+    {
+        auto task = make_task(std::move(key), password, salt, params);
+        auto result = std::make_shared<std::future<K>>(task->get_future());
+
+        enqueue(params.memlimit, [task, result, done]() mutable {
+            (*task)();
+            done(std::move(*result));
+        });
+    }
+
+    /**
+     * Benchmark crypto_pwhash() on this host, and return limits such
+     * that a derivation takes about target, using at most
+     * max_memlimit bytes.
+     *
+     * A derivation with opslimit 1 and max_memlimit bytes is timed
+     * first. If it already takes longer than target, the memlimit is
+     * halved until it fits (but not below crypto_pwhash_MEMLIMIT_MIN).
+     * The opslimit is then scaled up to fill the target, as the
+     * running time of Argon2 is about linear in it.
+     *
+     * This is meant to be called once at startup, as it runs (at
+     * least) one full derivation on the calling thread.
+     *
+     * Throw a std::runtime_error if crypto_pwhash() fails.
+     **/
+
+    static params_type calibrate(
+      std::chrono::milliseconds target,
+      std::size_t max_memlimit = crypto_pwhash_MEMLIMIT_MODERATE)
+    {
+        using duration = std::chrono::steady_clock::duration;
+        const unsigned long long min_ops = crypto_pwhash_OPSLIMIT_MIN;
+        const std::size_t min_mem = crypto_pwhash_MEMLIMIT_MIN;
+
+        std::size_t memlimit = std::max(max_memlimit, min_mem);
+        duration elapsed = time_pwhash(min_ops, memlimit);
+        while (elapsed > target && memlimit / 2 >= min_mem) {
+            memlimit /= 2;
+            elapsed = time_pwhash(min_ops, memlimit);
+        }
+
+        const auto per_run = std::max<duration::rep>(elapsed.count(), 1);
+        const auto runs = std::max<duration::rep>(
+          std::chrono::duration_cast<duration>(target).count() / per_run, 1);
+        const unsigned long long opslimit =
+          min_ops * static_cast<unsigned long long>(runs);
+
+        return { opslimit, memlimit };
+    }
+
+  private:
+    struct job_type
+    {
+        std::size_t memlimit;
+        std::function<void()> run;
+    };
+
+    template<typename K>
+    static std::shared_ptr<std::packaged_task<K()>> make_task(
+      K key,
+      std::string password,
+      const bytes& salt,
+      const params_type& params)
+    {
+        if (salt.size() != KEYSIZE_SALT)
+            throw std::runtime_error{
+                "sodium::pwhash_service::derive() wrong salt size"
+            };
+
+        return std::make_shared<std::packaged_task<K()>>(
+          [key = std::move(key),
+           password = std::move(password),
+           salt,
+           params]() mutable {
+              try {
+                  key.setpass(
+                    password, salt, params.opslimit, params.memlimit);
+              } catch (...) {
+                  sodium_memzero(password.data(), password.size());
+                  throw;
+              }
+              sodium_memzero(password.data(), password.size());
+
+              return std::move(key);
+          });
+    }
+
+    void enqueue(std::size_t memlimit, std::function<void()> run)
+    {
+        if (memlimit > budget_)
+            throw std::runtime_error{ "sodium::pwhash_service::derive() "
+                                      "memlimit exceeds memory budget" };
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (done_)
+                throw std::runtime_error{ "sodium::pwhash_service::derive() "
+                                          "service is shutting down" };
+            if (max_pending_ != 0 && jobs_.size() >= max_pending_)
+                throw std::runtime_error{
+                    "sodium::pwhash_service::derive() queue is full"
+                };
+            jobs_.push_back(job_type{ memlimit, std::move(run) });
+        }
+        cv_.notify_all();
+    }
+
+    void work()
+    {
+        for (;;) {
+            job_type job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] {
+                    return (done_ && jobs_.empty()) ||
+                           (!jobs_.empty() &&
+                            jobs_.front().memlimit <= budget_ - in_use_);
+                });
+                if (jobs_.empty())
+                    return; // done_ and nothing left to do
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+                in_use_ += job.memlimit;
+            }
+
+            try {
+                job.run();
+            } catch (...) {
+                // only done() callbacks can throw here: ignore them
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                in_use_ -= job.memlimit;
+            }
+            cv_.notify_all();
+        }
+    }
+
+    static std::chrono::steady_clock::duration time_pwhash(
+      unsigned long long opslimit,
+      std::size_t memlimit)
+    {
+        const char password[] = "sodium::pwhash_service::calibrate()";
+        unsigned char salt[crypto_pwhash_SALTBYTES] = {};
+        unsigned char out[32];
+
+        const auto start = std::chrono::steady_clock::now();
+        if (crypto_pwhash(out,
+                          sizeof out,
+                          password,
+                          sizeof password - 1,
+                          salt,
+                          opslimit,
+                          memlimit,
+                          crypto_pwhash_ALG_DEFAULT) != 0)
+            throw std::runtime_error{ "sodium::pwhash_service::calibrate() "
+                                      "crypto_pwhash()" };
+
+        return std::chrono::steady_clock::now() - start;
+    }
+
+    const std::size_t budget_;
+    const std::size_t max_pending_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<job_type> jobs_;
+    std::vector<std::thread> workers_;
+    std::size_t in_use_ = 0;
+    bool done_ = false;
+};
+
+} // namespace sodium
@@ -19,9 +19,19 @@
 #pragma once
 
 #include "common.h"
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <sodium.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
 namespace sodium {
 
 using default_seed_type = std::array<unsigned char, randombytes_SEEDBYTES>;
@@ -92,4 +102,170 @@ randombytes_keygen_inplace(SEED_TYPE& seed)
     ::randombytes_buf(seed.data(), seed.size());
 }
 
+class buffered_random
+{
+    /**
+     * A sodium::buffered_random hands out random bytes from a
+     * per-thread buffer of BUFFERSIZE bytes, instead of asking the
+     * system RNG (i.e. a syscall) for every small request, like
+     * randombytes_buf() does for each nonce or key.
+     *
+     * Every thread has its own ChaCha20-based generator: a buffer of
+     * randombytes_SEEDBYTES + BUFFERSIZE bytes is refilled with
+     * randombytes_buf_deterministic(), keyed by the first
+     * randombytes_SEEDBYTES bytes of the previous refill ("fast key
+     * erasure"). Bytes are zeroed as soon as they have been handed
+     * out, so that a later leak of the buffer doesn't reveal earlier
+     * output. The buffer lives in protected memory.
+     *
+     * The generator is seeded from the system CSPRNG on first use,
+     * reseeded from it every RESEED_INTERVAL refills, and after a
+     * fork() (on POSIX systems): the child doesn't repeat the
+     * parent's bytes.
+     *
+     * buffered_random also models the UniformRandomBitGenerator
+     * concept, e.g. for std::shuffle() or the <random> distributions.
+     **/
+
+  public:
+    static constexpr std::size_t BUFFERSIZE = 4096;
+    static constexpr unsigned RESEED_INTERVAL = 256; // i.e. every 1 MiB
+
+    using result_type = std::uint64_t;
+
+    static constexpr result_type min()
+    {
+        return std::numeric_limits<result_type>::min();
+    }
+    static constexpr result_type max()
+    {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()()
+    {
+        result_type result;
+        fill(&result, sizeof result);
+        return result;
+    }
+
+    /**
+     * Fill the size bytes at buf with random bytes.
+     *
+     * Requests larger than BUFFERSIZE are generated in place, with a
+     * fresh seed taken from the buffer.
+     **/
+
+    static void fill(void* buf, std::size_t size)
+    {
+        unsigned char* out = static_cast<unsigned char*>(buf);
+
+        if (size > BUFFERSIZE) {
+            unsigned char seed[randombytes_SEEDBYTES];
+            fill(seed, sizeof seed);
+            ::randombytes_buf_deterministic(out, size, seed);
+            sodium_memzero(seed, sizeof seed);
+            return;
+        }
+
+        state_type& state = local();
+        if (state.generation != generation().load())
+            state.reseed();
+
+        while (size != 0) {
+            if (state.pos == state.buffer.size())
+                state.refill();
+
+            const std::size_t n =
+              std::min(size, state.buffer.size() - state.pos);
+            std::memcpy(out, state.buffer.data() + state.pos, n);
+            sodium_memzero(state.buffer.data() + state.pos, n);
+            state.pos += n;
+            out += n;
+            size -= n;
+        }
+    }
+
+  private:
+    struct state_type
+    {
+        state_type()
+          : buffer(randombytes_SEEDBYTES + BUFFERSIZE)
+        {
+            reseed();
+        }
+
+        // a fresh seed from the system CSPRNG, and an empty buffer
+        void reseed()
+        {
+            watch_fork();
+            generation = buffered_random::generation().load();
+            ::randombytes_buf(buffer.data(), randombytes_SEEDBYTES);
+            refills = 0;
+            refill();
+        }
+
+        // the next BUFFERSIZE bytes, keyed by the last seed
+        void refill()
+        {
+            if (refills == RESEED_INTERVAL) {
+                reseed();
+                return;
+            }
+
+            unsigned char seed[randombytes_SEEDBYTES];
+            std::memcpy(seed, buffer.data(), sizeof seed);
+            ::randombytes_buf_deterministic(
+              buffer.data(), buffer.size(), seed);
+            sodium_memzero(seed, sizeof seed);
+
+            ++refills;
+            pos = randombytes_SEEDBYTES;
+        }
+
+        bytes_protected buffer;
+        std::size_t pos = 0;
+        unsigned refills = 0;
+        unsigned generation = 0;
+    };
+
+    static state_type& local()
+    {
+        thread_local state_type state;
+        return state;
+    }
+
+    // incremented in every child process after a fork()
+    static std::atomic<unsigned>& generation()
+    {
+        static std::atomic<unsigned> counter{ 0 };
+        return counter;
+    }
+
+    static void watch_fork()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        static const int registered =
+          pthread_atfork(nullptr, nullptr, [] { ++generation(); });
+        (void)registered;
+#endif
+    }
+};
+
+template<typename BT = bytes>
+BT
+randombytes_buf_buffered(const std::size_t size)
+{
+    BT buf(size);
+    buffered_random::fill(buf.data(), buf.size());
+    return buf;
+}
+
+template<typename BT = bytes>
+void
+randombytes_buf_buffered_inplace(BT& buf)
+{
+    buffered_random::fill(buf.data(), buf.size());
+}
+
 } // namespace sodium
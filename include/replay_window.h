@@ -0,0 +1,203 @@
+// replay_window.h -- Sliding-window replay protection for received nonces
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "nonce.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace sodium {
+
+template<std::size_t N, std::size_t WINDOW = 1024>
+class replay_window
+{
+    /**
+     * A sodium::replay_window<N, WINDOW> detects replayed messages on
+     * a datagram transport, where messages may be lost or reordered,
+     * but must not be accepted twice. It is the anti-replay window of
+     * IPsec and DTLS (RFC 4303, RFC 6479):
+     *
+     *   sodium::replay_window<secretbox<>::NONCESIZE> window{ first };
+     *
+     *   // for every received message, after it has been authenticated
+     *   if (!window.check_and_mark(nonce))
+     *       drop(); // a replay, or too old to tell
+     *
+     * The sender is expected to derive the nonce of its k-th message
+     * as base + k, with nonce::increment() or nonce::operator+=(), from
+     * a base nonce that the receiver knows. The window then tracks the
+     * 64-bit sequence number k = nonce - base of the received nonces:
+     * the highest one seen so far, and a bitmap of the WINDOW ones
+     * below it. Nonces that are more than 2^64-1 ahead of base, or
+     * that are too old to be in the window, are rejected.
+     *
+     * check() and check_and_mark() run in O(1), don't allocate, and
+     * don't throw: the bitmap is a ring of 64-bit blocks, and moving
+     * the window ahead only clears the blocks that it uncovers.
+     *
+     * Only mark nonces of messages that have been authenticated, or
+     * an attacker could advance the window with forged messages.
+     **/
+
+    static_assert(WINDOW % 64 == 0 && WINDOW != 0,
+                  "replay_window<> WINDOW must be a multiple of 64");
+
+    // one more block than the window, so that moving the window ahead
+    // never clears bits that are still inside of it
+    static constexpr std::size_t BLOCKS = WINDOW / 64 + 1;
+
+  public:
+    static constexpr std::size_t WINDOWSIZE = WINDOW;
+
+    using nonce_type = nonce<N>;
+
+    explicit replay_window(const nonce_type& base) noexcept
+      : base_{ base }
+    {
+        reset();
+    }
+
+    // forget all received nonces, but keep the base
+    void reset() noexcept
+    {
+        blocks_.fill(0);
+        highest_ = 0;
+        empty_ = true;
+    }
+
+    // forget all received nonces, and use a new base
+    void reset(const nonce_type& base) noexcept
+    {
+        base_ = base;
+        reset();
+    }
+
+    /**
+     * Return true if nonce would be accepted, i.e. if it is neither
+     * a replay, nor too old, nor unrelated to base.
+     **/
+
+    bool check(const nonce_type& nonce) const noexcept
+    {
+        std::uint64_t seq;
+        return sequence(nonce, seq) && check(seq);
+    }
+
+    /**
+     * Accept nonce and return true, or reject it and return false,
+     * as check() does. An accepted nonce is marked as seen, and
+     * moves the window ahead if it's the highest one so far.
+     **/
+
+    bool check_and_mark(const nonce_type& nonce) noexcept
+    {
+        std::uint64_t seq;
+        return sequence(nonce, seq) && check_and_mark(seq);
+    }
+
+    // the same, for a sequence number that is sent as such
+    bool check(std::uint64_t seq) const noexcept
+    {
+        if (empty_ || seq > highest_)
+            return true;
+        if (highest_ - seq >= WINDOW)
+            return false;
+        return (blocks_[block_of(seq)] & bit_of(seq)) == 0;
+    }
+
+    bool check_and_mark(std::uint64_t seq) noexcept
+    {
+        if (empty_ || seq > highest_) {
+            advance(seq);
+        } else {
+            if (highest_ - seq >= WINDOW)
+                return false;
+            if ((blocks_[block_of(seq)] & bit_of(seq)) != 0)
+                return false;
+        }
+
+        blocks_[block_of(seq)] |= bit_of(seq);
+        return true;
+    }
+
+    // the highest sequence number accepted so far, if !empty()
+    std::uint64_t highest() const noexcept { return highest_; }
+    bool empty() const noexcept { return empty_; }
+
+    /**
+     * Compute seq = nonce - base. Return false if the difference
+     * doesn't fit into 64 bits, i.e. if nonce isn't a nonce of this
+     * sender. Like nonce::increment(), treat nonces as little endian.
+     **/
+
+    bool sequence(const nonce_type& nonce, std::uint64_t& seq) const noexcept
+    {
+        const byte* a = nonce.data();
+        const byte* b = base_.data();
+
+        seq = 0;
+        unsigned borrow = 0;
+        byte high = 0;
+        for (std::size_t i = 0; i != N; ++i) {
+            const unsigned d = unsigned(a[i]) - unsigned(b[i]) - borrow;
+            borrow = (d >> 8) & 1;
+            if (i < sizeof seq)
+                seq |= std::uint64_t(d & 0xff) << (8 * i);
+            else
+                high |= static_cast<byte>(d);
+        }
+
+        return high == 0 && borrow == 0;
+    }
+
+  private:
+    static std::size_t block_of(std::uint64_t seq) noexcept
+    {
+        return static_cast<std::size_t>((seq / 64) % BLOCKS);
+    }
+
+    static std::uint64_t bit_of(std::uint64_t seq) noexcept
+    {
+        return std::uint64_t(1) << (seq % 64);
+    }
+
+    // move the window ahead, so that seq becomes the highest seen
+    void advance(std::uint64_t seq) noexcept
+    {
+        if (empty_) {
+            empty_ = false;
+        } else {
+            std::uint64_t uncovered = seq / 64 - highest_ / 64;
+            if (uncovered > BLOCKS)
+                uncovered = BLOCKS;
+            for (std::uint64_t i = 1; i <= uncovered; ++i)
+                blocks_[block_of(highest_ + 64 * i)] = 0;
+        }
+        highest_ = seq;
+    }
+
+    nonce_type base_;
+    std::array<std::uint64_t, BLOCKS> blocks_;
+    std::uint64_t highest_;
+    bool empty_;
+};
+
+} // namespace sodium
@@ -0,0 +1,310 @@
+// rotating_key.h -- Lock-free key rotation with epoch-based reclamation
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace sodium {
+
+namespace epoch_detail {
+
+/**
+ * The process-wide epoch domain of sodium::rotating_key<>.
+ *
+ * Each thread that reads a rotating_key owns a reader_slot, in
+ * which it announces the global epoch while it holds a key. A key
+ * retired at epoch e can be freed as soon as no slot announces an
+ * epoch <= e: the readers that entered later can only have seen its
+ * successor.
+ *
+ * Slots are cache-line sized, never freed, and recycled when their
+ * thread exits, so there are never more slots than threads alive at
+ * the same time.
+ **/
+
+class epoch_domain
+{
+  public:
+    static constexpr std::uint64_t QUIESCENT = 0;
+
+    struct alignas(64) reader_slot
+    {
+        std::atomic<std::uint64_t> epoch{ QUIESCENT };
+        std::atomic<bool> in_use{ true };
+        unsigned nesting = 0; // only touched by the owning thread
+        reader_slot* next = nullptr;
+    };
+
+    static epoch_domain& instance()
+    {
+        static epoch_domain domain;
+        return domain;
+    }
+
+    // announce the current epoch in the calling thread's slot
+    void enter() noexcept
+    {
+        reader_slot& slot = this_thread().slot;
+        if (slot.nesting++ == 0) {
+            slot.epoch.store(epoch_.load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+            // the announcement must be visible before we load a key
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void leave() noexcept
+    {
+        reader_slot& slot = this_thread().slot;
+        if (--slot.nesting == 0)
+            slot.epoch.store(QUIESCENT, std::memory_order_release);
+    }
+
+    // start a new epoch, and return the one that just ended
+    std::uint64_t advance() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch_.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    // the oldest epoch announced by a reader, or UINT64_MAX if none
+    std::uint64_t oldest_reader() const noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        std::uint64_t result = UINT64_MAX;
+        for (const reader_slot* s = slots_.load(std::memory_order_acquire);
+             s != nullptr;
+             s = s->next) {
+            const std::uint64_t e = s->epoch.load(std::memory_order_acquire);
+            if (e != QUIESCENT && e < result)
+                result = e;
+        }
+        return result;
+    }
+
+  private:
+    // a thread's hold on a slot, released when the thread exits
+    struct thread_handle
+    {
+        explicit thread_handle(epoch_domain& domain)
+          : slot(domain.acquire_slot())
+        {}
+        ~thread_handle()
+        {
+            slot.in_use.store(false, std::memory_order_release);
+        }
+
+        reader_slot& slot;
+    };
+
+    epoch_domain() = default;
+
+    thread_handle& this_thread()
+    {
+        thread_local thread_handle handle{ *this };
+        return handle;
+    }
+
+    reader_slot& acquire_slot()
+    {
+        // recycle the slot of an exited thread...
+        for (reader_slot* s = slots_.load(std::memory_order_acquire);
+             s != nullptr;
+             s = s->next) {
+            bool expected = false;
+            if (s->in_use.compare_exchange_strong(expected, true))
+                return *s;
+        }
+
+        // ... or add a new one
+        reader_slot* s = new reader_slot;
+        s->next = slots_.load(std::memory_order_relaxed);
+        while (!slots_.compare_exchange_weak(
+          s->next, s, std::memory_order_release, std::memory_order_relaxed))
+            ; // s->next has been updated with the current head, retry
+        return *s;
+    }
+
+    std::atomic<std::uint64_t> epoch_{ 1 }; // 0 is QUIESCENT
+    std::atomic<reader_slot*> slots_{ nullptr };
+};
+
+} // namespace epoch_detail
+
+template<typename T>
+class rotating_key
+{
+    /**
+     * A sodium::rotating_key<T> holds the current key, or keyed
+     * object (e.g. a sodium::secretbox<>, sodium::aead<> or
+     * sodium::authenticator<>), of a service, and lets writers
+     * replace it while readers keep using it concurrently:
+     *
+     *   sodium::rotating_key<sodium::secretbox<>> box{ secretbox<>() };
+     *
+     *   // readers, on any thread
+     *   auto current = box.read();
+     *   current->encrypt(out, plaintext, nonce);
+     *
+     *   // a writer, e.g. hourly
+     *   box.rotate(secretbox<>(new_key));
+     *
+     * Readers don't take any lock: read() announces the current epoch
+     * in a per-thread slot, and loads the current object with a single
+     * atomic acquire. rotate() swaps in the new object, and retires
+     * the old one, which is destroyed (and its key material wiped by
+     * the protected memory allocator) as soon as no reader that could
+     * have seen it still holds a reader_guard.
+     *
+     * Retired objects are reclaimed by rotate(), reclaim() and the
+     * destructor; rotate() and reclaim() never wait for readers.
+     *
+     * All readers share the same T object: only call the members of T
+     * that are safe to call concurrently, such as the encrypt() and
+     * decrypt() members of the wrappers.
+     **/
+
+  public:
+    /**
+     * A reader_guard gives access to the current object, and keeps it
+     * alive, until it goes out of scope. Don't hold it for long: it
+     * delays the reclamation of everything retired in the meantime.
+     **/
+
+    class reader_guard
+    {
+      public:
+        ~reader_guard() { epoch_detail::epoch_domain::instance().leave(); }
+
+        reader_guard(const reader_guard&) = delete;
+        reader_guard& operator=(const reader_guard&) = delete;
+
+        T& operator*() const noexcept { return *current_; }
+        T* operator->() const noexcept { return current_; }
+        T* get() const noexcept { return current_; }
+
+      private:
+        friend class rotating_key;
+
+        explicit reader_guard(const std::atomic<T*>& current) noexcept
+        {
+            epoch_detail::epoch_domain::instance().enter();
+            current_ = current.load(std::memory_order_acquire);
+        }
+
+        T* current_;
+    };
+
+    explicit rotating_key(T initial)
+      : current_{ new T(std::move(initial)) }
+    {}
+
+    rotating_key(const rotating_key&) = delete;
+    rotating_key& operator=(const rotating_key&) = delete;
+
+    // there must not be any reader left
+    ~rotating_key()
+    {
+        delete current_.load(std::memory_order_relaxed);
+        for (auto& r : retired_)
+            delete r.ptr;
+    }
+
+    reader_guard read() const noexcept { return reader_guard{ current_ }; }
+
+    /**
+     * Call f(T&) with the current object, and return its result.
+     **/
+
+    template<typename F>
+    decltype(auto) with(F&& f) const
+    {
+        reader_guard guard = read();
+        return std::forward<F>(f)(*guard);
+    }
+
+    /**
+     * Replace the current object by next. Readers that already hold
+     * the previous one keep using it; new readers get next.
+     *
+     * Throws std::bad_alloc if next can't be moved to the heap.
+     **/
+
+    void rotate(T next)
+    {
+        std::unique_ptr<T> fresh{ new T(std::move(next)) };
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        retired_.reserve(retired_.size() + 1);
+
+        T* old = current_.exchange(fresh.release(), std::memory_order_acq_rel);
+        const std::uint64_t epoch =
+          epoch_detail::epoch_domain::instance().advance();
+        retired_.push_back(retired_type{ old, epoch });
+
+        reclaim_locked();
+    }
+
+    /**
+     * Destroy the retired objects that no reader can hold anymore,
+     * and return the number of those that are still pending.
+     **/
+
+    std::size_t reclaim()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reclaim_locked();
+        return retired_.size();
+    }
+
+  private:
+    struct retired_type
+    {
+        T* ptr;
+        std::uint64_t epoch; // the epoch it was retired in
+    };
+
+    void reclaim_locked()
+    {
+        const std::uint64_t oldest =
+          epoch_detail::epoch_domain::instance().oldest_reader();
+
+        std::size_t kept = 0;
+        for (auto& r : retired_) {
+            if (r.epoch < oldest)
+                delete r.ptr;
+            else
+                retired_[kept++] = r;
+        }
+        retired_.resize(kept);
+    }
+
+    std::atomic<T*> current_;
+    mutable std::mutex mutex_;
+    std::vector<retired_type> retired_;
+};
+
+} // namespace sodium
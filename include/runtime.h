@@ -0,0 +1,133 @@
+// runtime.h -- One-time library initialization and CPU feature probe
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <stdexcept> // std::runtime_error
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * The CPU features libsodium dispatches on, as probed by sodium_init()
+ * (sodium_runtime_has_*()), and the dispatch decisions derived from
+ * them.
+ **/
+
+struct cpu_features
+{
+    bool sse2 = false;
+    bool ssse3 = false;
+    bool sse41 = false;
+    bool avx = false;
+    bool avx2 = false;
+    bool avx512f = false;
+    bool aesni = false;
+    bool pclmul = false;
+    bool neon = false;
+
+    // crypto_aead_aes256gcm_*() can be used (AES-NI and PCLMUL)
+    bool aes256gcm = false;
+};
+
+class runtime
+{
+    /**
+     * sodium::runtime initializes libsodium once per process: the
+     * first call of instance() from any thread constructs a
+     * function-local static (thread-safe since C++11), which calls
+     * sodium_init(), probes the CPU features and caches them together
+     * with the dispatch decisions of the wrappers (e.g. whether
+     * aead_auto can pick AES-GCM). All later calls return the same
+     * immutable object. Once sodium_init() succeeded, randombytes_*()
+     * is usable: libsodium seeds it there, or fails.
+     *
+     * The wrappers consult the cached values instead of calling into
+     * libsodium again. ensure() is the fast path for code that runs
+     * very often, such as the constructors of sodium::allocator with
+     * SODIUM_INIT_IN_ALLOCATOR: after the first call in a thread, it
+     * only reads a thread_local flag, without atomic operations.
+     *
+     * Calling sodium_init() directly, before or after, is harmless.
+     **/
+
+  public:
+    runtime(const runtime&) = delete;
+    runtime& operator=(const runtime&) = delete;
+
+    // The process-wide runtime, initialized on first use
+    static const runtime& instance() noexcept
+    {
+        static const runtime the_runtime;
+        return the_runtime;
+    }
+
+    /**
+     * Make sure libsodium is initialized, and return the runtime.
+     * Throw a std::runtime_error if sodium_init() failed.
+     **/
+
+    static const runtime& init()
+    {
+        const runtime& rt = instance();
+        if (!rt.ok())
+            throw std::runtime_error{ "sodium::runtime::init() "
+                                      "sodium_init() failed" };
+        return rt;
+    }
+
+    // Same as init(), but only the first call per thread does any work
+    static void ensure()
+    {
+        static thread_local bool initialized = false;
+        if (!initialized) {
+            init();
+            initialized = true;
+        }
+    }
+
+    // sodium_init() succeeded
+    bool ok() const noexcept { return ok_; }
+
+    const cpu_features& cpu() const noexcept { return cpu_; }
+
+  private:
+    runtime() noexcept
+    {
+        ok_ = sodium_init() != -1;
+        if (!ok_)
+            return;
+
+        cpu_.sse2 = sodium_runtime_has_sse2() == 1;
+        cpu_.ssse3 = sodium_runtime_has_ssse3() == 1;
+        cpu_.sse41 = sodium_runtime_has_sse41() == 1;
+        cpu_.avx = sodium_runtime_has_avx() == 1;
+        cpu_.avx2 = sodium_runtime_has_avx2() == 1;
+        cpu_.avx512f = sodium_runtime_has_avx512f() == 1;
+        cpu_.aesni = sodium_runtime_has_aesni() == 1;
+        cpu_.pclmul = sodium_runtime_has_pclmul() == 1;
+        cpu_.neon = sodium_runtime_has_neon() == 1;
+        cpu_.aes256gcm = crypto_aead_aes256gcm_is_available() == 1;
+    }
+
+    bool ok_ = false;
+    cpu_features cpu_;
+};
+
+} // namespace sodium
@@ -19,10 +19,18 @@
 #pragma once
 
 #include "common.h"
+#include "error.h"
+#include "extern_templates.h"
 #include "key.h"
+#include "metrics.h"
 #include "nonce.h"
+#include "padding.h"
+#include "span.h"
 
+#include <cstring>
 #include <sodium.h>
+#include <stdexcept>
+#include <system_error>
 
 namespace sodium {
 
@@ -38,23 +46,39 @@ class secretbox
     using bytes_type = BT;
     using nonce_type = nonce<NONCESIZE>;
     using key_type = key<KEYSIZE>;
+    using shared_key_type = shared_key<KEYSIZE>;
 
     // A secretbox with a new random key
     secretbox()
-      : key_(std::move(key_type()))
+      : key_(make_shared_key(key_type()))
     {}
 
     // A secretbox with a user-supplied key (copying version)
     secretbox(const key_type& key)
-      : key_(key)
+      : key_(make_shared_key(key))
     {}
 
     // A secretbox with a user-supplied key (moving version)
     secretbox(key_type&& key)
-      : key_(std::move(key))
+      : key_(make_shared_key(std::move(key)))
     {}
 
-    // A copying constructor
+    /**
+     * A secretbox sharing the immutable key of other wrappers,
+     * filters, etc., see make_shared_key(). Throw a std::runtime_error
+     * if key is empty.
+     **/
+
+    explicit secretbox(shared_key_type key)
+      : key_(std::move(key))
+    {
+        if (!key_)
+            throw std::runtime_error{
+                "sodium::secretbox::secretbox() empty key"
+            };
+    }
+
+    // A copying constructor: shares the (immutable) key of other
     secretbox(const secretbox& other)
       : key_(other.key_)
     {}
@@ -66,6 +90,9 @@ class secretbox
 
     // XXX copying and moving assignment operators?
 
+    // the shared key of this secretbox
+    const shared_key_type& key_handle() const noexcept { return key_; }
+
     /**
      * Encrypt plaintext using secretbox's key and supplied nonce,
      * returning ciphertext.
@@ -89,7 +116,7 @@ class secretbox
      * and it too won't be stored in protected key_type memory.
      **/
 
-    BT encrypt(const BT& plaintext, const nonce_type& nonce);
+    BT encrypt(const BT& plaintext, const nonce_type& nonce) const;
 
     /**
      * In-place variant.
@@ -99,7 +126,7 @@ class secretbox
 
     void encrypt(BT& ciphertext_with_mac,
                  const BT& plaintext,
-                 const nonce_type& nonce);
+                 const nonce_type& nonce) const;
 
     /**
      * Encrypt plaintext using secretbox's key and supplied nonce,
@@ -127,7 +154,7 @@ class secretbox
      * channel, and they too won't be stored in protected key_type memory.
      **/
 
-    BT encrypt(const BT& plaintext, const nonce_type& nonce, BT& mac);
+    BT encrypt(const BT& plaintext, const nonce_type& nonce, BT& mac) const;
 
     /**
      * In-place variant.
@@ -138,7 +165,7 @@ class secretbox
     void encrypt(BT& ciphertext,
                  const BT& plaintext,
                  const nonce_type& nonce,
-                 BT& mac);
+                 BT& mac) const;
 
     /**
      * Decrypt ciphertext using secretbox's key and supplied nonce,
@@ -153,7 +180,7 @@ class secretbox
      * the ciphertext is too small to even contain the MAC (MACSIZE bytes).
      **/
 
-    BT decrypt(const BT& ciphertext_with_mac, const nonce_type& nonce);
+    BT decrypt(const BT& ciphertext_with_mac, const nonce_type& nonce) const;
 
     /**
      * In-place variant.
@@ -163,7 +190,7 @@ class secretbox
 
     void decrypt(BT& decrypted,
                  const BT& ciphertext_with_mac,
-                 const nonce_type& nonce);
+                 const nonce_type& nonce) const;
 
     /**
      * Decrypt ciphertext using secretbox's key and supplied nonce,
@@ -180,7 +207,9 @@ class secretbox
      * the mac isn't MACSIZE.
      **/
 
-    BT decrypt(const BT& ciphertext, const nonce_type& nonce, const BT& mac);
+    BT decrypt(const BT& ciphertext,
+               const nonce_type& nonce,
+               const BT& mac) const;
 
     /**
      * In-place variant.
@@ -191,15 +220,227 @@ class secretbox
     void decrypt(BT& decrypted,
                  const BT& ciphertext,
                  const nonce_type& nonce,
-                 const BT& mac);
+                 const BT& mac) const;
+
+    /**
+     * Non-throwing variants of the two decrypt() functions above.
+     *
+     * Instead of throwing a std::runtime_error, they set ec to
+     * sodium::errc::verification_failed if the ciphertext or the MAC
+     * have been tampered with, or to sodium::errc::message_too_short
+     * or sodium::errc::wrong_size, and return an empty BT. On success,
+     * ec is cleared. See error.h.
+     *
+     * The in-place variants don't need such overloads: just call the
+     * span-based decrypt() functions below, which return -1 instead.
+     **/
+
+    BT decrypt(const BT& ciphertext_with_mac,
+               const nonce_type& nonce,
+               std::error_code& ec) const;
+
+    BT decrypt(const BT& ciphertext,
+               const nonce_type& nonce,
+               const BT& mac,
+               std::error_code& ec) const;
+
+    /**
+     * The size of the combined (MAC || ciphertext) of a plaintext of
+     * plaintext_size bytes, and the other way around. plaintext_size()
+     * returns 0 if ciphertext_size is too small to even hold a MAC.
+     **/
+
+    static constexpr std::size_t ciphertext_size(std::size_t plaintext_size)
+    {
+        return MACSIZE + plaintext_size;
+    }
+
+    static constexpr std::size_t plaintext_size(std::size_t ciphertext_size)
+    {
+        return ciphertext_size < MACSIZE ? 0 : ciphertext_size - MACSIZE;
+    }
+
+    /**
+     * Allocation-free variants of encrypt() and decrypt() above.
+     *
+     * These functions read from and write into caller-owned buffers,
+     * passed as sodium::span<>s, e.g. sub-regions of a larger send or
+     * receive buffer:
+     *
+     *   span<byte> out(sendbuf + offset, secretbox<>::ciphertext_size(n));
+     *   if (sb.encrypt(out, span<const byte>(msg, n), nonce) != 0) ...
+     *
+     * They never allocate nor throw. Instead, they return 0 on success
+     * and -1 on failure (a too small output buffer, a wrong MAC size,
+     * or a forged/corrupted message), like the underlying libsodium
+     * functions. Output buffers may be larger than needed: only the
+     * first ciphertext_size() / plaintext_size() bytes are written.
+     *
+     * Encryption and decryption can be done in-place: the output span
+     * may start at the same address as the input span. Partially
+     * overlapping spans are not supported.
+     **/
+
+    int encrypt(span<byte> ciphertext_with_mac,
+                span<const byte> plaintext,
+                const nonce_type& nonce) const noexcept
+    {
+        if (ciphertext_with_mac.size() < ciphertext_size(plaintext.size()))
+            return -1;
+
+        if (crypto_secretbox_easy(ciphertext_with_mac.data(),
+                                  plaintext.data(),
+                                  plaintext.size(),
+                                  nonce.data(),
+                                  key_->data()) != 0)
+            return -1;
+
+        metrics::bytes_encrypted(plaintext.size());
+        return 0;
+    }
+
+    // detached mode: mac must be exactly MACSIZE bytes long
+    int encrypt(span<byte> ciphertext,
+                span<byte> mac,
+                span<const byte> plaintext,
+                const nonce_type& nonce) const noexcept
+    {
+        if (mac.size() != MACSIZE || ciphertext.size() < plaintext.size())
+            return -1;
+
+        if (crypto_secretbox_detached(ciphertext.data(),
+                                      mac.data(),
+                                      plaintext.data(),
+                                      plaintext.size(),
+                                      nonce.data(),
+                                      key_->data()) != 0)
+            return -1;
+
+        metrics::bytes_encrypted(plaintext.size());
+        return 0;
+    }
+
+    int decrypt(span<byte> decrypted,
+                span<const byte> ciphertext_with_mac,
+                const nonce_type& nonce) const noexcept
+    {
+        if (ciphertext_with_mac.size() < MACSIZE ||
+            decrypted.size() < plaintext_size(ciphertext_with_mac.size()))
+            return -1;
+
+        if (crypto_secretbox_open_easy(decrypted.data(),
+                                       ciphertext_with_mac.data(),
+                                       ciphertext_with_mac.size(),
+                                       nonce.data(),
+                                       key_->data()) != 0) {
+            metrics::mac_failure();
+            return -1;
+        }
+
+        metrics::bytes_decrypted(ciphertext_with_mac.size() - MACSIZE);
+        return 0;
+    }
+
+    // detached mode: mac must be exactly MACSIZE bytes long
+    int decrypt(span<byte> decrypted,
+                span<const byte> ciphertext,
+                span<const byte> mac,
+                const nonce_type& nonce) const noexcept
+    {
+        if (mac.size() != MACSIZE || decrypted.size() < ciphertext.size())
+            return -1;
+
+        if (crypto_secretbox_open_detached(decrypted.data(),
+                                           ciphertext.data(),
+                                           mac.data(),
+                                           ciphertext.size(),
+                                           nonce.data(),
+                                           key_->data()) != 0) {
+            metrics::mac_failure();
+            return -1;
+        }
+
+        metrics::bytes_decrypted(ciphertext.size());
+        return 0;
+    }
+
+    /**
+     * Pad plaintext to a multiple of blocksize (see sodium::pad()) and
+     * encrypt it, in a single pass over ciphertext_with_mac: the
+     * plaintext is copied once, straight into the output buffer,
+     * padded there, and encrypted in place. If plaintext already sits
+     * at ciphertext_with_mac.data() + MACSIZE, it isn't even copied.
+     *
+     * The result (MAC || padded ciphertext) is the same as encrypt()
+     * of the padded plaintext. Its length, MACSIZE +
+     * padded_size(plaintext.size(), blocksize), is stored into
+     * ciphertext_len.
+     *
+     * Return 0 on success, or -1 if ciphertext_with_mac is too small
+     * or blocksize is 0.
+     **/
+
+    int encrypt_padded(span<byte> ciphertext_with_mac,
+                       span<const byte> plaintext,
+                       std::size_t blocksize,
+                       const nonce_type& nonce,
+                       std::size_t& ciphertext_len) const noexcept
+    {
+        if (ciphertext_with_mac.size() < MACSIZE)
+            return -1;
+
+        span<byte> body = ciphertext_with_mac.subspan(
+          MACSIZE, ciphertext_with_mac.size() - MACSIZE);
+        if (plaintext.size() > body.size())
+            return -1;
+        std::memmove(body.data(), plaintext.data(), plaintext.size());
+
+        std::size_t padded_len;
+        if (sodium::pad(body, plaintext.size(), blocksize, padded_len) != 0)
+            return -1;
+
+        body = body.first(padded_len);
+        span<byte> mac = ciphertext_with_mac.first(MACSIZE);
+        if (encrypt(body, mac, body, nonce) != 0)
+            return -1;
+
+        ciphertext_len = MACSIZE + padded_len;
+        return 0;
+    }
+
+    /**
+     * Decrypt a ciphertext created by encrypt_padded() into decrypted,
+     * and store the length of the plaintext without its padding into
+     * plaintext_len. decrypted must have room for the padded
+     * plaintext, i.e. plaintext_size(ciphertext_with_mac.size())
+     * bytes.
+     *
+     * Return 0 on success, or -1 if decrypted is too small, if the
+     * ciphertext has been tampered with, or if the pad is malformed.
+     **/
+
+    int decrypt_padded(span<byte> decrypted,
+                       span<const byte> ciphertext_with_mac,
+                       std::size_t blocksize,
+                       const nonce_type& nonce,
+                       std::size_t& plaintext_len) const noexcept
+    {
+        if (decrypt(decrypted, ciphertext_with_mac, nonce) != 0)
+            return -1;
+
+        return sodium::unpad(
+          decrypted.first(plaintext_size(ciphertext_with_mac.size())),
+          blocksize,
+          plaintext_len);
+    }
 
   private:
-    key_type key_;
+    shared_key_type key_;
 };
 
 template<class BT>
 BT
-secretbox<BT>::encrypt(const BT& plaintext, const nonce_type& nonce)
+secretbox<BT>::encrypt(const BT& plaintext, const nonce_type& nonce) const
 {
     // make space for MAC and encrypted message,
     // combined form, i.e. (MAC || encrypted)
@@ -211,7 +452,8 @@ secretbox<BT>::encrypt(const BT& plaintext, const nonce_type& nonce)
       reinterpret_cast<const unsigned char*>(plaintext.data()),
       plaintext.size(),
       nonce.data(),
-      key_.data());
+      key_->data());
+    metrics::bytes_encrypted(plaintext.size());
 
     // return the encrypted bytes
     return ciphertext_with_mac;
@@ -221,7 +463,7 @@ template<class BT>
 void
 secretbox<BT>::encrypt(BT& ciphertext_with_mac,
                        const BT& plaintext,
-                       const nonce_type& nonce)
+                       const nonce_type& nonce) const
 {
     // sanity check before we get started:
     if (ciphertext_with_mac.size() != plaintext.size() + MACSIZE)
@@ -235,14 +477,17 @@ secretbox<BT>::encrypt(BT& ciphertext_with_mac,
       reinterpret_cast<const unsigned char*>(plaintext.data()),
       plaintext.size(),
       nonce.data(),
-      key_.data());
+      key_->data());
+    metrics::bytes_encrypted(plaintext.size());
 
     // ciphertext_with_mac is the implicit return value
 }
 
 template<class BT>
 BT
-secretbox<BT>::encrypt(const BT& plaintext, const nonce_type& nonce, BT& mac)
+secretbox<BT>::encrypt(const BT& plaintext,
+                       const nonce_type& nonce,
+                       BT& mac) const
 {
     // some sanity checks before we get started
     if (mac.size() != MACSIZE)
@@ -261,7 +506,8 @@ secretbox<BT>::encrypt(const BT& plaintext, const nonce_type& nonce, BT& mac)
       reinterpret_cast<const unsigned char*>(plaintext.data()),
       plaintext.size(),
       nonce.data(),
-      key_.data());
+      key_->data());
+    metrics::bytes_encrypted(plaintext.size());
 
     // return the encrypted bytes (mac is returned by reference)
     return ciphertext; // by move semantics
@@ -272,7 +518,7 @@ void
 secretbox<BT>::encrypt(BT& ciphertext,
                        const BT& plaintext,
                        const nonce_type& nonce,
-                       BT& mac)
+                       BT& mac) const
 {
     // some sanity checks before we get started
     if (ciphertext.size() != plaintext.size())
@@ -291,14 +537,16 @@ secretbox<BT>::encrypt(BT& ciphertext,
       reinterpret_cast<const unsigned char*>(plaintext.data()),
       plaintext.size(),
       nonce.data(),
-      key_.data());
+      key_->data());
+    metrics::bytes_encrypted(plaintext.size());
 
     // ciphertext and mac are returned by reference
 }
 
 template<class BT>
 BT
-secretbox<BT>::decrypt(const BT& ciphertext_with_mac, const nonce_type& nonce)
+secretbox<BT>::decrypt(const BT& ciphertext_with_mac,
+                       const nonce_type& nonce) const
 {
     // some sanity checks before we get started
     if (ciphertext_with_mac.size() < MACSIZE)
@@ -314,10 +562,13 @@ secretbox<BT>::decrypt(const BT& ciphertext_with_mac, const nonce_type& nonce)
           reinterpret_cast<const unsigned char*>(ciphertext_with_mac.data()),
           ciphertext_with_mac.size(),
           nonce.data(),
-          key_.data()) != 0)
+          key_->data()) != 0) {
+        metrics::mac_failure();
         throw std::runtime_error{
             "sodium::secretbox::decrypt(combined) can't decrypt"
         };
+    }
+    metrics::bytes_decrypted(decrypted.size());
 
     return decrypted;
 }
@@ -326,7 +577,7 @@ template<class BT>
 void
 secretbox<BT>::decrypt(BT& decrypted,
                        const BT& ciphertext_with_mac,
-                       const nonce_type& nonce)
+                       const nonce_type& nonce) const
 {
     // some sanity checks before we get started
     if (ciphertext_with_mac.size() < MACSIZE)
@@ -343,10 +594,13 @@ secretbox<BT>::decrypt(BT& decrypted,
           reinterpret_cast<const unsigned char*>(ciphertext_with_mac.data()),
           ciphertext_with_mac.size(),
           nonce.data(),
-          key_.data()) != 0)
+          key_->data()) != 0) {
+        metrics::mac_failure();
         throw std::runtime_error{
             "sodium::secretbox::decrypt(combined) can't decrypt"
         };
+    }
+    metrics::bytes_decrypted(decrypted.size());
 
     // decrypted is returned by reference
 }
@@ -355,7 +609,7 @@ template<class BT>
 BT
 secretbox<BT>::decrypt(const BT& ciphertext,
                        const nonce_type& nonce,
-                       const BT& mac)
+                       const BT& mac) const
 {
     // some sanity checks before we get started
     if (mac.size() != MACSIZE)
@@ -374,10 +628,13 @@ secretbox<BT>::decrypt(const BT& ciphertext,
           reinterpret_cast<const unsigned char*>(mac.data()),
           ciphertext.size(),
           nonce.data(),
-          key_.data()) != 0)
+          key_->data()) != 0) {
+        metrics::mac_failure();
         throw std::runtime_error{
             "sodium::secretbox::decrypt(detached) can't decrypt"
         };
+    }
+    metrics::bytes_decrypted(decrypted.size());
 
     return decrypted; // by move semantics
 }
@@ -387,7 +644,7 @@ void
 secretbox<BT>::decrypt(BT& decrypted,
                        const BT& ciphertext,
                        const nonce_type& nonce,
-                       const BT& mac)
+                       const BT& mac) const
 {
     // some sanity checks before we get started
     if (decrypted.size() != ciphertext.size())
@@ -406,12 +663,66 @@ secretbox<BT>::decrypt(BT& decrypted,
           reinterpret_cast<const unsigned char*>(mac.data()),
           ciphertext.size(),
           nonce.data(),
-          key_.data()) != 0)
+          key_->data()) != 0) {
+        metrics::mac_failure();
         throw std::runtime_error{
             "sodium::secretbox::decrypt(detached) can't decrypt"
         };
+    }
+    metrics::bytes_decrypted(decrypted.size());
 
     // decrypted is returned by reference
 }
 
+template<class BT>
+BT
+secretbox<BT>::decrypt(const BT& ciphertext_with_mac,
+                       const nonce_type& nonce,
+                       std::error_code& ec) const
+{
+    if (ciphertext_with_mac.size() < MACSIZE) {
+        ec = errc::message_too_short;
+        return BT();
+    }
+
+    BT decrypted(ciphertext_with_mac.size() - MACSIZE);
+    if (decrypt(span<byte>(decrypted),
+                span<const byte>(ciphertext_with_mac),
+                nonce) != 0) {
+        ec = errc::verification_failed;
+        return BT();
+    }
+
+    ec.clear();
+    return decrypted;
+}
+
+template<class BT>
+BT
+secretbox<BT>::decrypt(const BT& ciphertext,
+                       const nonce_type& nonce,
+                       const BT& mac,
+                       std::error_code& ec) const
+{
+    if (mac.size() != MACSIZE) {
+        ec = errc::wrong_size;
+        return BT();
+    }
+
+    BT decrypted(ciphertext.size());
+    if (decrypt(span<byte>(decrypted),
+                span<const byte>(ciphertext),
+                span<const byte>(mac),
+                nonce) != 0) {
+        ec = errc::verification_failed;
+        return BT();
+    }
+
+    ec.clear();
+    return decrypted;
+}
+
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(secretbox);
+
 } // namespace sodium
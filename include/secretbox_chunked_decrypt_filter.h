@@ -0,0 +1,236 @@
+// secretbox_chunked_decrypt_filter.h -- Chunked secretbox decryption filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "filter_profile.h"
+#include "key.h"
+#include "nonce.h"
+#include "secretbox.h"
+#include "secretbox_chunked_encrypt_filter.h" // secretbox_chunk_nonce()
+#include "span.h"
+#include "trace.h"
+
+#include <boost/iostreams/filter/symmetric.hpp>
+#include <boost/iostreams/pipeline.hpp>
+
+#include <algorithm> // std::min<>, std::copy
+#include <cstddef>   // std::size_t
+#include <cstdint>   // std::uint64_t
+#include <stdexcept> // std::runtime_error
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+namespace sodium {
+
+class secretbox_chunked_decrypt_symmetric_filter
+{
+    /**
+     * Decrypt a stream generated by secretbox_chunked_encrypt_filter,
+     * chunk by chunk, using memory proportional to the chunk size. See
+     * the format description in secretbox_chunked_encrypt_filter.h.
+     *
+     * Each chunk is authenticated _before_ its plaintext is emitted.
+     * A std::runtime_error is thrown if
+     *   - a chunk doesn't authenticate (wrong key, nonce or chunksize,
+     *     tampered, reordered, dropped or duplicated chunks, or data
+     *     appended after the final chunk),
+     *   - the stream ends without a final chunk (truncation).
+     * No strong guarantee: the plaintext of all chunks preceding the
+     * failure has been emitted already.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = secretbox<chars>::KEYSIZE;
+    static constexpr std::size_t NONCESIZE = secretbox<chars>::NONCESIZE;
+    static constexpr std::size_t MACSIZE = secretbox<chars>::MACSIZE;
+
+    typedef char char_type;
+
+    using key_type = secretbox<chars>::key_type;
+    using nonce_type = secretbox<chars>::nonce_type;
+
+    secretbox_chunked_decrypt_symmetric_filter(const key_type& key,
+                                               const nonce_type& nonce,
+                                               const std::size_t chunksize)
+      : secretbox_{ key }
+      , nonce_{ nonce }
+      , running_nonce_{ nonce }
+      , index_{ 0 }
+      , chunksize_{ chunksize }
+      , out_(chunksize)
+      , out_pos_{ 0 }
+      , out_size_{ 0 }
+      , finished_{ false }
+    {
+        if (chunksize < 1)
+            throw std::runtime_error{
+                "sodium::secretbox_chunked_decrypt_filter::"
+                "secretbox_chunked_decrypt_filter() wrong chunksize"
+            };
+        in_.reserve(MACSIZE + chunksize_);
+    }
+
+    bool filter(const char_type*& i1,
+                const char_type* i2,
+                char_type*& o1,
+                char_type* o2,
+                bool flush)
+    {
+        SODIUM_PROFILE_SPAN("secretbox_chunked_decrypt_filter", i1);
+
+        for (;;) {
+            // first, write out what's still waiting in out_
+            if (out_pos_ != out_size_) {
+                const auto n =
+                  std::min<std::size_t>(out_size_ - out_pos_, o2 - o1);
+                std::copy(out_.cbegin() + out_pos_,
+                          out_.cbegin() + out_pos_ + n,
+                          o1);
+                out_pos_ += n;
+                o1 += n;
+                if (out_pos_ != out_size_)
+                    return true; // output buffer is full, call again
+            }
+
+            if (finished_)
+                return false; // all done
+
+            // then, collect the next (MAC || ciphertext)
+            const auto n =
+              std::min<std::size_t>(MACSIZE + chunksize_ - in_.size(), i2 - i1);
+            in_.insert(in_.end(), i1, i1 + n);
+            i1 += n;
+
+            // a full chunk is never the final one, which is shorter
+            if (in_.size() == MACSIZE + chunksize_) {
+                open(running_nonce_);
+                continue;
+            }
+
+            if (!flush)
+                return true; // need more input
+
+            // end of stream: what's left must be the final chunk
+            if (in_.size() < MACSIZE)
+                throw std::runtime_error{
+                    "sodium::secretbox_chunked_decrypt_filter::filter() "
+                    "stream truncated"
+                };
+            open(secretbox_chunk_nonce(nonce_, index_, true));
+            finished_ = true;
+        }
+    }
+
+    /**
+     * Prepare to decrypt a whole new stream, starting at chunk 0.
+     **/
+
+    void close()
+    {
+        SODIUM_TRACE(
+          "sodium::secretbox_chunked_decrypt_symmetric_filter::close()",
+          "called");
+
+        in_.clear();
+        sodium_memzero(out_.data(), out_.size());
+        out_pos_ = out_size_ = 0;
+        running_nonce_ = nonce_;
+        index_ = 0;
+        finished_ = false;
+    }
+
+  private:
+    // decrypt and authenticate the chunk in in_ with nonce into out_
+    void open(const nonce_type& nonce)
+    {
+        if (secretbox_.decrypt(
+              span<byte>(out_), span<const byte>(in_), nonce) != 0)
+            throw std::runtime_error{
+                "sodium::secretbox_chunked_decrypt_filter::filter() "
+                "can't decrypt chunk"
+            };
+        out_size_ = secretbox<chars>::plaintext_size(in_.size());
+        out_pos_ = 0;
+
+        in_.clear();
+        running_nonce_.increment();
+        ++index_;
+    }
+
+    secretbox<chars> secretbox_;
+    nonce_type nonce_;         // base nonce of the stream
+    nonce_type running_nonce_; // nonce_ + index_
+    std::uint64_t index_;      // number of the current chunk
+    std::size_t chunksize_;
+    chars in_;  // (MAC || ciphertext) of the current chunk
+    chars out_; // decrypted chunk, up to chunksize_ bytes
+    std::size_t out_pos_;  // bytes of out_ already written
+    std::size_t out_size_; // bytes of out_ to be written
+    bool finished_;        // final chunk read?
+}; // secretbox_chunked_decrypt_symmetric_filter
+
+// Turn secretbox_chunked_decrypt_symmetric_filter into a DualUse filter:
+
+class secretbox_chunked_decrypt_filter
+  : public io::symmetric_filter<secretbox_chunked_decrypt_symmetric_filter>
+{
+    /**
+     * secretbox_chunked_decrypt_filter is a DualUseFilter that decrypts
+     * a stream produced by secretbox_chunked_encrypt_filter, using
+     * memory proportional to chunksize.
+     *
+     * Parameters:
+     *   buffer_size: size of the internal buffer of symmetric_filter.
+     *   key        : the secret key used for encryption/decryption.
+     *   nonce      : the base nonce used for encryption.
+     *   chunksize  : number of plaintext bytes per encrypted chunk,
+     *                which MUST be the same as for encryption.
+     *
+     * The truncation check happens when the chain is closed, so
+     * don't trust the output before close() returned successfully.
+     **/
+
+  private:
+    typedef io::symmetric_filter<secretbox_chunked_decrypt_symmetric_filter>
+      base_type;
+    typedef secretbox_chunked_decrypt_symmetric_filter symmetric_filter_type;
+
+  public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::category category;
+
+    static constexpr std::size_t MACSIZE = symmetric_filter_type::MACSIZE;
+
+    using key_type = symmetric_filter_type::key_type;
+    using nonce_type = symmetric_filter_type::nonce_type;
+
+    secretbox_chunked_decrypt_filter(std::streamsize buffer_size,
+                                     const key_type& key,
+                                     const nonce_type& nonce,
+                                     const std::size_t chunksize)
+      : base_type(buffer_size, key, nonce, chunksize)
+    {}
+};
+
+BOOST_IOSTREAMS_PIPABLE(secretbox_chunked_decrypt_filter, 0)
+
+} // namespace sodium
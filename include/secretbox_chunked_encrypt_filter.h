@@ -0,0 +1,294 @@
+// secretbox_chunked_encrypt_filter.h -- Chunked secretbox encryption filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "filter_profile.h"
+#include "key.h"
+#include "nonce.h"
+#include "secretbox.h"
+#include "span.h"
+#include "trace.h"
+
+#include <boost/iostreams/filter/symmetric.hpp>
+#include <boost/iostreams/pipeline.hpp>
+
+#include <algorithm> // std::min<>, std::copy
+#include <cstddef>   // std::size_t
+#include <cstdint>   // std::uint64_t
+#include <stdexcept> // std::runtime_error
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+namespace sodium {
+
+/**
+ * The nonce of chunk number index of a stream encrypted by
+ * secretbox_chunked_encrypt_filter with the base nonce base:
+ *
+ *   base + index                 for all chunks but the last,
+ *   base + index + 2^(8*N-1)     for the final chunk,
+ *
+ * i.e. the final chunk has the most significant bit of its nonce
+ * flipped. Since no stream has anywhere near 2^(8*N-1) chunks, no
+ * two chunks of a stream share a nonce, and a final chunk can't
+ * pass for a message chunk, or vice versa.
+ *
+ * All computations run in constant time.
+ **/
+
+inline nonce<NONCESIZE_SECRETBOX>
+secretbox_chunk_nonce(const nonce<NONCESIZE_SECRETBOX>& base,
+                      std::uint64_t index,
+                      bool final)
+{
+    nonce<NONCESIZE_SECRETBOX> result{ base + index };
+    if (final) {
+        byte marker[NONCESIZE_SECRETBOX] = { 0 };
+        marker[NONCESIZE_SECRETBOX - 1] = 0x80;
+        result += nonce<NONCESIZE_SECRETBOX>(marker);
+    }
+    return result;
+}
+
+class secretbox_chunked_encrypt_symmetric_filter
+{
+    /**
+     * Encrypt a stream with sodium::secretbox, in chunks of a fixed
+     * size, without ever holding more than one chunk in memory.
+     *
+     * Unlike secretbox_encrypt_filter, which is an aggregate_filter and
+     * thus keeps the whole stream in memory until close(), this filter
+     * emits its output as soon as a chunk is full:
+     *
+     *   chunk_0 || chunk_1 || ... || chunk_k-1 || final
+     *
+     * where each chunk_i is the (MAC || ciphertext) of chunksize
+     * plaintext bytes (chunksize + MACSIZE bytes), encrypted with the
+     * nonce secretbox_chunk_nonce(nonce, i, false), and final is the
+     * (MAC || ciphertext) of the remaining 0 <= n < chunksize
+     * plaintext bytes (n + MACSIZE bytes), encrypted with the nonce
+     * secretbox_chunk_nonce(nonce, k, true) and written at close().
+     *
+     * Reordering, dropping or duplicating chunks, as well as truncating
+     * the stream, are detected by secretbox_chunked_decrypt_filter.
+     *
+     * The same key, nonce and chunksize must be used to decrypt the
+     * stream. After close(), the filter starts again at chunk 0 with
+     * the same nonce: NEVER encrypt two different streams with the
+     * same key and nonce.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = secretbox<chars>::KEYSIZE;
+    static constexpr std::size_t NONCESIZE = secretbox<chars>::NONCESIZE;
+    static constexpr std::size_t MACSIZE = secretbox<chars>::MACSIZE;
+
+    typedef char char_type;
+
+    using key_type = secretbox<chars>::key_type;
+    using nonce_type = secretbox<chars>::nonce_type;
+
+    secretbox_chunked_encrypt_symmetric_filter(const key_type& key,
+                                               const nonce_type& nonce,
+                                               const std::size_t chunksize)
+      : secretbox_{ key }
+      , nonce_{ nonce }
+      , running_nonce_{ nonce }
+      , index_{ 0 }
+      , chunksize_{ chunksize }
+      , out_(MACSIZE + chunksize)
+      , out_pos_{ 0 }
+      , out_size_{ 0 }
+      , finished_{ false }
+    {
+        if (chunksize < 1)
+            throw std::runtime_error{
+                "sodium::secretbox_chunked_encrypt_filter::"
+                "secretbox_chunked_encrypt_filter() wrong chunksize"
+            };
+        in_.reserve(chunksize_);
+    }
+
+    /**
+     * Consume as much of [i1,i2) as possible, and produce as much
+     * output in [o1,o2) as possible. The final chunk is emitted when
+     * flush is set, i.e. when the stream is closed.
+     **/
+
+    bool filter(const char_type*& i1,
+                const char_type* i2,
+                char_type*& o1,
+                char_type* o2,
+                bool flush)
+    {
+        SODIUM_PROFILE_SPAN("secretbox_chunked_encrypt_filter", i1);
+
+        for (;;) {
+            // first, write out what's still waiting in out_
+            if (out_pos_ != out_size_) {
+                const auto n =
+                  std::min<std::size_t>(out_size_ - out_pos_, o2 - o1);
+                std::copy(out_.cbegin() + out_pos_,
+                          out_.cbegin() + out_pos_ + n,
+                          o1);
+                out_pos_ += n;
+                o1 += n;
+                if (out_pos_ != out_size_)
+                    return true; // output buffer is full, call again
+            }
+
+            if (finished_)
+                return false; // all done
+
+            // then, fill the current chunk
+            const auto n =
+              std::min<std::size_t>(chunksize_ - in_.size(), i2 - i1);
+            in_.insert(in_.end(), i1, i1 + n);
+            i1 += n;
+
+            if (in_.size() == chunksize_) {
+                seal(running_nonce_);
+                continue;
+            }
+
+            if (!flush)
+                return true; // need more input
+
+            // end of stream: the remaining bytes make up the final chunk
+            seal(secretbox_chunk_nonce(nonce_, index_, true));
+            finished_ = true;
+
+            SODIUM_TRACE(
+              "sodium::secretbox_chunked_encrypt_symmetric_filter::filter()",
+              "final chunk [index=" << index_ - 1 << "]");
+        }
+    }
+
+    /**
+     * Prepare to encrypt a whole new stream, starting at chunk 0.
+     **/
+
+    void close()
+    {
+        SODIUM_TRACE(
+          "sodium::secretbox_chunked_encrypt_symmetric_filter::close()",
+          "called");
+
+        sodium_memzero(in_.data(), in_.size());
+        in_.clear();
+        out_pos_ = out_size_ = 0;
+        running_nonce_ = nonce_;
+        index_ = 0;
+        finished_ = false;
+    }
+
+  private:
+    // encrypt the chunk in in_ with nonce into out_
+    void seal(const nonce_type& nonce)
+    {
+        out_size_ = secretbox<chars>::ciphertext_size(in_.size());
+        if (secretbox_.encrypt(
+              span<byte>(out_), span<const byte>(in_), nonce) != 0)
+            throw std::runtime_error{
+                "sodium::secretbox_chunked_encrypt_filter::filter() "
+                "crypto_secretbox_easy() -1"
+            };
+        out_pos_ = 0;
+
+        sodium_memzero(in_.data(), in_.size());
+        in_.clear();
+        running_nonce_.increment();
+        ++index_;
+    }
+
+    secretbox<chars> secretbox_;
+    nonce_type nonce_;         // base nonce of the stream
+    nonce_type running_nonce_; // nonce_ + index_
+    std::uint64_t index_;      // number of the current chunk
+    std::size_t chunksize_;
+    chars in_;  // plaintext of the current chunk, up to chunksize_ bytes
+    chars out_; // encrypted chunk, MACSIZE + chunksize_ bytes
+    std::size_t out_pos_;  // bytes of out_ already written
+    std::size_t out_size_; // bytes of out_ to be written
+    bool finished_;        // final chunk emitted?
+}; // secretbox_chunked_encrypt_symmetric_filter
+
+// Turn secretbox_chunked_encrypt_symmetric_filter into a DualUse filter:
+
+class secretbox_chunked_encrypt_filter
+  : public io::symmetric_filter<secretbox_chunked_encrypt_symmetric_filter>
+{
+    /**
+     * secretbox_chunked_encrypt_filter is a DualUseFilter that
+     * encrypts a stream in chunks of chunksize bytes, using memory
+     * proportional to chunksize, not to the size of the stream.
+     *
+     * Parameters:
+     *   buffer_size: size of the internal buffer of symmetric_filter.
+     *   key        : the secret key used for encryption/decryption.
+     *   nonce      : the base nonce of the chunk nonces.
+     *   chunksize  : number of plaintext bytes per encrypted chunk.
+     *
+     * Use it like this (as an OutputFilter):
+     *
+     *   secretbox_chunked_encrypt_filter::key_type key;
+     *   secretbox_chunked_encrypt_filter::nonce_type nonce;
+     *   secretbox_chunked_encrypt_filter encrypt_filter{ 4096,
+     *                                                    key,
+     *                                                    nonce,
+     *                                                    65536 };
+     *
+     *   io::filtering_ostream os(encrypt_filter | io::file_sink(encfile));
+     *   os << ...;            // chunks are written as they fill up
+     *   os.reset();           // close the stream: write final chunk
+     *
+     * The final chunk is only written when the chain is closed:
+     * flushing is not enough.
+     *
+     * See also: secretbox_chunked_decrypt_filter.
+     **/
+
+  private:
+    typedef io::symmetric_filter<secretbox_chunked_encrypt_symmetric_filter>
+      base_type;
+    typedef secretbox_chunked_encrypt_symmetric_filter symmetric_filter_type;
+
+  public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::category category;
+
+    static constexpr std::size_t MACSIZE = symmetric_filter_type::MACSIZE;
+
+    using key_type = symmetric_filter_type::key_type;
+    using nonce_type = symmetric_filter_type::nonce_type;
+
+    secretbox_chunked_encrypt_filter(std::streamsize buffer_size,
+                                     const key_type& key,
+                                     const nonce_type& nonce,
+                                     const std::size_t chunksize)
+      : base_type(buffer_size, key, nonce, chunksize)
+    {}
+};
+
+BOOST_IOSTREAMS_PIPABLE(secretbox_chunked_encrypt_filter, 0)
+
+} // namespace sodium
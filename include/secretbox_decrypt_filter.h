@@ -19,9 +19,11 @@
 #pragma once
 
 #include "common.h"
+#include "filter_profile.h"
 #include "key.h"
 #include "nonce.h"
 #include "secretbox.h"
+#include "trace.h"
 
 #include <boost/iostreams/categories.hpp>       // tags
 #include <boost/iostreams/filter/aggregate.hpp> // aggregate_filter
@@ -30,10 +32,7 @@
 #include <sodium.h>
 #include <stdexcept>
 
-#ifndef NDEBUG
-#include <iostream>
 #include <string>
-#endif // ! NDEBUG
 
 namespace io = boost::iostreams;
 
@@ -43,6 +42,10 @@ class secretbox_decrypt_filter : public io::aggregate_filter<char>
 {
 
     /**
+     * Being an aggregate_filter, secretbox_decrypt_filter holds the whole
+     * stream in memory until close(). For big streams, use the chunked
+     * sodium::secretbox_chunked_decrypt_filter instead.
+     *
      * Use secretbox_decrypt_filter as a DualUse filter like this:
      *
      *   #include <boost/iostreams/device/array.hpp>
@@ -143,12 +146,11 @@ class secretbox_decrypt_filter : public io::aggregate_filter<char>
   private:
     virtual void do_filter(const vector_type& src, vector_type& dest)
     {
+        SODIUM_PROFILE_SPAN("secretbox_decrypt_filter", src.size());
 
-#ifndef NDEBUG
-        std::string src_string{ src.cbegin(), src.cend() };
-        std::cerr << "secretbox_decrypt_filter::do_filter(" << src_string
-                  << ") called" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::secretbox_decrypt_filter::do_filter()",
+                     "(" << std::string(src.cbegin(), src.cend())
+                         << ") called");
 
         try {
             if (src.size() < MACSIZE)
@@ -166,20 +168,15 @@ class secretbox_decrypt_filter : public io::aggregate_filter<char>
             error_message.append(
               "\nsodium::secretbox_decrypt_filter::do_filter() can't decrypt");
 
-#ifndef NDEBUG
-            std::cerr << "sodium::secretbox_decrypt_filter::do_filter() "
-                      << "throwing exception {" << error_message << "}"
-                      << std::endl;
-#endif // ! NDEBUG
+            SODIUM_TRACE("sodium::secretbox_decrypt_filter::do_filter()",
+                         "throwing exception {" << error_message << "}");
 
             throw std::ios_base::failure(error_message);
         }
 
-#ifndef NDEBUG
-        std::string dest_string{ dest.cbegin(), dest.cend() };
-        std::cerr << "secretbox_decrypt_filter::do_filter() returned {"
-                  << dest_string << "}" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::secretbox_decrypt_filter::do_filter()",
+                     "returned {" << std::string(dest.cbegin(), dest.cend())
+                                  << "}");
     }
 
   private:
@@ -19,19 +19,17 @@
 #pragma once
 
 #include "common.h"
+#include "filter_profile.h"
 #include "key.h"
 #include "nonce.h"
 #include "secretbox.h"
+#include "trace.h"
 
 #include <boost/iostreams/categories.hpp>       // tags
 #include <boost/iostreams/filter/aggregate.hpp> // aggregate_filter
 
 #include <sodium.h>
 
-#ifndef NDEBUG
-#include <iostream>
-#endif // ! NDEBUG
-
 namespace io = boost::iostreams;
 
 namespace sodium {
@@ -40,6 +38,10 @@ class secretbox_encrypt_filter : public io::aggregate_filter<char>
 {
 
     /**
+     * Being an aggregate_filter, secretbox_encrypt_filter holds the whole
+     * stream in memory until close(). For big streams, use the chunked
+     * sodium::secretbox_chunked_encrypt_filter instead.
+     *
      * Use secretbox_encrypt_filter as a DualUse filter like this:
      *
      *     #include <boost/iostreams/device/array.hpp>
@@ -130,11 +132,9 @@ class secretbox_encrypt_filter : public io::aggregate_filter<char>
   private:
     virtual void do_filter(const vector_type& src, vector_type& dest)
     {
+        SODIUM_PROFILE_SPAN("secretbox_encrypt_filter", src.size());
 
-#ifndef NDEBUG
-        std::cerr << "secretbox_encrypt_filter::do_filter() called"
-                  << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::secretbox_encrypt_filter::do_filter()", "called");
 
         // compute (MAC || ciphertext)
         vector_type ciphertext_with_mac{ secretbox_.encrypt(src, nonce_) };
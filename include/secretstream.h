@@ -18,9 +18,15 @@
 
 #pragma once
 
+#include "aead_traits.h"
+#include "aead_xchacha20_poly1305_ietf.h"
 #include "common.h"
+#include "extern_templates.h"
 #include "key.h"
-#include "secretstream_xchacha20_poly1305.h"
+#include "metrics.h"
+#include "span.h"
+#include <cstdint>
+#include <cstring>
 #include <sodium.h>
 #include <stdexcept>
 #include <type_traits>
@@ -29,19 +35,21 @@ namespace sodium {
 
 template<typename BT = bytes,
          typename F = sodium::secretstream_xchacha20_poly1305,
-         typename T = typename std::enable_if<
-           std::is_same<F, sodium::secretstream_xchacha20_poly1305>::value,
-           int>::type>
+         typename T =
+           typename std::enable_if<sodium::is_secretstream<F>, int>::type>
 class secretstream
 {
   public:
-    static constexpr std::size_t KEYSIZE = F::KEYBYTES;
-    static constexpr std::size_t MACSIZE = F::ABYTES;
-    static constexpr std::size_t HEADERSIZE = F::HEADERBYTES;
-    static constexpr std::size_t MESSAGESIZE = F::MESSAGEBYTES_MAX;
+    static constexpr std::size_t KEYSIZE = secretstream_traits<F>::KEYBYTES;
+    static constexpr std::size_t MACSIZE = secretstream_traits<F>::ABYTES;
+    static constexpr std::size_t HEADERSIZE =
+      secretstream_traits<F>::HEADERBYTES;
+    static constexpr std::size_t MESSAGESIZE =
+      secretstream_traits<F>::MESSAGEBYTES_MAX;
 
     using bytes_type = BT;
     using key_type = key<KEYSIZE>;
+    using shared_key_type = shared_key<KEYSIZE>;
     using state_type = typename F::state_type;
 
     enum class tag_type : sodium::byte
@@ -63,41 +71,61 @@ class secretstream
 
     // A secretstream with a new random key
     secretstream()
-      : key_(std::move(key_type()))
+      : key_(make_shared_key(key_type()))
     {}
 
     // A secretstream with a user-supplied key (copying version)
     secretstream(const key_type& key)
-      : key_(key)
+      : key_(make_shared_key(key))
     {}
 
     // A secretstream with a user-supplied key (moving version)
     secretstream(key_type&& key)
-      : key_(std::move(key))
+      : key_(make_shared_key(std::move(key)))
     {}
 
-    // A copying constructor
+    /**
+     * A secretstream sharing the immutable key of other wrappers,
+     * filters, etc., see make_shared_key(). Throw a std::runtime_error
+     * if key is empty.
+     **/
+
+    explicit secretstream(shared_key_type key)
+      : key_(std::move(key))
+    {
+        if (!key_)
+            throw std::runtime_error{
+                "sodium::secretstream::secretstream() empty key"
+            };
+    }
+
+    // A copying constructor: shares the (immutable) key of other
     secretstream(const secretstream& other)
       : key_(other.key_)
       , state_(other.state_)
+      , direction_(other.direction_)
     {}
 
     // A moving constructor
     secretstream(secretstream&& other)
       : key_(std::move(other.key_))
       , state_(std::move(other.state_))
+      , direction_(other.direction_)
     {}
 
     // XXX copying and moving assignment operators?
 
+    // the shared key of this secretstream
+    const shared_key_type& key_handle() const noexcept { return key_; }
+
     BT init_push(void)
     {
         BT header(HEADERSIZE);
         if (F::init_push(&state_,
                          reinterpret_cast<unsigned char*>(header.data()),
-                         reinterpret_cast<const unsigned char*>(key_.data())) !=
-            0)
+                         key_->data()) != 0)
             throw std::runtime_error{ "secretstream::init_push() failed" };
+        direction_ = direction_type::push;
         return header;
     }
 
@@ -118,6 +146,7 @@ class secretstream
               added_data.size(),
               static_cast<unsigned char>(tag)) != 0)
             throw std::runtime_error{ "secretstream::push() failed" };
+        metrics::bytes_encrypted(plaintext.size());
         return ciphertext_with_mac;
     }
 
@@ -125,9 +154,9 @@ class secretstream
     {
         if (F::init_pull(&state_,
                          reinterpret_cast<const unsigned char*>(header.data()),
-                         reinterpret_cast<const unsigned char*>(key_.data())) !=
-            0)
+                         key_->data()) != 0)
             throw std::runtime_error{ "secretstream::init_pull() failed" };
+        direction_ = direction_type::pull;
     }
 
     BT pull(const BT& ciphertext_with_mac, const BT& added_data, tag_type& tag)
@@ -144,13 +173,362 @@ class secretstream
               (added_data.empty()
                  ? nullptr
                  : reinterpret_cast<const unsigned char*>(added_data.data())),
-              added_data.size()) == -1)
+              added_data.size()) == -1) {
+            metrics::mac_failure();
             throw std::runtime_error{ "secretstream::pull() failed" };
+        }
+        metrics::bytes_decrypted(plaintext.size());
         return plaintext;
     }
 
+    /**
+     * Allocation-free variants of push() and pull() above.
+     *
+     * These functions read from and write into caller-owned buffers,
+     * passed as sodium::span<>s, and never allocate. Instead of
+     * throwing a std::runtime_error, they return 0 on success and -1
+     * on failure (wrong buffer sizes, or a forged/corrupted message).
+     **/
+
+    /**
+     * Encrypt plaintext into the first plaintext.size() + MACSIZE
+     * bytes of ciphertext_with_mac, exactly as push() would.
+     *
+     * Return -1 if ciphertext_with_mac is too small.
+     **/
+
+    int push(span<byte> ciphertext_with_mac,
+             span<const byte> plaintext,
+             span<const byte> added_data,
+             const tag_type tag = tag_type::TAG_MESSAGE) noexcept
+    {
+        if (ciphertext_with_mac.size() < plaintext.size() + MACSIZE)
+            return -1;
+
+        if (F::push(&state_,
+                    ciphertext_with_mac.data(),
+                    nullptr,
+                    plaintext.data(),
+                    plaintext.size(),
+                    (added_data.empty() ? nullptr : added_data.data()),
+                    added_data.size(),
+                    static_cast<unsigned char>(tag)) != 0)
+            return -1;
+
+        metrics::bytes_encrypted(plaintext.size());
+        return 0;
+    }
+
+    /**
+     * Decrypt ciphertext_with_mac into the first
+     * ciphertext_with_mac.size() - MACSIZE bytes of plaintext, and
+     * store its tag into tag.
+     *
+     * Return -1 if plaintext is too small, or if ciphertext_with_mac
+     * or added_data have been tampered with.
+     **/
+
+    int pull(span<byte> plaintext,
+             tag_type& tag,
+             span<const byte> ciphertext_with_mac,
+             span<const byte> added_data) noexcept
+    {
+        if (ciphertext_with_mac.size() < MACSIZE ||
+            plaintext.size() < ciphertext_with_mac.size() - MACSIZE)
+            return -1;
+
+        if (F::pull(&state_,
+                    plaintext.data(),
+                    nullptr /* mlen_p */,
+                    reinterpret_cast<unsigned char*>(&tag),
+                    ciphertext_with_mac.data(),
+                    ciphertext_with_mac.size(),
+                    (added_data.empty() ? nullptr : added_data.data()),
+                    added_data.size()) != 0) {
+            metrics::mac_failure();
+            return -1;
+        }
+
+        metrics::bytes_decrypted(ciphertext_with_mac.size() - MACSIZE);
+        return 0;
+    }
+
+    /**
+     * Vectored push: encrypt the messages plaintexts[0..n) with the
+     * tags tags[0..n) (all TAG_MESSAGE if tags is empty), and store
+     * the n resulting frames back to back into out, which must be at
+     * least push_size(plaintexts) bytes long.
+     *
+     * Frame i is stored at out[offsets[i], offsets[i+1]), so offsets
+     * must have room for n+1 entries. offsets[n] is the total number
+     * of bytes written.
+     *
+     * This amortizes the cost of many small push()es: no allocation,
+     * and a single call for the whole batch. Without additional data.
+     *
+     * Return -1 if one of the spans is too small, in which case
+     * nothing has been pushed.
+     **/
+
+    static std::size_t push_size(
+      span<const span<const byte>> plaintexts) noexcept
+    {
+        std::size_t result = 0;
+        for (const auto& plaintext : plaintexts)
+            result += plaintext.size() + MACSIZE;
+        return result;
+    }
+
+    int push(span<byte> out,
+             span<std::size_t> offsets,
+             span<const span<const byte>> plaintexts,
+             span<const tag_type> tags = {}) noexcept
+    {
+        const std::size_t n = plaintexts.size();
+        if (offsets.size() < n + 1 || (!tags.empty() && tags.size() != n) ||
+            out.size() < push_size(plaintexts))
+            return -1;
+
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i != n; ++i) {
+            offsets[i] = offset;
+            if (F::push(&state_,
+                        out.data() + offset,
+                        nullptr,
+                        plaintexts[i].data(),
+                        plaintexts[i].size(),
+                        nullptr,
+                        0,
+                        static_cast<unsigned char>(
+                          tags.empty() ? tag_type::TAG_MESSAGE : tags[i])) !=
+                0)
+                return -1;
+            offset += plaintexts[i].size() + MACSIZE;
+        }
+        offsets[n] = offset;
+        metrics::bytes_encrypted(offset - n * MACSIZE);
+
+        return 0;
+    }
+
+    /**
+     * Vectored, in-place pull: decrypt the n frames stored at
+     * frames[offsets[i], offsets[i+1]), as written by the vectored
+     * push() above, without copying them.
+     *
+     * On return, plaintexts[i] views the decrypted message i inside
+     * frames, and tags[i] holds its tag. offsets must have n+1
+     * entries; plaintexts and tags must have room for n entries.
+     *
+     * Return -1 on wrong sizes, or as soon as a frame doesn't
+     * verify. Frames before the failing one have been decrypted, and
+     * the stream state stays at the failing frame.
+     **/
+
+    int pull(span<byte> frames,
+             span<const std::size_t> offsets,
+             span<span<byte>> plaintexts,
+             span<tag_type> tags) noexcept
+    {
+        if (offsets.empty())
+            return -1;
+
+        const std::size_t n = offsets.size() - 1;
+        if (plaintexts.size() < n || tags.size() < n ||
+            offsets[n] > frames.size())
+            return -1;
+
+        for (std::size_t i = 0; i != n; ++i) {
+            if (offsets[i + 1] < offsets[i] ||
+                offsets[i + 1] - offsets[i] < MACSIZE)
+                return -1;
+
+            const std::size_t framesize = offsets[i + 1] - offsets[i];
+            byte* frame = frames.data() + offsets[i];
+
+            // libsodium decrypts the message of the frame (which follows
+            // the encrypted tag byte) onto itself, i.e. exactly in place
+            byte* message = frame + 1;
+
+            if (F::pull(&state_,
+                        message,
+                        nullptr /* mlen_p */,
+                        reinterpret_cast<unsigned char*>(&tags[i]),
+                        frame,
+                        framesize,
+                        nullptr,
+                        0) != 0) {
+                metrics::mac_failure();
+                return -1;
+            }
+
+            plaintexts[i] = span<byte>(message, framesize - MACSIZE);
+            metrics::bytes_decrypted(framesize - MACSIZE);
+        }
+
+        return 0;
+    }
+
     void rekey(void) { F::rekey(&state_); }
 
+    /**
+     * Checkpoints: save the state of the stream at a chunk boundary,
+     * and restore it later, e.g. into a fresh secretstream in another
+     * process, to resume an interrupted transfer at the last chunk that
+     * the peer has acknowledged instead of at the start of the stream.
+     *
+     * checkpoint(wrapping_key, chunk) returns the current state, its
+     * direction (push or pull) and the caller's chunk counter (e.g. the
+     * number of chunks pushed or pulled so far), encrypted under
+     * wrapping_key with XChaCha20-Poly1305 and a random nonce. All
+     * integers are little-endian:
+     *
+     *   "SWCK" || direction (1) || LE64(chunk) || nonce || AEAD(state)
+     *
+     * where the AEAD authenticates the CHECKPOINT_PREFIXSIZE bytes
+     * before the nonce too. direction is 1 for push, 2 for pull.
+     * checkpoint() throws a std::runtime_error if neither init_push()
+     * nor init_pull() has been called (or restored) yet.
+     *
+     * restore(checkpoint, wrapping_key, policy) replaces the state of
+     * *this by the saved one and returns the chunk counter. It throws a
+     * std::runtime_error, leaving *this alone, if the checkpoint was
+     * truncated, corrupted, forged, or wrapped under another key, and
+     * if it holds a push state while policy isn't allow_push.
+     *
+     * CAUTION: restoring a push state rewinds the nonces of the stream
+     * to the checkpoint. Pushing anything but the very same chunks as
+     * before (which yields the same ciphertexts) then reuses the nonces
+     * of the lost chunks under the same subkey, which breaks the
+     * confidentiality and the integrity of the stream. Only restore a
+     * push state with restore_policy::allow_push if the plaintext that
+     * followed the checkpoint can be pushed again unchanged; otherwise,
+     * start a new stream with init_push(). Restoring a pull state is
+     * always safe.
+     *
+     * The state holds the stream's subkey: a checkpoint is as secret
+     * as the key of the stream.
+     **/
+
+    enum class restore_policy
+    {
+        pull_only, // refuse push states
+        allow_push // the caller pushes the same chunks again
+    };
+
+    static constexpr char CHECKPOINT_MAGIC[4] = { 'S', 'W', 'C', 'K' };
+
+    // the authenticated, unencrypted part: magic, direction, chunk
+    static constexpr std::size_t CHECKPOINT_PREFIXSIZE =
+      sizeof(CHECKPOINT_MAGIC) + 1 + sizeof(std::uint64_t);
+
+    static constexpr std::size_t CHECKPOINT_KEYSIZE =
+      aead_xchacha20_poly1305_ietf::KEYBYTES;
+    static constexpr std::size_t CHECKPOINTSIZE =
+      CHECKPOINT_PREFIXSIZE + aead_xchacha20_poly1305_ietf::NPUBBYTES +
+      sizeof(state_type) + aead_xchacha20_poly1305_ietf::ABYTES;
+
+    using wrapping_key_type = key<CHECKPOINT_KEYSIZE>;
+
+    BT checkpoint(const wrapping_key_type& wrapping_key,
+                  const std::uint64_t chunk) const
+    {
+        static_assert(std::is_trivially_copyable<state_type>::value,
+                      "secretstream::checkpoint() needs a flat state_type");
+
+        if (direction_ == direction_type::none)
+            throw std::runtime_error{
+                "sodium::secretstream::checkpoint() stream not initialized"
+            };
+
+        BT result(CHECKPOINTSIZE);
+        unsigned char* out = reinterpret_cast<unsigned char*>(result.data());
+
+        std::memcpy(out, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        out[sizeof(CHECKPOINT_MAGIC)] = static_cast<unsigned char>(direction_);
+        unsigned char* le_chunk = out + sizeof(CHECKPOINT_MAGIC) + 1;
+        for (std::size_t i = 0; i != sizeof(std::uint64_t); ++i)
+            le_chunk[i] = static_cast<unsigned char>(chunk >> (8 * i));
+
+        unsigned char* nonce = out + CHECKPOINT_PREFIXSIZE;
+        ::randombytes_buf(nonce, aead_xchacha20_poly1305_ietf::NPUBBYTES);
+
+        unsigned long long clen;
+        if (aead_xchacha20_poly1305_ietf::encrypt(
+              nonce + aead_xchacha20_poly1305_ietf::NPUBBYTES,
+              &clen,
+              reinterpret_cast<const unsigned char*>(&state_),
+              sizeof(state_type),
+              out,
+              CHECKPOINT_PREFIXSIZE,
+              nullptr /* nsec */,
+              nonce,
+              wrapping_key.data()) != 0)
+            throw std::runtime_error{
+                "sodium::secretstream::checkpoint() can't wrap state"
+            };
+
+        return result;
+    }
+
+    std::uint64_t restore(
+      const BT& checkpoint,
+      const wrapping_key_type& wrapping_key,
+      const restore_policy policy = restore_policy::pull_only)
+    {
+        const unsigned char* in =
+          reinterpret_cast<const unsigned char*>(checkpoint.data());
+
+        if (checkpoint.size() != CHECKPOINTSIZE ||
+            std::memcmp(in, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+            throw std::runtime_error{
+                "sodium::secretstream::restore() not a checkpoint"
+            };
+
+        const unsigned char* nonce = in + CHECKPOINT_PREFIXSIZE;
+        state_type state;
+        unsigned long long mlen;
+        if (aead_xchacha20_poly1305_ietf::decrypt(
+              reinterpret_cast<unsigned char*>(&state),
+              &mlen,
+              nullptr /* nsec */,
+              nonce + aead_xchacha20_poly1305_ietf::NPUBBYTES,
+              CHECKPOINTSIZE - CHECKPOINT_PREFIXSIZE -
+                aead_xchacha20_poly1305_ietf::NPUBBYTES,
+              in,
+              CHECKPOINT_PREFIXSIZE,
+              nonce,
+              wrapping_key.data()) != 0) {
+            metrics::mac_failure();
+            throw std::runtime_error{
+                "sodium::secretstream::restore() checkpoint corrupt or "
+                "wrong wrapping key"
+            };
+        }
+
+        // authenticated: only our own checkpoint() wrote it
+        const auto direction =
+          static_cast<direction_type>(in[sizeof(CHECKPOINT_MAGIC)]);
+        if (direction == direction_type::push &&
+            policy != restore_policy::allow_push) {
+            ::sodium_memzero(&state, sizeof(state));
+            throw std::runtime_error{
+                "sodium::secretstream::restore() push state needs "
+                "restore_policy::allow_push"
+            };
+        }
+
+        state_ = state;
+        direction_ = direction;
+        ::sodium_memzero(&state, sizeof(state));
+
+        const unsigned char* le_chunk = in + sizeof(CHECKPOINT_MAGIC) + 1;
+        std::uint64_t chunk = 0;
+        for (std::size_t i = 0; i != sizeof(std::uint64_t); ++i)
+            chunk |= static_cast<std::uint64_t>(le_chunk[i]) << (8 * i);
+        return chunk;
+    }
+
     // XXX TODO
     // 1. map state_type inside bytes_protected (like aes_ctx.h)
     // 2. write unit tests, git commit.
@@ -162,8 +540,19 @@ class secretstream
     // 6. do we still need streamcryptor? if so, use secretstream as backend.
 
   private:
-    key_type key_;
+    enum class direction_type : unsigned char
+    {
+        none = 0,
+        push = 1,
+        pull = 2
+    };
+
+    shared_key_type key_;
     state_type state_; // XXX currently in unprotected memory
+    direction_type direction_ = direction_type::none;
 };
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(secretstream);
+
 } // namespace sodium
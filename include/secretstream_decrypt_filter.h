@@ -0,0 +1,237 @@
+// secretstream_decrypt_filter.h -- Chunked secretstream decryption filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "filter_profile.h"
+#include "key.h"
+#include "secretstream.h"
+#include "trace.h"
+
+#include <boost/iostreams/filter/symmetric.hpp>
+#include <boost/iostreams/pipeline.hpp>
+
+#include <algorithm> // std::min<>, std::copy
+#include <cstddef>   // std::size_t
+#include <stdexcept> // std::runtime_error
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+namespace sodium {
+
+class secretstream_decrypt_symmetric_filter
+{
+    /**
+     * Decrypt a stream generated by secretstream_encrypt_filter, chunk
+     * by chunk, using constant memory. See the format description in
+     * secretstream_encrypt_filter.h.
+     *
+     * Each chunk is authenticated _before_ its plaintext is emitted.
+     * A std::runtime_error is thrown if
+     *   - a chunk doesn't authenticate (wrong key, wrong chunksize,
+     *     tampered, reordered or duplicated chunks),
+     *   - data follows the final chunk,
+     *   - the stream ends without a final chunk (truncation).
+     * No strong guarantee: the plaintext of all chunks preceding the
+     * failure has been emitted already.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = secretstream<chars>::KEYSIZE;
+    static constexpr std::size_t MACSIZE = secretstream<chars>::MACSIZE;
+    static constexpr std::size_t HEADERSIZE = secretstream<chars>::HEADERSIZE;
+
+    typedef char char_type;
+
+    using key_type = secretstream<chars>::key_type;
+
+    secretstream_decrypt_symmetric_filter(const key_type& key,
+                                          const std::size_t chunksize)
+      : secretstream_{ key }
+      , chunksize_{ chunksize }
+      , out_pos_{ 0 }
+      , started_{ false }
+      , finished_{ false }
+    {
+        if (chunksize < 1 || chunksize > secretstream<chars>::MESSAGESIZE)
+            throw std::runtime_error{
+                "sodium::secretstream_decrypt_filter::"
+                "secretstream_decrypt_filter() wrong chunksize"
+            };
+        in_.reserve(MACSIZE + chunksize_);
+    }
+
+    bool filter(const char_type*& i1,
+                const char_type* i2,
+                char_type*& o1,
+                char_type* o2,
+                bool flush)
+    {
+        SODIUM_PROFILE_SPAN("secretstream_decrypt_filter", i1);
+
+        for (;;) {
+            // first, write out what's still waiting in out_
+            if (out_pos_ != out_.size()) {
+                const auto n = std::min<std::size_t>(out_.size() - out_pos_,
+                                                     o2 - o1);
+                std::copy(out_.cbegin() + out_pos_,
+                          out_.cbegin() + out_pos_ + n,
+                          o1);
+                out_pos_ += n;
+                o1 += n;
+                if (out_pos_ != out_.size())
+                    return true; // output buffer is full, call again
+            }
+
+            // then, collect the header, or the next (MAC || ciphertext)
+            const std::size_t wanted =
+              started_ ? MACSIZE + chunksize_ : HEADERSIZE;
+            const auto n = std::min<std::size_t>(wanted - in_.size(), i2 - i1);
+            if (n != 0 && finished_)
+                throw std::runtime_error{
+                    "sodium::secretstream_decrypt_filter::filter() "
+                    "data after final chunk"
+                };
+            in_.insert(in_.end(), i1, i1 + n);
+            i1 += n;
+
+            if (in_.size() == wanted) {
+                if (!started_) {
+                    secretstream_.init_pull(in_);
+                    started_ = true;
+                } else
+                    pull(); // a full chunk, or a final full chunk
+                in_.clear();
+                continue;
+            }
+
+            if (!flush)
+                return true; // need more input
+
+            // end of stream: what's left must be the final chunk
+            if (!finished_) {
+                if (!started_ || in_.size() < MACSIZE)
+                    throw std::runtime_error{
+                        "sodium::secretstream_decrypt_filter::filter() "
+                        "stream truncated"
+                    };
+                pull();
+                in_.clear();
+                if (!finished_)
+                    throw std::runtime_error{
+                        "sodium::secretstream_decrypt_filter::filter() "
+                        "stream truncated"
+                    };
+                continue;
+            }
+
+            return out_pos_ != out_.size();
+        }
+    }
+
+    /**
+     * Prepare to decrypt a whole new stream, starting with its header.
+     **/
+
+    void close()
+    {
+        SODIUM_TRACE("sodium::secretstream_decrypt_symmetric_filter::close()",
+                     "called");
+
+        in_.clear();
+        out_.clear();
+        out_pos_ = 0;
+        started_ = false;
+        finished_ = false;
+    }
+
+  private:
+    // decrypt and authenticate the chunk in in_ into out_
+    void pull()
+    {
+        if (finished_)
+            throw std::runtime_error{
+                "sodium::secretstream_decrypt_filter::filter() "
+                "data after final chunk"
+            };
+
+        secretstream<chars>::tag_type tag;
+        out_ = secretstream_.pull(in_, chars{}, tag); // throws on failure
+        out_pos_ = 0;
+
+        if (tag == secretstream<chars>::tag_final())
+            finished_ = true;
+    }
+
+    secretstream<chars> secretstream_;
+    std::size_t chunksize_;
+    chars in_;  // header, or (MAC || ciphertext) of the current chunk
+    chars out_; // decrypted chunk, waiting to be written
+    std::size_t out_pos_;
+    bool started_;  // header read?
+    bool finished_; // final chunk read?
+}; // secretstream_decrypt_symmetric_filter
+
+// Turn secretstream_decrypt_symmetric_filter into a DualUse filter class:
+
+class secretstream_decrypt_filter
+  : public io::symmetric_filter<secretstream_decrypt_symmetric_filter>
+{
+    /**
+     * secretstream_decrypt_filter is a DualUseFilter that decrypts a
+     * stream produced by secretstream_encrypt_filter, using constant
+     * memory.
+     *
+     * Parameters:
+     *   buffer_size: size of the internal buffer of symmetric_filter.
+     *   key        : the secret key used for encryption/decryption.
+     *   chunksize  : number of plaintext bytes per encrypted chunk,
+     *                which MUST be the same as for encryption.
+     *
+     * The truncation check happens when the chain is closed, so
+     * don't trust the output before close() returned successfully.
+     **/
+
+  private:
+    typedef io::symmetric_filter<secretstream_decrypt_symmetric_filter>
+      base_type;
+    typedef secretstream_decrypt_symmetric_filter symmetric_filter_type;
+
+  public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::category category;
+
+    static constexpr std::size_t MACSIZE = symmetric_filter_type::MACSIZE;
+    static constexpr std::size_t HEADERSIZE =
+      symmetric_filter_type::HEADERSIZE;
+
+    using key_type = symmetric_filter_type::key_type;
+
+    secretstream_decrypt_filter(std::streamsize buffer_size,
+                                const key_type& key,
+                                const std::size_t chunksize)
+      : base_type(buffer_size, key, chunksize)
+    {}
+};
+
+BOOST_IOSTREAMS_PIPABLE(secretstream_decrypt_filter, 0)
+
+} // namespace sodium
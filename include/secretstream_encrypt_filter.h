@@ -0,0 +1,237 @@
+// secretstream_encrypt_filter.h -- Chunked secretstream encryption filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "filter_profile.h"
+#include "key.h"
+#include "secretstream.h"
+#include "trace.h"
+
+#include <boost/iostreams/filter/symmetric.hpp>
+#include <boost/iostreams/pipeline.hpp>
+
+#include <algorithm> // std::min<>, std::copy
+#include <cstddef>   // std::size_t
+#include <stdexcept> // std::runtime_error
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+namespace sodium {
+
+class secretstream_encrypt_symmetric_filter
+{
+    /**
+     * Encrypt a stream with sodium::secretstream, in chunks of a fixed
+     * size, without ever holding more than one chunk in memory.
+     *
+     * Unlike aead_encrypt_filter, which is an aggregate_filter and thus
+     * keeps the whole stream in memory until close(), this filter
+     * emits its output as soon as data arrives:
+     *
+     *   header || chunk_0 || chunk_1 || ... || chunk_n-1 || final
+     *
+     * where header is the secretstream header (HEADERSIZE bytes),
+     * each chunk_i is the push()ed encryption of chunksize plaintext
+     * bytes with TAG_MESSAGE (chunksize + MACSIZE bytes), and final is
+     * the encryption of the remaining 0 <= n < chunksize plaintext
+     * bytes with TAG_FINAL (n + MACSIZE bytes), written at close().
+     *
+     * Reordering, dropping or duplicating chunks, as well as truncating
+     * the stream, are detected by secretstream_decrypt_filter.
+     *
+     * The same key and chunksize must be used to decrypt the stream.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = secretstream<chars>::KEYSIZE;
+    static constexpr std::size_t MACSIZE = secretstream<chars>::MACSIZE;
+    static constexpr std::size_t HEADERSIZE = secretstream<chars>::HEADERSIZE;
+
+    typedef char char_type;
+
+    using key_type = secretstream<chars>::key_type;
+
+    secretstream_encrypt_symmetric_filter(const key_type& key,
+                                          const std::size_t chunksize)
+      : secretstream_{ key }
+      , chunksize_{ chunksize }
+      , out_pos_{ 0 }
+      , started_{ false }
+      , finished_{ false }
+    {
+        if (chunksize < 1 || chunksize > secretstream<chars>::MESSAGESIZE)
+            throw std::runtime_error{
+                "sodium::secretstream_encrypt_filter::"
+                "secretstream_encrypt_filter() wrong chunksize"
+            };
+        in_.reserve(chunksize_);
+    }
+
+    /**
+     * Consume as much of [i1,i2) as possible, and produce as much
+     * output in [o1,o2) as possible. The final chunk is emitted when
+     * flush is set, i.e. when the stream is closed.
+     **/
+
+    bool filter(const char_type*& i1,
+                const char_type* i2,
+                char_type*& o1,
+                char_type* o2,
+                bool flush)
+    {
+        SODIUM_PROFILE_SPAN("secretstream_encrypt_filter", i1);
+
+        for (;;) {
+            // first, write out what's still waiting in out_
+            if (out_pos_ != out_.size()) {
+                const auto n = std::min<std::size_t>(out_.size() - out_pos_,
+                                                     o2 - o1);
+                std::copy(out_.cbegin() + out_pos_,
+                          out_.cbegin() + out_pos_ + n,
+                          o1);
+                out_pos_ += n;
+                o1 += n;
+                if (out_pos_ != out_.size())
+                    return true; // output buffer is full, call again
+            }
+
+            if (!started_) {
+                emit(secretstream_.init_push());
+                started_ = true;
+                continue;
+            }
+            if (finished_)
+                return false; // all done
+
+            // then, fill the current chunk
+            const auto n =
+              std::min<std::size_t>(chunksize_ - in_.size(), i2 - i1);
+            in_.insert(in_.end(), i1, i1 + n);
+            i1 += n;
+
+            if (in_.size() == chunksize_) {
+                emit(secretstream_.push(in_, chars{}));
+                in_.clear();
+                continue;
+            }
+
+            if (!flush)
+                return true; // need more input
+
+            // end of stream: the remaining bytes make up the final chunk
+            emit(secretstream_.push(
+              in_, chars{}, secretstream<chars>::tag_final()));
+            in_.clear();
+            finished_ = true;
+
+            SODIUM_TRACE(
+              "sodium::secretstream_encrypt_symmetric_filter::filter()",
+              "final chunk");
+        }
+    }
+
+    /**
+     * Prepare to encrypt a whole new stream, with a new header.
+     **/
+
+    void close()
+    {
+        SODIUM_TRACE("sodium::secretstream_encrypt_symmetric_filter::close()",
+                     "called");
+
+        in_.clear();
+        out_.clear();
+        out_pos_ = 0;
+        started_ = false;
+        finished_ = false;
+    }
+
+  private:
+    void emit(chars&& data)
+    {
+        out_ = std::move(data);
+        out_pos_ = 0;
+    }
+
+    secretstream<chars> secretstream_;
+    std::size_t chunksize_;
+    chars in_;  // plaintext of the current chunk, up to chunksize_ bytes
+    chars out_; // header or encrypted chunk, waiting to be written
+    std::size_t out_pos_;
+    bool started_;  // header emitted?
+    bool finished_; // final chunk emitted?
+}; // secretstream_encrypt_symmetric_filter
+
+// Turn secretstream_encrypt_symmetric_filter into a DualUse filter class:
+
+class secretstream_encrypt_filter
+  : public io::symmetric_filter<secretstream_encrypt_symmetric_filter>
+{
+    /**
+     * secretstream_encrypt_filter is a DualUseFilter that encrypts a
+     * stream in chunks of chunksize bytes, using constant memory.
+     *
+     * Parameters:
+     *   buffer_size: size of the internal buffer of symmetric_filter.
+     *   key        : the secret key used for encryption/decryption.
+     *   chunksize  : number of plaintext bytes per encrypted chunk.
+     *
+     * Use it like this (as an OutputFilter):
+     *
+     *   secretstream_encrypt_filter::key_type key;
+     *   secretstream_encrypt_filter encrypt_filter{ 4096, key, 65536 };
+     *
+     *   io::filtering_ostream os(encrypt_filter | io::file_sink(encfile));
+     *   os << ...;            // chunks are written as they fill up
+     *   os.reset();           // close the stream: write final chunk
+     *
+     * The final chunk is only written when the chain is closed:
+     * flushing is not enough.
+     *
+     * See also: secretstream_decrypt_filter.
+     **/
+
+  private:
+    typedef io::symmetric_filter<secretstream_encrypt_symmetric_filter>
+      base_type;
+    typedef secretstream_encrypt_symmetric_filter symmetric_filter_type;
+
+  public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::category category;
+
+    static constexpr std::size_t MACSIZE = symmetric_filter_type::MACSIZE;
+    static constexpr std::size_t HEADERSIZE =
+      symmetric_filter_type::HEADERSIZE;
+
+    using key_type = symmetric_filter_type::key_type;
+
+    secretstream_encrypt_filter(std::streamsize buffer_size,
+                                const key_type& key,
+                                const std::size_t chunksize)
+      : base_type(buffer_size, key, chunksize)
+    {}
+};
+
+BOOST_IOSTREAMS_PIPABLE(secretstream_encrypt_filter, 0)
+
+} // namespace sodium
@@ -0,0 +1,613 @@
+// seekable_container.h -- Random-access encrypted container format
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "common.h"
+#include "nonce.h"
+#include "span.h"
+
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/positioning.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * The seekable container format
+ * -----------------------------
+ *
+ * A seekable container holds a message of potentially unlimited size,
+ * encrypted with one of the AEAD constructions F of sodium::aead, in a
+ * way that any byte range can be read back by decrypting only the few
+ * chunks it spans. All integers are little-endian.
+ *
+ *   header  = "SWSC" || version (1) || algorithm id (1)
+ *             || NONCESIZE (1) || 0 (1) || LE32(blocksize) || nonce base
+ *
+ *   chunk_i = AEAD_encrypt(key, nonce base + i, AD = header,
+ *                          plaintext[i * blocksize, (i+1) * blocksize))
+ *
+ *   footer  = LE64(plaintext size) || root || tag
+ *
+ * Every chunk holds blocksize bytes of plaintext and MACSIZE bytes of
+ * tag, except for the last one, which may be shorter. The empty
+ * message has no chunks at all. Since all chunks have the same size,
+ * the index of the container is implicit: chunk i starts at
+ * HEADERSIZE + i * (blocksize + MACSIZE), and only the footer is
+ * needed to know the plaintext size.
+ *
+ * root is a binary Merkle tree (BLAKE2b-256) over the tags of the
+ * chunks, with leaf_i = H(0x00 || tag_i) and node = H(0x01 || left
+ * || right); the left subtree of every node is the largest complete
+ * one. tag is the AEAD tag of an empty message with nonce base + n,
+ * where n is the number of chunks, with AD = header || LE64(size) ||
+ * root. It authenticates the size and the root in O(1) when opening
+ * a container, so that truncation, extension and chunk substitution
+ * are all detected.
+ *
+ * The algorithm ids are:
+ *   1: chacha20_poly1305
+ *   2: chacha20_poly1305_ietf
+ *   3: xchacha20_poly1305_ietf
+ *   4: aesgcm
+ **/
+
+namespace container_detail {
+
+template<typename F>
+constexpr std::uint8_t
+algorithm_id()
+{
+    return aead_traits<F>::id;
+}
+
+constexpr std::size_t MERKLE_HASHSIZE = crypto_generichash_BYTES;
+using merkle_hash = std::array<unsigned char, MERKLE_HASHSIZE>;
+
+/**
+ * Computes the Merkle root of the container format incrementally,
+ * keeping only one hash per level of the tree.
+ **/
+
+class merkle_stack
+{
+  public:
+    void push_tag(const unsigned char* tag, std::size_t size)
+    {
+        const unsigned char prefix = 0x00;
+        node n{ hash(&prefix, 1, tag, size, nullptr, 0), 1 };
+
+        // merge complete subtrees of the same size
+        while (!stack_.empty() && stack_.back().leaves == n.leaves) {
+            n = node{ combine(stack_.back().hash, n.hash), 2 * n.leaves };
+            stack_.pop_back();
+        }
+        stack_.push_back(n);
+    }
+
+    merkle_hash root() const
+    {
+        if (stack_.empty())
+            return merkle_hash{}; // all zeroes
+
+        merkle_hash result = stack_.back().hash;
+        for (auto it = stack_.rbegin() + 1; it != stack_.rend(); ++it)
+            result = combine(it->hash, result);
+        return result;
+    }
+
+  private:
+    struct node
+    {
+        merkle_hash hash;
+        std::uint64_t leaves;
+    };
+
+    static merkle_hash combine(const merkle_hash& left,
+                               const merkle_hash& right)
+    {
+        const unsigned char prefix = 0x01;
+        merkle_hash lr;
+        crypto_generichash_state state;
+        crypto_generichash_init(&state, NULL, 0, lr.size());
+        crypto_generichash_update(&state, &prefix, 1);
+        crypto_generichash_update(&state, left.data(), left.size());
+        crypto_generichash_update(&state, right.data(), right.size());
+        crypto_generichash_final(&state, lr.data(), lr.size());
+        return lr;
+    }
+
+    static merkle_hash hash(const unsigned char* a,
+                            std::size_t asize,
+                            const unsigned char* b,
+                            std::size_t bsize,
+                            const unsigned char* c,
+                            std::size_t csize)
+    {
+        merkle_hash result;
+        crypto_generichash_state state;
+        crypto_generichash_init(&state, NULL, 0, result.size());
+        crypto_generichash_update(&state, a, asize);
+        crypto_generichash_update(&state, b, bsize);
+        crypto_generichash_update(&state, c, csize);
+        crypto_generichash_final(&state, result.data(), result.size());
+        return result;
+    }
+
+    std::vector<node> stack_;
+};
+
+inline void
+store_le32(unsigned char* out, std::uint32_t value)
+{
+    for (std::size_t i = 0; i != 4; ++i)
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+inline void
+store_le64(unsigned char* out, std::uint64_t value)
+{
+    for (std::size_t i = 0; i != 8; ++i)
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+inline std::uint64_t
+load_le(const unsigned char* in, std::size_t size)
+{
+    std::uint64_t result = 0;
+    for (std::size_t i = 0; i != size; ++i)
+        result |= static_cast<std::uint64_t>(in[i]) << (8 * i);
+    return result;
+}
+
+} // namespace container_detail
+
+template<typename F = aead_xchacha20_poly1305_ietf>
+class seekable_container
+{
+    /**
+     * A seekable_container writes messages in the seekable container
+     * format described above. Use seekable_container_source to read
+     * them back with random access.
+     **/
+
+    static_assert(container_detail::algorithm_id<F>() != 0,
+                  "seekable_container: unsupported AEAD construction");
+
+  public:
+    using aead_type = aead<bytes, F>;
+    using key_type = typename aead_type::key_type;
+    using nonce_type = typename aead_type::nonce_type;
+
+    static constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+    static constexpr std::size_t NONCESIZE = aead_type::NONCESIZE;
+    static constexpr std::size_t HEADERSIZE = 12 + NONCESIZE;
+    static constexpr std::size_t FOOTERSIZE =
+      8 + container_detail::MERKLE_HASHSIZE + MACSIZE;
+    static constexpr std::uint8_t VERSION = 1;
+    static constexpr std::uint8_t ALGORITHM_ID =
+      container_detail::algorithm_id<F>();
+
+    /**
+     * Create a writer of containers with blocksize bytes of plaintext
+     * per chunk, encrypted with key.
+     *
+     * Throw a std::runtime_error if blocksize is 0 or doesn't fit in
+     * 32 bits.
+     **/
+
+    seekable_container(const key_type& key, const std::size_t blocksize)
+      : aead_{ key }
+      , blocksize_{ blocksize }
+    {
+        if (blocksize < 1 || blocksize > UINT32_MAX)
+            throw std::runtime_error{ "sodium::seekable_container::seekable_"
+                                      "container() wrong blocksize" };
+    }
+
+    /**
+     * Read the whole message from istr and write it as a container,
+     * with the given nonce base, to ostr.
+     *
+     * A nonce base MUST NOT be reused with the same key: the nonces
+     * nonce_base, ..., nonce_base + n are all used by the container.
+     * A random nonce_type (the default for XChaCha20) is fine.
+     *
+     * Throw a std::runtime_error if writing to ostr fails.
+     **/
+
+    void encrypt(std::istream& istr,
+                 std::ostream& ostr,
+                 const nonce_type& nonce_base)
+    {
+        const std::array<byte, HEADERSIZE> header = make_header(nonce_base);
+        write(ostr, header.data(), header.size());
+
+        bytes plaintext(blocksize_);
+        bytes chunk(blocksize_ + MACSIZE);
+        container_detail::merkle_stack merkle;
+        std::uint64_t size = 0;
+        std::uint64_t i = 0; // the number of chunks written so far
+
+        for (;;) {
+            istr.read(reinterpret_cast<char*>(plaintext.data()), blocksize_);
+            const std::size_t got = static_cast<std::size_t>(istr.gcount());
+            if (got == 0)
+                break;
+
+            span<const byte> in(plaintext.data(), got);
+            span<byte> out(chunk.data(), got + MACSIZE);
+            if (aead_.encrypt(out, header, in, nonce_base + i) != 0)
+                throw std::runtime_error{ "sodium::seekable_container::"
+                                          "encrypt() can't encrypt chunk" };
+            write(ostr, out.data(), out.size());
+
+            merkle.push_tag(out.data() + got, MACSIZE); // tag comes last
+            size += got;
+            ++i;
+
+            if (got != blocksize_)
+                break;
+        }
+
+        // the footer
+        std::array<byte, FOOTERSIZE> footer;
+        make_footer(footer, header, nonce_base + i, size, merkle.root());
+        write(ostr, footer.data(), footer.size());
+    }
+
+    /**
+     * The size of the container holding a message of size bytes.
+     **/
+
+    std::uint64_t container_size(std::uint64_t size) const
+    {
+        const std::uint64_t n = (size + blocksize_ - 1) / blocksize_;
+        return HEADERSIZE + size + n * MACSIZE + FOOTERSIZE;
+    }
+
+  private:
+    template<typename G>
+    friend class seekable_container_source;
+
+    std::array<byte, HEADERSIZE> make_header(const nonce_type& nonce_base) const
+    {
+        std::array<byte, HEADERSIZE> header{};
+        std::memcpy(header.data(), "SWSC", 4);
+        header[4] = VERSION;
+        header[5] = ALGORITHM_ID;
+        header[6] = static_cast<byte>(NONCESIZE);
+        header[7] = 0;
+        container_detail::store_le32(header.data() + 8,
+                                     static_cast<std::uint32_t>(blocksize_));
+        std::memcpy(header.data() + 12, nonce_base.data(), NONCESIZE);
+        return header;
+    }
+
+    // used by the reader as well, to recompute the tag of the footer
+    static void make_footer(std::array<byte, FOOTERSIZE>& footer,
+                            const std::array<byte, HEADERSIZE>& header,
+                            const nonce_type& nonce,
+                            std::uint64_t size,
+                            const container_detail::merkle_hash& root,
+                            aead_type& aead)
+    {
+        container_detail::store_le64(footer.data(), size);
+        std::memcpy(footer.data() + 8, root.data(), root.size());
+
+        std::array<byte, HEADERSIZE + 8 + container_detail::MERKLE_HASHSIZE>
+          ad;
+        std::memcpy(ad.data(), header.data(), HEADERSIZE);
+        std::memcpy(
+          ad.data() + HEADERSIZE, footer.data(), ad.size() - HEADERSIZE);
+
+        span<byte> tag(footer.data() + FOOTERSIZE - MACSIZE, MACSIZE);
+        if (aead.encrypt(tag, ad, span<const byte>(), nonce) != 0)
+            throw std::runtime_error{ "sodium::seekable_container::"
+                                      "make_footer() can't authenticate" };
+    }
+
+    void make_footer(std::array<byte, FOOTERSIZE>& footer,
+                     const std::array<byte, HEADERSIZE>& header,
+                     const nonce_type& nonce,
+                     std::uint64_t size,
+                     const container_detail::merkle_hash& root)
+    {
+        make_footer(footer, header, nonce, size, root, aead_);
+    }
+
+    static void write(std::ostream& ostr, const byte* data, std::size_t size)
+    {
+        ostr.write(reinterpret_cast<const char*>(data), size);
+        if (!ostr)
+            throw std::runtime_error{ "sodium::seekable_container::encrypt() "
+                                      "error writing to stream" };
+    }
+
+    aead_type aead_;
+    std::size_t blocksize_;
+};
+
+template<typename F = aead_xchacha20_poly1305_ietf>
+class seekable_container_source
+{
+    /**
+     * A seekable_container_source is a Boost.Iostreams seekable Source
+     * that reads the plaintext of a container written by
+     * seekable_container<F>, out of the seekable std::istream that
+     * holds the container (e.g. a std::ifstream):
+     *
+     *   std::ifstream ifs("blob.swsc", std::ios::binary);
+     *   io::stream<sodium::seekable_container_source<>> in(ifs, key);
+     *   in.seekg(offset);
+     *   in.read(buffer, length); // decrypts only the chunks it needs
+     *
+     * Opening a container reads and authenticates its header and
+     * footer only. Reads then decrypt and authenticate the chunks they
+     * touch, one at a time; the last decrypted chunk is cached in
+     * protected memory. verify() checks the Merkle root over all the
+     * tags, without decrypting anything.
+     *
+     * The container istr must outlive the source, and must not be
+     * used by anybody else meanwhile. Copies of a source share the same
+     * position (as Boost.Iostreams devices are copied around).
+     *
+     * Errors (a malformed or tampered-with container, a wrong key, ...)
+     * are reported by throwing std::runtime_error.
+     **/
+
+    using container_type = seekable_container<F>;
+
+  public:
+    typedef char char_type;
+    struct category
+      : boost::iostreams::input_seekable
+      , boost::iostreams::device_tag
+    {};
+
+    using key_type = typename container_type::key_type;
+    using nonce_type = typename container_type::nonce_type;
+
+    static constexpr std::size_t MACSIZE = container_type::MACSIZE;
+    static constexpr std::size_t HEADERSIZE = container_type::HEADERSIZE;
+    static constexpr std::size_t FOOTERSIZE = container_type::FOOTERSIZE;
+
+    /**
+     * Open the container held by istr, and authenticate its header and
+     * footer with key. Throw a std::runtime_error if that fails.
+     **/
+
+    seekable_container_source(std::istream& istr, const key_type& key)
+      : impl_{ std::make_shared<impl>(istr, key) }
+    {}
+
+    std::streamsize read(char_type* s, std::streamsize n)
+    {
+        return impl_->read(s, n);
+    }
+
+    std::streampos seek(boost::iostreams::stream_offset off,
+                        std::ios_base::seekdir way)
+    {
+        return impl_->seek(off, way);
+    }
+
+    // the size of the plaintext
+    std::uint64_t size() const { return impl_->size_; }
+
+    // the number of plaintext bytes per chunk
+    std::size_t blocksize() const { return impl_->blocksize_; }
+
+    /**
+     * Read all the tags of the container, and check that their Merkle
+     * root is the authenticated one of the footer. This detects
+     * swapped or substituted chunks without decrypting them.
+     **/
+
+    bool verify() { return impl_->verify(); }
+
+  private:
+    struct impl
+    {
+        impl(std::istream& istr, const key_type& key)
+          : istr_{ istr }
+          , aead_{ key }
+          , nonce_base_(false)
+          , pos_{ 0 }
+          , cached_{ UINT64_MAX }
+        {
+            istr_.clear();
+            read_at(0, header_.data(), header_.size(), "header");
+
+            const byte* h = header_.data();
+            if (std::memcmp(h, "SWSC", 4) != 0 ||
+                h[4] != container_type::VERSION ||
+                h[5] != container_type::ALGORITHM_ID ||
+                h[6] != container_type::NONCESIZE || h[7] != 0)
+                fail("not a container of this type");
+
+            blocksize_ = static_cast<std::size_t>(
+              container_detail::load_le(h + 8, 4));
+            if (blocksize_ == 0)
+                fail("wrong blocksize");
+            nonce_base_ = nonce_type(h + 12);
+
+            istr_.seekg(0, std::ios::end);
+            const std::streamoff total = istr_.tellg();
+            if (!istr_ || total < static_cast<std::streamoff>(HEADERSIZE +
+                                                              FOOTERSIZE))
+                fail("container too small");
+
+            std::array<byte, FOOTERSIZE> footer;
+            read_at(static_cast<std::uint64_t>(total) - FOOTERSIZE,
+                    footer.data(),
+                    footer.size(),
+                    "footer");
+            size_ = container_detail::load_le(footer.data(), 8);
+            nchunks_ = (size_ + blocksize_ - 1) / blocksize_;
+            std::memcpy(root_.data(), footer.data() + 8, root_.size());
+
+            // the size must match the footer...
+            if (size_ > static_cast<std::uint64_t>(total) ||
+                HEADERSIZE + size_ + nchunks_ * MACSIZE + FOOTERSIZE !=
+                  static_cast<std::uint64_t>(total))
+                fail("container size mismatch");
+
+            // ... and the footer must be authentic
+            std::array<byte, FOOTERSIZE> expected;
+            container_type::make_footer(
+              expected, header_, nonce_base_ + nchunks_, size_, root_, aead_);
+            if (sodium_memcmp(expected.data() + FOOTERSIZE - MACSIZE,
+                              footer.data() + FOOTERSIZE - MACSIZE,
+                              MACSIZE) != 0)
+                fail("footer authentication failed");
+
+            chunk_.resize(blocksize_);
+        }
+
+        std::streamsize read(char_type* s, std::streamsize n)
+        {
+            if (pos_ >= size_)
+                return -1; // EOF
+
+            std::streamsize done = 0;
+            while (done != n && pos_ < size_) {
+                const std::uint64_t k = pos_ / blocksize_;
+                if (k != cached_)
+                    load_chunk(k);
+
+                const std::size_t offset =
+                  static_cast<std::size_t>(pos_ - k * blocksize_);
+                const std::size_t avail = chunk_size(k) - offset;
+                const std::size_t m = static_cast<std::size_t>(
+                  std::min<std::uint64_t>(avail, n - done));
+                std::memcpy(s + done, chunk_.data() + offset, m);
+                done += static_cast<std::streamsize>(m);
+                pos_ += m;
+            }
+            return done;
+        }
+
+        std::streampos seek(boost::iostreams::stream_offset off,
+                            std::ios_base::seekdir way)
+        {
+            boost::iostreams::stream_offset base = 0;
+            if (way == std::ios_base::cur)
+                base = static_cast<boost::iostreams::stream_offset>(pos_);
+            else if (way == std::ios_base::end)
+                base = static_cast<boost::iostreams::stream_offset>(size_);
+
+            if (base + off < 0)
+                throw std::ios_base::failure{ "sodium::seekable_container_"
+                                              "source::seek() before start" };
+            pos_ = static_cast<std::uint64_t>(base + off);
+            return boost::iostreams::offset_to_position(
+              static_cast<boost::iostreams::stream_offset>(pos_));
+        }
+
+        bool verify()
+        {
+            container_detail::merkle_stack merkle;
+            byte tag[MACSIZE];
+            for (std::uint64_t k = 0; k != nchunks_; ++k) {
+                read_at(chunk_offset(k) + chunk_size(k), tag, MACSIZE, "tag");
+                merkle.push_tag(tag, MACSIZE);
+            }
+            const container_detail::merkle_hash root = merkle.root();
+            return sodium_memcmp(root.data(), root_.data(), root.size()) == 0;
+        }
+
+        void load_chunk(std::uint64_t k)
+        {
+            const std::size_t s = chunk_size(k);
+            ciphertext_.resize(s + MACSIZE);
+            read_at(chunk_offset(k), ciphertext_.data(), s + MACSIZE, "chunk");
+
+            cached_ = UINT64_MAX;
+            if (aead_.decrypt(span<byte>(chunk_.data(), s),
+                              header_,
+                              ciphertext_,
+                              nonce_base_ + k) != 0)
+                fail("chunk authentication failed");
+            cached_ = k;
+        }
+
+        std::uint64_t chunk_offset(std::uint64_t k) const
+        {
+            return HEADERSIZE + k * (blocksize_ + MACSIZE);
+        }
+
+        std::size_t chunk_size(std::uint64_t k) const
+        {
+            return static_cast<std::size_t>(
+              std::min<std::uint64_t>(blocksize_, size_ - k * blocksize_));
+        }
+
+        void read_at(std::uint64_t offset,
+                     byte* data,
+                     std::size_t size,
+                     const char* what)
+        {
+            istr_.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+            if (!istr_.read(reinterpret_cast<char*>(data), size)) {
+                istr_.clear();
+                fail(std::string("can't read ") + what);
+            }
+        }
+
+        [[noreturn]] static void fail(const std::string& why)
+        {
+            throw std::runtime_error{ "sodium::seekable_container_source: " +
+                                      why };
+        }
+
+        std::istream& istr_;
+        typename container_type::aead_type aead_;
+        std::array<byte, HEADERSIZE> header_;
+        nonce_type nonce_base_;
+        std::size_t blocksize_;
+        std::uint64_t size_;
+        std::uint64_t nchunks_;
+        container_detail::merkle_hash root_;
+
+        std::uint64_t pos_;
+        std::uint64_t cached_;  // the chunk held by chunk_, if any
+        bytes_protected chunk_; // its plaintext
+        bytes ciphertext_;
+    };
+
+    std::shared_ptr<impl> impl_;
+};
+
+} // namespace sodium
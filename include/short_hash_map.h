@@ -0,0 +1,440 @@
+// short_hash_map.h -- Flood-resistant open-addressing hash map and set
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "hasher_short.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * sodium::short_hash_map<K, V> is an open-addressing hash map whose
+ * hash function is a sodium::hasher_short (SipHash-2-4 with a secret
+ * key), so that an attacker who controls the keys can't make all of
+ * them collide (hash flooding). sodium::short_hash_set<K> is the
+ * corresponding set.
+ *
+ * Instead of the buckets and nodes of std::unordered_map, the table
+ * is an array of groups of GROUPSIZE slots. Each group starts with a
+ * cache line of one control byte per slot: 7 bits of the hash of the
+ * key in the slot, or EMPTY / DELETED. A lookup hashes the key once,
+ * picks a group with some bits of the hash, and scans its control
+ * bytes for the other 7 bits. Only slots whose control byte matches
+ * (1 in 128 of the others) have their key compared: a lookup thus
+ * costs one hash, one cache miss for the control bytes, and
+ * typically one for the entry. Full groups overflow into the next
+ * group; the table grows when it is 7/8 full.
+ *
+ *   sodium::hasher_short<> hasher;
+ *   sodium::short_hash_map<std::string, int> table(hasher);
+ *   table.insert("alice", 1);
+ *   if (const int* v = table.find("alice")) ...
+ *
+ * K is hashed like in sodium::short_hash<K>: it can be a contiguous
+ * container of trivially copyable elements (std::string, sodium::bytes,
+ * ...), or a trivially copyable type with unique object
+ * representations (integers, pointers, ...). Keys are compared with
+ * operator==.
+ *
+ * The map only refers to the hasher_short, which must outlive it. It
+ * is not thread-safe: const member functions may run concurrently,
+ * all others need exclusive access. Pointers to values stay valid
+ * until the next insertion or erasure.
+ **/
+
+namespace sodium {
+
+template<typename K, typename V, class BT = bytes>
+class short_hash_map
+{
+  public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+
+    static constexpr std::size_t GROUPSIZE = 64; // control bytes per line
+
+    explicit short_hash_map(const hasher_short<BT>& hasher,
+                            std::size_t capacity = 0)
+      : hasher_{ &hasher }
+    {
+        reserve(capacity);
+    }
+
+    short_hash_map(const short_hash_map& other)
+      : hasher_{ other.hasher_ }
+    {
+        reserve(other.size_);
+        other.for_each([this](const K& key, const V& value) {
+            insert(key, value);
+        });
+    }
+
+    short_hash_map& operator=(const short_hash_map& other)
+    {
+        if (this != &other) {
+            short_hash_map copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    short_hash_map(short_hash_map&& other) noexcept
+      : hasher_{ other.hasher_ }
+    {
+        swap(other);
+    }
+
+    short_hash_map& operator=(short_hash_map&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~short_hash_map() { destroy_all(); }
+
+    void swap(short_hash_map& other) noexcept
+    {
+        std::swap(hasher_, other.hasher_);
+        std::swap(groups_, other.groups_);
+        std::swap(ngroups_, other.ngroups_);
+        std::swap(size_, other.size_);
+        std::swap(used_, other.used_);
+    }
+
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    // the number of entries that fit before the table grows
+    std::size_t capacity() const noexcept
+    {
+        return ngroups_ * GROUPSIZE / 8 * 7;
+    }
+
+    /**
+     * Make room for capacity entries, so that inserting them won't
+     * grow (and rehash) the table.
+     **/
+
+    void reserve(std::size_t capacity)
+    {
+        if (capacity == 0 && ngroups_ == 0)
+            return; // the first insert() allocates
+
+        std::size_t ngroups = ngroups_ == 0 ? 1 : ngroups_;
+        while (ngroups * GROUPSIZE / 8 * 7 < capacity)
+            ngroups *= 2;
+        if (ngroups != ngroups_)
+            rehash(ngroups);
+    }
+
+    /**
+     * Insert (key, value) if key isn't in the map yet, and return true.
+     * Otherwise, leave the map unchanged and return false.
+     **/
+
+    template<typename VV>
+    bool insert(const K& key, VV&& value)
+    {
+        const std::uint64_t h = hash(key);
+        if (lookup(key, h) != nullptr)
+            return false;
+        emplace_new(h, key, std::forward<VV>(value));
+        return true;
+    }
+
+    // Insert (key, value), or replace the value of key with value
+    template<typename VV>
+    void insert_or_assign(const K& key, VV&& value)
+    {
+        const std::uint64_t h = hash(key);
+        if (value_type* entry = lookup(key, h))
+            entry->second = std::forward<VV>(value);
+        else
+            emplace_new(h, key, std::forward<VV>(value));
+    }
+
+    // The value of key, or nullptr if key isn't in the map
+    V* find(const K& key) noexcept
+    {
+        value_type* entry = lookup(key, hash(key));
+        return entry != nullptr ? &entry->second : nullptr;
+    }
+
+    const V* find(const K& key) const noexcept
+    {
+        const value_type* entry = lookup(key, hash(key));
+        return entry != nullptr ? &entry->second : nullptr;
+    }
+
+    bool contains(const K& key) const noexcept
+    {
+        return lookup(key, hash(key)) != nullptr;
+    }
+
+    // Remove key from the map. Return false if it wasn't there.
+    bool erase(const K& key) noexcept
+    {
+        const std::size_t slot = find_slot(key, hash(key));
+        if (slot == NPOS)
+            return false;
+
+        group_type& group = groups_[slot / GROUPSIZE];
+        group.entry(slot % GROUPSIZE).~value_type();
+        --size_;
+
+        // a group without EMPTY slots may have pushed entries into
+        // the next groups: leave a tombstone so lookups go on
+        if (has_empty(group)) {
+            group.ctrl[slot % GROUPSIZE] = EMPTY;
+            --used_;
+        } else
+            group.ctrl[slot % GROUPSIZE] = DELETED;
+        return true;
+    }
+
+    void clear() noexcept
+    {
+        destroy_all();
+        for (std::size_t g = 0; g != ngroups_; ++g)
+            std::memset(groups_[g].ctrl, EMPTY, GROUPSIZE);
+        size_ = used_ = 0;
+    }
+
+    // Call f(key, value) for each entry, in no particular order
+    template<typename F>
+    void for_each(F f) const
+    {
+        for (std::size_t g = 0; g != ngroups_; ++g)
+            for (std::size_t i = 0; i != GROUPSIZE; ++i)
+                if (is_full(groups_[g].ctrl[i])) {
+                    const value_type& entry = groups_[g].entry(i);
+                    f(entry.first, entry.second);
+                }
+    }
+
+  private:
+    static constexpr std::uint8_t EMPTY = 0x80;
+    static constexpr std::uint8_t DELETED = 0xfe;
+
+    // one cache line of control bytes, followed by the entries
+    struct alignas(64) group_type
+    {
+        std::uint8_t ctrl[GROUPSIZE];
+        typename std::aligned_storage<sizeof(value_type),
+                                      alignof(value_type)>::type
+          slots[GROUPSIZE];
+
+        value_type& entry(std::size_t i) noexcept
+        {
+            return *std::launder(reinterpret_cast<value_type*>(&slots[i]));
+        }
+        const value_type& entry(std::size_t i) const noexcept
+        {
+            return *std::launder(
+              reinterpret_cast<const value_type*>(&slots[i]));
+        }
+    };
+
+    static bool is_full(std::uint8_t ctrl) noexcept
+    {
+        return (ctrl & 0x80) == 0;
+    }
+
+    static bool has_empty(const group_type& group) noexcept
+    {
+        bool result = false;
+        for (std::size_t i = 0; i != GROUPSIZE; ++i)
+            result |= group.ctrl[i] == EMPTY;
+        return result;
+    }
+
+    std::uint64_t hash(const K& key) const noexcept
+    {
+        const span<const byte> bytes = short_hash_detail::bytes_of(key);
+        return hasher_->hash64(bytes.data(), bytes.size());
+    }
+
+    // the low 7 bits tag the slot, the others pick the first group
+    static std::uint8_t tag_of(std::uint64_t h) noexcept
+    {
+        return static_cast<std::uint8_t>(h & 0x7f);
+    }
+
+    std::size_t group_of(std::uint64_t h) const noexcept
+    {
+        return static_cast<std::size_t>(h >> 7) & (ngroups_ - 1);
+    }
+
+    static constexpr std::size_t NPOS = SIZE_MAX;
+
+    // the index (group * GROUPSIZE + slot) of key, or NPOS
+    std::size_t find_slot(const K& key, std::uint64_t h) const noexcept
+    {
+        if (ngroups_ == 0)
+            return NPOS;
+
+        const std::uint8_t tag = tag_of(h);
+        std::size_t g = group_of(h);
+        for (std::size_t probed = 0; probed != ngroups_; ++probed) {
+            const group_type& group = groups_[g];
+            bool empty = false;
+            for (std::size_t i = 0; i != GROUPSIZE; ++i) {
+                const std::uint8_t ctrl = group.ctrl[i];
+                if (ctrl == tag && group.entry(i).first == key)
+                    return g * GROUPSIZE + i;
+                empty |= ctrl == EMPTY;
+            }
+            if (empty)
+                return NPOS; // key would have been stored here
+            g = (g + 1) & (ngroups_ - 1);
+        }
+        return NPOS;
+    }
+
+    value_type* lookup(const K& key, std::uint64_t h) const noexcept
+    {
+        const std::size_t slot = find_slot(key, h);
+        if (slot == NPOS)
+            return nullptr;
+        return &groups_[slot / GROUPSIZE].entry(slot % GROUPSIZE);
+    }
+
+    template<typename VV>
+    void emplace_new(std::uint64_t h, const K& key, VV&& value)
+    {
+        if (used_ + 1 > capacity())
+            rehash(ngroups_ == 0 ? 1 : (size_ + 1 > capacity() / 2
+                                          ? 2 * ngroups_
+                                          : ngroups_));
+        place(h, value_type(key, std::forward<VV>(value)));
+    }
+
+    // move entry into the first free slot of its probe sequence
+    void place(std::uint64_t h, value_type&& entry)
+    {
+        std::size_t g = group_of(h);
+        for (;;) {
+            group_type& group = groups_[g];
+            for (std::size_t i = 0; i != GROUPSIZE; ++i) {
+                const std::uint8_t ctrl = group.ctrl[i];
+                if (!is_full(ctrl)) {
+                    new (&group.slots[i]) value_type(std::move(entry));
+                    group.ctrl[i] = tag_of(h);
+                    ++size_;
+                    if (ctrl == EMPTY)
+                        ++used_;
+                    return;
+                }
+            }
+            g = (g + 1) & (ngroups_ - 1);
+        }
+    }
+
+    // move all entries into a new table of ngroups groups, which also
+    // drops the tombstones
+    void rehash(std::size_t ngroups)
+    {
+        std::unique_ptr<group_type[]> old_groups(new group_type[ngroups]);
+        std::swap(old_groups, groups_);
+        const std::size_t old_ngroups = ngroups_;
+        ngroups_ = ngroups;
+        size_ = used_ = 0;
+        for (std::size_t g = 0; g != ngroups_; ++g)
+            std::memset(groups_[g].ctrl, EMPTY, GROUPSIZE);
+
+        for (std::size_t g = 0; g != old_ngroups; ++g)
+            for (std::size_t i = 0; i != GROUPSIZE; ++i)
+                if (is_full(old_groups[g].ctrl[i])) {
+                    value_type& entry = old_groups[g].entry(i);
+                    place(hash(entry.first), std::move(entry));
+                    entry.~value_type();
+                }
+    }
+
+    void destroy_all() noexcept
+    {
+        for (std::size_t g = 0; g != ngroups_; ++g)
+            for (std::size_t i = 0; i != GROUPSIZE; ++i)
+                if (is_full(groups_[g].ctrl[i]))
+                    groups_[g].entry(i).~value_type();
+    }
+
+    const hasher_short<BT>* hasher_;
+    std::unique_ptr<group_type[]> groups_;
+    std::size_t ngroups_ = 0; // a power of 2
+    std::size_t size_ = 0;    // entries
+    std::size_t used_ = 0;    // entries and tombstones
+};
+
+/**
+ * sodium::short_hash_set<K> is a set of keys with the same layout and
+ * guarantees as sodium::short_hash_map<K, V>.
+ **/
+
+template<typename K, class BT = bytes>
+class short_hash_set
+{
+    struct nothing
+    {};
+
+  public:
+    using key_type = K;
+    using value_type = K;
+
+    explicit short_hash_set(const hasher_short<BT>& hasher,
+                            std::size_t capacity = 0)
+      : map_(hasher, capacity)
+    {}
+
+    std::size_t size() const noexcept { return map_.size(); }
+    bool empty() const noexcept { return map_.empty(); }
+    std::size_t capacity() const noexcept { return map_.capacity(); }
+    void reserve(std::size_t capacity) { map_.reserve(capacity); }
+
+    // Insert key, and return false if it was already in the set
+    bool insert(const K& key) { return map_.insert(key, nothing{}); }
+
+    bool contains(const K& key) const noexcept { return map_.contains(key); }
+
+    // Remove key from the set. Return false if it wasn't there.
+    bool erase(const K& key) noexcept { return map_.erase(key); }
+
+    void clear() noexcept { map_.clear(); }
+
+    // Call f(key) for each key, in no particular order
+    template<typename F>
+    void for_each(F f) const
+    {
+        map_.for_each([&f](const K& key, const nothing&) { f(key); });
+    }
+
+  private:
+    short_hash_map<K, nothing, BT> map_;
+};
+
+} // namespace sodium
@@ -0,0 +1,251 @@
+// signed_aead.h -- Fused AEAD encrypt-then-sign and verify-then-decrypt
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "common.h"
+#include "keypairsign.h"
+#include "span.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<typename BT = bytes, typename F = sodium::aead_xchacha20_poly1305_ietf>
+class signed_aead
+{
+    /**
+     * A sodium::signed_aead<BT, F> encrypts a message with
+     * sodium::aead<BT, F> AND signs the result with Ed25519, so that a
+     * receiver who shares the AEAD key can also tell which holder of a
+     * signing key sent it (the AEAD MAC alone can't: every holder of
+     * the shared key can forge it).
+     *
+     * seal() writes everything into ONE output buffer of
+     * sealed_size(plaintext.size()) bytes:
+     *
+     *   (ciphertext || MAC || signature)
+     *
+     * where (ciphertext || MAC) is exactly the output of the aead, and
+     * signature is the SIGNATURE_SIZE bytes Ed25519ph signature
+     * (crypto_sign_{init,update,final_create}(), as in
+     * sodium::StreamSignorPK) of
+     *
+     *   (LE64(header.size()) || header || nonce || ciphertext || MAC)
+     *
+     * The signature hash is fed straight from the output buffer right
+     * after the aead has written it, i.e. while the ciphertext is
+     * still in the cache; there is no intermediate copy.
+     *
+     * open() goes the other way round: verify the signature first,
+     * then decrypt. A message that doesn't come from the holder of the
+     * signing key is thus rejected before any decryption work is done.
+     *
+     * The sender needs the private signing key, the receiver the
+     * corresponding public key: a signed_aead constructed with only
+     * one of them can only seal() resp. only open().
+     **/
+
+  public:
+    using aead_type = aead<BT, F>;
+    using key_type = typename aead_type::key_type;
+    using nonce_type = typename aead_type::nonce_type;
+    using keypairsign_type = keypairsign<>;
+    using private_key_type = typename keypairsign_type::private_key_type;
+    using public_key_type = typename keypairsign_type::public_key_type;
+
+    static constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+    static constexpr std::size_t SIGNATURE_SIZE = crypto_sign_BYTES;
+    static constexpr std::size_t KEYSIZE_PUBLIC_KEY =
+      keypairsign_type::KEYSIZE_PUBLIC_KEY;
+
+    /**
+     * A signed_aead with the AEAD key key, signing with signing_key
+     * and verifying with the sender's verify_key.
+     *
+     * Throw a std::runtime_error if verify_key isn't KEYSIZE_PUBLIC_KEY
+     * bytes long.
+     **/
+
+    signed_aead(const key_type& key,
+                const private_key_type& signing_key,
+                const public_key_type& verify_key)
+      : aead_(key)
+      , signing_key_(signing_key)
+      , verify_key_(verify_key)
+    {
+        check_verify_key();
+    }
+
+    // A sender's signed_aead: it can seal(), but not open()
+    signed_aead(const key_type& key, const private_key_type& signing_key)
+      : aead_(key)
+      , signing_key_(signing_key)
+    {}
+
+    // A receiver's signed_aead: it can open(), but not seal()
+    signed_aead(const key_type& key, const public_key_type& verify_key)
+      : aead_(key)
+      , verify_key_(verify_key)
+    {
+        check_verify_key();
+    }
+
+    // A signed_aead that signs and verifies with keypair
+    signed_aead(const key_type& key, const keypairsign_type& keypair)
+      : signed_aead(key, keypair.private_key(), keypair.public_key())
+    {}
+
+    // the size of the sealed message of a plaintext of size bytes
+    static constexpr std::size_t sealed_size(std::size_t size) noexcept
+    {
+        return size + MACSIZE + SIGNATURE_SIZE;
+    }
+
+    /**
+     * Encrypt and sign plaintext (and authenticate header) into the
+     * first sealed_size(plaintext.size()) bytes of sealed.
+     *
+     * Return 0 on success, or -1 if sealed is too small or if we
+     * don't have a signing key. Never throws.
+     **/
+
+    int seal(span<byte> sealed,
+             span<const byte> header,
+             span<const byte> plaintext,
+             const nonce_type& nonce) noexcept
+    {
+        const std::size_t clen = plaintext.size() + MACSIZE;
+        if (sealed.size() < clen + SIGNATURE_SIZE || !signing_key_)
+            return -1;
+
+        span<byte> ciphertext = sealed.first(clen);
+        if (aead_.encrypt(ciphertext, header, plaintext, nonce) != 0)
+            return -1;
+
+        crypto_sign_state state;
+        hash(state, header, nonce, ciphertext);
+        if (crypto_sign_final_create(
+              &state, sealed.data() + clen, NULL, signing_key_->data()) != 0)
+            return -1;
+
+        return 0;
+    }
+
+    /**
+     * Verify the signature of sealed against the sender's verify key,
+     * and only then decrypt it into the first sealed.size() - MACSIZE
+     * - SIGNATURE_SIZE bytes of plaintext.
+     *
+     * Return 0 on success, or -1 if plaintext is too small, if sealed
+     * is malformed, forged or tampered with, or if we don't have a
+     * verify key. Never throws.
+     **/
+
+    int open(span<byte> plaintext,
+             span<const byte> header,
+             span<const byte> sealed,
+             const nonce_type& nonce) noexcept
+    {
+        if (sealed.size() < MACSIZE + SIGNATURE_SIZE || verify_key_.empty())
+            return -1;
+
+        const std::size_t clen = sealed.size() - SIGNATURE_SIZE;
+        if (plaintext.size() < clen - MACSIZE)
+            return -1;
+
+        span<const byte> ciphertext = sealed.first(clen);
+
+        crypto_sign_state state;
+        hash(state, header, nonce, ciphertext);
+        // crypto_sign_final_verify() doesn't modify the signature
+        if (crypto_sign_final_verify(
+              &state,
+              const_cast<unsigned char*>(sealed.data() + clen),
+              verify_key_.data()) != 0)
+            return -1;
+
+        return aead_.decrypt(plaintext, header, ciphertext, nonce);
+    }
+
+    /**
+     * Allocating versions of seal() and open(). Throw a
+     * std::runtime_error instead of returning -1.
+     **/
+
+    BT seal(const BT& header, const BT& plaintext, const nonce_type& nonce)
+    {
+        BT sealed(sealed_size(plaintext.size()));
+        if (seal(sealed, header, plaintext, nonce) != 0)
+            throw std::runtime_error{ "sodium::signed_aead::seal() failed" };
+        return sealed; // by move semantics
+    }
+
+    BT open(const BT& header, const BT& sealed, const nonce_type& nonce)
+    {
+        if (sealed.size() < MACSIZE + SIGNATURE_SIZE)
+            throw std::runtime_error{
+                "sodium::signed_aead::open() sealed too small"
+            };
+
+        BT plaintext(sealed.size() - MACSIZE - SIGNATURE_SIZE);
+        if (open(plaintext, header, sealed, nonce) != 0)
+            throw std::runtime_error{
+                "sodium::signed_aead::open() can't verify or decrypt"
+            };
+        return plaintext; // by move semantics
+    }
+
+  private:
+    void check_verify_key() const
+    {
+        if (verify_key_.size() != KEYSIZE_PUBLIC_KEY)
+            throw std::runtime_error{
+                "sodium::signed_aead::signed_aead() wrong verify_key size"
+            };
+    }
+
+    static void hash(crypto_sign_state& state,
+                     span<const byte> header,
+                     const nonce_type& nonce,
+                     span<const byte> ciphertext) noexcept
+    {
+        byte header_size[8];
+        std::uint64_t n = header.size();
+        for (std::size_t i = 0; i != sizeof header_size; ++i, n >>= 8)
+            header_size[i] = static_cast<byte>(n & 0xff);
+
+        crypto_sign_init(&state);
+        crypto_sign_update(&state, header_size, sizeof header_size);
+        crypto_sign_update(&state, header.data(), header.size());
+        crypto_sign_update(&state, nonce.data(), nonce.size());
+        crypto_sign_update(&state, ciphertext.data(), ciphertext.size());
+    }
+
+    aead_type aead_;
+    std::optional<private_key_type> signing_key_;
+    public_key_type verify_key_; // empty if we can't open()
+};
+
+} // namespace sodium
@@ -19,11 +19,19 @@
 #pragma once
 
 #include "common.h"
+#include "extern_templates.h"
+#include "fixed_bytes.h"
 #include "key.h"
 #include "keypairsign.h"
+#include "span.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <future>
 #include <sodium.h>
 #include <stdexcept>
+#include <vector>
 
 namespace sodium {
 
@@ -64,6 +72,8 @@ class signer
       keypairsign_type::KEYSIZE_PRIVATE_KEY;
     static constexpr std::size_t SIGNATURE_SIZE = crypto_sign_BYTES;
 
+    using signature_type = fixed_bytes<SIGNATURE_SIZE>;
+
     // A signer with a user-supplied key (copying version)
     signer(const private_key_type& key)
       : key_(key)
@@ -96,7 +106,7 @@ class signer
      * long.
      **/
 
-    BT sign(const BT& plaintext)
+    BT sign(const BT& plaintext) const
     {
         BT plaintext_signed(SIGNATURE_SIZE + plaintext.size());
         if (crypto_sign(
@@ -116,7 +126,7 @@ class signer
      * Sign the plaintext with the saved private key. Return the
      * signature, which is SIGNATURE_SIZE bytes long.
      **/
-    bytes sign_detached(const BT& plaintext)
+    bytes sign_detached(const BT& plaintext) const
     {
         bytes signature(SIGNATURE_SIZE);
         unsigned long long signature_size;
@@ -139,8 +149,159 @@ class signer
         return signature; // per move semantics
     }
 
+    /**
+     * Allocation-free variant of sign_detached(): return the signature
+     * of plaintext in a fixed_bytes<SIGNATURE_SIZE> on the stack.
+     **/
+
+    signature_type sign_detached_fixed(span<const byte> plaintext) const
+    {
+        signature_type signature;
+
+        if (crypto_sign_detached(signature.data(),
+                                 NULL,
+                                 plaintext.data(),
+                                 plaintext.size(),
+                                 key_.data()) == -1)
+            throw std::runtime_error{ "sodium::signer::sign_detached_fixed()"
+                                      ": crypto_sign_detached() -1" };
+
+        return signature;
+    }
+
+    /**
+     * Sign a batch of plaintexts with the saved private key, in one
+     * call, into caller-owned memory: the signature of plaintexts[i] is
+     * written to the SIGNATURE_SIZE bytes at signatures.data() +
+     * i * SIGNATURE_SIZE, i.e. signatures is one contiguous array of
+     * plaintexts.size() * SIGNATURE_SIZE bytes.
+     *
+     * Return 0 on success, or -1 if signatures has the wrong size or
+     * if signing fails (in which case signatures is zeroed).
+     *
+     * libsodium's crypto_sign_detached() takes the 64 bytes secret key
+     * and expands its seed with SHA-512 on every call; there is no
+     * public API to hand it a precomputed expansion. What a batch
+     * saves is everything around it: no allocation, no copy of the
+     * messages, and one shared key for all items.
+     **/
+
+    int sign_detached(span<const span<const byte>> plaintexts,
+                      span<byte> signatures) const noexcept
+    {
+        if (signatures.size() != plaintexts.size() * SIGNATURE_SIZE)
+            return -1;
+
+        return sign_all(plaintexts, signatures);
+    }
+
+    /**
+     * Same as above, but with batches of at least PARALLEL_BATCHSIZE
+     * items split in one contiguous range per worker thread of pool.
+     * Smaller batches are signed on the calling thread. Throw only if
+     * pool can't take the tasks, and then only once the tasks it
+     * already took are done.
+     **/
+
+    static constexpr std::size_t PARALLEL_BATCHSIZE = 64;
+
+    int sign_detached(span<const span<const byte>> plaintexts,
+                      span<byte> signatures,
+                      thread_pool& pool) const
+    {
+        const std::size_t n = plaintexts.size();
+        if (signatures.size() != n * SIGNATURE_SIZE)
+            return -1;
+        if (n < PARALLEL_BATCHSIZE || pool.size() < 2)
+            return sign_all(plaintexts, signatures);
+
+        const std::size_t nranges = std::min<std::size_t>(pool.size(), n);
+        std::vector<std::future<int>> results;
+        results.reserve(nranges);
+        int rc = 0;
+        try {
+            for (std::size_t r = 0; r != nranges; ++r) {
+                const std::size_t first = n * r / nranges;
+                const std::size_t last = n * (r + 1) / nranges;
+                results.push_back(pool.submit([=] {
+                    return sign_range(plaintexts, signatures, first, last);
+                }));
+            }
+
+            for (auto& result : results)
+                if (pool.get(result) != 0)
+                    rc = -1;
+        } catch (...) {
+            // the pending ranges write into signatures: let them finish
+            for (auto& result : results)
+                if (result.valid())
+                    pool.wait(result);
+            throw;
+        }
+        if (rc != 0)
+            sodium_memzero(signatures.data(), signatures.size());
+        return rc;
+    }
+
+    /**
+     * Sign a batch of plaintexts with the saved private key, using the
+     * worker threads of pool for large batches. Return the signatures
+     * back to back in one bytes object of plaintexts.size() *
+     * SIGNATURE_SIZE bytes.
+     *
+     * Throws std::runtime_error if signing fails.
+     **/
+
+    bytes sign_detached(const std::vector<BT>& plaintexts,
+                        thread_pool& pool) const
+    {
+        std::vector<span<const byte>> views;
+        views.reserve(plaintexts.size());
+        for (const auto& plaintext : plaintexts)
+            views.emplace_back(
+              reinterpret_cast<const byte*>(plaintext.data()),
+              plaintext.size());
+
+        bytes signatures(plaintexts.size() * SIGNATURE_SIZE);
+        if (sign_detached(views, signatures, pool) != 0)
+            throw std::runtime_error{
+                "sodium::signer::sign_detached(batch): "
+                "crypto_sign_detached() -1"
+            };
+
+        return signatures; // per move semantics
+    }
+
   private:
+    int sign_all(span<const span<const byte>> plaintexts,
+                 span<byte> signatures) const noexcept
+    {
+        if (sign_range(plaintexts, signatures, 0, plaintexts.size()) == 0)
+            return 0;
+        sodium_memzero(signatures.data(), signatures.size());
+        return -1;
+    }
+
+    // sign the items [first, last) of a batch
+    int sign_range(span<const span<const byte>> plaintexts,
+                   span<byte> signatures,
+                   std::size_t first,
+                   std::size_t last) const noexcept
+    {
+        for (std::size_t i = first; i != last; ++i)
+            if (crypto_sign_detached(signatures.data() + i * SIGNATURE_SIZE,
+                                     NULL,
+                                     plaintexts[i].data(),
+                                     plaintexts[i].size(),
+                                     key_.data()) == -1)
+                return -1;
+        return 0;
+    }
+
     private_key_type key_;
 };
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(signer);
+
 } // namespace sodium
@@ -0,0 +1,386 @@
+// small_bytes.h -- Byte containers with small-buffer optimization
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "pooled_allocator.h"
+#include "span.h"
+
+#include <sodium.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <type_traits>
+
+/**
+ * Hashes, MACs and keys are dynamically sized in this library, yet
+ * almost always 16 to 64 bytes long. Storing them in a sodium::bytes
+ * costs a heap allocation each, and in a sodium::bytes_protected even
+ * a sodium_allocarray() region of its own (see allocator.h).
+ *
+ * sodium::small_bytes<N> is a byte container that keeps up to N bytes
+ * inline, in the object itself, and only goes to the heap for larger
+ * contents. It is meant for hash outputs and other non-secret values:
+ *
+ *   sodium::hasher_generic<> hasher(key);
+ *   sodium::small_bytes<> h = hasher.hash<sodium::small_bytes<>>(message);
+ *
+ * sodium::small_bytes_protected<N> is its counterpart for key
+ * material. Key bytes can't live inline, as the object may well be
+ * on the (unlocked, unguarded) stack. Instead, they live in one
+ * N bytes slot of the secure_arena (see pooled_allocator.h), which is
+ * carved out of a guard-paged, mlock()ed slab without any system call,
+ * and is reused as is when the contents are resized within N bytes:
+ *
+ *   sodium::keyvar<sodium::small_bytes_protected<>> key(32);
+ *
+ * Both containers offer the subset of the std::vector<byte> interface
+ * that the wrappers of this library use (data(), size(), a size
+ * constructor, resize(), iterators), and both wipe their bytes when
+ * they are destroyed or shrunk. Resizing zero-fills new bytes, like
+ * std::vector does.
+ **/
+
+namespace sodium {
+
+template<std::size_t N = 64>
+class small_bytes
+{
+    static_assert(N > 0, "small_bytes<> needs an inline capacity");
+
+  public:
+    using value_type = byte;
+    using size_type = std::size_t;
+    using pointer = byte*;
+    using const_pointer = const byte*;
+    using iterator = byte*;
+    using const_iterator = const byte*;
+
+    static constexpr std::size_t INLINE_CAPACITY = N;
+
+    small_bytes() noexcept {}
+
+    explicit small_bytes(size_type size, byte value = 0)
+    {
+        resize(size, value);
+    }
+
+    small_bytes(std::initializer_list<byte> bytes)
+    {
+        assign(bytes.begin(), bytes.size());
+    }
+
+    // a copy of the bytes of data, e.g. of a sodium::bytes
+    explicit small_bytes(span<const byte> data)
+    {
+        assign(data.data(), data.size());
+    }
+
+    small_bytes(const small_bytes& other)
+    {
+        assign(other.data(), other.size());
+    }
+
+    small_bytes& operator=(const small_bytes& other)
+    {
+        if (this != &other)
+            assign(other.data(), other.size());
+        return *this;
+    }
+
+    small_bytes(small_bytes&& other) noexcept { take(other); }
+
+    small_bytes& operator=(small_bytes&& other) noexcept
+    {
+        if (this != &other) {
+            clear();
+            release_heap();
+            take(other);
+        }
+        return *this;
+    }
+
+    ~small_bytes()
+    {
+        clear();
+        release_heap();
+    }
+
+    byte* data() noexcept { return heap_ ? heap_.get() : inline_; }
+    const byte* data() const noexcept { return heap_ ? heap_.get() : inline_; }
+    size_type size() const noexcept { return size_; }
+    size_type capacity() const noexcept { return heap_ ? capacity_ : N; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    // true if the bytes are stored inline, i.e. without allocation
+    bool is_inline() const noexcept { return !heap_; }
+
+    byte& operator[](size_type idx) noexcept { return data()[idx]; }
+    const byte& operator[](size_type idx) const noexcept
+    {
+        return data()[idx];
+    }
+
+    iterator begin() noexcept { return data(); }
+    iterator end() noexcept { return data() + size_; }
+    const_iterator begin() const noexcept { return data(); }
+    const_iterator end() const noexcept { return data() + size_; }
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+
+    /**
+     * Resize to size bytes. New bytes are set to value, dropped bytes
+     * are wiped. Growing beyond capacity() moves the contents to the
+     * heap; they stay there until the object is destroyed.
+     **/
+
+    void resize(size_type size, byte value = 0)
+    {
+        if (size > capacity())
+            grow(size);
+        if (size > size_)
+            std::fill(data() + size_, data() + size, value);
+        else
+            sodium_memzero(data() + size, size_ - size);
+        size_ = size;
+    }
+
+    void clear() noexcept
+    {
+        sodium_memzero(data(), size_);
+        size_ = 0;
+    }
+
+  private:
+    void assign(const byte* bytes, size_type size)
+    {
+        clear();
+        if (size > capacity())
+            grow(size);
+        std::copy(bytes, bytes + size, data());
+        size_ = size;
+    }
+
+    void grow(size_type capacity)
+    {
+        std::unique_ptr<byte[]> heap(new byte[capacity]);
+        std::copy(data(), data() + size_, heap.get());
+        sodium_memzero(data(), size_);
+        release_heap();
+        heap_ = std::move(heap);
+        capacity_ = capacity;
+    }
+
+    void release_heap() noexcept
+    {
+        if (heap_)
+            sodium_memzero(heap_.get(), capacity_);
+        heap_.reset();
+        capacity_ = 0;
+    }
+
+    // move the contents of other into *this, which holds nothing
+    void take(small_bytes& other) noexcept
+    {
+        if (other.heap_) {
+            heap_ = std::move(other.heap_);
+            capacity_ = other.capacity_;
+            other.capacity_ = 0;
+        } else {
+            std::copy(other.inline_, other.inline_ + other.size_, inline_);
+            sodium_memzero(other.inline_, other.size_);
+        }
+        size_ = other.size_;
+        other.size_ = 0;
+    }
+
+    std::unique_ptr<byte[]> heap_;
+    size_type capacity_ = 0; // of heap_
+    size_type size_ = 0;
+    byte inline_[N];
+};
+
+template<std::size_t N = 64>
+class small_bytes_protected
+{
+    static_assert(N > 0, "small_bytes_protected<> needs a slot size");
+
+  public:
+    using value_type = byte;
+    using size_type = std::size_t;
+    using pointer = byte*;
+    using const_pointer = const byte*;
+    using iterator = byte*;
+    using const_iterator = const byte*;
+    using allocator_type = pooled_allocator<byte>;
+
+    static constexpr std::size_t SLOT_CAPACITY = N;
+
+    small_bytes_protected() noexcept {}
+
+    explicit small_bytes_protected(size_type size, byte value = 0)
+    {
+        resize(size, value);
+    }
+
+    // a copy of the bytes of data, which must be readable
+    explicit small_bytes_protected(span<const byte> data)
+    {
+        assign(data.data(), data.size());
+    }
+
+    small_bytes_protected(const small_bytes_protected& other)
+    {
+        assign(other.data(), other.size());
+    }
+
+    small_bytes_protected& operator=(const small_bytes_protected& other)
+    {
+        if (this != &other)
+            assign(other.data(), other.size());
+        return *this;
+    }
+
+    small_bytes_protected(small_bytes_protected&& other) noexcept
+      : data_{ other.data_ }
+      , size_{ other.size_ }
+      , capacity_{ other.capacity_ }
+    {
+        other.data_ = nullptr;
+        other.size_ = other.capacity_ = 0;
+    }
+
+    small_bytes_protected& operator=(small_bytes_protected&& other) noexcept
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+        return *this;
+    }
+
+    // the slot is wiped by the secure_arena (or sodium_free())
+    ~small_bytes_protected() { release(); }
+
+    /**
+     * The allocator of the bytes, for noaccess(), readonly() and
+     * readwrite() of their memory, as with sodium::bytes_pooled. The
+     * slot has pages of its own, so this protects this object only.
+     **/
+
+    allocator_type get_allocator() const noexcept { return allocator_type{}; }
+
+    byte* data() noexcept { return data_; }
+    const byte* data() const noexcept { return data_; }
+    size_type size() const noexcept { return size_; }
+    size_type capacity() const noexcept { return capacity_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    byte& operator[](size_type idx) noexcept { return data_[idx]; }
+    const byte& operator[](size_type idx) const noexcept
+    {
+        return data_[idx];
+    }
+
+    iterator begin() noexcept { return data_; }
+    iterator end() noexcept { return data_ + size_; }
+    const_iterator begin() const noexcept { return data_; }
+    const_iterator end() const noexcept { return data_ + size_; }
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+
+    /**
+     * Resize to size bytes, which must be readwrite(). New bytes are
+     * set to value, dropped bytes are wiped. The first resize() to
+     * a non-zero size takes a slot of N bytes (or more, if size > N).
+     **/
+
+    void resize(size_type size, byte value = 0)
+    {
+        if (size > capacity_)
+            grow(size);
+        if (size > size_)
+            std::fill(data_ + size_, data_ + size, value);
+        else if (size < size_)
+            sodium_memzero(data_ + size, size_ - size);
+        size_ = size;
+    }
+
+    void clear() noexcept { resize(0); }
+
+  private:
+    void assign(const byte* bytes, size_type size)
+    {
+        if (size > capacity_)
+            grow(size);
+        std::copy(bytes, bytes + size, data_);
+        if (size < size_)
+            sodium_memzero(data_ + size, size_ - size);
+        size_ = size;
+    }
+
+    void grow(size_type capacity)
+    {
+        capacity = std::max(capacity, N);
+        byte* data = allocator_type{}.allocate(capacity);
+        std::copy(data_, data_ + size_, data);
+        release();
+        data_ = data;
+        capacity_ = capacity;
+    }
+
+    void release() noexcept
+    {
+        if (data_ != nullptr)
+            allocator_type{}.deallocate(data_, capacity_);
+        data_ = nullptr;
+        capacity_ = 0;
+    }
+
+    byte* data_ = nullptr;
+    size_type size_ = 0;
+    size_type capacity_ = 0;
+};
+
+// compare in constant time, like sodium::compare() (see helpers.h)
+template<std::size_t N>
+bool
+operator==(const small_bytes<N>& b1, const small_bytes<N>& b2) noexcept
+{
+    return b1.size() == b2.size() &&
+           sodium_memcmp(b1.data(), b2.data(), b1.size()) == 0;
+}
+
+template<std::size_t N>
+bool
+operator!=(const small_bytes<N>& b1, const small_bytes<N>& b2) noexcept
+{
+    return !(b1 == b2);
+}
+
+template<typename BT>
+struct is_small_bytes_protected : std::false_type
+{};
+
+template<std::size_t N>
+struct is_small_bytes_protected<small_bytes_protected<N>> : std::true_type
+{};
+
+} // namespace sodium
@@ -0,0 +1,134 @@
+// span.h -- A non-owning view of a contiguous range of bytes
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+namespace sodium {
+
+/**
+ * sodium::span<T> is a poor man's C++20 std::span<T>: a pointer and a
+ * length, referring to memory owned by someone else.
+ *
+ * It is used by the allocation-free overloads of the crypto classes
+ * (e.g. sodium::aead<>), which read from and write into caller-owned
+ * buffers instead of returning fresh BT containers.
+ *
+ * A span<T> of a byte-sized T can be implicitly constructed from any
+ * contiguous container of byte-sized elements with data() and size(),
+ * e.g. sodium::bytes, sodium::bytes_protected, sodium::chars or
+ * std::string. The elements are then reinterpreted as T, just like
+ * the reinterpret_cast<unsigned char*>(x.data()) of the BT-based APIs.
+ *
+ * A span<T> of any other T can be constructed from a contiguous
+ * container of T, e.g. a span<const span<const byte>> from a
+ * std::vector<span<const byte>>, as used by the vectored APIs.
+ *
+ * A span<const T> can be constructed from a span<T>, but not the other
+ * way around.
+ **/
+
+template<typename T>
+class span
+{
+    template<typename C>
+    using element_of =
+      typename std::remove_pointer<decltype(std::declval<C&>().data())>::type;
+
+    // C is a contiguous container that can be viewed as a span<T>:
+    // either both are byte-sized, or C holds elements of type T
+    template<typename C>
+    using if_compatible_container = typename std::enable_if<
+      ((sizeof(T) == 1 && sizeof(element_of<C>) == 1) ||
+       std::is_same<typename std::remove_cv<T>::type,
+                    typename std::remove_cv<element_of<C>>::type>::value) &&
+        (std::is_const<T>::value || !std::is_const<element_of<C>>::value),
+      int>::type;
+
+  public:
+    using element_type = T;
+    using value_type = typename std::remove_cv<T>::type;
+    using pointer = T*;
+    using iterator = T*;
+
+    constexpr span() noexcept
+      : data_(nullptr)
+      , size_(0)
+    {}
+
+    constexpr span(T* data, std::size_t size) noexcept
+      : data_(data)
+      , size_(size)
+    {}
+
+    template<std::size_t N>
+    constexpr span(T (&arr)[N]) noexcept
+      : data_(arr)
+      , size_(N)
+    {}
+
+    template<typename C, if_compatible_container<C> = 0>
+    span(C& container) noexcept
+      : data_(reinterpret_cast<T*>(container.data()))
+      , size_(container.size())
+    {}
+
+    // span<const T> from span<T>
+    template<typename U,
+             typename = typename std::enable_if<
+               std::is_same<const U, T>::value>::type>
+    constexpr span(const span<U>& other) noexcept
+      : data_(other.data())
+      , size_(other.size())
+    {}
+
+    constexpr T* data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+
+    constexpr T& operator[](std::size_t idx) const noexcept
+    {
+        return data_[idx];
+    }
+
+    constexpr iterator begin() const noexcept { return data_; }
+    constexpr iterator end() const noexcept { return data_ + size_; }
+
+    /**
+     * Return the sub-span [offset, offset+count) of this span.
+     * The caller must make sure that offset+count <= size().
+     **/
+    constexpr span subspan(std::size_t offset, std::size_t count) const
+      noexcept
+    {
+        return span(data_ + offset, count);
+    }
+
+    constexpr span first(std::size_t count) const noexcept
+    {
+        return span(data_, count);
+    }
+
+  private:
+    T* data_;
+    std::size_t size_;
+};
+
+} // namespace sodium
@@ -0,0 +1,259 @@
+// stream_xor_backend.h -- Pluggable key stream generation for stream ciphers
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "key.h"
+#include "nonce.h"
+
+#include <cstddef> // std::size_t
+#include <cstdint> // std::uint64_t
+#include <memory>  // std::shared_ptr<>, std::atomic_load()
+#include <utility> // std::move()
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * The stream ciphers of the stream cipher filters (xchacha20_filter,
+ * chacha20_filter, salsa20_filter, xsalsa20_filter and the
+ * buffered_stream_filter<> variants). They all have 64 bytes blocks
+ * and a 64-bit block counter.
+ **/
+
+enum class stream_cipher_id : int
+{
+    xchacha20,
+    chacha20,
+    salsa20,
+    xsalsa20
+};
+
+struct stream_cipher_xchacha20
+{
+    static constexpr stream_cipher_id ID = stream_cipher_id::xchacha20;
+    static constexpr std::size_t KEYSIZE = sodium::KEYSIZE_XCHACHA20;
+    static constexpr std::size_t NONCESIZE = sodium::NONCESIZE_XCHACHA20;
+
+    static int xor_ic(unsigned char* c,
+                      const unsigned char* m,
+                      unsigned long long mlen,
+                      const unsigned char* n,
+                      std::uint64_t ic,
+                      const unsigned char* k)
+    {
+        return crypto_stream_xchacha20_xor_ic(c, m, mlen, n, ic, k);
+    }
+};
+
+struct stream_cipher_chacha20
+{
+    static constexpr stream_cipher_id ID = stream_cipher_id::chacha20;
+    static constexpr std::size_t KEYSIZE = sodium::KEYSIZE_CHACHA20;
+    static constexpr std::size_t NONCESIZE = sodium::NONCESIZE_CHACHA20;
+
+    static int xor_ic(unsigned char* c,
+                      const unsigned char* m,
+                      unsigned long long mlen,
+                      const unsigned char* n,
+                      std::uint64_t ic,
+                      const unsigned char* k)
+    {
+        return crypto_stream_chacha20_xor_ic(c, m, mlen, n, ic, k);
+    }
+};
+
+struct stream_cipher_salsa20
+{
+    static constexpr stream_cipher_id ID = stream_cipher_id::salsa20;
+    static constexpr std::size_t KEYSIZE = sodium::KEYSIZE_SALSA20;
+    static constexpr std::size_t NONCESIZE = sodium::NONCESIZE_SALSA20;
+
+    static int xor_ic(unsigned char* c,
+                      const unsigned char* m,
+                      unsigned long long mlen,
+                      const unsigned char* n,
+                      std::uint64_t ic,
+                      const unsigned char* k)
+    {
+        return crypto_stream_salsa20_xor_ic(c, m, mlen, n, ic, k);
+    }
+};
+
+struct stream_cipher_xsalsa20
+{
+    static constexpr stream_cipher_id ID = stream_cipher_id::xsalsa20;
+    static constexpr std::size_t KEYSIZE = sodium::KEYSIZE_XSALSA20;
+    static constexpr std::size_t NONCESIZE = sodium::NONCESIZE_XSALSA20;
+
+    static int xor_ic(unsigned char* c,
+                      const unsigned char* m,
+                      unsigned long long mlen,
+                      const unsigned char* n,
+                      std::uint64_t ic,
+                      const unsigned char* k)
+    {
+        return crypto_stream_xsalsa20_xor_ic(c, m, mlen, n, ic, k);
+    }
+};
+
+class stream_xor_backend
+{
+    /**
+     * A stream_xor_backend xors ranges of bytes with the key stream of
+     * a stream cipher, starting at a given block counter, exactly like
+     * crypto_stream_*_xor_ic(). The stream cipher filters hand their
+     * bulk work to one, so that the key stream can be generated
+     * elsewhere: on a GPU (CUDA, OpenCL), on an accelerator card, or
+     * on many CPU cores. Since the key stream blocks of different
+     * counters are independent, a backend may split a call into
+     * counter-aligned slices of BLOCKSIZE bytes and process them in
+     * any order.
+     *
+     * A backend MUST produce the same bytes as libsodium: a stream
+     * encrypted with one backend can be decrypted with any other.
+     *
+     * The filters share a backend and call it from whatever thread
+     * they are used in: xor_ic() must be thread-safe.
+     **/
+
+  public:
+    static constexpr std::size_t BLOCKSIZE = 64;
+
+    virtual ~stream_xor_backend() = default;
+
+    // a short, human-readable name, e.g. for logs
+    virtual const char* name() const noexcept = 0;
+
+    /**
+     * The smallest mlen worth handing to xor_ic(): below it, the
+     * filters call libsodium directly, e.g. because the transfer to
+     * and from a GPU would cost more than it saves. 0: always use
+     * this backend.
+     **/
+
+    virtual std::size_t min_size() const noexcept { return 0; }
+
+    /**
+     * xor the mlen bytes at m with the key stream of cipher for nonce
+     * n and key k, starting at block ic, into c. m and c are either
+     * the same, or don't overlap. Return 0 on success, -1 on error.
+     **/
+
+    virtual int xor_ic(stream_cipher_id cipher,
+                       unsigned char* c,
+                       const unsigned char* m,
+                       unsigned long long mlen,
+                       const unsigned char* n,
+                       std::uint64_t ic,
+                       const unsigned char* k) noexcept = 0;
+};
+
+class libsodium_stream_xor_backend : public stream_xor_backend
+{
+    /**
+     * The default backend: libsodium's crypto_stream_*_xor_ic() in
+     * the calling thread.
+     **/
+
+  public:
+    const char* name() const noexcept override { return "libsodium"; }
+
+    int xor_ic(stream_cipher_id cipher,
+               unsigned char* c,
+               const unsigned char* m,
+               unsigned long long mlen,
+               const unsigned char* n,
+               std::uint64_t ic,
+               const unsigned char* k) noexcept override
+    {
+        switch (cipher) {
+            case stream_cipher_id::xchacha20:
+                return stream_cipher_xchacha20::xor_ic(c, m, mlen, n, ic, k);
+            case stream_cipher_id::chacha20:
+                return stream_cipher_chacha20::xor_ic(c, m, mlen, n, ic, k);
+            case stream_cipher_id::salsa20:
+                return stream_cipher_salsa20::xor_ic(c, m, mlen, n, ic, k);
+            case stream_cipher_id::xsalsa20:
+                return stream_cipher_xsalsa20::xor_ic(c, m, mlen, n, ic, k);
+        }
+        return -1;
+    }
+};
+
+namespace stream_xor_detail {
+
+inline std::shared_ptr<stream_xor_backend>&
+default_backend_slot()
+{
+    static std::shared_ptr<stream_xor_backend> slot =
+      std::make_shared<libsodium_stream_xor_backend>();
+    return slot;
+}
+
+} // namespace stream_xor_detail
+
+/**
+ * The backend of the stream cipher filters that are constructed
+ * without one: libsodium_stream_xor_backend, unless replaced by
+ * set_default_stream_xor_backend(). A filter keeps the backend it was
+ * constructed with, even if the default changes afterwards.
+ **/
+
+inline std::shared_ptr<stream_xor_backend>
+default_stream_xor_backend()
+{
+    return std::atomic_load(&stream_xor_detail::default_backend_slot());
+}
+
+/**
+ * Make backend the default of the stream cipher filters constructed
+ * from now on, or libsodium again if backend is empty. Thread-safe.
+ **/
+
+inline void
+set_default_stream_xor_backend(std::shared_ptr<stream_xor_backend> backend)
+{
+    if (!backend)
+        backend = std::make_shared<libsodium_stream_xor_backend>();
+    std::atomic_store(&stream_xor_detail::default_backend_slot(),
+                      std::move(backend));
+}
+
+/**
+ * xor with the key stream of Cipher, like Cipher::xor_ic(), but with
+ * backend if there is one and mlen is at least backend->min_size().
+ **/
+
+template<typename Cipher>
+int
+stream_xor(stream_xor_backend* backend,
+           unsigned char* c,
+           const unsigned char* m,
+           unsigned long long mlen,
+           const unsigned char* n,
+           std::uint64_t ic,
+           const unsigned char* k) noexcept
+{
+    if (backend == nullptr || mlen < backend->min_size())
+        return Cipher::xor_ic(c, m, mlen, n, ic, k);
+    return backend->xor_ic(Cipher::ID, c, m, mlen, n, ic, k);
+}
+
+} // namespace sodium
@@ -0,0 +1,220 @@
+// streambuf_io.h -- Block I/O on std::streambufs and file descriptors
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "span.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <stdexcept>
+#include <streambuf>
+
+#include <unistd.h>
+
+namespace sodium {
+
+/**
+ * The readers and writers below are the fast paths of the stream
+ * classes (StreamHash, StreamSignorPK, streamcryptor_aead,
+ * filecryptor_aead): their overloads for a std::streambuf* or a
+ * sodium::raw_fd skip the std::istream / std::ostream layer, i.e. the
+ * sentry, the state checks, and, where possible, the copy through a
+ * buffer of our own.
+ *
+ * Reading a block of n bytes from a std::streambuf hands out a view
+ * of its get area when n bytes are already there (e.g. always for a
+ * std::stringbuf, whose get area is the whole string), and falls back
+ * to sgetn() into a buffer otherwise, which std::filebuf serves with
+ * one read() straight from the file for large blocks. A raw_fd is
+ * read() and write()n directly.
+ *
+ * Errors of the file descriptors throw a std::runtime_error; the
+ * std::streambuf functions throw whatever the streambuf throws.
+ **/
+
+// a file descriptor, to select the raw_fd overloads
+struct raw_fd
+{
+    int fd;
+};
+
+namespace streambuf_detail {
+
+// public access to the get area of any streambuf, through pointers to
+// the protected members (which a derived class may take)
+struct get_area : std::streambuf
+{
+    static const char* next(std::streambuf* sb)
+    {
+        return (sb->*&get_area::gptr)();
+    }
+    static const char* end(std::streambuf* sb)
+    {
+        return (sb->*&get_area::egptr)();
+    }
+    static void bump(std::streambuf* sb, int n)
+    {
+        (sb->*&get_area::gbump)(n);
+    }
+};
+
+} // namespace streambuf_detail
+
+class streambuf_reader
+{
+  public:
+    explicit streambuf_reader(std::streambuf* sb)
+      : sb_(sb)
+    {
+        if (sb_ == nullptr)
+            throw std::runtime_error{
+                "sodium::streambuf_reader() null streambuf"
+            };
+    }
+
+    /**
+     * Read the next block of up to n bytes (less only at the end of
+     * the data), and return a view of it: of the get area of the
+     * streambuf if the whole block is there, or else of the first
+     * bytes of buffer, into which it was copied. buffer must have at
+     * least n bytes. The view is valid until the next read.
+     **/
+
+    span<const byte> next_block(std::size_t n, span<byte> buffer)
+    {
+        using streambuf_detail::get_area;
+
+        const char* next = get_area::next(sb_);
+        if (next != nullptr && n <= INT_MAX &&
+            static_cast<std::size_t>(get_area::end(sb_) - next) >= n) {
+            get_area::bump(sb_, static_cast<int>(n));
+            return span<const byte>(reinterpret_cast<const byte*>(next), n);
+        }
+        return buffer.first(read(buffer.data(), n));
+    }
+
+    // copy the next up to n bytes into data, return their number
+    std::size_t read(byte* data, std::size_t n)
+    {
+        std::size_t got = 0;
+        while (got != n) {
+            const std::streamsize s =
+              sb_->sgetn(reinterpret_cast<char*>(data) + got,
+                         static_cast<std::streamsize>(n - got));
+            if (s <= 0)
+                break;
+            got += static_cast<std::size_t>(s);
+        }
+        return got;
+    }
+
+  private:
+    std::streambuf* sb_;
+};
+
+class streambuf_writer
+{
+  public:
+    explicit streambuf_writer(std::streambuf* sb)
+      : sb_(sb)
+    {
+        if (sb_ == nullptr)
+            throw std::runtime_error{
+                "sodium::streambuf_writer() null streambuf"
+            };
+    }
+
+    // write all of data, return false if the streambuf refuses some
+    bool write(span<const byte> data)
+    {
+        return data.empty() ||
+               sb_->sputn(reinterpret_cast<const char*>(data.data()),
+                          static_cast<std::streamsize>(data.size())) ==
+                 static_cast<std::streamsize>(data.size());
+    }
+
+  private:
+    std::streambuf* sb_;
+};
+
+class fd_reader
+{
+  public:
+    explicit fd_reader(raw_fd fd) noexcept
+      : fd_(fd.fd)
+    {}
+
+    // the same as streambuf_reader::next_block(), always into buffer
+    span<const byte> next_block(std::size_t n, span<byte> buffer)
+    {
+        return buffer.first(read(buffer.data(), n));
+    }
+
+    std::size_t read(byte* data, std::size_t n)
+    {
+        std::size_t got = 0;
+        while (got != n) {
+            const ssize_t s = ::read(fd_, data + got, n - got);
+            if (s == -1 && errno == EINTR)
+                continue;
+            if (s == -1)
+                throw std::runtime_error{
+                    "sodium::fd_reader::read() can't read file descriptor"
+                };
+            if (s == 0)
+                break;
+            got += static_cast<std::size_t>(s);
+        }
+        return got;
+    }
+
+  private:
+    int fd_;
+};
+
+class fd_writer
+{
+  public:
+    explicit fd_writer(raw_fd fd) noexcept
+      : fd_(fd.fd)
+    {}
+
+    bool write(span<const byte> data) noexcept
+    {
+        const byte* p = data.data();
+        std::size_t n = data.size();
+        while (n != 0) {
+            const ssize_t s = ::write(fd_, p, n);
+            if (s == -1 && errno == EINTR)
+                continue;
+            if (s <= 0)
+                return false;
+            p += s;
+            n -= static_cast<std::size_t>(s);
+        }
+        return true;
+    }
+
+  private:
+    int fd_;
+};
+
+} // namespace sodium
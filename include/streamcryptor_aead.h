@@ -20,25 +20,155 @@
 #pragma once
 
 #include "aead.h"
+#include "aead_traits.h"
+#include "blocksize.h"
 #include "common.h"
+#include "io_pipeline.h"
 #include "key.h"
 #include "nonce.h"
+#include "span.h"
+#include "streambuf_io.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <future>
 #include <istream>
 #include <ostream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <sodium.h>
 
 /**
- * Deprecated: use sodium::secretstream instead.
- *
- * Currently only used in sodiumtester. It will be deleted
- * as soom as it is re-implemented using sodium::secretstream.
+ * Deprecated: use sodium::streamcryptor_secretstream (see
+ * streamcryptor_secretstream.h) instead, which authenticates the end
+ * of the stream and doesn't need a nonce to be managed by the caller.
  **/
 
 namespace sodium {
 
+/**
+ * The framed stream format
+ * ------------------------
+ *
+ * encrypt() writes headerless chunks of blocksize + MACSIZE bytes,
+ * that only the same key, nonce AND blocksize decrypt.
+ * encrypt_framed() writes a self-describing, more compact stream
+ * instead. All integers are little-endian:
+ *
+ *   header  = "SWSF" || version (1) || algorithm id (1)
+ *             || NONCESIZE (1) || 0 (1) || LE32(blocksize)
+ *             || LE32(superblock) || nonce base
+ *
+ *   frame_i = AEAD_encrypt(key, nonce base + i, AD = header || last_i,
+ *                          plaintext[i * S, (i+1) * S))
+ *
+ * where S = blocksize * superblock, and last_i is the byte 1 for the
+ * last frame and 0 for all others. Every frame holds S bytes of
+ * plaintext and MACSIZE bytes of tag, except for the last one, which
+ * holds the remaining 0..S bytes: no padding, no length fields. The
+ * empty message is a single empty last frame.
+ *
+ * Compared to encrypt(), the MAC overhead is divided by superblock,
+ * the nonce and blocksize travel with the stream, and truncation or
+ * extension at a frame boundary is detected: the last frame is
+ * sealed as such. The algorithm ids are those of aead_traits<>.
+ *
+ * decrypt_auto() tells both formats apart by the "SWSF" magic (an
+ * encrypt() stream starts with it with probability 2^-32).
+ **/
+
+namespace streamcryptor_detail {
+
+constexpr char FRAMED_MAGIC[4] = { 'S', 'W', 'S', 'F' };
+constexpr std::uint8_t FRAMED_VERSION = 1;
+
+// the most plaintext bytes per frame decrypt_framed() accepts
+constexpr std::uint64_t FRAMED_MAX_FRAMESIZE = std::uint64_t(1) << 30;
+
+inline void
+store_le32(unsigned char* out, std::uint32_t value)
+{
+    for (std::size_t i = 0; i != 4; ++i)
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+inline std::uint32_t
+load_le32(const unsigned char* in)
+{
+    std::uint32_t value = 0;
+    for (std::size_t i = 0; i != 4; ++i)
+        value |= static_cast<std::uint32_t>(in[i]) << (8 * i);
+    return value;
+}
+
+/**
+ * A read-only streambuf that returns the bytes [prefix, prefix+size)
+ * before those of source, to "unread" the bytes that decrypt_auto()
+ * has looked at.
+ **/
+
+class prefixed_streambuf : public std::streambuf
+{
+  public:
+    prefixed_streambuf(const char* prefix,
+                       std::size_t size,
+                       std::streambuf* source)
+      : prefix_(prefix, prefix + size)
+      , source_{ source }
+    {
+        setg(prefix_.data(), prefix_.data(), prefix_.data() + size);
+    }
+
+  protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        if (!in_source_) {
+            in_source_ = true;
+            setg(nullptr, nullptr, nullptr);
+        }
+        return source_->sgetc();
+    }
+
+    int_type uflow() override
+    {
+        if (gptr() < egptr()) {
+            const char c = *gptr();
+            gbump(1);
+            return traits_type::to_int_type(c);
+        }
+        underflow();
+        return source_->sbumpc();
+    }
+
+    std::streamsize xsgetn(char* s, std::streamsize n) override
+    {
+        std::streamsize done = 0;
+        if (gptr() < egptr()) {
+            done = std::min<std::streamsize>(n, egptr() - gptr());
+            std::memcpy(s, gptr(), static_cast<std::size_t>(done));
+            gbump(static_cast<int>(done));
+        }
+        if (done < n) {
+            underflow();
+            done += source_->sgetn(s + done, n - done);
+        }
+        return done;
+    }
+
+  private:
+    std::vector<char> prefix_;
+    std::streambuf* source_;
+    bool in_source_ = false;
+};
+
+} // namespace streamcryptor_detail
+
 template<typename BT = bytes>
 class streamcryptor_aead
 {
@@ -56,6 +186,10 @@ class streamcryptor_aead
      **/
     constexpr static std::size_t MACSIZE = aead<BT>::MACSIZE;
 
+    // the most plaintext bytes per frame decrypt_framed() accepts by
+    // default
+    constexpr static std::size_t DECRYPT_FRAMESIZE_MAX = 16 * 1024 * 1024;
+
     /**
      * A StreamCryptor will encrypt/decrypt streams blockwise using a
      * CryptorAEAD as the crypto engine.
@@ -72,22 +206,56 @@ class streamcryptor_aead
      * that will be used for both encryption and decryption of the
      * streams.
      *
-     * If the key size isn't correct, or the blocksize doesn't make sense,
-     * the constructor throws a std::runtime_error.
+     * decrypt_framed() reads the frame size (blocksize * superblock)
+     * from the stream, before anything of it has been authenticated,
+     * and refuses frames larger than the larger of blocksize and
+     * max_framesize: a forged header can't make it allocate more than
+     * that.
+     *
+     * If the key size isn't correct, or the blocksize or max_framesize
+     * don't make sense, the constructor throws a std::runtime_error.
      **/
 
     streamcryptor_aead(const typename aead<BT>::key_type& key,
                        const typename aead<BT>::nonce_type& nonce,
-                       const std::size_t blocksize)
-      : sc_aead_{ aead<>(key) }
+                       const std::size_t blocksize,
+                       const std::size_t max_framesize =
+                         DECRYPT_FRAMESIZE_MAX)
+      : streamcryptor_aead(make_shared_key(key),
+                           nonce,
+                           blocksize,
+                           max_framesize)
+    {}
+
+    /**
+     * A StreamCryptor sharing an immutable key (e.g. the key_handle()
+     * of an aead<>) instead of copying it into new protected memory.
+     **/
+
+    streamcryptor_aead(typename aead<BT>::shared_key_type key,
+                       const typename aead<BT>::nonce_type& nonce,
+                       const std::size_t blocksize,
+                       const std::size_t max_framesize =
+                         DECRYPT_FRAMESIZE_MAX)
+      : sc_aead_{ std::move(key) }
       , nonce_{ nonce }
       , header_{}
       , blocksize_{ blocksize }
+      , max_framesize_{ std::max(blocksize, max_framesize) }
     {
         // some sanity checks, before we start
         if (blocksize < 1)
             throw std::runtime_error{ "sodium::streamcryptor_aead::"
                                       "streamcryptor_aead(): wrong blocksize" };
+        if (blocksize == sodium::blocksize::auto_tune)
+            throw std::runtime_error{ "sodium::streamcryptor_aead::"
+                                      "streamcryptor_aead(): auto_tune isn't "
+                                      "stored in the stream" };
+        if (max_framesize < 1 ||
+            max_framesize > streamcryptor_detail::FRAMED_MAX_FRAMESIZE)
+            throw std::runtime_error{ "sodium::streamcryptor_aead::"
+                                      "streamcryptor_aead(): wrong "
+                                      "max_framesize" };
     }
 
     /**
@@ -235,11 +403,626 @@ class streamcryptor_aead
         }
     }
 
+    /**
+     * Fast-path versions of encrypt(istr, ostr) and decrypt(istr,
+     * ostr): read from the std::streambuf in and write to the
+     * std::streambuf out (e.g. istr.rdbuf() and ostr.rdbuf()), or use
+     * the file descriptors in and out, without the std::istream /
+     * std::ostream layer. Chunks are crypted with the allocation-free
+     * span API of aead<BT> into one reused buffer, and straight from
+     * the get area of in when it holds the whole chunk; see
+     * streambuf_io.h.
+     *
+     * The output is the same as that of encrypt(istr, ostr) and
+     * decrypt(istr, ostr), and so are the errors.
+     **/
+
+    void encrypt(std::streambuf* in, std::streambuf* out)
+    {
+        streambuf_reader reader{ in };
+        streambuf_writer writer{ out };
+        encrypt_from(reader, writer);
+    }
+
+    void encrypt(raw_fd in, raw_fd out)
+    {
+        fd_reader reader{ in };
+        fd_writer writer{ out };
+        encrypt_from(reader, writer);
+    }
+
+    void decrypt(std::streambuf* in, std::streambuf* out)
+    {
+        streambuf_reader reader{ in };
+        streambuf_writer writer{ out };
+        decrypt_from(reader, writer);
+    }
+
+    void decrypt(raw_fd in, raw_fd out)
+    {
+        fd_reader reader{ in };
+        fd_writer writer{ out };
+        decrypt_from(reader, writer);
+    }
+
+    /**
+     * Framed versions of encrypt() and decrypt(): see "The framed
+     * stream format" above.
+     *
+     * encrypt_framed() writes the header, with the saved nonce and
+     * blocksize, followed by frames of superblock blocks each: the
+     * larger superblock, the fewer MACs, but the more data needs to
+     * be buffered and is lost to a single corrupted byte. Frames of
+     * more than DECRYPT_FRAMESIZE_MAX bytes need a decryptor with a
+     * larger max_framesize(). Throw a std::runtime_error if superblock
+     * is 0 or too large, or if writing to ostr fails.
+     **/
+
+    static constexpr std::size_t FRAMED_HEADERSIZE =
+      16 + aead<BT>::NONCESIZE;
+
+    using algorithm_type = sodium::aead_xchacha20_poly1305_ietf; // of aead<BT>
+
+    void encrypt_framed(std::istream& istr,
+                        std::ostream& ostr,
+                        const std::size_t superblock = 1)
+    {
+        const std::uint64_t framesize =
+          static_cast<std::uint64_t>(blocksize_) * superblock;
+        if (superblock < 1 || superblock > UINT32_MAX ||
+            blocksize_ > UINT32_MAX ||
+            framesize > streamcryptor_detail::FRAMED_MAX_FRAMESIZE)
+            throw std::runtime_error{
+                "sodium::streamcryptor_aead::encrypt_framed() wrong blocksize "
+                "or superblock"
+            };
+
+        BT ad = framed_header(superblock);
+        ostr.write(reinterpret_cast<const char*>(ad.data()),
+                   FRAMED_HEADERSIZE);
+        ad.push_back(0); // last_i
+
+        BT plaintext(static_cast<std::size_t>(framesize), '\0');
+        BT ciphertext(plaintext.size() + MACSIZE, '\0');
+        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+        bool last = false;
+        while (!last) {
+            istr.read(reinterpret_cast<char*>(plaintext.data()),
+                      plaintext.size());
+            const std::size_t s = static_cast<std::size_t>(istr.gcount());
+            last = s != plaintext.size() ||
+                   istr.peek() == std::istream::traits_type::eof();
+
+            ad.back() = last ? 1 : 0;
+            sc_aead_.encrypt(span<byte>(ciphertext),
+                             span<const byte>(ad),
+                             span<const byte>(plaintext).first(s),
+                             running_nonce);
+            running_nonce.increment();
+
+            ostr.write(reinterpret_cast<const char*>(ciphertext.data()),
+                       s + MACSIZE);
+            if (!ostr)
+                throw std::runtime_error{ "sodium::streamcryptor_aead::"
+                                          "encrypt_framed() error writing "
+                                          "frame to stream" };
+        }
+    }
+
+    /**
+     * Decrypt a stream written by encrypt_framed() with the saved
+     * key, writing the plaintext to ostr. The nonce and blocksize are
+     * those of the stream's header: the saved ones are not used.
+     *
+     * Throw a std::runtime_error without writing the frame if
+     *   - the header is missing, has an unknown version, isn't for
+     *     the algorithm of aead<BT>, or has frames larger than
+     *     max_framesize(),
+     *   - a frame doesn't verify (wrong key, corrupted header or
+     *     frame, reordered frames),
+     *   - the stream has been truncated or extended.
+     * No strong guarantee w.r.t. ostr: the frames before the failing
+     * one have been written.
+     **/
+
+    void decrypt_framed(std::istream& istr, std::ostream& ostr)
+    {
+        unsigned char magic[4];
+        if (!istr.read(reinterpret_cast<char*>(magic), sizeof magic) ||
+            std::memcmp(magic, streamcryptor_detail::FRAMED_MAGIC, 4) != 0)
+            throw std::runtime_error{ "sodium::streamcryptor_aead::decrypt_"
+                                      "framed() not a framed stream" };
+        decrypt_framed_after_magic(istr, ostr);
+    }
+
+    /**
+     * Decrypt a stream written by either encrypt_framed(), with the
+     * saved key, or encrypt(), with the saved key, nonce and
+     * blocksize, telling them apart by the magic of the framed format.
+     **/
+
+    void decrypt_auto(std::istream& istr, std::ostream& ostr)
+    {
+        char magic[4];
+        istr.read(magic, sizeof magic);
+        const std::size_t s = static_cast<std::size_t>(istr.gcount());
+        if (s == sizeof magic &&
+            std::memcmp(magic, streamcryptor_detail::FRAMED_MAGIC, 4) == 0) {
+            decrypt_framed_after_magic(istr, ostr);
+            return;
+        }
+
+        istr.clear(istr.rdstate() & ~std::ios::failbit & ~std::ios::eofbit);
+        streamcryptor_detail::prefixed_streambuf buf(magic, s, istr.rdbuf());
+        std::istream prefixed(&buf);
+        decrypt(prefixed, ostr);
+    }
+
+    /**
+     * Parallel version of encrypt(istr, ostr).
+     *
+     * Because the nonce of block i is just the initial nonce
+     * incremented i times, blocks can be encrypted independently of
+     * each other. This function reads a window of up to window blocks
+     * from istr, precomputes their nonces, splits the window into one
+     * contiguous range of blocks per worker of pool, waits for all
+     * ranges to be encrypted, and writes the window in order to ostr.
+     *
+     * If window is 0, use 4 blocks per worker thread of pool.
+     *
+     * The output is byte-for-byte identical to that of
+     * encrypt(istr, ostr), and can be decrypted by both decrypt()
+     * functions.
+     *
+     * Memory usage is approximately window * (2 * blocksize + MACSIZE)
+     * bytes. Throw a std::runtime_error if writing to ostr fails.
+     **/
+
+    void encrypt(std::istream& istr,
+                 std::ostream& ostr,
+                 thread_pool& pool,
+                 std::size_t window = 0)
+    {
+        run_parallel(istr, ostr, pool, window, true);
+    }
+
+    /**
+     * Parallel version of decrypt(istr, ostr), see encrypt() above.
+     *
+     * All blocks of the window are decrypted in parallel. If one of
+     * them can't be decrypted, the plaintext of the blocks preceding
+     * it is written to ostr, and a std::runtime_error is thrown, just
+     * like decrypt(istr, ostr) would. No strong guarantee w.r.t. ostr.
+     **/
+
+    void decrypt(std::istream& istr,
+                 std::ostream& ostr,
+                 thread_pool& pool,
+                 std::size_t window = 0)
+    {
+        run_parallel(istr, ostr, pool, window, false);
+    }
+
+    /**
+     * Pipelined version of encrypt(istr, ostr).
+     *
+     * Reading from istr, encrypting, and writing to ostr overlap in
+     * time, with the sodium::io_pipeline of depth buffers of window
+     * blocks each: while the calling thread encrypts one buffer,
+     * another one is being read and a third one written in the
+     * background. This keeps both the disk and the CPU busy when
+     * istr and ostr are files.
+     *
+     * The output is byte-for-byte identical to that of
+     * encrypt(istr, ostr). Memory usage is approximately
+     * depth * window * (2 * blocksize + MACSIZE) bytes.
+     *
+     * Throw a std::runtime_error if reading or writing fails.
+     **/
+
+    void encrypt_pipelined(std::istream& istr,
+                           std::ostream& ostr,
+                           std::size_t depth = io_pipeline::DEPTH,
+                           std::size_t window = 16)
+    {
+        run_pipelined(istr, ostr, depth, window, true);
+    }
+
+    /**
+     * Pipelined version of decrypt(istr, ostr), see encrypt_pipelined()
+     * above.
+     *
+     * If a block can't be decrypted, throw a std::runtime_error. The
+     * plaintext of some of the preceding blocks may already have been
+     * written to ostr: no strong guarantee w.r.t. ostr.
+     **/
+
+    void decrypt_pipelined(std::istream& istr,
+                           std::ostream& ostr,
+                           std::size_t depth = io_pipeline::DEPTH,
+                           std::size_t window = 16)
+    {
+        run_pipelined(istr, ostr, depth, window, false);
+    }
+
+    /**
+     * Random access: decrypt only block k (counting from 0) of a
+     * stream generated by encrypt(), and return its plaintext.
+     *
+     * The stream istr must be seekable: it is positioned at the start
+     * of the (MAC || ciphertext) chunk of block k, and at most MACSIZE
+     * + blocksize bytes are read. The nonce of block k is computed in
+     * constant time as the initial nonce + k.
+     *
+     * Only the MAC of block k is checked. In particular, a truncated
+     * stream whose last remaining block is k can't be detected here.
+     *
+     * Throw a std::runtime_error if block k doesn't exist, or if it
+     * can't be decrypted.
+     **/
+
+    BT decrypt_block(std::istream& istr, std::uint64_t k)
+    {
+        const std::size_t chunksize = MACSIZE + blocksize_;
+
+        istr.clear();
+        istr.seekg(static_cast<std::streamoff>(k * chunksize), std::ios::beg);
+        if (!istr)
+            throw std::runtime_error{ "sodium::streamcryptor_aead::decrypt_"
+                                      "block() can't seek to block" };
+
+        BT ciphertext(chunksize, '\0');
+        istr.read(reinterpret_cast<char*>(ciphertext.data()), chunksize);
+        ciphertext.resize(static_cast<std::size_t>(istr.gcount()));
+
+        return decrypt_block(ciphertext, k);
+    }
+
+    /**
+     * Random access: decrypt the (MAC || ciphertext) chunk of block k
+     * of a stream generated by encrypt(), e.g. after having fetched the
+     * bytes [k * (MACSIZE + blocksize), (k+1) * (MACSIZE + blocksize))
+     * of the stream by other means.
+     *
+     * Throw a std::runtime_error if ciphertext is shorter than MACSIZE,
+     * or if it can't be decrypted.
+     **/
+
+    BT decrypt_block(const BT& ciphertext, std::uint64_t k)
+    {
+        if (ciphertext.size() < MACSIZE)
+            throw std::runtime_error{ "sodium::streamcryptor_aead::decrypt_"
+                                      "block() no such block" };
+
+        return sc_aead_.decrypt(header_, ciphertext, nonce_ + k);
+    }
+
+    // the blocksize in use
+    std::size_t blocksize() const noexcept { return blocksize_; }
+
+    // the most plaintext bytes per frame decrypt_framed() accepts
+    std::size_t max_framesize() const noexcept { return max_framesize_; }
+
   private:
+    template<typename Reader, typename Writer>
+    void encrypt_from(Reader& in, Writer& out)
+    {
+        BT plaintext(blocksize_, '\0');
+        BT ciphertext(MACSIZE + blocksize_, '\0');
+        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+
+        span<const byte> block;
+        while (!(block = in.next_block(blocksize_, plaintext)).empty()) {
+            const bool full = block.size() == blocksize_;
+
+            sc_aead_.encrypt(span<byte>(ciphertext),
+                             span<const byte>(header_),
+                             block,
+                             running_nonce);
+            running_nonce.increment();
+
+            if (!out.write(
+                  span<const byte>(ciphertext).first(MACSIZE + block.size())))
+                throw std::runtime_error{
+                    full ? "sodium::streamcryptor_aead::encrypt() error "
+                           "writing full chunk to stream"
+                         : "sodium::streamcryptor_aead::encrypt() error "
+                           "writing final chunk to stream"
+                };
+            if (!full)
+                break;
+        }
+    }
+
+    template<typename Reader, typename Writer>
+    void decrypt_from(Reader& in, Writer& out)
+    {
+        BT ciphertext(MACSIZE + blocksize_, '\0');
+        BT plaintext(blocksize_, '\0');
+        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+
+        span<const byte> chunk;
+        while (!(chunk = in.next_block(MACSIZE + blocksize_, ciphertext))
+                  .empty()) {
+            const bool full = chunk.size() == MACSIZE + blocksize_;
+
+            if (chunk.size() < MACSIZE)
+                throw std::runtime_error{
+                    "sodium::streamcryptor_aead::decrypt() ciphertext length "
+                    "too small for a tag"
+                };
+            if (sc_aead_.decrypt(span<byte>(plaintext),
+                                 span<const byte>(header_),
+                                 chunk,
+                                 running_nonce) != 0)
+                throw std::runtime_error{
+                    "sodium::streamcryptor_aead::decrypt() can't decrypt or "
+                    "message/tag corrupt"
+                };
+            running_nonce.increment();
+
+            if (!out.write(
+                  span<const byte>(plaintext).first(chunk.size() - MACSIZE)))
+                throw std::runtime_error{
+                    full ? "sodium::streamcryptor_aead::decrypt() error "
+                           "writing full chunk to stream"
+                         : "sodium::streamcryptor_aead::decrypt() error "
+                           "writing final chunk to stream"
+                };
+            if (!full)
+                break;
+        }
+    }
+
+    void run_parallel(std::istream& istr,
+                      std::ostream& ostr,
+                      thread_pool& pool,
+                      std::size_t window,
+                      bool encrypting)
+    {
+        if (window == 0)
+            window = 4 * pool.size();
+
+        const std::size_t inblock =
+          encrypting ? blocksize_ : MACSIZE + blocksize_;
+        const std::size_t outblock =
+          encrypting ? MACSIZE + blocksize_ : blocksize_;
+        const char* what = encrypting ? "sodium::streamcryptor_aead::encrypt()"
+                                      : "sodium::streamcryptor_aead::decrypt()";
+
+        BT inbuf(window * inblock);
+        BT outbuf(window * outblock);
+        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+
+        for (;;) {
+            istr.read(reinterpret_cast<char*>(inbuf.data()), inbuf.size());
+            const std::size_t got = static_cast<std::size_t>(istr.gcount());
+            if (got == 0)
+                break;
+
+            // full blocks, and the size of a trailing partial block
+            const std::size_t nblocks = (got + inblock - 1) / inblock;
+            const std::size_t lastsize = got - (nblocks - 1) * inblock;
+            if (!encrypting && lastsize < MACSIZE)
+                throw std::runtime_error{
+                    std::string(what) + " final chunk too small for a tag"
+                };
+
+            // one contiguous range of blocks per worker
+            const std::size_t nranges = std::min(pool.size(), nblocks);
+            const std::size_t perrange = (nblocks + nranges - 1) / nranges;
+
+            // process blocks [first, last), return the first failed one
+            auto range = [&](std::size_t first,
+                             std::size_t last,
+                             typename aead<BT>::nonce_type n) {
+                for (std::size_t i = first; i != last; ++i) {
+                    const std::size_t insize =
+                      (i == nblocks - 1) ? lastsize : inblock;
+                    span<const byte> in(
+                      reinterpret_cast<const byte*>(inbuf.data()) +
+                        i * inblock,
+                      insize);
+                    span<byte> out(
+                      reinterpret_cast<byte*>(outbuf.data()) + i * outblock,
+                      outblock);
+                    const int rc =
+                      encrypting ? sc_aead_.encrypt(out, header_, in, n)
+                                 : sc_aead_.decrypt(out, header_, in, n);
+                    if (rc != 0)
+                        return i;
+                    n.increment();
+                }
+                return nblocks;
+            };
+
+            std::vector<std::future<std::size_t>> results;
+            results.reserve(nranges); // no future lost to a reallocation
+            std::size_t failed = nblocks;
+            try {
+                for (std::size_t first = 0; first < nblocks;
+                     first += perrange) {
+                    const std::size_t last =
+                      std::min(first + perrange, nblocks);
+                    results.push_back(
+                      pool.submit([&range, first, last, running_nonce] {
+                          return range(first, last, running_nonce);
+                      }));
+                    running_nonce += last - first;
+                }
+
+                // wait for all ranges, even if one of them failed
+                for (auto& result : results)
+                    failed = std::min(failed, pool.get(result));
+            } catch (...) {
+                // the pending ranges use the buffers and this: let them
+                // finish
+                for (auto& result : results)
+                    if (result.valid())
+                        pool.wait(result);
+                throw;
+            }
+
+            // write the blocks preceding the first failed block (if any)
+            std::size_t outsize = failed * outblock;
+            if (failed == nblocks) {
+                const std::size_t lastout =
+                  encrypting ? MACSIZE + lastsize : lastsize - MACSIZE;
+                outsize = (nblocks - 1) * outblock + lastout;
+            }
+            ostr.write(reinterpret_cast<char*>(outbuf.data()), outsize);
+            if (!ostr)
+                throw std::runtime_error{ std::string(what) +
+                                          " error writing chunk to stream" };
+
+            if (failed != nblocks)
+                throw std::runtime_error{
+                    std::string(what) + " can't decrypt or message/tag corrupt"
+                };
+
+            if (got != inbuf.size())
+                break; // that was the last window
+        }
+    }
+
+    void run_pipelined(std::istream& istr,
+                       std::ostream& ostr,
+                       std::size_t depth,
+                       std::size_t window,
+                       bool encrypting)
+    {
+        if (window == 0)
+            throw std::runtime_error{ "sodium::streamcryptor_aead::run_"
+                                      "pipelined() wrong window" };
+
+        const std::size_t inblock =
+          encrypting ? blocksize_ : MACSIZE + blocksize_;
+        const std::size_t outblock =
+          encrypting ? MACSIZE + blocksize_ : blocksize_;
+        const char* what = encrypting ? "sodium::streamcryptor_aead::encrypt_"
+                                        "pipelined()"
+                                      : "sodium::streamcryptor_aead::decrypt_"
+                                        "pipelined()";
+
+        io_pipeline pipeline(window * inblock, window * outblock, depth);
+        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+
+        pipeline.run(istr, ostr, [&](span<const byte> in, span<byte> out) {
+            std::size_t outsize = 0;
+            for (std::size_t offset = 0; offset < in.size();
+                 offset += inblock) {
+                const std::size_t insize =
+                  std::min(inblock, in.size() - offset);
+                if (!encrypting && insize < MACSIZE)
+                    throw std::runtime_error{
+                        std::string(what) + " final chunk too small for a tag"
+                    };
+                const std::size_t size =
+                  encrypting ? insize + MACSIZE : insize - MACSIZE;
+
+                const int rc =
+                  encrypting
+                    ? sc_aead_.encrypt(out.subspan(outsize, size),
+                                       header_,
+                                       in.subspan(offset, insize),
+                                       running_nonce)
+                    : sc_aead_.decrypt(out.subspan(outsize, size),
+                                       header_,
+                                       in.subspan(offset, insize),
+                                       running_nonce);
+                if (rc != 0)
+                    throw std::runtime_error{
+                        std::string(what) +
+                        " can't decrypt or message/tag corrupt"
+                    };
+                running_nonce.increment();
+                outsize += size;
+            }
+            return outsize;
+        });
+    }
+
+    BT framed_header(const std::size_t superblock) const
+    {
+        BT header(FRAMED_HEADERSIZE, '\0');
+        unsigned char* h = reinterpret_cast<unsigned char*>(header.data());
+        std::memcpy(h, streamcryptor_detail::FRAMED_MAGIC, 4);
+        h[4] = streamcryptor_detail::FRAMED_VERSION;
+        h[5] = aead_traits<algorithm_type>::id;
+        h[6] = static_cast<unsigned char>(aead<BT>::NONCESIZE);
+        h[7] = 0;
+        streamcryptor_detail::store_le32(
+          h + 8, static_cast<std::uint32_t>(blocksize_));
+        streamcryptor_detail::store_le32(
+          h + 12, static_cast<std::uint32_t>(superblock));
+        std::memcpy(h + 16, nonce_.data(), aead<BT>::NONCESIZE);
+        return header;
+    }
+
+    void decrypt_framed_after_magic(std::istream& istr, std::ostream& ostr)
+    {
+        constexpr const char* what =
+          "sodium::streamcryptor_aead::decrypt_framed()";
+
+        BT ad(FRAMED_HEADERSIZE + 1, '\0');
+        unsigned char* h = reinterpret_cast<unsigned char*>(ad.data());
+        std::memcpy(h, streamcryptor_detail::FRAMED_MAGIC, 4);
+        if (!istr.read(reinterpret_cast<char*>(h + 4), FRAMED_HEADERSIZE - 4))
+            throw std::runtime_error{ std::string(what) + " header too short" };
+        if (h[4] != streamcryptor_detail::FRAMED_VERSION)
+            throw std::runtime_error{ std::string(what) +
+                                      " unsupported version" };
+        if (h[5] != aead_traits<algorithm_type>::id ||
+            h[6] != aead<BT>::NONCESIZE)
+            throw std::runtime_error{ std::string(what) + " wrong algorithm" };
+
+        // not authenticated yet: bound it before sizing the buffers
+        const std::uint64_t framesize =
+          static_cast<std::uint64_t>(streamcryptor_detail::load_le32(h + 8)) *
+          streamcryptor_detail::load_le32(h + 12);
+        if (framesize == 0 || framesize > max_framesize_ ||
+            framesize > streamcryptor_detail::FRAMED_MAX_FRAMESIZE)
+            throw std::runtime_error{ std::string(what) +
+                                      " wrong blocksize or superblock" };
+        typename aead<BT>::nonce_type running_nonce{ h + 16 };
+
+        BT ciphertext(static_cast<std::size_t>(framesize) + MACSIZE, '\0');
+        BT plaintext(static_cast<std::size_t>(framesize), '\0');
+        bool last = false;
+        while (!last) {
+            istr.read(reinterpret_cast<char*>(ciphertext.data()),
+                      ciphertext.size());
+            const std::size_t s = static_cast<std::size_t>(istr.gcount());
+            last = s != ciphertext.size() ||
+                   istr.peek() == std::istream::traits_type::eof();
+            if (s < MACSIZE)
+                throw std::runtime_error{ std::string(what) +
+                                          " stream truncated" };
+
+            ad.back() = last ? 1 : 0;
+            if (sc_aead_.decrypt(span<byte>(plaintext),
+                                 span<const byte>(ad),
+                                 span<const byte>(ciphertext).first(s),
+                                 running_nonce) != 0)
+                throw std::runtime_error{
+                    std::string(what) +
+                    " can't decrypt or message/tag corrupt"
+                };
+            running_nonce.increment();
+
+            ostr.write(reinterpret_cast<const char*>(plaintext.data()),
+                       s - MACSIZE);
+            if (!ostr)
+                throw std::runtime_error{ std::string(what) +
+                                          " error writing frame to stream" };
+        }
+    }
+
     aead<BT> sc_aead_;
     typename aead<BT>::nonce_type nonce_;
     BT header_;
     std::size_t blocksize_;
+    std::size_t max_framesize_; // of decrypt_framed()
 };
 
 } // namespace sodium
@@ -0,0 +1,360 @@
+// streamcryptor_secretstream.h -- Stream/file encryption with secretstream
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h"
+#include "secretstream.h"
+#include "secretstream_xchacha20_poly1305.h"
+#include "span.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * The streamcryptor_secretstream format
+ * -------------------------------------
+ *
+ * All integers are little-endian:
+ *
+ *   header  = "SWSS" || version (1) || 0 (3) || LE32(chunksize)
+ *             || secretstream header (HEADERSIZE)
+ *
+ *   chunk_i = secretstream push(plaintext[i * chunksize,
+ *                                         (i+1) * chunksize), tag_i)
+ *
+ * The first 12 bytes of the header are the additional data of chunk 0.
+ * Every chunk holds chunksize bytes of plaintext and MACSIZE bytes of
+ * (encrypted tag and) MAC, except for the last one, which holds the
+ * remaining 0..chunksize bytes. The empty message is a single empty
+ * chunk. The tags are:
+ *   - TAG_FINAL on the last chunk, and only there: a stream that ends
+ *     without it, or goes on after it, has been truncated or extended;
+ *   - TAG_REKEY on every rekey_interval-th chunk: both sides rekey()
+ *     after it, for forward secrecy within long streams;
+ *   - TAG_PUSH on the last chunk of every read buffer, a boundary
+ *     where a reader may flush;
+ *   - TAG_MESSAGE on all others.
+ **/
+
+template<typename BT = bytes>
+class streamcryptor_secretstream
+{
+    /**
+     * A streamcryptor_secretstream encrypts or decrypts a
+     * (potentially unlimited) std::istream into a std::ostream with
+     * sodium::secretstream (XChaCha20-Poly1305), e.g. files.
+     *
+     * It reads chunks_per_read chunks of chunksize bytes at a time,
+     * in one istream::read() call, into a buffer allocated once per
+     * encrypt() / decrypt(), and encrypts them in place in another
+     * one: there is no allocation per chunk, and each buffer is
+     * written with one ostream::write() call.
+     *
+     * Unlike streamcryptor_aead, the stream is self-describing (a
+     * fresh random secretstream header per encrypt(), the chunksize)
+     * and its end is authenticated: decrypt() only needs the key.
+     *
+     * A streamcryptor_secretstream keeps no state between calls to
+     * encrypt() / decrypt(); it is not thread-safe nevertheless.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = secretstream<BT>::KEYSIZE;
+    static constexpr std::size_t MACSIZE = secretstream<BT>::MACSIZE;
+    static constexpr std::size_t HEADERSIZE = 12 + secretstream<BT>::HEADERSIZE;
+
+    static constexpr std::size_t CHUNKSIZE = 64 * 1024;
+    static constexpr std::size_t CHUNKS_PER_READ = 16;
+    static constexpr std::size_t REKEY_INTERVAL = 1024; // chunks
+
+    // the largest chunksize of all
+    static constexpr std::size_t CHUNKSIZE_MAX = 1 << 30;
+
+    // the largest chunksize decrypt() accepts by default
+    static constexpr std::size_t DECRYPT_CHUNKSIZE_MAX = 16 * 1024 * 1024;
+
+    using key_type = typename secretstream<BT>::key_type;
+    using shared_key_type = typename secretstream<BT>::shared_key_type;
+    using tag_type = typename secretstream<BT>::tag_type;
+
+    /**
+     * A streamcryptor_secretstream with a copy of key, encrypting
+     * chunks of chunksize bytes, chunks_per_read at a time, with a
+     * TAG_REKEY every rekey_interval chunks (0: never).
+     *
+     * decrypt() reads the chunksize from the stream, before anything
+     * of it has been authenticated, and refuses chunksizes above the
+     * larger of chunksize and max_chunksize: a forged header can't
+     * make it allocate more than that. It reads as many chunks at a
+     * time as fit into chunks_per_read * chunksize bytes (at least
+     * one).
+     *
+     * Throw a std::runtime_error if chunksize, chunks_per_read or
+     * max_chunksize are 0, or if chunksize or max_chunksize are larger
+     * than CHUNKSIZE_MAX.
+     **/
+
+    streamcryptor_secretstream(const key_type& key,
+                               const std::size_t chunksize = CHUNKSIZE,
+                               const std::size_t chunks_per_read =
+                                 CHUNKS_PER_READ,
+                               const std::size_t rekey_interval =
+                                 REKEY_INTERVAL,
+                               const std::size_t max_chunksize =
+                                 DECRYPT_CHUNKSIZE_MAX)
+      : streamcryptor_secretstream(make_shared_key(key),
+                                   chunksize,
+                                   chunks_per_read,
+                                   rekey_interval,
+                                   max_chunksize)
+    {}
+
+    // Same, sharing an immutable key instead of copying it
+    streamcryptor_secretstream(shared_key_type key,
+                               const std::size_t chunksize = CHUNKSIZE,
+                               const std::size_t chunks_per_read =
+                                 CHUNKS_PER_READ,
+                               const std::size_t rekey_interval =
+                                 REKEY_INTERVAL,
+                               const std::size_t max_chunksize =
+                                 DECRYPT_CHUNKSIZE_MAX)
+      : key_{ std::move(key) }
+      , chunksize_{ chunksize }
+      , chunks_per_read_{ chunks_per_read }
+      , rekey_interval_{ rekey_interval }
+      , max_chunksize_{ std::max(chunksize, max_chunksize) }
+    {
+        if (!key_)
+            throw std::runtime_error{ "sodium::streamcryptor_secretstream::"
+                                      "streamcryptor_secretstream() empty "
+                                      "key" };
+        if (chunksize < 1 || chunksize > CHUNKSIZE_MAX || chunks_per_read < 1)
+            throw std::runtime_error{ "sodium::streamcryptor_secretstream::"
+                                      "streamcryptor_secretstream() wrong "
+                                      "chunksize or chunks_per_read" };
+        if (max_chunksize < 1 || max_chunksize > CHUNKSIZE_MAX)
+            throw std::runtime_error{ "sodium::streamcryptor_secretstream::"
+                                      "streamcryptor_secretstream() wrong "
+                                      "max_chunksize" };
+    }
+
+    // the largest chunksize decrypt() accepts
+    std::size_t max_chunksize() const noexcept { return max_chunksize_; }
+
+    // the shared key, e.g. for a secretstream<BT> on the same key
+    const shared_key_type& key_handle() const noexcept { return key_; }
+
+    /**
+     * Encrypt everything that can be read from istr, writing the
+     * header and the chunks to ostr. Throw a std::runtime_error if
+     * writing to ostr fails.
+     **/
+
+    void encrypt(std::istream& istr, std::ostream& ostr) const
+    {
+        constexpr const char* what =
+          "sodium::streamcryptor_secretstream::encrypt()";
+
+        secretstream<BT> stream{ key_ };
+        BT header(HEADERSIZE, '\0');
+        unsigned char* h = reinterpret_cast<unsigned char*>(header.data());
+        std::memcpy(h, MAGIC, 4);
+        h[4] = VERSION;
+        store_le32(h + 8, static_cast<std::uint32_t>(chunksize_));
+        const BT ss_header = stream.init_push();
+        std::memcpy(h + 12, ss_header.data(), ss_header.size());
+        write(ostr, header.data(), header.size(), what);
+
+        const std::size_t readsize = chunks_per_read_ * chunksize_;
+        BT in(readsize, '\0');
+        BT out(chunks_per_read_ * (chunksize_ + MACSIZE), '\0');
+        span<const byte> added_data(h, 12); // for chunk 0 only
+        std::uint64_t index = 0;
+
+        bool last = false;
+        while (!last) {
+            istr.read(reinterpret_cast<char*>(in.data()), readsize);
+            const std::size_t n = static_cast<std::size_t>(istr.gcount());
+            last = n != readsize ||
+                   istr.peek() == std::istream::traits_type::eof();
+
+            std::size_t outsize = 0;
+            std::size_t offset = 0;
+            do {
+                const std::size_t s = std::min(chunksize_, n - offset);
+                const bool last_chunk = offset + s == n;
+                tag_type tag = tag_type::TAG_MESSAGE;
+                if (last_chunk && last)
+                    tag = tag_type::TAG_FINAL;
+                else if (rekey_interval_ != 0 &&
+                         index % rekey_interval_ == rekey_interval_ - 1)
+                    tag = tag_type::TAG_REKEY;
+                else if (last_chunk)
+                    tag = tag_type::TAG_PUSH;
+
+                stream.push(span<byte>(out).subspan(outsize, s + MACSIZE),
+                            span<const byte>(in).subspan(offset, s),
+                            added_data,
+                            tag);
+                added_data = span<const byte>();
+                ++index;
+                offset += s;
+                outsize += s + MACSIZE;
+            } while (offset != n);
+
+            write(ostr, out.data(), outsize, what);
+        }
+    }
+
+    /**
+     * Decrypt a stream written by encrypt() with the same key, from
+     * istr to ostr.
+     *
+     * Throw a std::runtime_error if the header is wrong (including a
+     * chunksize above max_chunksize()), if a chunk
+     * doesn't verify (wrong key, corrupted or reordered chunks), if
+     * the stream has been truncated (no TAG_FINAL chunk at its end)
+     * or extended (data after the TAG_FINAL chunk), or if writing to
+     * ostr fails. No strong guarantee w.r.t. ostr: the read buffers
+     * before the failing one have been written.
+     **/
+
+    void decrypt(std::istream& istr, std::ostream& ostr) const
+    {
+        constexpr const char* what =
+          "sodium::streamcryptor_secretstream::decrypt()";
+
+        BT header(HEADERSIZE, '\0');
+        unsigned char* h = reinterpret_cast<unsigned char*>(header.data());
+        if (!istr.read(reinterpret_cast<char*>(h), HEADERSIZE) ||
+            std::memcmp(h, MAGIC, 4) != 0)
+            throw std::runtime_error{ std::string(what) +
+                                      " not a secretstream stream" };
+        if (h[4] != VERSION)
+            throw std::runtime_error{ std::string(what) +
+                                      " unsupported version" };
+        // not authenticated yet: bound it before sizing the buffers
+        const std::size_t chunksize = load_le32(h + 8);
+        if (chunksize < 1 || chunksize > max_chunksize_)
+            throw std::runtime_error{ std::string(what) + " wrong chunksize" };
+
+        secretstream<BT> stream{ key_ };
+        stream.init_pull(BT(header.begin() + 12, header.end()));
+
+        const std::size_t nchunks =
+          std::max<std::size_t>(1, chunks_per_read_ * chunksize_ / chunksize);
+        const std::size_t framesize = chunksize + MACSIZE;
+        const std::size_t readsize = nchunks * framesize;
+        BT in(readsize, '\0');
+        BT out(nchunks * chunksize, '\0');
+        span<const byte> added_data(h, 12); // for chunk 0 only
+
+        bool final_seen = false;
+        while (!final_seen) {
+            istr.read(reinterpret_cast<char*>(in.data()), readsize);
+            const std::size_t n = static_cast<std::size_t>(istr.gcount());
+            if (n == 0)
+                throw std::runtime_error{ std::string(what) +
+                                          " stream truncated" };
+
+            std::size_t outsize = 0;
+            std::size_t offset = 0;
+            while (offset != n) {
+                if (final_seen)
+                    throw std::runtime_error{ std::string(what) +
+                                              " data after the final chunk" };
+
+                const std::size_t s = std::min(framesize, n - offset);
+                tag_type tag;
+                if (s < MACSIZE ||
+                    stream.pull(span<byte>(out).subspan(outsize, s - MACSIZE),
+                                tag,
+                                span<const byte>(in).subspan(offset, s),
+                                added_data) != 0)
+                    throw std::runtime_error{
+                        std::string(what) +
+                        " can't decrypt or message/tag corrupt"
+                    };
+                added_data = span<const byte>();
+
+                final_seen = tag == tag_type::TAG_FINAL;
+                if (s != framesize && !final_seen)
+                    throw std::runtime_error{ std::string(what) +
+                                              " stream truncated" };
+                offset += s;
+                outsize += s - MACSIZE;
+            }
+
+            if (final_seen &&
+                istr.peek() != std::istream::traits_type::eof())
+                throw std::runtime_error{ std::string(what) +
+                                          " data after the final chunk" };
+            write(ostr, out.data(), outsize, what);
+        }
+    }
+
+  private:
+    static constexpr char MAGIC[4] = { 'S', 'W', 'S', 'S' };
+    static constexpr unsigned char VERSION = 1;
+
+    static void store_le32(unsigned char* out, std::uint32_t value) noexcept
+    {
+        for (std::size_t i = 0; i != 4; ++i)
+            out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+
+    static std::uint32_t load_le32(const unsigned char* in) noexcept
+    {
+        std::uint32_t value = 0;
+        for (std::size_t i = 0; i != 4; ++i)
+            value |= static_cast<std::uint32_t>(in[i]) << (8 * i);
+        return value;
+    }
+
+    template<typename T>
+    static void write(std::ostream& ostr,
+                      const T* data,
+                      std::size_t size,
+                      const char* what)
+    {
+        ostr.write(reinterpret_cast<const char*>(data), size);
+        if (!ostr)
+            throw std::runtime_error{ std::string(what) +
+                                      " error writing to stream" };
+    }
+
+    shared_key_type key_;
+    std::size_t chunksize_;
+    std::size_t chunks_per_read_;
+    std::size_t rekey_interval_;
+    std::size_t max_chunksize_; // of decrypt()
+};
+
+} // namespace sodium
@@ -18,9 +18,13 @@
 
 #pragma once
 
+#include "blocksize.h"
 #include "common.h"
 #include "key.h" // key sizes
 #include "keyvar.h"
+#include "streambuf_io.h"
+#include "thread_pool.h"
+#include "tree_hash.h"
 
 #include <istream>
 #include <ostream>
@@ -70,7 +74,7 @@ class StreamHash
                const std::size_t blocksize)
       : key_{ key }
       , hashsize_{ hashsize }
-      , blocksize_{ blocksize }
+      , blocksize_{ sodium::blocksize::resolve(blocksize) }
     {
 
         if (key.size() < KEYSIZE_MIN)
@@ -107,7 +111,7 @@ class StreamHash
     StreamHash(const std::size_t hashsize, const std::size_t blocksize)
       : key_{ 0, false }
       , hashsize_{ hashsize }
-      , blocksize_{ blocksize }
+      , blocksize_{ sodium::blocksize::resolve(blocksize) }
     {
         if (hashsize < HASHSIZE_MIN)
             throw std::runtime_error{
@@ -241,7 +245,98 @@ class StreamHash
         // returning outHash implicitely by reference.
     }
 
+    /**
+     * Parallel version of hash(): compute the sodium::tree_hash of the
+     * data provided by istr, with leaves of leafsize bytes hashed
+     * concurrently on the threads of pool. The key and hash size are
+     * the same as for hash().
+     *
+     * The result is NOT the same as that of hash(), and depends on
+     * leafsize; see tree_hash.h for the exact construction.
+     *
+     * hash() will throw a std::runtime_error if leafsize is 0.
+     **/
+
+    bytes hash(std::istream& istr,
+               thread_pool& pool,
+               const std::size_t leafsize = tree_hash::LEAFSIZE)
+    {
+        tree_hash tree(key_, hashsize_, leafsize, pool);
+        bytes plaintext(blocksize_, '\0');
+
+        while (
+          istr.read(reinterpret_cast<char*>(plaintext.data()), blocksize_)) {
+            // read a whole block of size blocksize_
+            tree.update(plaintext.data(), plaintext.size());
+        }
+
+        // a final partial chunk, if any
+        std::size_t s = static_cast<std::size_t>(istr.gcount());
+        if (s != 0)
+            tree.update(plaintext.data(), s);
+
+        bytes outHash(hashsize_);
+        tree.final(outHash.data());
+
+        return outHash; // with move semantics
+    }
+
+    /**
+     * Fast-path versions of hash(istr): read the data straight from the
+     * std::streambuf sb (e.g. istr.rdbuf()), or from the file
+     * descriptor fd, without the std::istream layer. Blocks that are
+     * wholly in the get area of sb are hashed in place; see
+     * streambuf_io.h.
+     *
+     * The hash is the same as that of hash(istr).
+     **/
+
+    bytes hash(std::streambuf* sb)
+    {
+        streambuf_reader in{ sb };
+        return hash_from(in);
+    }
+
+    bytes hash(raw_fd fd)
+    {
+        fd_reader in{ fd };
+        return hash_from(in);
+    }
+
+    // the blocksize in use (e.g. chosen by blocksize::auto_tune)
+    std::size_t blocksize() const noexcept { return blocksize_; }
+
   private:
+    template<typename Reader>
+    bytes hash_from(Reader& in)
+    {
+        bytes plaintext(blocksize_, '\0');
+        bytes outHash(hashsize_);
+
+        if (key_.size() != 0)
+            crypto_generichash_init(
+              &state_, key_.data(), key_.size(), hashsize_);
+        else
+            crypto_generichash_init(&state_, NULL, 0, hashsize_); // keyless
+
+        span<const byte> block;
+        do {
+            block = in.next_block(blocksize_, plaintext);
+            crypto_generichash_update(&state_, block.data(), block.size());
+        } while (block.size() == blocksize_);
+
+        crypto_generichash_final(&state_, outHash.data(), outHash.size());
+
+        // reset state_, so can call hash() again
+        if (key_.size() != 0)
+            crypto_generichash_init(
+              &state_, key_.data(), key_.size(), hashsize_);
+        else
+            crypto_generichash_init(&state_, NULL, 0, hashsize_); // keyless
+
+        return outHash;
+    }
+
     key_type key_;
     std::size_t hashsize_;
     std::size_t blocksize_;
@@ -18,13 +18,22 @@
 
 #pragma once
 
+#include "blocksize.h"
 #include "common.h"
+#include "io_pipeline.h"
 #include "key.h"
 #include "keypairsign.h"
+#include "span.h"
+#include "streambuf_io.h"
 
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <filesystem>
 #include <istream>
 #include <ostream>
 #include <stdexcept>
+#include <string>
+#include <system_error>
 
 #include <sodium.h>
 
@@ -52,7 +61,7 @@ class StreamSignorPK
 
     StreamSignorPK(const privkey_type& privkey, const std::size_t blocksize)
       : privkey_{ privkey }
-      , blocksize_{ blocksize }
+      , blocksize_{ sodium::blocksize::resolve(blocksize) }
     {
         if (blocksize < 1)
             throw std::runtime_error{
@@ -74,7 +83,7 @@ class StreamSignorPK
      **/
     StreamSignorPK(const keypairsign<>& keypair, const std::size_t blocksize)
       : privkey_{ keypair.private_key() }
-      , blocksize_{ blocksize }
+      , blocksize_{ sodium::blocksize::resolve(blocksize) }
     {
         if (blocksize < 1)
             throw std::runtime_error{
@@ -116,18 +125,129 @@ class StreamSignorPK
             crypto_sign_update(&state_, plaintext.data(), plaintext.size());
         }
 
-        // finalize the signature
+        return finish();
+    }
+
+    /**
+     * Pipelined version of sign(istr), with the same signature.
+     *
+     * The next chunks of istr are read on a background thread while
+     * the current one is being hashed, through a sodium::io_pipeline
+     * of depth reused buffers of window * blocksize_ bytes each.
+     *
+     * Throw a std::runtime_error if window is 0, or if reading istr
+     * fails. The state is reset in any case.
+     **/
+
+    bytes sign_pipelined(std::istream& istr,
+                         std::size_t depth = io_pipeline::DEPTH,
+                         std::size_t window = 16)
+    {
+        if (window == 0)
+            throw std::runtime_error{
+                "sodium::StreamSignorPK::sign_pipelined() wrong window"
+            };
+
+        io_pipeline pipeline(window * blocksize_, 0, depth);
+        try {
+            pipeline.run(istr, [this](span<const byte> in) {
+                crypto_sign_update(&state_, in.data(), in.size());
+            });
+        } catch (...) {
+            crypto_sign_init(&state_);
+            throw;
+        }
+
+        return finish();
+    }
+
+    /**
+     * Sign the whole file at path, which is memory-mapped and hashed
+     * in place, without any copy into intermediate buffers. The
+     * signature is the same as the one of sign() on the file's
+     * contents.
+     *
+     * Throw a std::runtime_error if the file can't be mapped.
+     **/
+
+    bytes sign(const std::string& path)
+    {
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(path, ec);
+        if (ec)
+            throw std::runtime_error{ "sodium::StreamSignorPK::sign() "
+                                      "can't stat " +
+                                      path + ": " + ec.message() };
+
+        // an empty file can't be mapped, and has nothing to hash
+        if (size != 0) {
+            boost::iostreams::mapped_file_source file(
+              path, static_cast<std::size_t>(size));
+            if (!file.is_open())
+                throw std::runtime_error{
+                    "sodium::StreamSignorPK::sign() can't map " + path
+                };
+
+            crypto_sign_update(&state_,
+                               reinterpret_cast<const byte*>(file.data()),
+                               file.size());
+        }
+
+        return finish();
+    }
+
+    /**
+     * Fast-path versions of sign(istr): read the data straight from the
+     * std::streambuf sb (e.g. istr.rdbuf()), or from the file
+     * descriptor fd, without the std::istream layer. Blocks that are
+     * wholly in the get area of sb are signed in place; see
+     * streambuf_io.h.
+     *
+     * The signature is the same as that of sign(istr).
+     **/
+
+    bytes sign(std::streambuf* sb)
+    {
+        streambuf_reader in{ sb };
+        return sign_from(in);
+    }
+
+    bytes sign(raw_fd fd)
+    {
+        fd_reader in{ fd };
+        return sign_from(in);
+    }
+
+    // the blocksize in use (e.g. chosen by blocksize::auto_tune)
+    std::size_t blocksize() const noexcept { return blocksize_; }
+
+  private:
+    template<typename Reader>
+    bytes sign_from(Reader& in)
+    {
+        bytes plaintext(blocksize_, '\0');
+
+        span<const byte> block;
+        do {
+            block = in.next_block(blocksize_, plaintext);
+            crypto_sign_update(&state_, block.data(), block.size());
+        } while (block.size() == blocksize_);
+
+        return finish();
+    }
+
+    // finalize the signature, and reset the state for the next sign()
+    bytes finish()
+    {
         bytes signature(SIGNATURE_SIZE);
         crypto_sign_final_create(
           &state_, signature.data(), NULL, privkey_.data());
 
-        // reset the state for next invocation of sign()
         crypto_sign_init(&state_);
 
         return signature; // using move semantics
     }
 
-  private:
     privkey_type privkey_;
     crypto_sign_state state_;
     std::size_t blocksize_;
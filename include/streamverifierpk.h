@@ -18,13 +18,21 @@
 
 #pragma once
 
+#include "blocksize.h"
 #include "common.h"
+#include "io_pipeline.h"
 #include "key.h"
 #include "keypairsign.h"
+#include "span.h"
 
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <filesystem>
 #include <istream>
 #include <ostream>
 #include <stdexcept>
+#include <string>
+#include <system_error>
 
 #include <sodium.h>
 
@@ -52,7 +60,7 @@ class StreamVerifierPK
 
     StreamVerifierPK(const bytes& pubkey, const std::size_t blocksize)
       : pubkey_{ pubkey }
-      , blocksize_{ blocksize }
+      , blocksize_{ sodium::blocksize::resolve(blocksize) }
     {
         if (pubkey.size() != KEYSIZE_PUBKEY)
             throw std::runtime_error{
@@ -79,7 +87,7 @@ class StreamVerifierPK
      **/
     StreamVerifierPK(const keypairsign<>& keypair, const std::size_t blocksize)
       : pubkey_{ keypair.public_key() }
-      , blocksize_{ blocksize }
+      , blocksize_{ sodium::blocksize::resolve(blocksize) }
     {
         if (blocksize < 1)
             throw std::runtime_error{
@@ -124,25 +132,99 @@ class StreamVerifierPK
             crypto_sign_update(&state_, plaintext.data(), plaintext.size());
         }
 
+        return finish(signature);
+    }
+
+    /**
+     * Pipelined version of verify(istr, signature), with the same
+     * result. See StreamSignorPK::sign_pipelined().
+     *
+     * Throw a std::runtime_error if window is 0, or if reading istr
+     * fails. The state is reset in any case.
+     **/
+
+    bool verify_pipelined(std::istream& istr,
+                          const bytes& signature,
+                          std::size_t depth = io_pipeline::DEPTH,
+                          std::size_t window = 16)
+    {
+        if (window == 0)
+            throw std::runtime_error{
+                "sodium::StreamVerifierPK::verify_pipelined() wrong window"
+            };
+
+        io_pipeline pipeline(window * blocksize_, 0, depth);
+        try {
+            pipeline.run(istr, [this](span<const byte> in) {
+                crypto_sign_update(&state_, in.data(), in.size());
+            });
+        } catch (...) {
+            crypto_sign_init(&state_);
+            throw;
+        }
+
+        return finish(signature);
+    }
+
+    /**
+     * Verify the signature of the whole file at path, which is
+     * memory-mapped and hashed in place. See StreamSignorPK::sign(path).
+     *
+     * Throw a std::runtime_error if the file can't be mapped.
+     **/
+
+    bool verify(const std::string& path, const bytes& signature)
+    {
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(path, ec);
+        if (ec)
+            throw std::runtime_error{ "sodium::StreamVerifierPK::verify() "
+                                      "can't stat " +
+                                      path + ": " + ec.message() };
+
+        // an empty file can't be mapped, and has nothing to hash
+        if (size != 0) {
+            boost::iostreams::mapped_file_source file(
+              path, static_cast<std::size_t>(size));
+            if (!file.is_open())
+                throw std::runtime_error{
+                    "sodium::StreamVerifierPK::verify() can't map " + path
+                };
+
+            crypto_sign_update(&state_,
+                               reinterpret_cast<const byte*>(file.data()),
+                               file.size());
+        }
+
+        return finish(signature);
+    }
+
+    // the blocksize in use (e.g. chosen by blocksize::auto_tune)
+    std::size_t blocksize() const noexcept { return blocksize_; }
+
+  private:
+    // compare signatures, and reset the state for the next verify()
+    bool finish(const bytes& signature)
+    {
+        if (signature.size() != SIGNATURE_SIZE) {
+            crypto_sign_init(&state_);
+            return false;
+        }
+
         // XXX: since crypto_sign_final_verify() doesn't accept a const
         // signature, we need to copy signature beforehand
         bytes signature_copy{ signature };
 
         // finalize and compare signatures
-        if (crypto_sign_final_verify(
-              &state_, signature_copy.data(), pubkey_.data()) != 0) {
-            // message forged
-            crypto_sign_init(&state_);
-            return false;
-        }
+        const bool ok = crypto_sign_final_verify(&state_,
+                                                 signature_copy.data(),
+                                                 pubkey_.data()) == 0;
 
-        // reset the state for next invocation of sign()
         crypto_sign_init(&state_);
 
-        return true;
+        return ok;
     }
 
-  private:
     bytes pubkey_;
     crypto_sign_state state_;
     std::size_t blocksize_;
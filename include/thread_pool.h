@@ -0,0 +1,450 @@
+// thread_pool.h -- A fixed-size pool of worker threads
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace sodium {
+
+/**
+ * The number of CPUs this process may run on: the CPUs of its
+ * affinity mask (e.g. restricted by taskset, cpusets or a container)
+ * where the platform can tell, std::thread::hardware_concurrency()
+ * otherwise. At least 1.
+ **/
+
+inline std::size_t
+default_concurrency()
+{
+#if defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (sched_getaffinity(0, sizeof cpus, &cpus) == 0 && CPU_COUNT(&cpus) > 0)
+        return static_cast<std::size_t>(CPU_COUNT(&cpus));
+#endif
+    const std::size_t n = std::thread::hardware_concurrency();
+    return n != 0 ? n : 1;
+}
+
+/**
+ * How a thread_pool creates its worker threads.
+ *
+ *   threads : the number of worker threads, 0 = default_concurrency().
+ *   pin     : pin worker i to CPU cpus[i % cpus.size()], or to the
+ *             i-th CPU of the affinity mask if cpus is empty. This is
+ *             a hint: it is ignored where the platform doesn't
+ *             support it, and if pinning fails.
+ *   cpus    : the CPUs to pin the workers to (e.g. those of one NUMA
+ *             node), see pin.
+ **/
+
+struct thread_pool_options
+{
+    std::size_t threads = 0;
+    bool pin = false;
+    std::vector<unsigned> cpus;
+};
+
+class thread_pool
+{
+    /**
+     * A sodium::thread_pool runs submit()ted tasks on a fixed number of
+     * worker threads, and hands their results (or exceptions) back
+     * through std::future<>s.
+     *
+     * It is used by all parallel modes of the library (the stream
+     * cryptors, filecryptor_aead, tree hashing, batch signing and
+     * verification, box_seal, parallel_stream_xor_backend), which
+     * split their input in independent blocks. Share one pool between
+     * them, e.g. default_thread_pool(), instead of creating one per
+     * feature: that avoids oversubscribing the CPUs.
+     *
+     * Every worker has its own task deque. Tasks submitted from a
+     * worker go to the back of its own deque, where it takes them
+     * first (LIFO, cache-warm); tasks submitted from other threads
+     * are spread round-robin. An idle worker steals from the front of
+     * the other workers' deques (FIFO, oldest first).
+     *
+     * Alternatively, a thread_pool can forward its tasks to an
+     * executor of the application (see the executor_type constructor),
+     * so that the library's parallel modes run on the application's
+     * threads instead of on threads of their own.
+     *
+     * A task may submit() more tasks and wait for them, but only with
+     * wait() or get() of this pool, never with the future's own wait()
+     * or get(): a worker waiting that way blocks, and once all workers
+     * do, the tasks they wait for never run. wait() and get() run
+     * other pending tasks of the pool instead, until the result is
+     * ready.
+     *
+     * The destructor finishes all pending tasks before joining the
+     * worker threads.
+     **/
+
+  public:
+    // an executor of the application: runs the task, now or later
+    using executor_type = std::function<void(std::function<void()>)>;
+
+    /**
+     * Create a pool with nthreads worker threads. If nthreads is 0,
+     * use default_concurrency() threads.
+     **/
+
+    explicit thread_pool(std::size_t nthreads = 0)
+      : thread_pool(thread_pool_options{ nthreads, false, {} })
+    {}
+
+    // Create a pool of worker threads as described by options
+    explicit thread_pool(const thread_pool_options& options)
+      : done_{ false }
+      , pending_{ 0 }
+      , next_{ 0 }
+    {
+        std::size_t nthreads = options.threads;
+        if (nthreads == 0)
+            nthreads = default_concurrency();
+
+        queues_.reserve(nthreads);
+        for (std::size_t i = 0; i != nthreads; ++i)
+            queues_.push_back(std::make_unique<task_queue>());
+
+        workers_.reserve(nthreads);
+        for (std::size_t i = 0; i != nthreads; ++i) {
+            workers_.emplace_back([this, i] { work(i); });
+            if (options.pin)
+                pin(workers_.back(), i, options.cpus);
+        }
+    }
+
+    /**
+     * Create a pool without threads of its own, that hands every task
+     * to executor, e.g. a post() to the application's Asio thread
+     * pool. concurrency is the number of threads behind executor, as
+     * reported by size(); the parallel modes use it to decide how
+     * many tasks to split their work in. If concurrency is 0, use
+     * default_concurrency().
+     *
+     * The executor must run every task eventually, and tasks may run
+     * after the thread_pool has been destroyed.
+     *
+     * Throw a std::runtime_error if executor is empty.
+     **/
+
+    thread_pool(executor_type executor, std::size_t concurrency)
+      : done_{ false }
+      , pending_{ 0 }
+      , next_{ 0 }
+      , executor_{ std::move(executor) }
+      , concurrency_{ concurrency != 0 ? concurrency : default_concurrency() }
+    {
+        if (!executor_)
+            throw std::runtime_error{
+                "sodium::thread_pool::thread_pool() empty executor"
+            };
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cv_.notify_all();
+        for (auto& worker : workers_)
+            worker.join();
+    }
+
+    // the number of worker threads (or the concurrency of the executor)
+    std::size_t size() const
+    {
+        return executor_ ? concurrency_ : workers_.size();
+    }
+
+    /**
+     * Schedule f() for execution on one of the worker threads, and
+     * return a std::future of its result. If f() throws, the exception
+     * is rethrown by the future's get().
+     *
+     * Throw a std::runtime_error if the pool is shutting down.
+     **/
+
+    template<typename Func>
+    std::future<std::invoke_result_t<Func>> submit(Func f)
+    {
+        using result_type = std::invoke_result_t<Func>;
+
+        auto task =
+          std::make_shared<std::packaged_task<result_type()>>(std::move(f));
+        std::future<result_type> result = task->get_future();
+
+        if (executor_) {
+            executor_([task] { (*task)(); });
+            return result;
+        }
+
+        // our own worker: its own deque, someone else: round-robin
+        const worker_id& self = current_worker();
+        const std::size_t index = self.pool == this
+                                    ? self.index
+                                    : next_.fetch_add(1) % queues_.size();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (done_)
+                throw std::runtime_error{
+                    "sodium::thread_pool::submit() pool is shutting down"
+                };
+            // count first: pending_ is never less than the queued tasks
+            ++pending_;
+            try {
+                std::lock_guard<std::mutex> qlock(queues_[index]->mutex);
+                queues_[index]->tasks.emplace_back([task] { (*task)(); });
+            } catch (...) {
+                --pending_;
+                throw;
+            }
+        }
+        cv_.notify_one();
+
+        return result;
+    }
+
+    /**
+     * Wait until result, a future of a task of this pool, is ready.
+     *
+     * Called from a worker of this pool (i.e. from a task), run the
+     * pending tasks of the pool meanwhile, its own first, so that
+     * tasks waiting for tasks can't deadlock the pool. Called from
+     * any other thread, just wait. With an executor, the executor
+     * decides: it needs enough threads for tasks that wait.
+     **/
+
+    template<typename T>
+    void wait(const std::future<T>& result)
+    {
+        const worker_id& self = current_worker();
+        if (executor_ || self.pool != this) {
+            result.wait();
+            return;
+        }
+
+        while (result.wait_for(std::chrono::seconds::zero()) !=
+               std::future_status::ready) {
+            std::function<void()> task;
+            if (take(self.index, task))
+                task(); // a packaged_task: doesn't throw
+            else
+                result.wait_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // wait(result), then return its result.get()
+    template<typename T>
+    T get(std::future<T>& result)
+    {
+        wait(result);
+        return result.get();
+    }
+
+  private:
+    struct task_queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // the pool and index of the calling thread, if it is a worker
+    struct worker_id
+    {
+        const thread_pool* pool = nullptr;
+        std::size_t index = 0;
+    };
+
+    static worker_id& current_worker()
+    {
+        static thread_local worker_id id;
+        return id;
+    }
+
+    // take a task from the back of queue index, or steal one from the
+    // front of another queue
+    bool take(std::size_t index, std::function<void()>& task)
+    {
+        for (std::size_t i = 0; i != queues_.size(); ++i) {
+            task_queue& q = *queues_[(index + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty())
+                continue;
+            if (i == 0) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            } else {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            --pending_;
+            return true;
+        }
+        return false;
+    }
+
+    void work(std::size_t index)
+    {
+        current_worker() = worker_id{ this, index };
+
+        for (;;) {
+            std::function<void()> task;
+            if (take(index, task)) {
+                task();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return done_ || pending_ != 0; });
+            if (done_ && pending_ == 0)
+                return; // done_ and nothing left to do
+        }
+    }
+
+    static void pin(std::thread& worker,
+                    std::size_t index,
+                    const std::vector<unsigned>& cpus)
+    {
+#if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (cpus.empty() && sched_getaffinity(0, sizeof allowed, &allowed) != 0)
+            return;
+
+        unsigned cpu = 0;
+        if (!cpus.empty())
+            cpu = cpus[index % cpus.size()];
+        else {
+            // the (index % count)-th CPU of our affinity mask
+            std::size_t n = index % static_cast<std::size_t>(
+                                      std::max(CPU_COUNT(&allowed), 1));
+            for (cpu = 0; cpu != CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &allowed) && n-- == 0)
+                    break;
+        }
+        if (cpu >= CPU_SETSIZE)
+            return;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(worker.native_handle(), sizeof set, &set);
+#else
+        (void)worker;
+        (void)index;
+        (void)cpus;
+#endif
+    }
+
+    std::mutex mutex_; // protects done_ and increments of pending_
+    std::condition_variable cv_;
+    std::vector<std::unique_ptr<task_queue>> queues_;
+    std::vector<std::thread> workers_;
+    bool done_;
+    std::atomic<std::size_t> pending_; // tasks in all queues
+    std::atomic<std::size_t> next_;    // round-robin queue of submit()
+    executor_type executor_;
+    std::size_t concurrency_ = 0;
+};
+
+namespace thread_pool_detail {
+
+inline std::shared_ptr<thread_pool>&
+default_pool_slot()
+{
+    static std::shared_ptr<thread_pool> slot;
+    return slot;
+}
+
+} // namespace thread_pool_detail
+
+/**
+ * The library-wide default thread_pool, created with
+ * default_concurrency() threads on first use, unless replaced by
+ * set_default_thread_pool(). Pass it to the parallel modes of the
+ * library, so that they all share the same workers:
+ *
+ *   auto pool = sodium::default_thread_pool();
+ *   sc.encrypt(istr, ostr, *pool);
+ *
+ * The shared_ptr keeps the pool alive while it is being used, even
+ * if the default is replaced in the meantime.
+ **/
+
+inline std::shared_ptr<thread_pool>
+default_thread_pool()
+{
+    auto& slot = thread_pool_detail::default_pool_slot();
+    std::shared_ptr<thread_pool> pool = std::atomic_load(&slot);
+    if (pool)
+        return pool;
+
+    auto fresh = std::make_shared<thread_pool>();
+    if (std::atomic_compare_exchange_strong(&slot, &pool, fresh))
+        return fresh;
+    return pool; // another thread was faster
+}
+
+/**
+ * Replace the library-wide default thread_pool, e.g. by one with
+ * pinned threads, or by one that forwards to the application's own
+ * executor:
+ *
+ *   sodium::set_default_thread_pool(std::make_shared<sodium::thread_pool>(
+ *     [&io](std::function<void()> task) { asio::post(io, std::move(task)); },
+ *     nthreads));
+ *
+ * An empty pool restores the default on the next default_thread_pool().
+ * Thread-safe.
+ **/
+
+inline void
+set_default_thread_pool(std::shared_ptr<thread_pool> pool)
+{
+    std::atomic_store(&thread_pool_detail::default_pool_slot(),
+                      std::move(pool));
+}
+
+} // namespace sodium
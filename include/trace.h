@@ -0,0 +1,229 @@
+// trace.h -- Compile-time selectable tracing and lock-free event counters
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// Select how much tracing the wrappers do, by passing one of these
+// via the command line (e.g. -DSODIUM_TRACE_LEVEL=1):
+//
+//   SODIUM_TRACE_LEVEL 0   no tracing at all (default with NDEBUG)
+//   SODIUM_TRACE_LEVEL 1   count events in sodium::trace counters only
+//   SODIUM_TRACE_LEVEL 2   count events, and log them to std::cerr
+//                          (default without NDEBUG)
+//
+// or provide your own policy (see below) with
+//   -DSODIUM_TRACE_POLICY=my_namespace::my_policy
+//
+// Level 1 is meant for debug builds running under real load: they
+// keep their assertions, but without the serialized writes to stderr.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+
+#ifdef NDEBUG
+#define SODIUM_TRACE_LEVEL_DEFAULT 0
+#else
+#define SODIUM_TRACE_LEVEL_DEFAULT 2
+#endif // NDEBUG
+
+#ifndef SODIUM_TRACE_LEVEL
+#define SODIUM_TRACE_LEVEL SODIUM_TRACE_LEVEL_DEFAULT
+#endif // ! SODIUM_TRACE_LEVEL
+
+namespace sodium {
+
+namespace trace {
+
+/**
+ * A sodium::trace::counter counts the occurrences of one event. It
+ * registers itself, on construction, in a global lock-free registry:
+ * an intrusive singly-linked list that is only ever prepended to.
+ *
+ * Counters are meant to have static storage duration, e.g. the
+ * function-local statics defined by SODIUM_TRACE(). Incrementing
+ * is a single relaxed atomic add.
+ *
+ * Several counters may share the same name (e.g. one per template
+ * instantiation); value(name) adds them up.
+ **/
+
+class counter
+{
+  public:
+    explicit counter(const char* name) noexcept
+      : name_{ name }
+      , value_{ 0 }
+      , next_{ head().load(std::memory_order_relaxed) }
+    {
+        while (!head().compare_exchange_weak(
+          next_, this, std::memory_order_release, std::memory_order_relaxed))
+            ; // next_ has been updated with the current head, retry
+    }
+
+    counter(const counter&) = delete;
+    counter& operator=(const counter&) = delete;
+
+    void increment() noexcept
+    {
+        value_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void reset() noexcept { value_.store(0, std::memory_order_relaxed); }
+
+    const char* name() const noexcept { return name_; }
+    std::uint64_t value() const noexcept
+    {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+    // the most recently registered counter, or nullptr
+    static const counter* first() noexcept
+    {
+        return head().load(std::memory_order_acquire);
+    }
+    const counter* next() const noexcept { return next_; }
+
+  private:
+    static std::atomic<counter*>& head() noexcept
+    {
+        static std::atomic<counter*> the_head{ nullptr };
+        return the_head;
+    }
+
+    const char* name_;
+    std::atomic<std::uint64_t> value_;
+    counter* next_;
+};
+
+// call f(name, value) for each registered counter
+template<typename F>
+void
+for_each_counter(F f)
+{
+    for (const counter* c = counter::first(); c != nullptr; c = c->next())
+        f(c->name(), c->value());
+}
+
+// the sum of all the counters named name
+inline std::uint64_t
+value(const char* name) noexcept
+{
+    std::uint64_t result = 0;
+    for (const counter* c = counter::first(); c != nullptr; c = c->next())
+        if (std::strcmp(c->name(), name) == 0)
+            result += c->value();
+    return result;
+}
+
+// reset all the registered counters to 0
+inline void
+reset_counters() noexcept
+{
+    for (const counter* c = counter::first(); c != nullptr; c = c->next())
+        const_cast<counter*>(c)->reset();
+}
+
+/**
+ * Tracing policies.
+ *
+ * A policy has a static constexpr bool enabled, and a static
+ * event(counter, message) function, where message(os) writes a
+ * description of the event to the std::ostream os. The message is
+ * only formatted if the policy decides to call it.
+ *
+ * If enabled is false, SODIUM_TRACE() compiles to nothing at all.
+ **/
+
+struct null_policy
+{
+    static constexpr bool enabled = false;
+
+    template<typename Message>
+    static void event(counter&, const Message&) noexcept
+    {}
+};
+
+struct counting_policy
+{
+    static constexpr bool enabled = true;
+
+    template<typename Message>
+    static void event(counter& c, const Message&) noexcept
+    {
+        c.increment();
+    }
+};
+
+struct logging_policy
+{
+    static constexpr bool enabled = true;
+
+    template<typename Message>
+    static void event(counter& c, const Message& message)
+    {
+        c.increment();
+
+        // one event per line, even with several threads logging
+        static std::mutex log_mutex;
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << "DEBUG: " << c.name() << ' ';
+        message(std::cerr);
+        std::cerr << std::endl;
+    }
+};
+
+#if defined(SODIUM_TRACE_POLICY)
+using policy = SODIUM_TRACE_POLICY;
+#elif SODIUM_TRACE_LEVEL == 0
+using policy = null_policy;
+#elif SODIUM_TRACE_LEVEL == 1
+using policy = counting_policy;
+#else
+using policy = logging_policy;
+#endif
+
+} // namespace trace
+
+} // namespace sodium
+
+/**
+ * SODIUM_TRACE(name, message)
+ *
+ * Record the event name (a string literal, by convention the
+ * qualified name of the function), with an optional message:
+ * a chain of operator<<() operands, evaluated lazily.
+ *
+ *   SODIUM_TRACE("sodium::allocator::allocate()",
+ *                "[num=" << num << "] -> " << ptr);
+ *
+ * With the null_policy, neither name nor message are evaluated.
+ **/
+
+#define SODIUM_TRACE(name, message)                                           \
+    do {                                                                      \
+        if constexpr (::sodium::trace::policy::enabled) {                     \
+            static ::sodium::trace::counter sodium_trace_counter_{ name };    \
+            ::sodium::trace::policy::event(                                   \
+              sodium_trace_counter_, [&](std::ostream& sodium_trace_os_) {    \
+                  sodium_trace_os_ << message;                                \
+              });                                                             \
+        }                                                                     \
+    } while (false)
@@ -0,0 +1,336 @@
+// tree_hash.h -- Parallel BLAKE2b tree hashing
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h" // key sizes
+#include "keyvar.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <stdexcept>
+#include <utility>
+
+#include <sodium.h>
+
+namespace sodium {
+
+class tree_hash
+{
+    /**
+     * A sodium::tree_hash computes a (keyed or keyless) BLAKE2b hash
+     * of a message of potentially unlimited length in a way that can
+     * use more than one core: the message is cut into leaves of
+     * leafsize bytes, the leaves are hashed concurrently on a
+     * sodium::thread_pool, and their hashes are combined into a root
+     * hash of the desired size.
+     *
+     * The tree has a fixed depth of 2, like BLAKE2bp, but with an
+     * unbounded fan-out. With key K, leaf i (counting from 0) of the
+     * message M_0 || M_1 || ... || M_{n-1} is hashed into 32 bytes as
+     *
+     *   L_i  = BLAKE2b_K(0x00 || LE64(i) || M_i)
+     *
+     * and the root hash, of hashsize bytes, is
+     *
+     *   root = BLAKE2b_K(0x01 || LE64(leafsize) ||
+     *                    L_0 || ... || L_{n-1} || LE64(total length))
+     *
+     * Every leaf but the last one is exactly leafsize bytes long; the
+     * empty message has no leaves at all. The prefixes keep leaves and
+     * root apart, and leafsize and the total length are both bound to
+     * the root, so that different trees of the same message never
+     * collide.
+     *
+     * A tree hash is NOT the same as the crypto_generichash() of the
+     * message, and it depends on leafsize: both parties must agree on
+     * the same leafsize.
+     *
+     * The leaf hashes are folded into the root strictly in order, and
+     * at most window leaves are in flight at the same time, which
+     * bounds the memory use to about window * leafsize bytes.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = sodium::KEYSIZE_HASHKEY;
+    static constexpr std::size_t KEYSIZE_MIN = sodium::KEYSIZE_HASHKEY_MIN;
+    static constexpr std::size_t KEYSIZE_MAX = sodium::KEYSIZE_HASHKEY_MAX;
+
+    static constexpr std::size_t HASHSIZE = crypto_generichash_BYTES;
+    static constexpr std::size_t HASHSIZE_MIN = crypto_generichash_BYTES_MIN;
+    static constexpr std::size_t HASHSIZE_MAX = crypto_generichash_BYTES_MAX;
+
+    // the size of the leaf hashes L_i
+    static constexpr std::size_t LEAF_HASHSIZE = crypto_generichash_BYTES;
+
+    // a good default for leafsize
+    static constexpr std::size_t LEAFSIZE = 1024 * 1024;
+
+    using key_type = keyvar<>;
+
+    /**
+     * Create a tree hash with the given key, hash size and leaf size,
+     * that hashes its leaves on the thread pool pool. A key of size 0
+     * selects keyless hashing. If window is 0, keep up to twice as
+     * many leaves as pool has threads in flight.
+     *
+     * The following preconditions must hold, or else the constructor
+     * will throw a std::runtime_error:
+     *
+     *   key.size() == 0 || KEYSIZE_MIN <= key.size() <= KEYSIZE_MAX
+     *   HASHSIZE_MIN  <= hashsize   <= HASHSIZE_MAX
+     *   leafsize > 0
+     *
+     * The pool must outlive this tree_hash.
+     **/
+
+    tree_hash(const key_type& key,
+              const std::size_t hashsize,
+              const std::size_t leafsize,
+              thread_pool& pool,
+              const std::size_t window = 0)
+      : key_{ key }
+      , hashsize_{ hashsize }
+      , leafsize_{ leafsize }
+      , window_{ window != 0 ? window : 2 * pool.size() }
+      , pool_{ pool }
+    {
+        if (key.size() != 0 && key.size() < KEYSIZE_MIN)
+            throw std::runtime_error{
+                "sodium::tree_hash::tree_hash() key too small"
+            };
+        if (key.size() > KEYSIZE_MAX)
+            throw std::runtime_error{
+                "sodium::tree_hash::tree_hash() key too big"
+            };
+        if (hashsize < HASHSIZE_MIN)
+            throw std::runtime_error{
+                "sodium::tree_hash::tree_hash() hash size too small"
+            };
+        if (hashsize > HASHSIZE_MAX)
+            throw std::runtime_error{
+                "sodium::tree_hash::tree_hash() hash size too big"
+            };
+        if (leafsize < 1)
+            throw std::runtime_error{
+                "sodium::tree_hash::tree_hash() wrong leafsize"
+            };
+
+        reset();
+    }
+
+    tree_hash(const tree_hash&) = delete;
+    tree_hash& operator=(const tree_hash&) = delete;
+
+    // wait for the leaves still in flight: they refer to *this
+    ~tree_hash()
+    {
+        for (auto& leaf : pending_)
+            leaf.wait();
+    }
+
+    /**
+     * Add the size bytes at data to the message being hashed.
+     *
+     * update() may block while the window of leaves in flight is full.
+     **/
+
+    void update(const unsigned char* data, std::size_t size)
+    {
+        while (size != 0) {
+            std::size_t n = std::min(size, leafsize_ - leaf_.size());
+            leaf_.insert(leaf_.end(), data, data + n);
+            data += n;
+            size -= n;
+
+            if (leaf_.size() == leafsize_)
+                submit_leaf();
+        }
+    }
+
+    /**
+     * Wait for all leaves, and write the root hash into out, which
+     * must have room for hashsize bytes. Reset the tree_hash, so it
+     * can hash another message.
+     **/
+
+    void final(unsigned char* out)
+    {
+        if (!leaf_.empty())
+            submit_leaf();
+        while (!pending_.empty())
+            fold_oldest();
+
+        final_root(root_, total_, out);
+
+        reset();
+    }
+
+    // the size of the root hash
+    std::size_t hashsize() const { return hashsize_; }
+
+    // the size of the leaves
+    std::size_t leafsize() const { return leafsize_; }
+
+    /**
+     * The two halves of the tree, for callers that hold the whole
+     * message in memory (e.g. a memory-mapped file) and schedule the
+     * leaves themselves, or that store the leaf hashes to pinpoint
+     * corrupted leaves later.
+     *
+     * hash_leaf() writes the LEAF_HASHSIZE bytes L_index of leaf into
+     * out. It only reads const state, and can be called concurrently.
+     *
+     * hash_root() writes the root hash over the leaf_hashes
+     * L_0 || ... || L_{n-1} of a message of total bytes into out,
+     * which must have room for hashsize() bytes.
+     *
+     * Feeding the leaves of a message to hash_leaf() and their hashes
+     * to hash_root() gives the same root hash as update() and final().
+     **/
+
+    void hash_leaf(std::uint64_t index,
+                   const unsigned char* leaf,
+                   std::size_t size,
+                   unsigned char* out) const
+    {
+        crypto_generichash_state state;
+        init_state(state, LEAF_HASHSIZE);
+
+        unsigned char prefix[1 + 8] = { 0x00 };
+        store_le64(prefix + 1, index);
+        crypto_generichash_update(&state, prefix, sizeof prefix);
+        crypto_generichash_update(&state, leaf, size);
+
+        crypto_generichash_final(&state, out, LEAF_HASHSIZE);
+    }
+
+    void hash_root(const unsigned char* leaf_hashes,
+                   std::size_t nleaves,
+                   std::uint64_t total,
+                   unsigned char* out) const
+    {
+        crypto_generichash_state root;
+        init_root(root);
+        crypto_generichash_update(
+          &root, leaf_hashes, nleaves * LEAF_HASHSIZE);
+        final_root(root, total, out);
+    }
+
+  private:
+    using leaf_hash_type = bytes;
+
+    void reset()
+    {
+        init_root(root_);
+
+        leaf_.clear();
+        leaf_.reserve(leafsize_);
+        nleaves_ = 0;
+        total_ = 0;
+    }
+
+    void submit_leaf()
+    {
+        if (pending_.size() >= window_)
+            fold_oldest();
+
+        total_ += leaf_.size();
+        pending_.push_back(pool_.submit(
+          [this, index = nleaves_++, leaf = std::move(leaf_)] {
+              return hash_leaf(index, leaf);
+          }));
+
+        leaf_ = bytes();
+        leaf_.reserve(leafsize_);
+    }
+
+    void fold_oldest()
+    {
+        leaf_hash_type leaf_hash = pool_.get(pending_.front());
+        pending_.pop_front();
+        crypto_generichash_update(&root_, leaf_hash.data(), leaf_hash.size());
+    }
+
+    // called concurrently from the worker threads: only read const state
+    leaf_hash_type hash_leaf(std::uint64_t index, const bytes& leaf) const
+    {
+        leaf_hash_type leaf_hash(LEAF_HASHSIZE);
+        hash_leaf(index, leaf.data(), leaf.size(), leaf_hash.data());
+        return leaf_hash;
+    }
+
+    void init_root(crypto_generichash_state& root) const
+    {
+        init_state(root);
+
+        unsigned char prefix[1 + 8] = { 0x01 };
+        store_le64(prefix + 1, leafsize_);
+        crypto_generichash_update(&root, prefix, sizeof prefix);
+    }
+
+    void final_root(crypto_generichash_state& root,
+                    std::uint64_t total,
+                    unsigned char* out) const
+    {
+        unsigned char le[8];
+        store_le64(le, total);
+        crypto_generichash_update(&root, le, sizeof le);
+        crypto_generichash_final(&root, out, hashsize_);
+    }
+
+    void init_state(crypto_generichash_state& state) const
+    {
+        init_state(state, hashsize_);
+    }
+
+    void init_state(crypto_generichash_state& state,
+                    std::size_t hashsize) const
+    {
+        if (key_.size() != 0)
+            crypto_generichash_init(
+              &state, key_.data(), key_.size(), hashsize);
+        else
+            crypto_generichash_init(&state, NULL, 0, hashsize); // keyless
+    }
+
+    static void store_le64(unsigned char* out, std::uint64_t value)
+    {
+        for (std::size_t i = 0; i != 8; ++i)
+            out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+
+    key_type key_;
+    std::size_t hashsize_;
+    std::size_t leafsize_;
+    std::size_t window_;
+    thread_pool& pool_;
+
+    crypto_generichash_state root_;
+    bytes leaf_;
+    std::deque<std::future<leaf_hash_type>> pending_;
+    std::uint64_t nleaves_;
+    std::uint64_t total_;
+};
+
+} // namespace sodium
@@ -19,11 +19,21 @@
 #pragma once
 
 #include "common.h"
+#include "error.h"
+#include "extern_templates.h"
+#include "fixed_bytes.h"
 #include "key.h"
 #include "keypairsign.h"
+#include "span.h"
+#include "thread_pool.h"
 
 #include <sodium.h>
+
+#include <algorithm>
+#include <future>
 #include <stdexcept>
+#include <system_error>
+#include <vector>
 
 namespace sodium {
 
@@ -57,13 +67,15 @@ class verifier
       keypairsign_type::KEYSIZE_PUBLIC_KEY;
     static constexpr std::size_t SIGNATURE_SIZE = crypto_sign_BYTES;
 
+    using signature_type = fixed_bytes<SIGNATURE_SIZE>;
+
     // A verifier with a user-supplied key (copying version)
     verifier(const public_key_type& key)
       : key_(key)
     {
         // some sanity checks before we get started
         if (key_.size() != KEYSIZE_PUBLIC_KEY) {
-            key_.empty();
+            key_.clear();
             throw std::runtime_error{
                 "sodium::verifier::verifier(): wrong public key size"
             };
@@ -76,7 +88,7 @@ class verifier
     {
         // some sanity checks before we get started
         if (key_.size() != KEYSIZE_PUBLIC_KEY) {
-            key_.empty();
+            key_.clear();
             throw std::runtime_error{
                 "sodium::verifier::verifier(&&): wrong public key size"
             };
@@ -111,7 +123,7 @@ class verifier
      * with signature being SIGNATURE_SIZE bytes long.
      **/
 
-    BT verify(const BT& plaintext_with_signature)
+    BT verify(const BT& plaintext_with_signature) const
     {
         // some sanity checks before we get started
         if (plaintext_with_signature.size() < SIGNATURE_SIZE)
@@ -150,7 +162,7 @@ class verifier
      *of signature isn't SIGNATURE_SIZE bytes, throw std::runtime_error.
      **/
 
-    bool verify_detached(const BT& plaintext, const bytes& signature)
+    bool verify_detached(const BT& plaintext, const bytes& signature) const
     {
         // some sanity checks before we get started
         if (signature.size() != SIGNATURE_SIZE)
@@ -167,8 +179,191 @@ class verifier
                  key_.data()) != -1;
     }
 
+    /**
+     * Non-throwing variants of verify() and verify_detached() above.
+     *
+     * Instead of throwing a std::runtime_error, they set ec to
+     * sodium::errc::verification_failed if the signature doesn't
+     * verify, or to sodium::errc::message_too_short or
+     * sodium::errc::wrong_size, and return an empty BT or false. On
+     * success, ec is cleared. See error.h.
+     **/
+
+    BT verify(const BT& plaintext_with_signature, std::error_code& ec) const
+    {
+        if (plaintext_with_signature.size() < SIGNATURE_SIZE) {
+            ec = errc::message_too_short;
+            return BT();
+        }
+
+        BT plaintext(plaintext_with_signature.size() - SIGNATURE_SIZE);
+        unsigned long long plaintext_size;
+
+        if (crypto_sign_open(reinterpret_cast<unsigned char*>(plaintext.data()),
+                             &plaintext_size,
+                             reinterpret_cast<const unsigned char*>(
+                               plaintext_with_signature.data()),
+                             plaintext_with_signature.size(),
+                             key_.data()) != 0 ||
+            plaintext_size != plaintext.size()) {
+            ec = errc::verification_failed;
+            return BT();
+        }
+
+        ec.clear();
+        return plaintext;
+    }
+
+    bool verify_detached(const BT& plaintext,
+                         const bytes& signature,
+                         std::error_code& ec) const noexcept
+    {
+        if (signature.size() != SIGNATURE_SIZE) {
+            ec = errc::wrong_size;
+            return false;
+        }
+
+        if (crypto_sign_verify_detached(
+              signature.data(),
+              reinterpret_cast<const unsigned char*>(plaintext.data()),
+              plaintext.size(),
+              key_.data()) != 0) {
+            ec = errc::verification_failed;
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    /**
+     * Allocation-free variant of verify_detached(), for a signature
+     * returned by signer::sign_detached_fixed(). As the size of
+     * signature is right by construction, this doesn't throw.
+     **/
+
+    bool verify_detached(span<const byte> plaintext,
+                         const signature_type& signature) const noexcept
+    {
+        return crypto_sign_verify_detached(signature.data(),
+                                           plaintext.data(),
+                                           plaintext.size(),
+                                           key_.data()) != -1;
+    }
+
+    /**
+     * Verify many detached signatures against the saved public key at
+     * once, using all worker threads of pool.
+     *
+     * Item i is (plaintexts[i], signatures[i]). The result has one bit
+     * per item: true if the signature verified, false otherwise.
+     * Signatures that aren't SIGNATURE_SIZE bytes long don't throw
+     * here, they just don't verify.
+     *
+     * This is the fast path for many messages under the same public
+     * key: the key was size-checked once at construction time and is
+     * shared by all workers. libsodium doesn't expose a batch
+     * verification or a precomputed form of the decoded public key,
+     * so each item still costs one crypto_sign_verify_detached().
+     *
+     * Throws std::runtime_error if the sizes of the arrays differ.
+     **/
+
+    std::vector<bool> verify_detached(const std::vector<BT>& plaintexts,
+                                      const std::vector<bytes>& signatures,
+                                      thread_pool& pool) const
+    {
+        if (plaintexts.size() != signatures.size())
+            throw std::runtime_error{ "sodium::verifier::verify_detached("
+                                      "batch): array sizes differ" };
+
+        return verify_batch(
+          plaintexts.size(), pool, [&](std::size_t i) {
+              return verify_one(plaintexts[i], signatures[i], key_);
+          });
+    }
+
+    /**
+     * Like the above, but item i is verified against public_keys[i].
+     * Public keys that aren't KEYSIZE_PUBLIC_KEY bytes long don't
+     * throw, their items just don't verify.
+     **/
+
+    static std::vector<bool> verify_detached(
+      const std::vector<BT>& plaintexts,
+      const std::vector<bytes>& signatures,
+      const std::vector<public_key_type>& public_keys,
+      thread_pool& pool)
+    {
+        if (plaintexts.size() != signatures.size() ||
+            plaintexts.size() != public_keys.size())
+            throw std::runtime_error{ "sodium::verifier::verify_detached("
+                                      "batch): array sizes differ" };
+
+        return verify_batch(
+          plaintexts.size(), pool, [&](std::size_t i) {
+              return public_keys[i].size() == KEYSIZE_PUBLIC_KEY &&
+                     verify_one(plaintexts[i], signatures[i], public_keys[i]);
+          });
+    }
+
   private:
+    static bool verify_one(const BT& plaintext,
+                           const bytes& signature,
+                           const public_key_type& key)
+    {
+        return signature.size() == SIGNATURE_SIZE &&
+               crypto_sign_verify_detached(
+                 signature.data(),
+                 reinterpret_cast<const unsigned char*>(plaintext.data()),
+                 plaintext.size(),
+                 key.data()) != -1;
+    }
+
+    // run verify(i) for all i in [0, n), one contiguous range per worker
+    template<typename Func>
+    static std::vector<bool> verify_batch(std::size_t n,
+                                          thread_pool& pool,
+                                          Func verify)
+    {
+        // std::vector<bool> can't be written concurrently: one byte per
+        // item, then pack.
+        std::vector<unsigned char> ok(n, 0);
+
+        const std::size_t nranges = std::max<std::size_t>(
+          1, std::min<std::size_t>(pool.size(), n));
+        const std::size_t perrange = (n + nranges - 1) / nranges;
+
+        std::vector<std::future<void>> results;
+        results.reserve(nranges); // no future lost to a reallocation
+        try {
+            for (std::size_t first = 0; first < n; first += perrange) {
+                const std::size_t last = std::min(first + perrange, n);
+                results.push_back(pool.submit([&, first, last] {
+                    for (std::size_t i = first; i != last; ++i)
+                        ok[i] = verify(i) ? 1 : 0;
+                }));
+            }
+        } catch (...) {
+            // the tasks already submitted write into ok: let them finish
+            for (auto& result : results)
+                pool.wait(result);
+            throw;
+        }
+
+        // all workers must be done with ok before we rethrow
+        for (auto& result : results)
+            pool.wait(result);
+        for (auto& result : results)
+            result.get();
+
+        return std::vector<bool>(ok.cbegin(), ok.cend());
+    }
+
     public_key_type key_;
 };
 
+// instantiated in the sodium-wrapper library (see extern_templates.h)
+SODIUM_EXTERN_TEMPLATE_BT(verifier);
+
 } // namespace sodium
@@ -18,23 +18,24 @@
 
 #pragma once
 
+#include "filter_profile.h"
 #include "key.h"
 #include "nonce.h"
+#include "stream_xor_backend.h"
+#include "trace.h"
 
 #include <boost/iostreams/filter/symmetric.hpp>
 #include <boost/iostreams/pipeline.hpp>
 
 #include <algorithm> // std::min<>
 #include <cstddef>   // std::ptrdiff_t
+#include <memory>    // std::shared_ptr<>
 #include <stdexcept> // std::runtime_error
+#include <string>
+#include <utility>   // std::move()
 
 #include <sodium.h>
 
-#ifndef NDEBUG
-#include <iostream>
-#include <string>
-#endif // ! NDEBUG
-
 namespace io = boost::iostreams;
 
 namespace sodium {
@@ -62,8 +63,10 @@ class xchacha20_symmetric_filter
      * Construct a SymmetricFilter model for the XChaCha20 stream cipher.
      *
      * Parameters:
-     *   key   : the secret key used to encrypt/decrypt.
-     *   nonce : a public nonce.
+     *   key     : the secret key used to encrypt/decrypt.
+     *   nonce   : a public nonce.
+     *   backend : generates the key stream (default: libsodium, see
+     *             default_stream_xor_backend() in stream_xor_backend.h).
      *
      * Even though we supply a nonce, xchacha20_symmetric_filter uses a
      * running internal counter that automatically gets incremented
@@ -77,9 +80,13 @@ class xchacha20_symmetric_filter
      * exceeds BLOCKSIZE bytes.
      **/
 
-    xchacha20_symmetric_filter(const key_type& key, const nonce_type& nonce)
+    xchacha20_symmetric_filter(const key_type& key,
+                               const nonce_type& nonce,
+                               std::shared_ptr<stream_xor_backend> backend =
+                                 default_stream_xor_backend())
       : key_{ key }
       , nonce_{ nonce }
+      , backend_{ std::move(backend) }
       , initptr_{ nullptr }
     {}
 
@@ -99,12 +106,10 @@ class xchacha20_symmetric_filter
                 const char_type* i2,
                 char_type*& o1,
                 char_type* o2,
-#ifndef NDEBUG
                 bool flush)
-#else
-                bool /* flush */)
-#endif // ! NDEBUG
     {
+        SODIUM_PROFILE_SPAN("xchacha20_filter", i1);
+
         // mlen = number of bytes to filter:
         auto mlen = static_cast<unsigned long long>(
           std::min<std::ptrdiff_t>(i2 - i1, o2 - o1));
@@ -122,7 +127,8 @@ class xchacha20_symmetric_filter
         // filter as many bytes as possible from [i1,i2) to [o1,o2)
         // and update i1, and o1 when done.
 
-        if (crypto_stream_xchacha20_xor_ic(
+        if (stream_xor<stream_cipher_xchacha20>(
+              backend_.get(),
               reinterpret_cast<unsigned char*>(o1),
               reinterpret_cast<const unsigned char*>(i1),
               mlen,
@@ -132,20 +138,18 @@ class xchacha20_symmetric_filter
             throw std::runtime_error{ "sodium::xchacha20_filter::filter() "
                                       "crypto_stream_xchacha20_xor_ic() -1" };
 
-#ifndef NDEBUG
-        std::cerr << "xchacha20_symmetric_filter::filter("
-                  << static_cast<const void*>(i1) << ","
-                  << static_cast<const void*>(i2) << ","
-                  << static_cast<const void*>(o1) << ","
-                  << static_cast<const void*>(o2) << "," << flush << ") called"
-                  << '\n'
-                  << "  [mlen=" << mlen << "]" << '\n'
-                  << "  [[i1,i1+mlen)={" << std::string(i1, i1 + mlen) << "}"
-                  << '\n'
-                  << "  [[o1,o1+mlen)={" << std::string(o1, o1 + mlen) << "}"
-                  << "  [ic]=" << ic << '\n'
-                  << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::xchacha20_symmetric_filter::filter()",
+                     "(" << static_cast<const void*>(i1) << ","
+                         << static_cast<const void*>(i2) << ","
+                         << static_cast<const void*>(o1) << ","
+                         << static_cast<const void*>(o2) << "," << flush
+                         << ") called" << '\n'
+                         << "  [mlen=" << mlen << "]" << '\n'
+                         << "  [[i1,i1+mlen)={" << std::string(i1, i1 + mlen)
+                         << "}" << '\n'
+                         << "  [[o1,o1+mlen)={" << std::string(o1, o1 + mlen)
+                         << "}"
+                         << "  [ic]=" << ic);
 
         i1 += static_cast<std::ptrdiff_t>(mlen);
         o1 += static_cast<std::ptrdiff_t>(mlen);
@@ -167,9 +171,7 @@ class xchacha20_symmetric_filter
 
     void close()
     {
-#ifndef NDEBUG
-        std::cerr << "xchacha20_symmetric_filter::close() called" << std::endl;
-#endif // ! NDEBUG
+        SODIUM_TRACE("sodium::xchacha20_symmetric_filter::close()", "called");
 
         initptr_ = nullptr; // restart with a whole new input sequence
     }
@@ -177,6 +179,7 @@ class xchacha20_symmetric_filter
   private:
     key_type key_;
     nonce_type nonce_;
+    std::shared_ptr<stream_xor_backend> backend_;
     const char_type* initptr_; // address of the start of the whole input string
 
 }; // xchacha20_symmetric_filter
@@ -270,6 +273,7 @@ class xchacha20_filter : public io::symmetric_filter<xchacha20_symmetric_filter>
      *   buffer_size: proceed encryption/decryption in blocks of so many bytes.
      *   key        : secret key used to encrypt/decrypt data with XChaCha20
      *   nonce      : public nonce used to encrypt/decrypt.
+     *   backend    : generates the key stream (default: libsodium).
      *
      * Note that to facilitate computations, buffer_size will always be
      * rounded up to the next xchacha20_symmetric_filter::BLOCKSIZE
@@ -279,8 +283,13 @@ class xchacha20_filter : public io::symmetric_filter<xchacha20_symmetric_filter>
 
     xchacha20_filter(std::streamsize buffer_size,
                      const key_type& key,
-                     const nonce_type& nonce)
-      : base_type(round_up_to_xchacha20_blocksize(buffer_size), key, nonce)
+                     const nonce_type& nonce,
+                     std::shared_ptr<stream_xor_backend> backend =
+                       default_stream_xor_backend())
+      : base_type(round_up_to_xchacha20_blocksize(buffer_size),
+                  key,
+                  nonce,
+                  std::move(backend))
     {}
 
   private:
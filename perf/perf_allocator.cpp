@@ -0,0 +1,54 @@
+// perf_allocator.cpp -- Performance regression tests of the allocators
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "perf_common.h"
+
+#include "allocator.h"
+#include "common.h"
+#include "key.h"
+#include "pooled_allocator.h"
+
+int
+main(int argc, char** argv)
+{
+    perf::suite suite("perf_allocator", argc, argv);
+
+    sodium::allocator<sodium::byte> alloc;
+    suite.run("allocator_4k", 0, 2000, [&] {
+        sodium::byte* p = alloc.allocate(4096);
+        alloc.deallocate(p, 4096);
+    });
+
+    sodium::pooled_allocator<sodium::byte> pooled;
+    suite.run("pooled_allocator_64", 0, 2000, [&] {
+        sodium::byte* p = pooled.allocate(64);
+        pooled.deallocate(p, 64);
+    });
+
+    suite.run("bytes_pooled_1k", 0, 2000, [] {
+        sodium::bytes_pooled buf(1024);
+        (void)buf;
+    });
+
+    suite.run("key_32", 0, 2000, [] {
+        sodium::key<32> key;
+        (void)key;
+    });
+
+    return suite.finish();
+}
@@ -0,0 +1,273 @@
+// perf_common.h -- Harness of the performance regression tests
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "../tools/alloc_counter.h"
+
+#include <sodium.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace perf {
+
+using alloc_counter::allocations;
+
+// the standard library the allocation counts of "any" are exact for
+#if defined(__GLIBCXX__)
+constexpr bool ANY_ALLOCS_EXACT = true;
+#else
+constexpr bool ANY_ALLOCS_EXACT = false;
+#endif
+
+/**
+ * A perf::suite runs fixed workloads ("cases") of one hot path, and
+ * compares their throughput and heap allocations per operation with
+ * a baseline:
+ *
+ *   perf::suite suite("perf_aead", argc, argv);
+ *   suite.run("encrypt_span_64k", 64 * 1024, 256, [&] { ... });
+ *   return suite.finish();
+ *
+ * run(name, bytes_per_op, ops, f) calls f() once to warm up, then
+ * ops times per repetition, and keeps the best repetition: the rate
+ * is MB/s (ops/s if bytes_per_op is 0). Allocations are exact, and
+ * don't depend on the machine, but they do depend on the standard
+ * library (std::string, iostreams, ...): the "any" baselines have been
+ * recorded with libstdc++. With any other standard library (e.g.
+ * libc++), only their zero-allocation cases are checked; the others
+ * are reported against the baseline, but don't fail.
+ *
+ * The baselines live in DIR/MACHINE_CLASS/SUITE.txt, one case per
+ * line: "name rate allocs_per_op". A case fails when
+ *   - it allocates more per operation than its baseline, or
+ *   - its rate is more than tolerance below its baseline.
+ * The machine class "any" only checks allocations, and is what
+ * other machine classes fall back to for cases they don't list.
+ * Cases without any baseline are reported, but don't fail.
+ *
+ * Command line:
+ *   --baselines DIR      (default: no baselines; report only)
+ *   --machine-class NAME (default: $SODIUM_PERF_MACHINE_CLASS, or any)
+ *   --tolerance T        (default: 0.15, i.e. 15% slower)
+ *   --repetitions N      (default: 5)
+ *   --record             write the results as the baseline of
+ *                        MACHINE_CLASS instead of checking them
+ **/
+
+class suite
+{
+  public:
+    suite(const std::string& name, int argc, char** argv)
+      : name_{ name }
+    {
+        if (const char* env = std::getenv("SODIUM_PERF_MACHINE_CLASS"))
+            machine_class_ = env;
+
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_value = i + 1 < argc;
+            if (arg == "--baselines" && has_value)
+                baselines_ = argv[++i];
+            else if (arg == "--machine-class" && has_value)
+                machine_class_ = argv[++i];
+            else if (arg == "--tolerance" && has_value)
+                tolerance_ = std::stod(argv[++i]);
+            else if (arg == "--repetitions" && has_value)
+                repetitions_ = std::max(1, std::stoi(argv[++i]));
+            else if (arg == "--record")
+                record_ = true;
+            else {
+                std::cerr << name_ << ": unknown option " << arg << '\n';
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        if (machine_class_.empty())
+            machine_class_ = "any";
+
+        if (sodium_init() == -1) {
+            std::cerr << name_ << ": can't sodium_init()\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if (!baselines_.empty()) {
+            load(path("any"), true);
+            if (machine_class_ != "any")
+                load(path(machine_class_), false);
+        }
+
+        std::cout << name_ << " [machine class " << machine_class_
+                  << ", tolerance " << tolerance_ * 100 << "%, "
+                  << repetitions_ << " repetitions]\n";
+    }
+
+    template<typename Func>
+    void run(const std::string& name,
+             std::size_t bytes_per_op,
+             std::size_t ops,
+             Func f)
+    {
+        f(); // warm up caches, pools and lazily created state
+
+        double best = 0;
+        std::size_t allocs = static_cast<std::size_t>(-1);
+        for (int r = 0; r != repetitions_; ++r) {
+            const std::size_t a0 = allocations();
+            const auto t0 = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i != ops; ++i)
+                f();
+            const auto t1 = std::chrono::steady_clock::now();
+            const std::size_t a1 = allocations();
+
+            const double seconds =
+              std::chrono::duration<double>(t1 - t0).count();
+            const double units = bytes_per_op != 0 ? ops * bytes_per_op / 1e6
+                                                   : static_cast<double>(ops);
+            best = std::max(best, units / std::max(seconds, 1e-9));
+            allocs = std::min(allocs, a1 - a0);
+        }
+
+        result res{ best, static_cast<double>(allocs) / ops };
+        results_.emplace_back(name, res);
+        report(name, bytes_per_op != 0 ? "MB/s" : "ops/s", res);
+    }
+
+    // check or record the results; the exit code of main()
+    int finish()
+    {
+        if (record_)
+            return save() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        if (failures_ != 0)
+            std::cout << name_ << ": " << failures_ << " of "
+                      << results_.size() << " cases regressed\n";
+        return failures_ == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+  private:
+    struct result
+    {
+        double rate;
+        double allocs;
+    };
+
+    struct baseline
+    {
+        result values;
+        bool allocs_only;
+    };
+
+    std::string path(const std::string& machine_class) const
+    {
+        return baselines_ + "/" + machine_class + "/" + name_ + ".txt";
+    }
+
+    void load(const std::string& file, bool allocs_only)
+    {
+        std::ifstream ifs(file);
+        std::string line;
+        while (std::getline(ifs, line)) {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            std::string name;
+            result values{ 0, 0 };
+            if (fields >> name >> values.rate >> values.allocs)
+                baselines_by_case_[name] = baseline{ values, allocs_only };
+        }
+    }
+
+    bool save() const
+    {
+        const std::string file = path(machine_class_);
+        std::ofstream ofs(file);
+        ofs << "# " << name_ << " baseline of machine class "
+            << machine_class_ << '\n'
+            << "# case  rate (MB/s or ops/s)  allocs/op\n";
+        for (const auto& [name, res] : results_)
+            ofs << name << ' ' << (machine_class_ == "any" ? 0 : res.rate)
+                << ' ' << res.allocs << '\n';
+        if (!ofs) {
+            std::cerr << name_ << ": can't write " << file
+                      << " (does the directory exist?)\n";
+            return false;
+        }
+        std::cout << name_ << ": recorded " << file << '\n';
+        return true;
+    }
+
+    void report(const std::string& name, const char* unit, const result& res)
+    {
+        char line[160];
+        std::snprintf(line,
+                      sizeof line,
+                      "  %-32s %10.1f %-5s %8.2f allocs/op",
+                      name.c_str(),
+                      res.rate,
+                      unit,
+                      res.allocs);
+        std::cout << line;
+
+        const auto it = baselines_by_case_.find(name);
+        if (record_ || it == baselines_by_case_.end()) {
+            std::cout << (record_ ? "\n" : "  [no baseline]\n");
+            return;
+        }
+
+        const baseline& base = it->second;
+        const bool exact =
+          !base.allocs_only || ANY_ALLOCS_EXACT || base.values.allocs == 0;
+        bool failed = false;
+        if (exact && res.allocs > base.values.allocs + 1e-9) {
+            std::cout << "  FAIL: allocs/op > " << base.values.allocs;
+            failed = true;
+        }
+        if (!exact)
+            std::cout << "  (allocs/op unchecked)";
+        if (!base.allocs_only && base.values.rate > 0 &&
+            res.rate < base.values.rate * (1 - tolerance_)) {
+            std::cout << "  FAIL: " << unit << " < " << base.values.rate
+                      << " - " << tolerance_ * 100 << "%";
+            failed = true;
+        }
+        std::cout << (failed ? "\n" : "  ok\n");
+        failures_ += failed;
+    }
+
+    std::string name_;
+    std::string baselines_;
+    std::string machine_class_;
+    double tolerance_ = 0.15;
+    int repetitions_ = 5;
+    bool record_ = false;
+
+    std::map<std::string, baseline> baselines_by_case_;
+    std::vector<std::pair<std::string, result>> results_;
+    std::size_t failures_ = 0;
+};
+
+} // namespace perf
@@ -0,0 +1,73 @@
+// perf_filters.cpp -- Performance regression tests of the stream filters
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "perf_common.h"
+
+#include "buffered_stream_filter.h"
+#include "common.h"
+#include "secretstream_encrypt_filter.h"
+#include "xchacha20_filter.h"
+
+#include <boost/iostreams/device/null.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+namespace io = boost::iostreams;
+
+using sodium::chars;
+
+// write plaintext through a fresh chain of filter and a null_sink
+template<typename Filter>
+void
+run_filter(const Filter& filter, const chars& plaintext)
+{
+    io::filtering_ostream os;
+    os.push(filter);
+    os.push(io::null_sink{});
+    os.write(plaintext.data(), plaintext.size());
+    os.reset();
+}
+
+int
+main(int argc, char** argv)
+{
+    perf::suite suite("perf_filters", argc, argv);
+
+    const chars plaintext(1024 * 1024);
+
+    sodium::xchacha20_filter::key_type key;
+    sodium::xchacha20_filter::nonce_type nonce;
+    const sodium::xchacha20_filter xchacha20{ 4096, key, nonce };
+    suite.run("xchacha20_filter_1m", plaintext.size(), 32, [&] {
+        run_filter(xchacha20, plaintext);
+    });
+
+    const sodium::buffered_xchacha20_filter buffered{ 1 << 16, key, nonce };
+    suite.run("buffered_xchacha20_filter_1m", plaintext.size(), 32, [&] {
+        run_filter(buffered, plaintext);
+    });
+
+    sodium::secretstream_encrypt_filter::key_type sskey;
+    const sodium::secretstream_encrypt_filter secretstream{ 1 << 16,
+                                                            sskey,
+                                                            16 * 1024 };
+    suite.run("secretstream_encrypt_filter_1m", plaintext.size(), 32, [&] {
+        run_filter(secretstream, plaintext);
+    });
+
+    return suite.finish();
+}
@@ -0,0 +1,57 @@
+// perf_secretbox.cpp -- Performance regression tests of sodium::secretbox
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "perf_common.h"
+
+#include "common.h"
+#include "secretbox.h"
+
+using sodium::byte;
+using sodium::bytes;
+using sodium::span;
+
+int
+main(int argc, char** argv)
+{
+    perf::suite suite("perf_secretbox", argc, argv);
+
+    sodium::secretbox<bytes> sb;
+    sodium::secretbox<bytes>::nonce_type nonce;
+
+    const bytes small(1024);
+    suite.run("encrypt_1k", small.size(), 20000, [&] {
+        bytes ciphertext = sb.encrypt(small, nonce);
+        (void)ciphertext;
+    });
+
+    const bytes plaintext(64 * 1024);
+    bytes ciphertext(plaintext.size() + sodium::secretbox<bytes>::MACSIZE);
+    suite.run("encrypt_span_64k", plaintext.size(), 256, [&] {
+        sb.encrypt(span<byte>(ciphertext), span<const byte>(plaintext), nonce);
+    });
+
+    bytes decrypted(plaintext.size());
+    suite.run("decrypt_span_64k", plaintext.size(), 256, [&] {
+        if (sb.decrypt(span<byte>(decrypted),
+                       span<const byte>(ciphertext),
+                       nonce) != 0)
+            std::abort();
+    });
+
+    return suite.finish();
+}
@@ -0,0 +1,61 @@
+// perf_streams.cpp -- Performance regression tests of the stream classes
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "perf_common.h"
+
+#include "aead.h"
+#include "common.h"
+#include "streamcryptor_aead.h"
+#include "streamcryptor_secretstream.h"
+#include "streamhash.h"
+
+#include <sstream>
+#include <string>
+
+int
+main(int argc, char** argv)
+{
+    perf::suite suite("perf_streams", argc, argv);
+
+    const std::string plaintext(4 * 1024 * 1024, 'a');
+
+    sodium::streamcryptor_secretstream<>::key_type sskey;
+    const sodium::streamcryptor_secretstream<> secretstream(sskey);
+    suite.run("streamcryptor_secretstream_4m", plaintext.size(), 8, [&] {
+        std::istringstream istr(plaintext);
+        std::ostringstream ostr;
+        secretstream.encrypt(istr, ostr);
+    });
+
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::streamcryptor_aead<> aead(key, nonce, 64 * 1024);
+    suite.run("streamcryptor_aead_4m", plaintext.size(), 8, [&] {
+        std::istringstream istr(plaintext);
+        std::ostringstream ostr;
+        aead.encrypt(istr, ostr);
+    });
+
+    sodium::StreamHash hasher(sodium::StreamHash::HASHSIZE, 64 * 1024);
+    suite.run("streamhash_4m", plaintext.size(), 8, [&] {
+        std::istringstream istr(plaintext);
+        hasher.hash(istr);
+    });
+
+    return suite.finish();
+}
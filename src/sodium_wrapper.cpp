@@ -0,0 +1,60 @@
+// sodium_wrapper.cpp -- Explicit instantiations of the sodium-wrapper library
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// The wrappers for the common BT types bytes, chars and
+// bytes_protected, compiled once here instead of in every translation
+// unit that uses them. The headers declare them extern when
+// SODIUM_EXTERN_TEMPLATES is 1 (see extern_templates.h).
+
+#include "aead.h"
+#include "authenticator.h"
+#include "box.h"
+#include "box_precomputed.h"
+#include "box_seal.h"
+#include "decode_filter.h"
+#include "encode_filter.h"
+#include "extern_templates.h"
+#include "hasher_generic.h"
+#include "hasher_generic_keyless.h"
+#include "hasher_short.h"
+#include "secretbox.h"
+#include "secretstream.h"
+#include "signer.h"
+#include "verifier.h"
+
+namespace sodium {
+
+SODIUM_INSTANTIATE_BT(aead);
+SODIUM_INSTANTIATE_BT(authenticator);
+SODIUM_INSTANTIATE_BT(box);
+SODIUM_INSTANTIATE_BT(box_precomputed);
+SODIUM_INSTANTIATE_BT(box_seal);
+SODIUM_INSTANTIATE_BT(hasher_generic);
+SODIUM_INSTANTIATE_BT(hasher_generic_keyless);
+SODIUM_INSTANTIATE_BT(hasher_short);
+SODIUM_INSTANTIATE_BT(secretbox);
+SODIUM_INSTANTIATE_BT(secretstream);
+SODIUM_INSTANTIATE_BT(signer);
+SODIUM_INSTANTIATE_BT(verifier);
+
+template class encode_symmetric_filter<codec_hex>;
+template class encode_symmetric_filter<codec_base64<>>;
+template class decode_symmetric_filter<codec_hex>;
+template class decode_symmetric_filter<codec_base64<>>;
+
+} // namespace sodium
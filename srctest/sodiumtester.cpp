@@ -28,9 +28,11 @@
 #include "nonce.h"
 #include "random.h"
 #include "secretbox.h"
-#include "streamcryptor_aead.h"
+#include "streamcryptor_secretstream.h"
 
+#include <algorithm>
 #include <fstream>
+#include <iterator>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -43,7 +45,7 @@ using sodium::key;
 using sodium::keyvar;
 using sodium::nonce;
 using sodium::secretbox;
-using sodium::streamcryptor_aead;
+using sodium::streamcryptor_secretstream;
 
 #ifndef NDEBUG
 #include <iostream>
@@ -456,19 +458,21 @@ SodiumTester::test4(const std::string& plaintext, const std::string& header)
 }
 
 /**
- * This function tests sodium::streamcryptor_aead:
+ * This function tests sodium::streamcryptor_secretstream:
  *
- * We will test the stream cryptors streamcryptor_aead::encrypt() and
- * streamcryptor_aead::decrypt() on std::ifstream and std::ofstream,
- * i.e. on regular binary files.
+ * We will test the stream cryptors streamcryptor_secretstream::encrypt()
+ * and streamcryptor_secretstream::decrypt() on std::ifstream and
+ * std::ofstream, i.e. on regular binary files.
  *
- * The preparations consist in intantiating a sodium::streamcryptor_aead object.
+ * The preparations consist in intantiating a
+ * sodium::streamcryptor_secretstream object.
  *
  * - we first create a random key with the right number of bytes
- * - we also create a random nonce with the right number of bytes
- * - from this, we create a sodium::streamcryptor_aead strm_crypt;
- *   we also specify a granularity of 1024 bytes to be used for
- *   the chunking.
+ * - from this, we create a sodium::streamcryptor_secretstream strm_crypt,
+ *   with its default chunking: chunks of 64 KiB, read and written 16 at
+ *   a time, with a secretstream rekey every 1024 chunks (64 MiB).
+ *   There is no nonce to manage: encrypt() starts every stream with a
+ *   fresh random secretstream header, and writes it to the output.
  * - since we squirreled away a copy of the key in strm_crypt, we disable
  *   access to our local key (not needed anymore here).
  *
@@ -482,35 +486,27 @@ SodiumTester::test4(const std::string& plaintext, const std::string& header)
  *   output stream ofs
  * - then we close the streams. We're done chunkwise encrypting.
  *
- * We finally want to chunkwise decrypt the encrypted file.
+ * We then want to chunkwise decrypt the encrypted file.
  *
  * - we open the encrypted file for reading in binary mode: ifs2.
  * - we open a file for writing in binary mode: ofs2
  *   (same name, with .dec appended).
- * - since ifs2 and ofs2 are also std::istream resp. std::ostream, we
- *   can directly chunkwise decrypt the input stream into the output
- *   stream.
- * - we reuse the same sodium::streamcryptor_aead object strm_crypt, which
- *   already contains the good key, the right initial nonce, and
- *   the correct blocksize (the decryption takes care to adjust the
- *   block size with MACSIZE, the added MACs for each chunk, automatically).
- * - if the decryption fails for some reason, we throw an error and exit.
- * - the decrypt() function writes to the output stream, i.e. to ofs2,
- *   direcly to the output file.
+ * - we reuse the same sodium::streamcryptor_secretstream object
+ *   strm_crypt, which already contains the good key; the header and
+ *   the chunk size are read from the encrypted file.
+ * - if the decryption fails for some reason (wrong key, corrupted,
+ *   truncated or extended file), decrypt() throws and we exit.
  * - then we close the streams. We're done chunkwise decrypting.
  *
- * Exercise: compare original file with decrypted file... (NYI).
+ * Finally, we compare the original file with the decrypted file.
  *
  **/
 
 bool
 SodiumTester::test5(const std::string& filename)
 {
-    std::size_t MYBLKSIZE = 1024;
-
-    aead<>::key_type key;
-    aead<>::nonce_type nonce;
-    streamcryptor_aead<> strm_crypt(key, nonce, MYBLKSIZE);
+    streamcryptor_secretstream<>::key_type key;
+    streamcryptor_secretstream<> strm_crypt(key);
 
     key.noaccess();
 
@@ -539,9 +535,6 @@ SodiumTester::test5(const std::string& filename)
             "SodiumTester::test5() can't open second input or output files"
         };
 
-    // we reuse str_crypt from above: it has saved inside it
-    // key, (initial) nonce and the blocksize, so we're safe.
-
     // now do the decryption
     strm_crypt.decrypt(ifs2, ofs2);
 
@@ -549,7 +542,15 @@ SodiumTester::test5(const std::string& filename)
     ofs2.close();
     ifs2.close();
 
-    return true;
+    // -------------------- compare original and decrypted -----------------
+
+    std::ifstream orig(filename, std::ios_base::binary);
+    std::ifstream dec(filename + ".dec", std::ios_base::binary);
+
+    return std::equal(std::istreambuf_iterator<char>(orig),
+                      std::istreambuf_iterator<char>(),
+                      std::istreambuf_iterator<char>(dec),
+                      std::istreambuf_iterator<char>());
 }
 
 bool
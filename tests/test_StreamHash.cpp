@@ -22,10 +22,14 @@
 
 #include "keyvar.h"
 #include "streamhash.h"
+#include "thread_pool.h"
+#include "tree_hash.h"
 #include <algorithm>
+#include <cstdint>
 #include <sodium.h>
 #include <sstream>
 #include <string>
+#include <vector>
 
 using sodium::StreamHash;
 using bytes = sodium::bytes;
@@ -113,6 +117,53 @@ compare_both_hashes(const std::string& plaintext)
     return hash1 == hash2;
 }
 
+// straightforward serial implementation of the tree hash of tree_hash.h
+bytes
+reference_tree_hash(const StreamHash::key_type& key,
+                    const std::string& plaintext,
+                    const std::size_t leafsize)
+{
+    auto le64 = [](std::uint64_t value) {
+        bytes result(8);
+        for (std::size_t i = 0; i != 8; ++i)
+            result[i] = static_cast<unsigned char>(value >> (8 * i));
+        return result;
+    };
+
+    bytes root_input{ 0x01 };
+    bytes leafsize_le = le64(leafsize);
+    root_input.insert(root_input.end(), leafsize_le.begin(), leafsize_le.end());
+
+    for (std::size_t i = 0; i * leafsize < plaintext.size(); ++i) {
+        bytes leaf{ 0x00 };
+        bytes index_le = le64(i);
+        leaf.insert(leaf.end(), index_le.begin(), index_le.end());
+        std::string chunk = plaintext.substr(i * leafsize, leafsize);
+        leaf.insert(leaf.end(), chunk.begin(), chunk.end());
+
+        bytes leaf_hash(sodium::tree_hash::LEAF_HASHSIZE);
+        crypto_generichash(leaf_hash.data(),
+                           leaf_hash.size(),
+                           leaf.data(),
+                           leaf.size(),
+                           key.data(),
+                           key.size());
+        root_input.insert(root_input.end(), leaf_hash.begin(), leaf_hash.end());
+    }
+
+    bytes total_le = le64(plaintext.size());
+    root_input.insert(root_input.end(), total_le.begin(), total_le.end());
+
+    bytes root(hashsize);
+    crypto_generichash(root.data(),
+                       root.size(),
+                       root_input.data(),
+                       root_input.size(),
+                       key.data(),
+                       key.size());
+    return root;
+}
+
 struct SodiumFixture
 {
     SodiumFixture()
@@ -171,4 +222,64 @@ BOOST_AUTO_TEST_CASE(sodium_streamhash_test_compare_hashes_empty_plaintext)
     BOOST_CHECK(compare_both_hashes(plaintext));
 }
 
+BOOST_AUTO_TEST_CASE(sodium_streamhash_test_tree_hash_matches_reference)
+{
+    StreamHash::key_type key(StreamHash::KEYSIZE);
+    StreamHash hasher{ key, hashsize, blocksize };
+    sodium::thread_pool pool(3);
+
+    for (std::size_t size : { 0UL, 1UL, 99UL, 100UL, 101UL, 2500UL }) {
+        std::string plaintext(size, '\0');
+        randombytes_buf(plaintext.data(), plaintext.size());
+        bytes expected = reference_tree_hash(key, plaintext, 100);
+
+        std::istringstream istr(plaintext);
+        BOOST_CHECK(hasher.hash(istr, pool, 100) == expected);
+
+        // the tree doesn't depend on the number of threads or the window
+        sodium::thread_pool pool1(1);
+        sodium::tree_hash tree(key, hashsize, 100, pool1, 1);
+        for (char c : plaintext) // one byte at a time
+            tree.update(reinterpret_cast<const unsigned char*>(&c), 1);
+        bytes result(hashsize);
+        tree.final(result.data());
+        BOOST_CHECK(result == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_streamhash_test_tree_hash_keyless)
+{
+    StreamHash::key_type nokey{ 0, false };
+    StreamHash hasher{ hashsize, blocksize };
+    sodium::thread_pool pool(2);
+
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+
+    std::istringstream istr(plaintext);
+    BOOST_CHECK(hasher.hash(istr, pool, 10) ==
+                reference_tree_hash(nokey, plaintext, 10));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_streamhash_test_tree_hash_depends_on_leafsize)
+{
+    StreamHash::key_type key(StreamHash::KEYSIZE);
+    StreamHash hasher{ key, hashsize, blocksize };
+    sodium::thread_pool pool(2);
+
+    std::string plaintext(1000, 'A');
+
+    std::istringstream istr1(plaintext);
+    std::istringstream istr2(plaintext);
+    std::istringstream istr3(plaintext);
+    bytes tree100 = hasher.hash(istr1, pool, 100);
+    bytes tree200 = hasher.hash(istr2, pool, 200);
+    bytes flat = hasher.hash(istr3);
+
+    BOOST_CHECK(tree100 != tree200);
+    BOOST_CHECK(tree100 != flat);
+
+    std::istringstream istr4(plaintext);
+    BOOST_CHECK_THROW(hasher.hash(istr4, pool, 0), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
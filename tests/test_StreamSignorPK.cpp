@@ -23,10 +23,13 @@
 #include "keypairsign.h"
 #include "streamsignorpk.h"
 #include "streamverifierpk.h"
+#include <filesystem>
+#include <fstream>
 #include <string>
 // #include <algorithm>
 #include <sodium.h>
 #include <sstream>
+#include <stdexcept>
 
 using sodium::keypairsign;
 using sodium::StreamSignorPK;
@@ -295,4 +298,73 @@ BOOST_AUTO_TEST_CASE(sodium_streamsignorpk_test_small_plaintext)
     BOOST_CHECK(sc_verifier.verify(istr_received, signature));
 }
 
+BOOST_AUTO_TEST_CASE(sodium_streamsignorpk_test_pipelined)
+{
+    keypairsign<> keypair_alice{};
+    StreamSignorPK sc_signor(keypair_alice.private_key(), blocksize);
+    StreamVerifierPK sc_verifier(keypair_alice.public_key(), blocksize);
+
+    for (std::size_t size : { 0, 1, 7, 8, 9, 128, 129, 5000 }) {
+        std::string plaintext(size, 'A');
+        for (std::size_t i = 0; i != size; ++i)
+            plaintext[i] = static_cast<char>(i * 7);
+
+        std::istringstream istr(plaintext);
+        bytes signature = sc_signor.sign(istr);
+
+        for (std::size_t window : { 1, 3, 16 }) {
+            std::istringstream istr_pipelined(plaintext);
+            BOOST_CHECK(sc_signor.sign_pipelined(istr_pipelined, 2, window) ==
+                        signature);
+
+            std::istringstream istr_received(plaintext);
+            BOOST_CHECK(sc_verifier.verify_pipelined(
+              istr_received, signature, 3, window));
+        }
+
+        // a falsified signature
+        bytes falsified{ signature };
+        ++falsified[0];
+        std::istringstream istr_falsified(plaintext);
+        BOOST_CHECK(!sc_verifier.verify_pipelined(istr_falsified, falsified));
+    }
+
+    std::istringstream istr("CPE1704TKS");
+    BOOST_CHECK_THROW(sc_signor.sign_pipelined(istr, 2, 0), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_streamsignorpk_test_mmap)
+{
+    namespace fs = std::filesystem;
+
+    keypairsign<> keypair_alice{};
+    StreamSignorPK sc_signor(keypair_alice.private_key(), blocksize);
+    StreamVerifierPK sc_verifier(keypair_alice.public_key(), blocksize);
+
+    const fs::path path = fs::temp_directory_path() /
+                          ("test_StreamSignorPK." +
+                           std::to_string(randombytes_random()));
+
+    for (std::size_t size : { 0, 1, 10, 100000 }) {
+        std::string plaintext(size, 'x');
+        {
+            std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+            ofs.write(plaintext.data(), plaintext.size());
+        }
+
+        std::istringstream istr(plaintext);
+        bytes signature = sc_signor.sign(istr);
+        BOOST_CHECK(sc_signor.sign(path.string()) == signature);
+        BOOST_CHECK(sc_verifier.verify(path.string(), signature));
+
+        bytes falsified{ signature };
+        ++falsified[10];
+        BOOST_CHECK(!sc_verifier.verify(path.string(), falsified));
+        BOOST_CHECK(!sc_verifier.verify(path.string(), bytes(10)));
+    }
+    fs::remove(path);
+
+    BOOST_CHECK_THROW(sc_signor.sign(path.string()), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -24,10 +24,14 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include "aead.h"
+#include "thread_pool.h"
+#include <algorithm>
 #include <chrono>
+#include <future>
 #include <sodium.h>
 #include <sstream>
 #include <string>
+#include <vector>
 
 constexpr unsigned long TEST_TIMING_COUNT_DEFAULT = 10000UL;
 constexpr std::size_t TEST_TIMING_HEADER_SIZE_DEFAULT = 350;
@@ -229,6 +233,166 @@ timing_encrypt_decrypt_detached(
     BOOST_TEST_MESSAGE(oss.str());
 }
 
+template<typename BT = sodium::bytes,
+         typename F = sodium::aead_xchacha20_poly1305_ietf>
+bool
+test_of_correctness_span(const std::string& header,
+                         const std::string& plaintext,
+                         bool falsify_ciphertext = false)
+{
+    using aead_type = sodium::aead<BT, F>;
+
+    aead_type sc;                         // with random key
+    typename aead_type::nonce_type nonce; // random nonce
+
+    BT plainblob{ plaintext.cbegin(), plaintext.cend() };
+    BT headerblob{ header.cbegin(), header.cend() };
+
+    // combined mode must agree with the allocating version
+    BT ciphertext(aead_type::MACSIZE + plainblob.size());
+    if (sc.encrypt(ciphertext, headerblob, plainblob, nonce) != 0)
+        return false;
+    if (ciphertext != sc.encrypt(headerblob, plainblob, nonce))
+        return false;
+
+    if (falsify_ciphertext)
+        ++ciphertext[0];
+
+    BT decrypted(plainblob.size());
+    if (sc.decrypt(decrypted, headerblob, ciphertext, nonce) != 0)
+        return false;
+    if (decrypted != plainblob)
+        return false;
+
+    // in-place, combined mode
+    BT buffer(aead_type::MACSIZE + plainblob.size());
+    std::copy(plainblob.cbegin(), plainblob.cend(), buffer.begin());
+    if (sc.encrypt(buffer,
+                   headerblob,
+                   sodium::span<const sodium::byte>(
+                     reinterpret_cast<const sodium::byte*>(buffer.data()),
+                     plainblob.size()),
+                   nonce) != 0)
+        return false;
+    if (buffer != ciphertext)
+        return false;
+    if (sc.decrypt(buffer, headerblob, buffer, nonce) != 0)
+        return false;
+    if (!std::equal(plainblob.cbegin(), plainblob.cend(), buffer.cbegin()))
+        return false;
+
+    // in-place, detached mode
+    BT mac(aead_type::MACSIZE);
+    buffer = plainblob;
+    if (sc.encrypt(buffer, mac, headerblob, buffer, nonce) != 0)
+        return false;
+    if (sc.decrypt(buffer, headerblob, buffer, mac, nonce) != 0)
+        return false;
+
+    return buffer == plainblob;
+}
+
+template<typename BT = sodium::bytes,
+         typename F = sodium::aead_xchacha20_poly1305_ietf>
+void
+test_of_span_errors()
+{
+    using aead_type = sodium::aead<BT, F>;
+
+    aead_type sc;
+    typename aead_type::nonce_type nonce;
+
+    BT header(10);
+    BT plaintext(100);
+    BT too_small(aead_type::MACSIZE + plaintext.size() - 1);
+    BT ciphertext(aead_type::MACSIZE + plaintext.size());
+    BT wrong_mac(aead_type::MACSIZE + 1);
+
+    BOOST_CHECK_EQUAL(sc.encrypt(too_small, header, plaintext, nonce), -1);
+    BOOST_CHECK_EQUAL(
+      sc.encrypt(plaintext, wrong_mac, header, plaintext, nonce), -1);
+
+    BOOST_CHECK_EQUAL(sc.encrypt(ciphertext, header, plaintext, nonce), 0);
+    BT short_plaintext(plaintext.size() - 1);
+    BOOST_CHECK_EQUAL(
+      sc.decrypt(short_plaintext, header, ciphertext, nonce), -1);
+    BOOST_CHECK_EQUAL(sc.decrypt(plaintext, header, too_small, nonce), -1);
+
+    // falsified header
+    ++header[0];
+    BOOST_CHECK_EQUAL(sc.decrypt(plaintext, header, ciphertext, nonce), -1);
+}
+
+template<typename BT = sodium::bytes,
+         typename F = sodium::aead_xchacha20_poly1305_ietf>
+void
+test_of_padded()
+{
+    using aead_type = sodium::aead<BT, F>;
+    constexpr std::size_t blocksize = 16;
+
+    aead_type sc;
+    typename aead_type::nonce_type nonce;
+    std::string header{ "the head" };
+    std::string pt{ "the quick brown fox jumps over the lazy dog" };
+    BT plaintext(pt.cbegin(), pt.cend());
+
+    // same as encrypt() of the padded plaintext
+    BT ciphertext(sodium::padded_size(pt.size(), blocksize) +
+                  aead_type::MACSIZE + 7);
+    std::size_t clen = 0;
+    BOOST_CHECK_EQUAL(
+      sc.encrypt_padded(ciphertext, header, pt, blocksize, nonce, clen), 0);
+    BOOST_CHECK_EQUAL(clen, 48 + aead_type::MACSIZE);
+    BT header_bt(header.cbegin(), header.cend());
+    BOOST_CHECK(BT(ciphertext.cbegin(), ciphertext.cbegin() + clen) ==
+                sc.encrypt(header_bt, sodium::pad(plaintext, blocksize), nonce));
+
+    BT decrypted(clen - aead_type::MACSIZE);
+    std::size_t plen = 0;
+    BOOST_CHECK_EQUAL(sc.decrypt_padded(decrypted,
+                                        header,
+                                        sodium::span<const sodium::byte>(
+                                          ciphertext.data(), clen),
+                                        blocksize,
+                                        nonce,
+                                        plen),
+                      0);
+    BOOST_CHECK_EQUAL(plen, pt.size());
+    BOOST_CHECK(BT(decrypted.cbegin(), decrypted.cbegin() + plen) == plaintext);
+
+    // in place: the plaintext already sits in the output buffer
+    BT inplace(plaintext);
+    inplace.resize(clen);
+    BOOST_CHECK_EQUAL(
+      sc.encrypt_padded(inplace,
+                        header,
+                        sodium::span<const sodium::byte>(
+                          reinterpret_cast<const sodium::byte*>(inplace.data()),
+                          pt.size()),
+                        blocksize,
+                        nonce,
+                        clen),
+      0);
+    BOOST_CHECK(BT(ciphertext.cbegin(), ciphertext.cbegin() + clen) == inplace);
+
+    // too small, or falsified
+    BOOST_CHECK_EQUAL(sc.encrypt_padded(sodium::span<sodium::byte>(inplace)
+                                          .first(clen - 1),
+                                        header,
+                                        pt,
+                                        blocksize,
+                                        nonce,
+                                        clen),
+                      -1);
+    BOOST_CHECK_EQUAL(
+      sc.encrypt_padded(ciphertext, header, pt, 0, nonce, clen), -1);
+    ++inplace[3];
+    BOOST_CHECK_EQUAL(
+      sc.decrypt_padded(decrypted, header, inplace, blocksize, nonce, plen),
+      -1);
+}
+
 struct SodiumFixture
 {
     SodiumFixture()
@@ -1607,6 +1771,111 @@ BOOST_AUTO_TEST_CASE(sodium_aead_test_timing_aead_aead_aesgcm_precomputed)
                                     sodium::aead_aesgcm_precomputed>();
 }
 
+// ---- span-based, allocation-free overloads ---------------------------
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_span_xchacha20_poly1305_ietf)
+{
+    std::string header{ "the head" };
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+
+    BOOST_TEST(test_of_correctness_span(header, plaintext));
+    BOOST_TEST(test_of_correctness_span(std::string(), plaintext));
+    BOOST_TEST(test_of_correctness_span(header, std::string()));
+    BOOST_TEST(!test_of_correctness_span(header, plaintext, true));
+
+    test_of_span_errors();
+}
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_span_chacha20_poly1305)
+{
+    std::string header{ "the head" };
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+
+    BOOST_TEST((test_of_correctness_span<sodium::bytes,
+                                         sodium::aead_chacha20_poly1305>(
+      header, plaintext)));
+    BOOST_TEST((test_of_correctness_span<sodium::bytes_protected,
+                                         sodium::aead_chacha20_poly1305_ietf>(
+      header, plaintext)));
+
+    test_of_span_errors<sodium::bytes, sodium::aead_chacha20_poly1305>();
+}
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_span_aesgcm)
+{
+    std::string header{ "the head" };
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+
+    BOOST_TEST((test_of_correctness_span<sodium::bytes, sodium::aead_aesgcm>(
+      header, plaintext)));
+    BOOST_TEST((test_of_correctness_span<sodium::bytes,
+                                         sodium::aead_aesgcm_precomputed>(
+      header, plaintext)));
+    BOOST_TEST((!test_of_correctness_span<sodium::bytes,
+                                          sodium::aead_aesgcm_precomputed>(
+      header, plaintext, true)));
+
+    test_of_span_errors<sodium::bytes, sodium::aead_aesgcm_precomputed>();
+}
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_aesgcm_precomputed_shared_context)
+{
+    using aead_type =
+      sodium::aead<sodium::bytes, sodium::aead_aesgcm_precomputed>;
+
+    if (crypto_aead_aes256gcm_is_available() == 0) {
+        BOOST_TEST_MESSAGE("AES-GCM not available: skipping test.");
+        return;
+    }
+
+    aead_type::key_type key;
+    aead_type::context_type context = aead_type::make_context(key);
+    const aead_type reference(key);
+
+    // copies and aeads built from the same context share one state
+    const aead_type sc1(context);
+    const aead_type sc2(sc1);
+    BOOST_TEST((sc1.context() == context && sc2.context() == context));
+    BOOST_CHECK_THROW(aead_type(aead_type::context_type()),
+                      std::runtime_error);
+
+    std::string pt{ "the quick brown fox jumps over the lazy dog" };
+    sodium::bytes header{ 'h', 'e', 'a', 'd' };
+    sodium::bytes plaintext{ pt.cbegin(), pt.cend() };
+
+    // many threads encrypt and decrypt concurrently with one context
+    sodium::thread_pool pool(4);
+    std::vector<std::future<bool>> results;
+    for (int i = 0; i != 64; ++i)
+        results.push_back(pool.submit([&] {
+            aead_type sc(context);
+            aead_type::nonce_type nonce;
+            sodium::bytes ciphertext = sc.encrypt(header, plaintext, nonce);
+            sodium::bytes mac(aead_type::MACSIZE);
+            sodium::bytes detached =
+              sc.encrypt(header, plaintext, nonce, mac);
+
+            return ciphertext == reference.encrypt(header, plaintext, nonce) &&
+                   sc.decrypt(header, ciphertext, nonce) == plaintext &&
+                   sc.decrypt(header, detached, nonce, mac) == plaintext;
+        }));
+    for (auto& result : results)
+        BOOST_TEST(result.get());
+
+    // the aeads keep the context alive after the last other handle
+    context.reset();
+    aead_type::nonce_type nonce;
+    BOOST_TEST(sc2.decrypt(header, sc1.encrypt(header, plaintext, nonce),
+                           nonce) == plaintext);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_padded)
+{
+    test_of_padded();
+    test_of_padded<sodium::bytes_protected, sodium::aead_chacha20_poly1305>();
+    test_of_padded<sodium::bytes, sodium::aead_aesgcm_precomputed>();
+}
+
 // XXX TODO: Test that other types for F are being rejected at compile-time.
 
 BOOST_AUTO_TEST_SUITE_END()
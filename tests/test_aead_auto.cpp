@@ -0,0 +1,176 @@
+// test_aead_auto.cpp -- Test sodium::aead_auto
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::aead_auto Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "aead_auto.h"
+#include "common.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <sodium.h>
+
+using sodium::aead_auto;
+using bytes = sodium::bytes;
+using algorithm = aead_auto<>::algorithm;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_auto_preferred)
+{
+    const algorithm expected = crypto_aead_aes256gcm_is_available()
+                                 ? algorithm::aesgcm
+                                 : algorithm::xchacha20_poly1305_ietf;
+    BOOST_CHECK(aead_auto<>::preferred() == expected);
+    BOOST_CHECK(aead_auto<>::available(algorithm::xchacha20_poly1305_ietf));
+
+    aead_auto<>::key_type key;
+    aead_auto<> aa(key);
+    BOOST_CHECK(aa.chosen() == expected);
+    BOOST_TEST_MESSAGE("aead_auto: " << aead_auto<>::name(aa.chosen()));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_auto_matches_aead)
+{
+    aead_auto<>::key_type key;
+    aead_auto<>::nonce_type nonce;
+    std::string text{ "the quick brown fox jumps over the lazy dog" };
+    bytes plaintext{ text.cbegin(), text.cend() };
+    bytes header{ 'h', 'e', 'a', 'd' };
+
+    // XChaCha20: the same as sodium::aead<>, after the tag
+    aead_auto<> xchacha(key, algorithm::xchacha20_poly1305_ietf);
+    bytes ciphertext = xchacha.encrypt(header, plaintext, nonce);
+    BOOST_CHECK_EQUAL(ciphertext.size(),
+                      aead_auto<>::TAGSIZE + aead_auto<>::MACSIZE +
+                        plaintext.size());
+    BOOST_CHECK_EQUAL(ciphertext[0], 3);
+    BOOST_CHECK(bytes(ciphertext.cbegin() + 1, ciphertext.cend()) ==
+                sodium::aead<>(key).encrypt(header, plaintext, nonce));
+    BOOST_CHECK(xchacha.decrypt(header, ciphertext, nonce) == plaintext);
+
+    if (!aead_auto<>::available(algorithm::aesgcm)) {
+        BOOST_CHECK_THROW(aead_auto<>(key, algorithm::aesgcm),
+                          std::runtime_error);
+        return;
+    }
+
+    // AES-GCM: uses the first 12 bytes of the nonce
+    using aesgcm = sodium::aead<bytes, sodium::aead_aesgcm>;
+    aead_auto<> gcm(key, algorithm::aesgcm);
+    bytes ciphertext2 = gcm.encrypt(header, plaintext, nonce);
+    BOOST_CHECK_EQUAL(ciphertext2[0], 4);
+    BOOST_CHECK(bytes(ciphertext2.cbegin() + 1, ciphertext2.cend()) ==
+                aesgcm(key).encrypt(
+                  header, plaintext, aesgcm::nonce_type(nonce.data())));
+
+    // both sides decrypt both constructions
+    BOOST_CHECK(gcm.decrypt(header, ciphertext, nonce) == plaintext);
+    BOOST_CHECK(xchacha.decrypt(header, ciphertext2, nonce) == plaintext);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_auto_falsified)
+{
+    aead_auto<>::key_type key;
+    aead_auto<>::nonce_type nonce;
+    aead_auto<> aa(key);
+    std::string text{ "the quick brown fox jumps over the lazy dog" };
+    bytes plaintext{ text.cbegin(), text.cend() };
+    bytes header{ 'h', 'e', 'a', 'd' };
+    const bytes ciphertext = aa.encrypt(header, plaintext, nonce);
+
+    // the tag: switched to the other construction, or unknown
+    bytes falsified{ ciphertext };
+    falsified[0] = (falsified[0] == 3) ? 4 : 3;
+    BOOST_CHECK_THROW(aa.decrypt(header, falsified, nonce), std::runtime_error);
+    falsified[0] = 42;
+    BOOST_CHECK_THROW(aa.decrypt(header, falsified, nonce), std::runtime_error);
+
+    // the ciphertext, the header, the nonce
+    falsified = ciphertext;
+    ++falsified[5];
+    BOOST_CHECK_THROW(aa.decrypt(header, falsified, nonce), std::runtime_error);
+    BOOST_CHECK_THROW(aa.decrypt(bytes{}, ciphertext, nonce),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(aa.decrypt(header, ciphertext, nonce + 1),
+                      std::runtime_error);
+
+    // the span API returns codes
+    bytes out(plaintext.size());
+    BOOST_CHECK_EQUAL(aa.decrypt(sodium::span<sodium::byte>(out),
+                                 header,
+                                 ciphertext,
+                                 nonce),
+                      0);
+    BOOST_CHECK(out == plaintext);
+    BOOST_CHECK_EQUAL(aa.decrypt(sodium::span<sodium::byte>(out),
+                                 header,
+                                 falsified,
+                                 nonce),
+                      -1);
+    BOOST_CHECK_EQUAL(aa.encrypt(sodium::span<sodium::byte>(out),
+                                 header,
+                                 plaintext,
+                                 nonce),
+                      -1); // too small
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_auto_shared_key)
+{
+    aead_auto<>::key_type key;
+    aead_auto<>::nonce_type nonce;
+    bytes plaintext{ 'a', 'b', 'c' };
+    bytes header{ 'h', 'e', 'a', 'd' };
+
+    // copies share the key, instead of duplicating it
+    aead_auto<> aa(key, algorithm::xchacha20_poly1305_ietf);
+    aead_auto<> copy{ aa };
+    BOOST_CHECK(copy.key_handle() == aa.key_handle());
+    BOOST_CHECK(*aa.key_handle() == key);
+
+    // and so do sodium::aead<> and aead_auto over the same shared key
+    sodium::aead<> plain(aa.key_handle());
+    aead_auto<> shared(plain.key_handle(),
+                       algorithm::xchacha20_poly1305_ietf);
+    BOOST_CHECK(shared.key_handle() == aa.key_handle());
+    BOOST_CHECK(shared.decrypt(header,
+                               aa.encrypt(header, plaintext, nonce),
+                               nonce) == plaintext);
+
+    BOOST_CHECK_THROW(aead_auto<>(aead_auto<>::shared_key_type{}),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
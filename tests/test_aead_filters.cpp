@@ -23,6 +23,7 @@
 #include "aead_decrypt_filter.h"
 #include "aead_encrypt_filter.h"
 #include "common.h"
+#include "trace.h"
 
 #include <algorithm>
 #include <stdexcept>
@@ -752,4 +753,42 @@ BOOST_AUTO_TEST_CASE(
     BOOST_CHECK(result);
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_aead_filters_chain_shares_key)
+{
+    std::string header{ "the header" };
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    chars headerblob{ header.cbegin(), header.cend() };
+    chars plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    aead_encrypt_filter::nonce_type nonce;
+    aead crypt{ aead_encrypt_filter::key_type() };
+
+    // copies of the aead share its key
+    aead copy{ crypt };
+    BOOST_CHECK(copy.key_handle() == crypt.key_handle());
+    BOOST_CHECK_THROW(aead{ aead::shared_key_type() }, std::runtime_error);
+
+    // building and running the filter chain doesn't allocate any
+    // protected memory, even though Boost.Iostreams copies the filters
+    sodium::trace::reset_counters();
+
+    aead_encrypt_filter encrypt_filter{ crypt, nonce, headerblob };
+    aead_decrypt_filter decrypt_filter{ crypt, nonce, headerblob };
+    chars decrypted(plainblob.size());
+    {
+        io::array_sink sink{ decrypted.data(), decrypted.size() };
+        io::filtering_ostream os{};
+        os.push(encrypt_filter);
+        os.push(decrypt_filter);
+        os.push(sink);
+        os.write(plainblob.data(), plainblob.size());
+        os.flush();
+        os.pop();
+    }
+
+    BOOST_CHECK(decrypted == plainblob);
+    BOOST_CHECK_EQUAL(sodium::trace::value("sodium::allocator::allocate()"),
+                      0UL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,249 @@
+// test_aead_multi.cpp -- Test sodium::aead_multi<>
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::aead_multi Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "aead_multi.h"
+#include "common.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::byte;
+using sodium::bytes;
+using sodium::span;
+
+/**
+ * A batch of n lanes of sizes 0..511, over nkeys keys (adjacent lanes
+ * share a key), with their plaintexts, headers and output buffers.
+ **/
+
+template<typename F>
+struct batch
+{
+    using multi_type = sodium::aead_multi<F>;
+    using lane_type = typename multi_type::lane_type;
+
+    batch(std::size_t n, std::size_t nkeys)
+      : keys(nkeys)
+      , nonces(n)
+      , plaintexts(n)
+      , headers(n)
+      , ciphertexts(n)
+      , decrypted(n)
+    {
+        for (std::size_t i = 0; i != n; ++i) {
+            plaintexts[i] = sodium::randombytes_buf(i * 37 % 512);
+            headers[i] = sodium::randombytes_buf(i % 3 == 0 ? 0 : 13);
+            ciphertexts[i].resize(plaintexts[i].size() + multi_type::MACSIZE);
+            decrypted[i].resize(plaintexts[i].size());
+        }
+    }
+
+    const typename multi_type::key_type& key_of(std::size_t i) const
+    {
+        return keys[i * keys.size() / nonces.size()];
+    }
+
+    std::vector<lane_type> encrypt_lanes()
+    {
+        std::vector<lane_type> lanes;
+        for (std::size_t i = 0; i != nonces.size(); ++i)
+            lanes.push_back(lane_type{ &key_of(i),
+                                       &nonces[i],
+                                       span<const byte>(headers[i]),
+                                       span<const byte>(plaintexts[i]),
+                                       span<byte>(ciphertexts[i]) });
+        return lanes;
+    }
+
+    std::vector<lane_type> decrypt_lanes()
+    {
+        std::vector<lane_type> lanes;
+        for (std::size_t i = 0; i != nonces.size(); ++i)
+            lanes.push_back(lane_type{ &key_of(i),
+                                       &nonces[i],
+                                       span<const byte>(headers[i]),
+                                       span<const byte>(ciphertexts[i]),
+                                       span<byte>(decrypted[i]) });
+        return lanes;
+    }
+
+    // each lane is the same as a single aead<>::encrypt()
+    bool same_as_aead() const
+    {
+        for (std::size_t i = 0; i != nonces.size(); ++i) {
+            const sodium::aead<bytes, F> aead(key_of(i));
+            bytes expected(ciphertexts[i].size());
+            if (aead.encrypt(expected, headers[i], plaintexts[i], nonces[i]) !=
+                  0 ||
+                expected != ciphertexts[i])
+                return false;
+        }
+        return true;
+    }
+
+    std::vector<typename multi_type::key_type> keys;
+    std::vector<typename multi_type::nonce_type> nonces;
+    std::vector<bytes> plaintexts;
+    std::vector<bytes> headers;
+    std::vector<bytes> ciphertexts;
+    std::vector<bytes> decrypted;
+};
+
+template<typename F>
+void
+test_roundtrip(std::size_t n, std::size_t nkeys, sodium::thread_pool* pool)
+{
+    using multi_type = sodium::aead_multi<F>;
+
+    batch<F> b(n, nkeys);
+    const auto elanes = b.encrypt_lanes();
+    BOOST_CHECK_EQUAL(pool ? multi_type::encrypt(elanes, *pool)
+                           : multi_type::encrypt(elanes),
+                      0);
+    BOOST_CHECK(b.same_as_aead());
+
+    const auto dlanes = b.decrypt_lanes();
+    bytes verified(n, 0);
+    BOOST_CHECK_EQUAL(pool ? multi_type::decrypt(dlanes, verified, *pool)
+                           : multi_type::decrypt(dlanes, verified),
+                      0);
+    BOOST_CHECK(std::count(verified.begin(), verified.end(), 1) ==
+                static_cast<long>(n));
+    BOOST_CHECK(b.decrypted == b.plaintexts);
+
+    // tampered lanes fail, the others still decrypt
+    if (n > 7) {
+        b.ciphertexts[3][0] ^= 1;
+        b.ciphertexts[7].back() ^= 1;
+        b.decrypted = std::vector<bytes>(n);
+        for (std::size_t i = 0; i != n; ++i)
+            b.decrypted[i].resize(b.plaintexts[i].size());
+        const auto tlanes = b.decrypt_lanes();
+        BOOST_CHECK_EQUAL(pool ? multi_type::decrypt(tlanes, verified, *pool)
+                               : multi_type::decrypt(tlanes, verified),
+                          -1);
+        for (std::size_t i = 0; i != n; ++i) {
+            const bool bad = i == 3 || i == 7;
+            BOOST_CHECK_EQUAL(verified[i], bad ? 0 : 1);
+            if (!bad)
+                BOOST_CHECK(b.decrypted[i] == b.plaintexts[i]);
+        }
+    }
+}
+
+template<typename F>
+void
+test_invalid()
+{
+    using multi_type = sodium::aead_multi<F>;
+
+    batch<F> b(10, 2);
+    auto lanes = b.encrypt_lanes();
+    lanes[5].output = lanes[5].output.first(lanes[5].input.size());
+    BOOST_CHECK_EQUAL(multi_type::encrypt(lanes), -1);
+
+    lanes = b.encrypt_lanes();
+    lanes[9].nonce = nullptr;
+    BOOST_CHECK_EQUAL(multi_type::encrypt(lanes), -1);
+
+    // nothing was encrypted
+    BOOST_CHECK(b.ciphertexts[0] == bytes(b.ciphertexts[0].size(), 0));
+
+    lanes = b.encrypt_lanes();
+    BOOST_CHECK_EQUAL(multi_type::encrypt(lanes), 0);
+    auto dlanes = b.decrypt_lanes();
+    bytes verified(10);
+    bytes too_short(9);
+    BOOST_CHECK_EQUAL(multi_type::decrypt(dlanes, too_short), -1);
+    dlanes[2].input = dlanes[2].input.first(multi_type::MACSIZE - 1);
+    BOOST_CHECK_EQUAL(multi_type::decrypt(dlanes, verified), -1);
+
+    // an empty batch is fine
+    BOOST_CHECK_EQUAL(multi_type::encrypt(span<const typename multi_type::
+                                                  lane_type>()),
+                      0);
+}
+
+template<typename F>
+void
+test_all()
+{
+    sodium::thread_pool pool(4);
+
+    test_roundtrip<F>(1, 1, nullptr);
+    test_roundtrip<F>(100, 1, nullptr);
+    test_roundtrip<F>(100, 100, nullptr);
+    test_roundtrip<F>(1000, 10, &pool); // split across pool
+    test_roundtrip<F>(1000, 10, nullptr);
+    test_invalid<F>();
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_multi_chacha20_poly1305_ietf)
+{
+    test_all<sodium::aead_chacha20_poly1305_ietf>();
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_multi_xchacha20_poly1305_ietf)
+{
+    test_all<sodium::aead_xchacha20_poly1305_ietf>();
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_multi_chacha20_poly1305)
+{
+    test_all<sodium::aead_chacha20_poly1305>();
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_multi_aesgcm)
+{
+    using multi_type = sodium::aead_multi<sodium::aead_aesgcm>;
+
+    if (crypto_aead_aes256gcm_is_available() == 0) {
+        // not available: every batch is refused
+        batch<sodium::aead_aesgcm> b(10, 2);
+        const auto lanes = b.encrypt_lanes();
+        BOOST_CHECK_EQUAL(multi_type::encrypt(lanes), -1);
+        return;
+    }
+
+    test_all<sodium::aead_aesgcm>();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,148 @@
+// test_aead_traits.cpp -- Test sodium::aead_traits and secretstream_traits
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::aead_traits Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "aead_traits.h"
+#include "common.h"
+#include "secretstream.h"
+
+#include <cstring>
+#include <string>
+
+#include <sodium.h>
+
+using bytes = sodium::bytes;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+// the registry is the only whitelist of sodium::aead<> and secretstream<>
+static_assert(sodium::is_aead<sodium::aead_xchacha20_poly1305_ietf>,
+              "xchacha20_poly1305_ietf not registered");
+static_assert(sodium::is_aead<sodium::aead_aesgcm_precomputed>,
+              "aesgcm_precomputed not registered");
+static_assert(!sodium::is_aead<int>, "int registered as aead");
+static_assert(!sodium::is_aead<sodium::secretstream_xchacha20_poly1305>,
+              "secretstream registered as aead");
+static_assert(
+  sodium::is_secretstream<sodium::secretstream_xchacha20_poly1305>,
+  "secretstream_xchacha20_poly1305 not registered");
+static_assert(!sodium::is_secretstream<sodium::aead_aesgcm>,
+              "aesgcm registered as secretstream");
+
+// a generic engine, written once for all registered constructions
+template<typename F>
+bool
+roundtrip_with_traits()
+{
+    using traits = sodium::aead_traits<F>;
+    using aead_type = sodium::aead<bytes, F>;
+
+    static_assert(aead_type::NONCESIZE == traits::NPUBBYTES, "nonce size");
+    static_assert(aead_type::KEYSIZE == traits::KEYBYTES, "key size");
+    static_assert(aead_type::MACSIZE == traits::ABYTES, "MAC size");
+
+    if (!traits::available())
+        return true; // nothing to check on this host
+
+    aead_type sc_aead;
+    typename aead_type::nonce_type nonce;
+    bytes header{ 'h', 'd', 'r' };
+    bytes plaintext(traits::BLOCKSIZE, 'x');
+
+    bytes ciphertext = sc_aead.encrypt(header, plaintext, nonce);
+    if (ciphertext.size() != traits::BLOCKSIZE + traits::ABYTES)
+        return false;
+    return sc_aead.decrypt(header, ciphertext, nonce) == plaintext;
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_traits_capabilities)
+{
+    using sodium::aead_traits;
+
+    BOOST_CHECK(aead_traits<sodium::aead_xchacha20_poly1305_ietf>::
+                  random_nonces);
+    BOOST_CHECK(!aead_traits<sodium::aead_chacha20_poly1305_ietf>::
+                  random_nonces);
+    BOOST_CHECK(!aead_traits<sodium::aead_aesgcm>::random_nonces);
+
+    BOOST_CHECK(aead_traits<sodium::aead_aesgcm_precomputed>::
+                  supports_precomputed);
+    BOOST_CHECK(!aead_traits<sodium::aead_aesgcm>::supports_precomputed);
+
+    BOOST_CHECK(aead_traits<sodium::aead_aesgcm>::hw_accelerated);
+    BOOST_CHECK(!aead_traits<sodium::aead_chacha20_poly1305>::hw_accelerated);
+
+    BOOST_CHECK_EQUAL(aead_traits<sodium::aead_aesgcm>::available(),
+                      crypto_aead_aes256gcm_is_available() == 1);
+    BOOST_CHECK(aead_traits<sodium::aead_xchacha20_poly1305_ietf>::available());
+
+    BOOST_CHECK_EQUAL(
+      std::strcmp(aead_traits<sodium::aead_chacha20_poly1305_ietf>::name,
+                  "chacha20_poly1305_ietf"),
+      0);
+
+    // the ids of the on-disk formats
+    BOOST_CHECK_EQUAL(aead_traits<sodium::aead_chacha20_poly1305>::id, 1);
+    BOOST_CHECK_EQUAL(aead_traits<sodium::aead_chacha20_poly1305_ietf>::id,
+                      2);
+    BOOST_CHECK_EQUAL(aead_traits<sodium::aead_xchacha20_poly1305_ietf>::id,
+                      3);
+    BOOST_CHECK_EQUAL(aead_traits<sodium::aead_aesgcm>::id, 4);
+    BOOST_CHECK_EQUAL(aead_traits<sodium::aead_aesgcm_precomputed>::id, 0);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_traits_generic)
+{
+    BOOST_CHECK(roundtrip_with_traits<sodium::aead_chacha20_poly1305>());
+    BOOST_CHECK(roundtrip_with_traits<sodium::aead_chacha20_poly1305_ietf>());
+    BOOST_CHECK(roundtrip_with_traits<sodium::aead_xchacha20_poly1305_ietf>());
+    BOOST_CHECK(roundtrip_with_traits<sodium::aead_aesgcm>());
+    BOOST_CHECK(roundtrip_with_traits<sodium::aead_aesgcm_precomputed>());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretstream_traits)
+{
+    using traits =
+      sodium::secretstream_traits<sodium::secretstream_xchacha20_poly1305>;
+    using secretstream_type = sodium::secretstream<>;
+
+    BOOST_CHECK_EQUAL(secretstream_type::KEYSIZE, traits::KEYBYTES);
+    BOOST_CHECK_EQUAL(secretstream_type::MACSIZE, traits::ABYTES);
+    BOOST_CHECK_EQUAL(secretstream_type::HEADERSIZE, traits::HEADERBYTES);
+    BOOST_CHECK(traits::available());
+    BOOST_CHECK(traits::BLOCKSIZE <= traits::MESSAGEBYTES_MAX);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,247 @@
+// test_asio_buffers.cpp -- Test the Boost.Asio buffer sequence adapters
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::asio_buffers Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "asio_buffers.h"
+#include "authenticator.h"
+#include "common.h"
+#include "hasher_generic.h"
+#include "random.h"
+#include "secretbox.h"
+#include "secretstream.h"
+#include "span.h"
+
+#include <boost/asio/buffer.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+namespace asio = boost::asio;
+
+using sodium::byte;
+using sodium::bytes;
+using sodium::span;
+
+bytes
+random_bytes(std::size_t size)
+{
+    bytes result(size);
+    sodium::randombytes_buf_inplace(result);
+    return result;
+}
+
+// buffers viewing data, cut at the offsets cuts (plus an empty one)
+template<typename Buffer, typename Data>
+std::vector<Buffer>
+split(Data& data, const std::vector<std::size_t>& cuts)
+{
+    std::vector<Buffer> result;
+    std::size_t offset = 0;
+    for (std::size_t cut : cuts) {
+        result.emplace_back(data.data() + offset, cut - offset);
+        offset = cut;
+    }
+    result.emplace_back(data.data() + offset, 0);
+    result.emplace_back(data.data() + offset, data.size() - offset);
+    return result;
+}
+
+// the layouts of a message of size bytes exercised by the tests
+std::vector<std::vector<std::size_t>>
+layouts(std::size_t size)
+{
+    return { {}, { size / 2 }, { 1, size / 3, size / 2, size - 1 } };
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- so long.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_asio_buffers_secretbox)
+{
+    sodium::secretbox<> sb;
+    sodium::secretbox<>::nonce_type nonce;
+
+    const bytes plaintext = random_bytes(1000);
+    bytes expected(plaintext.size() + sodium::secretbox<>::MACSIZE);
+    BOOST_CHECK_EQUAL(
+      sb.encrypt(span<byte>(expected), span<const byte>(plaintext), nonce), 0);
+
+    for (const auto& in_cuts : layouts(plaintext.size()))
+        for (const auto& out_cuts : layouts(expected.size())) {
+            const auto in = split<asio::const_buffer>(plaintext, in_cuts);
+            bytes ciphertext(expected.size());
+            const auto out = split<asio::mutable_buffer>(ciphertext, out_cuts);
+            BOOST_CHECK_EQUAL(sodium::encrypt(sb, out, in, nonce), 0);
+            BOOST_CHECK(ciphertext == expected);
+
+            const auto cin = split<asio::const_buffer>(ciphertext, out_cuts);
+            bytes decrypted(plaintext.size());
+            const auto dout = split<asio::mutable_buffer>(decrypted, in_cuts);
+            BOOST_CHECK_EQUAL(sodium::decrypt(sb, dout, cin, nonce), 0);
+            BOOST_CHECK(decrypted == plaintext);
+
+            ciphertext[7] ^= 0x01;
+            BOOST_CHECK_EQUAL(sodium::decrypt(sb, dout, cin, nonce), -1);
+        }
+
+    // output too small
+    bytes small(expected.size() - 1);
+    BOOST_CHECK_EQUAL(
+      sodium::encrypt(sb, asio::buffer(small), asio::buffer(plaintext), nonce),
+      -1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_asio_buffers_aead)
+{
+    sodium::aead<> sc_aead;
+    sodium::aead<>::nonce_type nonce;
+
+    const bytes header = random_bytes(20);
+    const bytes plaintext = random_bytes(3000);
+    bytes expected(plaintext.size() + sodium::aead<>::MACSIZE);
+    BOOST_CHECK_EQUAL(sc_aead.encrypt(span<byte>(expected),
+                                      span<const byte>(header),
+                                      span<const byte>(plaintext),
+                                      nonce),
+                      0);
+
+    for (const auto& in_cuts : layouts(plaintext.size()))
+        for (const auto& out_cuts : layouts(expected.size())) {
+            const auto in = split<asio::const_buffer>(plaintext, in_cuts);
+            bytes ciphertext(expected.size());
+            const auto out = split<asio::mutable_buffer>(ciphertext, out_cuts);
+            BOOST_CHECK_EQUAL(sodium::encrypt(
+                                sc_aead, out, asio::buffer(header), in, nonce),
+                              0);
+            BOOST_CHECK(ciphertext == expected);
+
+            const auto cin = split<asio::const_buffer>(ciphertext, out_cuts);
+            bytes decrypted(plaintext.size());
+            const auto dout = split<asio::mutable_buffer>(decrypted, in_cuts);
+            BOOST_CHECK_EQUAL(
+              sodium::decrypt(sc_aead, dout, asio::buffer(header), cin, nonce),
+              0);
+            BOOST_CHECK(decrypted == plaintext);
+
+            BOOST_CHECK_EQUAL(
+              sodium::decrypt(sc_aead, dout, asio::const_buffer(), cin, nonce),
+              -1);
+        }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_asio_buffers_too_big_for_the_stack)
+{
+    sodium::secretbox<> sb;
+    sodium::secretbox<>::nonce_type nonce;
+
+    const bytes plaintext = random_bytes(10000);
+    const auto in = split<asio::const_buffer>(plaintext, { 5000 });
+    bytes ciphertext(plaintext.size() + sodium::secretbox<>::MACSIZE);
+
+    // a contiguous output is fine...
+    BOOST_CHECK_EQUAL(
+      sodium::encrypt(sb, asio::buffer(ciphertext), in, nonce), 0);
+
+    // ...but a scattered one would need a large stack buffer
+    const auto out = split<asio::mutable_buffer>(ciphertext, { 5000 });
+    BOOST_CHECK_EQUAL(sodium::encrypt(sb, out, in, nonce), -1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_asio_buffers_secretstream)
+{
+    sodium::secretstream<> pusher;
+    sodium::secretstream<> puller(pusher.key_handle());
+    puller.init_pull(pusher.init_push());
+
+    using tag_type = sodium::secretstream<>::tag_type;
+    const bytes added_data = random_bytes(10);
+
+    for (std::size_t size : { 0, 1, 100, 1000 }) {
+        const bytes plaintext = random_bytes(size);
+        const auto in = split<asio::const_buffer>(plaintext, { size / 2 });
+        bytes ciphertext(size + sodium::secretstream<>::MACSIZE);
+        const auto out = split<asio::mutable_buffer>(
+          ciphertext, { ciphertext.size() / 3 });
+        BOOST_CHECK_EQUAL(sodium::push(pusher,
+                                       out,
+                                       in,
+                                       asio::buffer(added_data),
+                                       tag_type::TAG_PUSH),
+                          0);
+
+        bytes decrypted(size);
+        tag_type tag = tag_type::TAG_MESSAGE;
+        const auto cin = split<asio::const_buffer>(ciphertext, { 3 });
+        BOOST_CHECK_EQUAL(
+          sodium::pull(puller,
+                       split<asio::mutable_buffer>(decrypted, { size / 4 }),
+                       tag,
+                       cin,
+                       asio::buffer(added_data)),
+          0);
+        BOOST_CHECK(decrypted == plaintext);
+        BOOST_CHECK(tag == tag_type::TAG_PUSH);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_asio_buffers_mac_and_hash)
+{
+    const bytes plaintext = random_bytes(5000);
+    const auto in = split<asio::const_buffer>(plaintext, { 1, 64, 129, 4000 });
+
+    sodium::authenticator<> auth;
+    const auto mac = sodium::mac(auth, in);
+    BOOST_CHECK(mac == auth.mac_fixed(plaintext));
+    BOOST_CHECK(sodium::verify(auth, in, mac));
+    BOOST_CHECK(!sodium::verify(auth, asio::buffer(plaintext, 4999), mac));
+
+    sodium::poly1305_key_type key;
+    sodium::poly1305_mac_type expected;
+    crypto_onetimeauth(
+      expected.data(), plaintext.data(), plaintext.size(), key.data());
+    BOOST_CHECK(sodium::poly1305_mac(key, in) == expected);
+
+    sodium::hasher_generic<> hasher;
+    bytes hash(sodium::hasher_generic<>::HASHSIZE);
+    sodium::hash(hasher, in, hash);
+    BOOST_CHECK(hash == hasher.hash(plaintext));
+    BOOST_CHECK_THROW(sodium::hash(hasher, in, span<byte>(hash.data(), 3)),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,264 @@
+// test_async_streamcryptor_aead.cpp -- Test sodium::async_streamcryptor_aead
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::async_streamcryptor_aead Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "async_streamcryptor_aead.h"
+#include "common.h"
+#include "error.h"
+#include "random.h"
+#include "streamcryptor_aead.h"
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include <sodium.h>
+
+namespace asio = boost::asio;
+
+using sodium::async_streamcryptor_aead;
+using sodium::streamcryptor_aead;
+
+using key_type = sodium::aead<>::key_type;
+using nonce_type = sodium::aead<>::nonce_type;
+
+constexpr std::size_t BLOCKSIZE = 1000;
+
+/**
+ * A minimal AsyncReadStream / AsyncWriteStream over a std::string.
+ * Reads return at most max_chunk bytes, to exercise short reads.
+ * Completion handlers are always posted, never invoked inline.
+ **/
+
+class memory_stream
+{
+  public:
+    using executor_type = asio::io_context::executor_type;
+
+    memory_stream(asio::io_context& ioc,
+                  std::string data = {},
+                  std::size_t max_chunk = 333)
+      : ex_{ ioc.get_executor() }
+      , data_{ std::move(data) }
+      , max_chunk_{ max_chunk }
+    {}
+
+    executor_type get_executor() const noexcept { return ex_; }
+
+    template<typename MutableBufferSequence, typename ReadHandler>
+    auto async_read_some(const MutableBufferSequence& buffers,
+                         ReadHandler&& handler)
+    {
+        return asio::async_initiate<ReadHandler,
+                                    void(boost::system::error_code,
+                                         std::size_t)>(
+          [this, buffers](auto&& h) {
+              std::size_t n = std::min(data_.size() - pos_, max_chunk_);
+              n = asio::buffer_copy(buffers, asio::buffer(data_.data() + pos_, n));
+              pos_ += n;
+              boost::system::error_code ec;
+              if (n == 0 && asio::buffer_size(buffers) != 0)
+                  ec = asio::error::eof;
+              asio::post(ex_, [h = std::move(h), ec, n]() mutable {
+                  h(ec, n);
+              });
+          },
+          handler);
+    }
+
+    template<typename ConstBufferSequence, typename WriteHandler>
+    auto async_write_some(const ConstBufferSequence& buffers,
+                          WriteHandler&& handler)
+    {
+        return asio::async_initiate<WriteHandler,
+                                    void(boost::system::error_code,
+                                         std::size_t)>(
+          [this, buffers](auto&& h) {
+              const std::size_t n = asio::buffer_size(buffers);
+              const std::size_t old_size = data_.size();
+              data_.resize(old_size + n);
+              asio::buffer_copy(asio::buffer(&data_[old_size], n), buffers);
+              asio::post(ex_, [h = std::move(h), n]() mutable {
+                  h(boost::system::error_code{}, n);
+              });
+          },
+          handler);
+    }
+
+    const std::string& str() const { return data_; }
+
+  private:
+    executor_type ex_;
+    std::string data_;
+    std::size_t pos_ = 0;
+    std::size_t max_chunk_;
+};
+
+struct result
+{
+    boost::system::error_code ec;
+    std::uint64_t written = 0;
+    std::string output;
+};
+
+std::string
+random_string(std::size_t size)
+{
+    std::string result(size, '\0');
+    sodium::randombytes_buf_inplace(result);
+    return result;
+}
+
+result
+run(const async_streamcryptor_aead& sc,
+    const std::string& input,
+    bool encrypting)
+{
+    asio::io_context ioc;
+    asio::thread_pool pool(4);
+    memory_stream in(ioc, input);
+    memory_stream out(ioc);
+
+    result r;
+    auto handler = [&r](boost::system::error_code ec, std::uint64_t n) {
+        r.ec = ec;
+        r.written = n;
+    };
+    if (encrypting)
+        sc.async_encrypt(in, out, pool.get_executor(), handler);
+    else
+        sc.async_decrypt(in, out, pool.get_executor(), handler);
+
+    ioc.run(); // returns once the operation has completed
+    pool.join();
+
+    r.output = out.str();
+    return r;
+}
+
+std::string
+encrypt_sync(const key_type& key,
+             const nonce_type& nonce,
+             const std::string& plaintext)
+{
+    streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+    std::istringstream istr(plaintext);
+    std::ostringstream ostr;
+    sc.encrypt(istr, ostr);
+    return ostr.str();
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- so long.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_async_streamcryptor_aead_same_as_sync)
+{
+    key_type key;
+    nonce_type nonce;
+
+    for (std::size_t window : { 1, 2, 4, 16 }) {
+        async_streamcryptor_aead sc(key, nonce, BLOCKSIZE, window);
+        for (std::size_t size :
+             { 0, 1, 999, 1000, 1001, 2000, 10 * 1000 + 17, 100 * 1000 }) {
+            const std::string plaintext = random_string(size);
+            const std::string expected = encrypt_sync(key, nonce, plaintext);
+
+            result enc = run(sc, plaintext, true);
+            BOOST_CHECK(!enc.ec);
+            BOOST_CHECK_EQUAL(enc.written, expected.size());
+            BOOST_CHECK(enc.output == expected);
+
+            result dec = run(sc, enc.output, false);
+            BOOST_CHECK(!dec.ec);
+            BOOST_CHECK_EQUAL(dec.written, size);
+            BOOST_CHECK(dec.output == plaintext);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_async_streamcryptor_aead_tampered)
+{
+    key_type key;
+    nonce_type nonce;
+    async_streamcryptor_aead sc(key, nonce, BLOCKSIZE);
+
+    const std::string plaintext = random_string(10 * BLOCKSIZE);
+    std::string ciphertext = run(sc, plaintext, true).output;
+    const std::size_t chunk = BLOCKSIZE + sodium::aead<>::MACSIZE;
+
+    // flip a bit in the 4th block: the first 3 blocks are still written
+    ciphertext[3 * chunk + 10] ^= 0x01;
+    result dec = run(sc, ciphertext, false);
+    BOOST_CHECK(dec.ec == sodium::async_detail::to_error_code(
+                            sodium::errc::verification_failed));
+    BOOST_CHECK_EQUAL(std::string(dec.ec.category().name()), "sodium");
+    BOOST_CHECK_EQUAL(dec.written, 3 * BLOCKSIZE);
+    BOOST_CHECK(dec.output == plaintext.substr(0, 3 * BLOCKSIZE));
+
+    // a final block shorter than a MAC
+    const std::string truncated = ciphertext.substr(0, chunk + 3);
+    dec = run(sc, truncated, false);
+    BOOST_CHECK(dec.ec == sodium::async_detail::to_error_code(
+                            sodium::errc::message_too_short));
+
+    // wrong key
+    key_type key2;
+    async_streamcryptor_aead sc2(key2, nonce, BLOCKSIZE);
+    dec = run(sc2, run(sc, plaintext, true).output, false);
+    BOOST_CHECK(dec.ec == sodium::async_detail::to_error_code(
+                            sodium::errc::verification_failed));
+    BOOST_CHECK_EQUAL(dec.written, 0);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_async_streamcryptor_aead_wrong_args)
+{
+    key_type key;
+    nonce_type nonce;
+
+    BOOST_CHECK_THROW(async_streamcryptor_aead(key, nonce, 0),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(async_streamcryptor_aead(key, nonce, BLOCKSIZE, 0),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(
+      async_streamcryptor_aead(key, nonce, sodium::blocksize::auto_tune),
+      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
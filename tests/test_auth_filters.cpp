@@ -22,16 +22,22 @@
 
 #include "auth_mac_filter.h"
 #include "auth_verify_filter.h"
+#include "auth_verify_stream_filter.h"
 #include "authenticator.h"
 #include "common.h"
 
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
 #include <string>
 
 #include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 
 using sodium::auth_mac_filter;
 using sodium::auth_verify_filter;
+using sodium::auth_verify_stream_filter;
 using chars = sodium::chars;
 using authenticator = sodium::authenticator<chars>; // NOT bytes!
 
@@ -644,4 +650,114 @@ BOOST_AUTO_TEST_CASE(sodium_test_auth_filters_falsify_plaintext_input_filter)
     BOOST_CHECK_EQUAL(result[0], '0');
 }
 
+// pass plaintext through an auth_verify_stream_filter, in small writes
+std::string
+verify_stream_output(auth_verify_stream_filter& verify_filter,
+                     const std::string& plaintext)
+{
+    std::string result;
+    io::filtering_ostream os(verify_filter | io::back_inserter(result));
+    for (std::size_t pos = 0; pos < plaintext.size(); pos += 1000)
+        os.write(plaintext.data() + pos,
+                 std::min<std::size_t>(1000, plaintext.size() - pos));
+    os.reset(); // checks the MAC
+
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_auth_filters_verify_stream_output_filter)
+{
+    auth_verify_stream_filter::key_type key;
+    authenticator sa{ key };
+
+    for (std::size_t size : { 0UL, 1UL, 100UL, 100000UL }) {
+        std::string plaintext(size, 'x');
+        chars plainblob{ plaintext.cbegin(), plaintext.cend() };
+        chars mac = sa.mac(plainblob);
+
+        auth_verify_stream_filter verify_filter{ 4096, key, mac };
+        BOOST_CHECK(verify_stream_output(verify_filter, plaintext) ==
+                    plaintext);
+        BOOST_CHECK(verify_filter.verified());
+
+        // the same filter verifies the next stream afresh
+        BOOST_CHECK(verify_stream_output(verify_filter, plaintext) ==
+                    plaintext);
+        BOOST_CHECK(verify_filter.verified());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_auth_filters_verify_stream_falsified)
+{
+    auth_verify_stream_filter::key_type key;
+    authenticator sa{ key };
+
+    std::string plaintext(10000, 'x');
+    chars plainblob{ plaintext.cbegin(), plaintext.cend() };
+    chars mac = sa.mac(plainblob);
+
+    std::string falsified{ plaintext };
+    ++falsified[5000];
+
+    auth_verify_stream_filter verify_filter{ 4096, key, mac };
+    BOOST_CHECK_THROW(verify_stream_output(verify_filter, falsified),
+                      std::runtime_error);
+    BOOST_CHECK(!verify_filter.verified());
+
+    // without exceptions, the data still goes through, unverified
+    auth_verify_stream_filter no_throw_filter{ 4096, key, mac, false };
+    BOOST_CHECK(verify_stream_output(no_throw_filter, falsified) ==
+                falsified);
+    BOOST_CHECK(!no_throw_filter.verified());
+
+    // a wrong key
+    auth_verify_stream_filter::key_type key2;
+    auth_verify_stream_filter wrong_key_filter{ 4096, key2, mac, false };
+    verify_stream_output(wrong_key_filter, plaintext);
+    BOOST_CHECK(!wrong_key_filter.verified());
+
+    chars short_mac(macsize - 1);
+    BOOST_CHECK_THROW(auth_verify_stream_filter(4096, key, short_mac),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_auth_filters_verify_stream_input_filter)
+{
+    auth_verify_stream_filter::key_type key;
+    authenticator sa{ key };
+
+    std::string plaintext(100000, 'x');
+    chars plainblob{ plaintext.cbegin(), plaintext.cend() };
+    chars mac = sa.mac(plainblob);
+
+    auth_verify_stream_filter verify_filter{ 4096, key, mac, false };
+    io::filtering_istream is;
+    is.push(verify_filter);
+    is.push(io::array_source{ plainblob.data(), plainblob.size() });
+
+    std::string result(std::istreambuf_iterator<char>(is), {});
+    BOOST_CHECK(result == plaintext);
+    BOOST_CHECK(verify_filter.verified()); // the source was exhausted
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_auth_filters_verify_stream_bounded_memory)
+{
+    auth_verify_stream_filter::key_type key;
+    chars mac(macsize); // wrong, but we don't get to the end anyway
+    auth_verify_stream_filter verify_filter{ 4096, key, mac, false };
+
+    // data is released downstream before the end of the stream: only
+    // what's still in the stream and filter buffers is held back
+    std::string plaintext(100000, 'x');
+    std::string result;
+    io::filtering_ostream os(verify_filter | io::back_inserter(result));
+    os.write(plaintext.data(), plaintext.size());
+    os.flush();
+    BOOST_CHECK_GE(result.size(), plaintext.size() - 2 * 4096);
+
+    os.reset();
+    BOOST_CHECK_EQUAL(result.size(), plaintext.size());
+    BOOST_CHECK(!verify_filter.verified());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -23,9 +23,13 @@
 #include "authenticator.h"
 #include "common.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
 #include <string>
 
 using sodium::authenticator;
+using sodium::authenticator_state;
 using bytes = sodium::bytes;
 
 static constexpr std::size_t macsize = authenticator<>::MACSIZE;
@@ -257,4 +261,107 @@ BOOST_AUTO_TEST_CASE(sodium_test_auth_mac_verify_empty_falsify_key)
     BOOST_CHECK(!sa2.verify(plainblob, mac));
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_auth_mac_fixed)
+{
+    authenticator<> sa{};
+
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    // same MAC as mac(), but in a fixed_bytes<> on the stack
+    authenticator<>::mac_type mac = sa.mac_fixed(plaintext);
+    BOOST_CHECK_EQUAL(mac.size(), macsize);
+    BOOST_CHECK(mac.to() == sa.mac(plainblob));
+    BOOST_CHECK(mac == sa.mac_fixed(plainblob));
+
+    BOOST_CHECK(sa.verify(plaintext, mac));
+    BOOST_CHECK(sa.verify(plainblob, mac.to()));
+    std::string empty;
+    BOOST_CHECK(sa.verify(empty, sa.mac_fixed(empty)));
+
+    // falsified MAC, or falsified plaintext
+    authenticator<>::mac_type falsified{ mac };
+    ++falsified[macsize - 1];
+    BOOST_CHECK(falsified != mac);
+    BOOST_CHECK(!sa.verify(plaintext, falsified));
+    plaintext[0] = 'T';
+    BOOST_CHECK(!sa.verify(plaintext, mac));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_auth_state_incremental)
+{
+    authenticator<> sa{};
+
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    // a MAC absorbed in pieces is the same as the one-shot MAC
+    authenticator_state state = sa.state();
+    for (std::size_t i = 0; i < plaintext.size(); i += 5)
+        state.update(plaintext.data() + i,
+                     std::min<std::size_t>(5, plaintext.size() - i));
+    authenticator_state::mac_type mac = state.final();
+    BOOST_CHECK(mac == sa.mac_fixed(plaintext));
+    BOOST_CHECK(mac.to() == sa.mac(plainblob));
+
+    // final() has reset the state for the next message
+    state.update(plaintext);
+    bytes out(macsize);
+    state.final(out);
+    BOOST_CHECK(out == sa.mac(plainblob));
+    BOOST_CHECK_THROW(state.final(sodium::span<sodium::byte>(out.data(), 3)),
+                      std::runtime_error);
+
+    // the empty message, and reset()
+    state.update(plaintext);
+    state.reset();
+    std::string empty;
+    BOOST_CHECK(state.final() == sa.mac_fixed(empty));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_auth_state_clone_verify)
+{
+    authenticator<> sa{};
+
+    std::string header{ "record 42: " };
+    std::string body1{ "the quick brown fox" };
+    std::string body2{ "jumps over the lazy dog" };
+    std::string record1_text{ header + body1 };
+    std::string record2_text{ header + body2 };
+
+    // one state per record from a common prefix, by copying
+    authenticator_state prefix = sa.state();
+    prefix.update(header);
+    authenticator_state record1{ prefix };
+    authenticator_state record2{ prefix };
+    record1.update(body1);
+    record2.update(body2);
+
+    const auto mac1 = sa.mac_fixed(record1_text);
+    const auto mac2 = sa.mac_fixed(record2_text);
+    BOOST_CHECK(record1.verify(mac1));
+    BOOST_CHECK(record2.verify(mac2));
+
+    // the wrong record, a falsified MAC, or a truncated one
+    record1.update(record2_text);
+    BOOST_CHECK(!record1.verify(mac1));
+
+    authenticator<>::mac_type falsified{ mac1 };
+    ++falsified[0];
+    record1.update(record1_text);
+    BOOST_CHECK(!record1.verify(falsified));
+
+    record1.update(record1_text);
+    BOOST_CHECK(
+      !record1.verify(sodium::span<const sodium::byte>(mac1.data(), 16)));
+
+    // a different key
+    authenticator<> sa2{};
+    authenticator_state other = sa2.state();
+    other.update(record1_text);
+    BOOST_CHECK(!other.verify(mac1));
+
+    BOOST_CHECK_THROW(authenticator_state(mac1.data(), 3), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -23,10 +23,15 @@
 #include "blake2b_tee_filter.h"
 #include "common.h"
 #include "helpers.h"
+#include "thread_pool.h"
+#include "tree_hash.h"
 
 #include <cstdio> // std::remove()
+#include <iterator>
+#include <sstream>
 #include <string>
 
+#include <boost/iostreams/device/array.hpp>
 #include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/iostreams/device/file.hpp>
 #include <boost/iostreams/device/null.hpp>
@@ -404,4 +409,73 @@ BOOST_AUTO_TEST_CASE(sodium_test_blake2b_filter_blake2b_to_vector_null_keyless)
     BOOST_CHECK(result);
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_blake2b_filter_tree_hash)
+{
+    using blake2b_to_vector_filter_type = blake2b_tee_filter<vector_sink>;
+    blake2b_to_vector_filter_type::key_type key(
+      blake2b_to_vector_filter_type::KEYSIZE);
+    sodium::thread_pool pool(2);
+
+    std::string plaintext(5000, '\0');
+    randombytes_buf(plaintext.data(), plaintext.size());
+
+    hash_array_type hash;
+    std::string passed_through;
+    {
+        vector_sink hashsink{ hash };
+        blake2b_to_vector_filter_type blake2b_filter(
+          hashsink, key, blake2b_to_vector_filter_type::HASHSIZE, pool, 64);
+        io::filtering_ostream os(blake2b_filter |
+                                 io::back_inserter(passed_through));
+        os.write(plaintext.data(), plaintext.size());
+    }
+
+    // the data is passed through unchanged
+    BOOST_CHECK(passed_through == plaintext);
+
+    // the tee-ed hash is the same tree hash as the one of tree_hash
+    sodium::tree_hash tree(
+      key, blake2b_to_vector_filter_type::HASHSIZE, 64, pool);
+    tree.update(reinterpret_cast<const unsigned char*>(plaintext.data()),
+                plaintext.size());
+    hash_array_type expected(tree.hashsize());
+    tree.final(reinterpret_cast<unsigned char*>(expected.data()));
+
+    BOOST_CHECK(hash == expected);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_blake2b_filter_input_chain)
+{
+    using blake2b_to_vector_filter_type = blake2b_tee_filter<vector_sink>;
+    blake2b_to_vector_filter_type::key_type key(
+      blake2b_to_vector_filter_type::KEYSIZE);
+
+    std::string plaintext(100000, '\0');
+    randombytes_buf(plaintext.data(), plaintext.size());
+
+    hash_array_type hash;
+    vector_sink hashsink{ hash };
+    io::filtering_istream is;
+    is.push(blake2b_to_vector_filter_type(
+      hashsink, key, blake2b_to_vector_filter_type::HASHSIZE));
+    is.push(io::array_source{ plaintext.data(), plaintext.size() });
+
+    // the data is passed through unchanged
+    std::string read_back(std::istreambuf_iterator<char>(is), {});
+    BOOST_CHECK(read_back == plaintext);
+
+    // and the hash is there as soon as we hit EOF, before closing
+    hash_array_type expected(blake2b_to_vector_filter_type::HASHSIZE);
+    crypto_generichash(reinterpret_cast<unsigned char*>(expected.data()),
+                       expected.size(),
+                       reinterpret_cast<unsigned char*>(plaintext.data()),
+                       plaintext.size(),
+                       key.data(),
+                       key.size());
+    BOOST_CHECK(hash == expected);
+
+    is.reset();
+    BOOST_CHECK(hash == expected); // sent only once
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,113 @@
+// test_blocksize.cpp -- Test sodium::blocksize calibration
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::blocksize Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "blocksize.h"
+#include "common.h"
+#include "streamcryptor_aead.h"
+#include "streamhash.h"
+
+#include <cstddef>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+
+#include <sodium.h>
+
+namespace blocksize = sodium::blocksize;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- so long.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_blocksize_calibrate)
+{
+    const blocksize::calibration result = blocksize::calibrate(256 * 1024);
+
+    // one measurement per power of 2 from MIN to MAX
+    std::size_t expected = blocksize::MIN;
+    for (const auto& m : result.measurements) {
+        BOOST_CHECK_EQUAL(m.blocksize, expected);
+        BOOST_CHECK(m.bytes_per_second > 0);
+        expected *= 2;
+    }
+    BOOST_CHECK_EQUAL(expected, 2 * blocksize::MAX);
+
+    BOOST_CHECK(result.best >= blocksize::MIN);
+    BOOST_CHECK(result.best <= blocksize::MAX);
+    BOOST_CHECK_EQUAL(result.best & (result.best - 1), 0U); // power of 2
+
+    // any blocksize is within 100% of the best
+    BOOST_CHECK_EQUAL(blocksize::calibrate(256 * 1024, 1.0).best,
+                      blocksize::MIN);
+
+    BOOST_TEST_MESSAGE("calibrated blocksize: " << result.best);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_blocksize_tuned)
+{
+    const std::size_t tuned = blocksize::tuned();
+    BOOST_CHECK(tuned >= blocksize::MIN && tuned <= blocksize::MAX);
+    BOOST_CHECK_EQUAL(blocksize::tuned(), tuned); // cached
+
+    BOOST_CHECK_EQUAL(blocksize::resolve(blocksize::auto_tune), tuned);
+    BOOST_CHECK_EQUAL(blocksize::resolve(1000), 1000U);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_blocksize_auto_tune)
+{
+    using sc_type = sodium::streamcryptor_aead<>;
+
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+
+    // the cryptors don't store the blocksize: no auto_tune
+    BOOST_CHECK_THROW(sc_type(key, nonce, blocksize::auto_tune),
+                      std::runtime_error);
+    sc_type sc(key, nonce, blocksize::tuned());
+    BOOST_CHECK_EQUAL(sc.blocksize(), blocksize::tuned());
+
+    // the hash doesn't depend on the blocksize
+    sodium::StreamHash sh(sodium::StreamHash::HASHSIZE, blocksize::auto_tune);
+    BOOST_CHECK_EQUAL(sh.blocksize(), blocksize::tuned());
+
+    const std::string plaintext(3 * sh.blocksize() + 17, 'a');
+    std::istringstream istr(plaintext);
+    sodium::StreamHash sh2(sodium::StreamHash::HASHSIZE, 1000);
+    std::istringstream istr2(plaintext);
+    BOOST_CHECK(sh.hash(istr) == sh2.hash(istr2));
+
+    BOOST_CHECK_THROW(sc_type(key, nonce, 0), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,107 @@
+// test_bloom_filter.cpp -- Test sodium::bloom_filter<>
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::bloom_filter Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "bloom_filter.h"
+#include "hasher_short.h"
+
+#include <sodium.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+using sodium::bloom_filter;
+using sodium::hasher_short;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_bloom_filter_no_false_negatives)
+{
+    hasher_short<> hasher;
+    bloom_filter<> filter(hasher, 10000, 0.01);
+    BOOST_CHECK_EQUAL(filter.size_bits() % bloom_filter<>::BLOCKBITS, 0UL);
+    BOOST_CHECK(filter.hashes() >= 1UL);
+
+    for (int i = 0; i != 10000; ++i)
+        filter.insert(std::to_string(i));
+    BOOST_CHECK_EQUAL(filter.count(), 10000UL);
+
+    for (int i = 0; i != 10000; ++i)
+        BOOST_REQUIRE(filter.possibly_contains(std::to_string(i)));
+
+    filter.clear();
+    BOOST_CHECK_EQUAL(filter.count(), 0UL);
+    BOOST_CHECK(!filter.possibly_contains(std::string{ "1" }));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_bloom_filter_false_positive_rate)
+{
+    hasher_short<> hasher;
+    bloom_filter<> filter(hasher, 20000, 0.01);
+
+    for (std::uint64_t i = 0; i != 20000; ++i)
+        filter.insert(i);
+
+    std::size_t false_positives = 0;
+    for (std::uint64_t i = 20000; i != 120000; ++i)
+        false_positives += filter.possibly_contains(i);
+
+    // about 1%, with room for the blocked layout and chance
+    BOOST_CHECK_LT(false_positives, 2500UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_bloom_filter_keyed)
+{
+    hasher_short<> hasher1;
+    hasher_short<> hasher2;
+    bloom_filter<> filter1(hasher1, 100, 0.01);
+    bloom_filter<> filter2(hasher2, 100, 0.01);
+
+    filter1.insert("secret", 6);
+    BOOST_CHECK(filter1.possibly_contains("secret", 6));
+
+    // the same value, but another key: (most likely) other bits
+    filter2.insert("secret", 6);
+    BOOST_CHECK(filter2.possibly_contains("secret", 6));
+    std::size_t both = 0;
+    for (std::uint64_t i = 0; i != 1000; ++i)
+        both += filter1.possibly_contains(i) && filter2.possibly_contains(i);
+    BOOST_CHECK_LT(both, 50UL);
+
+    BOOST_CHECK_THROW(bloom_filter<>(hasher1, 100, 0.0), std::runtime_error);
+    BOOST_CHECK_THROW(bloom_filter<>(hasher1, 100, 1.0), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
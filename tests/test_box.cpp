@@ -22,8 +22,11 @@
 
 #include "box.h"
 #include "keypair.h"
+#include "span.h"
+#include "thread_pool.h"
 #include <sodium.h>
 #include <string>
+#include <vector>
 
 using sodium::box;
 using sodium::keypair;
@@ -527,4 +530,81 @@ BOOST_AUTO_TEST_CASE(sodium_box_test_falsify_mac_empty)
     BOOST_CHECK(falsify_mac_detached(plaintext));
 }
 
+BOOST_AUTO_TEST_CASE(sodium_box_test_decrypt_batch)
+{
+    using sodium::byte;
+    using sodium::span;
+    box<> sc{};
+    keypair<> recipient{};
+    std::vector<keypair<>> senders(3);
+
+    std::vector<bytes> plaintexts;
+    std::vector<bytes> ciphertexts;
+    std::vector<box<>::nonce_type> nonces;
+    std::vector<box<>::public_key_type> sender_keys;
+    for (std::size_t i = 0; i != 40; ++i) {
+        // runs of messages from the same sender
+        const keypair<>& sender = senders[(i / 5) % senders.size()];
+        plaintexts.emplace_back(i * 3, static_cast<byte>(i));
+        nonces.emplace_back();
+        ciphertexts.push_back(sc.encrypt(plaintexts.back(),
+                                         recipient.public_key(),
+                                         sender.private_key(),
+                                         nonces.back()));
+        sender_keys.push_back(sender.public_key());
+    }
+    sender_keys[12] = senders[0].public_key(); // not the real sender
+    ++ciphertexts[33][0];                       // tampered with
+
+    std::vector<span<const byte>> inbox(ciphertexts.cbegin(),
+                                        ciphertexts.cend());
+    bytes arena(box<>::open_size(inbox));
+
+    sodium::thread_pool pool(3);
+    for (bool parallel : { false, true }) {
+        std::vector<span<byte>> opened_plaintexts(inbox.size());
+        bytes opened(inbox.size(), 0xff);
+        BOOST_CHECK_EQUAL(parallel ? sc.decrypt_batch(arena,
+                                                      opened_plaintexts,
+                                                      opened,
+                                                      inbox,
+                                                      nonces,
+                                                      sender_keys,
+                                                      recipient.private_key(),
+                                                      pool)
+                                   : sc.decrypt_batch(arena,
+                                                      opened_plaintexts,
+                                                      opened,
+                                                      inbox,
+                                                      nonces,
+                                                      sender_keys,
+                                                      recipient.private_key()),
+                          0);
+
+        for (std::size_t i = 0; i != inbox.size(); ++i) {
+            const bool ok = i != 12 && i != 33;
+            BOOST_CHECK_EQUAL(opened[i], ok ? 1 : 0);
+            if (ok)
+                BOOST_CHECK(bytes(opened_plaintexts[i].begin(),
+                                  opened_plaintexts[i].end()) ==
+                            plaintexts[i]);
+            else
+                BOOST_CHECK(opened_plaintexts[i].empty());
+        }
+    }
+
+    // fewer nonces than messages
+    std::vector<span<byte>> opened_plaintexts(inbox.size());
+    bytes opened(inbox.size());
+    span<const box<>::nonce_type> few_nonces(nonces.data(), 3);
+    BOOST_CHECK_EQUAL(sc.decrypt_batch(arena,
+                                       opened_plaintexts,
+                                       opened,
+                                       inbox,
+                                       few_nonces,
+                                       sender_keys,
+                                       recipient.private_key()),
+                      -1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,154 @@
+// test_box_precomputed_cache.cpp -- Test sodium::box_precomputed_cache
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::box_precomputed_cache Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "box_precomputed.h"
+#include "box_precomputed_cache.h"
+#include "keypair.h"
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::box_precomputed;
+using sodium::box_precomputed_cache;
+using sodium::keypair;
+
+using bytes = sodium::bytes;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_box_precomputed_cache_test_hit_miss)
+{
+    keypair<> alice;
+    keypair<> bob;
+    box_precomputed_cache<> cache(100);
+
+    auto box1 = cache.get(alice.private_key(), bob.public_key());
+    auto box2 = cache.get(alice.private_key(), bob.public_key());
+    BOOST_CHECK(box1 == box2); // the very same shared key
+
+    auto stats = cache.stats();
+    BOOST_CHECK_EQUAL(stats.hits, 1UL);
+    BOOST_CHECK_EQUAL(stats.misses, 1UL);
+    BOOST_CHECK_EQUAL(stats.evictions, 0UL);
+    BOOST_CHECK_EQUAL(stats.size, 1UL);
+
+    // the cached shared key is the right one
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+    box_precomputed<>::nonce_type nonce;
+
+    box_precomputed<> bob_box(bob.private_key(), alice.public_key());
+    bytes ciphertext = box1->encrypt(plainblob, nonce);
+    BOOST_CHECK(bob_box.decrypt(ciphertext, nonce) == plainblob);
+
+    // another private key is another entry
+    auto box3 = cache.get(bob);
+    BOOST_CHECK(box3 != box1);
+    BOOST_CHECK_EQUAL(cache.stats().misses, 2UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_box_precomputed_cache_test_lru_eviction)
+{
+    keypair<> local;
+    std::vector<keypair<>> peers(3);
+    box_precomputed_cache<> cache(2, 1); // a single shard
+    BOOST_CHECK_EQUAL(cache.capacity(), 2UL);
+
+    auto box0 = cache.get(local.private_key(), peers[0].public_key());
+    cache.get(local.private_key(), peers[1].public_key());
+    cache.get(local.private_key(), peers[0].public_key()); // peers[1] is LRU
+    cache.get(local.private_key(), peers[2].public_key()); // evicts peers[1]
+
+    auto stats = cache.stats();
+    BOOST_CHECK_EQUAL(stats.evictions, 1UL);
+    BOOST_CHECK_EQUAL(stats.size, 2UL);
+
+    BOOST_CHECK(cache.erase(local.private_key(), peers[0].public_key()));
+    BOOST_CHECK(!cache.erase(local.private_key(), peers[1].public_key()));
+    BOOST_CHECK(cache.erase(local.private_key(), peers[2].public_key()));
+    BOOST_CHECK_EQUAL(cache.stats().size, 0UL);
+
+    // an evicted box is still usable
+    bytes plainblob{ 'a', 'b', 'c' };
+    box_precomputed<>::nonce_type nonce;
+    BOOST_CHECK_EQUAL(box0->encrypt(plainblob, nonce).size(),
+                      box_precomputed<>::MACSIZE + plainblob.size());
+
+    cache.get(local);
+    cache.clear();
+    BOOST_CHECK_EQUAL(cache.stats().size, 0UL);
+    BOOST_CHECK_EQUAL(cache.stats().misses, 4UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_box_precomputed_cache_test_errors)
+{
+    BOOST_CHECK_THROW(box_precomputed_cache<>(0), std::runtime_error);
+    BOOST_CHECK_THROW(box_precomputed_cache<>(10, 0), std::runtime_error);
+
+    keypair<> local;
+    box_precomputed_cache<> cache(10);
+    box_precomputed_cache<>::public_key_type short_key(10);
+    BOOST_CHECK_THROW(cache.get(local.private_key(), short_key),
+                      std::runtime_error);
+    BOOST_CHECK_EQUAL(cache.stats().size, 0UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_box_precomputed_cache_test_concurrent)
+{
+    keypair<> local;
+    std::vector<keypair<>> peers(20);
+    box_precomputed_cache<> cache(64, 4);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 4; ++t)
+        threads.emplace_back([&] {
+            for (int round = 0; round != 5; ++round)
+                for (const auto& peer : peers)
+                    cache.get(local.private_key(), peer.public_key());
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    auto stats = cache.stats();
+    BOOST_CHECK_EQUAL(stats.hits + stats.misses, 4UL * 5UL * peers.size());
+    BOOST_CHECK_EQUAL(stats.size, peers.size());
+    BOOST_CHECK(stats.misses >= peers.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
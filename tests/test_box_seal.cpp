@@ -22,8 +22,11 @@
 
 #include "box_seal.h"
 #include "keypair.h"
+#include "thread_pool.h"
 #include <sodium.h>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 using sodium::box_seal;
 using sodium::keypair;
@@ -417,4 +420,141 @@ BOOST_AUTO_TEST_CASE(sodium_sealedbox_test_falsify_seal_empty_bytes_chars)
     BOOST_CHECK(falsify_seal<sodium::chars>(plaintext));
 }
 
+// 4. multiple recipients -----------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(sodium_sealedbox_test_multi_recipients)
+{
+    box_seal<> sb{};
+    sodium::thread_pool pool(3);
+    std::vector<keypair<>> recipients(10);
+    std::vector<keypair<>::public_key_type> public_keys;
+    for (const auto& recipient : recipients)
+        public_keys.push_back(recipient.public_key());
+
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    for (const bytes& ciphertext : { sb.encrypt_multi(plainblob, public_keys),
+                                     sb.encrypt_multi(
+                                       plainblob, public_keys, pool) }) {
+        BOOST_CHECK_EQUAL(ciphertext.size(),
+                          box_seal<>::MULTI_HEADERSIZE +
+                            10 * box_seal<>::MULTI_WRAPSIZE +
+                            box_seal<>::MULTI_MACSIZE + plainblob.size());
+
+        for (std::size_t i = 0; i != recipients.size(); ++i) {
+            BOOST_CHECK(sb.decrypt_multi(ciphertext, recipients[i], i) ==
+                        plainblob);
+            BOOST_CHECK(sb.decrypt_multi(ciphertext, recipients[i]) ==
+                        plainblob);
+        }
+
+        // the wrong index, or somebody else
+        BOOST_CHECK_THROW(sb.decrypt_multi(ciphertext, recipients[3], 4),
+                          std::runtime_error);
+        BOOST_CHECK_THROW(sb.decrypt_multi(ciphertext, keypair<>{}),
+                          std::runtime_error);
+        BOOST_CHECK_THROW(sb.decrypt_multi(ciphertext, recipients[0], 10),
+                          std::runtime_error);
+    }
+
+    // more workers than recipients, and an empty plaintext
+    bytes one = sb.encrypt_multi(bytes{}, { public_keys[7] }, pool);
+    BOOST_CHECK(sb.decrypt_multi(one, recipients[7]).empty());
+
+    BOOST_CHECK_THROW(sb.encrypt_multi(plainblob, {}), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_sealedbox_test_multi_falsified)
+{
+    box_seal<> sb{};
+    std::vector<keypair<>> recipients(3);
+    std::vector<keypair<>::public_key_type> public_keys;
+    for (const auto& recipient : recipients)
+        public_keys.push_back(recipient.public_key());
+
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+    const bytes ciphertext = sb.encrypt_multi(plainblob, public_keys);
+
+    // a falsified wrap only locks out its recipient
+    bytes falsified{ ciphertext };
+    ++falsified[box_seal<>::MULTI_HEADERSIZE + box_seal<>::MULTI_WRAPSIZE];
+    BOOST_CHECK_THROW(sb.decrypt_multi(falsified, recipients[1]),
+                      std::runtime_error);
+    BOOST_CHECK(sb.decrypt_multi(falsified, recipients[2]) == plainblob);
+
+    // a falsified payload, or number of recipients, locks out everybody
+    falsified = ciphertext;
+    ++falsified.back();
+    BOOST_CHECK_THROW(sb.decrypt_multi(falsified, recipients[0]),
+                      std::runtime_error);
+
+    falsified = ciphertext;
+    --falsified[0];
+    BOOST_CHECK_THROW(sb.decrypt_multi(falsified, recipients[0]),
+                      std::runtime_error);
+
+    // truncated
+    bytes truncated(ciphertext.cbegin(), ciphertext.cbegin() + 100);
+    BOOST_CHECK_THROW(sb.decrypt_multi(truncated, recipients[0]),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_box_seal_test_decrypt_batch)
+{
+    using sodium::byte;
+    using sodium::span;
+    box_seal<> sb{};
+    keypair<> recipient{};
+    keypair<> stranger{};
+
+    std::vector<bytes> plaintexts;
+    std::vector<bytes> ciphertexts;
+    for (std::size_t i = 0; i != 50; ++i) {
+        plaintexts.emplace_back(i * 3, static_cast<byte>(i));
+        ciphertexts.push_back(
+          sb.encrypt(plaintexts.back(), (i == 7) ? stranger : recipient));
+    }
+    ++ciphertexts[20][5];       // tampered with
+    ciphertexts[30].resize(10); // too small for a seal
+    plaintexts[30].clear();
+
+    std::vector<span<const byte>> inbox(ciphertexts.cbegin(),
+                                        ciphertexts.cend());
+    bytes arena(box_seal<>::open_size(inbox));
+
+    sodium::thread_pool pool(3);
+    for (bool parallel : { false, true }) {
+        std::vector<span<byte>> opened_plaintexts(inbox.size());
+        bytes opened(inbox.size(), 0xff);
+        BOOST_CHECK_EQUAL(
+          parallel ? sb.decrypt_batch(
+                       arena, opened_plaintexts, opened, inbox, recipient, pool)
+                   : sb.decrypt_batch(
+                       arena, opened_plaintexts, opened, inbox, recipient),
+          0);
+
+        for (std::size_t i = 0; i != inbox.size(); ++i) {
+            const bool ok = i != 7 && i != 20 && i != 30;
+            BOOST_CHECK_EQUAL(opened[i], ok ? 1 : 0);
+            if (ok)
+                BOOST_CHECK(bytes(opened_plaintexts[i].begin(),
+                                  opened_plaintexts[i].end()) ==
+                            plaintexts[i]);
+            else
+                BOOST_CHECK(opened_plaintexts[i].empty());
+        }
+    }
+
+    // an arena too small
+    bytes small_arena(arena.size() - 1);
+    std::vector<span<byte>> opened_plaintexts(inbox.size());
+    bytes opened(inbox.size());
+    BOOST_CHECK_EQUAL(
+      sb.decrypt_batch(
+        small_arena, opened_plaintexts, opened, inbox, recipient),
+      -1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,132 @@
+// test_buffer.cpp -- Test sodium::buffer and sodium::buffer_allocator
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::buffer Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "box.h"
+#include "buffer_allocator.h"
+#include "common.h"
+#include "keypair.h"
+#include "secretbox.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <sodium.h>
+
+using buffer = sodium::buffer;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+// a type that records whether it was value- or default-initialized
+struct init_probe
+{
+    init_probe()
+      : value_initialized{ false }
+    {}
+    explicit init_probe(bool v)
+      : value_initialized{ v }
+    {}
+
+    bool value_initialized;
+};
+
+static bool
+is_aligned(const void* ptr, std::size_t alignment)
+{
+    return reinterpret_cast<std::uintptr_t>(ptr) % alignment == 0;
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_buffer_alignment)
+{
+    for (std::size_t size : { 1, 3, 64, 1000, 1024 * 1024 }) {
+        buffer buf(size);
+        BOOST_CHECK(is_aligned(buf.data(), 64));
+        buf.resize(3 * size);
+        BOOST_CHECK(is_aligned(buf.data(), 64));
+    }
+
+    std::vector<std::uint32_t, sodium::buffer_allocator<std::uint32_t, 4096>>
+      page(10);
+    BOOST_CHECK(is_aligned(page.data(), 4096));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_buffer_default_init)
+{
+    std::vector<init_probe, sodium::buffer_allocator<init_probe>> v(4);
+    BOOST_CHECK(!v[0].value_initialized);
+
+    // arguments are still forwarded to the constructor
+    v.emplace_back(true);
+    BOOST_CHECK(v.back().value_initialized);
+
+    // a buffer keeps its capacity across calls when cleared
+    buffer buf(1024);
+    const auto* data = buf.data();
+    buf.clear();
+    buf.resize(512);
+    BOOST_CHECK(buf.data() == data);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_buffer_as_bt)
+{
+    buffer plaintext(100000);
+    randombytes_buf(plaintext.data(), plaintext.size());
+
+    sodium::aead<buffer> sc_aead;
+    sodium::aead<buffer>::nonce_type aead_nonce;
+    buffer header{ 'h', 'd', 'r' };
+    buffer ciphertext = sc_aead.encrypt(header, plaintext, aead_nonce);
+    BOOST_CHECK(is_aligned(ciphertext.data(), 64));
+    BOOST_CHECK(sc_aead.decrypt(header, ciphertext, aead_nonce) == plaintext);
+
+    sodium::secretbox<buffer> sc_box;
+    sodium::secretbox<buffer>::nonce_type box_nonce;
+    ciphertext = sc_box.encrypt(plaintext, box_nonce);
+    BOOST_CHECK(sc_box.decrypt(ciphertext, box_nonce) == plaintext);
+
+    sodium::box<buffer>::keypair_type alice;
+    sodium::box<buffer>::keypair_type bob;
+    sodium::box<buffer> sc_pk;
+    sodium::box<buffer>::nonce_type pk_nonce;
+    ciphertext = sc_pk.encrypt(
+      plaintext, bob.public_key(), alice.private_key(), pk_nonce);
+    BOOST_CHECK(sc_pk.decrypt(ciphertext,
+                              bob.private_key(),
+                              alice.public_key(),
+                              pk_nonce) == plaintext);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,154 @@
+// test_buffered_stream_filter.cpp -- Test sodium::buffered_stream_filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::buffered_stream_filter Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "buffered_stream_filter.h"
+#include "common.h"
+
+#include <algorithm> // std::min()
+#include <string>
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+using chars = sodium::chars;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+// the whole plaintext xor-ed with the key stream in one go
+template<typename Filter, typename Cipher>
+chars
+reference_xor(const chars& plaintext,
+              const typename Filter::key_type& key,
+              const typename Filter::nonce_type& nonce)
+{
+    chars result(plaintext.size());
+    Cipher::xor_ic(reinterpret_cast<unsigned char*>(result.data()),
+                   reinterpret_cast<const unsigned char*>(plaintext.data()),
+                   plaintext.size(),
+                   nonce.data(),
+                   0,
+                   key.data());
+    return result;
+}
+
+// write plaintext through filter in chunks of varying sizes
+template<typename Filter>
+chars
+filter_output(Filter& filter, const chars& plaintext)
+{
+    chars result;
+    io::filtering_ostream os;
+    os.push(filter);
+    os.push(io::back_inserter(result));
+
+    std::size_t pos = 0;
+    for (std::size_t i = 0; pos != plaintext.size(); ++i) {
+        // mostly small records, and now and then a big one
+        std::size_t n = (i % 10 == 9) ? 150000 : 1 + (i * 7919) % 3000;
+        n = std::min(n, plaintext.size() - pos);
+        os.write(plaintext.data() + pos, n);
+        pos += n;
+    }
+    os.reset();
+    return result;
+}
+
+template<typename Filter>
+chars
+filter_input(Filter& filter, const chars& input)
+{
+    chars result(input.size());
+    io::array_source source{ input.data(), input.size() };
+    io::filtering_istream is;
+    is.push(filter);
+    is.push(source);
+    is.read(result.data(), result.size());
+    BOOST_CHECK_EQUAL(static_cast<std::size_t>(is.gcount()), input.size());
+    return result;
+}
+
+template<typename Filter, typename Cipher>
+void
+test_cipher(std::size_t size)
+{
+    typename Filter::key_type key;
+    typename Filter::nonce_type nonce;
+
+    chars plaintext(size);
+    randombytes_buf(plaintext.data(), plaintext.size());
+    chars expected = reference_xor<Filter, Cipher>(plaintext, key, nonce);
+
+    Filter encrypt_filter{ 1000, key, nonce }; // rounded up to 64 KiB
+    chars ciphertext = filter_output(encrypt_filter, plaintext);
+    BOOST_CHECK(ciphertext == expected);
+
+    // the filter restarts at the beginning of the key stream after close
+    BOOST_CHECK(filter_output(encrypt_filter, plaintext) == expected);
+
+    Filter decrypt_filter{ 100000, key, nonce };
+    BOOST_CHECK(filter_input(decrypt_filter, ciphertext) == plaintext);
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_buffered_xchacha20_filter)
+{
+    for (std::size_t size : { 0UL, 1UL, 63UL, 65536UL, 65537UL, 500000UL })
+        test_cipher<sodium::buffered_xchacha20_filter,
+                    sodium::stream_cipher_xchacha20>(size);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_buffered_chacha20_filter)
+{
+    test_cipher<sodium::buffered_chacha20_filter,
+                sodium::stream_cipher_chacha20>(300000);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_buffered_salsa20_filter)
+{
+    test_cipher<sodium::buffered_salsa20_filter,
+                sodium::stream_cipher_salsa20>(300000);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_buffered_xsalsa20_filter)
+{
+    test_cipher<sodium::buffered_xsalsa20_filter,
+                sodium::stream_cipher_xsalsa20>(300000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
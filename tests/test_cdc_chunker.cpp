@@ -0,0 +1,162 @@
+// test_cdc_chunker.cpp -- Test sodium::cdc_chunker
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::cdc_chunker Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "cdc_chunker.h"
+#include "common.h"
+#include "random.h"
+
+#include <cstddef>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::cdc_chunker;
+using bytes = sodium::bytes;
+
+// cut all of data into chunks, return their sizes
+std::vector<std::size_t>
+chunk_sizes(const cdc_chunker& chunker, const bytes& data)
+{
+    std::vector<std::size_t> sizes;
+    std::size_t pos = 0;
+    while (pos != data.size()) {
+        const std::size_t size = chunker.cut(
+          sodium::span<const sodium::byte>(data.data() + pos,
+                                           data.size() - pos),
+          true);
+        sizes.push_back(size);
+        pos += size;
+    }
+    return sizes;
+}
+
+// the offsets where chunks end
+std::set<std::size_t>
+boundaries(const std::vector<std::size_t>& sizes)
+{
+    std::set<std::size_t> result;
+    std::size_t pos = 0;
+    for (std::size_t size : sizes)
+        result.insert(pos += size);
+    return result;
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_cdc_chunker_sizes)
+{
+    const cdc_chunker chunker{ cdc_chunker::key_type() };
+    bytes data(4 * 1024 * 1024);
+    sodium::randombytes_buf_inplace(data);
+
+    const auto sizes = chunk_sizes(chunker, data);
+    std::size_t total = 0;
+    for (std::size_t i = 0; i != sizes.size(); ++i) {
+        total += sizes[i];
+        BOOST_CHECK(sizes[i] <= cdc_chunker::MAX_SIZE);
+        if (i + 1 != sizes.size())
+            BOOST_CHECK(sizes[i] > cdc_chunker::MIN_SIZE);
+    }
+    BOOST_CHECK_EQUAL(total, data.size());
+
+    // normalized chunking: the average is close to AVG_SIZE
+    const double avg = static_cast<double>(total) / sizes.size();
+    BOOST_CHECK(avg > cdc_chunker::AVG_SIZE / 2);
+    BOOST_CHECK(avg < cdc_chunker::AVG_SIZE * 2);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_cdc_chunker_incremental)
+{
+    const cdc_chunker chunker{ cdc_chunker::key_type() };
+    bytes data(100000);
+    sodium::randombytes_buf_inplace(data);
+    const sodium::span<const sodium::byte> all(data);
+
+    const std::size_t first = chunker.cut(all, true);
+
+    // not enough data yet: 0, or the same cut point
+    for (std::size_t n : { 10UL, 2048UL, first - 1, first, first + 1 }) {
+        const std::size_t size = chunker.cut(all.first(n), false);
+        BOOST_CHECK(size == 0 || size == first);
+        BOOST_CHECK_EQUAL(size == first, n >= first);
+    }
+    BOOST_CHECK_EQUAL(chunker.cut(all.first(10), true), 10UL);
+    BOOST_CHECK_EQUAL(chunker.cut(all.first(0), true), 0UL);
+
+    // with max_size() bytes or more, there is always a cut point
+    const bytes zeroes(200000, 0);
+    const std::size_t size = chunker.cut(zeroes, false);
+    BOOST_CHECK(size > cdc_chunker::MIN_SIZE);
+    BOOST_CHECK(size <= cdc_chunker::MAX_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_cdc_chunker_shift_resistance)
+{
+    const cdc_chunker chunker{ cdc_chunker::key_type() };
+    bytes data(1024 * 1024);
+    sodium::randombytes_buf_inplace(data);
+
+    // insert a few bytes in the middle: only nearby chunks change
+    bytes edited(data.begin(), data.begin() + 500000);
+    edited.insert(edited.end(), { 1, 2, 3, 4, 5 });
+    edited.insert(edited.end(), data.begin() + 500000, data.end());
+
+    const auto before = boundaries(chunk_sizes(chunker, data));
+    std::set<std::size_t> after;
+    for (std::size_t b : boundaries(chunk_sizes(chunker, edited)))
+        after.insert(b > 500000 ? b - 5 : b);
+
+    std::size_t common = 0;
+    for (std::size_t b : before)
+        common += after.count(b);
+    BOOST_CHECK(common + 4 >= before.size());
+
+    // another key, other boundaries
+    const cdc_chunker other{ cdc_chunker::key_type() };
+    BOOST_CHECK(boundaries(chunk_sizes(other, data)) != before);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_cdc_chunker_wrong_sizes)
+{
+    const cdc_chunker::key_type key;
+    BOOST_CHECK_THROW(cdc_chunker(key, 32, 64, 128), std::runtime_error);
+    BOOST_CHECK_THROW(cdc_chunker(key, 4096, 4096, 8192), std::runtime_error);
+    BOOST_CHECK_THROW(cdc_chunker(key, 1024, 8192, 8192), std::runtime_error);
+    BOOST_CHECK_NO_THROW(cdc_chunker(key, 64, 256, 1024));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
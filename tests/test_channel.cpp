@@ -0,0 +1,208 @@
+// test_channel.cpp -- Test sodium::channel
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::channel Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "channel.h"
+#include "common.h"
+#include "keypair.h"
+#include "random.h"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <sodium.h>
+
+using sodium::bytes;
+using sodium::channel;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+// a connected client/server pair
+struct channel_pair
+{
+    channel_pair(std::uint64_t rekey_messages = channel::REKEY_MESSAGES,
+                 std::uint64_t rekey_bytes = channel::REKEY_BYTES)
+      : client{ client_keypair,
+                server_keypair.public_key(),
+                channel::role_type::client,
+                rekey_messages,
+                rekey_bytes }
+      , server{ server_keypair,
+                client_keypair.public_key(),
+                channel::role_type::server,
+                rekey_messages,
+                rekey_bytes }
+    {
+        client.accept(server.header());
+        server.accept(client.header());
+    }
+
+    channel::keypair_type client_keypair;
+    channel::keypair_type server_keypair;
+    channel client;
+    channel server;
+};
+
+bytes
+random_bytes(std::size_t size)
+{
+    bytes result(size);
+    sodium::randombytes_buf_inplace(result);
+    return result;
+}
+
+// seal with from, open with to
+bool
+roundtrip(channel& from, channel& to, const bytes& plaintext)
+{
+    bytes sealed(channel::sealed_size(plaintext.size()));
+    bytes opened(plaintext.size());
+
+    return from.seal_into(sealed, plaintext) == 0 &&
+           to.open_into(opened, sealed) == 0 && opened == plaintext;
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_channel_duplex)
+{
+    channel_pair p;
+
+    for (std::size_t size : { 0UL, 1UL, 100UL, 10000UL }) {
+        BOOST_CHECK(roundtrip(p.client, p.server, random_bytes(size)));
+        BOOST_CHECK(roundtrip(p.server, p.client, random_bytes(size)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_channel_falsified)
+{
+    channel_pair p;
+
+    bytes plaintext = random_bytes(100);
+    bytes sealed(channel::sealed_size(plaintext.size()));
+    bytes opened(plaintext.size());
+    BOOST_REQUIRE_EQUAL(p.client.seal_into(sealed, plaintext), 0);
+
+    bytes falsified{ sealed };
+    ++falsified[10];
+    BOOST_CHECK_EQUAL(p.server.open_into(opened, falsified), -1);
+
+    // wrong added data
+    bytes added_data{ 'a', 'd' };
+    BOOST_CHECK_EQUAL(p.server.open_into(opened, sealed, added_data), -1);
+
+    // the genuine message still opens, but can't be replayed
+    BOOST_CHECK_EQUAL(p.server.open_into(opened, sealed), 0);
+    BOOST_CHECK(opened == plaintext);
+    BOOST_CHECK_EQUAL(p.server.open_into(opened, sealed), -1);
+
+    // a message sealed by the client can't be opened by the client
+    BOOST_REQUIRE_EQUAL(p.client.seal_into(sealed, plaintext), 0);
+    BOOST_CHECK_EQUAL(p.client.open_into(opened, sealed), -1);
+
+    // buffers too small
+    bytes too_small(channel::sealed_size(plaintext.size()) - 1);
+    BOOST_CHECK_EQUAL(p.client.seal_into(too_small, plaintext), -1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_channel_wrong_peer)
+{
+    channel::keypair_type client_keypair;
+    channel::keypair_type server_keypair;
+    channel::keypair_type mallory_keypair;
+
+    channel client{ client_keypair,
+                    server_keypair.public_key(),
+                    channel::role_type::client };
+    channel server{ server_keypair,
+                    mallory_keypair.public_key(),
+                    channel::role_type::server };
+    client.accept(server.header());
+    server.accept(client.header());
+
+    BOOST_CHECK(!roundtrip(client, server, random_bytes(100)));
+
+    bytes wrong_size(channel::KEYSIZE_PUBLIC_KEY - 1);
+    BOOST_CHECK_THROW(
+      channel(client_keypair, wrong_size, channel::role_type::client),
+      std::runtime_error);
+    BOOST_CHECK_THROW(client.accept(wrong_size), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_channel_rekey)
+{
+    // rekey every 3 messages, resp. every 1000 bytes
+    channel_pair by_messages(3, 0);
+    channel_pair by_bytes(0, 1000);
+
+    for (int i = 0; i != 20; ++i) {
+        BOOST_CHECK(
+          roundtrip(by_messages.client, by_messages.server, random_bytes(50)));
+        BOOST_CHECK(
+          roundtrip(by_bytes.server, by_bytes.client, random_bytes(300)));
+    }
+
+    // rekeying after every single message
+    channel::keypair_type a;
+    channel::keypair_type b;
+    channel rekeyed{ a, b.public_key(), channel::role_type::client, 1, 0 };
+    channel peer{ b, a.public_key(), channel::role_type::server, 1, 0 };
+    peer.accept(rekeyed.header());
+    BOOST_CHECK(roundtrip(rekeyed, peer, random_bytes(10)));
+    BOOST_CHECK(roundtrip(rekeyed, peer, random_bytes(10)));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_channel_final)
+{
+    channel_pair p;
+
+    bytes plaintext = random_bytes(10);
+    bytes sealed(channel::sealed_size(plaintext.size()));
+    bytes opened(plaintext.size());
+
+    BOOST_REQUIRE_EQUAL(p.client.seal_into(sealed, plaintext, {}, true), 0);
+    BOOST_CHECK(!p.server.closed());
+    BOOST_CHECK_EQUAL(p.server.open_into(opened, sealed), 0);
+    BOOST_CHECK(p.server.closed());
+
+    // nothing can be sealed, nor opened, after the final message
+    BOOST_CHECK(p.client.tx_closed());
+    BOOST_CHECK_THROW(p.client.seal_into(sealed, plaintext),
+                      std::runtime_error);
+    BOOST_CHECK_EQUAL(p.server.open_into(opened, sealed), -1);
+
+    // the other direction is still open
+    BOOST_CHECK(roundtrip(p.server, p.client, plaintext));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,234 @@
+// test_compress_encrypt_filter.cpp -- Test compress+encrypt filters
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::compress_encrypt_filter Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "compress_encrypt_filter.h"
+#include "decrypt_decompress_filter.h"
+#include "random.h"
+
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+using sodium::compress_encrypt_filter;
+using sodium::decrypt_decompress_filter;
+using key_type = compress_encrypt_filter::key_type;
+
+constexpr std::size_t CHUNKSIZE = 16384;
+
+std::string
+encrypt(const key_type& key,
+        const std::string& plaintext,
+        std::size_t chunksize = CHUNKSIZE,
+        double threshold =
+          sodium::compress_encrypt_symmetric_filter::ENTROPY_THRESHOLD)
+{
+    std::string ciphertext;
+    compress_encrypt_filter filter(4096, key, chunksize);
+    filter.set_entropy_threshold(threshold);
+    {
+        io::filtering_ostream os;
+        os.push(filter);
+        os.push(io::back_inserter(ciphertext));
+        os.write(plaintext.data(), plaintext.size());
+    }
+    return ciphertext;
+}
+
+std::string
+decrypt(const key_type& key,
+        const std::string& ciphertext,
+        std::size_t chunksize = CHUNKSIZE)
+{
+    std::string plaintext;
+    io::filtering_ostream os;
+    os.push(decrypt_decompress_filter(4096, key, chunksize));
+    os.push(io::back_inserter(plaintext));
+    os.exceptions(std::ios_base::badbit); // don't swallow errors in write()
+    os.write(ciphertext.data(), ciphertext.size());
+    os.reset();
+    return plaintext;
+}
+
+// text-like, compressible data
+std::string
+make_text(std::size_t size)
+{
+    static const char* words[] = { "the ",  "quick ", "brown ", "fox ",
+                                   "jumps ", "over ",  "lazy ",  "dog\n" };
+    std::string text;
+    while (text.size() < size)
+        text += words[randombytes_uniform(8)];
+    text.resize(size);
+    return text;
+}
+
+std::string
+make_random(std::size_t size)
+{
+    std::string data(size, '\0');
+    sodium::randombytes_buf_inplace(data);
+    return data;
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_compress_encrypt_roundtrip)
+{
+    const key_type key;
+
+    for (std::size_t size : { 0UL,
+                              1UL,
+                              CHUNKSIZE - 1,
+                              CHUNKSIZE,
+                              CHUNKSIZE + 1,
+                              10 * CHUNKSIZE + 7 }) {
+        const std::string text = make_text(size);
+        BOOST_CHECK(decrypt(key, encrypt(key, text)) == text);
+
+        const std::string data = make_random(size);
+        BOOST_CHECK(decrypt(key, encrypt(key, data)) == data);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_compress_encrypt_sizes)
+{
+    const key_type key;
+    const std::size_t size = 8 * CHUNKSIZE;
+    const std::size_t records = size / CHUNKSIZE + 1; // + empty final
+    const std::size_t overhead =
+      compress_encrypt_filter::HEADERSIZE +
+      records * (compress_encrypt_filter::RECORD_PREFIXSIZE +
+                 compress_encrypt_filter::MACSIZE);
+
+    // text compresses well
+    const std::string text = make_text(size);
+    BOOST_CHECK(encrypt(key, text).size() < size / 2);
+
+    // random data is stored: exactly the size of the plaintext
+    const std::string data = make_random(size);
+    BOOST_CHECK_EQUAL(encrypt(key, data).size(), size + overhead);
+
+    // also when the entropy estimate lets it through to zlib
+    BOOST_CHECK_EQUAL(encrypt(key, data, CHUNKSIZE, 9.0).size(),
+                      size + overhead);
+
+    // a threshold of 0 disables compression altogether
+    BOOST_CHECK_EQUAL(encrypt(key, text, CHUNKSIZE, 0.0).size(),
+                      size + overhead);
+    BOOST_CHECK(decrypt(key, encrypt(key, text, CHUNKSIZE, 0.0)) == text);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_compress_encrypt_entropy)
+{
+    using sodium::compress_detail::estimate_entropy;
+
+    const std::string zeroes(100000, '\0');
+    const std::string text = make_text(100000);
+    const std::string data = make_random(100000);
+    using span_type = sodium::span<const sodium::byte>;
+
+    BOOST_CHECK_EQUAL(estimate_entropy(span_type(zeroes)), 0.0);
+    BOOST_CHECK(estimate_entropy(span_type(text)) < 5.0);
+    BOOST_CHECK(estimate_entropy(span_type(data)) > 7.5);
+    BOOST_CHECK_EQUAL(estimate_entropy(span_type()), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_compress_encrypt_tampering)
+{
+    const key_type key;
+    const std::string text = make_text(3 * CHUNKSIZE) + make_random(CHUNKSIZE);
+    const std::string ciphertext = encrypt(key, text);
+    const std::size_t header = compress_encrypt_filter::HEADERSIZE;
+
+    // flip a bit of the header, of a length, of a label, of a record
+    for (std::size_t pos : { 0UL, 8UL, 20UL, header, header + 4, header + 9 }) {
+        std::string bad = ciphertext;
+        bad[pos] ^= 1;
+        BOOST_CHECK_THROW(decrypt(key, bad), std::runtime_error);
+    }
+
+    // truncated, extended, another key, another chunksize
+    BOOST_CHECK_THROW(decrypt(key, ciphertext.substr(0, ciphertext.size() - 1)),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(decrypt(key, ciphertext.substr(0, header)),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(decrypt(key, ciphertext + ciphertext),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(decrypt(key_type(), ciphertext), std::runtime_error);
+    BOOST_CHECK_THROW(decrypt(key, ciphertext, CHUNKSIZE / 2),
+                      std::runtime_error);
+
+    // dropping a whole (stored) record
+    const std::size_t first = compress_encrypt_filter::RECORD_PREFIXSIZE +
+                              sodium::compress_detail::load_le32(
+                                reinterpret_cast<const sodium::byte*>(
+                                  ciphertext.data() + header));
+    const std::string dropped =
+      ciphertext.substr(0, header) + ciphertext.substr(header + first);
+    BOOST_CHECK_THROW(decrypt(key, dropped), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_compress_encrypt_input_filter)
+{
+    const key_type key;
+    const std::string text = make_text(5 * CHUNKSIZE + 3);
+    const std::string ciphertext = encrypt(key, text);
+
+    // decrypt_decompress_filter as an InputFilter
+    std::istringstream istr(ciphertext);
+    io::filtering_istream is;
+    is.push(decrypt_decompress_filter(1024, key, CHUNKSIZE));
+    is.push(istr);
+
+    std::string plaintext;
+    io::copy(is, io::back_inserter(plaintext));
+    BOOST_CHECK(plaintext == text);
+
+    BOOST_CHECK_THROW(compress_encrypt_filter(1024, key, 0),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(decrypt_decompress_filter(1024, key, 0),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,220 @@
+// test_concurrency.cpp -- Stress test sharing sealed wrappers across threads
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::concurrency Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "aead_auto.h"
+#include "authenticator.h"
+#include "box_precomputed.h"
+#include "common.h"
+#include "hasher_generic.h"
+#include "hasher_short.h"
+#include "keypair.h"
+#include "keypairsign.h"
+#include "secretbox.h"
+#include "signer.h"
+#include "trace.h"
+#include "verifier.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using bytes = sodium::bytes;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+constexpr std::size_t NTHREADS = 8;
+constexpr std::size_t ITERATIONS = 500;
+
+// the trace counters of every page protection change and protected
+// allocation: none of them may move while sealed wrappers are in use
+static std::uint64_t
+protected_memory_events()
+{
+    return sodium::trace::value("sodium::allocator::allocate()") +
+           sodium::trace::value("sodium::allocator::deallocate()") +
+           sodium::trace::value("sodium::allocator::noaccess()") +
+           sodium::trace::value("sodium::allocator::readonly()") +
+           sodium::trace::value("sodium::allocator::readwrite()");
+}
+
+// run f(thread_index, iteration) on NTHREADS threads, and count the
+// iterations for which it returned false
+template<typename F>
+std::size_t
+hammer(F f)
+{
+    std::atomic<std::size_t> failures{ 0 };
+    std::vector<std::thread> threads;
+
+    for (std::size_t t = 0; t != NTHREADS; ++t)
+        threads.emplace_back([&f, &failures, t]() {
+            for (std::size_t i = 0; i != ITERATIONS; ++i)
+                if (!f(t, i))
+                    failures.fetch_add(1, std::memory_order_relaxed);
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    return failures.load();
+}
+
+// a message that differs for every thread and iteration
+static bytes
+message(std::size_t t, std::size_t i)
+{
+    const std::string s =
+      "message " + std::to_string(t) + "/" + std::to_string(i);
+    return bytes(s.cbegin(), s.cend());
+}
+
+// a nonce that is unique for every thread and iteration. Random nonces
+// are not drawn in the threads: every thread would set up its own
+// (protected) sodium::buffered_random state.
+template<typename NONCE>
+NONCE
+nonce_for(const NONCE& base, std::size_t t, std::size_t i)
+{
+    NONCE result = base;
+    result += t * ITERATIONS + i;
+    return result;
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_concurrency_symmetric)
+{
+    const sodium::aead<bytes> sc_aead;
+    const sodium::aead_auto<bytes> sc_auto{ sodium::aead_auto<>::key_type() };
+    const sodium::secretbox<bytes> sc_box;
+    const sodium::authenticator<bytes> sc_auth;
+
+    const sodium::aead<bytes>::nonce_type aead_base;
+    const sodium::aead_auto<bytes>::nonce_type auto_base;
+    const sodium::secretbox<bytes>::nonce_type box_base;
+
+    const std::uint64_t events = protected_memory_events();
+
+    const std::size_t failures = hammer([&](std::size_t t, std::size_t i) {
+        const bytes plaintext = message(t, i);
+        const bytes header{ static_cast<sodium::byte>(t) };
+
+        const auto aead_nonce = nonce_for(aead_base, t, i);
+        const bytes c1 = sc_aead.encrypt(header, plaintext, aead_nonce);
+
+        const auto auto_nonce = nonce_for(auto_base, t, i);
+        const bytes c2 = sc_auto.encrypt(header, plaintext, auto_nonce);
+
+        const auto box_nonce = nonce_for(box_base, t, i);
+        const bytes c3 = sc_box.encrypt(plaintext, box_nonce);
+
+        const bytes mac = sc_auth.mac(plaintext);
+
+        return sc_aead.decrypt(header, c1, aead_nonce) == plaintext &&
+               sc_auto.decrypt(header, c2, auto_nonce) == plaintext &&
+               sc_box.decrypt(c3, box_nonce) == plaintext &&
+               sc_auth.verify(plaintext, mac);
+    });
+
+    BOOST_CHECK_EQUAL(failures, 0);
+    BOOST_CHECK_EQUAL(protected_memory_events(), events);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_concurrency_hashers)
+{
+    const sodium::hasher_generic<bytes> hasher;
+    const sodium::hasher_short<bytes> hasher_short;
+
+    // the expected hashes, computed on this thread
+    std::vector<std::vector<bytes>> expected(NTHREADS);
+    for (std::size_t t = 0; t != NTHREADS; ++t)
+        for (std::size_t i = 0; i != ITERATIONS; ++i) {
+            const bytes plaintext = message(t, i);
+            bytes both = hasher.hash(plaintext);
+            const bytes h = hasher_short.hash(plaintext);
+            both.insert(both.end(), h.cbegin(), h.cend());
+            expected[t].push_back(both);
+        }
+
+    const std::uint64_t events = protected_memory_events();
+
+    const std::size_t failures = hammer([&](std::size_t t, std::size_t i) {
+        const bytes plaintext = message(t, i);
+        bytes both = hasher.hash(plaintext);
+        const bytes h = hasher_short.hash(plaintext);
+        both.insert(both.end(), h.cbegin(), h.cend());
+        return both == expected[t][i];
+    });
+
+    BOOST_CHECK_EQUAL(failures, 0);
+    BOOST_CHECK_EQUAL(protected_memory_events(), events);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_concurrency_public_key)
+{
+    sodium::keypair<> alice;
+    sodium::keypair<> bob;
+    const sodium::box_precomputed<bytes> alice_box(alice.private_key(),
+                                                   bob.public_key());
+    const sodium::box_precomputed<bytes> bob_box(bob.private_key(),
+                                                 alice.public_key());
+
+    sodium::keypairsign<> keypair;
+    const sodium::signer<bytes> sc_signer(keypair.private_key());
+    const sodium::verifier<bytes> sc_verifier(keypair.public_key());
+
+    const sodium::box_precomputed<bytes>::nonce_type base;
+
+    const std::uint64_t events = protected_memory_events();
+
+    const std::size_t failures = hammer([&](std::size_t t, std::size_t i) {
+        const bytes plaintext = message(t, i);
+
+        const auto nonce = nonce_for(base, t, i);
+        const bytes ciphertext = alice_box.encrypt(plaintext, nonce);
+        const bytes signature = sc_signer.sign_detached(plaintext);
+
+        return bob_box.decrypt(ciphertext, nonce) == plaintext &&
+               sc_verifier.verify_detached(plaintext, signature);
+    });
+
+    BOOST_CHECK_EQUAL(failures, 0);
+    BOOST_CHECK_EQUAL(protected_memory_events(), events);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,259 @@
+// test_datagram_batch.cpp -- Test sodium::datagram_{batch,sealer,opener}
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::datagram_batch Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "common.h"
+#include "datagram_batch.h"
+#include "random.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <sodium.h>
+
+using sodium::byte;
+using sodium::bytes;
+
+using batch_type = sodium::datagram_batch<>;
+using sealer_type = sodium::datagram_sealer<>;
+using opener_type = sodium::datagram_opener<>;
+using key_type = sealer_type::key_type;
+using nonce_type = sealer_type::nonce_type;
+
+constexpr std::size_t MAX_PAYLOAD = 1200;
+
+// the payload of datagram i: i % MAX_PAYLOAD (up to 1200) bytes
+bytes
+make_payload(std::size_t i)
+{
+    bytes payload((i * 53) % (MAX_PAYLOAD + 1));
+    for (std::size_t j = 0; j != payload.size(); ++j)
+        payload[j] = static_cast<byte>(i + j);
+    return payload;
+}
+
+// fill slots [0, n) of batch with the payloads first, first + 1, ...
+void
+fill(batch_type& batch, std::size_t first, std::size_t n)
+{
+    batch.resize(n);
+    for (std::size_t i = 0; i != n; ++i) {
+        const bytes payload = make_payload(first + i);
+        std::copy(payload.begin(), payload.end(), batch.payload(i).begin());
+        batch.set_length(i, payload.size());
+    }
+}
+
+// deliver datagram i of from into slot j of to, as a transport would
+void
+deliver(batch_type& from, std::size_t i, batch_type& to, std::size_t j)
+{
+    const auto wire = from.wire(i);
+    std::copy(wire.begin(), wire.end(), to.wire_buffer(j).begin());
+    to.set_wire_length(j, wire.size());
+}
+
+// payload j of batch is make_payload(expected)
+bool
+has_payload(batch_type& batch, std::size_t j, std::size_t expected)
+{
+    const bytes payload = make_payload(expected);
+    const auto got = batch.payload(j).first(batch.length(j));
+    return batch.accepted(j) && got.size() == payload.size() &&
+           std::equal(got.begin(), got.end(), payload.begin());
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+      : initialized{ sodium_init() != -1 }
+      , tx(64, MAX_PAYLOAD)
+      , rx(64, MAX_PAYLOAD)
+    {
+        BOOST_REQUIRE(initialized);
+    }
+
+    bool initialized;
+    key_type key;
+    nonce_type base;
+    batch_type tx;
+    batch_type rx;
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_datagram_batch_roundtrip)
+{
+    sealer_type sealer(key, base);
+    opener_type opener(key, base);
+
+    for (std::size_t round = 0; round != 3; ++round) {
+        fill(tx, round * 64, 64);
+        BOOST_CHECK_EQUAL(sealer.seal(tx), 0);
+        BOOST_CHECK_EQUAL(sealer.next_sequence(), (round + 1) * 64);
+
+        // delivered in reverse order
+        rx.resize(64);
+        for (std::size_t i = 0; i != 64; ++i)
+            deliver(tx, i, rx, 63 - i);
+        BOOST_CHECK_EQUAL(opener.open(rx), 64UL);
+        for (std::size_t j = 0; j != 64; ++j)
+            BOOST_CHECK(has_payload(rx, j, round * 64 + 63 - j));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_datagram_batch_format)
+{
+    sealer_type sealer(key, base, 1000);
+    fill(tx, 0, 3);
+    BOOST_CHECK_EQUAL(sealer.seal(tx), 0);
+
+    // LE64(seq) || aead<>::encrypt(AD = LE64(seq), nonce = base + seq)
+    const sodium::aead<bytes, sodium::aead_chacha20_poly1305_ietf> aead(key);
+    for (std::size_t i = 0; i != 3; ++i) {
+        const auto wire = tx.wire(i);
+        const bytes payload = make_payload(i);
+        BOOST_REQUIRE_EQUAL(wire.size(), payload.size() + batch_type::OVERHEAD);
+        BOOST_CHECK_EQUAL(sodium::datagram_detail::load_le64(wire.data()),
+                          1000 + i);
+
+        const bytes prefix(wire.data(), wire.data() + 8);
+        bytes expected(payload.size() + batch_type::MACSIZE);
+        BOOST_CHECK_EQUAL(
+          aead.encrypt(expected, prefix, payload, base + (1000 + i)), 0);
+        BOOST_CHECK(
+          std::equal(expected.begin(), expected.end(), wire.data() + 8));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_datagram_batch_rejects)
+{
+    sealer_type sealer(key, base);
+    opener_type opener(key, base);
+
+    fill(tx, 0, 8);
+    BOOST_CHECK_EQUAL(sealer.seal(tx), 0);
+
+    // 0 and 1 fine, 2 tampered, 3 twice, 4 too short, 5 tampered seq
+    rx.resize(7);
+    deliver(tx, 0, rx, 0);
+    deliver(tx, 1, rx, 1);
+    deliver(tx, 2, rx, 2);
+    rx.wire(2)[rx.wire(2).size() - 1] ^= 1;
+    deliver(tx, 3, rx, 3);
+    deliver(tx, 3, rx, 4);
+    rx.set_wire_length(5, batch_type::OVERHEAD - 1);
+    deliver(tx, 5, rx, 6);
+    rx.wire(6)[0] ^= 1;
+
+    BOOST_CHECK_EQUAL(opener.open(rx), 3UL);
+    BOOST_CHECK(has_payload(rx, 0, 0));
+    BOOST_CHECK(has_payload(rx, 1, 1));
+    BOOST_CHECK(!rx.accepted(2));
+    BOOST_CHECK(rx.accepted(3) != rx.accepted(4));
+    BOOST_CHECK(!rx.accepted(5));
+    BOOST_CHECK(!rx.accepted(6));
+
+    // replays
+    rx.resize(2);
+    deliver(tx, 0, rx, 0);
+    deliver(tx, 1, rx, 1);
+    BOOST_CHECK_EQUAL(opener.open(rx), 0UL);
+
+    // the tampered datagram didn't burn its sequence number
+    rx.resize(1);
+    deliver(tx, 2, rx, 0);
+    BOOST_CHECK_EQUAL(opener.open(rx), 1UL);
+    BOOST_CHECK(has_payload(rx, 0, 2));
+
+    // another key, another base
+    opener_type stranger(key_type(), base);
+    opener_type stranger2(key, nonce_type());
+    rx.resize(1);
+    deliver(tx, 6, rx, 0);
+    BOOST_CHECK_EQUAL(stranger.open(rx), 0UL);
+    deliver(tx, 6, rx, 0);
+    BOOST_CHECK_EQUAL(stranger2.open(rx), 0UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_datagram_batch_window)
+{
+    sealer_type sealer(key, base);
+    opener_type opener(key, base);
+
+    // seal 0..63 and keep 0, then skip ahead by more than WINDOW
+    fill(tx, 0, 64);
+    BOOST_CHECK_EQUAL(sealer.seal(tx), 0);
+    batch_type old(1, MAX_PAYLOAD);
+    deliver(tx, 0, old, 0);
+
+    for (std::size_t round = 1; round != 20; ++round) {
+        fill(tx, round * 64, 64);
+        BOOST_CHECK_EQUAL(sealer.seal(tx), 0);
+    }
+    rx.resize(1);
+    deliver(tx, 63, rx, 0);
+    BOOST_CHECK_EQUAL(opener.open(rx), 1UL);
+    BOOST_CHECK_EQUAL(opener.window().highest(), 20 * 64 - 1);
+
+    BOOST_CHECK_EQUAL(opener.open(old), 0UL); // too old to tell
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_datagram_batch_socket)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(::socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0);
+
+    sealer_type sealer(key, base);
+    opener_type opener(key, base);
+
+    std::size_t received = 0;
+    for (std::size_t round = 0; round != 4; ++round) {
+        fill(tx, round * 16, 16);
+        BOOST_CHECK_EQUAL(sealer.seal(tx), 0);
+        BOOST_CHECK_EQUAL(tx.send(fds[0]), 16);
+
+        BOOST_CHECK_EQUAL(rx.receive(fds[1], MSG_DONTWAIT), 16);
+        BOOST_CHECK_EQUAL(rx.size(), 16UL);
+        BOOST_CHECK_EQUAL(opener.open(rx), 16UL);
+        for (std::size_t j = 0; j != rx.size(); ++j)
+            received += has_payload(rx, j, round * 16 + j);
+    }
+    BOOST_CHECK_EQUAL(received, 64UL);
+
+    // nothing left
+    BOOST_CHECK_EQUAL(rx.receive(fds[1], MSG_DONTWAIT), -1);
+    BOOST_CHECK_EQUAL(rx.size(), 0UL);
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+
+    BOOST_CHECK_THROW(batch_type(0, MAX_PAYLOAD), std::runtime_error);
+    BOOST_CHECK_THROW(rx.resize(65), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,147 @@
+// test_decode_filter.cpp -- Test sodium::{hex,base64}_decode_filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::decode_filter Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "decode_filter.h"
+#include "helpers.h"
+
+#include <algorithm> // std::min()
+#include <stdexcept>
+#include <string>
+
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+// write input through filter in chunks of 1, 2, ..., chunk chars
+template<typename Filter>
+std::string
+filter_output(Filter& filter, const std::string& input, std::size_t chunk)
+{
+    std::string result;
+    io::filtering_ostream os;
+    os.push(filter);
+    os.push(io::back_inserter(result));
+    os.exceptions(std::ios_base::badbit | std::ios_base::failbit);
+
+    std::size_t pos = 0;
+    for (std::size_t i = 0; pos != input.size(); ++i) {
+        std::size_t n = std::min(1 + i % chunk, input.size() - pos);
+        os.write(input.data() + pos, n);
+        pos += n;
+    }
+    os.flush(); // errors of buffered writes are only reported here
+    os.reset();
+    return result;
+}
+
+template<int VARIANT>
+void
+test_base64(const std::string& input)
+{
+    const std::string encoded = sodium::bin2base64<VARIANT>(input);
+
+    // down to an output buffer that can't even hold a whole group
+    for (std::streamsize buffer_size : { 1, 2, 5, 4096 }) {
+        sodium::base64_decode_filter<VARIANT> filter(buffer_size);
+        for (std::size_t chunk : { 1UL, 3UL, 7UL, 1000UL })
+            BOOST_CHECK(filter_output(filter, encoded, chunk) == input);
+    }
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_hex_decode_filter)
+{
+    for (std::size_t size : { 0UL, 1UL, 2UL, 3UL, 100UL, 10000UL }) {
+        std::string input(size, '\0');
+        randombytes_buf(input.data(), input.size());
+        const std::string encoded = sodium::bin2hex(input);
+
+        for (std::streamsize buffer_size : { 1, 3, 4096 }) {
+            sodium::hex_decode_filter filter(buffer_size);
+            for (std::size_t chunk : { 1UL, 7UL, 1000UL })
+                BOOST_CHECK(filter_output(filter, encoded, chunk) == input);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_base64_decode_filter)
+{
+    // all combinations of full groups and partial last groups
+    for (std::size_t size : { 0UL, 1UL, 2UL, 3UL, 4UL, 5UL, 10000UL }) {
+        std::string input(size, '\0');
+        randombytes_buf(input.data(), input.size());
+
+        test_base64<sodium_base64_VARIANT_ORIGINAL>(input);
+        test_base64<sodium_base64_VARIANT_ORIGINAL_NO_PADDING>(input);
+        test_base64<sodium_base64_VARIANT_URLSAFE>(input);
+        test_base64<sodium_base64_VARIANT_URLSAFE_NO_PADDING>(input);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_base64_decode_filter_invalid)
+{
+    // an invalid char, padding in the middle, a lone trailing char
+    for (std::string encoded :
+         { "c3ViamVjdHM!X2Q=", "c3Vi=mVjdHM/X2Q=", "QQ==QUFB", "QUFBQ" }) {
+        sodium::base64_decode_filter<> filter;
+        BOOST_CHECK_THROW(filter_output(filter, encoded, 3),
+                          std::exception);
+    }
+
+    sodium::hex_decode_filter filter;
+    BOOST_CHECK_THROW(filter_output(filter, std::string{ "0a0" }, 1),
+                      std::exception);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_base64_decode_filter_source)
+{
+    // decode while reading, without materialising the decoded stream
+    const std::string encoded{ "c3ViamVjdHM/X2Q=" };
+    io::filtering_istream is(sodium::base64_decode_filter<>() |
+                             io::array_source(encoded.data(), encoded.size()));
+
+    std::string result;
+    io::copy(is, io::back_inserter(result));
+    BOOST_CHECK(result == "subjects?_d");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
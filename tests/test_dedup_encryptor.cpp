@@ -0,0 +1,229 @@
+// test_dedup_encryptor.cpp -- Test sodium::dedup_encryptor
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::dedup_encryptor Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "cdc_chunker.h"
+#include "common.h"
+#include "dedup_encryptor.h"
+#include "random.h"
+#include "thread_pool.h"
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <sodium.h>
+
+using sodium::cdc_chunker;
+using encryptor_type = sodium::dedup_encryptor<>;
+using chunk_id_type = encryptor_type::chunk_id_type;
+using bytes = sodium::bytes;
+
+// a thread-safe chunk store: is_new() claims ids, sink() stores chunks
+struct chunk_store
+{
+    bool is_new(const chunk_id_type& id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return claimed.insert(id).second;
+    }
+
+    void sink(const chunk_id_type& id, sodium::span<const sodium::byte> c)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        chunks[id] = bytes(c.begin(), c.end());
+    }
+
+    bytes fetch(const chunk_id_type& id) { return chunks.at(id); }
+
+    encryptor_type::recipe_type encrypt(const encryptor_type& enc,
+                                        const std::string& data,
+                                        sodium::thread_pool* pool = nullptr)
+    {
+        std::istringstream istr(data);
+        return enc.encrypt(
+          istr,
+          [this](const chunk_id_type& id) { return is_new(id); },
+          [this](const chunk_id_type& id, sodium::span<const sodium::byte> c) {
+              sink(id, c);
+          },
+          pool);
+    }
+
+    std::string decrypt(const encryptor_type& enc,
+                        const encryptor_type::recipe_type& recipe)
+    {
+        std::ostringstream ostr;
+        enc.decrypt(
+          recipe, [this](const chunk_id_type& id) { return fetch(id); }, ostr);
+        return ostr.str();
+    }
+
+    std::mutex mutex;
+    std::set<chunk_id_type> claimed;
+    std::map<chunk_id_type, bytes> chunks;
+};
+
+std::string
+random_string(std::size_t size)
+{
+    std::string s(size, '\0');
+    sodium::randombytes_buf_inplace(s);
+    return s;
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+      : initialized{ sodium_init() != -1 } // before the keys
+      , chunker{ cdc_chunker::key_type() }
+      , enc{ encryptor_type::key_type(),
+             encryptor_type::id_key_type(encryptor_type::IDSIZE),
+             chunker,
+             256 * 1024 }
+    {
+        BOOST_REQUIRE(initialized);
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+
+    bool initialized;
+    cdc_chunker chunker;
+    encryptor_type enc;
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_dedup_encryptor_roundtrip)
+{
+    for (std::size_t size : { 0UL, 1UL, 5000UL, 300000UL, 2000000UL }) {
+        chunk_store store;
+        const std::string data = random_string(size);
+
+        const auto recipe = store.encrypt(enc, data);
+        std::size_t total = 0;
+        for (const auto& ref : recipe) {
+            BOOST_CHECK_EQUAL(ref.offset, total);
+            BOOST_CHECK(ref.stored);
+            total += ref.size;
+        }
+        BOOST_CHECK_EQUAL(total, size);
+        BOOST_CHECK_EQUAL(store.chunks.size(), recipe.size());
+        BOOST_CHECK(store.decrypt(enc, recipe) == data);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_dedup_encryptor_dedup)
+{
+    chunk_store store;
+    const std::string data = random_string(1000000);
+    const auto recipe1 = store.encrypt(enc, data);
+    const std::size_t stored = store.chunks.size();
+
+    // the same data again: nothing new to encrypt
+    const auto recipe2 = store.encrypt(enc, data);
+    BOOST_CHECK_EQUAL(store.chunks.size(), stored);
+    BOOST_REQUIRE_EQUAL(recipe2.size(), recipe1.size());
+    for (const auto& ref : recipe2)
+        BOOST_CHECK(!ref.stored);
+
+    // an edit in the middle: only a few new chunks
+    std::string edited = data;
+    edited.insert(400000, "an edit");
+    const auto recipe3 = store.encrypt(enc, edited);
+    BOOST_CHECK(store.chunks.size() - stored <= 3);
+    BOOST_CHECK(store.decrypt(enc, recipe3) == edited);
+
+    // repeated content within one stream is stored once
+    chunk_store other;
+    const std::string block = random_string(200000);
+    const auto recipe4 = other.encrypt(enc, block + block + block);
+    BOOST_CHECK(other.chunks.size() < recipe4.size());
+    BOOST_CHECK(other.decrypt(enc, recipe4) == block + block + block);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_dedup_encryptor_parallel)
+{
+    sodium::thread_pool pool(3);
+    const std::string data = random_string(3000000);
+
+    chunk_store sequential;
+    chunk_store parallel;
+    const auto recipe1 = sequential.encrypt(enc, data);
+    const auto recipe2 = parallel.encrypt(enc, data, &pool);
+
+    // same chunks and ids, whatever the schedule
+    BOOST_REQUIRE_EQUAL(recipe1.size(), recipe2.size());
+    for (std::size_t i = 0; i != recipe1.size(); ++i) {
+        BOOST_CHECK(recipe1[i].id == recipe2[i].id);
+        BOOST_CHECK_EQUAL(recipe1[i].size, recipe2[i].size);
+    }
+    BOOST_CHECK_EQUAL(parallel.chunks.size(), sequential.chunks.size());
+    BOOST_CHECK(parallel.decrypt(enc, recipe2) == data);
+
+    // exceptions of the callbacks are rethrown
+    std::istringstream istr(data);
+    BOOST_CHECK_THROW(
+      enc.encrypt(
+        istr,
+        [](const chunk_id_type&) -> bool {
+            throw std::runtime_error{ "is_new" };
+        },
+        [](const chunk_id_type&, sodium::span<const sodium::byte>) {},
+        &pool),
+      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_dedup_encryptor_tampering)
+{
+    chunk_store store;
+    const std::string data = random_string(100000);
+    const auto recipe = store.encrypt(enc, data);
+    BOOST_REQUIRE(recipe.size() >= 2);
+
+    const chunk_id_type id0 = recipe[0].id;
+    const chunk_id_type id1 = recipe[1].id;
+    const bytes chunk0 = store.chunks[id0];
+
+    bytes bad = chunk0;
+    bad[bad.size() / 2] ^= 1;
+    BOOST_CHECK_THROW(enc.decrypt_chunk(id0, bad), std::runtime_error);
+
+    // a chunk under another id
+    BOOST_CHECK_THROW(enc.decrypt_chunk(id1, chunk0), std::runtime_error);
+    const bytes small(10);
+    BOOST_CHECK_THROW(enc.decrypt_chunk(id0, small), std::runtime_error);
+
+    // other keys can't decrypt
+    const encryptor_type other{ encryptor_type::key_type(),
+                                encryptor_type::id_key_type(32),
+                                chunker };
+    BOOST_CHECK_THROW(other.decrypt_chunk(id0, chunk0), std::runtime_error);
+    BOOST_CHECK(other.chunk_id(sodium::span<const sodium::byte>(data)) !=
+                enc.chunk_id(sodium::span<const sodium::byte>(data)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,214 @@
+// test_direct_devices.cpp -- Test the zero-copy Direct devices
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::direct_devices Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "common.h"
+#include "direct_devices.h"
+#include "random.h"
+
+#include <boost/iostreams/stream.hpp>
+
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+namespace fs = std::filesystem;
+
+using sodium::byte;
+using sodium::bytes;
+using sodium::direct_mode;
+
+using stream_device = sodium::stream_cipher_device<>;
+using aead_device = sodium::aead_device<>;
+
+std::string
+make_plaintext(std::size_t size)
+{
+    std::string plaintext(size, '\0');
+    for (std::size_t i = 0; i != size; ++i)
+        plaintext[i] = static_cast<char>('a' + i % 26);
+    return plaintext;
+}
+
+// write plaintext through an io::stream over device
+template<typename Device>
+void
+write_all(Device device, const std::string& plaintext)
+{
+    io::stream<Device> os(device);
+    os.write(plaintext.data(), plaintext.size());
+    BOOST_CHECK(os.good());
+}
+
+// read size bytes at offset through an io::stream over device
+template<typename Device>
+std::string
+read_at(Device device, std::size_t offset, std::size_t size)
+{
+    io::stream<Device> is(device);
+    is.seekg(offset);
+    std::string result(size, '\0');
+    is.read(&result[0], size);
+    BOOST_CHECK_EQUAL(static_cast<std::size_t>(is.gcount()), size);
+    return result;
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+      : initialized{ sodium_init() != -1 }
+    {
+        BOOST_REQUIRE(initialized);
+    }
+
+    bool initialized;
+    stream_device::key_type key;
+    stream_device::nonce_type nonce;
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_direct_stream_cipher_roundtrip)
+{
+    const std::string plaintext = make_plaintext(10000);
+    std::vector<char> region(plaintext.size());
+
+    write_all(stream_device(region, key, nonce, direct_mode::encrypt),
+              plaintext);
+
+    // the same as the key stream of libsodium
+    std::string expected(plaintext.size(), '\0');
+    crypto_stream_xchacha20_xor(
+      reinterpret_cast<unsigned char*>(&expected[0]),
+      reinterpret_cast<const unsigned char*>(plaintext.data()),
+      plaintext.size(),
+      nonce.data(),
+      key.data());
+    BOOST_CHECK(std::string(region.begin(), region.end()) == expected);
+
+    // seek and read, decrypted in place
+    BOOST_CHECK(read_at(stream_device(region, key, nonce, direct_mode::decrypt),
+                        4321,
+                        100) == plaintext.substr(4321, 100));
+    BOOST_CHECK(std::string(region.begin(), region.end()) == plaintext);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_direct_stream_cipher_counter)
+{
+    const std::string plaintext = make_plaintext(1000);
+    std::string whole = plaintext;
+    {
+        stream_device device(whole, key, nonce, direct_mode::encrypt);
+        device.close();
+        device.close(); // only once
+    }
+
+    // a region starting at block 2 of the key stream
+    std::string tail = plaintext.substr(128);
+    {
+        stream_device device(tail, key, nonce, direct_mode::encrypt, 2);
+        io::stream<stream_device> os(device); // a copy, sharing the state
+        os.close();
+    }
+    BOOST_CHECK(tail == whole.substr(128));
+
+    // another key, another nonce
+    std::string other = whole;
+    const stream_device::key_type other_key;
+    stream_device(other, other_key, nonce, direct_mode::decrypt);
+    BOOST_CHECK(other != plaintext);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_direct_aead_roundtrip)
+{
+    using aead_type = sodium::aead<bytes>;
+
+    const aead_type::key_type akey;
+    const aead_type::nonce_type anonce;
+    const bytes header{ 'h', 'd', 'r' };
+    const std::string plaintext = make_plaintext(5000);
+
+    bytes region(plaintext.size());
+    bytes mac(aead_device::MACSIZE);
+    write_all(
+      aead_device(region, mac, akey, anonce, direct_mode::encrypt, header),
+      plaintext);
+
+    // the same as aead<>::encrypt() in detached mode
+    const aead_type aead(akey);
+    bytes expected(plaintext.size()), expected_mac(aead_type::MACSIZE);
+    const bytes pbytes(plaintext.begin(), plaintext.end());
+    BOOST_CHECK_EQUAL(
+      aead.encrypt(expected, expected_mac, header, pbytes, anonce), 0);
+    BOOST_CHECK(region == expected);
+    BOOST_CHECK(mac == expected_mac);
+
+    // tampered: throws, and wipes the region rather than exposing it
+    bytes bad = region;
+    bad[17] ^= 1;
+    BOOST_CHECK_THROW(
+      aead_device(bad, mac, akey, anonce, direct_mode::decrypt, header),
+      std::runtime_error);
+    bytes copy = region;
+    BOOST_CHECK_THROW(
+      aead_device(copy, mac, akey, anonce, direct_mode::decrypt),
+      std::runtime_error);
+    bytes short_mac(aead_device::MACSIZE - 1);
+    BOOST_CHECK_THROW(
+      aead_device(region, short_mac, akey, anonce, direct_mode::decrypt),
+      std::runtime_error);
+    BOOST_CHECK(region == expected);
+
+    const aead_device reader(
+      region, mac, akey, anonce, direct_mode::decrypt, header);
+    BOOST_CHECK(read_at(reader, 1000, 2000) == plaintext.substr(1000, 2000));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_direct_mapped_file)
+{
+    const fs::path path =
+      fs::temp_directory_path() /
+      ("test_direct_devices." + std::to_string(randombytes_random()));
+    const std::string plaintext = make_plaintext(100000);
+
+    {
+        auto file = sodium::map_direct_region(path.string(), plaintext.size());
+        write_all(stream_device(file, key, nonce, direct_mode::encrypt),
+                  plaintext);
+    }
+    BOOST_CHECK_EQUAL(fs::file_size(path), plaintext.size());
+    {
+        auto file = sodium::map_direct_region(path.string());
+        const stream_device reader(file, key, nonce, direct_mode::decrypt);
+        BOOST_CHECK(read_at(reader, 99000, 1000) == plaintext.substr(99000));
+    }
+    fs::remove(path);
+
+    BOOST_CHECK_THROW(sodium::map_direct_region(path.string()),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,322 @@
+// test_encrypted_log.cpp -- Test sodium::encrypted_log_{writer,reader}
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::encrypted_log Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "encrypted_log.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+namespace fs = std::filesystem;
+
+using writer_type = sodium::encrypted_log_writer<>;
+using reader_type = sodium::encrypted_log_reader<>;
+using key_type = writer_type::key_type;
+
+std::string
+slurp(const fs::path& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(ifs), {});
+}
+
+void
+spit(const fs::path& path, const std::string& data)
+{
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs.write(data.data(), data.size());
+}
+
+// the payload of record seq: seq % 97 bytes, derived from seq
+sodium::bytes
+make_payload(std::uint64_t seq)
+{
+    sodium::bytes payload(seq % 97);
+    for (std::size_t i = 0; i != payload.size(); ++i)
+        payload[i] = static_cast<sodium::byte>(seq * 31 + i);
+    return payload;
+}
+
+// append records [first, last) with time seq * 10
+void
+append(writer_type& writer, std::uint64_t first, std::uint64_t last)
+{
+    for (std::uint64_t seq = first; seq != last; ++seq) {
+        const sodium::bytes payload = make_payload(seq);
+        BOOST_REQUIRE_EQUAL(writer.append(payload, seq * 10), seq);
+    }
+}
+
+bool
+check_log(const reader_type& reader, std::uint64_t n)
+{
+    if (reader.size() != n)
+        return false;
+    for (std::uint64_t seq = 0; seq != n; ++seq) {
+        std::uint64_t time = 0;
+        if (reader.get(seq, &time) != make_payload(seq) || time != seq * 10)
+            return false;
+    }
+    return true;
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+      : initialized{ sodium_init() != -1 }
+      , dir{ fs::temp_directory_path() /
+             ("test_encrypted_log." + std::to_string(randombytes_random())) }
+      , path{ (dir / "audit.log").string() }
+    {
+        BOOST_REQUIRE(initialized);
+        fs::create_directory(dir);
+        options.index_interval = 64;
+        options.group_bytes = 4096;
+    }
+    ~SodiumFixture() { fs::remove_all(dir); }
+
+    bool initialized;
+    fs::path dir;
+    std::string path;
+    key_type key;
+    sodium::encrypted_log_options options;
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_encrypted_log_roundtrip)
+{
+    {
+        writer_type writer(path, key, options);
+        BOOST_CHECK_EQUAL(writer.size(), 0UL);
+        append(writer, 0, 1000);
+        BOOST_CHECK_EQUAL(writer.size(), 1000UL);
+        BOOST_CHECK(writer.durable() > 0); // group_bytes reached
+        writer.commit();
+        BOOST_CHECK_EQUAL(writer.durable(), 1000UL);
+    }
+
+    reader_type reader(path, key);
+    BOOST_CHECK_EQUAL(reader.index_interval(), 64UL);
+    BOOST_CHECK(check_log(reader, 1000));
+    BOOST_CHECK_THROW(reader.get(1000), std::runtime_error);
+
+    // the index holds every 64th record: 1000 / 64 rounded up
+    BOOST_CHECK_EQUAL(fs::file_size(path + ".idx"),
+                      16 + (1000 + 63) / 64 * 24);
+
+    // reopening continues after the last record
+    {
+        writer_type writer(path, key, options);
+        BOOST_CHECK_EQUAL(writer.size(), 1000UL);
+        append(writer, 1000, 1234);
+    }
+    BOOST_CHECK(check_log(reader_type(path, key), 1234));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_encrypted_log_lower_bound)
+{
+    {
+        writer_type writer(path, key, options);
+        append(writer, 0, 500);
+    }
+    reader_type reader(path, key);
+
+    BOOST_CHECK_EQUAL(reader.lower_bound(0), 0UL);
+    BOOST_CHECK_EQUAL(reader.lower_bound(55), 6UL);
+    BOOST_CHECK_EQUAL(reader.lower_bound(640), 64UL);
+    BOOST_CHECK_EQUAL(reader.lower_bound(641), 65UL);
+    BOOST_CHECK_EQUAL(reader.lower_bound(4990), 499UL);
+    BOOST_CHECK_EQUAL(reader.lower_bound(4991), 500UL);
+
+    for (std::uint64_t time = 0; time < 5000; time += 7)
+        BOOST_CHECK_EQUAL(reader.lower_bound(time), (time + 9) / 10);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_encrypted_log_scan)
+{
+    {
+        writer_type writer(path, key, options);
+        append(writer, 0, 3000);
+    }
+    reader_type reader(path, key);
+
+    // a sequential range, crossing index entries
+    std::uint64_t expected = 60;
+    bool ok = true;
+    reader.scan(60, 200, [&](std::uint64_t seq, std::uint64_t time, auto p) {
+        const sodium::bytes payload = make_payload(seq);
+        ok = ok && seq == expected++ && time == seq * 10 &&
+             sodium::bytes(p.begin(), p.end()) == payload;
+    });
+    BOOST_CHECK(ok);
+    BOOST_CHECK_EQUAL(expected, 200UL);
+    BOOST_CHECK_THROW(reader.scan(0, 3001, [](auto, auto, auto) {}),
+                      std::runtime_error);
+
+    // all records in parallel: each sets its own flag
+    sodium::thread_pool pool(4);
+    std::vector<char> seen(3000, 0);
+    reader.scan(pool, [&](std::uint64_t seq, std::uint64_t time, auto p) {
+        const sodium::bytes payload = make_payload(seq);
+        seen[seq] = time == seq * 10 &&
+                    sodium::bytes(p.begin(), p.end()) == payload;
+    });
+    BOOST_CHECK(std::count(seen.begin(), seen.end(), 1) == 3000);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_encrypted_log_group_commit)
+{
+    constexpr std::size_t THREADS = 4;
+    constexpr std::size_t RECORDS = 100;
+
+    options.durable = true;
+    {
+        writer_type writer(path, key, options);
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t != THREADS; ++t)
+            threads.emplace_back([&writer] {
+                const sodium::bytes payload(100, 'x');
+                for (std::size_t i = 0; i != RECORDS; ++i)
+                    writer.append_sync(payload, 0);
+            });
+        for (auto& thread : threads)
+            thread.join();
+        BOOST_CHECK_EQUAL(writer.durable(), THREADS * RECORDS);
+    }
+
+    reader_type reader(path, key);
+    BOOST_CHECK_EQUAL(reader.size(), THREADS * RECORDS);
+    std::size_t n = 0;
+    reader.scan(0, reader.size(), [&n](auto, auto, auto p) {
+        n += p.size() == 100;
+    });
+    BOOST_CHECK_EQUAL(n, THREADS * RECORDS);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_encrypted_log_recovery)
+{
+    {
+        writer_type writer(path, key, options);
+        append(writer, 0, 300);
+    }
+    const std::string log = slurp(path);
+
+    // a torn record at the end is cut off
+    spit(path, log + log.substr(100, 50));
+    {
+        writer_type writer(path, key, options);
+        BOOST_CHECK_EQUAL(writer.size(), 300UL);
+    }
+    BOOST_CHECK(slurp(path) == log);
+
+    // a missing index is rebuilt, to the same index
+    const std::string index = slurp(path + ".idx");
+    fs::remove(path + ".idx");
+    {
+        // without an index, the reader walks from the start
+        reader_type reader(path, key);
+        BOOST_CHECK_EQUAL(reader.index_interval(), 0UL);
+        BOOST_CHECK(check_log(reader, 300));
+        BOOST_CHECK_EQUAL(reader.lower_bound(2000), 200UL);
+    }
+    {
+        writer_type writer(path, key, options);
+        BOOST_CHECK_EQUAL(writer.size(), 300UL);
+    }
+    BOOST_CHECK(slurp(path + ".idx") == index);
+
+    // an index that is ahead of the log is cut back
+    spit(path, log.substr(0, log.size() / 2));
+    {
+        writer_type writer(path, key, options);
+        append(writer, writer.size(), 300);
+    }
+    BOOST_CHECK(check_log(reader_type(path, key), 300));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_encrypted_log_tampering)
+{
+    {
+        writer_type writer(path, key, options);
+        append(writer, 0, 200);
+    }
+    const std::string log = slurp(path);
+    const std::string index = slurp(path + ".idx");
+
+    // another key
+    BOOST_CHECK_THROW(reader_type(path, key_type()).get(0),
+                      std::runtime_error);
+
+    // a flipped bit in a record
+    std::string bad = log;
+    bad[log.size() - 1] ^= 1;
+    spit(path, bad);
+    {
+        reader_type reader(path, key);
+        BOOST_CHECK_NO_THROW(reader.get(0));
+        BOOST_CHECK_THROW(reader.get(199), std::runtime_error);
+    }
+
+    // a flipped bit in the time of a record
+    bad = log;
+    bad[writer_type::HEADERSIZE + 4] ^= 1;
+    spit(path, bad);
+    BOOST_CHECK_THROW(reader_type(path, key).get(0), std::runtime_error);
+
+    // an index entry pointing to the wrong record
+    spit(path, log);
+    std::string bad_index = index;
+    bad_index[16 + 24 + 16] = bad_index[16 + 16]; // entry 1 := offset 0
+    bad_index[16 + 24 + 17] = bad_index[16 + 17];
+    bad_index[16 + 24 + 18] = bad_index[16 + 18];
+    spit(path + ".idx", bad_index);
+    {
+        reader_type reader(path, key);
+        BOOST_CHECK_NO_THROW(reader.get(63));
+        BOOST_CHECK_THROW(reader.get(64), std::runtime_error);
+    }
+
+    // not a log, another index interval
+    spit(path + ".idx", index);
+    options.index_interval = 32;
+    BOOST_CHECK_THROW(writer_type(path, key, options), std::runtime_error);
+    options.index_interval = 0;
+    BOOST_CHECK_THROW(writer_type(path, key, options), std::runtime_error);
+    spit(path, "not an encrypted log at all, but long enough");
+    BOOST_CHECK_THROW(reader_type(path, key), std::runtime_error);
+    options.index_interval = 64;
+    BOOST_CHECK_THROW(writer_type(path, key, options), std::runtime_error);
+    BOOST_CHECK_THROW(reader_type((dir / "missing").string(), key),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,273 @@
+// test_envelope.cpp -- Test sodium::envelope
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::envelope Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "envelope.h"
+#include "random.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::envelope;
+using bytes = sodium::bytes;
+using span_type = sodium::span<const sodium::byte>;
+
+bytes
+make_plaintext(std::size_t size)
+{
+    bytes plaintext(size);
+    sodium::randombytes_buf_inplace(plaintext);
+    return plaintext;
+}
+
+span_type
+header_of(const bytes& object)
+{
+    return span_type(object.data(), envelope<>::HEADERSIZE);
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_envelope_roundtrip)
+{
+    const envelope<>::key_type kek;
+    envelope<> env(kek, 7);
+
+    for (std::size_t size : { 0UL, 1UL, 100UL, 65536UL }) {
+        const bytes plaintext = make_plaintext(size);
+        const bytes ad{ 'a', 'd' };
+
+        const bytes object = env.encrypt(plaintext, ad);
+        BOOST_CHECK_EQUAL(object.size(), size + envelope<>::OVERHEAD);
+        BOOST_CHECK(env.decrypt(object, ad) == plaintext);
+
+        // every object has its own DEK
+        BOOST_CHECK(!std::equal(object.begin(),
+                                object.begin() + envelope<>::HEADERSIZE,
+                                env.encrypt(plaintext, ad).begin()));
+
+        BOOST_CHECK_THROW(env.decrypt(object), std::runtime_error);
+    }
+
+    // another envelope with the same KEK can decrypt, too
+    envelope<> other(kek, 7);
+    const bytes plaintext = make_plaintext(42);
+    BOOST_CHECK(other.decrypt(env.encrypt(plaintext)) == plaintext);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_envelope_cache_hits)
+{
+    envelope<> env(envelope<>::key_type{});
+    const bytes plaintext = make_plaintext(100);
+    const bytes object = env.encrypt(plaintext);
+
+    BOOST_CHECK_EQUAL(env.stats().size, 0UL);
+    BOOST_CHECK(env.decrypt(object) == plaintext);
+    BOOST_CHECK(env.decrypt(object) == plaintext);
+    BOOST_CHECK(env.decrypt(object) == plaintext);
+
+    auto stats = env.stats();
+    BOOST_CHECK_EQUAL(stats.misses, 1UL);
+    BOOST_CHECK_EQUAL(stats.hits, 2UL);
+    BOOST_CHECK_EQUAL(stats.size, 1UL);
+
+    // the DEK remains usable after it has been evicted
+    const envelope<>::aead_type dek = env.unwrap(header_of(object));
+    BOOST_CHECK(env.erase(header_of(object)));
+    BOOST_CHECK(!env.erase(header_of(object)));
+    env.clear();
+    BOOST_CHECK_EQUAL(env.stats().size, 0UL);
+
+    const envelope<>::nonce_type nonce(object.data() + envelope<>::HEADERSIZE);
+    bytes decrypted(plaintext.size());
+    BOOST_CHECK_EQUAL(
+      dek.decrypt(decrypted,
+                  span_type(),
+                  span_type(object.data() + envelope<>::HEADERSIZE +
+                              envelope<>::NONCESIZE,
+                            plaintext.size() + envelope<>::MACSIZE),
+                  nonce),
+      0);
+    BOOST_CHECK(decrypted == plaintext);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_envelope_ttl)
+{
+    envelope<> env(envelope<>::key_type{}, 0, 16, std::chrono::seconds(0));
+    const bytes plaintext = make_plaintext(100);
+    const bytes object = env.encrypt(plaintext);
+
+    BOOST_CHECK(env.decrypt(object) == plaintext);
+    BOOST_CHECK(env.decrypt(object) == plaintext);
+
+    const auto stats = env.stats();
+    BOOST_CHECK_EQUAL(stats.hits, 0UL);
+    BOOST_CHECK_EQUAL(stats.misses, 2UL);
+    BOOST_CHECK_EQUAL(stats.expirations, 1UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_envelope_capacity)
+{
+    envelope<> env(
+      envelope<>::key_type{}, 0, 4, std::chrono::minutes(1), 1);
+    BOOST_CHECK_EQUAL(env.capacity(), 4UL);
+
+    std::vector<bytes> objects;
+    for (int i = 0; i != 10; ++i) {
+        objects.push_back(env.encrypt(make_plaintext(10)));
+        env.decrypt(objects.back());
+    }
+
+    const auto stats = env.stats();
+    BOOST_CHECK_EQUAL(stats.size, 4UL);
+    BOOST_CHECK_EQUAL(stats.evictions, 6UL);
+
+    BOOST_CHECK_THROW(
+      (envelope<>(envelope<>::key_type{}, 0, 0)), std::runtime_error);
+    BOOST_CHECK_THROW(
+      (envelope<>(envelope<>::key_type{}, 0, 4, std::chrono::seconds(1), 0)),
+      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_envelope_tampering)
+{
+    const envelope<>::key_type kek;
+    envelope<> env(kek, 1);
+    const bytes plaintext = make_plaintext(100);
+    const bytes object = env.encrypt(plaintext);
+
+    // every byte of the header and of the body is authenticated
+    for (std::size_t i : { 0UL, 5UL, 8UL, 12UL, 40UL, 90UL, 100UL, 150UL }) {
+        bytes bad = object;
+        bad[i] ^= 1;
+        BOOST_CHECK_THROW(env.decrypt(bad), std::runtime_error);
+    }
+
+    // a wrong kek id or a wrong KEK
+    envelope<> other_id(kek, 2);
+    BOOST_CHECK_THROW(other_id.decrypt(object), std::runtime_error);
+    envelope<> other_kek(envelope<>::key_type{}, 1);
+    BOOST_CHECK_THROW(other_kek.decrypt(object), std::runtime_error);
+
+    // swapped headers: the body doesn't authenticate under the other DEK
+    bytes swapped = env.encrypt(plaintext);
+    std::copy(object.begin(),
+              object.begin() + envelope<>::HEADERSIZE,
+              swapped.begin());
+    BOOST_CHECK_THROW(env.decrypt(swapped), std::runtime_error);
+
+    BOOST_CHECK_THROW(env.decrypt(bytes(envelope<>::OVERHEAD - 1)),
+                      std::runtime_error);
+
+    // failures are not cached
+    BOOST_CHECK_EQUAL(other_kek.stats().size, 0UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_envelope_batch_unwrap)
+{
+    sodium::thread_pool pool(2);
+    envelope<> env(envelope<>::key_type{});
+
+    std::vector<bytes> plaintexts;
+    std::vector<bytes> objects;
+    std::vector<bytes> headers;
+    for (int i = 0; i != 20; ++i) {
+        plaintexts.push_back(make_plaintext(50));
+        objects.push_back(env.encrypt(plaintexts.back()));
+        headers.emplace_back(objects.back().begin(),
+                             objects.back().begin() + envelope<>::HEADERSIZE);
+    }
+    env.decrypt(objects[3]); // a hit
+    headers[5][30] ^= 1;     // doesn't authenticate
+    headers[6].pop_back();   // malformed
+
+    auto deks = env.unwrap(headers, pool);
+    BOOST_REQUIRE_EQUAL(deks.size(), headers.size());
+    for (std::size_t i = 0; i != deks.size(); ++i)
+        BOOST_CHECK_EQUAL(deks[i] == nullptr, i == 5 || i == 6);
+
+    const auto stats = env.stats();
+    BOOST_CHECK_EQUAL(stats.hits, 1UL);
+    BOOST_CHECK_EQUAL(stats.size, 18UL);
+
+    // all other objects now decrypt from the cache
+    for (std::size_t i = 0; i != objects.size(); ++i)
+        if (i != 5 && i != 6)
+            BOOST_CHECK(env.decrypt(objects[i]) == plaintexts[i]);
+    BOOST_CHECK_EQUAL(env.stats().hits, 1UL + 18UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_envelope_batch_unwrap_error)
+{
+    envelope<> env(envelope<>::key_type{});
+    std::vector<bytes> headers;
+    for (int i = 0; i != 4; ++i) {
+        const bytes object = env.encrypt(make_plaintext(50));
+        headers.emplace_back(object.begin(),
+                             object.begin() + envelope<>::HEADERSIZE);
+    }
+
+    // an executor that runs its tasks late, on threads of its own, and
+    // fails on the third one
+    std::atomic<int> submitted{ 0 };
+    std::vector<std::thread> threads;
+    sodium::thread_pool pool(
+      [&](std::function<void()> task) {
+          if (++submitted == 3)
+              throw std::logic_error{ "executor full" };
+          threads.emplace_back([task] {
+              std::this_thread::sleep_for(std::chrono::milliseconds(50));
+              task();
+          });
+      },
+      2);
+
+    // unwrap() only rethrows once the queued tasks are done with headers
+    // (and have inserted their DEKs into the cache)
+    BOOST_CHECK_THROW(env.unwrap(headers, pool), std::logic_error);
+    BOOST_CHECK_EQUAL(env.stats().size, 2UL);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
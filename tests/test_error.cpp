@@ -0,0 +1,204 @@
+// test_error.cpp -- Test the std::error_code overloads of the wrappers
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::error Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "aead_auto.h"
+#include "box.h"
+#include "box_precomputed.h"
+#include "box_seal.h"
+#include "common.h"
+#include "error.h"
+#include "keypair.h"
+#include "keypairsign.h"
+#include "secretbox.h"
+#include "signer.h"
+#include "verifier.h"
+
+#include <string>
+#include <system_error>
+
+#include <sodium.h>
+
+using sodium::bytes;
+using sodium::errc;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+static const std::string plaintext{
+    "the quick brown fox jumps over the lazy dog"
+};
+static const bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_error_category)
+{
+    std::error_code ec = errc::verification_failed;
+    BOOST_CHECK(ec);
+    BOOST_CHECK(ec == errc::verification_failed);
+    BOOST_CHECK(ec != errc::wrong_size);
+    BOOST_CHECK_EQUAL(std::string(ec.category().name()), "sodium");
+    BOOST_CHECK_EQUAL(ec.message(), "verification failed");
+    BOOST_CHECK(&ec.category() == &sodium::error_category());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_error_secretbox)
+{
+    sodium::secretbox<> sb;
+    sodium::secretbox<>::nonce_type nonce;
+    std::error_code ec = errc::wrong_size;
+
+    bytes ciphertext = sb.encrypt(plainblob, nonce);
+    BOOST_CHECK(sb.decrypt(ciphertext, nonce, ec) == plainblob);
+    BOOST_CHECK(!ec);
+
+    ++ciphertext[0];
+    BOOST_CHECK(sb.decrypt(ciphertext, nonce, ec).empty());
+    BOOST_CHECK(ec == errc::verification_failed);
+
+    BOOST_CHECK(sb.decrypt(bytes(3), nonce, ec).empty());
+    BOOST_CHECK(ec == errc::message_too_short);
+
+    bytes mac(sodium::secretbox<>::MACSIZE);
+    bytes detached = sb.encrypt(plainblob, nonce, mac);
+    BOOST_CHECK(sb.decrypt(detached, nonce, mac, ec) == plainblob);
+    BOOST_CHECK(!ec);
+    ++mac[0];
+    BOOST_CHECK(sb.decrypt(detached, nonce, mac, ec).empty());
+    BOOST_CHECK(ec == errc::verification_failed);
+    BOOST_CHECK(sb.decrypt(detached, nonce, bytes(3), ec).empty());
+    BOOST_CHECK(ec == errc::wrong_size);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_error_aead)
+{
+    sodium::aead<> sc;
+    sodium::aead<>::nonce_type nonce;
+    bytes header{ 'h', 'd', 'r' };
+    std::error_code ec;
+
+    bytes ciphertext = sc.encrypt(header, plainblob, nonce);
+    BOOST_CHECK(sc.decrypt(header, ciphertext, nonce, ec) == plainblob);
+    BOOST_CHECK(!ec);
+
+    ++header[0];
+    BOOST_CHECK(sc.decrypt(header, ciphertext, nonce, ec).empty());
+    BOOST_CHECK(ec == errc::verification_failed);
+    --header[0];
+
+    bytes mac(sodium::aead<>::MACSIZE);
+    bytes detached = sc.encrypt(header, plainblob, nonce, mac);
+    BOOST_CHECK(sc.decrypt(header, detached, nonce, mac, ec) == plainblob);
+    BOOST_CHECK(!ec);
+    ++detached[0];
+    BOOST_CHECK(sc.decrypt(header, detached, nonce, mac, ec).empty());
+    BOOST_CHECK(ec == errc::verification_failed);
+
+    sodium::aead_auto<>::key_type key;
+    sodium::aead_auto<> aa(key);
+    sodium::aead_auto<>::nonce_type nonce_auto;
+    bytes tagged = aa.encrypt(header, plainblob, nonce_auto);
+    BOOST_CHECK(aa.decrypt(header, tagged, nonce_auto, ec) == plainblob);
+    BOOST_CHECK(!ec);
+    tagged[0] = 0xff; // an unknown tag
+    BOOST_CHECK(aa.decrypt(header, tagged, nonce_auto, ec).empty());
+    BOOST_CHECK(ec == errc::verification_failed);
+    BOOST_CHECK(aa.decrypt(header, bytes(1), nonce_auto, ec).empty());
+    BOOST_CHECK(ec == errc::message_too_short);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_error_box)
+{
+    sodium::keypair<> alice;
+    sodium::keypair<> bob;
+    sodium::box<> sc;
+    sodium::box<>::nonce_type nonce;
+    std::error_code ec;
+
+    bytes ciphertext = sc.encrypt(
+      plainblob, bob.public_key(), alice.private_key(), nonce);
+    BOOST_CHECK(sc.decrypt(ciphertext,
+                           bob.private_key(),
+                           alice.public_key(),
+                           nonce,
+                           ec) == plainblob);
+    BOOST_CHECK(!ec);
+
+    // bob can't decrypt with his own public key
+    BOOST_CHECK(sc.decrypt(ciphertext, bob, nonce, ec).empty());
+    BOOST_CHECK(ec == errc::verification_failed);
+
+    sodium::box_precomputed<> bp(bob.private_key(), alice.public_key());
+    BOOST_CHECK(bp.decrypt(ciphertext, nonce, ec) == plainblob);
+    BOOST_CHECK(!ec);
+    bp.destroy_shared_key();
+    BOOST_CHECK(bp.decrypt(ciphertext, nonce, ec).empty());
+    BOOST_CHECK(ec == errc::invalid_key);
+
+    sodium::box_seal<> bs;
+    bytes sealed = bs.encrypt(plainblob, bob.public_key());
+    BOOST_CHECK(bs.decrypt(sealed, bob, ec) == plainblob);
+    BOOST_CHECK(!ec);
+    BOOST_CHECK(bs.decrypt(sealed, alice, ec).empty());
+    BOOST_CHECK(ec == errc::verification_failed);
+    BOOST_CHECK(bs.decrypt(bytes(1), bob, ec).empty());
+    BOOST_CHECK(ec == errc::message_too_short);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_error_verifier)
+{
+    sodium::keypairsign<> alice;
+    sodium::signer<> s{ alice.private_key() };
+    sodium::verifier<> v{ alice.public_key() };
+    std::error_code ec;
+
+    bytes signed_message = s.sign(plainblob);
+    BOOST_CHECK(v.verify(signed_message, ec) == plainblob);
+    BOOST_CHECK(!ec);
+    ++signed_message.back();
+    BOOST_CHECK(v.verify(signed_message, ec).empty());
+    BOOST_CHECK(ec == errc::verification_failed);
+    BOOST_CHECK(v.verify(bytes(3), ec).empty());
+    BOOST_CHECK(ec == errc::message_too_short);
+
+    bytes signature = s.sign_detached(plainblob);
+    BOOST_CHECK(v.verify_detached(plainblob, signature, ec));
+    BOOST_CHECK(!ec);
+    ++signature[0];
+    BOOST_CHECK(!v.verify_detached(plainblob, signature, ec));
+    BOOST_CHECK(ec == errc::verification_failed);
+    BOOST_CHECK(!v.verify_detached(plainblob, bytes(3), ec));
+    BOOST_CHECK(ec == errc::wrong_size);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
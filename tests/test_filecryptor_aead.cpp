@@ -0,0 +1,284 @@
+// test_filecryptor_aead.cpp -- Test sodium::filecryptor_aead
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::filecryptor_aead Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "filecryptor_aead.h"
+#include "keyvar.h"
+#include "random.h"
+#include "thread_pool.h"
+#include "tree_hash.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::filecryptor_aead;
+
+namespace fs = std::filesystem;
+
+constexpr std::size_t BLOCKSIZE = 1024;
+
+std::string
+slurp(const fs::path& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(ifs), {});
+}
+
+void
+spit(const fs::path& path, const std::string& data)
+{
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs.write(data.data(), data.size());
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+      : dir{ fs::temp_directory_path() /
+             ("test_filecryptor_aead." + std::to_string(randombytes_random())) }
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        fs::create_directory(dir);
+    }
+    ~SodiumFixture() { fs::remove_all(dir); }
+
+    fs::path dir;
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_filecryptor_aead_mmap_matches_streams)
+{
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::keyvar<> hashkey(filecryptor_aead<>::HASHKEYSIZE);
+    filecryptor_aead<> fc(
+      key, nonce, BLOCKSIZE, hashkey, filecryptor_aead<>::HASHSIZE);
+
+    for (std::size_t size : { 0UL, 1UL, 1023UL, 1024UL, 1025UL, 100000UL }) {
+        std::string plaintext(size, '\0');
+        sodium::randombytes_buf_inplace(plaintext);
+        spit(dir / "plain", plaintext);
+
+        // reference: the iostreams version
+        std::istringstream istr(plaintext);
+        std::ostringstream ostr;
+        fc.encrypt(istr, ostr);
+
+        fc.encrypt((dir / "plain").string(), (dir / "cipher").string());
+        BOOST_CHECK(slurp(dir / "cipher") == ostr.str());
+
+        fc.decrypt((dir / "cipher").string(), (dir / "decrypted").string());
+        BOOST_CHECK(slurp(dir / "decrypted") == plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_filecryptor_aead_mmap_falsified)
+{
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::keyvar<> hashkey(filecryptor_aead<>::HASHKEYSIZE);
+    filecryptor_aead<> fc(
+      key, nonce, BLOCKSIZE, hashkey, filecryptor_aead<>::HASHSIZE);
+
+    std::string plaintext(5000, 'A');
+    spit(dir / "plain", plaintext);
+    fc.encrypt((dir / "plain").string(), (dir / "cipher").string());
+    std::string ciphertext = slurp(dir / "cipher");
+
+    // falsify a byte in the middle of the ciphertext
+    std::string falsified{ ciphertext };
+    ++falsified[2000];
+    spit(dir / "falsified", falsified);
+    BOOST_CHECK_THROW(
+      fc.decrypt((dir / "falsified").string(), (dir / "out").string()),
+      std::runtime_error);
+    BOOST_CHECK(!fs::exists(dir / "out")); // hash checked first
+
+    // truncate the whole last block
+    std::string truncated{ ciphertext.substr(
+      0, ciphertext.size() - filecryptor_aead<>::HASHSIZE - 1000) };
+    truncated += ciphertext.substr(ciphertext.size() -
+                                   filecryptor_aead<>::HASHSIZE);
+    spit(dir / "truncated", truncated);
+    BOOST_CHECK_THROW(
+      fc.decrypt((dir / "truncated").string(), (dir / "out").string()),
+      std::runtime_error);
+
+    // a missing input file
+    BOOST_CHECK_THROW(
+      fc.decrypt((dir / "missing").string(), (dir / "out").string()),
+      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_filecryptor_aead_decrypt_block)
+{
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::keyvar<> hashkey(filecryptor_aead<>::HASHKEYSIZE);
+    filecryptor_aead<> fc(
+      key, nonce, BLOCKSIZE, hashkey, filecryptor_aead<>::HASHSIZE);
+
+    std::string plaintext(5 * BLOCKSIZE + 10, '\0');
+    sodium::randombytes_buf_inplace(plaintext);
+    spit(dir / "plain", plaintext);
+    fc.encrypt((dir / "plain").string(), (dir / "cipher").string());
+
+    std::ifstream ifs(dir / "cipher", std::ios::binary);
+    for (std::uint64_t k : { 3, 5, 0 }) {
+        sodium::bytes block = fc.decrypt_block(ifs, k);
+        BOOST_CHECK(std::string(block.cbegin(), block.cend()) ==
+                    plaintext.substr(k * BLOCKSIZE, BLOCKSIZE));
+    }
+    BOOST_CHECK_THROW(fc.decrypt_block(ifs, 6), std::runtime_error);
+
+    // a falsified block fails, the others are still readable
+    std::string ciphertext = slurp(dir / "cipher");
+    ++ciphertext[(filecryptor_aead<>::MACSIZE + BLOCKSIZE) + 10];
+    std::istringstream falsified(ciphertext);
+    BOOST_CHECK_THROW(fc.decrypt_block(falsified, 1), std::runtime_error);
+    BOOST_CHECK_NO_THROW(fc.decrypt_block(falsified, 2));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_filecryptor_aead_pipelined)
+{
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::keyvar<> hashkey(filecryptor_aead<>::HASHKEYSIZE);
+    filecryptor_aead<> fc(
+      key, nonce, BLOCKSIZE, hashkey, filecryptor_aead<>::HASHSIZE);
+
+    for (std::size_t size : { 0UL, 1UL, 1023UL, 1024UL, 1025UL, 100000UL }) {
+        std::string plaintext(size, '\0');
+        sodium::randombytes_buf_inplace(plaintext);
+
+        std::istringstream istr(plaintext);
+        std::ostringstream ostr;
+        fc.encrypt(istr, ostr);
+
+        std::istringstream istr2(plaintext);
+        std::ostringstream ostr2;
+        fc.encrypt_pipelined(istr2, ostr2, 3, 4);
+        BOOST_CHECK(ostr2.str() == ostr.str());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_filecryptor_aead_tree)
+{
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::keyvar<> hashkey(filecryptor_aead<>::HASHKEYSIZE);
+    filecryptor_aead<> fc(
+      key, nonce, BLOCKSIZE, hashkey, filecryptor_aead<>::HASHSIZE);
+    sodium::thread_pool pool(3);
+
+    const std::size_t chunksize = filecryptor_aead<>::MACSIZE + BLOCKSIZE;
+    const std::size_t leafsize = filecryptor_aead<>::TREE_LEAF_HASHSIZE;
+
+    for (std::size_t size : { 0UL, 1UL, 1023UL, 1024UL, 1025UL, 100000UL }) {
+        std::string plaintext(size, '\0');
+        sodium::randombytes_buf_inplace(plaintext);
+        spit(dir / "plain", plaintext);
+
+        fc.encrypt_tree(
+          (dir / "plain").string(), (dir / "tree").string(), pool);
+        fc.encrypt((dir / "plain").string(), (dir / "cipher").string());
+        std::string tree = slurp(dir / "tree");
+        std::string cipher = slurp(dir / "cipher");
+
+        // same chunks as the serial version, then leaves and root
+        const std::size_t csize = cipher.size() - filecryptor_aead<>::HASHSIZE;
+        const std::size_t nblocks = (size + BLOCKSIZE - 1) / BLOCKSIZE;
+        BOOST_CHECK_EQUAL(tree.size(), cipher.size() + nblocks * leafsize);
+        BOOST_CHECK(tree.substr(0, csize) == cipher.substr(0, csize));
+
+        // the root is the tree_hash of the chunks
+        sodium::tree_hash th(
+          hashkey, filecryptor_aead<>::HASHSIZE, chunksize, pool);
+        th.update(reinterpret_cast<const unsigned char*>(tree.data()), csize);
+        std::string root(filecryptor_aead<>::HASHSIZE, '\0');
+        th.final(reinterpret_cast<unsigned char*>(&root[0]));
+        BOOST_CHECK(tree.substr(tree.size() - root.size()) == root);
+
+        BOOST_CHECK(fc.verify_tree((dir / "tree").string(), pool).empty());
+        fc.decrypt_tree(
+          (dir / "tree").string(), (dir / "decrypted").string(), pool);
+        BOOST_CHECK(slurp(dir / "decrypted") == plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_filecryptor_aead_tree_falsified)
+{
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::keyvar<> hashkey(filecryptor_aead<>::HASHKEYSIZE);
+    filecryptor_aead<> fc(
+      key, nonce, BLOCKSIZE, hashkey, filecryptor_aead<>::HASHSIZE);
+    sodium::thread_pool pool(2);
+
+    const std::size_t chunksize = filecryptor_aead<>::MACSIZE + BLOCKSIZE;
+
+    std::string plaintext(10 * BLOCKSIZE + 10, 'A');
+    spit(dir / "plain", plaintext);
+    fc.encrypt_tree((dir / "plain").string(), (dir / "tree").string(), pool);
+    std::string tree = slurp(dir / "tree");
+
+    // corrupted chunks are pinpointed
+    std::string falsified{ tree };
+    ++falsified[2 * chunksize + 5];
+    ++falsified[7 * chunksize];
+    spit(dir / "falsified", falsified);
+    BOOST_CHECK((fc.verify_tree((dir / "falsified").string(), pool) ==
+                 std::vector<std::uint64_t>{ 2, 7 }));
+    BOOST_CHECK_THROW(fc.decrypt_tree((dir / "falsified").string(),
+                                      (dir / "out").string(),
+                                      pool),
+                      std::runtime_error);
+
+    // a falsified leaf hash or root hash
+    for (std::size_t pos :
+         { tree.size() - filecryptor_aead<>::HASHSIZE - 1, tree.size() - 1 }) {
+        falsified = tree;
+        ++falsified[pos];
+        spit(dir / "falsified", falsified);
+        BOOST_CHECK_THROW(fc.verify_tree((dir / "falsified").string(), pool),
+                          std::runtime_error);
+    }
+
+    // truncated files
+    for (std::size_t size : { 0UL, 10UL, tree.size() - 1 }) {
+        spit(dir / "truncated", tree.substr(0, size));
+        BOOST_CHECK_THROW(fc.decrypt_tree((dir / "truncated").string(),
+                                          (dir / "out").string(),
+                                          pool),
+                          std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
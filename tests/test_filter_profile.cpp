@@ -0,0 +1,207 @@
+// test_filter_profile.cpp -- Test sodium::filter_profile
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::filter_profile Test
+#include <boost/test/included/unit_test.hpp>
+
+// record the spans built into the filters too
+#define SODIUM_PROFILE 1
+
+#include "aead.h"
+#include "aead_decrypt_filter.h"
+#include "aead_encrypt_filter.h"
+#include "common.h"
+#include "filter_profile.h"
+#include "xchacha20_filter.h"
+
+#include <sstream>
+#include <string>
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+using sodium::aead;
+using sodium::aead_decrypt_filter;
+using sodium::aead_encrypt_filter;
+using sodium::filter_profile;
+using sodium::profiled;
+using sodium::stage_stats;
+using sodium::xchacha20_filter;
+using chars = sodium::chars;
+
+namespace io = boost::iostreams;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+const stage_stats*
+find_stage(const std::vector<stage_stats>& stages, const std::string& name)
+{
+    for (const auto& s : stages)
+        if (s.name == name)
+            return &s;
+    return nullptr;
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_filter_profile_output_chain)
+{
+    std::string plaintext(10000, 'A');
+    chars plainblob{ plaintext.cbegin(), plaintext.cend() };
+    chars header{ 'h', 'e', 'a', 'd' };
+
+    aead_encrypt_filter::key_type key;
+    aead_encrypt_filter::nonce_type nonce;
+    xchacha20_filter::key_type xkey;
+    xchacha20_filter::nonce_type xnonce;
+    aead<chars> crypt{ std::move(key) };
+
+    filter_profile profile;
+    chars ciphertext;
+    {
+        io::filtering_ostream os;
+        os.push(profiled(aead_encrypt_filter{ crypt, nonce, header },
+                         profile,
+                         "aead"));
+        os.push(profiled(xchacha20_filter{ 1024, xkey, xnonce },
+                         profile,
+                         "xchacha20"));
+        os.push(io::back_inserter(ciphertext));
+        os.write(plainblob.data(), plainblob.size());
+        os.flush();
+        os.pop();
+    }
+
+    BOOST_CHECK_EQUAL(ciphertext.size(),
+                      plainblob.size() + aead_encrypt_filter::MACSIZE);
+
+    const auto stages = profile.stages();
+    const stage_stats* aead_stage = find_stage(stages, "aead");
+    const stage_stats* xchacha_stage = find_stage(stages, "xchacha20");
+    BOOST_REQUIRE(aead_stage != nullptr);
+    BOOST_REQUIRE(xchacha_stage != nullptr);
+
+    BOOST_CHECK_EQUAL(aead_stage->bytes_in, plainblob.size());
+    BOOST_CHECK_EQUAL(aead_stage->bytes_out, ciphertext.size());
+    BOOST_CHECK_EQUAL(xchacha_stage->bytes_in, ciphertext.size());
+    BOOST_CHECK_EQUAL(xchacha_stage->bytes_out, ciphertext.size());
+    BOOST_CHECK(aead_stage->calls > 0);
+    BOOST_CHECK(xchacha_stage->calls > 0);
+    BOOST_CHECK(aead_stage->ticks > 0);
+    BOOST_CHECK(xchacha_stage->ticks > 0);
+
+    // the built-in spans, nested in the profiled stages
+    const stage_stats* aead_span = find_stage(stages, "aead_encrypt_filter");
+    const stage_stats* xchacha_span = find_stage(stages, "xchacha20_filter");
+    BOOST_REQUIRE(aead_span != nullptr);
+    BOOST_REQUIRE(xchacha_span != nullptr);
+    BOOST_CHECK_EQUAL(aead_span->bytes_in, plainblob.size());
+    BOOST_CHECK_EQUAL(xchacha_span->bytes_in, ciphertext.size());
+
+    std::ostringstream report;
+    profile.report(report);
+    BOOST_CHECK(report.str().find("xchacha20_filter") != std::string::npos);
+    BOOST_CHECK(report.str().find("aead ") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_filter_profile_input_chain)
+{
+    std::string plaintext(5000, 'B');
+    chars plainblob{ plaintext.cbegin(), plaintext.cend() };
+    chars header{ 'h', 'e', 'a', 'd' };
+
+    aead_encrypt_filter::key_type key;
+    aead_encrypt_filter::nonce_type nonce;
+    aead<chars> crypt{ std::move(key) };
+    chars ciphertext = crypt.encrypt(header, plainblob, nonce);
+
+    filter_profile profile;
+    chars decrypted(plainblob.size());
+    {
+        io::array_source source{ ciphertext.data(), ciphertext.size() };
+        io::filtering_istream is;
+        is.push(profiled(aead_decrypt_filter{ crypt, nonce, header },
+                         profile,
+                         "aead"));
+        is.push(source);
+        is.read(decrypted.data(), decrypted.size());
+    }
+
+    BOOST_CHECK(decrypted == plainblob);
+
+    const auto stages = profile.stages();
+    const stage_stats* aead_stage = find_stage(stages, "aead");
+    BOOST_REQUIRE(aead_stage != nullptr);
+    BOOST_CHECK_EQUAL(aead_stage->bytes_in, ciphertext.size());
+    BOOST_CHECK_EQUAL(aead_stage->bytes_out, plainblob.size());
+    BOOST_CHECK(aead_stage->ticks > 0);
+    BOOST_CHECK(find_stage(stages, "aead_decrypt_filter") != nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_filter_profile_spans_without_profile)
+{
+    xchacha20_filter::key_type key;
+    xchacha20_filter::nonce_type nonce;
+    chars plainblob(1000, 'C');
+    chars ciphertext;
+
+    filter_profile profile;
+    BOOST_CHECK(filter_profile::active() == nullptr);
+    {
+        // no profile active: the built-in spans record nothing
+        io::filtering_ostream os;
+        os.push(xchacha20_filter{ 256, key, nonce });
+        os.push(io::back_inserter(ciphertext));
+        os.write(plainblob.data(), plainblob.size());
+        os.pop();
+    }
+    BOOST_CHECK(profile.stages().empty());
+    BOOST_CHECK_EQUAL(ciphertext.size(), plainblob.size());
+
+    {
+        // a scope activates the profile for the spans
+        filter_profile::scope scope(profile);
+        BOOST_CHECK(filter_profile::active() == &profile);
+        io::filtering_ostream os;
+        os.push(xchacha20_filter{ 256, key, nonce });
+        os.push(io::back_inserter(ciphertext));
+        os.write(plainblob.data(), plainblob.size());
+        os.pop();
+    }
+    BOOST_CHECK(filter_profile::active() == nullptr);
+
+    const auto stages = profile.stages();
+    BOOST_REQUIRE_EQUAL(stages.size(), 1UL);
+    BOOST_CHECK_EQUAL(stages[0].name, "xchacha20_filter");
+    BOOST_CHECK_EQUAL(stages[0].bytes_in, plainblob.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -24,6 +24,7 @@
 #include <sodium.h>
 #include <stdexcept>
 #include <string>
+#include <thread>
 
 using bytes = sodium::bytes;
 using hasher_generic = sodium::hasher_generic<bytes>;
@@ -263,4 +264,89 @@ BOOST_AUTO_TEST_CASE(
     BOOST_CHECK(test_different_keys(plaintext));
 }
 
+BOOST_AUTO_TEST_CASE(sodium_hasher_generic_test_state_matches_hash)
+{
+    hasher_generic hasher;
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    for (std::size_t hashsize : { hasher_generic::HASHSIZE_MIN,
+                                  hasher_generic::HASHSIZE,
+                                  hasher_generic::HASHSIZE_MAX }) {
+        sodium::hasher_generic_state state = hasher.state(hashsize);
+        BOOST_CHECK_EQUAL(state.hashsize(), hashsize);
+
+        // in pieces, and several times in a row: final() resets
+        for (int i = 0; i != 3; ++i) {
+            state.update(plainblob.data(), 10);
+            state.update(plainblob.data() + 10, plainblob.size() - 10);
+            BOOST_CHECK(state.final<bytes>() ==
+                        hasher.hash(plainblob, hashsize));
+        }
+
+        // reset() drops what was absorbed so far
+        state.update(plainblob);
+        state.reset();
+        BOOST_CHECK(state.final<bytes>() == hasher.hash(bytes{}, hashsize));
+    }
+
+    BOOST_CHECK_THROW(hasher.state(hasher_generic::HASHSIZE_MAX + 1),
+                      std::runtime_error);
+
+    // keyless
+    sodium::hasher_generic_state keyless(sodium::keyvar<>(0, false));
+    bytes expected(sodium::hasher_generic_state::HASHSIZE);
+    crypto_generichash(expected.data(),
+                       expected.size(),
+                       plainblob.data(),
+                       plainblob.size(),
+                       NULL,
+                       0);
+    keyless.update(plainblob);
+    BOOST_CHECK(keyless.final<bytes>() == expected);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_hasher_generic_test_local_state)
+{
+    hasher_generic hasher1;
+    hasher_generic hasher2;
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+    bytes hash(hasher_generic::HASHSIZE);
+
+    // the same state on the same thread, reset on every call
+    sodium::hasher_generic_state& state1 = hasher1.local_state();
+    state1.update(plainblob);
+    BOOST_CHECK(&hasher1.local_state() == &state1);
+    hasher1.local_state().final(hash);
+    BOOST_CHECK(hash == hasher1.hash(bytes{}));
+
+    // different hashers and hash sizes have their own states
+    BOOST_CHECK(&hasher2.local_state() != &state1);
+    BOOST_CHECK(&hasher1.local_state(16) != &state1);
+    hasher2.local_state().update(plainblob);
+    hasher2.local_state().final(hash);
+    BOOST_CHECK(hash != hasher2.hash(plainblob)); // reset by local_state()
+
+    auto& state2 = hasher2.local_state();
+    state2.update(plainblob);
+    state2.final(hash);
+    BOOST_CHECK(hash == hasher2.hash(plainblob));
+
+    // another thread has another state
+    const sodium::hasher_generic_state* other = nullptr;
+    std::thread t([&] { other = &hasher1.local_state(); });
+    t.join();
+    BOOST_CHECK(other != &state1);
+
+    // more hashers than LOCAL_STATES still work
+    for (std::size_t i = 0; i != 2 * hasher_generic::LOCAL_STATES; ++i) {
+        hasher_generic hasher;
+        auto& state = hasher.local_state();
+        state.update(plainblob);
+        state.final(hash);
+        BOOST_CHECK(hash == hasher.hash(plainblob));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -23,7 +23,10 @@
 #include "hasher_short.h"
 #include <sodium.h>
 #include <stdexcept>
+#include <cstdint>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 using bytes = sodium::bytes;
 using sodium::hasher_short;
@@ -233,4 +236,114 @@ BOOST_AUTO_TEST_CASE(sodium_hashshort_test_move_hashers)
     BOOST_CHECK(hash1 == hash2);
 }
 
+BOOST_AUTO_TEST_CASE(sodium_hashshort_test_hash64)
+{
+    hasher_short<> hasher{};
+
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    bytes hash = hasher.hash(plainblob);
+    std::uint64_t expected = 0;
+    for (std::size_t i = 0; i != hash.size(); ++i)
+        expected |= static_cast<std::uint64_t>(hash[i]) << (8 * i);
+
+    BOOST_CHECK_EQUAL(hasher.hash64(plaintext.data(), plaintext.size()),
+                      expected);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_hashshort_test_hash64_batch)
+{
+    hasher_short<> hasher{};
+
+    // all sizes up to 3 blocks, in every lane position, plus a partial group
+    std::vector<bytes> plaintexts;
+    for (std::size_t size = 0; size != 67; ++size) {
+        plaintexts.emplace_back(size);
+        randombytes_buf(plaintexts.back().data(), size);
+    }
+
+    std::vector<const void*> data;
+    std::vector<std::size_t> sizes;
+    for (const auto& plaintext : plaintexts) {
+        data.push_back(plaintext.data());
+        sizes.push_back(plaintext.size());
+    }
+
+    for (std::size_t first = 0; first != hasher_short<>::LANES; ++first) {
+        std::size_t n = plaintexts.size() - first;
+        std::vector<std::uint64_t> out(n);
+        hasher.hash64(data.data() + first, sizes.data() + first, n, out.data());
+
+        for (std::size_t i = 0; i != n; ++i)
+            BOOST_CHECK_EQUAL(out[i],
+                              hasher.hash64(data[first + i], sizes[first + i]));
+    }
+
+    // lanes of the same size: the lockstep path covers the whole input
+    std::vector<bytes> same(8, bytes(100, 'A'));
+    for (std::size_t i = 0; i != same.size(); ++i)
+        same[i][i] = 'B';
+    std::vector<const void*> same_data;
+    for (const auto& plaintext : same)
+        same_data.push_back(plaintext.data());
+    std::vector<std::size_t> same_sizes(same.size(), 100);
+    std::vector<std::uint64_t> out(same.size());
+    hasher.hash64(same_data.data(), same_sizes.data(), same.size(), out.data());
+    for (std::size_t i = 0; i != same.size(); ++i)
+        BOOST_CHECK_EQUAL(out[i], hasher.hash64(same[i].data(), 100));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_hashshort_test_short_hash_functor)
+{
+    hasher_short<> hasher{};
+
+    sodium::short_hash<std::string> string_hash(hasher);
+    std::string plaintext{ "hello" };
+    BOOST_CHECK_EQUAL(string_hash(plaintext),
+                      static_cast<std::size_t>(hasher.hash64("hello", 5)));
+
+    sodium::short_hash<std::uint32_t> int_hash(hasher);
+    std::uint32_t value = 42;
+    BOOST_CHECK_EQUAL(int_hash(value),
+                      static_cast<std::size_t>(
+                        hasher.hash64(&value, sizeof value)));
+
+    std::unordered_map<std::string, int, sodium::short_hash<std::string>>
+      table(16, string_hash);
+    for (int i = 0; i != 1000; ++i)
+        table[std::to_string(i)] = i;
+    BOOST_CHECK_EQUAL(table.size(), 1000UL);
+    BOOST_CHECK_EQUAL(table.at("123"), 123);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_hashshort_test_hash_fixed)
+{
+    hasher_short<> hasher{};
+
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    hasher_short<>::hash_type hash = hasher.hash_fixed(plaintext);
+    BOOST_CHECK_EQUAL(hash.size(), hasher_short<>::HASHSIZE);
+    BOOST_CHECK(hash.to() == hasher.hash(plainblob));
+    BOOST_CHECK(hash == hasher.hash_fixed(plainblob));
+    std::string empty;
+    BOOST_CHECK(hash != hasher.hash_fixed(empty));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_hashshort_test_hash128)
+{
+    hasher_short<> hasher{};
+
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+
+    const auto h = hasher.hash128(plaintext.data(), plaintext.size());
+    BOOST_CHECK(h == hasher.hash128(plaintext.data(), plaintext.size()));
+    BOOST_CHECK(h != hasher.hash128(plaintext.data(), plaintext.size() - 1));
+
+    hasher_short<> other{};
+    BOOST_CHECK(h != other.hash128(plaintext.data(), plaintext.size()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
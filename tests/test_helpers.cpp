@@ -29,6 +29,7 @@
 #include <algorithm>
 #include <chrono>
 #include <cstring>
+#include <iterator>
 #include <sstream>
 #include <string>
 #include <type_traits>
@@ -943,6 +944,218 @@ BOOST_AUTO_TEST_CASE(sodium_test_helpers_bin2hex_wrong_return_type)
 }
 #endif
 
+BOOST_AUTO_TEST_CASE(sodium_test_helpers_encoded_size)
+{
+    static_assert(sodium::hex_encoded_size(32) == 64, "hex_encoded_size()");
+    static_assert(sodium::base64_encoded_size<>(32) == 44,
+                  "base64_encoded_size()");
+
+    for (std::size_t size = 0; size != 10; ++size) {
+        BOOST_CHECK_EQUAL(
+          sodium::base64_encoded_size<sodium_base64_VARIANT_ORIGINAL>(size),
+          sodium_base64_encoded_len(size, sodium_base64_VARIANT_ORIGINAL) - 1);
+        BOOST_CHECK_EQUAL(
+          sodium::base64_encoded_size<
+            sodium_base64_VARIANT_URLSAFE_NO_PADDING>(size),
+          sodium_base64_encoded_len(size,
+                                    sodium_base64_VARIANT_URLSAFE_NO_PADDING) -
+            1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_helpers_bin2hex_span)
+{
+    std::string in1{ "0123456789" };
+    sodium::bytes b1{ in1.cbegin(), in1.cend() };
+
+    // exactly as large as needed: no room for a \0
+    char out[20 + 1] = { 0 };
+    out[20] = 'X';
+    BOOST_CHECK_EQUAL(sodium::bin2hex(sodium::span<char>(out, 20), b1), 0);
+    BOOST_CHECK(std::string(out, 20) == "30313233343536373839");
+    BOOST_CHECK_EQUAL(out[20], 'X');
+
+    // too small
+    BOOST_CHECK_EQUAL(sodium::bin2hex(sodium::span<char>(out, 19), b1), -1);
+
+    // an output iterator
+    std::string hex;
+    sodium::bytes b2(1000);
+    randombytes_buf(b2.data(), b2.size());
+    sodium::bin2hex_copy(b2, std::back_inserter(hex));
+    BOOST_CHECK(hex == sodium::bin2hex(b2));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_helpers_bin2base64_span)
+{
+    sodium::bytes b1(100);
+    randombytes_buf(b1.data(), b1.size());
+
+    for (std::size_t size = 0; size != b1.size(); ++size) {
+        sodium::span<const sodium::byte> in(b1.data(), size);
+        std::string expected{ sodium::bin2base64(
+          sodium::bytes(b1.cbegin(), b1.cbegin() + size)) };
+
+        const std::size_t n = sodium::base64_encoded_size<>(size);
+        std::string out(n + 1, 'X');
+        BOOST_CHECK_EQUAL(
+          sodium::bin2base64(sodium::span<char>(out.data(), n), in), 0);
+        BOOST_CHECK(out.substr(0, n) == expected);
+        BOOST_CHECK_EQUAL(out[n], 'X'); // no \0 appended
+
+        if (n != 0)
+            BOOST_CHECK_EQUAL(
+              sodium::bin2base64(sodium::span<char>(out.data(), n - 1), in),
+              -1);
+
+        std::string copied;
+        sodium::bin2base64_copy<sodium_base64_VARIANT_URLSAFE_NO_PADDING>(
+          in, std::back_inserter(copied));
+        BOOST_CHECK(
+          copied ==
+          (sodium::bin2base64<sodium_base64_VARIANT_URLSAFE_NO_PADDING>(
+            sodium::bytes(b1.cbegin(), b1.cbegin() + size))));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_helpers_hex2bin_span)
+{
+    // both sides of the SIMD threshold, and SIMD blocks plus a tail
+    for (std::size_t size : { 0UL, 1UL, 31UL, 32UL, 33UL, 100UL, 100000UL }) {
+        sodium::bytes b1(size);
+        randombytes_buf(b1.data(), b1.size());
+        std::string hex{ sodium::bin2hex(b1) };
+
+        BOOST_CHECK_EQUAL(sodium::hex_decoded_size(hex.size()), size);
+        sodium::bytes out(size);
+        BOOST_CHECK_EQUAL(sodium::hex2bin(out, hex), 0);
+        BOOST_CHECK(out == b1);
+
+        // upper case is fine, too
+        std::transform(hex.begin(), hex.end(), hex.begin(), ::toupper);
+        std::fill(out.begin(), out.end(), 0);
+        BOOST_CHECK_EQUAL(sodium::hex2bin(out, hex), 0);
+        BOOST_CHECK(out == b1);
+
+        // an invalid char anywhere, and out is wiped
+        for (std::size_t pos : { 0UL, hex.size() / 2, hex.size() - 1 }) {
+            if (hex.empty())
+                break;
+            for (char bad : { 'g', 'G', ':', '/', '@', '\x80' }) {
+                std::string broken{ hex };
+                broken[pos] = bad;
+                BOOST_CHECK_EQUAL(sodium::hex2bin(out, broken), -1);
+                BOOST_CHECK(sodium::is_zero(out));
+            }
+        }
+
+        // too small, odd size
+        if (size != 0) {
+            sodium::span<sodium::byte> small(out.data(), size - 1);
+            BOOST_CHECK_EQUAL(sodium::hex2bin(small, hex), -1);
+            sodium::span<const char> odd(hex.data(), hex.size() - 1);
+            BOOST_CHECK_EQUAL(sodium::hex2bin(out, odd), -1);
+        }
+
+        // the string API takes the same path: exactly sized
+        BOOST_CHECK(sodium::hex2bin(hex) == b1);
+    }
+}
+
+template<int VARIANT>
+void
+test_base642bin_span(const sodium::bytes& b1)
+{
+    std::string b64{ sodium::bin2base64<VARIANT>(b1) };
+    sodium::span<const char> in(b64);
+
+    BOOST_CHECK_EQUAL(sodium::base64_decoded_size<VARIANT>(in), b1.size());
+    sodium::bytes out(b1.size());
+    BOOST_CHECK_EQUAL(sodium::base642bin<VARIANT>(out, in), 0);
+    BOOST_CHECK(out == b1);
+    BOOST_CHECK(sodium::base642bin<VARIANT>(b64) == b1);
+
+    // an invalid char anywhere (padding included), and out is wiped
+    if (!b64.empty()) {
+        const char other =
+          (VARIANT == sodium_base64_VARIANT_URLSAFE ||
+           VARIANT == sodium_base64_VARIANT_URLSAFE_NO_PADDING)
+            ? '+'
+            : '-';
+        for (std::size_t pos : { 0UL, b64.size() / 2, b64.size() - 1 }) {
+            for (char bad : { '!', '.', '=', other, '\x80' }) {
+                // '=' may turn the last group into a valid padded one
+                std::string broken{ b64 };
+                if (broken[pos] == bad || (bad == '=' && pos + 4 >= b64.size()))
+                    continue;
+                broken[pos] = bad;
+                BOOST_CHECK_EQUAL(
+                  sodium::base642bin<VARIANT>(out, sodium::span<const char>(
+                                                     broken)),
+                  -1);
+                BOOST_CHECK(sodium::is_zero(out));
+            }
+        }
+    }
+
+    // too small
+    if (!b1.empty()) {
+        sodium::span<sodium::byte> small(out.data(), out.size() - 1);
+        BOOST_CHECK_EQUAL(sodium::base642bin<VARIANT>(small, in), -1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_helpers_base642bin_span)
+{
+    // all tails, both sides of the SIMD threshold, and SIMD blocks
+    // plus a tail
+    for (std::size_t size = 0; size != 200; ++size) {
+        sodium::bytes b1(size);
+        randombytes_buf(b1.data(), b1.size());
+
+        test_base642bin_span<sodium_base64_VARIANT_ORIGINAL>(b1);
+        test_base642bin_span<sodium_base64_VARIANT_ORIGINAL_NO_PADDING>(b1);
+        test_base642bin_span<sodium_base64_VARIANT_URLSAFE>(b1);
+        test_base642bin_span<sodium_base64_VARIANT_URLSAFE_NO_PADDING>(b1);
+    }
+
+    sodium::bytes large(1000001);
+    randombytes_buf(large.data(), large.size());
+    test_base642bin_span<sodium_base64_VARIANT_ORIGINAL>(large);
+    test_base642bin_span<sodium_base64_VARIANT_URLSAFE_NO_PADDING>(large);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_helpers_base642bin_span_strict)
+{
+    sodium::bytes out(16);
+
+    // unused bits of the last char must be zero
+    std::string in1{ "QR==" };
+    BOOST_CHECK_EQUAL(sodium::base642bin<>(out, in1), -1);
+    std::string in2{ "QUF=" };
+    BOOST_CHECK_EQUAL(sodium::base642bin<>(out, in2), -1);
+    std::string in3{ "QUE=" };
+    BOOST_CHECK_EQUAL(sodium::base642bin<>(out, in3), 0);
+
+    // padding only at the end, and only if the variant pads
+    std::string in4{ "QQ==QUFB" };
+    BOOST_CHECK_EQUAL(sodium::base642bin<>(out, in4), -1);
+    std::string in5{ "QUE" };
+    BOOST_CHECK_EQUAL(sodium::base642bin<>(out, in5), -1);
+    BOOST_CHECK_EQUAL(
+      sodium::base642bin<sodium_base64_VARIANT_ORIGINAL_NO_PADDING>(out, in5),
+      0);
+    BOOST_CHECK_EQUAL(
+      sodium::base642bin<sodium_base64_VARIANT_ORIGINAL_NO_PADDING>(out, in3),
+      -1);
+
+    // a single char can't be decoded
+    std::string in6{ "QUFBQ" };
+    BOOST_CHECK_EQUAL(
+      sodium::base642bin<sodium_base64_VARIANT_ORIGINAL_NO_PADDING>(out, in6),
+      -1);
+}
+
 #if 0
 BOOST_AUTO_TEST_CASE(sodium_test_helpers_bin2base64_wrong_variant)
 {
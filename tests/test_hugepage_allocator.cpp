@@ -0,0 +1,130 @@
+// test_hugepage_allocator.cpp -- Test sodium::hugepage_allocator
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::hugepage_allocator Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "hugepage_allocator.h"
+#include "key.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include <sodium.h>
+
+using sodium::bytes_hugepage;
+using sodium::hugepage_arena;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_hugepage_allocator_large_buffers)
+{
+    const auto before = hugepage_arena::instance().stats();
+
+    {
+        bytes_hugepage big(3 * 1024 * 1024 + 5, 0x42);
+
+        // the data is 16-byte aligned, and ends right before a guard page
+        const auto addr = reinterpret_cast<std::uintptr_t>(big.data());
+        BOOST_CHECK_EQUAL(addr % 16, 0UL);
+        BOOST_CHECK(std::all_of(big.cbegin(), big.cend(), [](sodium::byte b) {
+            return b == 0x42;
+        }));
+
+#if SODIUM_HAVE_HUGEPAGES
+        const auto during = hugepage_arena::instance().stats();
+        BOOST_CHECK_EQUAL(during.regions, before.regions + 1);
+        BOOST_CHECK_EQUAL(during.bytes,
+                          before.bytes + 2 * hugepage_arena::HUGEPAGESIZE);
+        BOOST_CHECK_EQUAL((addr + big.size() + 11) %
+                            hugepage_arena::HUGEPAGESIZE,
+                          0UL);
+
+        BOOST_TEST_MESSAGE("hugetlb regions: " << during.hugetlb
+                                               << ", NUMA-bound regions: "
+                                               << during.numa);
+#endif // SODIUM_HAVE_HUGEPAGES
+    }
+
+    // regions are unmapped immediately
+    const auto after = hugepage_arena::instance().stats();
+    BOOST_CHECK_EQUAL(after.regions, before.regions);
+    BOOST_CHECK_EQUAL(after.bytes, before.bytes);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_hugepage_allocator_small_objects_fallback)
+{
+    const auto before = hugepage_arena::instance().stats();
+
+    bytes_hugepage small(4096, 0x17);
+
+    // too small for huge pages: allocated by sodium_allocarray()
+    BOOST_CHECK_EQUAL(hugepage_arena::instance().stats().regions,
+                      before.regions);
+    BOOST_CHECK_EQUAL(small[4095], 0x17);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_hugepage_allocator_protection)
+{
+    bytes_hugepage big(hugepage_arena::THRESHOLD, 0x01);
+    auto alloc = big.get_allocator();
+
+    alloc.noaccess(big.data());
+    alloc.readonly(big.data());
+    BOOST_CHECK_EQUAL(big[12345], 0x01);
+
+    alloc.readwrite(big.data());
+    big[12345] = 0x02;
+    BOOST_CHECK_EQUAL(big[12345], 0x02);
+
+    // deallocation works whatever the current protection is
+    alloc.noaccess(big.data());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_hugepage_allocator_zeroed_on_reuse)
+{
+    sodium::hugepage_allocator<std::uint64_t> alloc;
+    const std::size_t num = hugepage_arena::THRESHOLD / sizeof(std::uint64_t);
+
+    std::uint64_t* p = alloc.allocate(num);
+    std::fill(p, p + num, ~std::uint64_t(0));
+    alloc.deallocate(p, num);
+
+    // a fresh mapping: whatever address we get, it is clean
+    p = alloc.allocate(num);
+    BOOST_CHECK(
+      std::all_of(p, p + num, [](std::uint64_t v) { return v == 0; }));
+    alloc.deallocate(p, num);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
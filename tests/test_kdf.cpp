@@ -0,0 +1,201 @@
+// test_kdf.cpp -- Test sodium::kdf and sodium::kdf_cache
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::kdf Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "kdf.h"
+#include "key.h"
+#include "key_table.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::kdf;
+using sodium::kdf_cache;
+
+template<std::size_t N>
+bool
+same_key(const sodium::key<N>& a, const unsigned char* b)
+{
+    return sodium_memcmp(a.data(), b, N) == 0;
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_matches_libsodium)
+{
+    const kdf::key_type master;
+    const kdf k(master);
+    const auto ctx = kdf::make_context("tenants");
+
+    for (std::uint64_t id : { 0ULL, 1ULL, 42ULL, ~0ULL }) {
+        unsigned char expected[32];
+        crypto_kdf_derive_from_key(
+          expected, sizeof expected, id, ctx.data(), master.data());
+        BOOST_CHECK(same_key(k.derive<32>(id, ctx), expected));
+    }
+
+    // sizes other than 32
+    unsigned char expected[64];
+    crypto_kdf_derive_from_key(
+      expected, sizeof expected, 7, ctx.data(), master.data());
+    BOOST_CHECK(same_key(k.derive<64>(7, ctx), expected));
+
+    unsigned char small[kdf::SUBKEYSIZE_MIN - 1];
+    unsigned char big[kdf::SUBKEYSIZE_MAX + 1];
+    BOOST_CHECK_EQUAL(k.derive(small, 7, ctx), -1);
+    BOOST_CHECK_EQUAL(k.derive(big, 7, ctx), -1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_separation)
+{
+    const kdf k;
+    const auto tenants = kdf::make_context("tenants");
+    const auto sessions = kdf::make_context("sessions");
+
+    BOOST_CHECK(k.derive<32>(1, tenants) == k.derive<32>(1, tenants));
+    BOOST_CHECK(k.derive<32>(1, tenants) != k.derive<32>(2, tenants));
+    BOOST_CHECK(k.derive<32>(1, tenants) != k.derive<32>(1, sessions));
+    BOOST_CHECK(k.derive<32>(1, tenants) != kdf().derive<32>(1, tenants));
+
+    // copies share the master key
+    const kdf copy(k);
+    BOOST_CHECK_EQUAL(copy.key_handle().get(), k.key_handle().get());
+    BOOST_CHECK(copy.derive<32>(9, tenants) == k.derive<32>(9, tenants));
+
+    BOOST_CHECK_THROW(kdf::make_context("too long!"), std::runtime_error);
+    const auto padded = kdf::make_context("ab");
+    BOOST_CHECK_EQUAL(padded[1], 'b');
+    BOOST_CHECK_EQUAL(padded[2], '\0');
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_batch)
+{
+    const kdf k;
+    const auto ctx = kdf::make_context("tenants");
+    const std::vector<kdf::subkey_id_type> ids{ 5, 3, 1000, 0, 77 };
+
+    const auto keys = k.derive<32>(ids, ctx);
+    BOOST_REQUIRE_EQUAL(keys.size(), ids.size());
+    for (std::size_t i = 0; i != ids.size(); ++i)
+        BOOST_CHECK(keys[i] == k.derive<32>(ids[i], ctx));
+
+    sodium::key_table<32> table(ids.size() + 1, false);
+    k.derive(ids, ctx, table);
+    BOOST_CHECK(table.protection() ==
+                sodium::key_table<32>::protection_type::readonly);
+    for (std::size_t i = 0; i != ids.size(); ++i)
+        BOOST_CHECK(same_key(keys[i], table.data(i)));
+    BOOST_CHECK(table.empty(ids.size()));
+
+    sodium::key_table<32> small(ids.size() - 1, false);
+    BOOST_CHECK_THROW(k.derive(ids, ctx, small), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_cache)
+{
+    const kdf k;
+    const auto ctx = kdf::make_context("tenants");
+    const auto other_ctx = kdf::make_context("other");
+    kdf_cache<32> cache(k, 64);
+
+    const auto key1 = cache.get(1, ctx);
+    const auto key1_again = cache.get(1, ctx);
+    BOOST_CHECK_EQUAL(key1.get(), key1_again.get());
+    BOOST_CHECK(*key1 == k.derive<32>(1, ctx));
+    BOOST_CHECK(*cache.get(1, other_ctx) == k.derive<32>(1, other_ctx));
+
+    auto stats = cache.stats();
+    BOOST_CHECK_EQUAL(stats.hits, 1UL);
+    BOOST_CHECK_EQUAL(stats.misses, 2UL);
+    BOOST_CHECK_EQUAL(stats.size, 2UL);
+
+    BOOST_CHECK(cache.erase(1, ctx));
+    BOOST_CHECK(!cache.erase(1, ctx));
+    BOOST_CHECK(*key1 == k.derive<32>(1, ctx)); // still valid
+    cache.clear();
+    BOOST_CHECK_EQUAL(cache.stats().size, 0UL);
+
+    BOOST_CHECK_THROW(kdf_cache<32>(k, 0), std::runtime_error);
+    BOOST_CHECK_THROW(kdf_cache<32>(k, 1, 0), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_cache_eviction)
+{
+    const kdf k;
+    const auto ctx = kdf::make_context("tenants");
+    kdf_cache<32> cache(k, 4, 1);
+
+    for (kdf::subkey_id_type id = 0; id != 10; ++id)
+        cache.get(id, ctx);
+    cache.get(9, ctx); // the most recently used ones are still there
+
+    const auto stats = cache.stats();
+    BOOST_CHECK_EQUAL(stats.size, 4UL);
+    BOOST_CHECK_EQUAL(stats.evictions, 6UL);
+    BOOST_CHECK_EQUAL(stats.hits, 1UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_cache_concurrent)
+{
+    const kdf k;
+    const auto ctx = kdf::make_context("tenants");
+    kdf_cache<32> cache(k, 1000);
+
+    std::vector<std::thread> threads;
+    std::vector<char> ok(4, 0);
+
+    // BOOST_CHECK is not thread-safe: collect the results
+    for (std::size_t t = 0; t != ok.size(); ++t)
+        threads.emplace_back([&, t] {
+            bool all = true;
+            for (kdf::subkey_id_type id = 0; id != 200; ++id)
+                all = all && (*cache.get(id, ctx) == k.derive<32>(id, ctx));
+            ok[t] = all;
+        });
+    for (auto& th : threads)
+        th.join();
+
+    for (char result : ok)
+        BOOST_CHECK(result);
+    const auto stats = cache.stats();
+    BOOST_CHECK_EQUAL(stats.size, 200UL);
+    BOOST_CHECK_EQUAL(stats.hits + stats.misses, 800UL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,159 @@
+// test_key_ring.cpp -- Test sodium::key_ring
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::key_ring Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "common.h"
+#include "key_ring.h"
+#include "secretbox.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <sodium.h>
+
+using sodium::aead;
+using sodium::key_ring;
+using sodium::secretbox;
+using sodium::span;
+
+using byte = sodium::byte;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_ring_aead)
+{
+    using aead_type = aead<>;
+
+    aead_type::key_type k1, k2, k3;
+    key_ring<aead_type> ring;
+    ring.add(1, aead_type(k1));
+    ring.add(2, aead_type(k2));
+    ring.add(3, aead_type(k3));
+    BOOST_CHECK_EQUAL(ring.size(), 3UL);
+    BOOST_CHECK_EQUAL(ring.newest_id(), 3U);
+    BOOST_CHECK_THROW(ring.add(2, aead_type()), std::runtime_error);
+
+    const std::string msg{ "Hello, World!" };
+    sodium::bytes plaintext{ msg.cbegin(), msg.cend() };
+    sodium::bytes header{ 'h', 'd', 'r' };
+    aead_type::nonce_type nonce;
+
+    aead_type sender(k2);
+    sodium::bytes ciphertext = sender.encrypt(header, plaintext, nonce);
+    sodium::bytes decrypted(plaintext.size());
+
+    // a right hint, a wrong hint, an unknown hint
+    for (std::uint32_t hint : { 2U, 1U, 3U, 42U }) {
+        std::uint32_t id = hint;
+        BOOST_CHECK_EQUAL(
+          ring.decrypt(id,
+                       decrypted,
+                       span<const byte>(header),
+                       span<const byte>(ciphertext),
+                       nonce),
+          0);
+        BOOST_CHECK_EQUAL(id, 2U);
+        BOOST_CHECK(decrypted == plaintext);
+    }
+
+    // detached mode
+    sodium::bytes mac(aead_type::MACSIZE);
+    sodium::bytes detached =
+      sender.encrypt(header, plaintext, nonce, mac);
+    std::uint32_t id = 3;
+    BOOST_CHECK_EQUAL(ring.decrypt(id,
+                                   decrypted,
+                                   span<const byte>(header),
+                                   span<const byte>(detached),
+                                   span<const byte>(mac),
+                                   nonce),
+                      0);
+    BOOST_CHECK_EQUAL(id, 2U);
+    BOOST_CHECK(decrypted == plaintext);
+
+    // once key 2 is retired, nothing matches anymore
+    BOOST_CHECK(ring.remove(2));
+    BOOST_CHECK(!ring.remove(2));
+    id = 2;
+    BOOST_CHECK_EQUAL(ring.decrypt(id,
+                                   decrypted,
+                                   span<const byte>(header),
+                                   span<const byte>(ciphertext),
+                                   nonce),
+                      -1);
+    BOOST_CHECK_EQUAL(id, 2U);
+    BOOST_CHECK(sodium_is_zero(decrypted.data(), decrypted.size()));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_ring_secretbox)
+{
+    using box_type = secretbox<>;
+
+    box_type::key_type k1, k2;
+    key_ring<box_type, std::string> ring;
+    ring.add("old", box_type(k1));
+    ring.add("new", box_type(k2));
+
+    const std::string msg{ "the quick brown fox jumps over the lazy dog" };
+    sodium::bytes plaintext{ msg.cbegin(), msg.cend() };
+    box_type::nonce_type nonce;
+
+    sodium::bytes ciphertext = box_type(k1).encrypt(plaintext, nonce);
+    sodium::bytes decrypted(plaintext.size());
+
+    std::string id{ "new" };
+    BOOST_CHECK_EQUAL(
+      ring.decrypt(id, decrypted, span<const byte>(ciphertext), nonce), 0);
+    BOOST_CHECK_EQUAL(id, "old");
+    BOOST_CHECK(decrypted == plaintext);
+
+    // a falsified ciphertext fails with every key, without throwing
+    ++ciphertext[box_type::MACSIZE];
+    BOOST_CHECK_EQUAL(
+      ring.decrypt(id, decrypted, span<const byte>(ciphertext), nonce), -1);
+    BOOST_CHECK(sodium_is_zero(decrypted.data(), decrypted.size()));
+
+    // a too small output buffer fails as well
+    sodium::bytes small(plaintext.size() - 1);
+    --ciphertext[box_type::MACSIZE];
+    BOOST_CHECK_EQUAL(
+      ring.decrypt(id, small, span<const byte>(ciphertext), nonce), -1);
+
+    key_ring<box_type> empty_ring;
+    BOOST_CHECK_THROW(empty_ring.newest(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
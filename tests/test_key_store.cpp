@@ -0,0 +1,289 @@
+// test_key_store.cpp -- Test sodium::key_store
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::key_store Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "key_store.h"
+#include "key_table.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+namespace fs = std::filesystem;
+
+constexpr std::size_t KEYSZ = 32;
+using store_type = sodium::key_store<KEYSZ>;
+using table_type = sodium::key_table<KEYSZ>;
+
+std::string
+slurp(const fs::path& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(ifs), {});
+}
+
+void
+spit(const fs::path& path, const std::string& data)
+{
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs.write(data.data(), data.size());
+}
+
+// ids i * 7 + 3, in descending order, to check the sorting of write()
+std::vector<store_type::id_type>
+make_ids(std::size_t n)
+{
+    std::vector<store_type::id_type> ids;
+    for (std::size_t i = n; i != 0; --i)
+        ids.push_back((i - 1) * 7 + 3);
+    return ids;
+}
+
+bool
+same_key(sodium::span<const sodium::byte> k, const table_type& table, size_t i)
+{
+    return k.size() == KEYSZ &&
+           sodium_memcmp(k.data(), table.data(i), KEYSZ) == 0;
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+      : dir{ fs::temp_directory_path() /
+             ("test_key_store." + std::to_string(randombytes_random())) }
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        fs::create_directory(dir);
+    }
+    ~SodiumFixture() { fs::remove_all(dir); }
+
+    fs::path dir;
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_store_lazy_lookup)
+{
+    const std::size_t n = 1000;
+    const store_type::wrapping_key_type wkey;
+    const table_type table(n);
+    const auto ids = make_ids(n);
+    const std::string path = (dir / "keys").string();
+
+    store_type::write(path, wkey, ids, table);
+    const std::size_t entry = 8 + store_type::RECORDSIZE;
+    BOOST_CHECK_EQUAL(fs::file_size(path), store_type::HEADERSIZE + n * entry);
+
+    store_type store(path, wkey);
+    BOOST_CHECK_EQUAL(store.size(), n);
+    BOOST_CHECK_EQUAL(store.materialized_count(), 0UL);
+
+    // the index is sorted
+    for (std::size_t i = 0; i != n; ++i)
+        BOOST_CHECK_EQUAL(store.id(i), i * 7 + 3);
+
+    BOOST_CHECK(store.contains(ids[10]));
+    BOOST_CHECK(!store.contains(4));
+    BOOST_CHECK_EQUAL(store.index_of(4), store_type::npos);
+    BOOST_CHECK_THROW(store.lookup(4), std::runtime_error);
+
+    // slot i of table has id ids[i]
+    BOOST_CHECK(!store.materialized(ids[10]));
+    BOOST_CHECK(same_key(store.lookup(ids[10]), table, 10));
+    BOOST_CHECK(store.materialized(ids[10]));
+    BOOST_CHECK_EQUAL(store.materialized_count(), 1UL);
+
+    // the second lookup is served from the table
+    const auto k1 = store.lookup(ids[10]);
+    const auto k2 = store.lookup(ids[10]);
+    BOOST_CHECK_EQUAL(k1.data(), k2.data());
+    BOOST_CHECK_EQUAL(store.materialized_count(), 1UL);
+
+    const store_type::key_type k = store.get(ids[999]);
+    BOOST_CHECK(sodium_memcmp(k.data(), table.data(999), KEYSZ) == 0);
+    BOOST_CHECK_EQUAL(store.materialized_count(), 2UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_store_prewarm)
+{
+    const std::size_t n = 3 * store_type::PREWARM_BATCH + 5;
+    const store_type::wrapping_key_type wkey;
+    const table_type table(n);
+    const auto ids = make_ids(n);
+    const std::string path = (dir / "keys").string();
+    store_type::write(path, wkey, ids, table);
+
+    store_type store(path, wkey);
+    store.lookup(ids[0]);
+    BOOST_CHECK_EQUAL(store.prewarm(), n - 1);
+    BOOST_CHECK_EQUAL(store.materialized_count(), n);
+    BOOST_CHECK_EQUAL(store.prewarm(), 0UL);
+
+    for (std::size_t i = 0; i < n; i += 97)
+        BOOST_CHECK(same_key(store.lookup(ids[i]), table, i));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_store_background_prewarm)
+{
+    const std::size_t n = 2 * store_type::PREWARM_BATCH;
+    const store_type::wrapping_key_type wkey;
+    const table_type table(n);
+    const auto ids = make_ids(n);
+    const std::string path = (dir / "keys").string();
+    store_type::write(path, wkey, ids, table);
+
+    sodium::thread_pool pool(2);
+    store_type store(path, wkey);
+    store.prewarm(pool);
+
+    // lookups race with the background prewarm()
+    for (std::size_t i = 0; i < n; i += 101)
+        BOOST_CHECK(same_key(store.lookup(ids[i]), table, i));
+
+    BOOST_CHECK(store.wait_prewarm() <= n);
+    BOOST_CHECK_EQUAL(store.materialized_count(), n);
+
+    // destroying a store while prewarming in the background
+    {
+        store_type other(path, wkey);
+        other.prewarm(pool);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_store_concurrent_lookup)
+{
+    const std::size_t n = 500;
+    const store_type::wrapping_key_type wkey;
+    const table_type table(n);
+    const auto ids = make_ids(n);
+    const std::string path = (dir / "keys").string();
+    store_type::write(path, wkey, ids, table);
+
+    store_type store(path, wkey);
+    std::vector<std::thread> threads;
+    std::vector<char> ok(4, 0);
+
+    // BOOST_CHECK is not thread-safe: collect the results
+    for (std::size_t t = 0; t != ok.size(); ++t)
+        threads.emplace_back([&, t] {
+            bool all = true;
+            for (std::size_t i = t; i < n; i += 2)
+                all = all && same_key(store.lookup(ids[i]), table, i);
+            ok[t] = all;
+        });
+    for (auto& th : threads)
+        th.join();
+
+    for (char result : ok)
+        BOOST_CHECK(result);
+    BOOST_CHECK_EQUAL(store.materialized_count(), n);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_store_wrong_wrapping_key)
+{
+    const store_type::wrapping_key_type wkey;
+    const store_type::wrapping_key_type other_wkey;
+    const table_type table(10);
+    const auto ids = make_ids(10);
+    const std::string path = (dir / "keys").string();
+    store_type::write(path, wkey, ids, table);
+
+    // opening doesn't unwrap anything, the first lookup does
+    store_type store(path, other_wkey);
+    BOOST_CHECK_THROW(store.lookup(ids[0]), std::runtime_error);
+    BOOST_CHECK_EQUAL(store.prewarm(), 0UL);
+    BOOST_CHECK_EQUAL(store.materialized_count(), 0UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_store_tampering)
+{
+    const std::size_t n = 10;
+    const store_type::wrapping_key_type wkey;
+    const table_type table(n);
+    const auto ids = make_ids(n);
+    const fs::path path = dir / "keys";
+    store_type::write(path.string(), wkey, ids, table);
+    const std::string good = slurp(path);
+
+    const std::size_t records = store_type::HEADERSIZE + n * 8;
+
+    // flipping a bit of record 3 (ids are ascending: id(3) == 3*7+3)
+    std::string bad = good;
+    bad[records + 3 * store_type::RECORDSIZE + 30] ^= 1;
+    spit(path, bad);
+    {
+        store_type store(path.string(), wkey);
+        BOOST_CHECK_THROW(store.lookup(24), std::runtime_error);
+        BOOST_CHECK_NO_THROW(store.lookup(31));
+        BOOST_CHECK_EQUAL(store.prewarm(), n - 2);
+    }
+
+    // swapping the ids of records 0 and 1
+    bad = good;
+    std::swap_ranges(bad.begin() + store_type::HEADERSIZE,
+                     bad.begin() + store_type::HEADERSIZE + 8,
+                     bad.begin() + store_type::HEADERSIZE + 8);
+    spit(path, bad);
+    {
+        store_type store(path.string(), wkey);
+        BOOST_CHECK_THROW(store.get(3), std::runtime_error);
+        BOOST_CHECK_THROW(store.get(10), std::runtime_error);
+    }
+
+    // truncated, extended, wrong magic, wrong key size
+    spit(path, good.substr(0, good.size() - 1));
+    BOOST_CHECK_THROW(store_type(path.string(), wkey), std::runtime_error);
+    spit(path, good + "x");
+    BOOST_CHECK_THROW(store_type(path.string(), wkey), std::runtime_error);
+    bad = good;
+    bad[0] = 'X';
+    spit(path, bad);
+    BOOST_CHECK_THROW(store_type(path.string(), wkey), std::runtime_error);
+    spit(path, good);
+    BOOST_CHECK_THROW((sodium::key_store<16>(path.string(), wkey)),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(store_type((dir / "missing").string(), wkey),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_store_write_errors)
+{
+    const store_type::wrapping_key_type wkey;
+    const table_type table(3);
+    const std::string path = (dir / "keys").string();
+
+    std::vector<store_type::id_type> ids{ 1, 2 };
+    BOOST_CHECK_THROW(store_type::write(path, wkey, ids, table),
+                      std::runtime_error);
+    ids = { 1, 2, 1 };
+    BOOST_CHECK_THROW(store_type::write(path, wkey, ids, table),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
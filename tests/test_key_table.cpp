@@ -0,0 +1,138 @@
+// test_key_table.cpp -- Test sodium::key_table
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::key_table Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "key.h"
+#include "key_table.h"
+#include "nonce.h"
+#include "secretbox.h"
+
+#include <stdexcept>
+
+#include <sodium.h>
+
+using sodium::key_table;
+
+using table_type = key_table<sodium::KEYSIZE_SECRETBOX>;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_table_layout)
+{
+    table_type table(1000);
+
+    BOOST_CHECK_EQUAL(table.size(), 1000UL);
+    BOOST_CHECK(table.protection() == table_type::protection_type::readonly);
+
+    // contiguous slots
+    BOOST_CHECK(table.data(999) ==
+                table.data(0) + 999 * sodium::KEYSIZE_SECRETBOX);
+    BOOST_CHECK(table[7].data() == table.data(7));
+    BOOST_CHECK_EQUAL(table[7].size(), sodium::KEYSIZE_SECRETBOX);
+
+    // random, hence (almost surely) pairwise different and non-zero
+    BOOST_CHECK(!table.empty(0));
+    BOOST_CHECK(sodium_memcmp(table.data(0),
+                              table.data(1),
+                              sodium::KEYSIZE_SECRETBOX) != 0);
+
+    table_type zeroed(10, false);
+    for (std::size_t i = 0; i != zeroed.size(); ++i)
+        BOOST_CHECK(zeroed.empty(i));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_table_get_set)
+{
+    table_type table(16, false);
+    sodium::key<sodium::KEYSIZE_SECRETBOX> k;
+
+    table.set(3, k);
+    BOOST_CHECK(table.get(3) == k);
+    BOOST_CHECK(table.empty(2) && table.empty(4)); // neighbours untouched
+    BOOST_CHECK(table.protection() == table_type::protection_type::readonly);
+
+    // a key from the table works like any other key
+    sodium::secretbox<> sb1(k);
+    sodium::secretbox<> sb2(table.get(3));
+    sodium::secretbox<>::nonce_type nonce;
+    sodium::bytes plaintext{ 'a', 'b', 'c' };
+    BOOST_CHECK(sb2.decrypt(sb1.encrypt(plaintext, nonce), nonce) ==
+                plaintext);
+
+    table.initialize(5);
+    BOOST_CHECK(!table.empty(5));
+
+    BOOST_CHECK_THROW(table.get(16), std::runtime_error);
+    BOOST_CHECK_THROW(table.set(16, k), std::runtime_error);
+    BOOST_CHECK_THROW(table.initialize(16), std::runtime_error);
+    BOOST_CHECK_THROW(table.destroy(16), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_table_destroy)
+{
+    table_type table(8);
+
+    table.noaccess();
+    table.destroy(2); // whatever the protection
+    BOOST_CHECK(table.protection() == table_type::protection_type::noaccess);
+
+    table.readonly();
+    BOOST_CHECK(table.empty(2));
+    BOOST_CHECK(!table.empty(1) && !table.empty(3));
+    BOOST_CHECK_THROW(
+      [&table] {
+          table.noaccess();
+          table.get(1);
+      }(),
+      std::runtime_error);
+
+    table.readwrite();
+    table.destroy();
+    for (std::size_t i = 0; i != table.size(); ++i)
+        BOOST_CHECK(table.empty(i));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_table_hugepages)
+{
+    // 65536 keys, 2 MiB: a single hugepage_arena region
+    key_table<sodium::KEYSIZE_SECRETBOX, sodium::bytes_hugepage> table(65536);
+
+    sodium::key<sodium::KEYSIZE_SECRETBOX> k;
+    table.set(65535, k);
+    BOOST_CHECK(table.get(65535) == k);
+    BOOST_CHECK(!table.empty(0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,140 @@
+// test_keypair_pool.cpp -- Test sodium::keypair_pool
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::keypair_pool Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "helpers.h"
+#include "keypair.h"
+#include "keypair_pool.h"
+#include "keypairsign.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::keypair;
+using sodium::keypair_pool;
+using sodium::keypairsign;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_keypair_pool_pop)
+{
+    keypair_pool<> pool(0, 10);
+    BOOST_CHECK_EQUAL(pool.size(), 10UL);
+    BOOST_CHECK_EQUAL(pool.capacity(), 10UL);
+
+    keypair<> first = pool.pop();
+    for (int i = 0; i != 9; ++i) {
+        keypair<> kp = pool.pop();
+
+        // the public key belongs to the private key
+        keypair<> derived(kp.private_key().data(), kp.private_key().size());
+        BOOST_CHECK(derived == kp);
+        BOOST_CHECK(kp != first);
+    }
+    BOOST_CHECK_EQUAL(pool.size(), 0UL);
+    BOOST_CHECK_EQUAL(pool.misses(), 0UL);
+
+    // no refills with a low watermark of 0
+    sodium::bytes pk(keypair_pool<>::KEYSIZE_PUBLIC_KEY);
+    sodium::bytes_protected sk(keypair_pool<>::KEYSIZE_PRIVATE_KEY);
+    BOOST_CHECK_EQUAL(pool.pop(pk, sk), -1);
+
+    // an empty pool still hands out valid keypairs
+    keypair<> kp = pool.pop();
+    BOOST_CHECK(keypair<>(kp.private_key().data(), kp.private_key().size()) ==
+                kp);
+    BOOST_CHECK_EQUAL(pool.misses(), 1UL);
+
+    BOOST_CHECK_EQUAL(pool.refill(), 10UL);
+    BOOST_CHECK_EQUAL(pool.pop(pk, sk), 0);
+    BOOST_CHECK(!sodium::is_zero(pk));
+    sodium::bytes pk_short(pk.size() - 1);
+    BOOST_CHECK_EQUAL(pool.pop(pk_short, sk), -1);
+    BOOST_CHECK_EQUAL(pool.size(), 9UL);
+
+    BOOST_CHECK_THROW(keypair_pool<>(0, 0), std::runtime_error);
+    BOOST_CHECK_THROW(keypair_pool<>(11, 10), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_keypair_pool_background_refill)
+{
+    keypair_pool<> pool(8, 16);
+
+    for (int i = 0; i != 9; ++i)
+        pool.pop();
+
+    // the 9th pop() leaves 7 keypairs, below the low watermark:
+    // the refill thread tops the pool up again
+    for (int i = 0; i != 1000 && pool.size() != 16; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    BOOST_CHECK_EQUAL(pool.size(), 16UL);
+
+    // concurrent consumers
+    std::vector<std::thread> consumers;
+    for (int t = 0; t != 4; ++t)
+        consumers.emplace_back([&pool] {
+            for (int i = 0; i != 50; ++i)
+                pool.pop();
+        });
+    for (auto& consumer : consumers)
+        consumer.join();
+    BOOST_CHECK(pool.size() <= 16UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_keypair_pool_sign)
+{
+    keypair_pool<keypairsign<>> pool(2, 4);
+
+    for (int i = 0; i != 6; ++i) {
+        keypairsign<> kp = pool.pop();
+
+        unsigned char sig[crypto_sign_BYTES];
+        const unsigned char msg[] = "hello";
+        crypto_sign_detached(
+          sig, nullptr, msg, sizeof msg, kp.private_key().data());
+        BOOST_CHECK(crypto_sign_verify_detached(
+                      sig,
+                      msg,
+                      sizeof msg,
+                      reinterpret_cast<const unsigned char*>(
+                        kp.public_key().data())) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,178 @@
+// test_metrics.cpp -- Test sodium::metrics counters and export
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// record metrics in the wrappers used by this test
+#undef SODIUM_METRICS
+#define SODIUM_METRICS 1
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::metrics Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "key.h"
+#include "metrics.h"
+#include "nonce.h"
+#include "secretbox.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <sodium.h>
+
+namespace metrics = sodium::metrics;
+
+using sodium::secretbox;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_metrics_crypto_counters)
+{
+    secretbox<> sb;
+    secretbox<>::nonce_type nonce;
+    sodium::bytes plaintext(1000, 'A');
+
+    auto before = metrics::collect_this_thread();
+
+    sodium::bytes ciphertext = sb.encrypt(plaintext, nonce);
+    BOOST_CHECK(sb.decrypt(ciphertext, nonce) == plaintext);
+
+    ++ciphertext[10];
+    BOOST_CHECK_THROW(sb.decrypt(ciphertext, nonce), std::runtime_error);
+
+    // the span API records the same events
+    sodium::bytes out(ciphertext.size());
+    BOOST_CHECK_EQUAL(sb.decrypt(sodium::span<sodium::byte>(out),
+                                 sodium::span<const sodium::byte>(ciphertext),
+                                 nonce),
+                      -1);
+
+    auto used = metrics::collect_this_thread() - before;
+    BOOST_CHECK_EQUAL(used.bytes_encrypted, 1000UL);
+    BOOST_CHECK_EQUAL(used.bytes_decrypted, 1000UL);
+    BOOST_CHECK_EQUAL(used.mac_failures, 2UL);
+    BOOST_CHECK_EQUAL(used.filter_flushes, 0UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_metrics_allocations)
+{
+    auto before = metrics::collect_this_thread();
+    {
+        sodium::key<32> k1;
+        sodium::key<64> k2;
+    }
+    auto used = metrics::collect_this_thread() - before;
+
+    BOOST_CHECK(used.allocations >= 2);
+    BOOST_CHECK(used.allocated_bytes >= 32 + 64);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_metrics_threads)
+{
+    auto before_all = metrics::collect();
+    auto before_this = metrics::collect_this_thread();
+
+    // the counters of an exited thread are kept
+    std::thread worker([] {
+        secretbox<> sb;
+        secretbox<>::nonce_type nonce;
+        sb.encrypt(sodium::bytes(500), nonce);
+    });
+    worker.join();
+
+    auto used_all = metrics::collect() - before_all;
+    auto used_this = metrics::collect_this_thread() - before_this;
+
+    BOOST_CHECK_EQUAL(used_all.bytes_encrypted, 500UL);
+    BOOST_CHECK_EQUAL(used_this.bytes_encrypted, 0UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_metrics_pwhash_histogram)
+{
+    using metrics::histogram;
+
+    BOOST_CHECK_EQUAL(histogram::bucket_of(0), 0UL);
+    BOOST_CHECK_EQUAL(histogram::bucket_of(1000000), 0UL); // 1ms, inclusive
+    BOOST_CHECK_EQUAL(histogram::bucket_of(1000001), 1UL);
+    BOOST_CHECK_EQUAL(histogram::bucket_of(60000000000), histogram::BUCKETS);
+
+    auto before = metrics::collect_this_thread();
+
+    sodium::key<32> k;
+    sodium::bytes salt(sodium::KEYSIZE_SALT);
+    k.setpass(
+      "secret", salt, crypto_pwhash_OPSLIMIT_MIN, crypto_pwhash_MEMLIMIT_MIN);
+    metrics::pwhash_timed(std::chrono::milliseconds(30));
+
+    auto used = metrics::collect_this_thread() - before;
+    BOOST_CHECK_EQUAL(used.pwhash_latency.count(), 2UL);
+    BOOST_CHECK(used.pwhash_latency.buckets[histogram::bucket_of(30000000)] >=
+                1);
+    BOOST_CHECK(used.pwhash_latency.sum_seconds() >= 0.030);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_metrics_prometheus)
+{
+    metrics::snapshot s;
+    s.bytes_encrypted = 42;
+    s.mac_failures = 3;
+    s.pwhash_latency.buckets[0] = 1;
+    s.pwhash_latency.buckets[metrics::histogram::BUCKETS] = 2;
+    s.pwhash_latency.sum_nanoseconds = 7500000000;
+
+    std::string text = metrics::to_prometheus(s);
+    BOOST_CHECK(text.find("# TYPE sodium_bytes_encrypted_total counter\n"
+                          "sodium_bytes_encrypted_total 42\n") !=
+                std::string::npos);
+    BOOST_CHECK(text.find("sodium_mac_failures_total 3\n") !=
+                std::string::npos);
+    BOOST_CHECK(text.find("# TYPE sodium_pwhash_duration_seconds histogram\n"
+                          "sodium_pwhash_duration_seconds_bucket"
+                          "{le=\"0.001\"} 1\n") != std::string::npos);
+    BOOST_CHECK(text.find("sodium_pwhash_duration_seconds_bucket"
+                          "{le=\"5\"} 1\n"
+                          "sodium_pwhash_duration_seconds_bucket"
+                          "{le=\"+Inf\"} 3\n"
+                          "sodium_pwhash_duration_seconds_sum 7.500000000\n"
+                          "sodium_pwhash_duration_seconds_count 3\n") !=
+                std::string::npos);
+
+    // with labels
+    text = metrics::to_prometheus(s, "tenant=\"acme\"");
+    BOOST_CHECK(text.find("sodium_bytes_encrypted_total{tenant=\"acme\"} "
+                          "42\n") != std::string::npos);
+    BOOST_CHECK(text.find("sodium_pwhash_duration_seconds_bucket"
+                          "{tenant=\"acme\",le=\"+Inf\"} 3\n") !=
+                std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,174 @@
+// test_mlock_budget.cpp -- Test sodium::mlock_budget
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::mlock_budget Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "hugepage_allocator.h"
+#include "mlock_budget.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include <sodium.h>
+
+using sodium::lock_priority;
+using sodium::mlock_budget;
+using sodium::mlock_options;
+
+struct SodiumFixture
+{
+    SodiumFixture() { BOOST_REQUIRE(sodium_init() != -1); }
+
+    // back to the defaults, for the next test case
+    ~SodiumFixture() { mlock_budget::instance().configure(mlock_options{}); }
+
+    // a budget with room for extra more bytes than are locked now
+    static void budget_for(std::size_t extra, std::size_t key_reserve)
+    {
+        mlock_options options;
+        options.budget = mlock_budget::instance().stats().locked_bytes + extra;
+        options.key_reserve = key_reserve;
+        mlock_budget::instance().configure(options);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_mlock_budget_defaults)
+{
+    const auto stats = mlock_budget::instance().stats();
+    BOOST_CHECK(stats.budget != 0);
+    BOOST_CHECK_EQUAL(stats.key_reserve, stats.budget / 4);
+    BOOST_CHECK_EQUAL(stats.locked_pages * mlock_budget::page_size(),
+                      stats.locked_bytes);
+    BOOST_CHECK_EQUAL(stats.locked_bytes, stats.key_bytes + stats.bulk_bytes);
+
+    // sodium_malloc() locks whole pages, canary included
+    const std::size_t pagesize = mlock_budget::page_size();
+    BOOST_CHECK_EQUAL(mlock_budget::locked_size(1), pagesize);
+    BOOST_CHECK_EQUAL(mlock_budget::locked_size(pagesize - 16), pagesize);
+    BOOST_CHECK_EQUAL(mlock_budget::locked_size(pagesize), 2 * pagesize);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_mlock_budget_keys_are_accounted)
+{
+    const auto before = mlock_budget::instance().stats();
+    {
+        sodium::bytes_protected key(100);
+        const auto during = mlock_budget::instance().stats();
+        BOOST_CHECK_EQUAL(during.key_bytes - before.key_bytes,
+                          mlock_budget::locked_size(100));
+        BOOST_CHECK_EQUAL(during.locked_pages - before.locked_pages, 1u);
+    }
+    const auto after = mlock_budget::instance().stats();
+    BOOST_CHECK_EQUAL(after.key_bytes, before.key_bytes);
+    BOOST_CHECK_EQUAL(after.locked_bytes, before.locked_bytes);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_mlock_budget_keys_stay_locked)
+{
+    budget_for(1, 0);
+    const auto before = mlock_budget::instance().stats();
+
+    // beyond the budget: still allocated, and locked
+    sodium::bytes_protected key(100);
+    std::fill(key.begin(), key.end(), 42);
+    const auto during = mlock_budget::instance().stats();
+    BOOST_CHECK_EQUAL(during.over_budget, before.over_budget + 1);
+    BOOST_CHECK_EQUAL(during.key_bytes - before.key_bytes,
+                      mlock_budget::locked_size(100));
+    BOOST_CHECK_EQUAL(during.unlocked_bytes, before.unlocked_bytes);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_mlock_budget_bulk_falls_back)
+{
+    const std::size_t size = 100000; // below hugepage_arena::THRESHOLD
+
+    // with room to spare: locked
+    budget_for(4 * mlock_budget::locked_size(size), 0);
+    auto before = mlock_budget::instance().stats();
+    {
+        sodium::bytes_hugepage buffer(size);
+        const auto during = mlock_budget::instance().stats();
+        BOOST_CHECK_EQUAL(during.bulk_bytes - before.bulk_bytes,
+                          mlock_budget::locked_size(size));
+        BOOST_CHECK_EQUAL(during.unlocked_bytes, before.unlocked_bytes);
+    }
+    BOOST_CHECK_EQUAL(mlock_budget::instance().stats().bulk_bytes,
+                      before.bulk_bytes);
+
+    // the same room, but reserved for keys: unlocked, yet usable
+    budget_for(4 * mlock_budget::locked_size(size),
+               4 * mlock_budget::locked_size(size));
+    before = mlock_budget::instance().stats();
+    {
+        sodium::bytes_hugepage buffer(size);
+        BOOST_CHECK(std::all_of(buffer.cbegin(), buffer.cend(), [](auto b) {
+            return b == 0;
+        }));
+        std::fill(buffer.begin(), buffer.end(), 0xaa);
+
+        const auto during = mlock_budget::instance().stats();
+        BOOST_CHECK_EQUAL(during.bulk_bytes, before.bulk_bytes);
+        BOOST_CHECK_EQUAL(during.locked_bytes, before.locked_bytes);
+        BOOST_CHECK_EQUAL(during.unlocked_bytes - before.unlocked_bytes, size);
+
+        // keys still get their locked memory from the reserve
+        sodium::bytes_protected key(32);
+        BOOST_CHECK_EQUAL(mlock_budget::instance().stats().over_budget,
+                          before.over_budget);
+    }
+    BOOST_CHECK_EQUAL(mlock_budget::instance().stats().unlocked_bytes,
+                      before.unlocked_bytes);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_mlock_budget_hugepage_regions)
+{
+    const std::size_t size = 3 * sodium::hugepage_arena::HUGEPAGESIZE / 2;
+
+    budget_for(1, 0);
+    const auto before = mlock_budget::instance().stats();
+    {
+        sodium::bytes_hugepage buffer(size);
+        buffer.back() = 1;
+        const auto during = mlock_budget::instance().stats();
+        BOOST_CHECK_EQUAL(during.locked_bytes, before.locked_bytes);
+        BOOST_CHECK(during.unlocked_bytes - before.unlocked_bytes >= size);
+    }
+    BOOST_CHECK_EQUAL(mlock_budget::instance().stats().unlocked_bytes,
+                      before.unlocked_bytes);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_mlock_budget_acquire_release)
+{
+    budget_for(10000, 4000);
+    mlock_budget& budget = mlock_budget::instance();
+
+    BOOST_CHECK(budget.acquire(6000, lock_priority::bulk));
+    BOOST_CHECK(!budget.acquire(1, lock_priority::bulk)); // key reserve
+    BOOST_CHECK(budget.acquire(4000, lock_priority::key));
+    budget.release(6000, lock_priority::bulk);
+    budget.release(4000, lock_priority::key);
+    BOOST_CHECK(budget.acquire(6000, lock_priority::bulk));
+    budget.release(6000, lock_priority::bulk);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
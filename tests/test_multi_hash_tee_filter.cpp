@@ -0,0 +1,227 @@
+// test_multi_hash_tee_filter.cpp -- Test sodium::multi_hash_tee_filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::multi_hash_tee_filter Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "multi_hash_tee_filter.h"
+#include "random.h"
+
+#include <iterator>
+#include <string>
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/device/null.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+using sodium::blake2b_digest;
+using sodium::multi_hash_tee_device;
+using sodium::multi_hash_tee_filter;
+using sodium::poly1305_digest;
+using sodium::sha256_digest;
+using sodium::sha512_digest;
+using chars = sodium::chars;
+
+using vector_sink = io::back_insert_device<chars>;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+std::string
+random_string(std::size_t size)
+{
+    std::string result(size, '\0');
+    sodium::randombytes_buf_inplace(result);
+    return result;
+}
+
+chars
+blake2b_of(const std::string& in, const sodium::keyvar<>* key = nullptr)
+{
+    chars out(crypto_generichash_BYTES);
+    crypto_generichash(reinterpret_cast<unsigned char*>(out.data()),
+                       out.size(),
+                       reinterpret_cast<const unsigned char*>(in.data()),
+                       in.size(),
+                       key ? key->data() : nullptr,
+                       key ? key->size() : 0);
+    return out;
+}
+
+chars
+sha512_of(const std::string& in)
+{
+    chars out(crypto_hash_sha512_BYTES);
+    crypto_hash_sha512(reinterpret_cast<unsigned char*>(out.data()),
+                       reinterpret_cast<const unsigned char*>(in.data()),
+                       in.size());
+    return out;
+}
+
+chars
+sha256_of(const std::string& in)
+{
+    chars out(crypto_hash_sha256_BYTES);
+    crypto_hash_sha256(reinterpret_cast<unsigned char*>(out.data()),
+                       reinterpret_cast<const unsigned char*>(in.data()),
+                       in.size());
+    return out;
+}
+
+chars
+slice(const chars& tags, std::size_t offset, std::size_t size)
+{
+    return chars(tags.cbegin() + offset, tags.cbegin() + offset + size);
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_multi_hash_tee_filter_output_chain)
+{
+    using tee_type =
+      multi_hash_tee_filter<vector_sink, blake2b_digest<>, sha512_digest>;
+    BOOST_CHECK_EQUAL(tee_type::DIGESTSIZE,
+                      crypto_generichash_BYTES + crypto_hash_sha512_BYTES);
+    BOOST_CHECK_EQUAL(tee_type::offset<1>(), crypto_generichash_BYTES);
+
+    // empty, smaller than a block, and several blocks
+    for (std::size_t size : { 0UL, 1UL, 1000UL, 100000UL }) {
+        std::string plaintext = random_string(size);
+        std::string passed_through;
+        chars tags;
+        {
+            vector_sink tagsink{ tags };
+            io::filtering_ostream os(tee_type(tagsink) |
+                                     io::back_inserter(passed_through));
+            os.write(plaintext.data(), plaintext.size());
+        }
+
+        BOOST_CHECK(passed_through == plaintext);
+        BOOST_REQUIRE_EQUAL(tags.size(), tee_type::DIGESTSIZE);
+        BOOST_CHECK(slice(tags, 0, crypto_generichash_BYTES) ==
+                    blake2b_of(plaintext));
+        BOOST_CHECK(slice(tags, tee_type::offset<1>(),
+                          crypto_hash_sha512_BYTES) == sha512_of(plaintext));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_multi_hash_tee_filter_keyed_input_chain)
+{
+    using tee_type = multi_hash_tee_filter<vector_sink,
+                                           blake2b_digest<>,
+                                           poly1305_digest,
+                                           sha256_digest>;
+
+    sodium::keyvar<> hashkey(sodium::KEYSIZE_HASHKEY);
+    poly1305_digest::key_type mackey;
+
+    std::string plaintext = random_string(50000);
+
+    chars tags;
+    vector_sink tagsink{ tags };
+    io::filtering_istream is;
+    is.push(tee_type(
+      tagsink, blake2b_digest<>(hashkey), poly1305_digest(mackey), {}));
+    is.push(io::array_source{ plaintext.data(), plaintext.size() });
+
+    std::string read_back(std::istreambuf_iterator<char>(is), {});
+    BOOST_CHECK(read_back == plaintext);
+
+    // all tags are there as soon as we hit EOF
+    BOOST_REQUIRE_EQUAL(tags.size(), tee_type::DIGESTSIZE);
+    BOOST_CHECK(slice(tags, 0, crypto_generichash_BYTES) ==
+                blake2b_of(plaintext, &hashkey));
+    BOOST_CHECK_EQUAL(
+      crypto_onetimeauth_verify(
+        reinterpret_cast<unsigned char*>(tags.data() + tee_type::offset<1>()),
+        reinterpret_cast<const unsigned char*>(plaintext.data()),
+        plaintext.size(),
+        mackey.data()),
+      0);
+    BOOST_CHECK(slice(tags, tee_type::offset<2>(), crypto_hash_sha256_BYTES) ==
+                sha256_of(plaintext));
+
+    is.reset();
+    BOOST_CHECK_EQUAL(tags.size(), tee_type::DIGESTSIZE); // sent only once
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_multi_hash_tee_device)
+{
+    using tee_type = multi_hash_tee_device<io::null_sink,
+                                           vector_sink,
+                                           blake2b_digest<>,
+                                           sha512_digest>;
+
+    std::string plaintext = random_string(70000);
+
+    chars tags;
+    {
+        vector_sink tagsink{ tags };
+        io::filtering_ostream os(tee_type(io::null_sink(), tagsink));
+        os.write(plaintext.data(), plaintext.size());
+    }
+
+    BOOST_REQUIRE_EQUAL(tags.size(), tee_type::DIGESTSIZE);
+    BOOST_CHECK(slice(tags, 0, crypto_generichash_BYTES) ==
+                blake2b_of(plaintext));
+    BOOST_CHECK(slice(tags, tee_type::offset<1>(), crypto_hash_sha512_BYTES) ==
+                sha512_of(plaintext));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_multi_hash_reuse)
+{
+    sodium::multi_hash<blake2b_digest<16>, sha512_digest> hash;
+    BOOST_CHECK_EQUAL(hash.DIGESTSIZE, 16UL + crypto_hash_sha512_BYTES);
+
+    std::string plaintext = random_string(40000);
+    chars first(hash.DIGESTSIZE);
+    chars second(hash.DIGESTSIZE);
+
+    hash.update(reinterpret_cast<const unsigned char*>(plaintext.data()),
+                plaintext.size());
+    hash.final(reinterpret_cast<unsigned char*>(first.data()));
+
+    // final() resets the state: split input gives the same digests
+    hash.update(reinterpret_cast<const unsigned char*>(plaintext.data()), 7);
+    hash.update(reinterpret_cast<const unsigned char*>(plaintext.data()) + 7,
+                plaintext.size() - 7);
+    hash.final(reinterpret_cast<unsigned char*>(second.data()));
+
+    BOOST_CHECK(first == second);
+    BOOST_CHECK(slice(first, 16, crypto_hash_sha512_BYTES) ==
+                sha512_of(plaintext));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
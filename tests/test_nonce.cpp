@@ -22,6 +22,10 @@
 
 #include "nonce.h"
 
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
 struct SodiumFixture
 {
     SodiumFixture()
@@ -201,4 +205,53 @@ BOOST_AUTO_TEST_CASE(sodium_test_nonce_operator_plus_equal)
     BOOST_CHECK(a == b);
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_operator_plus_offset)
+{
+    sodium::nonce<> a{};
+
+    for (std::uint64_t k : { 0, 1, 255, 256, 70000 }) {
+        sodium::nonce<> incremented{ a };
+        for (std::uint64_t i = 0; i != k; ++i)
+            incremented.increment();
+
+        BOOST_CHECK(a + k == incremented);
+
+        sodium::nonce<> b{ a };
+        b += k;
+        BOOST_CHECK(b == incremented);
+    }
+
+    // carries propagate beyond the 8 bytes of the offset
+    sodium::nonce<16> c(false);
+    c += UINT64_MAX;
+    sodium::nonce<16> d = c + 1;
+    BOOST_CHECK(d.as_bytes()[8] == 1);
+    for (std::size_t i = 0; i != 8; ++i)
+        BOOST_CHECK(d.as_bytes()[i] == 0);
+
+    // a nonce smaller than the offset wraps around
+    sodium::nonce<4> e(false);
+    e += 0x100000001ULL;
+    BOOST_CHECK(e.as_bytes()[0] == 1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_inline_storage)
+{
+    using nonce_type = sodium::nonce<24>;
+
+    // the bytes are stored inline: copies are plain memcpy()s
+    static_assert(std::is_trivially_copyable<nonce_type>::value,
+                  "nonce<> must be trivially copyable");
+    BOOST_CHECK_GE(sizeof(nonce_type), nonce_type::size());
+    BOOST_CHECK_EQUAL(alignof(nonce_type) % alignof(std::uint64_t), 0UL);
+
+    nonce_type a;
+    nonce_type b(false);
+    std::memcpy(static_cast<void*>(&b), &a, sizeof a);
+    BOOST_CHECK(a == b);
+    BOOST_CHECK(nonce_type(a.data()) == a);
+
+    BOOST_CHECK(nonce_type(false).is_zero());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -25,6 +25,7 @@
 
 #include "common.h"
 #include "padding.h"
+#include <algorithm>
 #include <string>
 #include <typeinfo>
 #include <vector>
@@ -343,4 +344,57 @@ BOOST_AUTO_TEST_CASE(sodium_test_padding_unpad_inplace_tamper_with_pad)
     }
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_padding_span)
+{
+    std::string in_as_string{ "0123456789abcde" };
+    sodium::bytes buf(64);
+    std::copy(in_as_string.cbegin(), in_as_string.cend(), buf.begin());
+
+    BOOST_CHECK_EQUAL(sodium::padded_size(15, 16), 16UL);
+    BOOST_CHECK_EQUAL(sodium::padded_size(16, 16), 32UL);
+
+    // padded within buf, same result as sodium::pad()
+    std::size_t padded_len = 0;
+    BOOST_CHECK_EQUAL(sodium::pad(buf, 15, 16, padded_len), 0);
+    BOOST_CHECK_EQUAL(padded_len, 16UL);
+    sodium::bytes in{ in_as_string.cbegin(), in_as_string.cend() };
+    BOOST_CHECK(sodium::bytes(buf.cbegin(), buf.cbegin() + 16) ==
+                sodium::pad(in, 16));
+
+    std::size_t unpadded_len = 0;
+    BOOST_CHECK_EQUAL(
+      sodium::unpad(sodium::span<const sodium::byte>(buf.data(), padded_len),
+                    16,
+                    unpadded_len),
+      0);
+    BOOST_CHECK_EQUAL(unpadded_len, 15UL);
+
+    // not enough room, a malformed pad, a zero blocksize
+    BOOST_CHECK_EQUAL(
+      sodium::pad(sodium::span<sodium::byte>(buf).first(15), 15, 16, padded_len),
+      -1);
+    ++buf[15];
+    BOOST_CHECK_EQUAL(
+      sodium::unpad(sodium::span<const sodium::byte>(buf.data(), padded_len),
+                    16,
+                    unpadded_len),
+      -1);
+    BOOST_CHECK_EQUAL(sodium::pad(buf, 15, 0, padded_len), -1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_padding_reserve_padded)
+{
+    std::string in_as_string{ "0123456789abcdef0" };
+    sodium::bytes in{ in_as_string.cbegin(), in_as_string.cend() };
+    in.shrink_to_fit();
+
+    sodium::reserve_padded(in, 16);
+    const sodium::byte* data = in.data();
+
+    // pad_inplace() doesn't reallocate anymore
+    sodium::pad_inplace(in, 16);
+    BOOST_CHECK_EQUAL(in.size(), 32UL);
+    BOOST_CHECK(in.data() == data);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,194 @@
+// test_pinned_key.cpp -- Test sodium::pinned_key
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::pinned_key Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "key.h"
+#include "pinned_key.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using key_type = sodium::key<sodium::KEYSIZE_AUTH>;
+using pinned_type = sodium::pinned_key<key_type>;
+using namespace std::chrono_literals;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+static std::uint64_t
+noaccess_count()
+{
+    return sodium::trace::value("sodium::allocator::noaccess()");
+}
+
+static std::uint64_t
+readonly_count()
+{
+    return sodium::trace::value("sodium::allocator::readonly()");
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_pinned_key_nested)
+{
+    key_type key;
+    const key_type copy{ key };
+    pinned_type pinned(std::move(key));
+    BOOST_CHECK(!pinned.accessible());
+
+    const std::uint64_t readonly0 = readonly_count();
+    const std::uint64_t noaccess0 = noaccess_count();
+
+    {
+        auto outer = pinned.access();
+        BOOST_CHECK(pinned.accessible());
+        BOOST_CHECK(outer.key() == copy);
+        {
+            auto inner = pinned.access();
+            BOOST_CHECK_EQUAL(pinned.users(), 2);
+            BOOST_CHECK(std::equal(
+              inner.data(), inner.data() + inner.size(), copy.data()));
+        }
+        BOOST_CHECK(pinned.accessible());
+
+        auto moved = std::move(outer);
+        BOOST_CHECK_EQUAL(pinned.users(), 1);
+    }
+    BOOST_CHECK_EQUAL(pinned.users(), 0);
+    BOOST_CHECK(!pinned.accessible());
+
+    // one readonly() for the first guard, one noaccess() for the last
+    BOOST_CHECK_EQUAL(readonly_count() - readonly0, 1);
+    BOOST_CHECK_EQUAL(noaccess_count() - noaccess0, 1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pinned_key_idle_timeout)
+{
+    key_type key;
+    pinned_type pinned(std::move(key), 50ms);
+
+    const std::uint64_t readonly0 = readonly_count();
+    const std::uint64_t noaccess0 = noaccess_count();
+
+    // used again and again, well within the idle timeout
+    for (int i = 0; i != 100; ++i) {
+        auto access = pinned.access();
+        BOOST_CHECK_EQUAL(access.size(), sodium::KEYSIZE_AUTH);
+    }
+    BOOST_CHECK(pinned.accessible());
+    BOOST_CHECK_EQUAL(readonly_count() - readonly0, 1);
+
+    // idle: the background thread locks it away again
+    for (int i = 0; i != 100 && pinned.accessible(); ++i)
+        std::this_thread::sleep_for(10ms);
+    BOOST_CHECK(!pinned.accessible());
+    BOOST_CHECK_EQUAL(noaccess_count() - noaccess0, 1);
+
+    // and the next guard makes it readable again
+    auto access = pinned.access();
+    BOOST_CHECK(pinned.accessible());
+    BOOST_CHECK_EQUAL(readonly_count() - readonly0, 2);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pinned_key_shared_reaper)
+{
+    sodium::key_reaper reaper;
+
+    {
+        // many keys, a single reaper thread
+        std::vector<std::unique_ptr<pinned_type>> pinned;
+        for (int i = 0; i != 16; ++i)
+            pinned.push_back(
+              std::make_unique<pinned_type>(key_type{}, 20ms, reaper));
+        BOOST_CHECK_EQUAL(reaper.size(), 16);
+
+        for (auto& p : pinned)
+            p->access();
+        BOOST_CHECK(std::all_of(pinned.cbegin(),
+                                pinned.cend(),
+                                [](const auto& p) { return p->accessible(); }));
+
+        // all of them idle at about the same time: swept together
+        const auto any_accessible = [&pinned]() {
+            return std::any_of(pinned.cbegin(),
+                               pinned.cend(),
+                               [](const auto& p) { return p->accessible(); });
+        };
+        for (int i = 0; i != 100 && any_accessible(); ++i)
+            std::this_thread::sleep_for(10ms);
+        BOOST_CHECK(!any_accessible());
+    }
+    BOOST_CHECK_EQUAL(reaper.size(), 0);
+
+    // without an idle timeout, nothing to register
+    pinned_type immediate(key_type{});
+    BOOST_CHECK_EQUAL(reaper.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pinned_key_threads)
+{
+    key_type key;
+    const key_type copy{ key };
+    const pinned_type pinned(std::move(key), 10s);
+
+    std::atomic<int> mismatches{ 0 };
+    const std::uint64_t readonly0 = readonly_count();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 8; ++t)
+        threads.emplace_back([&]() {
+            for (int i = 0; i != 2000; ++i) {
+                auto access = pinned.access();
+                if (!std::equal(access.data(),
+                                access.data() + access.size(),
+                                copy.data()))
+                    ++mismatches;
+            }
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    BOOST_CHECK_EQUAL(mismatches.load(), 0);
+    BOOST_CHECK_EQUAL(pinned.users(), 0);
+
+    // a single mprotect() for 16000 uses
+    BOOST_CHECK_EQUAL(readonly_count() - readonly0, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -25,8 +25,10 @@
 #include "poly1305_tee_filter.h"
 
 #include <cstdio> // std::remove()
+#include <iterator>
 #include <string>
 
+#include <boost/iostreams/device/array.hpp>
 #include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/iostreams/device/file.hpp>
 #include <boost/iostreams/device/null.hpp>
@@ -330,4 +332,54 @@ BOOST_AUTO_TEST_CASE(sodium_test_poly1305_filter_poly1305_to_vector_null)
     BOOST_CHECK(result);
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_poly1305_filter_input_chain)
+{
+    using poly1305_to_vector_filter_type = poly1305_tee_filter<vector_sink>;
+    poly1305_to_vector_filter_type::key_type key;
+
+    std::string plaintext(100000, '\0');
+    randombytes_buf(plaintext.data(), plaintext.size());
+
+    mac_array_type mac;
+    vector_sink macsink{ mac };
+    io::filtering_istream is;
+    is.push(poly1305_to_vector_filter_type(macsink, key));
+    is.push(io::array_source{ plaintext.data(), plaintext.size() });
+
+    // the data is passed through unchanged
+    std::string read_back(std::istreambuf_iterator<char>(is), {});
+    BOOST_CHECK(read_back == plaintext);
+
+    // and the MAC is there as soon as we hit EOF, before closing
+    BOOST_REQUIRE_EQUAL(mac.size(), poly1305_to_vector_filter_type::MACSIZE);
+    BOOST_CHECK_EQUAL(crypto_onetimeauth_verify(
+                        reinterpret_cast<unsigned char*>(mac.data()),
+                        reinterpret_cast<unsigned char*>(plaintext.data()),
+                        plaintext.size(),
+                        key.data()),
+                      0);
+
+    is.reset();
+    BOOST_CHECK_EQUAL(mac.size(), poly1305_to_vector_filter_type::MACSIZE);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_poly1305_filter_output_chain_mac_once)
+{
+    using poly1305_to_vector_filter_type = poly1305_tee_filter<vector_sink>;
+    poly1305_to_vector_filter_type::key_type key;
+
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    std::string passed_through;
+    mac_array_type mac;
+    {
+        vector_sink macsink{ mac };
+        io::filtering_ostream os(poly1305_to_vector_filter_type(macsink, key) |
+                                 io::back_inserter(passed_through));
+        os.write(plaintext.data(), plaintext.size());
+    }
+
+    BOOST_CHECK(passed_through == plaintext);
+    BOOST_CHECK_EQUAL(mac.size(), poly1305_to_vector_filter_type::MACSIZE);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,192 @@
+// test_pooled_allocator.cpp -- Test sodium::pooled_allocator<>
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::pooled_allocator Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "key.h"
+#include "pooled_allocator.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <vector>
+
+#include <sodium.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using sodium::bytes_pooled;
+using sodium::secure_arena;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_pooled_allocator_small_objects_share_slab)
+{
+    const auto before = secure_arena::instance().stats();
+
+    {
+        std::vector<bytes_pooled> objects;
+        for (int i = 0; i != 100; ++i)
+            objects.emplace_back(32, static_cast<sodium::byte>(i));
+
+        const auto during = secure_arena::instance().stats();
+
+        // one slot (of whole pages) each, in as few slabs as possible
+        const std::size_t n = secure_arena::instance().slots_per_slab();
+        BOOST_CHECK(n >= 1);
+        BOOST_CHECK_EQUAL(during.slabs, before.slabs + (100 + n - 1) / n);
+        BOOST_CHECK_EQUAL(during.slots_inuse, before.slots_inuse + 100);
+
+        for (int i = 0; i != 100; ++i)
+            BOOST_CHECK(std::all_of(
+              objects[i].cbegin(), objects[i].cend(), [i](sodium::byte b) {
+                  return b == static_cast<sodium::byte>(i);
+              }));
+    }
+
+    // empty slabs are released immediately
+    const auto after = secure_arena::instance().stats();
+    BOOST_CHECK_EQUAL(after.slabs, before.slabs);
+    BOOST_CHECK_EQUAL(after.slots_inuse, before.slots_inuse);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pooled_allocator_slots_are_zeroed)
+{
+    sodium::byte* data = nullptr;
+
+    bytes_pooled keep(16, 0x00); // keeps the slab alive
+    {
+        bytes_pooled b(16, 0xAA);
+        data = b.data();
+    }
+
+    // the freed slot will be handed out again: must be clean
+    sodium::pooled_allocator<sodium::byte> alloc;
+    sodium::byte* again = alloc.allocate(16);
+    BOOST_CHECK_EQUAL(again, data);
+    BOOST_CHECK(sodium_is_zero(again, 16) == 1);
+    alloc.deallocate(again, 16);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pooled_allocator_large_objects_fallback)
+{
+    const auto before = secure_arena::instance().stats();
+
+    bytes_pooled big(1 << 16, 0x42);
+
+    // too big for a slot: allocated by sodium_allocarray()
+    BOOST_CHECK_EQUAL(secure_arena::instance().stats().slabs, before.slabs);
+    BOOST_CHECK(std::all_of(big.cbegin(), big.cend(), [](sodium::byte b) {
+        return b == 0x42;
+    }));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pooled_allocator_protection)
+{
+    bytes_pooled a(32, 0x01);
+    bytes_pooled b(32, 0x02);
+    auto alloc = a.get_allocator();
+
+    // a and b never share a page
+    const auto pa = reinterpret_cast<std::uintptr_t>(a.data());
+    const auto pb = reinterpret_cast<std::uintptr_t>(b.data());
+    const std::size_t pagesize = sodium::mlock_budget::page_size();
+    BOOST_CHECK(pa / pagesize != pb / pagesize);
+    BOOST_CHECK_EQUAL(pa % pagesize, 0u);
+
+    // a is noaccess, while its neighbour b stays readwrite
+    alloc.noaccess(a.data());
+    b[0] = 0x03;
+    BOOST_CHECK_EQUAL(b[0], 0x03);
+
+    alloc.readonly(b.data());
+    BOOST_CHECK_EQUAL(b[0], 0x03);
+
+    alloc.readwrite(a.data());
+    alloc.readwrite(b.data());
+    BOOST_CHECK_EQUAL(a[0], 0x01);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+BOOST_AUTO_TEST_CASE(sodium_test_pooled_allocator_noaccess_is_enforced)
+{
+    bytes_pooled a(32, 0x01);
+    bytes_pooled b(32, 0x02); // a readwrite neighbour in the same slab
+    a.get_allocator().noaccess(a.data());
+
+    // reading a noaccess() object must fault, whatever its neighbours
+    pid_t pid = fork();
+    BOOST_REQUIRE(pid != -1);
+    if (pid == 0) {
+        std::signal(SIGSEGV, SIG_DFL); // not Boost.Test's handler
+        std::signal(SIGBUS, SIG_DFL);
+        volatile sodium::byte x = a[0];
+        static_cast<void>(x);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    BOOST_CHECK(WIFSIGNALED(status));
+
+    a.get_allocator().readwrite(a.data());
+    BOOST_CHECK_EQUAL(a[0], 0x01);
+    BOOST_CHECK_EQUAL(b[0], 0x02);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(sodium_test_pooled_allocator_keys)
+{
+    const auto before = secure_arena::instance().stats();
+
+    {
+        std::vector<sodium::key<sodium::KEYSIZE_SECRETBOX, bytes_pooled>> keys(
+          1000);
+
+        // 1000 keys in a few slabs, not 1000 sodium_malloc() regions
+        const std::size_t n = secure_arena::instance().slots_per_slab();
+        BOOST_CHECK_EQUAL(secure_arena::instance().stats().slabs,
+                          before.slabs + (1000 + n - 1) / n);
+
+        // keys are readonly() after initialization, and still readable
+        BOOST_CHECK(keys[0] != keys[1]);
+        BOOST_CHECK_EQUAL(keys[999].size(), sodium::KEYSIZE_SECRETBOX);
+    }
+
+    BOOST_CHECK_EQUAL(secure_arena::instance().stats().slabs, before.slabs);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
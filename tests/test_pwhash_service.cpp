@@ -0,0 +1,187 @@
+// test_pwhash_service.cpp -- Test sodium::pwhash_service
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::pwhash_service Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "key.h"
+#include "keyvar.h"
+#include "pwhash_service.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::pwhash_service;
+
+using key_type = sodium::key<32>;
+
+// cheap limits, so that the tests run fast
+constexpr pwhash_service::params_type PARAMS{ 1, 1 << 20 };
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_service_matches_setpass)
+{
+    pwhash_service service(4 * PARAMS.memlimit, 2);
+    BOOST_CHECK_EQUAL(service.size(), 2UL);
+    BOOST_CHECK_EQUAL(service.budget(), 4 * PARAMS.memlimit);
+
+    sodium::bytes salt(sodium::KEYSIZE_SALT, 42);
+    std::string password{ "CPE1704TKS" };
+
+    key_type expected(false);
+    expected.setpass(password, salt, PARAMS.opslimit, PARAMS.memlimit);
+
+    std::future<key_type> derived =
+      service.derive(key_type(false), password, salt, PARAMS);
+    BOOST_CHECK(derived.get() == expected);
+
+    sodium::keyvar<> keyvar = service
+                                .derive(sodium::keyvar<>(32, false),
+                                        password,
+                                        salt,
+                                        PARAMS)
+                                .get();
+    BOOST_CHECK(std::equal(
+      keyvar.data(), keyvar.data() + keyvar.size(), expected.data()));
+
+    // a failing derivation (memlimit too small) fails in get()
+    std::future<key_type> failing =
+      service.derive(key_type(false), password, salt, { 1, 1 });
+    BOOST_CHECK_THROW(failing.get(), std::runtime_error);
+
+    // bad requests fail right away
+    BOOST_CHECK_THROW(
+      service.derive(key_type(false), password, sodium::bytes(3), PARAMS),
+      std::runtime_error);
+    BOOST_CHECK_THROW(service.derive(key_type(false),
+                                     password,
+                                     salt,
+                                     { 1, 5 * PARAMS.memlimit }),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(pwhash_service(0), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_service_memory_budget)
+{
+    // 4 threads, but only room for 2 derivations at a time
+    pwhash_service service(2 * PARAMS.memlimit, 4);
+    sodium::bytes salt(sodium::KEYSIZE_SALT, 1);
+
+    std::atomic<std::size_t> peak{ 0 };
+    std::atomic<int> derived{ 0 };
+    std::vector<std::promise<void>> done(16);
+
+    for (auto& promise : done)
+        service.derive(key_type(false),
+                       "password",
+                       salt,
+                       PARAMS,
+                       [&](std::future<key_type> key) {
+                           std::size_t in_use = service.in_use();
+                           std::size_t old = peak.load();
+                           while (in_use > old &&
+                                  !peak.compare_exchange_weak(old, in_use))
+                               ;
+                           key.get();
+                           ++derived;
+                           promise.set_value();
+                       });
+
+    for (auto& promise : done)
+        promise.get_future().wait();
+
+    BOOST_CHECK_EQUAL(derived.load(), 16);
+    BOOST_CHECK(peak.load() != 0 && peak.load() <= service.budget());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_service_queue_full)
+{
+    pwhash_service service(PARAMS.memlimit, 1, 1);
+    sodium::bytes salt(sodium::KEYSIZE_SALT, 2);
+
+    // keep the only worker busy until released
+    std::promise<void> release;
+    std::promise<void> started;
+    std::shared_future<void> released = release.get_future().share();
+    service.derive(key_type(false),
+                   "first",
+                   salt,
+                   PARAMS,
+                   [&started, released](std::future<key_type>) {
+                       started.set_value();
+                       released.wait();
+                   });
+    started.get_future().wait();
+
+    std::future<key_type> second =
+      service.derive(key_type(false), "second", salt, PARAMS);
+    BOOST_CHECK_EQUAL(service.pending(), 1UL);
+    BOOST_CHECK_THROW(service.derive(key_type(false), "third", salt, PARAMS),
+                      std::runtime_error);
+
+    release.set_value();
+    BOOST_CHECK_NO_THROW(second.get());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_service_calibrate)
+{
+    const auto target = std::chrono::milliseconds(50);
+    pwhash_service::params_type params =
+      pwhash_service::calibrate(target, 4 * PARAMS.memlimit);
+
+    BOOST_CHECK(params.memlimit >= crypto_pwhash_MEMLIMIT_MIN);
+    BOOST_CHECK(params.memlimit <= 4 * PARAMS.memlimit);
+    BOOST_CHECK(params.opslimit >= crypto_pwhash_OPSLIMIT_MIN);
+
+    BOOST_TEST_MESSAGE("calibrate(50ms): opslimit=" << params.opslimit
+                                                    << ", memlimit="
+                                                    << params.memlimit);
+
+    // the calibrated limits are usable
+    pwhash_service service(params.memlimit, 1);
+    BOOST_CHECK_NO_THROW(service
+                           .derive(key_type(false),
+                                   "password",
+                                   sodium::bytes(sodium::KEYSIZE_SALT),
+                                   params)
+                           .get());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
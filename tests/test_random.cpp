@@ -26,11 +26,19 @@
 #include "common.h"
 #include "helpers.h"
 #include "random.h"
+#include <algorithm>
 #include <array>
+#include <future>
+#include <random>
 #include <string>
 #include <typeinfo>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 struct SodiumFixture
 {
     SodiumFixture()
@@ -228,6 +236,73 @@ BOOST_AUTO_TEST_CASE(
     BOOST_TEST_MESSAGE(typeid(r1).name());
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_random_randombytes_buf_buffered)
+{
+    using sodium::buffered_random;
+
+    // small, buffer-sized, and bigger-than-buffer requests, which
+    // also cross refills and reseeds
+    for (std::size_t size :
+         { 1UL, 24UL, 100UL, 4095UL, 4096UL, 4097UL, 100000UL }) {
+        auto r1{ sodium::randombytes_buf_buffered(size) };
+        auto r2{ sodium::randombytes_buf_buffered(size) };
+        BOOST_CHECK(r1.size() == size);
+        if (size >= 24)
+            BOOST_CHECK(sodium::compare(r1, r2) == false);
+    }
+    for (int i = 0; i != 2 * buffered_random::RESEED_INTERVAL; ++i)
+        sodium::randombytes_buf_buffered(buffered_random::BUFFERSIZE / 2);
+
+    sodium::bytes_protected r3(100);
+    sodium::randombytes_buf_buffered_inplace(r3);
+    BOOST_CHECK(!sodium::is_zero(r3));
+    sodium::bytes empty;
+    sodium::randombytes_buf_buffered_inplace(empty);
+
+    // as a UniformRandomBitGenerator
+    buffered_random gen;
+    std::uniform_int_distribution<int> dice(1, 6);
+    std::array<int, 7> counts{};
+    for (int i = 0; i != 6000; ++i)
+        ++counts[dice(gen)];
+    BOOST_CHECK(std::all_of(
+      counts.begin() + 1, counts.end(), [](int n) { return n > 800; }));
+
+    // every thread has its own generator
+    auto other = std::async(
+      std::launch::async, [] { return sodium::randombytes_buf_buffered(32); });
+    BOOST_CHECK(sodium::compare(other.get(),
+                                sodium::randombytes_buf_buffered(32)) == false);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+BOOST_AUTO_TEST_CASE(sodium_test_random_randombytes_buf_buffered_fork)
+{
+    // the child must not repeat the bytes of its parent
+    sodium::randombytes_buf_buffered(10); // seed this thread's buffer
+
+    int fds[2];
+    BOOST_REQUIRE(pipe(fds) == 0);
+    pid_t pid = fork();
+    BOOST_REQUIRE(pid != -1);
+    if (pid == 0) {
+        auto r = sodium::randombytes_buf_buffered(32);
+        ssize_t written = write(fds[1], r.data(), r.size());
+        _exit(written == 32 ? 0 : 1);
+    }
+
+    auto parent = sodium::randombytes_buf_buffered(32);
+    sodium::bytes child(32);
+    BOOST_CHECK(read(fds[0], child.data(), child.size()) == 32);
+    int status;
+    waitpid(pid, &status, 0);
+    close(fds[0]);
+    close(fds[1]);
+
+    BOOST_CHECK(sodium::compare(parent, child) == false);
+}
+#endif
+
 // XXX add missing tests.
 
 BOOST_AUTO_TEST_SUITE_END()
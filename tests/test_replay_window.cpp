@@ -0,0 +1,131 @@
+// test_replay_window.cpp -- Test sodium::replay_window
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::replay_window Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "nonce.h"
+#include "replay_window.h"
+
+#include <cstdint>
+#include <set>
+
+#include <sodium.h>
+
+using nonce_type = sodium::nonce<sodium::NONCESIZE_SECRETBOX>;
+using window_type = sodium::replay_window<nonce_type::size(), 256>;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_window_nonces)
+{
+    nonce_type base;
+    window_type window{ base };
+    BOOST_CHECK(window.empty());
+
+    // in order, and each one only once
+    for (std::uint64_t k = 0; k != 10; ++k) {
+        BOOST_CHECK(window.check(base + k));
+        BOOST_CHECK(window.check_and_mark(base + k));
+        BOOST_CHECK(!window.check(base + k));
+        BOOST_CHECK(!window.check_and_mark(base + k));
+    }
+    BOOST_CHECK_EQUAL(window.highest(), 9UL);
+
+    // out of order, within the window
+    BOOST_CHECK(window.check_and_mark(base + 200));
+    BOOST_CHECK(window.check_and_mark(base + 100));
+    BOOST_CHECK(!window.check_and_mark(base + 100));
+    BOOST_CHECK(window.check_and_mark(base + 10));
+    BOOST_CHECK_EQUAL(window.highest(), 200UL);
+
+    // too old once the window has moved past them
+    BOOST_CHECK(window.check_and_mark(base + 1000));
+    BOOST_CHECK(!window.check(base + 11));
+    BOOST_CHECK(!window.check(base + (1000 - 256)));
+    BOOST_CHECK(window.check(base + (1000 - 255)));
+
+    // nonces that aren't base + k, for a 64-bit k
+    nonce_type other;
+    BOOST_CHECK(!window.check_and_mark(other));
+
+    // a sequence number that carries into the high bytes of the base
+    window_type carry{ base + (~std::uint64_t(0) - 1) };
+    BOOST_CHECK(carry.check_and_mark(base + ~std::uint64_t(0)));
+    nonce_type wrapped = base + ~std::uint64_t(0);
+    wrapped += 2; // base + 2^64 + 1, three ahead of the base of carry
+    BOOST_CHECK(carry.check_and_mark(wrapped));
+    std::uint64_t seq = 0;
+    BOOST_CHECK(carry.sequence(wrapped, seq));
+    BOOST_CHECK_EQUAL(seq, 3UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_window_matches_set)
+{
+    // a pseudo-random, reordered and duplicated sequence, checked
+    // against a std::set of everything accepted so far
+    window_type window{ nonce_type(false) };
+    std::set<std::uint64_t> accepted;
+    std::uint64_t highest = 0;
+
+    for (std::uint64_t i = 0; i != 100000; ++i) {
+        std::uint64_t seq = i + randombytes_uniform(300);
+        if (randombytes_uniform(50) == 0)
+            seq += 5000; // a jump, that makes many others too old
+
+        bool expected = accepted.count(seq) == 0 &&
+                        (accepted.empty() || seq + 256 > highest);
+        BOOST_REQUIRE_EQUAL(window.check_and_mark(seq), expected);
+        if (expected) {
+            accepted.insert(seq);
+            if (seq > highest)
+                highest = seq;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_window_reset)
+{
+    nonce_type base;
+    window_type window{ base };
+    BOOST_CHECK(window.check_and_mark(base + 3));
+    window.reset();
+    BOOST_CHECK(window.empty());
+    BOOST_CHECK(window.check_and_mark(base + 3));
+
+    nonce_type base2;
+    window.reset(base2);
+    BOOST_CHECK(window.check_and_mark(base2 + 3));
+    BOOST_CHECK(!window.check(base + 3)); // unrelated to base2
+}
+
+BOOST_AUTO_TEST_SUITE_END()
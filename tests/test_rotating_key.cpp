@@ -0,0 +1,190 @@
+// test_rotating_key.cpp -- Test sodium::rotating_key
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::rotating_key Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "rotating_key.h"
+#include "secretbox.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::rotating_key;
+using sodium::secretbox;
+
+// counts its live instances, to observe reclamation
+struct counted
+{
+    explicit counted(int v)
+      : value{ v }
+    {
+        ++live;
+    }
+    counted(counted&& other)
+      : value{ other.value }
+    {
+        ++live;
+    }
+    ~counted() { --live; }
+
+    int value;
+    static std::atomic<int> live;
+};
+
+std::atomic<int> counted::live{ 0 };
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_rotating_key_read_rotate)
+{
+    {
+        rotating_key<counted> rk{ counted{ 1 } };
+        BOOST_CHECK_EQUAL(rk.read()->value, 1);
+        BOOST_CHECK_EQUAL(counted::live.load(), 1);
+
+        // without readers, the old value is reclaimed right away
+        rk.rotate(counted{ 2 });
+        BOOST_CHECK_EQUAL(rk.read()->value, 2);
+        BOOST_CHECK_EQUAL(rk.reclaim(), 0UL);
+        BOOST_CHECK_EQUAL(counted::live.load(), 1);
+
+        BOOST_CHECK_EQUAL(rk.with([](counted& c) { return c.value * 10; }),
+                          20);
+    }
+    BOOST_CHECK_EQUAL(counted::live.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_rotating_key_guard_delays_reclamation)
+{
+    {
+        rotating_key<counted> rk{ counted{ 1 } };
+
+        {
+            auto guard = rk.read();
+            rk.rotate(counted{ 2 });
+            rk.rotate(counted{ 3 });
+
+            // the guard still sees, and keeps alive, the first value;
+            // and everything retired after it
+            BOOST_CHECK_EQUAL(guard->value, 1);
+            BOOST_CHECK_EQUAL(rk.reclaim(), 2UL);
+            BOOST_CHECK_EQUAL(counted::live.load(), 3);
+
+            // nested reads on the same thread see the current value
+            BOOST_CHECK_EQUAL(rk.read()->value, 3);
+        }
+
+        BOOST_CHECK_EQUAL(rk.reclaim(), 0UL);
+        BOOST_CHECK_EQUAL(counted::live.load(), 1);
+
+        // a guard held by another thread delays reclamation too
+        std::atomic<bool> holding{ false };
+        std::atomic<bool> release{ false };
+        std::thread reader([&] {
+            auto guard = rk.read();
+            holding = true;
+            while (!release)
+                std::this_thread::yield();
+        });
+        while (!holding)
+            std::this_thread::yield();
+
+        rk.rotate(counted{ 4 });
+        BOOST_CHECK_EQUAL(rk.reclaim(), 1UL);
+
+        release = true;
+        reader.join();
+        BOOST_CHECK_EQUAL(rk.reclaim(), 0UL);
+    }
+    BOOST_CHECK_EQUAL(counted::live.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_rotating_key_retired_kept_until_destruction)
+{
+    {
+        rotating_key<counted> rk{ counted{ 1 } };
+        auto guard = rk.read();
+        rk.rotate(counted{ 2 });
+        BOOST_CHECK_EQUAL(counted::live.load(), 2);
+
+        // the guard goes out of scope first, then the destructor frees
+        // the value that rotate() couldn't reclaim
+    }
+    BOOST_CHECK_EQUAL(counted::live.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_rotating_key_secretbox_concurrent)
+{
+    using box_type = secretbox<>;
+
+    rotating_key<box_type> rk{ box_type{} };
+
+    const std::string message{ "the quick brown fox jumps over the lazy dog" };
+    sodium::bytes plaintext{ message.cbegin(), message.cend() };
+
+    std::atomic<bool> done{ false };
+    std::atomic<int> failures{ 0 };
+
+    // every reader encrypts and decrypts with the same box, however
+    // many rotations happen in the meantime
+    std::vector<std::thread> readers;
+    for (int i = 0; i != 4; ++i)
+        readers.emplace_back([&] {
+            box_type::nonce_type nonce;
+            do {
+                auto box = rk.read();
+                sodium::bytes ciphertext = box->encrypt(plaintext, nonce);
+                if (box->decrypt(ciphertext, nonce) != plaintext)
+                    ++failures;
+                nonce.increment();
+            } while (!done);
+        });
+
+    for (int i = 0; i != 200; ++i) {
+        rk.rotate(box_type{});
+        std::this_thread::yield();
+    }
+    done = true;
+    for (auto& reader : readers)
+        reader.join();
+
+    BOOST_CHECK_EQUAL(failures.load(), 0);
+    BOOST_CHECK_EQUAL(rk.reclaim(), 0UL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
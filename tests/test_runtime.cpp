@@ -0,0 +1,132 @@
+// test_runtime.cpp -- Test sodium::runtime
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::runtime Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead_auto.h"
+#include "allocator.h"
+#include "runtime.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::runtime;
+
+// no sodium_init() here: sodium::runtime must do it on its own
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("SodiumFixture(): no sodium_init().");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_runtime_instance)
+{
+    const runtime& rt1 = runtime::instance();
+    const runtime& rt2 = runtime::instance();
+
+    BOOST_CHECK_EQUAL(&rt1, &rt2);
+    BOOST_CHECK(rt1.ok());
+
+    // sodium_init() has been called: further calls return 1
+    BOOST_CHECK_EQUAL(sodium_init(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_runtime_init)
+{
+    BOOST_CHECK_EQUAL(&runtime::init(), &runtime::instance());
+    BOOST_CHECK_NO_THROW(runtime::ensure());
+    BOOST_CHECK_NO_THROW(runtime::ensure());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_runtime_cpu_features)
+{
+    const sodium::cpu_features& cpu = runtime::instance().cpu();
+
+    BOOST_CHECK_EQUAL(cpu.sse2, sodium_runtime_has_sse2() == 1);
+    BOOST_CHECK_EQUAL(cpu.ssse3, sodium_runtime_has_ssse3() == 1);
+    BOOST_CHECK_EQUAL(cpu.sse41, sodium_runtime_has_sse41() == 1);
+    BOOST_CHECK_EQUAL(cpu.avx, sodium_runtime_has_avx() == 1);
+    BOOST_CHECK_EQUAL(cpu.avx2, sodium_runtime_has_avx2() == 1);
+    BOOST_CHECK_EQUAL(cpu.avx512f, sodium_runtime_has_avx512f() == 1);
+    BOOST_CHECK_EQUAL(cpu.aesni, sodium_runtime_has_aesni() == 1);
+    BOOST_CHECK_EQUAL(cpu.pclmul, sodium_runtime_has_pclmul() == 1);
+    BOOST_CHECK_EQUAL(cpu.neon, sodium_runtime_has_neon() == 1);
+    BOOST_CHECK_EQUAL(cpu.aes256gcm,
+                      crypto_aead_aes256gcm_is_available() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_runtime_aead_dispatch)
+{
+    using aead_auto = sodium::aead_auto<>;
+
+    // aead_auto decides once, from the cached CPU features
+    BOOST_CHECK_EQUAL(aead_auto::preferred() ==
+                        aead_auto::algorithm::aesgcm,
+                      runtime::instance().cpu().aes256gcm);
+    BOOST_CHECK(
+      aead_auto::available(aead_auto::algorithm::xchacha20_poly1305_ietf));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_runtime_ensure_threads)
+{
+    constexpr std::size_t nthreads = 8;
+    std::atomic<std::size_t> ok{ 0 };
+    std::atomic<const runtime*> seen{ nullptr };
+    std::vector<std::thread> threads;
+
+    // runtime::ensure() and instance() race on first use in every thread
+    for (std::size_t t = 0; t != nthreads; ++t)
+        threads.emplace_back([&ok, &seen] {
+            for (int i = 0; i != 1000; ++i)
+                runtime::ensure();
+            const runtime* rt = &runtime::instance();
+            const runtime* expected = nullptr;
+            if (!seen.compare_exchange_strong(expected, rt) &&
+                expected != rt)
+                return;
+            if (rt->ok())
+                ++ok;
+        });
+    for (auto& th : threads)
+        th.join();
+
+    BOOST_CHECK_EQUAL(ok.load(), nthreads);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_runtime_allocator)
+{
+    // sodium::allocator works without any explicit sodium_init()
+    sodium::bytes_protected b(64, '\0');
+    randombytes_buf(b.data(), b.size());
+    BOOST_CHECK_EQUAL(b.size(), 64UL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
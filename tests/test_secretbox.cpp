@@ -1004,4 +1004,121 @@ BOOST_AUTO_TEST_CASE(sodium_secretbox_test_time_decrypt_bytes_protected)
     time_decrypt_detached<bytes_protected>();
 }
 
+// 4. allocation-free span API ------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretbox_span_sizes)
+{
+    static_assert(secretbox<>::ciphertext_size(10) ==
+                  10 + secretbox<>::MACSIZE);
+    static_assert(secretbox<>::plaintext_size(secretbox<>::MACSIZE + 10) ==
+                  10);
+    BOOST_CHECK_EQUAL(secretbox<>::plaintext_size(secretbox<>::MACSIZE - 1),
+                      0UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretbox_span_combined)
+{
+    secretbox<> sb{};
+    secretbox<>::nonce_type nonce{};
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    // two messages back to back in one buffer, at an odd offset
+    const std::size_t csize = secretbox<>::ciphertext_size(plaintext.size());
+    bytes sendbuf(1 + 2 * csize);
+    sodium::span<sodium::byte> first(sendbuf.data() + 1, csize);
+    sodium::span<sodium::byte> second(sendbuf.data() + 1 + csize, csize);
+    BOOST_CHECK_EQUAL(sb.encrypt(first, plaintext, nonce), 0);
+    BOOST_CHECK_EQUAL(sb.encrypt(second, plaintext, nonce + 1), 0);
+
+    // same as the allocating version
+    BOOST_CHECK(bytes(first.begin(), first.end()) ==
+                sb.encrypt(plainblob, nonce));
+
+    std::string decrypted(plaintext.size(), '\0');
+    BOOST_CHECK_EQUAL(sb.decrypt(decrypted, second, nonce + 1), 0);
+    BOOST_CHECK(decrypted == plaintext);
+    BOOST_CHECK_EQUAL(sb.decrypt(decrypted, second, nonce), -1);
+
+    // in-place
+    bytes inplace{ plainblob };
+    inplace.resize(csize);
+    sodium::span<sodium::byte> whole(inplace);
+    BOOST_CHECK_EQUAL(sb.encrypt(whole, whole.first(plaintext.size()), nonce),
+                      0);
+    BOOST_CHECK(inplace == sb.encrypt(plainblob, nonce));
+    BOOST_CHECK_EQUAL(sb.decrypt(whole, whole, nonce), 0);
+    BOOST_CHECK(bytes(inplace.begin(), inplace.begin() + plaintext.size()) ==
+                plainblob);
+
+    // too small buffers and forgeries: codes, no exceptions
+    BOOST_CHECK_EQUAL(sb.encrypt(first.first(csize - 1), plaintext, nonce), -1);
+    BOOST_CHECK_EQUAL(
+      sb.decrypt(sodium::span<sodium::byte>(decrypted).first(3), first, nonce),
+      -1);
+    BOOST_CHECK_EQUAL(sb.decrypt(decrypted, first.first(3), nonce), -1);
+    ++first[5];
+    BOOST_CHECK_EQUAL(sb.decrypt(decrypted, first, nonce), -1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretbox_span_detached)
+{
+    secretbox<> sb{};
+    secretbox<>::nonce_type nonce{};
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+
+    std::string ciphertext(plaintext.size(), '\0');
+    sodium::byte mac[secretbox<>::MACSIZE];
+    BOOST_CHECK_EQUAL(sb.encrypt(ciphertext, mac, plaintext, nonce), 0);
+
+    std::string decrypted(plaintext.size(), '\0');
+    BOOST_CHECK_EQUAL(sb.decrypt(decrypted, ciphertext, mac, nonce), 0);
+    BOOST_CHECK(decrypted == plaintext);
+
+    mac[0] ^= 1;
+    BOOST_CHECK_EQUAL(sb.decrypt(decrypted, ciphertext, mac, nonce), -1);
+    BOOST_CHECK_EQUAL(sb.encrypt(ciphertext,
+                                 sodium::span<sodium::byte>(mac).first(3),
+                                 plaintext,
+                                 nonce),
+                      -1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretbox_span_padded)
+{
+    secretbox<> sb{};
+    secretbox<>::nonce_type nonce{};
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    // one pass: same as encrypt() of the padded plaintext
+    bytes ciphertext(secretbox<>::ciphertext_size(64));
+    std::size_t clen = 0;
+    BOOST_CHECK_EQUAL(sb.encrypt_padded(ciphertext, plaintext, 16, nonce, clen),
+                      0);
+    BOOST_CHECK_EQUAL(clen, secretbox<>::ciphertext_size(48));
+    ciphertext.resize(clen);
+    BOOST_CHECK(ciphertext == sb.encrypt(sodium::pad(plainblob, 16), nonce));
+
+    bytes decrypted(secretbox<>::plaintext_size(clen));
+    std::size_t plen = 0;
+    BOOST_CHECK_EQUAL(
+      sb.decrypt_padded(decrypted, ciphertext, 16, nonce, plen), 0);
+    BOOST_CHECK_EQUAL(plen, plaintext.size());
+    decrypted.resize(plen);
+    BOOST_CHECK(decrypted == plainblob);
+
+    // too small buffer, forgery
+    BOOST_CHECK_EQUAL(sb.encrypt_padded(sodium::span<sodium::byte>(ciphertext)
+                                          .first(clen - 1),
+                                        plaintext,
+                                        16,
+                                        nonce,
+                                        clen),
+                      -1);
+    ++ciphertext[20];
+    BOOST_CHECK_EQUAL(
+      sb.decrypt_padded(decrypted, ciphertext, 16, nonce, plen), -1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
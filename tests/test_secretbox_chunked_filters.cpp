@@ -0,0 +1,223 @@
+// test_secretbox_chunked_filters.cpp -- Test sodium::secretbox_chunked_*_filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::secretbox_chunked_filters Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "secretbox.h"
+#include "secretbox_chunked_decrypt_filter.h"
+#include "secretbox_chunked_encrypt_filter.h"
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+using sodium::secretbox_chunked_decrypt_filter;
+using sodium::secretbox_chunked_encrypt_filter;
+using chars = sodium::chars;
+using key_type = secretbox_chunked_encrypt_filter::key_type;
+using nonce_type = secretbox_chunked_encrypt_filter::nonce_type;
+
+namespace io = boost::iostreams;
+
+constexpr std::streamsize BUFSIZE = 100;
+constexpr std::size_t CHUNKSIZE = 64;
+constexpr std::size_t MACSIZE = secretbox_chunked_encrypt_filter::MACSIZE;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+chars
+encrypt(const key_type& key,
+        const nonce_type& nonce,
+        const std::string& plaintext,
+        std::size_t chunksize = CHUNKSIZE)
+{
+    chars ciphertext;
+    io::filtering_ostream os(
+      secretbox_chunked_encrypt_filter{ BUFSIZE, key, nonce, chunksize } |
+      io::back_inserter(ciphertext));
+
+    // write in odd-sized pieces, to cross chunk boundaries
+    for (std::size_t pos = 0; pos < plaintext.size(); pos += 7)
+        os.write(plaintext.data() + pos,
+                 std::min<std::size_t>(7, plaintext.size() - pos));
+    os.reset(); // writes the final chunk
+
+    return ciphertext;
+}
+
+std::string
+decrypt_output(const key_type& key,
+               const nonce_type& nonce,
+               const chars& ciphertext,
+               std::size_t chunksize = CHUNKSIZE)
+{
+    std::string decrypted;
+    io::filtering_ostream os(
+      secretbox_chunked_decrypt_filter{ BUFSIZE, key, nonce, chunksize } |
+      io::back_inserter(decrypted));
+    os.write(ciphertext.data(), ciphertext.size());
+    os.reset(); // checks for truncation
+
+    return decrypted;
+}
+
+std::string
+decrypt_input(const key_type& key,
+              const nonce_type& nonce,
+              const chars& ciphertext)
+{
+    io::filtering_istream is;
+    is.push(secretbox_chunked_decrypt_filter{ BUFSIZE, key, nonce, CHUNKSIZE });
+    is.push(io::array_source{ ciphertext.data(), ciphertext.size() });
+
+    return std::string(std::istreambuf_iterator<char>(is), {});
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretbox_chunked_filters_roundtrip)
+{
+    key_type key;
+    nonce_type nonce;
+
+    for (std::size_t size : { 0UL, 1UL, 63UL, 64UL, 65UL, 128UL, 1000UL }) {
+        std::string plaintext(size, 'x');
+        chars ciphertext = encrypt(key, nonce, plaintext);
+
+        // full chunks || final chunk
+        const std::size_t nchunks = size / CHUNKSIZE + 1;
+        BOOST_CHECK_EQUAL(ciphertext.size(), size + nchunks * MACSIZE);
+
+        BOOST_CHECK(decrypt_output(key, nonce, ciphertext) == plaintext);
+        BOOST_CHECK(decrypt_input(key, nonce, ciphertext) == plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretbox_chunked_filters_chunk_nonces)
+{
+    key_type key;
+    nonce_type nonce;
+    std::string plaintext(2 * CHUNKSIZE + 10, 'A');
+    chars ciphertext = encrypt(key, nonce, plaintext);
+
+    // every chunk is a plain secretbox, with a nonce derived from
+    // the base nonce, the chunk index and the final marker
+    sodium::secretbox<chars> sb{ key };
+    for (std::uint64_t k : { 0, 1, 2 }) {
+        const bool final = (k == 2);
+        auto first = ciphertext.cbegin() + k * (MACSIZE + CHUNKSIZE);
+        auto last = final ? ciphertext.cend() : first + MACSIZE + CHUNKSIZE;
+        chars chunk(first, last);
+
+        chars decrypted = sb.decrypt(
+          chunk, sodium::secretbox_chunk_nonce(nonce, k, final));
+        BOOST_CHECK(std::string(decrypted.cbegin(), decrypted.cend()) ==
+                    plaintext.substr(k * CHUNKSIZE, CHUNKSIZE));
+        BOOST_CHECK_THROW(
+          sb.decrypt(chunk, sodium::secretbox_chunk_nonce(nonce, k, !final)),
+          std::exception);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretbox_chunked_filters_constant_memory)
+{
+    key_type key;
+    nonce_type nonce;
+    std::string plaintext(10 * CHUNKSIZE, 'A');
+
+    // chunks are emitted as soon as they are full, before close():
+    // only what's still in the stream and filter buffers is held back.
+    chars ciphertext;
+    io::filtering_ostream os(
+      secretbox_chunked_encrypt_filter{ BUFSIZE, key, nonce, CHUNKSIZE } |
+      io::back_inserter(ciphertext));
+    os.write(plaintext.data(), plaintext.size());
+    os.flush();
+
+    const std::size_t full = 10 * (CHUNKSIZE + MACSIZE);
+    BOOST_CHECK_GE(ciphertext.size(), full / 2);
+
+    os.reset();
+    BOOST_CHECK_EQUAL(ciphertext.size(), full + MACSIZE);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretbox_chunked_filters_falsified)
+{
+    key_type key;
+    key_type key2;
+    nonce_type nonce;
+    nonce_type nonce2;
+    std::string plaintext(500, 'A');
+    chars ciphertext = encrypt(key, nonce, plaintext);
+    const std::size_t chunk = MACSIZE + CHUNKSIZE;
+
+    // wrong key, wrong nonce
+    BOOST_CHECK_THROW(decrypt_output(key2, nonce, ciphertext), std::exception);
+    BOOST_CHECK_THROW(decrypt_output(key, nonce2, ciphertext), std::exception);
+
+    // wrong chunksize
+    BOOST_CHECK_THROW(decrypt_output(key, nonce, ciphertext, 32),
+                      std::exception);
+
+    // tampered ciphertext
+    chars tampered{ ciphertext };
+    ++tampered[100];
+    BOOST_CHECK_THROW(decrypt_output(key, nonce, tampered), std::exception);
+
+    // swapped chunks
+    chars swapped{ ciphertext };
+    std::swap_ranges(swapped.begin(),
+                     swapped.begin() + chunk,
+                     swapped.begin() + chunk);
+    BOOST_CHECK_THROW(decrypt_output(key, nonce, swapped), std::exception);
+
+    // truncated after a full chunk: the final chunk is missing
+    chars truncated(ciphertext.cbegin(), ciphertext.cbegin() + 2 * chunk);
+    BOOST_CHECK_THROW(decrypt_output(key, nonce, truncated), std::exception);
+
+    // a chunk cut short is neither a full nor a final chunk
+    chars shortened(ciphertext.cbegin(), ciphertext.cbegin() + chunk - 1);
+    BOOST_CHECK_THROW(decrypt_output(key, nonce, shortened), std::exception);
+
+    // data appended after the final chunk
+    chars appended{ ciphertext };
+    appended.push_back('!');
+    BOOST_CHECK_THROW(decrypt_output(key, nonce, appended), std::exception);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
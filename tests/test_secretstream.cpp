@@ -26,10 +26,13 @@
 #include "common.h"
 #include "key.h"
 #include "secretstream.h"
+#include "span.h"
+#include <algorithm>
 #include <sodium.h>
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 template<typename BT>
 BT
@@ -287,4 +290,216 @@ BOOST_AUTO_TEST_CASE(
 
 // XXX TODO: Test that other types for F are being rejected at compile-time.
 
+BOOST_AUTO_TEST_CASE(sodium_secretstream_test_push_pull_span)
+{
+    using secretstream = sodium::secretstream<sodium::bytes>;
+    secretstream::key_type key;
+
+    secretstream se{ key };
+    sodium::bytes header = se.init_push();
+    sodium::bytes plaintext = s2b<sodium::bytes>("the quick brown fox");
+    sodium::bytes added_data = s2b<sodium::bytes>("header");
+
+    // the span push() matches the BT push()
+    secretstream se2{ se };
+    sodium::bytes expected = se2.push(plaintext, added_data);
+
+    sodium::bytes ciphertext(plaintext.size() + secretstream::MACSIZE);
+    BOOST_CHECK_EQUAL(se.push(ciphertext, plaintext, added_data), 0);
+    BOOST_CHECK(ciphertext == expected);
+
+    sodium::bytes too_small(ciphertext.size() - 1);
+    BOOST_CHECK_EQUAL(se.push(too_small, plaintext, added_data), -1);
+
+    secretstream sd{ key };
+    sd.init_pull(header);
+    sodium::bytes decrypted(plaintext.size());
+    secretstream::tag_type tag;
+    sodium::bytes wrong_ad = s2b<sodium::bytes>("Header");
+    BOOST_CHECK_EQUAL(sd.pull(decrypted, tag, ciphertext, wrong_ad), -1);
+    BOOST_CHECK_EQUAL(sd.pull(decrypted, tag, ciphertext, added_data), 0);
+    BOOST_CHECK(decrypted == plaintext);
+    BOOST_CHECK(tag == secretstream::tag_message());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_secretstream_test_push_pull_vectored)
+{
+    using secretstream = sodium::secretstream<sodium::bytes>;
+    using sodium::byte;
+    using sodium::span;
+    secretstream::key_type key;
+
+    std::vector<sodium::bytes> messages;
+    for (std::size_t i = 0; i != 100; ++i)
+        messages.emplace_back(i % 7, static_cast<byte>(i));
+    std::vector<span<const byte>> segments(messages.cbegin(),
+                                           messages.cend());
+    std::vector<secretstream::tag_type> tags(messages.size(),
+                                             secretstream::tag_message());
+    tags[50] = secretstream::tag_rekey();
+    tags.back() = secretstream::tag_final();
+
+    // reference: one push() per message
+    secretstream se{ key };
+    sodium::bytes header = se.init_push();
+    secretstream se2{ se };
+    sodium::bytes expected;
+    for (std::size_t i = 0; i != messages.size(); ++i) {
+        sodium::bytes frame = se2.push(messages[i], sodium::bytes{}, tags[i]);
+        expected.insert(expected.end(), frame.cbegin(), frame.cend());
+    }
+
+    sodium::bytes out(secretstream::push_size(segments));
+    std::vector<std::size_t> offsets(messages.size() + 1);
+    BOOST_REQUIRE_EQUAL(se.push(out, offsets, segments, tags), 0);
+    BOOST_CHECK(out == expected);
+    BOOST_CHECK_EQUAL(offsets.back(), out.size());
+    BOOST_CHECK_EQUAL(offsets[1], messages[0].size() + secretstream::MACSIZE);
+
+    // in-place pull of the whole batch
+    secretstream sd{ key };
+    sd.init_pull(header);
+    std::vector<span<byte>> plaintexts(messages.size());
+    std::vector<secretstream::tag_type> pulled_tags(messages.size());
+    BOOST_REQUIRE_EQUAL(sd.pull(out, offsets, plaintexts, pulled_tags), 0);
+    for (std::size_t i = 0; i != messages.size(); ++i) {
+        BOOST_CHECK(sodium::bytes(plaintexts[i].begin(),
+                                  plaintexts[i].end()) == messages[i]);
+        BOOST_CHECK(pulled_tags[i] == tags[i]);
+        BOOST_CHECK(plaintexts[i].data() >= out.data() + offsets[i] &&
+                    plaintexts[i].end() <= out.data() + offsets[i + 1]);
+    }
+
+    // wrong sizes: nothing is pushed
+    std::vector<std::size_t> short_offsets(messages.size());
+    BOOST_CHECK_EQUAL(se.push(out, short_offsets, segments, tags), -1);
+    sodium::bytes short_out(out.size() - 1);
+    BOOST_CHECK_EQUAL(se.push(short_out, offsets, segments, tags), -1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_secretstream_test_pull_vectored_falsified)
+{
+    using secretstream = sodium::secretstream<sodium::bytes>;
+    using sodium::byte;
+    using sodium::span;
+    secretstream::key_type key;
+
+    std::vector<sodium::bytes> messages(10, s2b<sodium::bytes>("message"));
+    std::vector<span<const byte>> segments(messages.cbegin(),
+                                           messages.cend());
+
+    secretstream se{ key };
+    sodium::bytes header = se.init_push();
+    sodium::bytes out(secretstream::push_size(segments));
+    std::vector<std::size_t> offsets(messages.size() + 1);
+    BOOST_REQUIRE_EQUAL(se.push(out, offsets, segments), 0);
+
+    ++out[offsets[4] + 3]; // falsify the 5th frame
+
+    secretstream sd{ key };
+    sd.init_pull(header);
+    std::vector<span<byte>> plaintexts(messages.size());
+    std::vector<secretstream::tag_type> tags(messages.size());
+    BOOST_CHECK_EQUAL(sd.pull(out, offsets, plaintexts, tags), -1);
+
+    // the first 4 frames have been decrypted
+    for (std::size_t i = 0; i != 4; ++i)
+        BOOST_CHECK(sodium::bytes(plaintexts[i].begin(),
+                                  plaintexts[i].end()) == messages[i]);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_secretstream_test_checkpoint_resume)
+{
+    using secretstream = sodium::secretstream<sodium::bytes>;
+    secretstream::key_type key;
+    secretstream::wrapping_key_type wrapping_key;
+
+    std::vector<sodium::bytes> messages;
+    for (std::size_t i = 0; i != 20; ++i)
+        messages.push_back(s2b<sodium::bytes>("chunk " + std::to_string(i)));
+
+    // reference: the uninterrupted stream
+    secretstream se{ key };
+    sodium::bytes header = se.init_push();
+    secretstream se_ref{ se };
+    std::vector<sodium::bytes> frames;
+    for (const auto& message : messages)
+        frames.push_back(se_ref.push(message, sodium::bytes{}));
+
+    // push 12 chunks, checkpoint, and "crash"
+    for (std::size_t i = 0; i != 12; ++i)
+        BOOST_CHECK(se.push(messages[i], sodium::bytes{}) == frames[i]);
+    sodium::bytes saved = se.checkpoint(wrapping_key, 12);
+    BOOST_CHECK_EQUAL(saved.size(), secretstream::CHECKPOINTSIZE);
+
+    // resume in a fresh secretstream: the same ciphertexts follow, if
+    // the same chunks are pushed again (hence the explicit opt-in)
+    secretstream resumed{ key };
+    BOOST_CHECK_THROW(resumed.restore(saved, wrapping_key),
+                      std::runtime_error);
+    BOOST_CHECK_EQUAL(
+      resumed.restore(
+        saved, wrapping_key, secretstream::restore_policy::allow_push),
+      12u);
+    for (std::size_t i = 12; i != messages.size(); ++i)
+        BOOST_CHECK(resumed.push(messages[i], sodium::bytes{}) == frames[i]);
+
+    // the receiving side can checkpoint and resume as well
+    secretstream sd{ key };
+    sd.init_pull(header);
+    secretstream::tag_type tag;
+    for (std::size_t i = 0; i != 5; ++i)
+        BOOST_CHECK(sd.pull(frames[i], sodium::bytes{}, tag) == messages[i]);
+    sodium::bytes saved_pull = sd.checkpoint(wrapping_key, 5);
+    secretstream sd_resumed{ key };
+    BOOST_CHECK_EQUAL(sd_resumed.restore(saved_pull, wrapping_key), 5u);
+    for (std::size_t i = 5; i != messages.size(); ++i)
+        BOOST_CHECK(sd_resumed.pull(frames[i], sodium::bytes{}, tag) ==
+                    messages[i]);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_secretstream_test_checkpoint_falsified)
+{
+    using secretstream = sodium::secretstream<sodium::bytes>;
+    secretstream::key_type key;
+    secretstream::wrapping_key_type wrapping_key;
+    secretstream::wrapping_key_type other_key;
+
+    secretstream se{ key };
+    BOOST_CHECK_THROW(se.checkpoint(wrapping_key, 0), std::runtime_error);
+    se.init_pull(secretstream{ key }.init_push());
+    sodium::bytes saved = se.checkpoint(wrapping_key, 42);
+    BOOST_CHECK_EQUAL(saved.size(), secretstream::CHECKPOINTSIZE);
+    BOOST_CHECK(std::equal(saved.cbegin(),
+                           saved.cbegin() + 4,
+                           secretstream::CHECKPOINT_MAGIC));
+
+    secretstream resumed{ key };
+    BOOST_CHECK_THROW(resumed.restore(saved, other_key), std::runtime_error);
+
+    // the direction and the chunk counter are authenticated: a pull
+    // state can't be passed off as a push state, nor vice versa
+    sodium::bytes falsified{ saved };
+    falsified[4] = 1; // push
+    BOOST_CHECK_THROW(
+      resumed.restore(
+        falsified, wrapping_key, secretstream::restore_policy::allow_push),
+      std::runtime_error);
+    falsified = saved;
+    ++falsified[5];
+    BOOST_CHECK_THROW(resumed.restore(falsified, wrapping_key),
+                      std::runtime_error);
+
+    falsified = saved;
+    ++falsified.back();
+    BOOST_CHECK_THROW(resumed.restore(falsified, wrapping_key),
+                      std::runtime_error);
+
+    sodium::bytes truncated(saved.cbegin(), saved.cend() - 1);
+    BOOST_CHECK_THROW(resumed.restore(truncated, wrapping_key),
+                      std::runtime_error);
+
+    BOOST_CHECK_EQUAL(resumed.restore(saved, wrapping_key), 42u);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
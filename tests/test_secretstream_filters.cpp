@@ -0,0 +1,177 @@
+// test_secretstream_filters.cpp -- Test sodium::secretstream_{en,de}crypt_filter
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::secretstream_filters Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "secretstream_decrypt_filter.h"
+#include "secretstream_encrypt_filter.h"
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <stdexcept>
+#include <string>
+
+using sodium::secretstream_decrypt_filter;
+using sodium::secretstream_encrypt_filter;
+using chars = sodium::chars;
+
+namespace io = boost::iostreams;
+
+constexpr std::streamsize BUFSIZE = 100;
+constexpr std::size_t CHUNKSIZE = 64;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+chars
+encrypt(const secretstream_encrypt_filter::key_type& key,
+        const std::string& plaintext,
+        std::size_t chunksize = CHUNKSIZE)
+{
+    chars ciphertext;
+    io::filtering_ostream os(
+      secretstream_encrypt_filter{ BUFSIZE, key, chunksize } |
+      io::back_inserter(ciphertext));
+
+    // write in odd-sized pieces, to cross chunk boundaries
+    for (std::size_t pos = 0; pos < plaintext.size(); pos += 7)
+        os.write(plaintext.data() + pos,
+                 std::min<std::size_t>(7, plaintext.size() - pos));
+    os.reset(); // writes the final chunk
+
+    return ciphertext;
+}
+
+std::string
+decrypt_output(const secretstream_decrypt_filter::key_type& key,
+               const chars& ciphertext,
+               std::size_t chunksize = CHUNKSIZE)
+{
+    std::string decrypted;
+    io::filtering_ostream os(
+      secretstream_decrypt_filter{ BUFSIZE, key, chunksize } |
+      io::back_inserter(decrypted));
+    os.write(ciphertext.data(), ciphertext.size());
+    os.reset(); // checks for truncation
+
+    return decrypted;
+}
+
+std::string
+decrypt_input(const secretstream_decrypt_filter::key_type& key,
+              const chars& ciphertext)
+{
+    io::filtering_istream is;
+    is.push(secretstream_decrypt_filter{ BUFSIZE, key, CHUNKSIZE });
+    is.push(io::array_source{ ciphertext.data(), ciphertext.size() });
+
+    return std::string(std::istreambuf_iterator<char>(is), {});
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretstream_filters_roundtrip)
+{
+    secretstream_encrypt_filter::key_type key;
+
+    for (std::size_t size : { 0UL, 1UL, 63UL, 64UL, 65UL, 128UL, 1000UL }) {
+        std::string plaintext(size, 'x');
+        chars ciphertext = encrypt(key, plaintext);
+
+        // header || full chunks || final chunk
+        const std::size_t nchunks = size / CHUNKSIZE + 1;
+        BOOST_CHECK_EQUAL(ciphertext.size(),
+                          secretstream_encrypt_filter::HEADERSIZE + size +
+                            nchunks * secretstream_encrypt_filter::MACSIZE);
+
+        BOOST_CHECK(decrypt_output(key, ciphertext) == plaintext);
+        BOOST_CHECK(decrypt_input(key, ciphertext) == plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretstream_filters_constant_memory)
+{
+    secretstream_encrypt_filter::key_type key;
+    std::string plaintext(10 * CHUNKSIZE, 'A');
+
+    // chunks are emitted as soon as they are full, before close():
+    // only what's still in the stream and filter buffers is held back.
+    chars ciphertext;
+    io::filtering_ostream os(
+      secretstream_encrypt_filter{ BUFSIZE, key, CHUNKSIZE } |
+      io::back_inserter(ciphertext));
+    os.write(plaintext.data(), plaintext.size());
+    os.flush();
+
+    const std::size_t full =
+      secretstream_encrypt_filter::HEADERSIZE +
+      10 * (CHUNKSIZE + secretstream_encrypt_filter::MACSIZE);
+    BOOST_CHECK_GE(ciphertext.size(), full / 2);
+
+    os.reset();
+    BOOST_CHECK_EQUAL(ciphertext.size(),
+                      full + secretstream_encrypt_filter::MACSIZE);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_secretstream_filters_falsified)
+{
+    secretstream_encrypt_filter::key_type key;
+    secretstream_encrypt_filter::key_type key2;
+    std::string plaintext(500, 'A');
+    chars ciphertext = encrypt(key, plaintext);
+
+    // wrong key
+    BOOST_CHECK_THROW(decrypt_output(key2, ciphertext), std::exception);
+
+    // wrong chunksize
+    BOOST_CHECK_THROW(decrypt_output(key, ciphertext, 32), std::exception);
+
+    // tampered ciphertext
+    chars tampered{ ciphertext };
+    ++tampered[secretstream_encrypt_filter::HEADERSIZE + 100];
+    BOOST_CHECK_THROW(decrypt_output(key, tampered), std::exception);
+
+    // truncated after a full chunk: the final chunk is missing
+    chars truncated(ciphertext.cbegin(),
+                    ciphertext.cbegin() +
+                      secretstream_encrypt_filter::HEADERSIZE +
+                      2 * (CHUNKSIZE + secretstream_encrypt_filter::MACSIZE));
+    BOOST_CHECK_THROW(decrypt_output(key, truncated), std::exception);
+
+    // data appended after the final chunk
+    chars appended{ ciphertext };
+    appended.push_back('!');
+    BOOST_CHECK_THROW(decrypt_output(key, appended), std::exception);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,217 @@
+// test_seekable_container.cpp -- Test sodium::seekable_container
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::seekable_container Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "random.h"
+#include "seekable_container.h"
+
+#include <boost/iostreams/stream.hpp>
+
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+using sodium::seekable_container;
+using sodium::seekable_container_source;
+
+using key_type = seekable_container<>::key_type;
+using nonce_type = seekable_container<>::nonce_type;
+
+constexpr std::size_t BLOCKSIZE = 1000;
+
+std::string
+random_string(std::size_t size)
+{
+    std::string result(size, '\0');
+    sodium::randombytes_buf_inplace(result);
+    return result;
+}
+
+template<typename F = sodium::aead_xchacha20_poly1305_ietf>
+std::string
+make_container(const typename seekable_container<F>::key_type& key,
+               const std::string& plaintext,
+               std::size_t blocksize = BLOCKSIZE)
+{
+    seekable_container<F> sc(key, blocksize);
+    std::istringstream istr(plaintext);
+    std::ostringstream ostr;
+    sc.encrypt(istr, ostr, typename seekable_container<F>::nonce_type());
+    return ostr.str();
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_seekable_container_roundtrip)
+{
+    key_type key;
+    seekable_container<> sc(key, BLOCKSIZE);
+
+    for (std::size_t size : { 0UL, 1UL, 999UL, 1000UL, 1001UL, 12345UL }) {
+        std::string plaintext = random_string(size);
+        std::string container = make_container(key, plaintext);
+        BOOST_CHECK_EQUAL(container.size(), sc.container_size(size));
+
+        std::istringstream cstr(container);
+        seekable_container_source<> source(cstr, key);
+        BOOST_CHECK_EQUAL(source.size(), size);
+        BOOST_CHECK_EQUAL(source.blocksize(), BLOCKSIZE);
+        BOOST_CHECK(source.verify());
+
+        io::stream<seekable_container_source<>> in(source);
+        std::ostringstream decrypted;
+        decrypted << in.rdbuf();
+        BOOST_CHECK(decrypted.str() == plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_seekable_container_random_access)
+{
+    key_type key;
+    std::string plaintext = random_string(10 * BLOCKSIZE + 321);
+    std::istringstream cstr(make_container(key, plaintext));
+    io::stream<seekable_container_source<>> in(cstr, key);
+
+    // within a chunk, across chunks, up to and past the end
+    const std::size_t ranges[][2] = { { 4500, 100 }, { 0, 1 },   { 999, 2 },
+                                      { 3000, 2500 }, { 10300, 21 },
+                                      { 10000, 1000 } };
+    for (const auto& range : ranges) {
+        std::string buf(range[1], '\0');
+        in.clear();
+        in.seekg(range[0]);
+        in.read(&buf[0], buf.size());
+        buf.resize(static_cast<std::size_t>(in.gcount()));
+        BOOST_CHECK(buf == plaintext.substr(range[0], range[1]));
+    }
+
+    // relative seeks
+    in.clear();
+    in.seekg(-10, std::ios::end);
+    BOOST_CHECK_EQUAL(in.tellg(), std::streampos(plaintext.size() - 10));
+    std::string tail(10, '\0');
+    in.read(&tail[0], tail.size());
+    BOOST_CHECK(tail == plaintext.substr(plaintext.size() - 10));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_seekable_container_other_aead)
+{
+    using F = sodium::aead_chacha20_poly1305_ietf;
+    seekable_container<F>::key_type key;
+    std::string plaintext = random_string(5000);
+    std::istringstream cstr(make_container<F>(key, plaintext, 512));
+
+    io::stream<seekable_container_source<F>> in(cstr, key);
+    std::string buf(700, '\0');
+    in.seekg(2000);
+    in.read(&buf[0], buf.size());
+    BOOST_CHECK(buf == plaintext.substr(2000, 700));
+
+    // another construction refuses to open the container
+    std::istringstream cstr2(cstr.str());
+    BOOST_CHECK_THROW(seekable_container_source<>(cstr2, key_type()),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_seekable_container_falsified)
+{
+    key_type key;
+    std::string plaintext = random_string(5 * BLOCKSIZE + 10);
+    const std::string container = make_container(key, plaintext);
+    const std::size_t HEADERSIZE = seekable_container<>::HEADERSIZE;
+    const std::size_t FOOTERSIZE = seekable_container<>::FOOTERSIZE;
+    const std::size_t chunk = BLOCKSIZE + seekable_container<>::MACSIZE;
+
+    // wrong key
+    {
+        std::istringstream cstr(container);
+        BOOST_CHECK_THROW(seekable_container_source<>(cstr, key_type()),
+                          std::runtime_error);
+    }
+
+    // falsified header (the blocksize)
+    {
+        std::string falsified{ container };
+        ++falsified[9];
+        std::istringstream cstr(falsified);
+        BOOST_CHECK_THROW(seekable_container_source<>(cstr, key),
+                          std::runtime_error);
+    }
+
+    // truncated by a whole chunk
+    {
+        std::string truncated{ container.substr(
+          0, container.size() - FOOTERSIZE - chunk) };
+        truncated += container.substr(container.size() - FOOTERSIZE);
+        std::istringstream cstr(truncated);
+        BOOST_CHECK_THROW(seekable_container_source<>(cstr, key),
+                          std::runtime_error);
+    }
+
+    // a falsified chunk: the others are still readable
+    {
+        std::string falsified{ container };
+        ++falsified[HEADERSIZE + 2 * chunk + 10];
+        std::istringstream cstr(falsified);
+        seekable_container_source<> source(cstr, key);
+        BOOST_CHECK(source.verify()); // the tags are intact
+
+        std::string buf(100, '\0');
+        source.seek(2 * BLOCKSIZE, std::ios::beg);
+        BOOST_CHECK_THROW(source.read(&buf[0], 100), std::runtime_error);
+        source.seek(3 * BLOCKSIZE, std::ios::beg);
+        BOOST_CHECK_EQUAL(source.read(&buf[0], 100), 100);
+        BOOST_CHECK(buf == plaintext.substr(3 * BLOCKSIZE, 100));
+    }
+
+    // swapped chunks: verify() detects them without decrypting
+    {
+        std::string swapped{ container };
+        swapped.replace(
+          HEADERSIZE, chunk, container, HEADERSIZE + chunk, chunk);
+        swapped.replace(
+          HEADERSIZE + chunk, chunk, container, HEADERSIZE, chunk);
+        std::istringstream cstr(swapped);
+        seekable_container_source<> source(cstr, key);
+        BOOST_CHECK(!source.verify());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,162 @@
+// test_short_hash_map.cpp -- Test sodium::short_hash_map<>
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::short_hash_map Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "hasher_short.h"
+#include "short_hash_map.h"
+
+#include <sodium.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+
+using sodium::hasher_short;
+using sodium::short_hash_map;
+using sodium::short_hash_set;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_short_hash_map_basic)
+{
+    hasher_short<> hasher;
+    short_hash_map<std::string, int> table(hasher);
+    BOOST_CHECK(table.empty());
+    BOOST_CHECK(table.find("alice") == nullptr);
+
+    BOOST_CHECK(table.insert("alice", 1));
+    BOOST_CHECK(table.insert("bob", 2));
+    BOOST_CHECK(!table.insert("alice", 3)); // already there
+    BOOST_CHECK_EQUAL(table.size(), 2UL);
+
+    BOOST_REQUIRE(table.find("alice") != nullptr);
+    BOOST_CHECK_EQUAL(*table.find("alice"), 1);
+    BOOST_CHECK(table.contains("bob"));
+    BOOST_CHECK(!table.contains("carol"));
+
+    table.insert_or_assign("alice", 4);
+    BOOST_CHECK_EQUAL(*table.find("alice"), 4);
+    *table.find("bob") = 5;
+    BOOST_CHECK_EQUAL(*table.find("bob"), 5);
+
+    BOOST_CHECK(table.erase("alice"));
+    BOOST_CHECK(!table.erase("alice"));
+    BOOST_CHECK(!table.contains("alice"));
+    BOOST_CHECK_EQUAL(table.size(), 1UL);
+
+    table.clear();
+    BOOST_CHECK(table.empty());
+    BOOST_CHECK(!table.contains("bob"));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_short_hash_map_against_std_map)
+{
+    hasher_short<> hasher;
+    short_hash_map<std::uint64_t, std::uint64_t> table(hasher);
+    std::map<std::uint64_t, std::uint64_t> reference;
+
+    // many inserts and erases, to exercise growth and tombstones
+    std::mt19937_64 rng(42);
+    for (int round = 0; round != 50000; ++round) {
+        const std::uint64_t key = rng() % 5000;
+        if (rng() % 3 == 0) {
+            BOOST_CHECK_EQUAL(table.erase(key), reference.erase(key) == 1);
+        } else {
+            const bool inserted = reference.emplace(key, round).second;
+            BOOST_CHECK_EQUAL(table.insert(key, round), inserted);
+        }
+    }
+
+    BOOST_CHECK_EQUAL(table.size(), reference.size());
+    for (const auto& entry : reference) {
+        const std::uint64_t* value = table.find(entry.first);
+        BOOST_REQUIRE(value != nullptr);
+        BOOST_CHECK_EQUAL(*value, entry.second);
+    }
+
+    std::size_t visited = 0;
+    table.for_each([&](const std::uint64_t& key, const std::uint64_t& value) {
+        ++visited;
+        BOOST_CHECK_EQUAL(reference.at(key), value);
+    });
+    BOOST_CHECK_EQUAL(visited, reference.size());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_short_hash_map_copy_move_reserve)
+{
+    hasher_short<> hasher;
+    short_hash_map<std::string, std::unique_ptr<int>> owners(hasher);
+    owners.insert("x", std::make_unique<int>(7));
+    BOOST_CHECK_EQUAL(**owners.find("x"), 7);
+
+    short_hash_map<std::string, std::unique_ptr<int>> moved{ std::move(
+      owners) };
+    BOOST_CHECK_EQUAL(**moved.find("x"), 7);
+
+    short_hash_map<std::string, int> table(hasher, 1000);
+    const std::size_t capacity = table.capacity();
+    BOOST_CHECK(capacity >= 1000UL);
+    for (int i = 0; i != 1000; ++i)
+        table.insert(std::to_string(i), i);
+    BOOST_CHECK_EQUAL(table.capacity(), capacity); // no growth
+
+    short_hash_map<std::string, int> copy{ table };
+    BOOST_CHECK_EQUAL(copy.size(), 1000UL);
+    BOOST_CHECK_EQUAL(*copy.find("999"), 999);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_short_hash_set)
+{
+    hasher_short<> hasher;
+    short_hash_set<std::string> set(hasher);
+
+    for (int i = 0; i != 300; ++i)
+        BOOST_CHECK(set.insert(std::to_string(i)));
+    BOOST_CHECK(!set.insert("42"));
+    BOOST_CHECK_EQUAL(set.size(), 300UL);
+    BOOST_CHECK(set.contains("299"));
+    BOOST_CHECK(!set.contains("300"));
+
+    BOOST_CHECK(set.erase("42"));
+    BOOST_CHECK(!set.contains("42"));
+
+    std::size_t visited = 0;
+    set.for_each([&visited](const std::string&) { ++visited; });
+    BOOST_CHECK_EQUAL(visited, 299UL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
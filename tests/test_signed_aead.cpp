@@ -0,0 +1,140 @@
+// test_signed_aead.cpp -- Test sodium::signed_aead
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::signed_aead Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "keypairsign.h"
+#include "signed_aead.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <sodium.h>
+
+using sodium::bytes;
+using sodium::keypairsign;
+using sodium::signed_aead;
+
+using key_type = signed_aead<>::key_type;
+using nonce_type = signed_aead<>::nonce_type;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_signed_aead_seal_open)
+{
+    key_type key;
+    keypairsign<> alice;
+    bytes alice_pk = alice.public_key();
+
+    signed_aead<> sender(key, alice.private_key());
+    signed_aead<> receiver(key, alice_pk);
+    nonce_type nonce;
+
+    std::string pt{ "the quick brown fox jumps over the lazy dog" };
+    bytes plaintext(pt.cbegin(), pt.cend());
+    bytes header{ 'h', 'e', 'a', 'd' };
+
+    for (const bytes& hdr : { header, bytes{} }) {
+        bytes sealed = sender.seal(hdr, plaintext, nonce);
+        BOOST_CHECK_EQUAL(sealed.size(), signed_aead<>::sealed_size(pt.size()));
+
+        // (ciphertext || MAC) is the plain aead's output
+        sodium::aead<> plain(key);
+        bytes ciphertext = plain.encrypt(hdr, plaintext, nonce);
+        BOOST_CHECK(bytes(sealed.cbegin(),
+                          sealed.cbegin() + ciphertext.size()) == ciphertext);
+
+        BOOST_CHECK(receiver.open(hdr, sealed, nonce) == plaintext);
+    }
+
+    // a sender can't open, a receiver can't seal
+    bytes sealed = sender.seal(header, plaintext, nonce);
+    BOOST_CHECK_THROW(sender.open(header, sealed, nonce), std::runtime_error);
+    BOOST_CHECK_THROW(receiver.seal(header, plaintext, nonce),
+                      std::runtime_error);
+
+    // both with a keypair
+    signed_aead<> both(key, alice);
+    BOOST_CHECK(both.open(header, both.seal(header, plaintext, nonce), nonce) ==
+                plaintext);
+
+    BOOST_CHECK_THROW(signed_aead<>(key, bytes(5)), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_signed_aead_forgeries)
+{
+    key_type key;
+    keypairsign<> alice;
+    keypairsign<> mallory;
+    signed_aead<> receiver(key, alice.public_key());
+    nonce_type nonce;
+
+    bytes plaintext(100, 'x');
+    bytes header{ 'h' };
+    bytes sealed = signed_aead<>(key, alice).seal(header, plaintext, nonce);
+    bytes decrypted(plaintext.size());
+
+    BOOST_CHECK_EQUAL(receiver.open(decrypted, header, sealed, nonce), 0);
+    BOOST_CHECK(decrypted == plaintext);
+
+    // a valid aead message, signed by someone else: rejected
+    bytes forged = signed_aead<>(key, mallory).seal(header, plaintext, nonce);
+    BOOST_CHECK_EQUAL(receiver.open(decrypted, header, forged, nonce), -1);
+
+    // the ciphertext, the signature, the header, the nonce
+    for (std::size_t i : { 0UL, sealed.size() - 1 }) {
+        bytes falsified{ sealed };
+        ++falsified[i];
+        BOOST_CHECK_EQUAL(receiver.open(decrypted, header, falsified, nonce),
+                          -1);
+    }
+    bytes other_header{ 'H' };
+    BOOST_CHECK_EQUAL(receiver.open(decrypted, other_header, sealed, nonce),
+                      -1);
+    nonce_type other_nonce;
+    BOOST_CHECK_EQUAL(receiver.open(decrypted, header, sealed, other_nonce),
+                      -1);
+
+    // too small buffers
+    bytes small(sealed.size() - 1);
+    BOOST_CHECK_EQUAL(
+      signed_aead<>(key, alice).seal(small, header, plaintext, nonce), -1);
+    bytes small_decrypted(plaintext.size() - 1);
+    BOOST_CHECK_EQUAL(receiver.open(small_decrypted, header, sealed, nonce),
+                      -1);
+    bytes truncated(10);
+    BOOST_CHECK_EQUAL(receiver.open(decrypted, header, truncated, nonce), -1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -23,10 +23,12 @@
 #include "common.h"
 #include "keypairsign.h"
 #include "signer.h"
+#include "thread_pool.h"
 #include "verifier.h"
 #include <algorithm>
 #include <sodium.h>
 #include <string>
+#include <vector>
 
 using sodium::keypairsign;
 using sodium::signer;
@@ -869,4 +871,141 @@ BOOST_AUTO_TEST_CASE(
                  plainblob.data()));
 }
 
+BOOST_AUTO_TEST_CASE(sodium_signor_test_verify_detached_batch_same_key)
+{
+    keypairsign<> keypair;
+    signer<> sc_signer(keypair.private_key());
+    verifier<> sc_verifier(keypair.public_key());
+    sodium::thread_pool pool(3);
+
+    std::vector<bytes> plaintexts;
+    std::vector<bytes> signatures;
+    for (int i = 0; i != 100; ++i) {
+        plaintexts.emplace_back(static_cast<std::size_t>(i), 'x');
+        signatures.push_back(sc_signer.sign_detached(plaintexts.back()));
+    }
+
+    // falsify a few items
+    ++signatures[10][0];
+    ++plaintexts[20][0];
+    signatures[30].resize(10); // wrong size: doesn't throw in batch mode
+
+    std::vector<bool> result =
+      sc_verifier.verify_detached(plaintexts, signatures, pool);
+
+    BOOST_CHECK_EQUAL(result.size(), 100UL);
+    for (std::size_t i = 0; i != result.size(); ++i)
+        BOOST_CHECK_EQUAL(result[i], i != 10 && i != 20 && i != 30);
+
+    // mismatched array sizes
+    signatures.pop_back();
+    BOOST_CHECK_THROW(sc_verifier.verify_detached(plaintexts, signatures, pool),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_signor_test_verify_detached_batch_many_keys)
+{
+    sodium::thread_pool pool(2);
+
+    std::vector<bytes> plaintexts;
+    std::vector<bytes> signatures;
+    std::vector<verifier<>::public_key_type> public_keys;
+    for (int i = 0; i != 20; ++i) {
+        keypairsign<> keypair;
+        signer<> sc_signer(keypair.private_key());
+
+        plaintexts.emplace_back(100, static_cast<sodium::byte>(i));
+        signatures.push_back(sc_signer.sign_detached(plaintexts.back()));
+        public_keys.push_back(keypair.public_key());
+    }
+
+    // swap two public keys, and truncate another one
+    std::swap(public_keys[3], public_keys[4]);
+    public_keys[7].resize(5);
+
+    std::vector<bool> result =
+      verifier<>::verify_detached(plaintexts, signatures, public_keys, pool);
+
+    BOOST_CHECK_EQUAL(result.size(), 20UL);
+    for (std::size_t i = 0; i != result.size(); ++i)
+        BOOST_CHECK_EQUAL(result[i], i != 3 && i != 4 && i != 7);
+
+    // an empty batch
+    BOOST_CHECK(verifier<>::verify_detached(
+                  std::vector<bytes>{}, {}, {}, pool)
+                  .empty());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_signor_test_sign_detached_fixed)
+{
+    keypairsign<> keypair;
+    signer<> sc_signer(keypair.private_key());
+    verifier<> sc_verifier(keypair.public_key());
+
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    // Ed25519 is deterministic: same signature as sign_detached()
+    signer<>::signature_type signature =
+      sc_signer.sign_detached_fixed(plaintext);
+    BOOST_CHECK_EQUAL(signature.size(), signer<>::SIGNATURE_SIZE);
+    BOOST_CHECK(signature.to() == sc_signer.sign_detached(plainblob));
+
+    BOOST_CHECK(sc_verifier.verify_detached(plaintext, signature));
+    BOOST_CHECK(sc_verifier.verify_detached(plainblob, signature.to()));
+
+    verifier<>::signature_type falsified{ signature };
+    ++falsified[0];
+    BOOST_CHECK(!sc_verifier.verify_detached(plaintext, falsified));
+    std::string empty;
+    BOOST_CHECK(!sc_verifier.verify_detached(empty, signature));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_signor_test_sign_detached_batch)
+{
+    keypairsign<> keypair;
+    signer<> sc_signer(keypair.private_key());
+    verifier<> sc_verifier(keypair.public_key());
+    sodium::thread_pool pool(3);
+
+    // below and above the parallel threshold
+    for (std::size_t n : { 0UL, 1UL, 10UL, 200UL }) {
+        std::vector<bytes> plaintexts;
+        for (std::size_t i = 0; i != n; ++i)
+            plaintexts.emplace_back(i % 50, static_cast<sodium::byte>(i));
+
+        bytes signatures = sc_signer.sign_detached(plaintexts, pool);
+        BOOST_CHECK_EQUAL(signatures.size(), n * sigsize);
+
+        // Ed25519 is deterministic: same as one by one
+        std::vector<bytes> split;
+        for (std::size_t i = 0; i != n; ++i) {
+            split.emplace_back(signatures.cbegin() + i * sigsize,
+                               signatures.cbegin() + (i + 1) * sigsize);
+            BOOST_CHECK(split.back() ==
+                        sc_signer.sign_detached(plaintexts[i]));
+        }
+        std::vector<bool> ok =
+          sc_verifier.verify_detached(plaintexts, split, pool);
+        BOOST_CHECK(std::all_of(ok.cbegin(), ok.cend(), [](bool b) {
+            return b;
+        }));
+
+        // allocation-free, serial
+        std::vector<sodium::span<const sodium::byte>> views(
+          plaintexts.cbegin(), plaintexts.cend());
+        bytes serial(n * sigsize);
+        BOOST_CHECK_EQUAL(sc_signer.sign_detached(views, serial), 0);
+        BOOST_CHECK(serial == signatures);
+    }
+
+    // wrong size of the signatures array
+    std::vector<bytes> plaintexts(3, bytes(10, 'x'));
+    std::vector<sodium::span<const sodium::byte>> views(plaintexts.cbegin(),
+                                                       plaintexts.cend());
+    bytes signatures(3 * sigsize - 1);
+    BOOST_CHECK_EQUAL(sc_signer.sign_detached(views, signatures), -1);
+    BOOST_CHECK_EQUAL(sc_signer.sign_detached(views, signatures, pool), -1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,188 @@
+// test_small_bytes.cpp -- Test sodium::small_bytes<>
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::small_bytes Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "hasher_generic.h"
+#include "hasher_generic_keyless.h"
+#include "keyvar.h"
+#include "small_bytes.h"
+
+#include <sodium.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+using sodium::byte;
+using sodium::bytes;
+using sodium::small_bytes;
+using sodium::small_bytes_protected;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_small_bytes_inline)
+{
+    small_bytes<> b(32, 0x5a);
+    BOOST_CHECK_EQUAL(b.size(), 32UL);
+    BOOST_CHECK(b.is_inline());
+    BOOST_CHECK(std::all_of(
+      b.begin(), b.end(), [](byte c) { return c == 0x5a; }));
+
+    // the bytes live in the object itself
+    const byte* self = reinterpret_cast<const byte*>(&b);
+    BOOST_CHECK(b.data() >= self && b.data() < self + sizeof b);
+
+    b.resize(64);
+    BOOST_CHECK(b.is_inline());
+    BOOST_CHECK_EQUAL(b[63], 0);
+    BOOST_CHECK_EQUAL(b[31], 0x5a);
+
+    b.resize(16);
+    BOOST_CHECK_EQUAL(b.size(), 16UL);
+    BOOST_CHECK(b.is_inline());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_small_bytes_heap)
+{
+    small_bytes<16> b{ 1, 2, 3 };
+    b.resize(100, 7);
+    BOOST_CHECK(!b.is_inline());
+    BOOST_CHECK_EQUAL(b.size(), 100UL);
+    BOOST_CHECK_EQUAL(b[2], 3);
+    BOOST_CHECK_EQUAL(b[99], 7);
+
+    small_bytes<16> copy{ b };
+    BOOST_CHECK(copy == b);
+
+    small_bytes<16> moved{ std::move(b) };
+    BOOST_CHECK(moved == copy);
+    BOOST_CHECK(b.empty());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_small_bytes_copy_move)
+{
+    bytes source{ 10, 20, 30, 40 };
+    small_bytes<> a{ sodium::span<const byte>(source) };
+    BOOST_CHECK(std::equal(a.begin(), a.end(), source.begin(), source.end()));
+
+    small_bytes<> b;
+    b = a;
+    BOOST_CHECK(a == b);
+
+    small_bytes<> c;
+    c = std::move(b);
+    BOOST_CHECK(c == a);
+    BOOST_CHECK(b.empty());
+
+    c[0] = 11;
+    BOOST_CHECK(c != a);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_small_bytes_hash)
+{
+    sodium::hasher_generic<bytes> hasher;
+    std::string message{ "the quick brown fox" };
+    bytes plainblob{ message.cbegin(), message.cend() };
+
+    bytes expected = hasher.hash(plainblob, 48);
+    auto h = hasher.hash<small_bytes<>>(plainblob, 48);
+    BOOST_CHECK(h.is_inline());
+    BOOST_CHECK(
+      std::equal(h.begin(), h.end(), expected.begin(), expected.end()));
+
+    // the incremental API, too
+    auto state = hasher.state(48);
+    state.update(plainblob);
+    BOOST_CHECK(state.final<small_bytes<>>() == h);
+
+    sodium::hasher_generic_keyless<bytes> keyless;
+    bytes expected2 = keyless.hash(plainblob);
+    auto h2 = keyless.hash<small_bytes<>>(plainblob);
+    BOOST_CHECK(
+      std::equal(h2.begin(), h2.end(), expected2.begin(), expected2.end()));
+
+    BOOST_CHECK_THROW(hasher.hash<small_bytes<>>(plainblob, 65),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_small_bytes_protected)
+{
+    small_bytes_protected<> b(32, 1);
+    BOOST_CHECK_EQUAL(b.size(), 32UL);
+    BOOST_CHECK_EQUAL(b.capacity(), 64UL);
+    const byte* slot = b.data();
+
+    // resizing within the slot doesn't move the bytes
+    b.resize(64, 2);
+    BOOST_CHECK(b.data() == slot);
+    BOOST_CHECK_EQUAL(b[31], 1);
+    BOOST_CHECK_EQUAL(b[32], 2);
+
+    b.resize(200, 3);
+    BOOST_CHECK(b.capacity() >= 200UL);
+    BOOST_CHECK_EQUAL(b[0], 1);
+    BOOST_CHECK_EQUAL(b[199], 3);
+
+    small_bytes_protected<> copy{ b };
+    BOOST_CHECK(std::equal(copy.begin(), copy.end(), b.begin(), b.end()));
+
+    small_bytes_protected<> moved{ std::move(copy) };
+    BOOST_CHECK(copy.empty());
+    BOOST_CHECK_EQUAL(moved.size(), 200UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_small_bytes_keyvar)
+{
+    using keyvar_small = sodium::keyvar<small_bytes_protected<>>;
+
+    keyvar_small key(32); // random, readonly
+    BOOST_CHECK_EQUAL(key.size(), 32UL);
+
+    keyvar_small copy{ key };
+    BOOST_CHECK(copy == key);
+
+    keyvar_small moved{ std::move(copy) };
+    BOOST_CHECK(moved == key);
+
+    keyvar_small other(32);
+    BOOST_CHECK(other != key);
+
+    moved.destroy();
+    BOOST_CHECK(moved != key);
+    moved.readonly();
+    moved.readwrite();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,315 @@
+// test_stream_xor_backend.cpp -- Test pluggable stream cipher backends
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::stream_xor_backend Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "buffered_stream_filter.h"
+#include "chacha20_filter.h"
+#include "common.h"
+#include "parallel_stream_xor_backend.h"
+#include "random.h"
+#include "salsa20_filter.h"
+#include "stream_xor_backend.h"
+#include "thread_pool.h"
+#include "xchacha20_filter.h"
+#include "xsalsa20_filter.h"
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <sodium.h>
+
+namespace io = boost::iostreams;
+
+using chars = sodium::chars;
+using sodium::stream_cipher_id;
+using sodium::stream_xor_backend;
+
+// libsodium, counting the calls and bytes it gets
+class counting_backend : public sodium::libsodium_stream_xor_backend
+{
+  public:
+    explicit counting_backend(std::size_t min_size = 0)
+      : min_size_{ min_size }
+    {}
+
+    const char* name() const noexcept override { return "counting"; }
+    std::size_t min_size() const noexcept override { return min_size_; }
+
+    int xor_ic(stream_cipher_id cipher,
+               unsigned char* c,
+               const unsigned char* m,
+               unsigned long long mlen,
+               const unsigned char* n,
+               std::uint64_t ic,
+               const unsigned char* k) noexcept override
+    {
+        ++calls;
+        bytes += mlen;
+        return libsodium_stream_xor_backend::xor_ic(
+          cipher, c, m, mlen, n, ic, k);
+    }
+
+    std::atomic<std::size_t> calls{ 0 };
+    std::atomic<std::size_t> bytes{ 0 };
+
+  private:
+    std::size_t min_size_;
+};
+
+// an accelerator in miniature: one block at a time, last block first
+class blockwise_backend : public stream_xor_backend
+{
+  public:
+    const char* name() const noexcept override { return "blockwise"; }
+
+    int xor_ic(stream_cipher_id cipher,
+               unsigned char* c,
+               const unsigned char* m,
+               unsigned long long mlen,
+               const unsigned char* n,
+               std::uint64_t ic,
+               const unsigned char* k) noexcept override
+    {
+        const std::uint64_t blocks = (mlen + BLOCKSIZE - 1) / BLOCKSIZE;
+        for (std::uint64_t b = blocks; b-- != 0;) {
+            const std::size_t offset = b * BLOCKSIZE;
+            const std::size_t size =
+              std::min<std::size_t>(BLOCKSIZE, mlen - offset);
+            if (libsodium_.xor_ic(
+                  cipher, c + offset, m + offset, size, n, ic + b, k) != 0)
+                return -1;
+        }
+        return 0;
+    }
+
+  private:
+    sodium::libsodium_stream_xor_backend libsodium_;
+};
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+        sodium::set_default_stream_xor_backend(nullptr);
+    }
+};
+
+chars
+random_chars(std::size_t size)
+{
+    chars result(size);
+    sodium::randombytes_buf_inplace(result);
+    return result;
+}
+
+template<typename Filter>
+chars
+filter_output(Filter filter, const chars& plaintext)
+{
+    chars result;
+    io::filtering_ostream os;
+    os.push(filter);
+    os.push(io::back_inserter(result));
+    os.write(plaintext.data(), plaintext.size());
+    os.flush();
+    os.pop();
+    return result;
+}
+
+// Filter gives the same output with backend as with libsodium
+template<typename Filter>
+bool
+same_output(std::shared_ptr<stream_xor_backend> backend,
+            std::streamsize buffer_size)
+{
+    typename Filter::key_type key;
+    typename Filter::nonce_type nonce;
+    const chars plaintext = random_chars(200000 + 17);
+
+    const chars expected =
+      filter_output(Filter(buffer_size, key, nonce), plaintext);
+    const chars actual =
+      filter_output(Filter(buffer_size, key, nonce, backend), plaintext);
+
+    return expected != plaintext && actual == expected;
+}
+
+template<typename Filter>
+void
+check_same_output(std::shared_ptr<stream_xor_backend> backend,
+                  std::streamsize buffer_size)
+{
+    BOOST_CHECK(same_output<Filter>(backend, buffer_size));
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_stream_xor_backend_default)
+{
+    BOOST_CHECK_EQUAL(sodium::default_stream_xor_backend()->name(),
+                      std::string("libsodium"));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_stream_xor_backend_same_output)
+{
+    auto backend = std::make_shared<blockwise_backend>();
+
+    check_same_output<sodium::xchacha20_filter>(backend, 4096);
+    check_same_output<sodium::chacha20_filter>(backend, 4096);
+    check_same_output<sodium::salsa20_filter>(backend, 4096);
+    check_same_output<sodium::xsalsa20_filter>(backend, 4096);
+
+    check_same_output<sodium::buffered_xchacha20_filter>(backend, 1 << 16);
+    check_same_output<sodium::buffered_chacha20_filter>(backend, 1 << 16);
+    check_same_output<sodium::buffered_salsa20_filter>(backend, 1 << 16);
+    check_same_output<sodium::buffered_xsalsa20_filter>(backend, 1 << 16);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_stream_xor_backend_set_default)
+{
+    auto backend = std::make_shared<counting_backend>();
+    sodium::xchacha20_filter::key_type key;
+    sodium::xchacha20_filter::nonce_type nonce;
+    const chars plaintext = random_chars(10000);
+
+    sodium::xchacha20_filter before(1024, key, nonce);
+    sodium::set_default_stream_xor_backend(backend);
+    BOOST_CHECK_EQUAL(sodium::default_stream_xor_backend().get(),
+                      backend.get());
+
+    // filters keep the backend they were constructed with
+    const chars c1 = filter_output(before, plaintext);
+    BOOST_CHECK_EQUAL(backend->calls, 0UL);
+
+    const chars c2 =
+      filter_output(sodium::xchacha20_filter(1024, key, nonce), plaintext);
+    BOOST_CHECK(backend->calls > 0);
+    BOOST_CHECK_EQUAL(backend->bytes, plaintext.size());
+    BOOST_CHECK(c1 == c2);
+
+    // an empty backend restores libsodium
+    sodium::set_default_stream_xor_backend(nullptr);
+    BOOST_CHECK_EQUAL(sodium::default_stream_xor_backend()->name(),
+                      std::string("libsodium"));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_stream_xor_backend_min_size)
+{
+    sodium::buffered_xchacha20_filter::key_type key;
+    sodium::buffered_xchacha20_filter::nonce_type nonce;
+    const chars plaintext = random_chars(100000);
+
+    // calls below min_size() stay with libsodium
+    auto small = std::make_shared<counting_backend>(1 << 20);
+    filter_output(sodium::buffered_xchacha20_filter(1 << 16, key, nonce, small),
+                  plaintext);
+    BOOST_CHECK_EQUAL(small->calls, 0UL);
+
+    auto large = std::make_shared<counting_backend>(1 << 10);
+    filter_output(sodium::buffered_xchacha20_filter(1 << 16, key, nonce, large),
+                  plaintext);
+    BOOST_CHECK(large->calls > 0);
+    BOOST_CHECK_EQUAL(large->bytes, plaintext.size());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_parallel_stream_xor_backend_xor_ic)
+{
+    sodium::thread_pool pool(4);
+    sodium::parallel_stream_xor_backend parallel(pool, 0, 100);
+    sodium::libsodium_stream_xor_backend libsodium;
+    BOOST_CHECK_EQUAL(parallel.slice_size(), 128UL);
+
+    sodium::xchacha20_filter::key_type key;
+    sodium::xchacha20_filter::nonce_type nonce;
+    const chars plaintext = random_chars(100000 + 33);
+    const auto m = reinterpret_cast<const unsigned char*>(plaintext.data());
+
+    for (std::uint64_t ic : { 0UL, 1UL, 12345UL }) {
+        chars expected(plaintext.size());
+        chars actual(plaintext.size());
+        libsodium.xor_ic(stream_cipher_id::xchacha20,
+                         reinterpret_cast<unsigned char*>(expected.data()),
+                         m,
+                         plaintext.size(),
+                         nonce.data(),
+                         ic,
+                         key.data());
+        BOOST_CHECK_EQUAL(
+          parallel.xor_ic(stream_cipher_id::xchacha20,
+                          reinterpret_cast<unsigned char*>(actual.data()),
+                          m,
+                          plaintext.size(),
+                          nonce.data(),
+                          ic,
+                          key.data()),
+          0);
+        BOOST_CHECK(actual == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_parallel_stream_xor_backend_same_output)
+{
+    sodium::thread_pool pool(4);
+    auto backend =
+      std::make_shared<sodium::parallel_stream_xor_backend>(pool, 0, 4096);
+
+    check_same_output<sodium::xchacha20_filter>(backend, 50000);
+    check_same_output<sodium::chacha20_filter>(backend, 50000);
+    check_same_output<sodium::salsa20_filter>(backend, 50000);
+    check_same_output<sodium::xsalsa20_filter>(backend, 50000);
+
+    check_same_output<sodium::buffered_xchacha20_filter>(backend, 1 << 16);
+    check_same_output<sodium::buffered_chacha20_filter>(backend, 1 << 16);
+    check_same_output<sodium::buffered_salsa20_filter>(backend, 1 << 16);
+    check_same_output<sodium::buffered_xsalsa20_filter>(backend, 1 << 16);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_parallel_stream_xor_backend_in_pool)
+{
+    // all workers busy with filters on the same pool: no deadlock
+    sodium::thread_pool pool(2);
+    auto backend =
+      std::make_shared<sodium::parallel_stream_xor_backend>(pool, 0, 4096);
+
+    std::vector<std::future<bool>> results;
+    for (int i = 0; i != 4; ++i)
+        results.push_back(pool.submit([backend] {
+            return same_output<sodium::buffered_xchacha20_filter>(backend,
+                                                                  1 << 16);
+        }));
+    for (auto& result : results)
+        BOOST_CHECK(result.get());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,260 @@
+// test_streambuf_io.cpp -- Test the streambuf and file descriptor fast paths
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::streambuf_io Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "common.h"
+#include "filecryptor_aead.h"
+#include "keypairsign.h"
+#include "keyvar.h"
+#include "random.h"
+#include "streambuf_io.h"
+#include "streamcryptor_aead.h"
+#include "streamhash.h"
+#include "streamsignorpk.h"
+#include "streamverifierpk.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sodium.h>
+
+using sodium::byte;
+using sodium::bytes;
+using sodium::raw_fd;
+
+namespace fs = std::filesystem;
+
+constexpr std::size_t BLOCKSIZE = 64;
+
+std::string
+slurp(const fs::path& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(ifs), {});
+}
+
+void
+spit(const fs::path& path, const std::string& data)
+{
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs.write(data.data(), data.size());
+}
+
+// a file descriptor, closed at the end of the scope
+struct scoped_fd
+{
+    scoped_fd(const fs::path& path, int flags)
+      : fd{ ::open(path.c_str(), flags, 0600) }
+    {
+        BOOST_REQUIRE(fd != -1);
+    }
+    ~scoped_fd() { ::close(fd); }
+
+    int fd;
+};
+
+struct SodiumFixture
+{
+    SodiumFixture()
+      : dir{ fs::temp_directory_path() /
+             ("test_streambuf_io." + std::to_string(randombytes_random())) }
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        fs::create_directory(dir);
+    }
+    ~SodiumFixture() { fs::remove_all(dir); }
+
+    fs::path dir;
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_streambuf_reader_get_area)
+{
+    std::stringbuf sb(std::string(100, 'x'));
+    sodium::streambuf_reader in{ &sb };
+    bytes buffer(BLOCKSIZE);
+
+    // the whole block is in the get area of a stringbuf: no copy
+    sodium::span<const byte> block = in.next_block(BLOCKSIZE, buffer);
+    BOOST_CHECK_EQUAL(block.size(), BLOCKSIZE);
+    BOOST_CHECK(block.data() != buffer.data());
+    BOOST_CHECK_EQUAL(block[0], 'x');
+
+    // the rest, and then the end of the data
+    block = in.next_block(BLOCKSIZE, buffer);
+    BOOST_CHECK_EQUAL(block.size(), 100 - BLOCKSIZE);
+    BOOST_CHECK(in.next_block(BLOCKSIZE, buffer).empty());
+
+    BOOST_CHECK_THROW(sodium::streambuf_reader{ nullptr }, std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streambuf_io_hash)
+{
+    sodium::StreamHash::key_type key(sodium::StreamHash::KEYSIZE);
+    sodium::StreamHash hasher{ key, sodium::StreamHash::HASHSIZE, BLOCKSIZE };
+
+    for (std::size_t size : { 0UL, 1UL, 63UL, 64UL, 65UL, 10000UL }) {
+        std::string plaintext(size, '\0');
+        sodium::randombytes_buf_inplace(plaintext);
+        spit(dir / "plain", plaintext);
+
+        std::istringstream istr(plaintext);
+        bytes expected = hasher.hash(istr);
+
+        std::stringbuf sb(plaintext);
+        BOOST_CHECK(hasher.hash(&sb) == expected);
+
+        std::filebuf fb;
+        fb.open(dir / "plain", std::ios::in | std::ios::binary);
+        BOOST_CHECK(hasher.hash(&fb) == expected);
+
+        scoped_fd fd(dir / "plain", O_RDONLY);
+        BOOST_CHECK(hasher.hash(raw_fd{ fd.fd }) == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streambuf_io_sign)
+{
+    sodium::keypairsign<> keypair;
+    sodium::StreamSignorPK signor(keypair.private_key(), BLOCKSIZE);
+    sodium::StreamVerifierPK verifier(keypair.public_key(), BLOCKSIZE);
+
+    std::string plaintext(1000, '\0');
+    sodium::randombytes_buf_inplace(plaintext);
+    spit(dir / "plain", plaintext);
+
+    std::stringbuf sb(plaintext);
+    bytes signature = signor.sign(&sb);
+    std::istringstream istr(plaintext);
+    BOOST_CHECK(verifier.verify(istr, signature));
+
+    scoped_fd fd(dir / "plain", O_RDONLY);
+    signature = signor.sign(raw_fd{ fd.fd });
+    std::istringstream istr2(plaintext);
+    BOOST_CHECK(verifier.verify(istr2, signature));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streambuf_io_streamcryptor_aead)
+{
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+
+    for (std::size_t size : { 0UL, 1UL, 63UL, 64UL, 65UL, 10000UL }) {
+        std::string plaintext(size, '\0');
+        sodium::randombytes_buf_inplace(plaintext);
+
+        std::istringstream istr(plaintext);
+        std::ostringstream ostr;
+        sc.encrypt(istr, ostr);
+
+        std::stringbuf in(plaintext);
+        std::stringbuf out;
+        sc.encrypt(&in, &out);
+        BOOST_CHECK(out.str() == ostr.str());
+
+        std::stringbuf cin(out.str());
+        std::stringbuf decrypted;
+        sc.decrypt(&cin, &decrypted);
+        BOOST_CHECK(decrypted.str() == plaintext);
+
+        // through file descriptors
+        spit(dir / "plain", plaintext);
+        {
+            scoped_fd fin(dir / "plain", O_RDONLY);
+            scoped_fd fout(dir / "cipher", O_WRONLY | O_CREAT | O_TRUNC);
+            sc.encrypt(raw_fd{ fin.fd }, raw_fd{ fout.fd });
+        }
+        BOOST_CHECK(slurp(dir / "cipher") == ostr.str());
+        {
+            scoped_fd fin(dir / "cipher", O_RDONLY);
+            scoped_fd fout(dir / "decrypted", O_WRONLY | O_CREAT | O_TRUNC);
+            sc.decrypt(raw_fd{ fin.fd }, raw_fd{ fout.fd });
+        }
+        BOOST_CHECK(slurp(dir / "decrypted") == plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streambuf_io_streamcryptor_aead_falsified)
+{
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+
+    std::string plaintext(1000, 'A');
+    std::stringbuf in(plaintext);
+    std::stringbuf out;
+    sc.encrypt(&in, &out);
+
+    std::string falsified = out.str();
+    ++falsified[falsified.size() / 2];
+    std::stringbuf fin(falsified);
+    std::stringbuf decrypted;
+    BOOST_CHECK_THROW(sc.decrypt(&fin, &decrypted), std::runtime_error);
+
+    // a final chunk too short for its MAC
+    std::string truncated = out.str();
+    truncated.resize(
+      truncated.size() - (plaintext.size() % BLOCKSIZE) - 1);
+    std::stringbuf tin(truncated);
+    BOOST_CHECK_THROW(sc.decrypt(&tin, &decrypted), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streambuf_io_filecryptor_aead)
+{
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type nonce;
+    sodium::keyvar<> hashkey(sodium::filecryptor_aead<>::HASHKEYSIZE);
+    sodium::filecryptor_aead<> fc(
+      key, nonce, BLOCKSIZE, hashkey, sodium::filecryptor_aead<>::HASHSIZE);
+
+    for (std::size_t size : { 0UL, 1UL, 64UL, 10000UL }) {
+        std::string plaintext(size, '\0');
+        sodium::randombytes_buf_inplace(plaintext);
+
+        std::istringstream istr(plaintext);
+        std::ostringstream ostr;
+        fc.encrypt(istr, ostr);
+
+        std::stringbuf in(plaintext);
+        std::stringbuf out;
+        fc.encrypt(&in, &out);
+        BOOST_CHECK(out.str() == ostr.str());
+
+        // decrypt() of the file API accepts it
+        spit(dir / "cipher", out.str());
+        std::ifstream ifs(dir / "cipher", std::ios::binary);
+        std::ostringstream decrypted;
+        fc.decrypt(ifs, decrypted);
+        BOOST_CHECK(decrypted.str() == plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,429 @@
+// test_streamcryptor_aead.cpp -- Test sodium::streamcryptor_aead
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::streamcryptor_aead Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "io_pipeline.h"
+#include "random.h"
+#include "streamcryptor_aead.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <sodium.h>
+
+using sodium::io_pipeline;
+using sodium::streamcryptor_aead;
+using sodium::thread_pool;
+
+using key_type = sodium::aead<>::key_type;
+using nonce_type = sodium::aead<>::nonce_type;
+
+constexpr std::size_t BLOCKSIZE = 1000;
+
+std::string
+random_string(std::size_t size)
+{
+    std::string result(size, '\0');
+    sodium::randombytes_buf_inplace(result);
+    return result;
+}
+
+std::string
+encrypt_serial(streamcryptor_aead<>& sc, const std::string& plaintext)
+{
+    std::istringstream istr(plaintext);
+    std::ostringstream ostr;
+    sc.encrypt(istr, ostr);
+    return ostr.str();
+}
+
+std::string
+encrypt_parallel(streamcryptor_aead<>& sc,
+                 const std::string& plaintext,
+                 thread_pool& pool,
+                 std::size_t window = 0)
+{
+    std::istringstream istr(plaintext);
+    std::ostringstream ostr;
+    sc.encrypt(istr, ostr, pool, window);
+    return ostr.str();
+}
+
+std::string
+decrypt_parallel(streamcryptor_aead<>& sc,
+                 const std::string& ciphertext,
+                 thread_pool& pool,
+                 std::size_t window = 0)
+{
+    std::istringstream istr(ciphertext);
+    std::ostringstream ostr;
+    sc.decrypt(istr, ostr, pool, window);
+    return ostr.str();
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool_submit)
+{
+    thread_pool pool(3);
+    BOOST_CHECK_EQUAL(pool.size(), 3UL);
+
+    std::vector<std::future<int>> results;
+    for (int i = 0; i != 100; ++i)
+        results.push_back(pool.submit([i] { return i * i; }));
+    for (int i = 0; i != 100; ++i)
+        BOOST_CHECK_EQUAL(results[i].get(), i * i);
+
+    auto failing =
+      pool.submit([]() -> int { throw std::runtime_error{ "boom" }; });
+    BOOST_CHECK_THROW(failing.get(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_aead_parallel_matches_serial)
+{
+    key_type key;
+    nonce_type nonce;
+    streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+    thread_pool pool(4);
+
+    // empty, partial, exact, multiple windows, and a trailing partial block
+    for (std::size_t size :
+         { 0UL, 1UL, 999UL, 1000UL, 1001UL, 16000UL, 57123UL }) {
+        std::string plaintext = random_string(size);
+        std::string ciphertext = encrypt_serial(sc, plaintext);
+
+        BOOST_CHECK(encrypt_parallel(sc, plaintext, pool) == ciphertext);
+        BOOST_CHECK(encrypt_parallel(sc, plaintext, pool, 3) == ciphertext);
+        BOOST_CHECK(decrypt_parallel(sc, ciphertext, pool) == plaintext);
+        BOOST_CHECK(decrypt_parallel(sc, ciphertext, pool, 5) == plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_aead_parallel_falsified)
+{
+    key_type key;
+    nonce_type nonce;
+    streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+    thread_pool pool(2);
+
+    std::string plaintext = random_string(10 * BLOCKSIZE);
+    std::string ciphertext = encrypt_serial(sc, plaintext);
+
+    // falsify the 4th block
+    const std::size_t chunk = streamcryptor_aead<>::MACSIZE + BLOCKSIZE;
+    ++ciphertext[3 * chunk + 10];
+
+    std::istringstream istr(ciphertext);
+    std::ostringstream ostr;
+    BOOST_CHECK_THROW(sc.decrypt(istr, ostr, pool, 8), std::runtime_error);
+
+    // the first 3 blocks have been written before failing
+    BOOST_CHECK(ostr.str() == plaintext.substr(0, 3 * BLOCKSIZE));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_aead_decrypt_block)
+{
+    key_type key;
+    nonce_type nonce;
+    streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+
+    std::string plaintext = random_string(7 * BLOCKSIZE + 123);
+    std::istringstream istr(encrypt_serial(sc, plaintext));
+
+    // in any order, including the final partial block
+    for (std::uint64_t k : { 5, 0, 7, 3, 6 }) {
+        sodium::bytes block = sc.decrypt_block(istr, k);
+        BOOST_CHECK(std::string(block.cbegin(), block.cend()) ==
+                    plaintext.substr(k * BLOCKSIZE, BLOCKSIZE));
+    }
+
+    BOOST_CHECK_THROW(sc.decrypt_block(istr, 8), std::runtime_error);
+
+    // a block decrypted with the nonce of another block fails
+    std::string ciphertext = istr.str();
+    const std::size_t chunk = streamcryptor_aead<>::MACSIZE + BLOCKSIZE;
+    sodium::bytes block2(ciphertext.cbegin() + 2 * chunk,
+                         ciphertext.cbegin() + 3 * chunk);
+    BOOST_CHECK_NO_THROW(sc.decrypt_block(block2, 2));
+    BOOST_CHECK_THROW(sc.decrypt_block(block2, 3), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_io_pipeline_run)
+{
+    io_pipeline pipeline(100, 200, 3);
+    BOOST_CHECK_EQUAL(pipeline.depth(), 3UL);
+
+    // duplicate every byte, across runs of the same pipeline
+    for (std::size_t size : { 0UL, 1UL, 100UL, 299UL, 300UL, 12345UL }) {
+        std::string input = random_string(size);
+        std::string expected;
+        for (char c : input)
+            expected += std::string(2, c);
+
+        std::istringstream istr(input);
+        std::ostringstream ostr;
+        pipeline.run(
+          istr, ostr, [](sodium::span<const sodium::byte> in,
+                         sodium::span<sodium::byte> out) {
+              BOOST_REQUIRE(in.size() <= 100 && out.size() == 200);
+              for (std::size_t i = 0; i != in.size(); ++i)
+                  out[2 * i] = out[2 * i + 1] = in[i];
+              return 2 * in.size();
+          });
+        BOOST_CHECK(ostr.str() == expected);
+    }
+
+    // a failing transform stops the pipeline, and its exception is rethrown
+    std::istringstream istr(random_string(10000));
+    std::ostringstream ostr;
+    int calls = 0;
+    BOOST_CHECK_THROW(pipeline.run(istr,
+                                   ostr,
+                                   [&calls](sodium::span<const sodium::byte>,
+                                            sodium::span<sodium::byte>) {
+                                       if (++calls == 5)
+                                           throw std::runtime_error{ "boom" };
+                                       return std::size_t(0);
+                                   }),
+                      std::runtime_error);
+    BOOST_CHECK_EQUAL(calls, 5);
+
+    BOOST_CHECK_THROW(io_pipeline(100, 200, 1), std::runtime_error);
+
+    // a read-only pipeline hands every chunk to consume(), in order
+    io_pipeline reader(100, 0, 2);
+    std::string input = random_string(12345);
+    std::string consumed;
+    std::istringstream istr2(input);
+    reader.run(istr2, [&consumed](sodium::span<const sodium::byte> in) {
+        BOOST_REQUIRE(in.size() <= 100);
+        consumed.append(reinterpret_cast<const char*>(in.data()), in.size());
+    });
+    BOOST_CHECK(consumed == input);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_aead_pipelined)
+{
+    key_type key;
+    nonce_type nonce;
+    streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+
+    for (std::size_t size :
+         { 0UL, 1UL, 999UL, 1000UL, 1001UL, 16000UL, 57123UL }) {
+        std::string plaintext = random_string(size);
+        std::string ciphertext = encrypt_serial(sc, plaintext);
+
+        for (std::size_t window : { 1UL, 3UL, 16UL }) {
+            std::istringstream istr(plaintext);
+            std::ostringstream ostr;
+            sc.encrypt_pipelined(istr, ostr, 2, window);
+            BOOST_CHECK(ostr.str() == ciphertext);
+
+            std::istringstream istr2(ciphertext);
+            std::ostringstream ostr2;
+            sc.decrypt_pipelined(istr2, ostr2, 4, window);
+            BOOST_CHECK(ostr2.str() == plaintext);
+        }
+    }
+
+    // a falsified block
+    std::string ciphertext = encrypt_serial(sc, random_string(10 * BLOCKSIZE));
+    ++ciphertext[3 * (streamcryptor_aead<>::MACSIZE + BLOCKSIZE) + 10];
+    std::istringstream istr(ciphertext);
+    std::ostringstream ostr;
+    BOOST_CHECK_THROW(sc.decrypt_pipelined(istr, ostr, 3, 2),
+                      std::runtime_error);
+}
+
+std::string
+encrypt_framed(streamcryptor_aead<>& sc,
+               const std::string& plaintext,
+               std::size_t superblock)
+{
+    std::istringstream istr(plaintext);
+    std::ostringstream ostr;
+    sc.encrypt_framed(istr, ostr, superblock);
+    return ostr.str();
+}
+
+std::string
+decrypt_framed(streamcryptor_aead<>& sc, const std::string& ciphertext)
+{
+    std::istringstream istr(ciphertext);
+    std::ostringstream ostr;
+    sc.decrypt_framed(istr, ostr);
+    return ostr.str();
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_aead_framed)
+{
+    key_type key;
+    nonce_type nonce;
+    streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+    constexpr std::size_t MACSIZE = streamcryptor_aead<>::MACSIZE;
+
+    for (std::size_t superblock : { 1, 4 })
+        for (std::size_t size :
+             { 0, 1, 999, 1000, 1001, 4000, 4001, 10 * 1000 + 17 }) {
+            const std::string plaintext = random_string(size);
+            const std::string ciphertext =
+              encrypt_framed(sc, plaintext, superblock);
+
+            // one header, one MAC per frame, the empty message included
+            const std::size_t framesize = BLOCKSIZE * superblock;
+            const std::size_t nframes =
+              size == 0 ? 1 : (size + framesize - 1) / framesize;
+            BOOST_CHECK_EQUAL(ciphertext.size(),
+                              streamcryptor_aead<>::FRAMED_HEADERSIZE +
+                                nframes * MACSIZE + size);
+
+            // another nonce and blocksize: taken from the header
+            streamcryptor_aead<> other(key, nonce_type(), 17);
+            BOOST_CHECK(decrypt_framed(other, ciphertext) == plaintext);
+        }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_aead_framed_falsified)
+{
+    key_type key;
+    nonce_type nonce;
+    streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+    constexpr std::size_t HEADERSIZE = streamcryptor_aead<>::FRAMED_HEADERSIZE;
+    constexpr std::size_t CHUNKSIZE = BLOCKSIZE + streamcryptor_aead<>::MACSIZE;
+
+    const std::string plaintext = random_string(5 * BLOCKSIZE + 10);
+    const std::string ciphertext = encrypt_framed(sc, plaintext, 1);
+
+    // truncated at a frame boundary, or extended by a frame
+    BOOST_CHECK_THROW(
+      decrypt_framed(sc, ciphertext.substr(0, HEADERSIZE + 2 * CHUNKSIZE)),
+      std::runtime_error);
+    BOOST_CHECK_THROW(decrypt_framed(sc, ciphertext.substr(0, HEADERSIZE)),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(
+      decrypt_framed(sc,
+                     ciphertext + ciphertext.substr(HEADERSIZE, CHUNKSIZE)),
+      std::runtime_error);
+
+    // frame swapped, frame corrupted
+    std::string swapped = ciphertext;
+    swapped.replace(HEADERSIZE,
+                    CHUNKSIZE,
+                    ciphertext.substr(HEADERSIZE + CHUNKSIZE, CHUNKSIZE));
+    BOOST_CHECK_THROW(decrypt_framed(sc, swapped), std::runtime_error);
+    std::string corrupted = ciphertext;
+    corrupted[HEADERSIZE + 3 * CHUNKSIZE + 5] ^= 0x01;
+    BOOST_CHECK_THROW(decrypt_framed(sc, corrupted), std::runtime_error);
+
+    // header: version, algorithm, blocksize and nonce
+    for (std::size_t offset : { 4, 5, 8, 12, 20 }) {
+        std::string header_corrupted = ciphertext;
+        header_corrupted[offset] ^= 0x01;
+        BOOST_CHECK_THROW(decrypt_framed(sc, header_corrupted),
+                          std::runtime_error);
+    }
+
+    // wrong key, and not a framed stream
+    streamcryptor_aead<> other(key_type(), nonce, BLOCKSIZE);
+    BOOST_CHECK_THROW(decrypt_framed(other, ciphertext), std::runtime_error);
+    BOOST_CHECK_THROW(decrypt_framed(sc, encrypt_serial(sc, plaintext)),
+                      std::runtime_error);
+
+    BOOST_CHECK_THROW(encrypt_framed(sc, plaintext, 0), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_aead_framed_max_framesize)
+{
+    key_type key;
+    nonce_type nonce;
+    streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+    BOOST_CHECK_EQUAL(sc.max_framesize(),
+                      streamcryptor_aead<>::DECRYPT_FRAMESIZE_MAX);
+    const std::string plaintext = random_string(10 * BLOCKSIZE + 3);
+    const std::string ciphertext = encrypt_framed(sc, plaintext, 4);
+
+    // frames larger than max_framesize: refused before decrypting
+    streamcryptor_aead<> small(key, nonce, 64, 2 * BLOCKSIZE);
+    BOOST_CHECK_EQUAL(small.max_framesize(), 2 * BLOCKSIZE);
+    BOOST_CHECK_THROW(decrypt_framed(small, ciphertext), std::runtime_error);
+
+    streamcryptor_aead<> large(key, nonce, 64, 4 * BLOCKSIZE);
+    BOOST_CHECK(decrypt_framed(large, ciphertext) == plaintext);
+
+    // a forged, huge superblock doesn't size the buffers
+    std::string forged = ciphertext;
+    forged[12] = forged[13] = forged[14] = '\0';
+    forged[15] = '\x01'; // 2^24 blocks: about 16 GiB
+    BOOST_CHECK_THROW(decrypt_framed(sc, forged), std::runtime_error);
+    forged = ciphertext;
+    forged[12] = '\x00';
+    forged[13] = '\x00';
+    forged[14] = '\x01'; // 2^16 blocks: about 64 MiB, below 1 GiB
+    forged[15] = '\x00';
+    BOOST_CHECK_THROW(decrypt_framed(sc, forged), std::runtime_error);
+
+    // an object always decrypts its own blocksize
+    streamcryptor_aead<> own(key, nonce, BLOCKSIZE, 1);
+    BOOST_CHECK_EQUAL(own.max_framesize(), BLOCKSIZE);
+    BOOST_CHECK(decrypt_framed(own, encrypt_framed(sc, plaintext, 1)) ==
+                plaintext);
+
+    BOOST_CHECK_THROW(streamcryptor_aead<>(key, nonce, BLOCKSIZE, 0),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_aead_decrypt_auto)
+{
+    key_type key;
+    nonce_type nonce;
+    streamcryptor_aead<> sc(key, nonce, BLOCKSIZE);
+
+    for (std::size_t size : { 0, 1, 3, 4, 5, 1000, 2 * 1000 + 7 }) {
+        const std::string plaintext = random_string(size);
+        for (const std::string& ciphertext :
+             { encrypt_framed(sc, plaintext, 2),
+               encrypt_serial(sc, plaintext) }) {
+            std::istringstream istr(ciphertext);
+            std::ostringstream ostr;
+            sc.decrypt_auto(istr, ostr);
+            BOOST_CHECK(ostr.str() == plaintext);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,274 @@
+// test_streamcryptor_secretstream.cpp -- Test streamcryptor_secretstream
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::streamcryptor_secretstream Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "random.h"
+#include "secretstream.h"
+#include "streamcryptor_secretstream.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <sodium.h>
+
+using sodium::streamcryptor_secretstream;
+
+using key_type = streamcryptor_secretstream<>::key_type;
+using tag_type = streamcryptor_secretstream<>::tag_type;
+
+constexpr std::size_t CHUNKSIZE = 1000;
+constexpr std::size_t CHUNKS_PER_READ = 4;
+constexpr std::size_t REKEY_INTERVAL = 3;
+constexpr std::size_t MACSIZE = streamcryptor_secretstream<>::MACSIZE;
+constexpr std::size_t HEADERSIZE = streamcryptor_secretstream<>::HEADERSIZE;
+
+std::string
+random_string(std::size_t size)
+{
+    std::string result(size, '\0');
+    sodium::randombytes_buf_inplace(result);
+    return result;
+}
+
+std::string
+encrypt(const streamcryptor_secretstream<>& sc, const std::string& plaintext)
+{
+    std::istringstream istr(plaintext);
+    std::ostringstream ostr;
+    sc.encrypt(istr, ostr);
+    return ostr.str();
+}
+
+std::string
+decrypt(const streamcryptor_secretstream<>& sc, const std::string& ciphertext)
+{
+    std::istringstream istr(ciphertext);
+    std::ostringstream ostr;
+    sc.decrypt(istr, ostr);
+    return ostr.str();
+}
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_secretstream_roundtrip)
+{
+    key_type key;
+    streamcryptor_secretstream<> sc(
+      key, CHUNKSIZE, CHUNKS_PER_READ, REKEY_INTERVAL);
+
+    // around chunk and read buffer boundaries, and the empty message
+    for (std::size_t size :
+         { 0UL, 1UL, 999UL, 1000UL, 1001UL, 3999UL, 4000UL, 4001UL, 12345UL }) {
+        const std::string plaintext = random_string(size);
+        const std::string ciphertext = encrypt(sc, plaintext);
+
+        const std::size_t chunks =
+          std::max<std::size_t>(1, (size + CHUNKSIZE - 1) / CHUNKSIZE);
+        BOOST_CHECK_EQUAL(ciphertext.size(),
+                          HEADERSIZE + size + chunks * MACSIZE);
+        BOOST_CHECK(decrypt(sc, ciphertext) == plaintext);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_secretstream_fresh_header)
+{
+    key_type key;
+    streamcryptor_secretstream<> sc(key, CHUNKSIZE);
+
+    const std::string plaintext = random_string(2500);
+    BOOST_CHECK(encrypt(sc, plaintext) != encrypt(sc, plaintext));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_secretstream_read_size)
+{
+    // decrypt() reads the chunksize from the stream, and may read
+    // a different number of chunks at a time than encrypt()
+    key_type key;
+    streamcryptor_secretstream<> enc(key, CHUNKSIZE, CHUNKS_PER_READ);
+    streamcryptor_secretstream<> dec(key, 64, 1);
+
+    const std::string plaintext = random_string(9876);
+    BOOST_CHECK(decrypt(dec, encrypt(enc, plaintext)) == plaintext);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_secretstream_tags)
+{
+    key_type key;
+    streamcryptor_secretstream<> sc(
+      key, CHUNKSIZE, CHUNKS_PER_READ, REKEY_INTERVAL);
+
+    const std::string plaintext = random_string(9 * CHUNKSIZE + 10);
+    const std::string ciphertext = encrypt(sc, plaintext);
+
+    // decrypt chunk by chunk with the lower-level secretstream API
+    sodium::secretstream<> stream{ sc.key_handle() };
+    stream.init_pull(sodium::bytes(ciphertext.begin() + 12,
+                                   ciphertext.begin() + HEADERSIZE));
+    const std::string prefix = ciphertext.substr(0, 12);
+
+    // chunk 0..9: rekey every 3rd, push at the end of each read of 4,
+    // final at the end
+    const tag_type expected[] = {
+        tag_type::TAG_MESSAGE, tag_type::TAG_MESSAGE, tag_type::TAG_REKEY,
+        tag_type::TAG_PUSH,    tag_type::TAG_MESSAGE, tag_type::TAG_REKEY,
+        tag_type::TAG_MESSAGE, tag_type::TAG_PUSH,    tag_type::TAG_REKEY,
+        tag_type::TAG_FINAL
+    };
+
+    std::size_t offset = HEADERSIZE;
+    for (std::size_t i = 0; i != 10; ++i) {
+        const std::size_t s =
+          std::min(CHUNKSIZE + MACSIZE, ciphertext.size() - offset);
+        const std::string chunk = ciphertext.substr(offset, s);
+        std::string decrypted(s - MACSIZE, '\0');
+        tag_type tag;
+        BOOST_REQUIRE_EQUAL(
+          stream.pull(
+            decrypted, tag, chunk, i == 0 ? prefix : std::string()),
+          0);
+        BOOST_CHECK(tag == expected[i]);
+        BOOST_CHECK(decrypted == plaintext.substr(i * CHUNKSIZE, s - MACSIZE));
+        offset += s;
+    }
+    BOOST_CHECK_EQUAL(offset, ciphertext.size());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_secretstream_truncated)
+{
+    key_type key;
+    streamcryptor_secretstream<> sc(key, CHUNKSIZE, CHUNKS_PER_READ);
+
+    const std::string ciphertext = encrypt(sc, random_string(3 * CHUNKSIZE));
+
+    // cut at a chunk boundary: all remaining chunks verify, but the
+    // final one is missing
+    for (std::size_t chunks = 0; chunks != 3; ++chunks) {
+        const std::string truncated =
+          ciphertext.substr(0, HEADERSIZE + chunks * (CHUNKSIZE + MACSIZE));
+        BOOST_CHECK_THROW(decrypt(sc, truncated), std::runtime_error);
+    }
+
+    // cut within a chunk, or within the header
+    BOOST_CHECK_THROW(decrypt(sc, ciphertext.substr(0, ciphertext.size() - 1)),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(decrypt(sc, ciphertext.substr(0, HEADERSIZE - 1)),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(decrypt(sc, std::string()), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_secretstream_extended)
+{
+    key_type key;
+    streamcryptor_secretstream<> sc(key, CHUNKSIZE, CHUNKS_PER_READ);
+
+    const std::string ciphertext = encrypt(sc, random_string(2 * CHUNKSIZE));
+
+    // garbage after the final chunk, in the same read buffer or not
+    BOOST_CHECK_THROW(decrypt(sc, ciphertext + "x"), std::runtime_error);
+    BOOST_CHECK_THROW(
+      decrypt(sc, ciphertext + std::string(4 * (CHUNKSIZE + MACSIZE), 'x')),
+      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_secretstream_tampered)
+{
+    key_type key;
+    streamcryptor_secretstream<> sc(key, CHUNKSIZE, CHUNKS_PER_READ);
+
+    const std::string ciphertext = encrypt(sc, random_string(5000));
+
+    // every byte of the header and of the chunks is authenticated,
+    // except the chunksize, which is checked by the chunk boundaries
+    const std::size_t positions[] = {
+        0, 4, 5, 12, HEADERSIZE, HEADERSIZE + 1500, ciphertext.size() - 1
+    };
+    for (std::size_t pos : positions) {
+        std::string tampered = ciphertext;
+        tampered[pos] ^= 0x01;
+        BOOST_CHECK_THROW(decrypt(sc, tampered), std::runtime_error);
+    }
+
+    std::string tampered = ciphertext;
+    tampered[8] ^= 0x01; // chunksize
+    BOOST_CHECK_THROW(decrypt(sc, tampered), std::runtime_error);
+
+    // wrong key
+    key_type other_key;
+    streamcryptor_secretstream<> other(other_key, CHUNKSIZE);
+    BOOST_CHECK_THROW(decrypt(other, ciphertext), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_secretstream_max_chunksize)
+{
+    key_type key;
+    streamcryptor_secretstream<> enc(key, CHUNKSIZE, CHUNKS_PER_READ);
+    const std::string plaintext = random_string(5000);
+    const std::string ciphertext = encrypt(enc, plaintext);
+
+    // below the stream's chunksize: refused before decrypting anything
+    streamcryptor_secretstream<> small(key, 64, 1, REKEY_INTERVAL, 512);
+    BOOST_CHECK_EQUAL(small.max_chunksize(), 512);
+    BOOST_CHECK_THROW(decrypt(small, ciphertext), std::runtime_error);
+
+    streamcryptor_secretstream<> large(key, 64, 1, REKEY_INTERVAL, CHUNKSIZE);
+    BOOST_CHECK(decrypt(large, ciphertext) == plaintext);
+
+    // a forged, huge chunksize doesn't size the buffers
+    std::string forged = ciphertext;
+    forged[8] = forged[9] = forged[10] = '\0';
+    forged[11] = '\x40'; // 1 GiB
+    BOOST_CHECK_THROW(decrypt(enc, forged), std::runtime_error);
+
+    // an object always decrypts its own chunksize
+    streamcryptor_secretstream<> own(key, CHUNKSIZE, 1, REKEY_INTERVAL, 1);
+    BOOST_CHECK_EQUAL(own.max_chunksize(), CHUNKSIZE);
+    BOOST_CHECK(decrypt(own, ciphertext) == plaintext);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_streamcryptor_secretstream_wrong_params)
+{
+    key_type key;
+    BOOST_CHECK_THROW(streamcryptor_secretstream<>(key, 0), std::runtime_error);
+    BOOST_CHECK_THROW(streamcryptor_secretstream<>(key, CHUNKSIZE, 0),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(
+      streamcryptor_secretstream<>(key, CHUNKSIZE, 1, REKEY_INTERVAL, 0),
+      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,194 @@
+// test_thread_pool.cpp -- Test sodium::thread_pool
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::thread_pool Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using sodium::thread_pool;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+        sodium::set_default_thread_pool(nullptr);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool_size)
+{
+    BOOST_CHECK(sodium::default_concurrency() >= 1);
+
+    thread_pool pool;
+    BOOST_CHECK_EQUAL(pool.size(), sodium::default_concurrency());
+
+    thread_pool three(3);
+    BOOST_CHECK_EQUAL(three.size(), 3UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool_all_tasks_run)
+{
+    std::atomic<int> count{ 0 };
+    {
+        thread_pool pool(4);
+        for (int i = 0; i != 1000; ++i)
+            pool.submit([&count] { ++count; });
+    } // the destructor finishes all pending tasks
+    BOOST_CHECK_EQUAL(count, 1000);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool_nested_submit)
+{
+    // tasks submitted by a worker go to its own deque, and are
+    // stolen by the idle workers
+    thread_pool pool(4);
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+
+    auto outer = pool.submit([&] {
+        std::vector<std::future<void>> inner;
+        for (int i = 0; i != 64; ++i)
+            inner.push_back(pool.submit([&] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                std::lock_guard<std::mutex> lock(mutex);
+                threads.insert(std::this_thread::get_id());
+            }));
+        return inner;
+    });
+
+    for (auto& f : outer.get())
+        f.get();
+    BOOST_CHECK(threads.size() > 1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool_exceptions)
+{
+    thread_pool pool(2);
+    auto failing =
+      pool.submit([]() -> int { throw std::runtime_error{ "boom" }; });
+    BOOST_CHECK_THROW(failing.get(), std::runtime_error);
+    BOOST_CHECK_EQUAL(pool.submit([] { return 42; }).get(), 42);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool_nested_wait)
+{
+    // tasks waiting on tasks, deeper than there are workers: the
+    // waiting workers run the pending tasks instead of blocking
+    thread_pool pool(2);
+
+    std::function<int(int)> fib = [&](int n) {
+        if (n < 2)
+            return n;
+        auto a = pool.submit([&fib, n] { return fib(n - 1); });
+        auto b = pool.submit([&fib, n] { return fib(n - 2); });
+        return pool.get(a) + pool.get(b);
+    };
+    auto result = pool.submit([&fib] { return fib(12); });
+    BOOST_CHECK_EQUAL(pool.get(result), 144);
+
+    // exceptions still come through get()
+    auto outer = pool.submit([&pool] {
+        auto inner =
+          pool.submit([]() -> int { throw std::runtime_error{ "inner" }; });
+        return pool.get(inner);
+    });
+    BOOST_CHECK_THROW(pool.get(outer), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool_pinned)
+{
+    sodium::thread_pool_options options;
+    options.threads = 2;
+    options.pin = true;
+    thread_pool pool(options);
+
+    BOOST_CHECK_EQUAL(pool.size(), 2UL);
+    BOOST_CHECK_EQUAL(pool.submit([] { return 7; }).get(), 7);
+
+    options.cpus = { 0 };
+    thread_pool on_cpu0(options);
+    BOOST_CHECK_EQUAL(on_cpu0.submit([] { return 8; }).get(), 8);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool_executor)
+{
+    // the application's executor: here, one thread of its own
+    std::mutex mutex;
+    std::vector<std::function<void()>> posted;
+    thread_pool pool(
+      [&](std::function<void()> task) {
+          std::lock_guard<std::mutex> lock(mutex);
+          posted.push_back(std::move(task));
+      },
+      5);
+    BOOST_CHECK_EQUAL(pool.size(), 5UL);
+
+    auto result = pool.submit([] { return 6 * 7; });
+    BOOST_CHECK_EQUAL(posted.size(), 1UL);
+    BOOST_CHECK(result.wait_for(std::chrono::seconds(0)) !=
+                std::future_status::ready);
+
+    std::thread app([&] { posted.front()(); });
+    app.join();
+    BOOST_CHECK_EQUAL(result.get(), 42);
+
+    BOOST_CHECK_THROW(thread_pool(thread_pool::executor_type(), 1),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool_default)
+{
+    auto pool = sodium::default_thread_pool();
+    BOOST_REQUIRE(pool);
+    BOOST_CHECK_EQUAL(sodium::default_thread_pool().get(), pool.get());
+    BOOST_CHECK_EQUAL(pool->submit([] { return 1; }).get(), 1);
+
+    auto mine = std::make_shared<thread_pool>(2);
+    sodium::set_default_thread_pool(mine);
+    BOOST_CHECK_EQUAL(sodium::default_thread_pool().get(), mine.get());
+
+    // an empty pool: a fresh default on next use
+    sodium::set_default_thread_pool(nullptr);
+    auto fresh = sodium::default_thread_pool();
+    BOOST_CHECK(fresh && fresh.get() != mine.get());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
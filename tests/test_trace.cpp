@@ -0,0 +1,148 @@
+// test_trace.cpp -- Test sodium::trace counters and policies
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// count the events of the wrappers, but don't log them
+#undef SODIUM_TRACE_LEVEL
+#define SODIUM_TRACE_LEVEL 1
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::trace Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "key.h"
+#include "trace.h"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+#include <sodium.h>
+
+namespace trace = sodium::trace;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        trace::reset_counters();
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+// a custom policy, as could be selected with SODIUM_TRACE_POLICY
+struct formatting_policy
+{
+    static constexpr bool enabled = true;
+
+    static std::string last;
+
+    template<typename Message>
+    static void event(trace::counter& c, const Message& message)
+    {
+        c.increment();
+        std::ostringstream os;
+        message(os);
+        last = os.str();
+    }
+};
+
+std::string formatting_policy::last;
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_trace_level)
+{
+    BOOST_CHECK((std::is_same<trace::policy, trace::counting_policy>::value));
+    BOOST_CHECK(!trace::null_policy::enabled);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_trace_counter_registry)
+{
+    static trace::counter c1{ "sodium_test_trace::a" };
+    static trace::counter c2{ "sodium_test_trace::a" };
+    static trace::counter c3{ "sodium_test_trace::b" };
+
+    c1.increment();
+    c2.increment();
+    c2.increment();
+    c3.increment();
+
+    BOOST_CHECK_EQUAL(c2.value(), 2UL);
+    BOOST_CHECK_EQUAL(trace::value("sodium_test_trace::a"), 3UL);
+    BOOST_CHECK_EQUAL(trace::value("sodium_test_trace::b"), 1UL);
+    BOOST_CHECK_EQUAL(trace::value("sodium_test_trace::none"), 0UL);
+
+    // all three counters are reachable from the registry
+    int seen = 0;
+    trace::for_each_counter([&seen](const char* name, std::uint64_t) {
+        if (std::string(name).rfind("sodium_test_trace::", 0) == 0)
+            ++seen;
+    });
+    BOOST_CHECK_EQUAL(seen, 3);
+
+    trace::reset_counters();
+    BOOST_CHECK_EQUAL(trace::value("sodium_test_trace::a"), 0UL);
+    BOOST_CHECK_EQUAL(trace::value("sodium_test_trace::b"), 0UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_trace_allocator_events)
+{
+    // the first key also allocates a buffer that lives until exit
+    sodium::key<32> warmup;
+    trace::reset_counters();
+
+    {
+        sodium::key<32> k1;
+        sodium::key<32> k2;
+        BOOST_CHECK(k1 != k2);
+    }
+
+    // each key allocates, and deallocates its protected bytes
+    BOOST_CHECK(trace::value("sodium::allocator::allocate()") >= 2);
+    BOOST_CHECK_EQUAL(trace::value("sodium::allocator::allocate()"),
+                      trace::value("sodium::allocator::deallocate()"));
+    BOOST_CHECK_EQUAL(trace::value("sodium::key::operator!=()"), 1UL);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_trace_custom_policy)
+{
+    static trace::counter c{ "sodium_test_trace::custom" };
+    int calls = 0;
+
+    // the message is formatted lazily, by the policy
+    formatting_policy::event(c, [&calls](std::ostream& os) {
+        ++calls;
+        os << "[num=" << 42 << ']';
+    });
+    BOOST_CHECK_EQUAL(calls, 1);
+    BOOST_CHECK_EQUAL(formatting_policy::last, "[num=42]");
+    BOOST_CHECK_EQUAL(c.value(), 1UL);
+
+    // the message isn't even looked at by the counting policy
+    trace::counting_policy::event(c, [&calls](std::ostream&) { ++calls; });
+    BOOST_CHECK_EQUAL(calls, 1);
+    BOOST_CHECK_EQUAL(c.value(), 2UL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
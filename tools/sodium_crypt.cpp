@@ -0,0 +1,475 @@
+// sodium_crypt.cpp -- Bulk encryption, hashing and signing of streams
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// sodium-crypt is a command-line front-end to the wrappers, to operate
+// and benchmark them on real hardware. It streams stdin to stdout:
+//
+//   sodium-crypt keygen  secret|sign FILE
+//   sodium-crypt encrypt --key FILE [options] < plain  > cipher
+//   sodium-crypt decrypt --key FILE [options] < cipher > plain
+//   sodium-crypt hash    [--key FILE] [--tree] [options] < data
+//   sodium-crypt sign    --key FILE [options] < data
+//   sodium-crypt verify  --key FILE.pub --signature HEX [options] < data
+//   sodium-crypt calibrate
+//
+// options:
+//   --block-size N   read and encrypt blocks of N bytes  (default 65536)
+//                    hash, sign, verify: auto = sodium::blocksize::tuned()
+//   --threads N      worker threads for encrypt/decrypt and --tree hash
+//                    (default 1, 0 = sodium::default_thread_pool())
+//   --stats          print throughput, CPU utilisation and allocation
+//                    counts to stderr
+//
+// encrypt writes a random nonce, followed by the blocks of
+// sodium::streamcryptor_aead. decrypt must use the same --block-size,
+// which is why encrypt/decrypt don't accept --block-size auto.
+// calibrate prints the throughput measured by
+// sodium::blocksize::calibrate() per block size, and the one it picks.
+// hash --tree computes the sodium::tree_hash, which is NOT the same as
+// the plain hash.
+
+#include "alloc_counter.h"
+#include "blocksize.h"
+#include "common.h"
+#include "helpers.h"
+#include "key.h"
+#include "keypairsign.h"
+#include "keyvar.h"
+#include "runtime.h"
+#include "streamcryptor_aead.h"
+#include "streamhash.h"
+#include "streamsignorpk.h"
+#include "streamverifierpk.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif // _WIN32
+
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+namespace {
+
+using aead_type = sodium::aead<>;
+using cryptor_type = sodium::streamcryptor_aead<>;
+
+// ---- command line ----------------------------------------------------
+
+struct options
+{
+    std::string command;
+    std::vector<std::string> args; // positional arguments
+    std::string key_file;
+    std::string signature;
+    std::size_t blocksize = 64 * 1024;
+    std::size_t threads = 1;
+    bool tree = false;
+    bool stats = false;
+};
+
+[[noreturn]] void
+usage()
+{
+    std::cerr
+      << "usage: sodium-crypt keygen secret|sign FILE\n"
+         "       sodium-crypt encrypt|decrypt --key FILE [options]\n"
+         "       sodium-crypt hash [--key FILE] [--tree] [options]\n"
+         "       sodium-crypt sign --key FILE [options]\n"
+         "       sodium-crypt verify --key FILE.pub --signature HEX "
+         "[options]\n"
+         "       sodium-crypt calibrate\n"
+         "options: --block-size N|auto  --threads N  --stats\n";
+    std::exit(2);
+}
+
+std::size_t
+to_size(const std::string& value)
+{
+    std::size_t pos = 0;
+    const unsigned long long result = std::stoull(value, &pos);
+    if (pos != value.size())
+        throw std::runtime_error{ "not a number: " + value };
+    return static_cast<std::size_t>(result);
+}
+
+options
+parse(int argc, char** argv)
+{
+    if (argc < 2)
+        usage();
+
+    options opts;
+    opts.command = argv[1];
+    for (int i = 2; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 == argc)
+                usage();
+            return argv[++i];
+        };
+
+        if (arg == "--key")
+            opts.key_file = value();
+        else if (arg == "--signature")
+            opts.signature = value();
+        else if (arg == "--block-size") {
+            const std::string size = value();
+            opts.blocksize =
+              size == "auto" ? sodium::blocksize::auto_tune : to_size(size);
+        }
+        else if (arg == "--threads")
+            opts.threads = to_size(value());
+        else if (arg == "--tree")
+            opts.tree = true;
+        else if (arg == "--stats")
+            opts.stats = true;
+        else if (arg.compare(0, 2, "--") == 0)
+            usage();
+        else
+            opts.args.push_back(arg);
+    }
+
+    if (opts.blocksize == 0)
+        throw std::runtime_error{ "--block-size must not be 0" };
+    if (opts.blocksize == sodium::blocksize::auto_tune &&
+        (opts.command == "encrypt" || opts.command == "decrypt"))
+        throw std::runtime_error{ "--block-size auto: encrypt and decrypt "
+                                  "need the same fixed block size" };
+    return opts;
+}
+
+// ---- I/O -------------------------------------------------------------
+
+// a pass-through stream buffer that counts the bytes going through it
+class counting_streambuf : public std::streambuf
+{
+  public:
+    explicit counting_streambuf(std::streambuf* source)
+      : source_{ source }
+      , buffer_(64 * 1024)
+    {}
+
+    std::uint64_t count() const { return count_; }
+
+  protected:
+    int_type underflow() override
+    {
+        const std::streamsize n =
+          source_->sgetn(buffer_.data(), buffer_.size());
+        if (n <= 0)
+            return traits_type::eof();
+        count_ += static_cast<std::uint64_t>(n);
+        setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+        return traits_type::to_int_type(buffer_[0]);
+    }
+
+  private:
+    std::streambuf* source_;
+    std::vector<char> buffer_;
+    std::uint64_t count_ = 0;
+};
+
+sodium::bytes
+read_file(const std::string& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+        throw std::runtime_error{ "can't open " + path };
+    return sodium::bytes(std::istreambuf_iterator<char>(ifs), {});
+}
+
+void
+write_file(const std::string& path, const sodium::byte* data, std::size_t size)
+{
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char*>(data),
+              static_cast<std::streamsize>(size));
+    if (!ofs)
+        throw std::runtime_error{ "can't write " + path };
+}
+
+// fill the (uninitialized) key with the contents of the file at path,
+// which must have exactly key.size() bytes, and make it readonly
+template<typename KEY>
+KEY
+read_key(const std::string& path, KEY key)
+{
+    if (path.empty())
+        throw std::runtime_error{ "missing --key" };
+
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+        throw std::runtime_error{ "can't open " + path };
+    ifs.read(reinterpret_cast<char*>(key.setdata()), key.size());
+    if (static_cast<std::size_t>(ifs.gcount()) != key.size() ||
+        ifs.peek() != std::ifstream::traits_type::eof())
+        throw std::runtime_error{ path + ": not a key of " +
+                                  std::to_string(key.size()) + " bytes" };
+
+    key.readonly();
+    return key;
+}
+
+std::shared_ptr<sodium::thread_pool>
+make_pool(const options& opts)
+{
+    if (opts.threads == 1)
+        return nullptr;
+    if (opts.threads == 0)
+        return sodium::default_thread_pool();
+    return std::make_shared<sodium::thread_pool>(opts.threads);
+}
+
+// ---- commands --------------------------------------------------------
+
+int
+keygen(const options& opts)
+{
+    if (opts.args.size() != 2)
+        usage();
+    const std::string& path = opts.args[1];
+
+    if (opts.args[0] == "secret") {
+        aead_type::key_type key;
+        write_file(path, key.data(), key.size());
+    } else if (opts.args[0] == "sign") {
+        sodium::keypairsign<> keypair;
+        write_file(path,
+                   keypair.private_key().data(),
+                   keypair.private_key().size());
+        const sodium::bytes pk = keypair.public_key();
+        write_file(path + ".pub", pk.data(), pk.size());
+    } else
+        usage();
+    return 0;
+}
+
+int
+encrypt(const options& opts, std::istream& in, std::ostream& out)
+{
+    // a fresh random nonce goes first: decrypt() reads it back
+    const aead_type::nonce_type nonce;
+    cryptor_type sc(read_key(opts.key_file, aead_type::key_type(false)),
+                    nonce,
+                    opts.blocksize);
+    out.write(reinterpret_cast<const char*>(nonce.data()), nonce.size());
+
+    auto pool = make_pool(opts);
+    if (pool)
+        sc.encrypt(in, out, *pool);
+    else
+        sc.encrypt(in, out);
+    return out ? 0 : 1;
+}
+
+int
+decrypt(const options& opts, std::istream& in, std::ostream& out)
+{
+    sodium::byte nonce_data[aead_type::NONCESIZE];
+    if (!in.read(reinterpret_cast<char*>(nonce_data), sizeof nonce_data))
+        throw std::runtime_error{ "input too short for a nonce" };
+
+    cryptor_type sc(read_key(opts.key_file, aead_type::key_type(false)),
+                    aead_type::nonce_type(nonce_data),
+                    opts.blocksize);
+
+    auto pool = make_pool(opts);
+    if (pool)
+        sc.decrypt(in, out, *pool);
+    else
+        sc.decrypt(in, out);
+    return out ? 0 : 1;
+}
+
+int
+hash(const options& opts, std::istream& in, std::ostream& out)
+{
+    using hasher = sodium::StreamHash;
+
+    std::unique_ptr<hasher> sh;
+    if (opts.key_file.empty())
+        sh = std::make_unique<hasher>(hasher::HASHSIZE, opts.blocksize);
+    else
+        sh = std::make_unique<hasher>(
+          read_key(opts.key_file, hasher::key_type(hasher::KEYSIZE, false)),
+          hasher::HASHSIZE,
+          opts.blocksize);
+
+    sodium::bytes result;
+    if (opts.tree) {
+        auto pool = make_pool(opts);
+        if (!pool)
+            pool = std::make_shared<sodium::thread_pool>(1);
+        result = sh->hash(in, *pool);
+    } else
+        result = sh->hash(in);
+
+    out << sodium::bin2hex(result) << '\n';
+    return 0;
+}
+
+int
+sign(const options& opts, std::istream& in, std::ostream& out)
+{
+    using signor = sodium::StreamSignorPK;
+    signor ssp(read_key(opts.key_file, signor::privkey_type(false)),
+               opts.blocksize);
+
+    out << sodium::bin2hex(ssp.sign(in)) << '\n';
+    return 0;
+}
+
+int
+verify(const options& opts, std::istream& in, std::ostream& out)
+{
+    using verifier = sodium::StreamVerifierPK;
+    const sodium::bytes pk = read_file(opts.key_file);
+    verifier svp(pk, opts.blocksize);
+
+    const bool ok = svp.verify(in, sodium::hex2bin(opts.signature));
+    out << (ok ? "OK" : "FAILED") << '\n';
+    return ok ? 0 : 1;
+}
+
+int
+calibrate(const options& opts)
+{
+    if (!opts.args.empty())
+        usage();
+
+    const sodium::blocksize::calibration result =
+      sodium::blocksize::calibrate();
+    for (const auto& m : result.measurements)
+        std::cout << m.blocksize << '\t' << m.bytes_per_second / 1e6
+                  << " MB/s" << (m.blocksize == result.best ? "\t<-" : "")
+                  << '\n';
+    return 0;
+}
+
+// ---- --stats ---------------------------------------------------------
+
+double
+cpu_seconds()
+{
+#ifdef _WIN32
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           static_cast<double>(usage.ru_utime.tv_usec +
+                               usage.ru_stime.tv_usec) /
+             1e6;
+#endif // _WIN32
+}
+
+void
+print_stats(std::uint64_t nbytes,
+            double seconds,
+            double cpu,
+            std::size_t allocations)
+{
+    const double mb = static_cast<double>(nbytes) / 1e6;
+    std::fprintf(stderr,
+                 "bytes in:     %llu\n"
+                 "wall time:    %.3f s\n"
+                 "throughput:   %.1f MB/s\n"
+                 "cpu time:     %.3f s (%.0f%% of one core)\n"
+                 "heap allocs:  %zu\n",
+                 static_cast<unsigned long long>(nbytes),
+                 seconds,
+                 seconds > 0 ? mb / seconds : 0.0,
+                 cpu,
+                 seconds > 0 ? 100.0 * cpu / seconds : 0.0,
+                 allocations);
+#if SODIUM_TRACE_LEVEL >= 1
+    std::fprintf(
+      stderr,
+      "protected allocs: %llu\n",
+      static_cast<unsigned long long>(
+        sodium::trace::value("sodium::allocator::allocate()")));
+#endif // SODIUM_TRACE_LEVEL
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    if (!sodium::runtime::instance().ok()) {
+        std::cerr << "sodium-crypt: sodium_init() failed\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        const options opts = parse(argc, argv);
+        if (opts.command == "keygen")
+            return keygen(opts);
+        if (opts.command == "calibrate")
+            return calibrate(opts);
+
+        using command_type =
+          int (*)(const options&, std::istream&, std::ostream&);
+        const std::map<std::string, command_type> commands{
+            { "encrypt", encrypt }, { "decrypt", decrypt }, { "hash", hash },
+            { "sign", sign },       { "verify", verify },
+        };
+        auto command = commands.find(opts.command);
+        if (command == commands.end())
+            usage();
+
+        std::ios::sync_with_stdio(false);
+        counting_streambuf counter(std::cin.rdbuf());
+        std::istream in(&counter);
+
+        const std::size_t allocations0 = alloc_counter::allocations();
+        const double cpu0 = cpu_seconds();
+        const auto start = std::chrono::steady_clock::now();
+
+        const int rc = command->second(opts, in, std::cout);
+        std::cout.flush();
+
+        if (opts.stats)
+            print_stats(counter.count(),
+                        std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count(),
+                        cpu_seconds() - cpu0,
+                        alloc_counter::allocations() - allocations0);
+        return rc;
+    } catch (const std::exception& e) {
+        std::cerr << "sodium-crypt: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+}